@@ -0,0 +1,172 @@
+/* Measure how many user-visible actions spray performs per second:
+ * `inst`, `step` and `next` through each program, and breakpoint
+ * hits with `continue` on a function that's called in a tight loop.
+ * The `ptrace` and `process_vm_readv` calls are counted to get the
+ * cost of each action in round trips to the kernel. */
+
+#define UNIT_TESTS
+#include "debugger.h"
+#include "ptrace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+enum
+{
+  /* Each action is repeated at most this many times,
+   * or until the program exits. */
+  N_ACTIONS = 2000,
+};
+
+static const struct
+{
+  const char *filepath;
+  /* Function to `continue` to, or NULL to skip `continue`. */
+  const char *breakpoint;
+} BENCH_PROGRAMS[] = {
+  {"tests/assets/64bit-linux-simple.bin", NULL},
+  {"tests/assets/nested-functions.bin", NULL},
+  {"tests/assets/long-loop.bin", NULL},
+  {"bench/build/call-chain.bin", "chain_999"},
+};
+
+typedef struct
+{
+  bool is_ok;
+  size_t n_actions;
+  uint64_t n_syscalls;
+  double seconds;
+} ActionRun;
+
+double
+elapsed_seconds (struct timespec start, struct timespec end)
+{
+  return (double) (end.tv_sec - start.tv_sec) +
+    (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Send `stdout` to `/dev/null`, so that neither the source that's
+ * printed at each stop nor the program's output end up in the
+ * results. Returns a copy of the original `stdout`. */
+int
+silence_stdout (void)
+{
+  fflush (stdout);
+  int original = dup (STDOUT_FILENO);
+  int null_fd = open ("/dev/null", O_WRONLY);
+  dup2 (null_fd, STDOUT_FILENO);
+  close (null_fd);
+  return original;
+}
+
+void
+restore_stdout (int original)
+{
+  fflush (stdout);
+  dup2 (original, STDOUT_FILENO);
+  close (original);
+}
+
+/* Start `filepath` and run `command` over and over until it ran
+ * `N_ACTIONS` times or the program exited. If `breakpoint` isn't
+ * NULL, a breakpoint is set on that function first. */
+ActionRun
+run_action (const char *filepath, const char *command,
+	    const char *breakpoint)
+{
+  char *argv[] = { (char *) filepath, NULL };
+  Debugger dbg;
+  if (setup_debugger (filepath, argv, &dbg) == -1)
+    {
+      return (ActionRun) {.is_ok = false };
+    }
+
+  if (start_debugging (&dbg) == SP_ERR)
+    {
+      kill (dbg.pid, SIGKILL);
+      waitpid (dbg.pid, NULL, 0);
+      del_debugger (dbg);
+      return (ActionRun) {.is_ok = false };
+    }
+
+  if (breakpoint != NULL)
+    {
+      char break_command[REPL_LINE_BUF_SIZE];
+      snprintf (break_command, REPL_LINE_BUF_SIZE, "break %s", breakpoint);
+      handle_debug_command (&dbg, break_command);
+    }
+
+  ActionRun run = {.is_ok = true };
+  uint64_t start_syscalls = pt_n_syscalls ();
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  while (run.n_actions < N_ACTIONS && is_tracee_alive (&dbg))
+    {
+      handle_debug_command (&dbg, command);
+      run.n_actions++;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  run.seconds = elapsed_seconds (start, end);
+  run.n_syscalls = pt_n_syscalls () - start_syscalls;
+
+  if (is_tracee_alive (&dbg))
+    {
+      kill (dbg.pid, SIGKILL);
+      waitpid (dbg.pid, NULL, 0);
+    }
+  del_debugger (dbg);
+
+  return run;
+}
+
+int
+main (void)
+{
+  static const char *actions[] = { "inst", "step", "next" };
+  const size_t n_actions = sizeof (actions) / sizeof (*actions);
+  const size_t n_programs =
+    sizeof (BENCH_PROGRAMS) / sizeof (*BENCH_PROGRAMS);
+
+  printf ("%-38s %10s %10s %10s %12s %16s\n", "program", "action",
+	  "actions", "seconds", "actions/s", "syscalls/action");
+
+  for (size_t i = 0; i < n_programs; i++)
+    {
+      const char *filepath = BENCH_PROGRAMS[i].filepath;
+      const char *breakpoint = BENCH_PROGRAMS[i].breakpoint;
+
+      /* `continue` is run last, after the actions that step. */
+      for (size_t j = 0; j <= n_actions; j++)
+	{
+	  bool is_continue = j == n_actions;
+	  if (is_continue && breakpoint == NULL)
+	    {
+	      break;
+	    }
+	  const char *action = is_continue ? "continue" : actions[j];
+
+	  int original_stdout = silence_stdout ();
+	  ActionRun run = run_action (filepath, action,
+				      is_continue ? breakpoint : NULL);
+	  restore_stdout (original_stdout);
+
+	  if (!run.is_ok || run.n_actions == 0)
+	    {
+	      fprintf (stderr, "Failed to run %s on %s\n", action, filepath);
+	      return EXIT_FAILURE;
+	    }
+
+	  printf ("%-38s %10s %10zu %10.4f %12.0f %16.2f\n", filepath,
+		  action, run.n_actions, run.seconds,
+		  run.n_actions / run.seconds,
+		  (double) run.n_syscalls / run.n_actions);
+	}
+    }
+
+  return EXIT_SUCCESS;
+}
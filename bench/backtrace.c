@@ -0,0 +1,137 @@
+/* Measure how long it takes to unwind a deep call stack. The
+ * tracee recurses 10000 times before it hits a breakpoint. The
+ * stack is unwound both with and without a stack snapshot. */
+
+#include "backtrace.h"
+#include "debugger.h"
+#include "ptrace.h"
+#include "registers.h"
+#include "stack.h"
+
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+enum
+{
+  N_RUNS = 20,
+};
+
+static const char *BENCH_PROGRAM = "tests/assets/deep-recursion.bin";
+
+double
+elapsed_seconds (struct timespec start, struct timespec end)
+{
+  return (double) (end.tv_sec - start.tv_sec) +
+    (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Run the tracee until it reaches the function `bottom`. */
+SprayResult
+run_to_bottom (Debugger *dbg)
+{
+  const DebugSymbol *bottom = sym_by_name ("bottom", dbg->info);
+  dbg_addr bottom_addr = { 0 };
+  if (function_start_addr (bottom, dbg->info, &bottom_addr) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  real_addr addr = dbg_to_real (dbg->load_address, bottom_addr);
+  if (enable_breakpoint (dbg->breakpoints, addr) == SP_ERR
+      || pt_continue_execution (dbg->pid) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  int wait_status = 0;
+  waitpid (dbg->pid, &wait_status, 0);
+  if (!WIFSTOPPED (wait_status) || WSTOPSIG (wait_status) != SIGTRAP)
+    {
+      return SP_ERR;
+    }
+
+  /* Go back to the address of the breakpoint. */
+  return set_register_value (dbg->pid, rip, addr.value);
+}
+
+/* Unwind the stack `N_RUNS` times and return the
+ * average duration. `n_frames` is set to the depth. */
+double
+time_backtrace (Debugger *dbg, bool use_snapshot, size_t *n_frames)
+{
+  uint64_t pc = 0;
+  uint64_t stack_pointer = 0;
+  get_register_value (dbg->pid, rip, &pc);
+  get_register_value (dbg->pid, rsp, &stack_pointer);
+
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < N_RUNS; i++)
+    {
+      StackSnapshot *stack = NULL;
+      if (use_snapshot)
+	{
+	  stack = init_stack_snapshot (dbg->pid,
+				       (real_addr) {stack_pointer},
+				       DEFAULT_STACK_CAP);
+	}
+
+      CallFrame *frames =
+	init_backtrace (real_to_dbg (dbg->load_address, (real_addr) {pc}),
+			dbg->load_address, stack, dbg->pid, dbg->info);
+
+      *n_frames = 0;
+      for (const CallFrame *frame = frames; frame != NULL;
+	   frame = frame_caller (frame))
+	{
+	  (*n_frames)++;
+	}
+
+      free_backtrace (frames);
+      free_stack_snapshot (stack);
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+
+  return elapsed_seconds (start, end) / N_RUNS;
+}
+
+int
+main (void)
+{
+  char *argv[] = { (char *) BENCH_PROGRAM, NULL };
+  Debugger dbg;
+  if (setup_debugger (BENCH_PROGRAM, argv, &dbg) == -1)
+    {
+      fprintf (stderr, "Failed to start %s\n", BENCH_PROGRAM);
+      return EXIT_FAILURE;
+    }
+
+  if (run_to_bottom (&dbg) == SP_ERR)
+    {
+      fprintf (stderr, "Failed to run %s to `bottom`\n", BENCH_PROGRAM);
+      kill (dbg.pid, SIGKILL);
+      del_debugger (dbg);
+      return EXIT_FAILURE;
+    }
+
+  printf ("%-38s %12s %12s %12s\n", "program", "mode", "frames",
+	  "ms/backtrace");
+
+  size_t n_frames = 0;
+  double peek_seconds = time_backtrace (&dbg, false, &n_frames);
+  printf ("%-38s %12s %12zu %12.3f\n", BENCH_PROGRAM, "peekdata",
+	  n_frames, peek_seconds * 1e3);
+
+  double snapshot_seconds = time_backtrace (&dbg, true, &n_frames);
+  printf ("%-38s %12s %12zu %12.3f\n", BENCH_PROGRAM, "snapshot",
+	  n_frames, snapshot_seconds * 1e3);
+
+  kill (dbg.pid, SIGKILL);
+  waitpid (dbg.pid, NULL, 0);
+  del_debugger (dbg);
+
+  return EXIT_SUCCESS;
+}
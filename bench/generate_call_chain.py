@@ -0,0 +1,26 @@
+"""Generate a C program whose `main` calls a chain of functions in a
+tight loop. Function `chain_<i>` calls `chain_<i + 1>`, and the last
+one, `chain_<DEPTH - 1>`, returns right away.
+
+Usage: python generate_call_chain.py > call-chain.c
+"""
+
+DEPTH = 1000
+N_CALLS = 1000
+
+
+def main():
+    print('/* Generated by bench/generate_call_chain.py. */')
+    # Functions are defined before they are called.
+    print(f'int\nchain_{DEPTH - 1} (int n)\n{{\n  return n + 1;\n}}\n')
+    for i in reversed(range(DEPTH - 1)):
+        print(f'int\nchain_{i} (int n)\n{{\n'
+              f'  return chain_{i + 1} (n) + 1;\n}}\n')
+    print('int\nmain (void)\n{\n  int sum = 0;\n'
+          f'  for (int i = 0; i < {N_CALLS}; i++)\n'
+          '    sum += chain_0 (i);\n'
+          '  return sum == 0;\n}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,69 @@
+"""Generate the sources of a C program with many compilation units.
+
+Usage: python generate_program.py <directory> <units> <functions per unit>
+
+Unit `u` is `unit_<u>.c` and defines the functions `unit_<u>_func_<f>`.
+Function `f` starts on line `4 + 7 * f`, and its first statement, which
+declares the variable `local`, is on line `7 + 7 * f`. `bench/lookups.c`
+relies on this layout.
+"""
+
+import os
+import sys
+
+
+def unit_source(unit: int, n_functions: int) -> str:
+    lines = ['/* Generated by bench/generate_program.py. */',
+             f'int unit_{unit}_global = {unit};',
+             '']
+    for function in range(n_functions):
+        lines += ['int',
+                  f'unit_{unit}_func_{function} (int arg)',
+                  '{',
+                  f'  int local = arg + unit_{unit}_global;',
+                  f'  return local * {function};',
+                  '}',
+                  '']
+    return '\n'.join(lines)
+
+
+MAIN_SOURCE = """\
+/* Generated by bench/generate_program.py. */
+int unit_0_func_0 (int arg);
+
+int
+main (void)
+{
+  return unit_0_func_0 (0);
+}
+"""
+
+
+def write_if_changed(filepath: str, source: str):
+    # Unchanged files keep their timestamps, so make doesn't rebuild them.
+    if os.path.exists(filepath):
+        with open(filepath) as file:
+            if file.read() == source:
+                return
+    with open(filepath, 'w') as file:
+        file.write(source)
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__, file=sys.stderr)
+        sys.exit(1)
+
+    directory = sys.argv[1]
+    n_units = int(sys.argv[2])
+    n_functions = int(sys.argv[3])
+
+    os.makedirs(directory, exist_ok=True)
+    write_if_changed(os.path.join(directory, 'main.c'), MAIN_SOURCE)
+    for unit in range(n_units):
+        write_if_changed(os.path.join(directory, f'unit_{unit}.c'),
+                         unit_source(unit, n_functions))
+
+
+if __name__ == '__main__':
+    main()
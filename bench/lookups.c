@@ -0,0 +1,387 @@
+/* Measure how long it takes to load the debug information and to
+ * look things up in it as the number of compilation units grows.
+ * The programs are generated by `bench/generate_program.py`, and
+ * every unit has `FUNCTIONS_PER_UNIT` functions. The results are
+ * printed as JSON with one result per line in a fixed order, so
+ * that the output of two commits can be compared line by line. */
+
+#include "info.h"
+#include "json.h"
+#include "spray_dwarf.h"
+#include "spray_elf.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+enum
+{
+  /* Must match the Makefile. */
+  FUNCTIONS_PER_UNIT = 10,
+  /* Number of functions that are looked up in each program.
+   * They are spread over all units. */
+  N_QUERIES = 50,
+  /* Number of times the debug information is loaded. */
+  N_INIT_RUNS = 3,
+  NAME_BUF_SIZE = 64,
+  FILEPATH_BUF_SIZE = 256,
+};
+
+/* Directories of the generated programs. The executable is next
+ * to its directory, with `.bin` appended. */
+static const struct
+{
+  const char *name;
+  size_t n_units;
+} BENCH_PROGRAMS[] = {
+  {"units-10", 10},
+  {"units-1000", 1000},
+  {"units-10000", 10000},
+};
+
+static const char *BENCH_BUILD_DIR = "bench/build";
+
+typedef struct
+{
+  size_t n_units;
+  char dir[FILEPATH_BUF_SIZE];
+  ElfFile elf;
+  Dwarf_Debug dbg;
+  DebugInfo *info;
+  /* Results of earlier lookups that later lookups start from. */
+  dbg_addr sym_starts[N_QUERIES];
+  dbg_addr func_starts[N_QUERIES];
+} Program;
+
+double
+elapsed_seconds (struct timespec start, struct timespec end)
+{
+  return (double) (end.tv_sec - start.tv_sec) +
+    (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Get the unit and the function in it that `query` looks up. */
+void
+query_target (const Program *prog, size_t query, size_t *unit,
+	      size_t *function)
+{
+  *unit = query * prog->n_units / N_QUERIES;
+  *function = query % FUNCTIONS_PER_UNIT;
+}
+
+void
+query_func_name (const Program *prog, size_t query, char *name)
+{
+  size_t unit = 0;
+  size_t function = 0;
+  query_target (prog, query, &unit, &function);
+  snprintf (name, NAME_BUF_SIZE, "unit_%zu_func_%zu", unit, function);
+}
+
+typedef bool (*Lookup) (Program * prog, size_t query);
+
+bool
+lookup__symbol_from_name (Program *prog, size_t query)
+{
+  char name[NAME_BUF_SIZE];
+  query_func_name (prog, query, name);
+
+  const Elf64_Sym *sym = se_symbol_from_name (name, &prog->elf);
+  if (sym == NULL)
+    {
+      return false;
+    }
+
+  prog->sym_starts[query] = se_symbol_start_addr (sym);
+  return true;
+}
+
+bool
+lookup__symbol_from_addr (Program *prog, size_t query)
+{
+  /* Look up an address inside of the function. */
+  dbg_addr addr = { prog->sym_starts[query].value + 1 };
+  return se_symbol_from_addr (addr, &prog->elf) != NULL;
+}
+
+bool
+lookup__function_start_addr (Program *prog, size_t query)
+{
+  char name[NAME_BUF_SIZE];
+  query_func_name (prog, query, name);
+
+  const DebugSymbol *sym = sym_by_name (name, prog->info);
+  return function_start_addr (sym, prog->info, &prog->func_starts[query])
+    == SP_OK;
+}
+
+bool
+lookup__line_entry_from_pc (Program *prog, size_t query)
+{
+  return sd_line_entry_from_pc (prog->dbg, prog->func_starts[query]).is_ok;
+}
+
+bool
+lookup__line_entry_at (Program *prog, size_t query)
+{
+  size_t unit = 0;
+  size_t function = 0;
+  query_target (prog, query, &unit, &function);
+
+  /* The first statement of the function. */
+  char filepath[FILEPATH_BUF_SIZE];
+  snprintf (filepath, FILEPATH_BUF_SIZE, "%s/unit_%zu.c", prog->dir, unit);
+  unsigned lineno = 7 + 7 * function;
+
+  LineEntry line = sd_line_entry_at (prog->dbg, filepath, lineno);
+  return line.is_ok && line.ln == lineno;
+}
+
+bool
+lookup__runtime_variable (Program *prog, size_t query)
+{
+  SdVarattr attr = { 0 };
+  char *decl_file = NULL;
+  unsigned decl_line = 0;
+  if (sd_runtime_variable (prog->dbg, prog->func_starts[query], "local",
+			   &attr, &decl_file, &decl_line) == SP_ERR)
+    {
+      return false;
+    }
+
+  del_type (&attr.type);
+  free (decl_file);
+  return true;
+}
+
+/* Print a result as one line of the JSON array of results. */
+void
+print_result (const char *prog_name, const Program *prog,
+	      const char *lookup, size_t n_runs, size_t n_failed,
+	      double seconds, bool is_last)
+{
+  printf ("  {\"program\": ");
+  print_json_string (stdout, prog_name);
+  printf (", \"units\": %zu, \"functions\": %zu, \"lookup\": ",
+	  prog->n_units, prog->n_units * FUNCTIONS_PER_UNIT);
+  print_json_string (stdout, lookup);
+  printf (", \"runs\": %zu, \"failed\": %zu, \"us_per_run\": %.3f}%s\n",
+	  n_runs, n_failed, seconds / n_runs * 1e6, is_last ? "" : ",");
+}
+
+/* Run `lookup` for every query and print how long it took. */
+void
+time_lookup (const char *prog_name, Program *prog, const char *name,
+	     Lookup lookup, bool is_last)
+{
+  size_t n_failed = 0;
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  for (size_t query = 0; query < N_QUERIES; query++)
+    {
+      if (!lookup (prog, query))
+	{
+	  n_failed++;
+	}
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  print_result (prog_name, prog, name, N_QUERIES, n_failed,
+		elapsed_seconds (start, end), is_last);
+}
+
+SprayResult
+callback__count_row (LineEntry *line, void *const data)
+{
+  unused (line);
+  (*(size_t *) data)++;
+  return SP_OK;
+}
+
+SprayResult
+callback__count_function (const SdFunction *func, void *const data)
+{
+  unused (func);
+  (*(size_t *) data)++;
+  return SP_OK;
+}
+
+/* Decode the line tables of all units with libdwarf and then with
+ * the native decoder and print how long each of them took. */
+SprayResult
+time_line_tables (const char *prog_name, Program *prog, bool is_last)
+{
+  static const char *names[] = {
+    "line_tables_libdwarf",
+    "line_tables_native",
+  };
+  size_t n_rows[2] = { 0 };
+
+  for (size_t i = 0; i < 2; i++)
+    {
+      if (i == 1 && sd_set_sections (prog->dbg, &prog->elf) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+
+      struct timespec start, end;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      SprayResult res = sd_for_each_row (prog->dbg, callback__count_row,
+					 &n_rows[i]);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      print_result (prog_name, prog, names[i], 1, res == SP_ERR,
+		    elapsed_seconds (start, end), is_last && i == 1);
+    }
+
+  sd_clear_sections (prog->dbg);
+  return n_rows[0] == n_rows[1] ? SP_OK : SP_ERR;
+}
+
+/* Find all functions by searching the DIEs with libdwarf and then
+ * by scanning them natively and print how long each of them took. */
+SprayResult
+time_functions (const char *prog_name, Program *prog, bool is_last)
+{
+  static const char *names[] = {
+    "functions_libdwarf",
+    "functions_native",
+  };
+  size_t n_funcs[2] = { 0 };
+
+  for (size_t i = 0; i < 2; i++)
+    {
+      if (i == 1 && sd_set_sections (prog->dbg, &prog->elf) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+
+      struct timespec start, end;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      SprayResult res = sd_for_each_function (prog->dbg,
+					      callback__count_function,
+					      &n_funcs[i]);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      print_result (prog_name, prog, names[i], 1, res == SP_ERR,
+		    elapsed_seconds (start, end), is_last && i == 1);
+    }
+
+  sd_clear_sections (prog->dbg);
+  return n_funcs[0] == n_funcs[1] ? SP_OK : SP_ERR;
+}
+
+/* Load all parts of the debug information `N_INIT_RUNS` times and
+ * print how long it took. The last instance is kept in `prog`. */
+SprayResult
+time_init_debug_info (const char *prog_name, const char *filepath,
+		      Program *prog)
+{
+  double seconds = 0;
+  for (size_t run = 0; run < N_INIT_RUNS; run++)
+    {
+      free_debug_info (&prog->info);
+
+      struct timespec start, end;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      prog->info = init_debug_info (filepath);
+      if (prog->info == NULL
+	  || await_debug_info (prog->info, INFO_UNWIND) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      seconds += elapsed_seconds (start, end);
+    }
+
+  print_result (prog_name, prog, "init_debug_info", N_INIT_RUNS, 0,
+		seconds, false);
+  return SP_OK;
+}
+
+SprayResult
+bench_program (const char *name, size_t n_units, bool is_last)
+{
+  Program prog = {.n_units = n_units };
+  snprintf (prog.dir, FILEPATH_BUF_SIZE, "%s/%s", BENCH_BUILD_DIR, name);
+  char filepath[FILEPATH_BUF_SIZE];
+  snprintf (filepath, FILEPATH_BUF_SIZE, "%s.bin", prog.dir);
+
+  if (time_init_debug_info (name, filepath, &prog) == SP_ERR)
+    {
+      fprintf (stderr, "Failed to load the debug information of %s\n",
+	       filepath);
+      free_debug_info (&prog.info);
+      return SP_ERR;
+    }
+
+  Dwarf_Error error = NULL;
+  prog.dbg = sd_dwarf_init (filepath, &error);
+  if (prog.dbg == NULL
+      || se_parse_elf (filepath, &prog.elf) != ELF_PARSE_OK)
+    {
+      fprintf (stderr, "Failed to read %s\n", filepath);
+      free_debug_info (&prog.info);
+      return SP_ERR;
+    }
+
+  /* Lookups that set `sym_starts` and `func_starts`
+   * must run before the lookups that read them. */
+  static const struct
+  {
+    const char *name;
+    Lookup lookup;
+  } lookups[] = {
+    {"se_symbol_from_name", lookup__symbol_from_name},
+    {"se_symbol_from_addr", lookup__symbol_from_addr},
+    {"function_start_addr", lookup__function_start_addr},
+    {"sd_line_entry_from_pc", lookup__line_entry_from_pc},
+    {"sd_line_entry_at", lookup__line_entry_at},
+    {"sd_runtime_variable", lookup__runtime_variable},
+  };
+  const size_t n_lookups = sizeof (lookups) / sizeof (*lookups);
+
+  for (size_t i = 0; i < n_lookups; i++)
+    {
+      time_lookup (name, &prog, lookups[i].name, lookups[i].lookup, false);
+    }
+
+  SprayResult res = time_line_tables (name, &prog, false);
+  if (res == SP_ERR)
+    {
+      fprintf (stderr, "Failed to compare the line tables of %s\n",
+	       filepath);
+    }
+  else if ((res = time_functions (name, &prog, is_last)) == SP_ERR)
+    {
+      fprintf (stderr, "Failed to compare the functions of %s\n",
+	       filepath);
+    }
+
+  dwarf_finish (prog.dbg);
+  se_free_elf (prog.elf);
+  free_debug_info (&prog.info);
+  return res;
+}
+
+int
+main (void)
+{
+  const size_t n_programs =
+    sizeof (BENCH_PROGRAMS) / sizeof (*BENCH_PROGRAMS);
+
+  printf ("{\"benchmark\": \"lookups\", \"queries\": %d, \"results\": [\n",
+	  N_QUERIES);
+  for (size_t i = 0; i < n_programs; i++)
+    {
+      if (bench_program (BENCH_PROGRAMS[i].name, BENCH_PROGRAMS[i].n_units,
+			 i + 1 == n_programs) == SP_ERR)
+	{
+	  return EXIT_FAILURE;
+	}
+    }
+  printf ("]}\n");
+
+  return EXIT_SUCCESS;
+}
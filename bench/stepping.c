@@ -0,0 +1,137 @@
+/* Compare how fast the tracee can be advanced instruction by
+ * instruction (`PTRACE_SINGLESTEP`) and branch by branch
+ * (`PTRACE_SINGLEBLOCK`). Each program in `tests/assets` is
+ * run from start to end in both modes. */
+
+#include "ptrace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/personality.h>
+#include <sys/wait.h>
+
+typedef enum
+{
+  STEP_INSTRUCTION,
+  STEP_BLOCK,
+} StepMode;
+
+typedef struct
+{
+  bool is_ok;
+  uint64_t n_stops;
+  double seconds;
+} StepRun;
+
+static const char *BENCH_PROGRAMS[] = {
+  "tests/assets/64bit-linux-simple.bin",
+  "tests/assets/nested-functions.bin",
+  "tests/assets/long-loop.bin",
+  NULL,
+};
+
+double
+elapsed_seconds (struct timespec start, struct timespec end)
+{
+  return (double) (end.tv_sec - start.tv_sec) +
+    (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+StepRun
+run_stepping (const char *prog, StepMode mode)
+{
+  pid_t pid = fork ();
+  if (pid == -1)
+    {
+      return (StepRun) {.is_ok = false };
+    }
+  else if (pid == 0)
+    {
+      /* Keep the program's output out of the results. */
+      int null_fd = open ("/dev/null", O_WRONLY);
+      dup2 (null_fd, STDOUT_FILENO);
+
+      personality (ADDR_NO_RANDOMIZE);
+      pt_trace_me ();
+
+      char *argv[] = { (char *) prog, NULL };
+      execv (prog, argv);
+      exit (EXIT_FAILURE);
+    }
+
+  int wait_status = 0;
+  waitpid (pid, &wait_status, 0);
+  if (!WIFSTOPPED (wait_status))
+    {
+      return (StepRun) {.is_ok = false };
+    }
+
+  StepRun run = {.is_ok = true };
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  while (true)
+    {
+      SprayResult res = mode == STEP_BLOCK ?
+	pt_single_block (pid) : pt_single_step (pid);
+      if (res == SP_ERR)
+	{
+	  kill (pid, SIGKILL);
+	  waitpid (pid, NULL, 0);
+	  return (StepRun) {.is_ok = false };
+	}
+
+      waitpid (pid, &wait_status, 0);
+      if (WIFEXITED (wait_status) || WIFSIGNALED (wait_status))
+	{
+	  break;
+	}
+      run.n_stops++;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  run.seconds = elapsed_seconds (start, end);
+
+  return run;
+}
+
+int
+main (void)
+{
+  printf ("%-38s %12s %12s %10s %16s\n",
+	  "program", "mode", "stops", "seconds", "instructions/s");
+
+  for (size_t i = 0; BENCH_PROGRAMS[i] != NULL; i++)
+    {
+      const char *prog = BENCH_PROGRAMS[i];
+
+      StepRun single = run_stepping (prog, STEP_INSTRUCTION);
+      if (!single.is_ok)
+	{
+	  fprintf (stderr, "Failed to step through %s\n", prog);
+	  return EXIT_FAILURE;
+	}
+
+      /* Every stop in single-step mode is one instruction. */
+      uint64_t n_instructions = single.n_stops;
+      printf ("%-38s %12s %12lu %10.4f %16.0f\n",
+	      prog, "singlestep", single.n_stops, single.seconds,
+	      n_instructions / single.seconds);
+
+      StepRun block = run_stepping (prog, STEP_BLOCK);
+      if (!block.is_ok)
+	{
+	  printf ("%-38s %12s %12s\n", prog, "singleblock", "unsupported");
+	  continue;
+	}
+
+      printf ("%-38s %12s %12lu %10.4f %16.0f\n",
+	      prog, "singleblock", block.n_stops, block.seconds,
+	      n_instructions / block.seconds);
+    }
+
+  return EXIT_SUCCESS;
+}
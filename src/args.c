@@ -13,11 +13,45 @@ print_help_message (const char *me)
     }
 
   fprintf (stderr,
-	   "usage: %s [-c | --no-color] file [arg1 ...]\n"
+	   "usage: %s [-c | --no-color] [--coverage <out>] [--stack-cap <KiB>]\n"
+	   "       [-p <pid>] [--core <core>] [-x <script> [--json]] [--dap]\n"
+	   "       [--gdbserver <address>] [--startup-timings] [--stats]\n"
+	   "       [--trace-internal <out>] [--no-block-step]\n"
+	   "       file [arg1 ...]\n"
+	   "       %s symbolize file [--inlines] < addresses\n"
 	   "\n"
-	   "  file            The name of the executable file to debug\n"
-	   "  arg1 ...        Arguments passed to the executable to debug\n"
-	   "  -c, --no-color  Disable colored output\n"
+	   "  file              The name of the executable file to debug\n"
+	   "  arg1 ...          Arguments passed to the executable to debug\n"
+	   "  -p <pid>          Attach to the running process <pid> instead\n"
+	   "                    of starting file. file is optional then\n"
+	   "  --core <core>     Inspect the core dump <core> that was\n"
+	   "                    created by file instead of running it\n"
+	   "  -c, --no-color    Disable colored output\n"
+	   "  --coverage <out>  Run the executable without the REPL and\n"
+	   "                    write its line coverage to <out> (lcov)\n"
+	   "  --stack-cap <KiB> Copy at most <KiB> KiB of the stack at\n"
+	   "                    each stop (default 8192)\n"
+	   "  -x <script>       Run the commands in <script> instead of\n"
+	   "                    reading them from the terminal\n"
+	   "  --json            Print one JSON object per command and\n"
+	   "                    per stop of the executable. Needs -x\n"
+	   "  --dap             Talk to an editor over the Debug Adapter\n"
+	   "                    Protocol on stdin and stdout\n"
+	   "  --gdbserver <address>\n"
+	   "                    Serve GDB's remote protocol on <address>,\n"
+	   "                    which is :<port> or a unix socket path\n"
+	   "  --startup-timings Print how long each phase of the startup\n"
+	   "                    took to stderr\n"
+	   "  --stats           Print the internal counters and the time\n"
+	   "                    spent in each command to stderr at exit\n"
+	   "  --trace-internal <out>\n"
+	   "                    Write what Spray spends its time on to\n"
+	   "                    <out> as Chrome trace events at exit\n"
+	   "  --no-block-step   Step instruction by instruction, even\n"
+	   "                    if the kernel can step branch by branch\n"
+	   "  symbolize file    Print the function and source position of\n"
+	   "                    each address read from stdin. With\n"
+	   "                    --inlines, print all inlined calls too\n"
 	   "\n"
 	   "Spray is a simple debugger for programs written in C.\n"
 	   "For the best output, programs should be compiled using\n"
@@ -27,7 +61,7 @@ print_help_message (const char *me)
 	   "of how to use Spray can be found in the README.md file.\n"
 	   "\n"
 	   "spray <https://github.com/thass0/spray>\n",
-	   me);
+	   me, me);
 }
 
 const char *
@@ -43,9 +77,11 @@ prog_name_arg (int argc, char **argv)
     }
 }
 
-/* Parse a flag starting with a single dash. Returns -1 on error. */
+/* Parse a flag starting with a single dash. `value` is the argument
+ * following the flag or NULL if there is none. Returns -1 on error.
+ * Otherwise, the number of values that the flag consumed is returned. */
 int
-parse_short_flag (const char *flag, Flags *flags)
+parse_short_flag (const char *flag, char *value, Flags *flags)
 {
   if (flag == NULL || flags == NULL)
     {
@@ -56,6 +92,30 @@ parse_short_flag (const char *flag, Flags *flags)
     {
       flags->no_color = true;
     }
+  else if (strcmp ("-p", flag) == 0)
+    {
+      char *end = NULL;
+      if (value == NULL || value[0] == '-')
+	{
+	  return -1;
+	}
+      long pid = strtol (value, &end, 10);
+      if (*end != '\0' || pid <= 0)
+	{
+	  return -1;
+	}
+      flags->attach_pid = (pid_t) pid;
+      return 1;
+    }
+  else if (strcmp ("-x", flag) == 0)
+    {
+      if (value == NULL)
+	{
+	  return -1;
+	}
+      flags->script = value;
+      return 1;
+    }
   else
     {
       return -1;
@@ -64,9 +124,11 @@ parse_short_flag (const char *flag, Flags *flags)
   return 0;
 }
 
-/* Parse a flag starting with a double dash. Returns -1 on error. */
+/* Parse a flag starting with a double dash. `value` is the argument
+ * following the flag or NULL if there is none. Returns -1 on error.
+ * Otherwise, the number of values that the flag consumed is returned. */
 int
-parse_long_flag (const char *flag, Flags *flags)
+parse_long_flag (const char *flag, char *value, Flags *flags)
 {
   if (flag == NULL || flags == NULL)
     {
@@ -77,6 +139,81 @@ parse_long_flag (const char *flag, Flags *flags)
     {
       flags->no_color = true;
     }
+  else if (strcmp ("--json", flag) == 0)
+    {
+      /* Escape sequences for colors would end up in the strings. */
+      flags->json = true;
+      flags->no_color = true;
+    }
+  else if (strcmp ("--startup-timings", flag) == 0)
+    {
+      flags->startup_timings = true;
+    }
+  else if (strcmp ("--stats", flag) == 0)
+    {
+      flags->stats = true;
+    }
+  else if (strcmp ("--no-block-step", flag) == 0)
+    {
+      flags->no_block_step = true;
+    }
+  else if (strcmp ("--dap", flag) == 0)
+    {
+      flags->dap = true;
+      flags->no_color = true;
+    }
+  else if (strcmp ("--coverage", flag) == 0)
+    {
+      if (value == NULL)
+	{
+	  return -1;
+	}
+      flags->coverage = value;
+      return 1;
+    }
+  else if (strcmp ("--trace-internal", flag) == 0)
+    {
+      if (value == NULL)
+	{
+	  return -1;
+	}
+      flags->trace_internal = value;
+      return 1;
+    }
+  else if (strcmp ("--gdbserver", flag) == 0)
+    {
+      if (value == NULL)
+	{
+	  return -1;
+	}
+      flags->gdbserver = value;
+      flags->no_color = true;
+      return 1;
+    }
+  else if (strcmp ("--core", flag) == 0)
+    {
+      if (value == NULL)
+	{
+	  return -1;
+	}
+      flags->core = value;
+      return 1;
+    }
+  else if (strcmp ("--stack-cap", flag) == 0)
+    {
+      char *end = NULL;
+      if (value == NULL || value[0] == '-')
+	{
+	  return -1;
+	}
+      unsigned long kib = strtoul (value, &end, 10);
+      if (*end != '\0' || kib == 0)
+	{
+	  return -1;
+	}
+      flags->stack_cap = kib * 1024;
+      return 1;
+    }
   else
     {
       return -1;
@@ -87,7 +224,8 @@ parse_long_flag (const char *flag, Flags *flags)
 
 /* Parse all flags in the command line arguments. Flags start with
  * either (1) a single dash followed by a single character or (2) a
- * double dash followed by a string. Parsing stops once one of the
+ * double dash followed by a string. Flags of kind (2) may consume
+ * the argument following them as their value. Parsing stops once one of the
  * given arguments doesn't fulfill either (1) or (2).
  * -1 is returned if the arguments contain invalid flags or the arguments
  * to this function are invalid. On success the number of arguments that
@@ -109,11 +247,13 @@ parse_flags (int argc, char **argv, Flags *flags)
     {
       if (strncmp (argv[i], "--", 2) == 0)
 	{
-	  res = parse_long_flag (argv[i], &flags_buf);
+	  char *value = i + 1 < argc ? argv[i + 1] : NULL;
+	  res = parse_long_flag (argv[i], value, &flags_buf);
 	}
       else if (strncmp (argv[i], "-", 1) == 0)
 	{
-	  res = parse_short_flag (argv[i], &flags_buf);
+	  char *value = i + 1 < argc ? argv[i + 1] : NULL;
+	  res = parse_short_flag (argv[i], value, &flags_buf);
 	}
       else
 	{
@@ -126,11 +266,47 @@ parse_flags (int argc, char **argv, Flags *flags)
 	{
 	  return -1;
 	}
+
+      /* Skip the values consumed by the flag. */
+      i += res;
     }
 
-  if (i == argc)
+  if (i == argc && flags_buf.attach_pid == 0)
     {
-      /* There must be more arguments than just flags. */
+      /* There must be more arguments than just flags,
+       * unless spray attaches to a running process. */
+      return -1;
+    }
+
+  if (flags_buf.core != NULL
+      && (i == argc || flags_buf.attach_pid != 0
+	  || flags_buf.coverage != NULL))
+    {
+      /* A core dump needs the executable, and there is no process. */
+      return -1;
+    }
+
+  if ((flags_buf.json && flags_buf.script == NULL)
+      || (flags_buf.script != NULL && flags_buf.coverage != NULL))
+    {
+      /* Only the output of scripts is written as JSON, and
+       * there are no commands when coverage is recorded. */
+      return -1;
+    }
+
+  if (flags_buf.dap
+      && (flags_buf.script != NULL || flags_buf.coverage != NULL))
+    {
+      /* Commands come from the editor then. */
+      return -1;
+    }
+
+  if (flags_buf.gdbserver != NULL
+      && (flags_buf.script != NULL || flags_buf.coverage != NULL
+	  || flags_buf.dap || flags_buf.core != NULL))
+    {
+      /* Commands come from the client, and it
+       * might want to change a running process. */
       return -1;
     }
 
@@ -155,7 +331,7 @@ parse_args (int argc, char **argv, Args *args)
   else
     {
       int file_idx = flags_res;
-      args->file = argv[file_idx];
+      args->file = file_idx < argc ? argv[file_idx] : NULL;
 
       /* Are there any arguments that should be
        * passed to the debugged executable?  */
@@ -178,11 +354,32 @@ set_args (const Args *args)
 {
   assert (args != NULL);
 
+  free (GLOBAL_ARGS.flags.coverage);
+  free (GLOBAL_ARGS.flags.core);
+  free (GLOBAL_ARGS.flags.script);
+  free (GLOBAL_ARGS.flags.trace_internal);
   GLOBAL_ARGS.flags = args->flags;
+  if (args->flags.coverage != NULL)
+    {
+      GLOBAL_ARGS.flags.coverage = strdup (args->flags.coverage);
+    }
+  if (args->flags.core != NULL)
+    {
+      GLOBAL_ARGS.flags.core = strdup (args->flags.core);
+    }
+  if (args->flags.script != NULL)
+    {
+      GLOBAL_ARGS.flags.script = strdup (args->flags.script);
+    }
+  if (args->flags.trace_internal != NULL)
+    {
+      GLOBAL_ARGS.flags.trace_internal =
+	strdup (args->flags.trace_internal);
+    }
 
   /* Replace the filepath to the executable. */
   free (GLOBAL_ARGS.file);
-  GLOBAL_ARGS.file = strdup (args->file);
+  GLOBAL_ARGS.file = args->file != NULL ? strdup (args->file) : NULL;
 
   /* Replace the `args` array. */
   for (size_t i = 0; i < GLOBAL_ARGS.n_args; i++)
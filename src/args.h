@@ -7,16 +7,29 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 typedef struct
 {
   bool no_color;		/* -c, --no-color */
+  char *coverage;		/* --coverage <file> */
+  size_t stack_cap;		/* --stack-cap <KiB>, 0 if unset */
+  pid_t attach_pid;		/* -p <pid>, 0 if unset */
+  char *core;			/* --core <core> */
+  char *script;			/* -x <script> */
+  bool json;			/* --json */
+  bool dap;			/* --dap */
+  char *gdbserver;		/* --gdbserver <address> */
+  bool startup_timings;		/* --startup-timings */
+  bool stats;			/* --stats */
+  bool no_block_step;		/* --no-block-step */
+  char *trace_internal;		/* --trace-internal <out> */
 } Flags;
 
 typedef struct
 {
   Flags flags;
-  char *file;			/* file */
+  char *file;			/* file, NULL if attaching without it */
   char **args;			/* arg1 ... */
   size_t n_args;
 } Args;
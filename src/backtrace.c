@@ -3,14 +3,21 @@
 #include "magic.h"
 #include "ptrace.h"
 #include "registers.h"
+#include "unwind.h"
 
 #include <assert.h>
 #include <stdio.h>
 
+enum
+{
+  /* Stop unwinding after this many frames. Each frame is above the
+   * last one on the stack, so this only bounds the memory used. */
+  BACKTRACE_MAX_DEPTH = 1 << 20,
+};
+
 typedef struct
 {
   dbg_addr pc;
-  real_addr frame_pointer;
   struct
   {
     /* If `has_lineno` is false, `lineno` is meaningless.
@@ -25,11 +32,11 @@ struct CallFrame
 {
   CallFrame *caller;
   CallLocation location;
+  FrameRegs regs;		/* Registers in this frame. */
 };
 
 CallFrame *
-init_call_frame (CallFrame *caller, dbg_addr pc,
-		 real_addr frame_pointer, DebugInfo *info)
+init_call_frame (dbg_addr pc, DebugInfo *info)
 {
   const DebugSymbol *func_sym = sym_by_addr (pc, info);
 
@@ -55,9 +62,8 @@ init_call_frame (CallFrame *caller, dbg_addr pc,
       frame->location.has_lineno = false;
     }
 
-  frame->caller = caller;
+  frame->caller = NULL;
   frame->location.pc = pc;
-  frame->location.frame_pointer = frame_pointer;
   frame->location.function = func_name;
 
   return frame;
@@ -99,26 +105,29 @@ stores_frame_pointer (dbg_addr pc, real_addr load_address,
   return inst_bytes == 0xe5894855;
 }
 
-/* NOTE: The following is a naive approach to getting a backtrace
- * which relies on the compiler emitting a frame pointer.
- * Try compiling again with `-fno-omit-frame-pointer` if
- * this doesn't work. */
+/* NOTE: Frames of functions that are described by the call frame
+ * information in the executable are unwound using that information.
+ * All other frames, e.g. those in shared libraries, are unwound
+ * by following the frame pointer. Try compiling again with
+ * `-fno-omit-frame-pointer` if this doesn't work. */
 
 CallFrame *
 init_backtrace (dbg_addr pc,
-		real_addr load_address, pid_t pid, DebugInfo *info)
+		real_addr load_address,
+		const StackSnapshot *stack, pid_t pid, DebugInfo *info)
 {
   assert (info != NULL);
 
-  /* Get the saved base pointer of the caller. */
-  real_addr frame_pointer = { 0 };
-  SprayResult reg_res = get_register_value (pid, rbp, &frame_pointer.value);
-  if (reg_res == SP_ERR)
+  struct user_regs_struct user_regs;
+  if (pt_read_registers (pid, &user_regs) == SP_ERR)
     {
       return NULL;
     }
 
-  if (!stores_frame_pointer (pc, load_address, pid, info))
+  const UnwindTable *table = unwind_table (info);
+
+  if (!has_unwind_row (table, pc)
+      && !stores_frame_pointer (pc, load_address, pid, info))
     {
       printf ("WARN: it seems like this executable doesn't maintain a frame "
 	      "pointer.\n"
@@ -126,44 +135,63 @@ init_backtrace (dbg_addr pc,
 	      "HINT: Try to compile again with `-fno-omit-frame-pointer`.\n\n");
     }
 
-  CallFrame *call_frame = init_call_frame (NULL, pc, frame_pointer, info);
+  FrameRegs regs = init_frame_regs (&user_regs);
+  CallFrame *innermost = init_call_frame (pc, info);
+  innermost->regs = regs;
+  CallFrame *frame = innermost;
 
-  while (frame_pointer.value != 0)
+  for (size_t depth = 1; depth < BACKTRACE_MAX_DEPTH; depth++)
     {
-      /* Read the return address of the current function
-       * and use it as the PC of the next function.
-       * NOTE: This operation must be performed *before* the
-       * frame pointer is updated. */
-      SprayResult ret_res = pt_read_memory (pid,
-					    (real_addr) { frame_pointer.value
-					    + 8
-					    },
-					    &pc.value);
-      if (ret_res == SP_ERR)
-	{
-	  free_backtrace (call_frame);
-	  return NULL;
-	}
-
-      /* Read the frame pointer of the next function. */
-      SprayResult fp_res =
-	pt_read_memory (pid, frame_pointer, &frame_pointer.value);
-      if (fp_res == SP_ERR)
+      FrameRegs caller_regs;
+      if (unwind_frame (table, load_address, stack, pid, &regs,
+			frame == innermost, &caller_regs) == SP_ERR)
 	{
-	  free_backtrace (call_frame);
-	  return NULL;
+	  break;
 	}
 
-      call_frame = init_call_frame (call_frame, pc, frame_pointer, info);
+      real_addr caller_pc = { caller_regs.values[UNWIND_RIP] };
+      frame->caller = init_call_frame (real_to_dbg (load_address,
+						    caller_pc), info);
+      frame = frame->caller;
+      frame->regs = caller_regs;
+      regs = caller_regs;
     }
 
-  return call_frame;
+  return innermost;
+}
+
+const CallFrame *
+frame_caller (const CallFrame *frame)
+{
+  assert (frame != NULL);
+  return frame->caller;
+}
+
+dbg_addr
+frame_pc (const CallFrame *frame)
+{
+  assert (frame != NULL);
+  return frame->location.pc;
+}
+
+real_addr
+frame_stack_pointer (const CallFrame *frame)
+{
+  assert (frame != NULL);
+  return (real_addr) {frame->regs.values[UNWIND_RSP]};
+}
+
+const FrameRegs *
+frame_regs (const CallFrame *frame)
+{
+  assert (frame != NULL);
+  return &frame->regs;
 }
 
 void
 free_backtrace (CallFrame *call_frame)
 {
-  /* Recursively free all call frames. */
+  /* Free the frame and all its callers. */
   while (call_frame != NULL)
     {
       CallFrame *caller = call_frame->caller;
@@ -173,41 +201,65 @@ free_backtrace (CallFrame *call_frame)
 }
 
 void
-print_backtrace (CallFrame *call_frame)
+print_call_frame (const CallFrame *call_frame)
+{
+  const CallLocation *location = &call_frame->location;
+
+  printf ("  " ADDR_FORMAT " ", location->pc.value);
+
+  if (location->function)
+    {
+      printf ("%s", location->function);
+    }
+  else
+    {
+      printf ("<?>");
+    }
+
+  if (location->has_lineno)
+    {
+      printf (":%u\n", location->lineno);
+    }
+  else
+    {
+      printf ("\n");
+    }
+}
+
+void
+print_backtrace (const CallFrame *innermost)
 {
   printf ("How did we even get here? (backtrace)\n");
-  if (call_frame == NULL)
+  if (innermost == NULL)
     {
       printf ("<empty backtrace>\n");
     }
   else
     {
-      CallLocation *location;
-      while (call_frame != NULL)
+      /* Print the outermost frame first so that the innermost
+       * frame, where the tracee stopped, ends up at the bottom. */
+      size_t n_frames = 0;
+      for (const CallFrame *frame = innermost; frame != NULL;
+	   frame = frame->caller)
+	{
+	  n_frames++;
+	}
+
+      const CallFrame **frames = calloc (n_frames, sizeof (*frames));
+      assert (frames != NULL);
+
+      size_t i = n_frames;
+      for (const CallFrame *frame = innermost; frame != NULL;
+	   frame = frame->caller)
+	{
+	  frames[--i] = frame;
+	}
+
+      for (i = 0; i < n_frames; i++)
 	{
-	  location = &call_frame->location;
-
-	  printf ("  " ADDR_FORMAT " ", location->pc.value);
-
-	  if (location->function)
-	    {
-	      printf ("%s", location->function);
-	    }
-	  else
-	    {
-	      printf ("<?>");
-	    }
-
-	  if (location->has_lineno)
-	    {
-	      printf (":%u\n", location->lineno);
-	    }
-	  else
-	    {
-	      printf ("\n");
-	    }
-
-	  call_frame = call_frame->caller;
+	  print_call_frame (frames[i]);
 	}
+
+      free (frames);
     }
 }
@@ -5,19 +5,39 @@
 
 #include "info.h"
 #include "magic.h"
+#include "stack.h"
+#include "unwind.h"
 
 typedef struct CallFrame CallFrame;
 
-/* Create a call frame starting at the code
-   address `pc` and the current stack frame. */
+/* Unwind the call stack of the tracee, which is stopped at
+ * the code address `pc`. The stack is read from `stack` where
+ * possible. Returns the innermost call frame or NULL on error. */
 CallFrame *init_backtrace (dbg_addr pc,
 			   real_addr load_address,
+			   const StackSnapshot * stack,
 			   pid_t pid, DebugInfo * info);
 
-/* Print a backtrace starting at the given call frame. */
-void print_backtrace (CallFrame * start_frame);
+/* Print a backtrace that ends at the given innermost frame. */
+void print_backtrace (const CallFrame * innermost);
 
-/* Delete the call frame. */
-void free_backtrace (CallFrame * call_frame);
+/* Get the frame of the function that called the function of
+ * `frame`. Returns NULL if `frame` is the outermost frame. */
+const CallFrame *frame_caller (const CallFrame * frame);
+
+/* Get the code address where execution is at in the given frame.
+ * For all but the innermost frame this is a return address. */
+dbg_addr frame_pc (const CallFrame * frame);
+
+/* Get the stack pointer of the given frame. The frame occupies
+ * the stack from there up to the stack pointer of its caller. */
+real_addr frame_stack_pointer (const CallFrame * frame);
+
+/* Get the registers that were recovered for the given frame. In
+ * the innermost frame, they're the registers of the tracee. */
+const FrameRegs *frame_regs (const CallFrame * frame);
+
+/* Delete the given frame and all the frames of its callers. */
+void free_backtrace (CallFrame * innermost);
 
 #endif /* _SPRAY_BACKTRACE_H_ */
@@ -186,3 +186,224 @@ disable_breakpoint (Breakpoints *breakpoints, real_addr addr)
 
   return SP_OK;
 }
+
+int
+compare_breakpoint_changes (const void *a, const void *b)
+{
+  uint64_t addr_a = ((const BreakpointChange *) a)->addr.value;
+  uint64_t addr_b = ((const BreakpointChange *) b)->addr.value;
+  return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+/* Is the breakpoint at `change->addr` not yet in the state it
+ * should be in? */
+bool
+is_breakpoint_changed (Breakpoints *breakpoints,
+		       const BreakpointChange *change)
+{
+  const Breakpoint *breakpoint = get_breakpoint (breakpoints, change->addr);
+  bool is_enabled = breakpoint != NULL && breakpoint->is_enabled;
+  return is_enabled != change->is_enabled;
+}
+
+SprayResult
+change_breakpoints (Breakpoints *breakpoints, BreakpointChange *changes,
+		    size_t n_changes)
+{
+  assert (breakpoints != NULL);
+  assert (changes != NULL || n_changes == 0);
+
+  qsort (changes, n_changes, sizeof (*changes), compare_breakpoint_changes);
+
+  SprayResult res = SP_OK;
+  size_t start = 0;
+  while (start < n_changes)
+    {
+      /* Find all changes in the same aligned word. */
+      uint64_t word_start =
+	changes[start].addr.value & ~(uint64_t) (sizeof (uint64_t) - 1);
+      size_t end = start;
+      bool is_changed = false;
+      while (end < n_changes
+	     && changes[end].addr.value - word_start < sizeof (uint64_t))
+	{
+	  is_changed |= is_breakpoint_changed (breakpoints, &changes[end]);
+	  end++;
+	}
+
+      if (!is_changed)
+	{
+	  start = end;
+	  continue;
+	}
+
+      uint64_t word = 0;
+      if (pt_read_memory (breakpoints->pid, (real_addr) {word_start}, &word)
+	  == SP_ERR)
+	{
+	  res = SP_ERR;
+	  start = end;
+	  continue;
+	}
+
+      unsigned char *bytes = (unsigned char *) &word;
+      Breakpoint updated[sizeof (uint64_t)];
+      size_t n_updated = 0;
+      for (size_t i = start; i < end; i++)
+	{
+	  if (!is_breakpoint_changed (breakpoints, &changes[i]))
+	    {
+	      continue;
+	    }
+
+	  size_t offset = changes[i].addr.value - word_start;
+	  const Breakpoint *breakpoint =
+	    get_breakpoint (breakpoints, changes[i].addr);
+	  Breakpoint *update = &updated[n_updated++];
+	  *update = (Breakpoint) {
+	    .addr = changes[i].addr,
+	    .is_enabled = changes[i].is_enabled,
+	  };
+
+	  if (changes[i].is_enabled)
+	    {
+	      update->orig_data = bytes[offset];
+	      bytes[offset] = INT3;
+	    }
+	  else
+	    {
+	      update->orig_data = breakpoint->orig_data;
+	      bytes[offset] = breakpoint->orig_data;
+	    }
+	}
+
+      /* Like in `enable_breakpoint`, the map is
+       * only updated after the write succeeded. */
+      if (pt_write_memory (breakpoints->pid, (real_addr) {word_start}, word)
+	  == SP_ERR)
+	{
+	  res = SP_ERR;
+	}
+      else
+	{
+	  for (size_t i = 0; i < n_updated; i++)
+	    {
+	      hashmap_set (breakpoints->map, &updated[i]);
+	    }
+	}
+
+      start = end;
+    }
+
+  return res;
+}
+
+SprayResult
+disable_all_breakpoints (Breakpoints *breakpoints)
+{
+  assert (breakpoints != NULL);
+
+  /* Disabling a breakpoint updates the map, so the
+   * addresses must be collected before that. */
+  size_t n_addrs = hashmap_count (breakpoints->map);
+  real_addr *addrs = calloc (n_addrs + 1, sizeof (real_addr));
+  assert (addrs != NULL);
+
+  size_t i = 0;
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (breakpoints->map, &iter, &item))
+    {
+      addrs[i++] = ((Breakpoint *) item)->addr;
+    }
+
+  SprayResult res = SP_OK;
+  for (i = 0; i < n_addrs; i++)
+    {
+      if (disable_breakpoint (breakpoints, addrs[i]) == SP_ERR)
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  free (addrs);
+
+  return res;
+}
+
+void
+hide_breakpoints (Breakpoints *breakpoints, real_addr start,
+		  unsigned char *bytes, size_t n_bytes)
+{
+  assert (breakpoints != NULL);
+  assert (bytes != NULL);
+
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (breakpoints->map, &iter, &item))
+    {
+      const Breakpoint *breakpoint = (Breakpoint *) item;
+      if (breakpoint->is_enabled && breakpoint->addr.value >= start.value
+	  && breakpoint->addr.value - start.value < n_bytes)
+	{
+	  bytes[breakpoint->addr.value - start.value] = breakpoint->orig_data;
+	}
+    }
+}
+
+/* Replace the low byte of the word at `addr` in the process `pid`. */
+SprayResult
+write_low_byte (pid_t pid, real_addr addr, uint8_t byte)
+{
+  uint64_t word = 0;
+  if (pt_read_memory (pid, addr, &word) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+  return pt_write_memory (pid, addr, (word & ~BTM_BYTE_MASK) | byte);
+}
+
+SprayResult
+clear_breakpoint_traps (Breakpoints *breakpoints, pid_t pid)
+{
+  assert (breakpoints != NULL);
+
+  SprayResult res = SP_OK;
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (breakpoints->map, &iter, &item))
+    {
+      const Breakpoint *breakpoint = (Breakpoint *) item;
+      if (breakpoint->is_enabled
+	  && write_low_byte (pid, breakpoint->addr,
+			     breakpoint->orig_data) == SP_ERR)
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  return res;
+}
+
+SprayResult
+move_breakpoints (Breakpoints *breakpoints, pid_t pid)
+{
+  assert (breakpoints != NULL);
+
+  breakpoints->pid = pid;
+
+  SprayResult res = SP_OK;
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (breakpoints->map, &iter, &item))
+    {
+      const Breakpoint *breakpoint = (Breakpoint *) item;
+      if (breakpoint->is_enabled
+	  && write_low_byte (pid, breakpoint->addr, INT3) == SP_ERR)
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  return res;
+}
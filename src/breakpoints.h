@@ -30,9 +30,45 @@ SprayResult enable_breakpoint (Breakpoints * breakpoints, real_addr addr);
  * and thus the breakpoints remains active. */
 SprayResult disable_breakpoint (Breakpoints * breakpoints, real_addr addr);
 
+/* A breakpoint that should be enabled or disabled. */
+typedef struct
+{
+  real_addr addr;
+  bool is_enabled;
+} BreakpointChange;
+
+/* Enable and disable many breakpoints at once. Breakpoints that share
+ * a word of the tracee's memory are changed with a single read and
+ * write of that word, and changes that leave a breakpoint as it is
+ * don't touch the memory at all. `changes` is sorted by address and
+ * each address must only appear once. Returns `SP_ERR` if any of the
+ * changes failed. The others are made anyways. */
+SprayResult change_breakpoints (Breakpoints * breakpoints,
+				BreakpointChange * changes, size_t n_changes);
+
+/* Disable all breakpoints, restoring the original instructions.
+ * Returns `SP_ERR` if any of them couldn't be disabled. */
+SprayResult disable_all_breakpoints (Breakpoints * breakpoints);
+
 /* Return `true` if there is a breakpoint at `addr` and
  * this breakpoint is enabled. Otherwise, if the breakpoint
  * doesn't exist or is disabled, return `false`. */
 bool lookup_breakpoint (Breakpoints * breakpoints, real_addr addr);
 
+/* Replace the traps of all enabled breakpoints in `bytes`, which is a
+ * copy of the `n_bytes` of the tracee's memory at `start`, with the
+ * original instructions. */
+void hide_breakpoints (Breakpoints * breakpoints, real_addr start,
+		       unsigned char *bytes, size_t n_bytes);
+
+/* Restore the original instructions of all enabled breakpoints in
+ * the process `pid`, which is a fork of the tracee. The breakpoints
+ * stay enabled in the tracee. */
+SprayResult clear_breakpoint_traps (Breakpoints * breakpoints, pid_t pid);
+
+/* Insert all enabled breakpoints into the process `pid`, which runs
+ * the same program as the tracee but has no breakpoints in it. The
+ * breakpoints of `pid` are managed from now on. */
+SprayResult move_breakpoints (Breakpoints * breakpoints, pid_t pid);
+
 #endif /* _SPRAY_BREAKPOINTS_H_ */
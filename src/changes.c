@@ -0,0 +1,666 @@
+/* Required to use `process_vm_readv`. */
+#define _GNU_SOURCE
+
+#include "changes.h"
+
+#include "hashmap.h"
+#include "stats.h"
+
+#include <assert.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+enum
+{
+  /* Bits of the entries in `/proc/<pid>/pagemap`. See proc(5). */
+  PAGEMAP_SOFT_DIRTY_BIT = 55,
+  PAGEMAP_SWAPPED_BIT = 62,
+  PAGEMAP_PRESENT_BIT = 63,
+  /* Number of pagemap entries that are read at once. The
+   * changed pages among them are read in a single call. */
+  PAGEMAP_BATCH_SIZE = 512,
+  /* Changes with fewer unchanged bytes between them are merged. */
+  CHANGE_MERGE_GAP = 8,
+  /* At most this many pages are copied (64 MiB of 4 KiB pages). */
+  MAX_PAGE_COPIES = 16384,
+};
+
+/* Larger mappings are address space that's reserved rather than
+ * used, e.g. the shadow memory of the address sanitizer. Looking
+ * at all their pages would take much too long. */
+#define MAX_SCANNED_MAPPING_SIZE (64ULL << 30)
+
+/* Copy of a page of the tracee as it was at the last stop. */
+typedef struct
+{
+  uint64_t addr;		/* The address is used to look up copies. */
+  unsigned char *bytes;
+} PageCopy;
+
+/* Bytes of the changes. They're referred to by their offsets
+ * until all changes are found, since the buffer might move. */
+typedef struct
+{
+  unsigned char *bytes;
+  size_t n_bytes;
+  size_t capacity;
+} ByteBuffer;
+
+typedef struct
+{
+  uint64_t start;
+  size_t n_bytes;
+  MappingKind kind;
+  const char *filepath;
+  bool is_known;		/* Is the old content known? */
+  size_t old_offset;
+  size_t new_offset;
+} FoundChange;
+
+/* How the pages of the tracee are looked at. */
+typedef enum
+{
+  SCAN_COPY,			/* Copy pages that aren't copied yet. */
+  SCAN_CHANGES,			/* Compare the changed pages to their copies. */
+} ScanMode;
+
+struct ChangeTracker
+{
+  pid_t pid;
+  bool is_tracking;
+  bool has_soft_dirty_bits;
+  bool is_scanned;		/* Were the changes since the tracee was
+				 * last resumed found already? */
+  bool has_missed_copies;	/* Were pages left out since
+				 * there was no room for them? */
+  size_t page_size;
+  struct hashmap *copies;	/* `PageCopy`s of the tracee's pages. */
+  Mappings mappings;		/* Mappings at the current stop. */
+  FoundChange *found;
+  size_t n_found;
+  size_t found_capacity;
+  ByteBuffer old_bytes;
+  ByteBuffer new_bytes;
+  MemoryChange *changes;
+  unsigned char *batch;		/* Pages that are read at once. */
+  unsigned char *zero_page;
+};
+
+int
+page_copy_compare (const void *a, const void *b, void *udata)
+{
+  unused (udata);
+  const PageCopy *copy_a = (PageCopy *) a;
+  const PageCopy *copy_b = (PageCopy *) b;
+  return !(copy_a->addr == copy_b->addr);
+}
+
+uint64_t
+page_copy_hash (const void *entry, uint64_t seed0, uint64_t seed1)
+{
+  const PageCopy *copy = (PageCopy *) entry;
+  return hashmap_sip (&copy->addr, sizeof (copy->addr), seed0, seed1);
+}
+
+void
+page_copy_free (void *entry)
+{
+  free (((PageCopy *) entry)->bytes);
+}
+
+ChangeTracker *
+init_change_tracker (void)
+{
+  ChangeTracker *tracker = calloc (1, sizeof (*tracker));
+  if (tracker != NULL)
+    {
+      tracker->page_size = (size_t) sysconf (_SC_PAGESIZE);
+    }
+  return tracker;
+}
+
+void
+stop_tracking_changes (ChangeTracker *tracker)
+{
+  assert (tracker != NULL);
+
+  if (tracker->copies != NULL)
+    {
+      hashmap_free (tracker->copies);
+      tracker->copies = NULL;
+    }
+  free_mappings (&tracker->mappings);
+  tracker->mappings = (Mappings) { 0 };
+  free (tracker->batch);
+  tracker->batch = NULL;
+  free (tracker->zero_page);
+  tracker->zero_page = NULL;
+  tracker->n_found = 0;
+  tracker->has_missed_copies = false;
+  tracker->is_tracking = false;
+}
+
+void
+free_change_tracker (ChangeTracker *tracker)
+{
+  if (tracker == NULL)
+    {
+      return;
+    }
+
+  stop_tracking_changes (tracker);
+  free (tracker->found);
+  free (tracker->old_bytes.bytes);
+  free (tracker->new_bytes.bytes);
+  free (tracker->changes);
+  free (tracker);
+}
+
+bool
+is_tracking_changes (const ChangeTracker *tracker)
+{
+  assert (tracker != NULL);
+  return tracker->is_tracking;
+}
+
+bool
+has_soft_dirty_bits (const ChangeTracker *tracker)
+{
+  assert (tracker != NULL);
+  return tracker->has_soft_dirty_bits;
+}
+
+/* Clear the soft-dirty bits of all pages of the process `pid`. */
+SprayResult
+clear_soft_dirty_bits (pid_t pid)
+{
+  char filepath[PROC_PID_FILEPATH_LEN + 6] = { 0 };
+  snprintf (filepath, sizeof (filepath), "/proc/%d/clear_refs", pid);
+
+  int fd = open (filepath, O_WRONLY);
+  if (fd == -1)
+    {
+      return SP_ERR;
+    }
+
+  SprayResult res = write (fd, "4", 1) == 1 ? SP_OK : SP_ERR;
+  close (fd);
+  return res;
+}
+
+/* Read the pagemap entries of the `n_pages` pages starting at `addr`. */
+SprayResult
+read_pagemap (int pagemap_fd, uint64_t addr, size_t page_size,
+	      uint64_t *entries, size_t n_pages)
+{
+  size_t n_bytes = n_pages * sizeof (*entries);
+  off_t offset = (off_t) (addr / page_size * sizeof (*entries));
+  return pread (pagemap_fd, entries, n_bytes, offset) == (ssize_t) n_bytes
+    ? SP_OK : SP_ERR;
+}
+
+SprayResult
+open_pagemap (pid_t pid, int *pagemap_fd)
+{
+  char filepath[PROC_PID_FILEPATH_LEN + 3] = { 0 };
+  snprintf (filepath, sizeof (filepath), "/proc/%d/pagemap", pid);
+
+  *pagemap_fd = open (filepath, O_RDONLY);
+  return *pagemap_fd == -1 ? SP_ERR : SP_OK;
+}
+
+/* Find out if the kernel sets soft-dirty bits by writing
+ * to a page of the debugger after clearing its bits. */
+bool
+probe_soft_dirty_bits (size_t page_size)
+{
+  volatile unsigned char *page = mmap (NULL, page_size,
+				       PROT_READ | PROT_WRITE,
+				       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED)
+    {
+      return false;
+    }
+  page[0] = 1;
+
+  bool has_bits = false;
+  int pagemap_fd = -1;
+  if (clear_soft_dirty_bits (getpid ()) == SP_OK
+      && open_pagemap (getpid (), &pagemap_fd) == SP_OK)
+    {
+      page[0] = 2;
+      uint64_t entry = 0;
+      has_bits = read_pagemap (pagemap_fd, (uint64_t) page, page_size,
+			       &entry, 1) == SP_OK
+	&& (entry >> PAGEMAP_SOFT_DIRTY_BIT & 1) != 0;
+      close (pagemap_fd);
+    }
+
+  munmap ((void *) page, page_size);
+  return has_bits;
+}
+
+static inline void
+reserve_bytes (ByteBuffer *buffer, size_t n_bytes)
+{
+  if (buffer->n_bytes + n_bytes > buffer->capacity)
+    {
+      size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+      while (buffer->n_bytes + n_bytes > capacity)
+	{
+	  capacity *= 2;
+	}
+      buffer->bytes = realloc (buffer->bytes, capacity);
+      assert (buffer->bytes != NULL);
+      buffer->capacity = capacity;
+    }
+}
+
+/* Append `n_bytes` to `buffer` and return their offset. */
+size_t
+append_bytes (ByteBuffer *buffer, const unsigned char *bytes, size_t n_bytes)
+{
+  reserve_bytes (buffer, n_bytes);
+  size_t offset = buffer->n_bytes;
+  memcpy (buffer->bytes + offset, bytes, n_bytes);
+  buffer->n_bytes += n_bytes;
+  return offset;
+}
+
+/* Record that the `n_bytes` at `addr` changed from `old_bytes`
+ * to `new_bytes`. `old_bytes` is NULL if they're unknown. The
+ * change is merged with the one before if they touch. */
+void
+add_change (ChangeTracker *tracker, const Mapping *mapping, uint64_t addr,
+	    const unsigned char *old_bytes, const unsigned char *new_bytes,
+	    size_t n_bytes)
+{
+  bool is_known = old_bytes != NULL;
+  size_t old_offset = is_known
+    ? append_bytes (&tracker->old_bytes, old_bytes, n_bytes) : 0;
+  size_t new_offset = append_bytes (&tracker->new_bytes, new_bytes, n_bytes);
+
+  if (tracker->n_found > 0)
+    {
+      /* The bytes of both changes are next to each other in the
+       * buffers, since they were the last ones to be added. */
+      FoundChange *last = &tracker->found[tracker->n_found - 1];
+      if (last->start + last->n_bytes == addr && last->is_known == is_known
+	  && last->kind == mapping->kind
+	  && last->filepath == mapping->filepath)
+	{
+	  last->n_bytes += n_bytes;
+	  return;
+	}
+    }
+
+  if (tracker->n_found == tracker->found_capacity)
+    {
+      size_t capacity = tracker->found_capacity == 0
+	? 16 : tracker->found_capacity * 2;
+      FoundChange *grown = realloc (tracker->found,
+				    capacity * sizeof (*grown));
+      assert (grown != NULL);
+      tracker->found = grown;
+      tracker->found_capacity = capacity;
+    }
+
+  tracker->found[tracker->n_found++] = (FoundChange) {
+    .start = addr,
+    .n_bytes = n_bytes,
+    .kind = mapping->kind,
+    .filepath = mapping->filepath,
+    .is_known = is_known,
+    .old_offset = old_offset,
+    .new_offset = new_offset,
+  };
+}
+
+/* Compare the page at `addr` to its copy and record the differences. */
+void
+compare_page (ChangeTracker *tracker, const Mapping *mapping, uint64_t addr,
+	      const unsigned char *old_page, const unsigned char *new_page)
+{
+  size_t i = 0;
+  while (i < tracker->page_size)
+    {
+      if (old_page[i] == new_page[i])
+	{
+	  i++;
+	  continue;
+	}
+
+      /* Extend the change over short runs of unchanged bytes. */
+      size_t start = i;
+      size_t end = i + 1;
+      for (size_t j = end; j < tracker->page_size
+	   && j - end < CHANGE_MERGE_GAP; j++)
+	{
+	  if (old_page[j] != new_page[j])
+	    {
+	      end = j + 1;
+	    }
+	}
+
+      add_change (tracker, mapping, addr + start, old_page + start,
+		  new_page + start, end - start);
+      i = end;
+    }
+}
+
+/* Read the pages at `addrs` into `tracker->batch`. Pages that can't
+ * be read are marked by setting their address to 0. */
+void
+read_pages (ChangeTracker *tracker, uint64_t *addrs, size_t n_pages)
+{
+  struct iovec local[PAGEMAP_BATCH_SIZE];
+  struct iovec remote[PAGEMAP_BATCH_SIZE];
+  for (size_t i = 0; i < n_pages; i++)
+    {
+      local[i] = (struct iovec) {
+	.iov_base = tracker->batch + i * tracker->page_size,
+	.iov_len = tracker->page_size,
+      };
+      remote[i] = (struct iovec) {
+	.iov_base = (void *) addrs[i],
+	.iov_len = tracker->page_size,
+      };
+    }
+
+  /* Reading stops at the first page that can't be read. The
+   * pages after it are read one by one, skipping the bad ones. */
+  size_t n_done = 0;
+  while (n_done < n_pages)
+    {
+      add_stat (STAT_PROCESS_VM_READV, 1);
+      ssize_t n_read = process_vm_readv (tracker->pid, &local[n_done],
+					 n_pages - n_done, &remote[n_done],
+					 n_pages - n_done, 0);
+      size_t n_read_pages = n_read > 0
+	? (size_t) n_read / tracker->page_size : 0;
+      add_stat (STAT_BYTES_READ, n_read_pages * tracker->page_size);
+      n_done += n_read_pages;
+      if (n_done < n_pages && n_read_pages == 0)
+	{
+	  addrs[n_done++] = 0;
+	}
+    }
+}
+
+/* Is the content of `mapping` copied right away? The mapping
+ * of a file's zero-initialized data (`.bss`) counts as part
+ * of the file if `is_bss` is set. */
+bool
+is_copied_at_start (const ChangeTracker *tracker, const Mapping *mapping,
+		    bool is_bss)
+{
+  return !tracker->has_soft_dirty_bits || mapping->kind == MAPPING_FILE
+    || mapping->kind == MAPPING_STACK || is_bss;
+}
+
+/* Look at the pages of `mapping` according to `mode`. Pages that
+ * weren't copied held zeros before if `is_zero_filled` is set. */
+void
+scan_mapping (ChangeTracker *tracker, const Mapping *mapping,
+	      int pagemap_fd, ScanMode mode, bool is_zero_filled)
+{
+  size_t page_size = tracker->page_size;
+  uint64_t entries[PAGEMAP_BATCH_SIZE];
+  uint64_t addrs[PAGEMAP_BATCH_SIZE];
+
+  for (uint64_t batch_start = mapping->start; batch_start < mapping->end;
+       batch_start += PAGEMAP_BATCH_SIZE * page_size)
+    {
+      size_t n_pages = (mapping->end - batch_start) / page_size;
+      if (n_pages > PAGEMAP_BATCH_SIZE)
+	{
+	  n_pages = PAGEMAP_BATCH_SIZE;
+	}
+      if (read_pagemap (pagemap_fd, batch_start, page_size, entries,
+			n_pages) == SP_ERR)
+	{
+	  continue;
+	}
+
+      /* Collect the pages that have to be read. */
+      size_t n_selected = 0;
+      size_t n_copies = hashmap_count (tracker->copies);
+      for (size_t i = 0; i < n_pages; i++)
+	{
+	  uint64_t addr = batch_start + i * page_size;
+	  bool is_present = (entries[i] >> PAGEMAP_PRESENT_BIT & 1) != 0
+	    || (entries[i] >> PAGEMAP_SWAPPED_BIT & 1) != 0;
+	  bool is_selected = false;
+	  if (mode == SCAN_CHANGES && tracker->has_soft_dirty_bits)
+	    {
+	      is_selected = (entries[i] >> PAGEMAP_SOFT_DIRTY_BIT & 1) != 0;
+	    }
+	  else if (is_present)
+	    {
+	      /* Without soft-dirty bits, all copied pages are compared.
+	       * Pages that weren't copied must be new, unless there
+	       * is no room for more copies. */
+	      bool is_copied = hashmap_get (tracker->copies,
+					    &(PageCopy) {.addr = addr}) != NULL;
+	      bool has_room = n_copies + n_selected < MAX_PAGE_COPIES;
+	      is_selected = mode == SCAN_COPY
+		? !is_copied && has_room : is_copied || has_room;
+	      tracker->has_missed_copies |= !is_copied && !has_room;
+	    }
+
+	  if (is_selected)
+	    {
+	      addrs[n_selected++] = addr;
+	    }
+	}
+
+      read_pages (tracker, addrs, n_selected);
+
+      for (size_t i = 0; i < n_selected; i++)
+	{
+	  if (addrs[i] == 0)
+	    {
+	      continue;
+	    }
+
+	  unsigned char *page = tracker->batch + i * page_size;
+	  const PageCopy *copy =
+	    hashmap_get (tracker->copies, &(PageCopy) {.addr = addrs[i]});
+	  if (copy != NULL)
+	    {
+	      compare_page (tracker, mapping, addrs[i], copy->bytes, page);
+	      memcpy (copy->bytes, page, page_size);
+	      continue;
+	    }
+
+	  if (mode == SCAN_CHANGES)
+	    {
+	      if (is_zero_filled)
+		{
+		  compare_page (tracker, mapping, addrs[i], tracker->zero_page,
+				page);
+		}
+	      else
+		{
+		  add_change (tracker, mapping, addrs[i], NULL, page,
+			      page_size);
+		}
+	    }
+	  if (hashmap_count (tracker->copies) >= MAX_PAGE_COPIES)
+	    {
+	      tracker->has_missed_copies = true;
+	    }
+	  else
+	    {
+	      unsigned char *bytes = malloc (page_size);
+	      assert (bytes != NULL);
+	      memcpy (bytes, page, page_size);
+	      hashmap_set (tracker->copies,
+			   &(PageCopy) {.addr = addrs[i],.bytes = bytes});
+	    }
+	}
+    }
+}
+
+/* Look at all writable mappings of the tracee according to `mode`. */
+SprayResult
+scan_mappings (ChangeTracker *tracker, ScanMode mode)
+{
+  free_mappings (&tracker->mappings);
+  tracker->mappings = (Mappings) { 0 };
+  tracker->n_found = 0;
+  tracker->old_bytes.n_bytes = 0;
+  tracker->new_bytes.n_bytes = 0;
+
+  int pagemap_fd = -1;
+  if (read_mappings (tracker->pid, &tracker->mappings) == SP_ERR
+      || open_pagemap (tracker->pid, &pagemap_fd) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  const Mapping *previous = NULL;
+  for (size_t i = 0; i < tracker->mappings.n_mappings; i++)
+    {
+      Mapping *mapping = &tracker->mappings.mappings[i];
+      bool is_bss = mapping->kind == MAPPING_ANONYMOUS && previous != NULL
+	&& previous->kind == MAPPING_FILE && previous->filepath != NULL
+	&& previous->end == mapping->start;
+      bool is_copied = is_copied_at_start (tracker, mapping, is_bss);
+      /* Anonymous pages are filled with zeros when they're first used.
+       * So pages that weren't copied before held zeros, as long as
+       * every page that was used was copied. */
+      bool is_zero_filled = is_copied && !tracker->has_missed_copies
+	&& mapping->kind != MAPPING_FILE;
+
+      if (is_bss)
+	{
+	  /* Report changes of `.bss` as changes of the file's data.
+	   * The mapping after it isn't `.bss` anymore. */
+	  mapping->kind = MAPPING_FILE;
+	  mapping->filepath = strdup (previous->filepath);
+	  previous = NULL;
+	}
+      else
+	{
+	  previous = mapping;
+	}
+
+      if ((mapping->flags & PF_W) != 0 && mapping->is_readable
+	  && mapping->kind != MAPPING_SPECIAL
+	  && mapping->end - mapping->start <= MAX_SCANNED_MAPPING_SIZE
+	  && (mode == SCAN_CHANGES || is_copied))
+	{
+	  scan_mapping (tracker, mapping, pagemap_fd, mode, is_zero_filled);
+	}
+    }
+
+  close (pagemap_fd);
+  return SP_OK;
+}
+
+SprayResult
+start_tracking_changes (ChangeTracker *tracker, pid_t pid)
+{
+  assert (tracker != NULL);
+
+  stop_tracking_changes (tracker);
+  tracker->pid = pid;
+  tracker->has_soft_dirty_bits = probe_soft_dirty_bits (tracker->page_size);
+  tracker->copies = hashmap_new (sizeof (PageCopy), 0, 0, 0,
+				 page_copy_hash, page_copy_compare,
+				 page_copy_free, NULL);
+  tracker->batch = malloc (PAGEMAP_BATCH_SIZE * tracker->page_size);
+  tracker->zero_page = calloc (1, tracker->page_size);
+  assert (tracker->copies != NULL && tracker->batch != NULL
+	  && tracker->zero_page != NULL);
+
+  if (scan_mappings (tracker, SCAN_COPY) == SP_ERR)
+    {
+      int scan_errno = errno;
+      stop_tracking_changes (tracker);
+      errno = scan_errno;
+      return SP_ERR;
+    }
+
+  /* Nothing changed since tracking started. */
+  tracker->is_tracking = true;
+  tracker->is_scanned = true;
+  return SP_OK;
+}
+
+SprayResult
+reset_changes (ChangeTracker *tracker)
+{
+  assert (tracker != NULL);
+
+  if (!tracker->is_tracking)
+    {
+      return SP_OK;
+    }
+
+  /* Update the copies with the changes that weren't looked at. */
+  if (!tracker->is_scanned && scan_mappings (tracker, SCAN_CHANGES) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  tracker->is_scanned = false;
+  if (tracker->has_soft_dirty_bits)
+    {
+      return clear_soft_dirty_bits (tracker->pid);
+    }
+  return SP_OK;
+}
+
+SprayResult
+find_changes (ChangeTracker *tracker,
+	      const MemoryChange **changes, size_t *n_changes)
+{
+  assert (tracker != NULL);
+  assert (changes != NULL);
+  assert (n_changes != NULL);
+
+  if (!tracker->is_tracking)
+    {
+      errno = EINVAL;
+      return SP_ERR;
+    }
+
+  if (!tracker->is_scanned)
+    {
+      if (scan_mappings (tracker, SCAN_CHANGES) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      tracker->is_scanned = true;
+    }
+
+  free (tracker->changes);
+  tracker->changes = calloc (tracker->n_found + 1, sizeof (MemoryChange));
+  assert (tracker->changes != NULL);
+
+  for (size_t i = 0; i < tracker->n_found; i++)
+    {
+      const FoundChange *found = &tracker->found[i];
+      tracker->changes[i] = (MemoryChange) {
+	.start = {found->start},
+	.n_bytes = found->n_bytes,
+	.kind = found->kind,
+	.filepath = found->filepath,
+	.old_bytes = found->is_known
+	  ? tracker->old_bytes.bytes + found->old_offset : NULL,
+	.new_bytes = tracker->new_bytes.bytes + found->new_offset,
+      };
+    }
+
+  *changes = tracker->changes;
+  *n_changes = tracker->n_found;
+  return SP_OK;
+}
@@ -0,0 +1,69 @@
+/* Find the memory that the tracee changed since it was last resumed.
+ *
+ * Writing `4` to `/proc/<pid>/clear_refs` clears the soft-dirty bits
+ * of all pages of a process. The kernel sets the bit of a page again
+ * once the page is written to, and `/proc/<pid>/pagemap` tells which
+ * bits are set. So only the pages that were written to between two
+ * stops have to be read again and compared with their earlier copies.
+ *
+ * If the kernel doesn't support soft-dirty bits, all pages that
+ * were copied are read again and compared instead. */
+
+#pragma once
+
+#ifndef _SPRAY_CHANGES_H_
+#define _SPRAY_CHANGES_H_
+
+#include "magic.h"
+#include "mappings.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* A range of bytes that changed between two stops. */
+typedef struct
+{
+  real_addr start;
+  size_t n_bytes;
+  MappingKind kind;		/* Kind of mapping that contains it. */
+  const char *filepath;		/* File of the mapping, or NULL. */
+  const unsigned char *old_bytes;	/* NULL if the content before
+					 * is unknown. */
+  const unsigned char *new_bytes;
+} MemoryChange;
+
+typedef struct ChangeTracker ChangeTracker;
+
+ChangeTracker *init_change_tracker (void);
+
+void free_change_tracker (ChangeTracker * tracker);
+
+/* Start to track the changes of the stopped process `pid`. The
+ * writable mappings of files and the stack are copied right away.
+ * Other pages are copied once they're first found to be changed.
+ * Returns `SP_ERR` with `errno` set on error. */
+SprayResult start_tracking_changes (ChangeTracker * tracker, pid_t pid);
+
+/* Forget about all copies, e.g. because the tracee was replaced. */
+void stop_tracking_changes (ChangeTracker * tracker);
+
+bool is_tracking_changes (const ChangeTracker * tracker);
+
+/* Does the kernel set soft-dirty bits? */
+bool has_soft_dirty_bits (const ChangeTracker * tracker);
+
+/* Must be called right before the tracee is resumed. The copies are
+ * brought up to date and the soft-dirty bits are cleared, so that
+ * the next changes are those made until the next stop. Does nothing
+ * unless changes are tracked. */
+SprayResult reset_changes (ChangeTracker * tracker);
+
+/* Find the changes since the tracee was last resumed. The array is
+ * ordered by address and valid until `reset_changes` is called next.
+ * Changes that are only a few bytes apart are merged. Returns
+ * `SP_ERR` with `errno` set on error. */
+SprayResult find_changes (ChangeTracker * tracker,
+			  const MemoryChange ** changes, size_t *n_changes);
+
+#endif /* _SPRAY_CHANGES_H_ */
@@ -0,0 +1,366 @@
+/* Required to use `__WALL` */
+#define _GNU_SOURCE
+
+#include "checkpoints.h"
+
+#include "ptrace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+enum
+{
+  /* Encoding of the `syscall` instruction as it's
+   * stored in the low bytes of a little-endian word. */
+  SYSCALL_INSTRUCTION = 0x050f,
+  SYSCALL_MASK = 0xffff,
+};
+
+struct Checkpoints
+{
+  Checkpoint *checkpoints;
+  size_t n_checkpoints;
+  size_t next_number;
+  Stop *stops;
+  size_t n_stops;		/* Number of recorded stops. */
+  size_t stops_capacity;
+  size_t current;		/* Position of the current stop. */
+};
+
+Checkpoints *
+init_checkpoints (void)
+{
+  Checkpoints *checkpoints = calloc (1, sizeof (*checkpoints));
+  if (checkpoints != NULL)
+    {
+      checkpoints->next_number = 1;
+    }
+  return checkpoints;
+}
+
+/* Kill the stopped process `pid` and wait until it's gone. */
+void
+kill_stopped_process (pid_t pid)
+{
+  if (kill (pid, SIGKILL) == 0)
+    {
+      while (pt_wait (pid, NULL, __WALL) == -1 && errno == EINTR)
+	;
+    }
+}
+
+void
+free_checkpoints (Checkpoints *checkpoints)
+{
+  if (checkpoints == NULL)
+    {
+      return;
+    }
+
+  for (size_t i = 0; i < checkpoints->n_checkpoints; i++)
+    {
+      kill_stopped_process (checkpoints->checkpoints[i].pid);
+    }
+  free (checkpoints->checkpoints);
+  free (checkpoints->stops);
+  free (checkpoints);
+}
+
+/* Wait for the next stop of `pid`. Returns `SP_ERR`
+ * with `errno` set to `ESRCH` if `pid` is gone. */
+SprayResult
+wait_for_stop (pid_t pid, int *status)
+{
+  while (true)
+    {
+      pid_t waited = pt_wait (pid, status, __WALL);
+      if (waited == -1 && errno == EINTR)
+	{
+	  continue;
+	}
+      else if (waited == -1)
+	{
+	  return SP_ERR;
+	}
+      else if (WIFEXITED (*status) || WIFSIGNALED (*status))
+	{
+	  errno = ESRCH;
+	  return SP_ERR;
+	}
+      else if (WIFSTOPPED (*status))
+	{
+	  return SP_OK;
+	}
+    }
+}
+
+/* Run the `syscall` instruction that was written to the PC of `pid`.
+ * Signals that arrive in the meantime are held back and stored in
+ * `deferred_signo`. `child` is set to the id of the new process. */
+SprayResult
+step_over_fork (pid_t pid, pid_t *child, int *deferred_signo)
+{
+  *child = 0;
+  while (true)
+    {
+      int status = 0;
+      if (pt_single_step (pid) == SP_ERR
+	  || wait_for_stop (pid, &status) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+
+      if (status >> 16 == PTRACE_EVENT_FORK)
+	{
+	  unsigned long new_pid = 0;
+	  pt_get_event_msg (pid, &new_pid);
+	  *child = (pid_t) new_pid;
+	}
+      else if (status >> 16 == 0 && WSTOPSIG (status) == SIGTRAP)
+	{
+	  /* The `syscall` instruction was executed. */
+	  return SP_OK;
+	}
+      else if (status >> 16 == 0)
+	{
+	  *deferred_signo = WSTOPSIG (status);
+	}
+    }
+}
+
+SprayResult
+fork_stopped_process (pid_t pid, int options, Breakpoints *breakpoints,
+		      pid_t *child)
+{
+  assert (child != NULL);
+
+  struct user_regs_struct saved_regs = { 0 };
+  uint64_t saved_code = 0;
+  if (pt_read_registers (pid, &saved_regs) == SP_ERR
+      || pt_read_memory (pid, (real_addr) {saved_regs.rip},
+			 &saved_code) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  /* Run `fork` from wherever the process is stopped. Setting
+   * `orig_rax` to -1 prevents the kernel from restarting an
+   * interrupted system call instead. */
+  struct user_regs_struct fork_regs = saved_regs;
+  fork_regs.rax = SYS_fork;
+  fork_regs.orig_rax = (unsigned long long) -1;
+  uint64_t fork_code = (saved_code & ~(uint64_t) SYSCALL_MASK)
+    | SYSCALL_INSTRUCTION;
+
+  int deferred_signo = 0;
+  SprayResult res = SP_OK;
+  if (pt_set_options (pid, options | PTRACE_O_TRACEFORK) == SP_ERR
+      || pt_write_memory (pid, (real_addr) {saved_regs.rip},
+			  fork_code) == SP_ERR
+      || pt_write_registers (pid, &fork_regs) == SP_ERR
+      || step_over_fork (pid, child, &deferred_signo) == SP_ERR)
+    {
+      res = SP_ERR;
+    }
+
+  int fork_errno = errno;
+  if (res == SP_OK && *child == 0)
+    {
+      /* The return value of `fork` tells why it failed. */
+      struct user_regs_struct regs = { 0 };
+      pt_read_registers (pid, &regs);
+      fork_errno = -(long long) regs.rax;
+      res = SP_ERR;
+    }
+
+  /* Put everything back the way it was, even if the fork failed. */
+  pt_write_memory (pid, (real_addr) {saved_regs.rip}, saved_code);
+  pt_write_registers (pid, &saved_regs);
+  pt_set_options (pid, options);
+  if (deferred_signo != 0)
+    {
+      /* Raise the signal again so that it's reported later on. */
+      kill (pid, deferred_signo);
+    }
+
+  if (res == SP_ERR)
+    {
+      if (*child != 0)
+	{
+	  kill_stopped_process (*child);
+	}
+      errno = fork_errno;
+      return SP_ERR;
+    }
+
+  /* The child starts with the state of the process after the fork. */
+  int status = 0;
+  if (wait_for_stop (*child, &status) == SP_ERR
+      || pt_write_memory (*child, (real_addr) {saved_regs.rip},
+			  saved_code) == SP_ERR
+      || pt_write_registers (*child, &saved_regs) == SP_ERR
+      || pt_set_options (*child, options | PTRACE_O_EXITKILL) == SP_ERR
+      || (breakpoints != NULL
+	  && clear_breakpoint_traps (breakpoints, *child) == SP_ERR))
+    {
+      fork_errno = errno;
+      kill_stopped_process (*child);
+      errno = fork_errno;
+      return SP_ERR;
+    }
+
+  return SP_OK;
+}
+
+size_t
+add_checkpoint (Checkpoints *checkpoints, pid_t pid)
+{
+  assert (checkpoints != NULL);
+
+  Checkpoint *grown = realloc (checkpoints->checkpoints,
+			       (checkpoints->n_checkpoints + 1)
+			       * sizeof (*grown));
+  assert (grown != NULL);
+  checkpoints->checkpoints = grown;
+
+  Checkpoint checkpoint = {
+    .number = checkpoints->next_number++,
+    .pid = pid,
+    .stop = checkpoints->current,
+  };
+  checkpoints->checkpoints[checkpoints->n_checkpoints++] = checkpoint;
+
+  return checkpoint.number;
+}
+
+const Checkpoint *
+get_checkpoint (const Checkpoints *checkpoints, size_t number)
+{
+  assert (checkpoints != NULL);
+
+  for (size_t i = 0; i < checkpoints->n_checkpoints; i++)
+    {
+      if (checkpoints->checkpoints[i].number == number)
+	{
+	  return &checkpoints->checkpoints[i];
+	}
+    }
+  return NULL;
+}
+
+const Checkpoint *
+nearest_checkpoint (const Checkpoints *checkpoints, size_t stop)
+{
+  assert (checkpoints != NULL);
+
+  const Checkpoint *nearest = NULL;
+  for (size_t i = 0; i < checkpoints->n_checkpoints; i++)
+    {
+      const Checkpoint *checkpoint = &checkpoints->checkpoints[i];
+      if (checkpoint->stop <= stop
+	  && (nearest == NULL || checkpoint->stop >= nearest->stop))
+	{
+	  nearest = checkpoint;
+	}
+    }
+  return nearest;
+}
+
+const Checkpoint *
+all_checkpoints (const Checkpoints *checkpoints, size_t *n_checkpoints)
+{
+  assert (checkpoints != NULL);
+  assert (n_checkpoints != NULL);
+
+  *n_checkpoints = checkpoints->n_checkpoints;
+  return checkpoints->checkpoints;
+}
+
+static inline bool
+is_same_stop (Stop a, Stop b)
+{
+  return a.movement == b.movement && a.pc.value == b.pc.value
+    && a.is_breakpoint == b.is_breakpoint;
+}
+
+size_t
+record_stop (Checkpoints *checkpoints, Stop stop)
+{
+  assert (checkpoints != NULL);
+
+  size_t position = checkpoints->current;
+  if (position < checkpoints->n_stops
+      && is_same_stop (checkpoints->stops[position], stop))
+    {
+      checkpoints->current++;
+      return 0;
+    }
+
+  /* Delete the checkpoints that were taken after this stop. The
+   * ones that are kept stay in order of their numbers. */
+  size_t n_kept = 0;
+  for (size_t i = 0; i < checkpoints->n_checkpoints; i++)
+    {
+      Checkpoint checkpoint = checkpoints->checkpoints[i];
+      if (checkpoint.stop > position)
+	{
+	  kill_stopped_process (checkpoint.pid);
+	}
+      else
+	{
+	  checkpoints->checkpoints[n_kept++] = checkpoint;
+	}
+    }
+  size_t n_deleted = checkpoints->n_checkpoints - n_kept;
+  checkpoints->n_checkpoints = n_kept;
+
+  if (position == checkpoints->stops_capacity)
+    {
+      size_t capacity = position == 0 ? 16 : position * 2;
+      Stop *grown = realloc (checkpoints->stops, capacity * sizeof (*grown));
+      assert (grown != NULL);
+      checkpoints->stops = grown;
+      checkpoints->stops_capacity = capacity;
+    }
+
+  checkpoints->stops[position] = stop;
+  checkpoints->n_stops = position + 1;
+  checkpoints->current = position + 1;
+
+  return n_deleted;
+}
+
+const Stop *
+recorded_stop (const Checkpoints *checkpoints, size_t index)
+{
+  assert (checkpoints != NULL);
+
+  if (index < checkpoints->n_stops)
+    {
+      return &checkpoints->stops[index];
+    }
+  return NULL;
+}
+
+size_t
+current_stop (const Checkpoints *checkpoints)
+{
+  assert (checkpoints != NULL);
+  return checkpoints->current;
+}
+
+void
+rewind_to_checkpoint (Checkpoints *checkpoints, size_t number)
+{
+  assert (checkpoints != NULL);
+
+  const Checkpoint *checkpoint = get_checkpoint (checkpoints, number);
+  if (checkpoint != NULL)
+    {
+      checkpoints->current = checkpoint->stop;
+    }
+}
@@ -0,0 +1,98 @@
+/* Checkpoints are forks of the stopped tracee. Since the kernel
+ * shares the memory of a fork with the original process until
+ * either one writes to it, taking a checkpoint is cheap. The fork
+ * stays stopped until the checkpoint is restarted.
+ *
+ * Every stop of the tracee is recorded, so that a stop that lies
+ * in the past can be reached again by restarting the checkpoint
+ * before it and replaying the recorded stops up to it. */
+
+#pragma once
+
+#ifndef _SPRAY_CHECKPOINTS_H_
+#define _SPRAY_CHECKPOINTS_H_
+
+#include "breakpoints.h"
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* How the tracee got to a stop. */
+typedef enum
+{
+  MOVE_CONTINUE,
+  MOVE_STEP,
+  MOVE_NEXT,
+  MOVE_INST,
+  MOVE_LEAVE,
+  MOVE_INTERRUPT,		/* Can't be replayed. */
+} Movement;
+
+typedef struct
+{
+  Movement movement;
+  real_addr pc;			/* 0 if the tracee is gone. */
+  bool is_breakpoint;		/* Stopped at a user breakpoint? */
+} Stop;
+
+typedef struct
+{
+  size_t number;		/* Numbers start at 1. */
+  pid_t pid;			/* The stopped fork. */
+  size_t stop;			/* Number of stops before it was taken. */
+} Checkpoint;
+
+typedef struct Checkpoints Checkpoints;
+
+Checkpoints *init_checkpoints (void);
+
+/* Kill the processes of all checkpoints. */
+void free_checkpoints (Checkpoints * checkpoints);
+
+/* Make the stopped, single-threaded process `pid` call `fork`.
+ * Both processes are stopped in the state `pid` was in before.
+ * `options` are the `PTRACE_O_*` options `pid` was seized with.
+ * The child is traced with `PTRACE_O_EXITKILL` in addition. If
+ * `breakpoints` isn't NULL, their traps are removed from the
+ * child. Returns `SP_ERR` with `errno` set on error. */
+SprayResult fork_stopped_process (pid_t pid, int options,
+				  Breakpoints * breakpoints, pid_t *child);
+
+/* Add the stopped fork `pid` of the tracee as a checkpoint at
+ * the current stop. Returns the number of the checkpoint. */
+size_t add_checkpoint (Checkpoints * checkpoints, pid_t pid);
+
+/* Get the checkpoint with the given number, or NULL. */
+const Checkpoint *get_checkpoint (const Checkpoints * checkpoints,
+				  size_t number);
+
+/* Get the latest checkpoint that was taken at or before
+ * the stop with the index `stop`, or NULL. */
+const Checkpoint *nearest_checkpoint (const Checkpoints * checkpoints,
+				      size_t stop);
+
+/* Get the checkpoints ordered by their number. The length
+ * of the array is `n_checkpoints`. */
+const Checkpoint *all_checkpoints (const Checkpoints * checkpoints,
+				   size_t *n_checkpoints);
+
+/* Record that the tracee reached the next stop. If it's different
+ * from the stop that was recorded at the same position before, all
+ * stops recorded after it are forgotten and the checkpoints taken
+ * after it are deleted: they belong to a future that won't happen
+ * anymore. Returns the number of deleted checkpoints. */
+size_t record_stop (Checkpoints * checkpoints, Stop stop);
+
+/* Get the stop recorded at the position `index`, or NULL. */
+const Stop *recorded_stop (const Checkpoints * checkpoints, size_t index);
+
+/* Number of stops before the current one, i.e. its position. */
+size_t current_stop (const Checkpoints * checkpoints);
+
+/* Go back to the position of the checkpoint `number` after it was
+ * restarted. The stops recorded after it are kept for replaying. */
+void rewind_to_checkpoint (Checkpoints * checkpoints, size_t number);
+
+#endif /* _SPRAY_CHECKPOINTS_H_ */
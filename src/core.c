@@ -0,0 +1,554 @@
+#include "core.h"
+
+#include "spray_elf.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <unistd.h>
+
+enum
+{
+  /* Notes are padded to multiples of this size. */
+  NOTE_ALIGN = 4,
+  /* Words in the header of a `NT_FILE` note:
+   * the number of mappings and the page size. */
+  NT_FILE_HEADER_WORDS = 2,
+  /* Words per mapping in a `NT_FILE` note:
+   * start, end and file offset in pages. */
+  NT_FILE_ENTRY_WORDS = 3,
+};
+
+typedef struct
+{
+  pid_t tid;
+  int signo;
+  struct user_regs_struct regs;
+} CoreThread;
+
+/* A file that was mapped by the process. It's only mapped
+ * into the debugger once memory from it is read. */
+typedef struct
+{
+  const char *filepath;		/* Points into the core. */
+  bool is_mapped;		/* Was mapping the file attempted? */
+  unsigned char *bytes;		/* NULL if the file couldn't be mapped. */
+  size_t n_bytes;
+} CoreMappedFile;
+
+/* A range of the process' memory that's backed by a file. */
+typedef struct
+{
+  real_addr start;
+  real_addr end;
+  uint64_t file_offset;		/* In bytes. */
+  size_t file_idx;		/* Index in `CoreFile.files`. */
+} CoreFileRange;
+
+struct CoreFile
+{
+  ElfFile elf;
+  pid_t pid;
+  char exe_name[sizeof (((struct elf_prpsinfo *) 0)->pr_fname) + 1];
+  CoreThread *threads;
+  size_t n_threads;
+  bool has_siginfo;
+  siginfo_t siginfo;		/* Signal info of the first thread. */
+  const unsigned char *auxv;	/* Points into the core. */
+  size_t auxv_size;
+  CoreFileRange *ranges;
+  size_t n_ranges;
+  CoreMappedFile *files;
+  size_t n_files;
+};
+
+static inline size_t
+align_note (size_t size)
+{
+  return (size + NOTE_ALIGN - 1) & ~((size_t) NOTE_ALIGN - 1);
+}
+
+/* Read the `i`-th word of `bytes`. Notes are only aligned to four bytes. */
+static inline uint64_t
+word_at (const unsigned char *bytes, size_t i)
+{
+  uint64_t word = 0;
+  memcpy (&word, bytes + i * sizeof (word), sizeof (word));
+  return word;
+}
+
+SprayResult
+add_core_thread (CoreFile *core, const unsigned char *desc, size_t desc_size)
+{
+  struct elf_prstatus prstatus;
+  if (desc_size < sizeof (prstatus))
+    {
+      return SP_ERR;
+    }
+  memcpy (&prstatus, desc, sizeof (prstatus));
+
+  CoreThread *threads = realloc (core->threads,
+				 (core->n_threads + 1) * sizeof (*threads));
+  if (threads == NULL)
+    {
+      return SP_ERR;
+    }
+  core->threads = threads;
+
+  CoreThread *thread = &core->threads[core->n_threads++];
+  thread->tid = prstatus.pr_pid;
+  thread->signo = prstatus.pr_cursig;
+  /* `pr_reg` has the same layout as `struct user_regs_struct`. */
+  static_assert (sizeof (prstatus.pr_reg) == sizeof (thread->regs),
+		 "Unexpected size of pr_reg");
+  memcpy (&thread->regs, &prstatus.pr_reg, sizeof (thread->regs));
+
+  return SP_OK;
+}
+
+/* Index of the file `filepath` in `core->files`. Files that are
+ * mapped multiple times, e.g. for code and data, are only added
+ * once. Returns `SP_ERR` if the file couldn't be added. */
+SprayResult
+core_file_idx (CoreFile *core, const char *filepath, size_t *idx)
+{
+  for (size_t i = 0; i < core->n_files; i++)
+    {
+      if (str_eq (core->files[i].filepath, filepath))
+	{
+	  *idx = i;
+	  return SP_OK;
+	}
+    }
+
+  CoreMappedFile *files = realloc (core->files,
+				   (core->n_files + 1) * sizeof (*files));
+  if (files == NULL)
+    {
+      return SP_ERR;
+    }
+  core->files = files;
+  core->files[core->n_files] = (CoreMappedFile)
+  {
+  .filepath = filepath,.is_mapped = false,.bytes = NULL,.n_bytes = 0,};
+  *idx = core->n_files++;
+
+  return SP_OK;
+}
+
+/* Parse a `NT_FILE` note. It lists the files that were mapped
+ * by the process. See `fill_files_note` in the Linux kernel. */
+SprayResult
+parse_file_note (CoreFile *core, const unsigned char *desc, size_t desc_size)
+{
+  if (desc_size < NT_FILE_HEADER_WORDS * sizeof (uint64_t))
+    {
+      return SP_ERR;
+    }
+
+  uint64_t n_entries = word_at (desc, 0);
+  uint64_t page_size = word_at (desc, 1);
+  size_t names_off = (NT_FILE_HEADER_WORDS
+		      + n_entries * NT_FILE_ENTRY_WORDS) * sizeof (uint64_t);
+  if (n_entries > desc_size / sizeof (uint64_t) || names_off > desc_size)
+    {
+      return SP_ERR;
+    }
+
+  core->ranges = calloc (n_entries, sizeof (*core->ranges));
+  if (core->ranges == NULL && n_entries > 0)
+    {
+      return SP_ERR;
+    }
+
+  const char *name = (const char *) desc + names_off;
+  const char *names_end = (const char *) desc + desc_size;
+  for (uint64_t i = 0; i < n_entries; i++)
+    {
+      size_t name_len = strnlen (name, names_end - name);
+      if (name + name_len >= names_end)
+	{
+	  return SP_ERR;
+	}
+
+      size_t entry = NT_FILE_HEADER_WORDS + i * NT_FILE_ENTRY_WORDS;
+      CoreFileRange *range = &core->ranges[core->n_ranges];
+      range->start.value = word_at (desc, entry);
+      range->end.value = word_at (desc, entry + 1);
+      range->file_offset = word_at (desc, entry + 2) * page_size;
+      if (core_file_idx (core, name, &range->file_idx) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      core->n_ranges++;
+
+      name += name_len + 1;
+    }
+
+  return SP_OK;
+}
+
+SprayResult
+parse_note (CoreFile *core, const Elf64_Nhdr *nhdr, const char *name,
+	    const unsigned char *desc)
+{
+  /* All the notes of interest are owned by the core itself. */
+  if (nhdr->n_namesz != sizeof ("CORE") || !str_eq (name, "CORE"))
+    {
+      return SP_OK;
+    }
+
+  switch (nhdr->n_type)
+    {
+    case NT_PRSTATUS:
+      return add_core_thread (core, desc, nhdr->n_descsz);
+    case NT_PRPSINFO:
+      {
+	struct elf_prpsinfo prpsinfo;
+	if (nhdr->n_descsz >= sizeof (prpsinfo))
+	  {
+	    memcpy (&prpsinfo, desc, sizeof (prpsinfo));
+	    core->pid = prpsinfo.pr_pid;
+	    memcpy (core->exe_name, prpsinfo.pr_fname,
+		    sizeof (prpsinfo.pr_fname));
+	  }
+	return SP_OK;
+      }
+    case NT_SIGINFO:
+      if (nhdr->n_descsz >= sizeof (core->siginfo) && !core->has_siginfo)
+	{
+	  memcpy (&core->siginfo, desc, sizeof (core->siginfo));
+	  core->has_siginfo = true;
+	}
+      return SP_OK;
+    case NT_AUXV:
+      core->auxv = desc;
+      core->auxv_size = nhdr->n_descsz;
+      return SP_OK;
+    case NT_FILE:
+      return parse_file_note (core, desc, nhdr->n_descsz);
+    default:
+      return SP_OK;
+    }
+}
+
+/* Parse all notes in the `PT_NOTE` segment described by `phdr`. */
+SprayResult
+parse_notes (CoreFile *core, const Elf64_Phdr *phdr)
+{
+  const unsigned char *bytes = core->elf.data.bytes;
+  if (phdr->p_offset > core->elf.data.n_bytes
+      || phdr->p_filesz > core->elf.data.n_bytes - phdr->p_offset)
+    {
+      return SP_ERR;
+    }
+
+  size_t off = phdr->p_offset;
+  size_t end = phdr->p_offset + phdr->p_filesz;
+  while (off + sizeof (Elf64_Nhdr) <= end)
+    {
+      Elf64_Nhdr nhdr;
+      memcpy (&nhdr, bytes + off, sizeof (nhdr));
+      off += sizeof (nhdr);
+
+      size_t name_off = off;
+      size_t desc_off = name_off + align_note (nhdr.n_namesz);
+      off = desc_off + align_note (nhdr.n_descsz);
+      if (off > end || desc_off > end)
+	{
+	  return SP_ERR;
+	}
+
+      const char *name = (const char *) bytes + name_off;
+      if (nhdr.n_namesz > 0 && name[nhdr.n_namesz - 1] != '\0')
+	{
+	  return SP_ERR;
+	}
+
+      if (parse_note (core, &nhdr, name, bytes + desc_off) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+    }
+
+  return SP_OK;
+}
+
+CoreFile *
+open_core (const char *filepath)
+{
+  assert (filepath != NULL);
+
+  CoreFile *core = calloc (1, sizeof (*core));
+  if (core == NULL)
+    {
+      return NULL;
+    }
+
+  if (se_parse_elf (filepath, &core->elf) != ELF_PARSE_OK)
+    {
+      free (core);
+      return NULL;
+    }
+
+  if (core->elf.type != ELF_TYPE_CORE)
+    {
+      close_core (core);
+      return NULL;
+    }
+
+  const ElfProgTable *prog_table = &core->elf.prog_table;
+  for (size_t i = 0; i < prog_table->n_headers; i++)
+    {
+      if (prog_table->headers[i].p_type == PT_NOTE
+	  && parse_notes (core, &prog_table->headers[i]) == SP_ERR)
+	{
+	  close_core (core);
+	  return NULL;
+	}
+    }
+
+  if (core->n_threads == 0)
+    {
+      close_core (core);
+      return NULL;
+    }
+
+  /* Old cores might not say which process they belong to. */
+  if (core->pid == 0)
+    {
+      core->pid = core->threads[0].tid;
+    }
+
+  return core;
+}
+
+void
+close_core (CoreFile *core)
+{
+  if (core == NULL)
+    {
+      return;
+    }
+
+  for (size_t i = 0; i < core->n_files; i++)
+    {
+      if (core->files[i].bytes != NULL)
+	{
+	  munmap (core->files[i].bytes, core->files[i].n_bytes);
+	}
+    }
+  free (core->files);
+  free (core->ranges);
+  free (core->threads);
+  se_free_elf (core->elf);
+  free (core);
+}
+
+pid_t
+core_pid (const CoreFile *core)
+{
+  assert (core != NULL);
+  return core->pid;
+}
+
+size_t
+core_n_threads (const CoreFile *core)
+{
+  assert (core != NULL);
+  return core->n_threads;
+}
+
+pid_t
+core_thread (const CoreFile *core, size_t i)
+{
+  assert (core != NULL);
+  assert (i < core->n_threads);
+  return core->threads[i].tid;
+}
+
+const char *
+core_exe_name (const CoreFile *core)
+{
+  assert (core != NULL);
+  return core->exe_name[0] != '\0' ? core->exe_name : NULL;
+}
+
+const CoreThread *
+get_core_thread (const CoreFile *core, pid_t tid)
+{
+  for (size_t i = 0; i < core->n_threads; i++)
+    {
+      if (core->threads[i].tid == tid)
+	{
+	  return &core->threads[i];
+	}
+    }
+  return NULL;
+}
+
+SprayResult
+core_registers (const CoreFile *core, pid_t tid,
+		struct user_regs_struct *regs)
+{
+  assert (core != NULL);
+  assert (regs != NULL);
+
+  const CoreThread *thread = get_core_thread (core, tid);
+  if (thread == NULL)
+    {
+      return SP_ERR;
+    }
+
+  *regs = thread->regs;
+  return SP_OK;
+}
+
+SprayResult
+core_signal_info (const CoreFile *core, pid_t tid, siginfo_t *siginfo)
+{
+  assert (core != NULL);
+  assert (siginfo != NULL);
+
+  const CoreThread *thread = get_core_thread (core, tid);
+  if (thread == NULL)
+    {
+      return SP_ERR;
+    }
+
+  if (thread == &core->threads[0] && core->has_siginfo)
+    {
+      *siginfo = core->siginfo;
+    }
+  else
+    {
+      memset (siginfo, 0, sizeof (*siginfo));
+      siginfo->si_signo = thread->signo;
+    }
+
+  return SP_OK;
+}
+
+SprayResult
+core_auxv_value (const CoreFile *core, uint64_t type, uint64_t *value)
+{
+  assert (core != NULL);
+  assert (value != NULL);
+
+  size_t n_entries = core->auxv_size / sizeof (Elf64_auxv_t);
+  for (size_t i = 0; i < n_entries; i++)
+    {
+      Elf64_auxv_t entry;
+      memcpy (&entry, core->auxv + i * sizeof (entry), sizeof (entry));
+      if (entry.a_type == AT_NULL)
+	{
+	  break;
+	}
+      else if (entry.a_type == type)
+	{
+	  *value = entry.a_un.a_val;
+	  return SP_OK;
+	}
+    }
+
+  return SP_ERR;
+}
+
+/* Map the file into the debugger's memory unless that was tried already. */
+void
+map_core_file (CoreMappedFile *file)
+{
+  if (file->is_mapped)
+    {
+      return;
+    }
+  file->is_mapped = true;
+
+  int fd = open (file->filepath, O_RDONLY);
+  if (fd == -1)
+    {
+      return;
+    }
+
+  off_t n_bytes = lseek (fd, 0, SEEK_END);
+  if (n_bytes > 0)
+    {
+      void *bytes = mmap (NULL, n_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (bytes != MAP_FAILED)
+	{
+	  file->bytes = bytes;
+	  file->n_bytes = (size_t) n_bytes;
+	}
+    }
+
+  close (fd);
+}
+
+/* Is the range of `n_bytes` at `addr` inside of `[start, start + size)`? */
+static inline bool
+is_inside (real_addr addr, size_t n_bytes, uint64_t start, uint64_t size)
+{
+  return addr.value >= start && addr.value - start <= size
+    && n_bytes <= size - (addr.value - start);
+}
+
+const unsigned char *
+core_memory (CoreFile *core, real_addr addr, size_t n_bytes)
+{
+  assert (core != NULL);
+
+  /* Memory that was dumped is found in the `PT_LOAD` segments. */
+  const ElfProgTable *prog_table = &core->elf.prog_table;
+  for (size_t i = 0; i < prog_table->n_headers; i++)
+    {
+      const Elf64_Phdr *phdr = &prog_table->headers[i];
+      if (phdr->p_type == PT_LOAD
+	  && is_inside (addr, n_bytes, phdr->p_vaddr, phdr->p_filesz)
+	  && phdr->p_offset + phdr->p_filesz <= core->elf.data.n_bytes)
+	{
+	  return core->elf.data.bytes + phdr->p_offset
+	    + (addr.value - phdr->p_vaddr);
+	}
+    }
+
+  /* By default, the kernel doesn't dump mappings of files that
+   * weren't written to, e.g. code. Read them from the files. */
+  for (size_t i = 0; i < core->n_ranges; i++)
+    {
+      const CoreFileRange *range = &core->ranges[i];
+      if (!is_inside (addr, n_bytes, range->start.value,
+		      range->end.value - range->start.value))
+	{
+	  continue;
+	}
+
+      CoreMappedFile *file = &core->files[range->file_idx];
+      map_core_file (file);
+      uint64_t file_offset =
+	range->file_offset + (addr.value - range->start.value);
+      if (file->bytes != NULL && file_offset <= file->n_bytes
+	  && n_bytes <= file->n_bytes - file_offset)
+	{
+	  return file->bytes + file_offset;
+	}
+    }
+
+  return NULL;
+}
+
+SprayResult
+core_read_memory (CoreFile *core, real_addr addr, uint64_t *read)
+{
+  assert (read != NULL);
+
+  const unsigned char *bytes = core_memory (core, addr, sizeof (*read));
+  if (bytes == NULL)
+    {
+      return SP_ERR;
+    }
+
+  memcpy (read, bytes, sizeof (*read));
+  return SP_OK;
+}
@@ -0,0 +1,67 @@
+/* Read the state of a crashed process from its core dump. The core
+ * is mapped into memory once, and reads of the process' memory and
+ * registers are served straight from the mapping without copying
+ * whole segments. */
+
+#pragma once
+
+#ifndef _SPRAY_CORE_H_
+#define _SPRAY_CORE_H_
+
+#include "magic.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+typedef struct CoreFile CoreFile;
+
+/* Map the core dump at `filepath` and parse its notes. Returns
+ * NULL if the file can't be read or isn't a core dump. */
+CoreFile *open_core (const char *filepath);
+
+void close_core (CoreFile * core);
+
+/* Id of the process that the core was dumped from. */
+pid_t core_pid (const CoreFile * core);
+
+/* Number of threads the process had when it was dumped. */
+size_t core_n_threads (const CoreFile * core);
+
+/* Id of the `i`-th thread in the core. The first thread
+ * is the one that received the signal that caused the dump. */
+pid_t core_thread (const CoreFile * core, size_t i);
+
+/* Name of the executable as recorded in the core, or NULL. */
+const char *core_exe_name (const CoreFile * core);
+
+/* Get the registers of the thread `tid` when it was dumped. Returns
+ * `SP_ERR` if the core has no such thread. */
+SprayResult core_registers (const CoreFile * core, pid_t tid,
+			    struct user_regs_struct *regs);
+
+/* Get the signal that the thread `tid` received. `si_code` is
+ * only known for the first thread. Returns `SP_ERR` if the core
+ * has no such thread. */
+SprayResult core_signal_info (const CoreFile * core, pid_t tid,
+			      siginfo_t * siginfo);
+
+/* Get the value of the auxiliary vector entry `type`, e.g.
+ * `AT_ENTRY`. Returns `SP_ERR` if there is no such entry. */
+SprayResult core_auxv_value (const CoreFile * core, uint64_t type,
+			     uint64_t *value);
+
+/* Get a pointer to `n_bytes` of the process' memory starting at
+ * `addr`. Memory that isn't part of the core, e.g. the code of
+ * the executable, is read from the files that were mapped by the
+ * process. Returns NULL if the memory isn't available. */
+const unsigned char *core_memory (CoreFile * core, real_addr addr,
+				  size_t n_bytes);
+
+/* Read a word of the process' memory. Returns `SP_ERR`
+ * if the memory isn't available. */
+SprayResult core_read_memory (CoreFile * core, real_addr addr,
+			      uint64_t *read);
+
+#endif /* _SPRAY_CORE_H_ */
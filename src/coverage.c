@@ -0,0 +1,365 @@
+/* Required to use `qsort_r` */
+#define _GNU_SOURCE
+
+#include "coverage.h"
+
+#include "magic.h"
+#include "hashmap.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* A statement with a one-shot breakpoint on it. */
+typedef struct
+{
+  real_addr addr;
+  size_t file_idx;		/* Index into `Coverage.filepaths`. */
+  uint32_t line;
+  bool is_hit;
+} CoverageSite;
+
+/* Entry in the map used to look up sites by their address. */
+typedef struct
+{
+  real_addr addr;
+  size_t site_idx;
+} SiteIndex;
+
+struct Coverage
+{
+  char **filepaths;
+  size_t n_filepaths;
+  CoverageSite *sites;
+  size_t n_sites;
+  size_t n_alloc;
+  struct hashmap *index;
+};
+
+enum
+{
+  COVERAGE_ALLOC_SIZE = 256,
+};
+
+int
+site_index_compare (const void *a, const void *b, void *udata)
+{
+  unused (udata);
+  const SiteIndex *index_a = (SiteIndex *) a;
+  const SiteIndex *index_b = (SiteIndex *) b;
+  return !(index_a->addr.value == index_b->addr.value);
+}
+
+uint64_t
+site_index_hash (const void *entry, uint64_t seed0, uint64_t seed1)
+{
+  const SiteIndex *index = (SiteIndex *) entry;
+  uint64_t addr = index->addr.value;
+  return hashmap_sip (&addr, sizeof (addr), seed0, seed1);
+}
+
+/* Return the index of `filepath` in the file list of `cov`
+ * and add it to the list if it isn't there yet. */
+size_t
+coverage_file_idx (Coverage *cov, const char *filepath)
+{
+  assert (cov != NULL);
+  assert (filepath != NULL);
+
+  /* Consecutive statements are usually in the same
+   * file so start searching at the end of the list. */
+  for (size_t i = cov->n_filepaths; i > 0; i--)
+    {
+      if (str_eq (cov->filepaths[i - 1], filepath))
+	{
+	  return i - 1;
+	}
+    }
+
+  cov->filepaths = realloc (cov->filepaths,
+			    sizeof (char *) * (cov->n_filepaths + 1));
+  assert (cov->filepaths != NULL);
+  cov->filepaths[cov->n_filepaths] = strdup (filepath);
+  assert (cov->filepaths[cov->n_filepaths] != NULL);
+
+  return cov->n_filepaths++;
+}
+
+typedef struct
+{
+  Coverage *cov;
+  Breakpoints *breakpoints;
+  real_addr load_address;
+} CoverageInitData;
+
+SprayResult
+callback__add_coverage_site (const char *filepath,
+			     const Position *pos,
+			     dbg_addr addr, void *void_data)
+{
+  assert (filepath != NULL);
+  assert (pos != NULL);
+  assert (void_data != NULL);
+
+  CoverageInitData *data = (CoverageInitData *) void_data;
+  Coverage *cov = data->cov;
+  real_addr site_addr = dbg_to_real (data->load_address, addr);
+
+  /* Several line table rows may share the same address.
+   * Only the first of them gets a breakpoint. */
+  SiteIndex lookup = {.addr = site_addr };
+  if (hashmap_get (cov->index, &lookup) != NULL)
+    {
+      return SP_OK;
+    }
+
+  if (enable_breakpoint (data->breakpoints, site_addr) == SP_ERR)
+    {
+      /* Skip addresses that can't be written to. */
+      return SP_OK;
+    }
+
+  if (cov->n_sites >= cov->n_alloc)
+    {
+      cov->n_alloc += COVERAGE_ALLOC_SIZE;
+      cov->sites = realloc (cov->sites, sizeof (*cov->sites) * cov->n_alloc);
+      assert (cov->sites != NULL);
+    }
+
+  cov->sites[cov->n_sites] = (CoverageSite)
+  {
+    .addr = site_addr,
+    .file_idx = coverage_file_idx (cov, filepath),
+    .line = pos->line,
+    .is_hit = false,
+  };
+
+  SiteIndex index = {.addr = site_addr,.site_idx = cov->n_sites };
+  hashmap_set (cov->index, &index);
+
+  cov->n_sites++;
+
+  return SP_OK;
+}
+
+Coverage *
+init_coverage (DebugInfo *info,
+	       real_addr load_address, Breakpoints *breakpoints)
+{
+  if (info == NULL || breakpoints == NULL)
+    {
+      return NULL;
+    }
+
+  Coverage *cov = calloc (1, sizeof (*cov));
+  if (cov == NULL)
+    {
+      return NULL;
+    }
+
+  cov->index = hashmap_new (sizeof (SiteIndex), 0, 0, 0,
+			    site_index_hash, site_index_compare, NULL, NULL);
+  if (cov->index == NULL)
+    {
+      free (cov);
+      return NULL;
+    }
+
+  CoverageInitData data = {
+    .cov = cov,
+    .breakpoints = breakpoints,
+    .load_address = load_address,
+  };
+
+  if (for_each_statement (info, callback__add_coverage_site, &data) ==
+      SP_ERR)
+    {
+      for (size_t i = 0; i < cov->n_sites; i++)
+	{
+	  disable_breakpoint (breakpoints, cov->sites[i].addr);
+	}
+      free_coverage (cov);
+      return NULL;
+    }
+
+  return cov;
+}
+
+void
+free_coverage (Coverage *cov)
+{
+  if (cov != NULL)
+    {
+      for (size_t i = 0; i < cov->n_filepaths; i++)
+	{
+	  free (cov->filepaths[i]);
+	}
+      free (cov->filepaths);
+      free (cov->sites);
+      hashmap_free (cov->index);
+      free (cov);
+    }
+}
+
+bool
+record_coverage (Coverage *cov, Breakpoints *breakpoints, real_addr pc)
+{
+  assert (cov != NULL);
+  assert (breakpoints != NULL);
+
+  SiteIndex lookup = {.addr = pc };
+  const SiteIndex *index = hashmap_get (cov->index, &lookup);
+  if (index == NULL)
+    {
+      return false;
+    }
+
+  CoverageSite *site = &cov->sites[index->site_idx];
+  if (site->is_hit)
+    {
+      return false;
+    }
+
+  site->is_hit = true;
+  disable_breakpoint (breakpoints, pc);
+
+  return true;
+}
+
+/* `qsort_r` comparison function that orders sites
+ * by their file path first and their line second. */
+int
+compare_sites (const void *a, const void *b, void *void_cov)
+{
+  const Coverage *cov = (const Coverage *) void_cov;
+  const CoverageSite *site_a = &cov->sites[*(const size_t *) a];
+  const CoverageSite *site_b = &cov->sites[*(const size_t *) b];
+
+  int cmp_files = strcmp (cov->filepaths[site_a->file_idx],
+			  cov->filepaths[site_b->file_idx]);
+  if (cmp_files != 0)
+    {
+      return cmp_files;
+    }
+  else if (site_a->line != site_b->line)
+    {
+      return site_a->line < site_b->line ? -1 : 1;
+    }
+  else
+    {
+      return 0;
+    }
+}
+
+/* Return the indices of all sites in `cov` sorted by their
+ * position in the source. The caller must free the array. */
+size_t *
+sorted_sites (const Coverage *cov)
+{
+  assert (cov != NULL);
+
+  size_t *order = calloc (cov->n_sites + 1, sizeof (size_t));
+  assert (order != NULL);
+
+  for (size_t i = 0; i < cov->n_sites; i++)
+    {
+      order[i] = i;
+    }
+
+  qsort_r (order, cov->n_sites, sizeof (size_t), compare_sites,
+	   (void *) cov);
+
+  return order;
+}
+
+/* Is the site at `order[i]` on the same line as the one before? */
+bool
+is_same_line (const Coverage *cov, const size_t *order, size_t i)
+{
+  return i > 0 && compare_sites (&order[i - 1], &order[i], (void *) cov) == 0;
+}
+
+void
+coverage_summary (const Coverage *cov, size_t *n_lines, size_t *n_hit)
+{
+  assert (cov != NULL);
+  assert (n_lines != NULL);
+  assert (n_hit != NULL);
+
+  size_t *order = sorted_sites (cov);
+  *n_lines = 0;
+  *n_hit = 0;
+
+  for (size_t i = 0; i < cov->n_sites;)
+    {
+      /* A line is covered if any of its statements were executed. */
+      bool is_hit = false;
+      do
+	{
+	  is_hit = is_hit || cov->sites[order[i]].is_hit;
+	  i++;
+	}
+      while (i < cov->n_sites && is_same_line (cov, order, i));
+
+      (*n_lines)++;
+      if (is_hit)
+	{
+	  (*n_hit)++;
+	}
+    }
+
+  free (order);
+}
+
+SprayResult
+write_lcov (const Coverage *cov, const char *filepath)
+{
+  assert (cov != NULL);
+  assert (filepath != NULL);
+
+  FILE *file = fopen (filepath, "w");
+  if (file == NULL)
+    {
+      return SP_ERR;
+    }
+
+  size_t *order = sorted_sites (cov);
+
+  for (size_t i = 0; i < cov->n_sites;)
+    {
+      size_t file_idx = cov->sites[order[i]].file_idx;
+      size_t n_lines = 0;
+      size_t n_hit = 0;
+
+      fprintf (file, "TN:\nSF:%s\n", cov->filepaths[file_idx]);
+
+      while (i < cov->n_sites && cov->sites[order[i]].file_idx == file_idx)
+	{
+	  uint32_t line = cov->sites[order[i]].line;
+	  bool is_hit = false;
+	  do
+	    {
+	      is_hit = is_hit || cov->sites[order[i]].is_hit;
+	      i++;
+	    }
+	  while (i < cov->n_sites && is_same_line (cov, order, i));
+
+	  fprintf (file, "DA:%u,%d\n", line, is_hit ? 1 : 0);
+	  n_lines++;
+	  if (is_hit)
+	    {
+	      n_hit++;
+	    }
+	}
+
+      fprintf (file, "LF:%zu\nLH:%zu\nend_of_record\n", n_lines, n_hit);
+    }
+
+  free (order);
+
+  if (fclose (file) != 0)
+    {
+      return SP_ERR;
+    }
+
+  return SP_OK;
+}
@@ -0,0 +1,40 @@
+/* Line coverage using one-shot breakpoints. */
+
+#pragma once
+
+#ifndef _SPRAY_COVERAGE_H_
+#define _SPRAY_COVERAGE_H_
+
+#include "breakpoints.h"
+#include "info.h"
+
+#include <stdbool.h>
+
+typedef struct Coverage Coverage;
+
+/* Place a breakpoint on every address where a new statement
+ * begins. Each of these breakpoints is removed again the
+ * first time it's hit, so the overhead of tracing the program
+ * decays as more of it is covered. Returns NULL on error. */
+Coverage *init_coverage (DebugInfo * info,
+			 real_addr load_address, Breakpoints * breakpoints);
+
+void free_coverage (Coverage * cov);
+
+/* Record that the statement at `pc` was executed and remove
+ * the breakpoint on it. Returns `true` if `pc` is the address
+ * of a statement that wasn't covered yet. */
+bool record_coverage (Coverage * cov, Breakpoints * breakpoints,
+		      real_addr pc);
+
+/* Get the number of source lines that were instrumented
+ * and the number of those lines that were executed. */
+void coverage_summary (const Coverage * cov, size_t *n_lines,
+		       size_t *n_hit);
+
+/* Write the recorded coverage to `filepath` in the lcov
+ * tracefile format. Since each breakpoint is only hit
+ * once, the execution count of every covered line is 1. */
+SprayResult write_lcov (const Coverage * cov, const char *filepath);
+
+#endif /* _SPRAY_COVERAGE_H_ */
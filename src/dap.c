@@ -0,0 +1,1092 @@
+/* Required to use `asprintf`. */
+#define _GNU_SOURCE
+
+#include "dap.h"
+#include "debugger.h"
+#include "registers.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>		/* `INT_MAX`, `UINT_MAX` */
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+
+enum
+{
+  /* Headers longer than this are broken. */
+  DAP_HEADER_BUF_SIZE = 256,
+  /* Bigger messages are refused instead of being read into memory. */
+  DAP_MAX_MESSAGE_SIZE = 1 << 24,
+};
+
+/* Read the headers of the next message and get the length of its
+ * content. Returns `SP_ERR` at the end of the input or on error. */
+SprayResult
+read_dap_headers (FILE *in, size_t *length)
+{
+  char header[DAP_HEADER_BUF_SIZE];
+  bool has_length = false;
+
+  while (fgets (header, sizeof (header), in) != NULL)
+    {
+      if (strchr (header, '\n') == NULL)
+	{
+	  return SP_ERR;
+	}
+
+      /* An empty line ends the headers. */
+      header[strcspn (header, "\r\n")] = '\0';
+      if (header[0] == '\0')
+	{
+	  return has_length ? SP_OK : SP_ERR;
+	}
+
+      const char *name = "Content-Length:";
+      if (strncasecmp (header, name, strlen (name)) == 0)
+	{
+	  char *end = NULL;
+	  unsigned long long value = strtoull (header + strlen (name),
+					       &end, 10);
+	  if (end == header + strlen (name) || *end != '\0'
+	      || value > DAP_MAX_MESSAGE_SIZE)
+	    {
+	      return SP_ERR;
+	    }
+	  *length = value;
+	  has_length = true;
+	}
+    }
+
+  return SP_ERR;
+}
+
+JsonValue *
+read_dap_message (DapConnection *conn)
+{
+  assert (conn != NULL);
+
+  size_t length = 0;
+  while (read_dap_headers (conn->in, &length) == SP_OK)
+    {
+      char *content = malloc (length + 1);
+      assert (content != NULL);
+      if (fread (content, 1, length, conn->in) != length)
+	{
+	  free (content);
+	  return NULL;
+	}
+      content[length] = '\0';
+
+      JsonValue *message = parse_json (content);
+      free (content);
+      if (message != NULL && message->kind == JSON_OBJECT)
+	{
+	  return message;
+	}
+      free_json (message);
+    }
+
+  return NULL;
+}
+
+SprayResult
+start_dap_message (DapConnection *conn, DapMessage *msg, const char *type)
+{
+  *msg = (DapMessage) { 0 };
+  msg->stream = open_memstream (&msg->buf, &msg->size);
+  if (msg->stream == NULL)
+    {
+      return SP_ERR;
+    }
+
+  fprintf (msg->stream, "{\"seq\":%" PRId64 ",\"type\":\"%s\"",
+	   ++conn->seq, type);
+  return SP_OK;
+}
+
+SprayResult
+start_dap_response (DapConnection *conn, DapMessage *msg,
+		    const JsonValue *request, const char *error)
+{
+  assert (conn != NULL);
+  assert (msg != NULL);
+  assert (request != NULL);
+
+  if (start_dap_message (conn, msg, "response") == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  int64_t request_seq = 0;
+  json_int_member (request, "seq", &request_seq);
+  const char *command = json_string_member (request, "command");
+
+  fprintf (msg->stream, ",\"request_seq\":%" PRId64 ",\"command\":",
+	   request_seq);
+  print_json_string (msg->stream, command != NULL ? command : "");
+  fprintf (msg->stream, ",\"success\":%s", error == NULL ? "true" : "false");
+  if (error != NULL)
+    {
+      fprintf (msg->stream, ",\"message\":");
+      print_json_string (msg->stream, error);
+    }
+  fprintf (msg->stream, ",\"body\":{");
+  return SP_OK;
+}
+
+SprayResult
+start_dap_event (DapConnection *conn, DapMessage *msg, const char *event)
+{
+  assert (conn != NULL);
+  assert (msg != NULL);
+  assert (event != NULL);
+
+  if (start_dap_message (conn, msg, "event") == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  fprintf (msg->stream, ",\"event\":");
+  print_json_string (msg->stream, event);
+  fprintf (msg->stream, ",\"body\":{");
+  return SP_OK;
+}
+
+void
+send_dap_message (DapConnection *conn, DapMessage *msg)
+{
+  assert (conn != NULL);
+  assert (msg != NULL);
+
+  fprintf (msg->stream, "}}");
+  fclose (msg->stream);
+
+  fprintf (conn->out, "Content-Length: %zu\r\n\r\n", msg->size);
+  fwrite (msg->buf, 1, msg->size, conn->out);
+  fflush (conn->out);
+
+  free (msg->buf);
+  *msg = (DapMessage) { 0 };
+}
+
+void
+send_dap_response (DapConnection *conn, const JsonValue *request,
+		   const char *error)
+{
+  DapMessage msg = { 0 };
+  if (start_dap_response (conn, &msg, request, error) == SP_OK)
+    {
+      send_dap_message (conn, &msg);
+    }
+}
+
+void
+send_dap_event (DapConnection *conn, const char *event)
+{
+  DapMessage msg = { 0 };
+  if (start_dap_event (conn, &msg, event) == SP_OK)
+    {
+      send_dap_message (conn, &msg);
+    }
+}
+
+/* Scopes of each call frame. A variable reference encodes the frame
+ * and the scope so that no table of references has to be kept. */
+typedef enum
+{
+  DAP_SCOPE_LOCALS,
+  DAP_SCOPE_REGISTERS,
+  DAP_N_SCOPES,
+} DapScope;
+
+typedef struct
+{
+  char *name;
+  char *value;
+} DapVariable;
+
+/* A call frame at the current stop and its variables. The
+ * variables of a scope are read the first time they're requested. */
+typedef struct
+{
+  const CallFrame *frame;
+  DapVariable *vars[DAP_N_SCOPES];
+  size_t n_vars[DAP_N_SCOPES];
+  bool has_vars[DAP_N_SCOPES];
+} DapFrame;
+
+/* Breakpoints that were set in a source file. */
+typedef struct
+{
+  char *filepath;
+  real_addr *addrs;
+  size_t n_addrs;
+} DapSourceBreakpoints;
+
+typedef struct
+{
+  Debugger *dbg;
+  DapConnection conn;
+  /* Editors ask for the frames, scopes and variables of several
+   * frames after each stop. They're collected once per stop and
+   * all requests are answered from there. Frame ids are indices
+   * into `frames`, so they're only valid for a single stop. */
+  DapFrame *frames;		/* NULL until requested. */
+  size_t n_frames;
+  size_t n_stops;		/* `dbg->n_stops` when the frames were
+				 * collected. */
+  pid_t tid;			/* Thread the frames belong to. */
+  DapSourceBreakpoints *sources;
+  size_t n_sources;
+  real_addr *function_addrs;	/* Addresses of function breakpoints. */
+  size_t n_function_addrs;
+  bool stop_on_entry;
+  bool is_done;
+} DapServer;
+
+/* Drop everything collected at the current stop. */
+void
+forget_dap_stop (DapServer *server)
+{
+  for (size_t i = 0; i < server->n_frames; i++)
+    {
+      for (size_t scope = 0; scope < DAP_N_SCOPES; scope++)
+	{
+	  for (size_t j = 0; j < server->frames[i].n_vars[scope]; j++)
+	    {
+	      free (server->frames[i].vars[scope][j].name);
+	      free (server->frames[i].vars[scope][j].value);
+	    }
+	  free (server->frames[i].vars[scope]);
+	}
+    }
+  free (server->frames);
+  server->frames = NULL;
+  server->n_frames = 0;
+}
+
+/* Get the call frames at the current stop. */
+const DapFrame *
+dap_frames (DapServer *server, size_t *n_frames)
+{
+  Debugger *dbg = server->dbg;
+  if (server->frames != NULL
+      && (server->n_stops != dbg->n_stops || server->tid != dbg->pid))
+    {
+      forget_dap_stop (server);
+    }
+
+  if (server->frames == NULL && is_tracee_alive (dbg))
+    {
+      for (const CallFrame *frame = get_call_frames (dbg); frame != NULL;
+	   frame = frame_caller (frame))
+	{
+	  server->frames = realloc (server->frames, (server->n_frames + 1)
+				    * sizeof (*server->frames));
+	  assert (server->frames != NULL);
+	  server->frames[server->n_frames++] = (DapFrame) {.frame = frame };
+	}
+      server->n_stops = dbg->n_stops;
+      server->tid = dbg->pid;
+    }
+
+  *n_frames = server->n_frames;
+  return server->frames;
+}
+
+/* Send `output` to be shown in the editor's debug console. */
+void
+send_dap_output (DapServer *server, const char *output)
+{
+  if (output == NULL || *output == '\0')
+    {
+      return;
+    }
+
+  DapMessage msg = { 0 };
+  if (start_dap_event (&server->conn, &msg, "output") == SP_OK)
+    {
+      fprintf (msg.stream, "\"category\":\"console\",\"output\":");
+      print_json_string (msg.stream, output);
+      send_dap_message (&server->conn, &msg);
+    }
+}
+
+/* Tell the editor where the tracee stopped, or that it exited. */
+void
+send_dap_stop (DapServer *server, const char *reason)
+{
+  Debugger *dbg = server->dbg;
+  DapMessage msg = { 0 };
+
+  if (is_tracee_alive (dbg))
+    {
+      if (start_dap_event (&server->conn, &msg, "stopped") == SP_OK)
+	{
+	  fprintf (msg.stream, "\"reason\":\"%s\",\"threadId\":%d,"
+		   "\"allThreadsStopped\":true", reason, dbg->pid);
+	  send_dap_message (&server->conn, &msg);
+	}
+      return;
+    }
+
+  if (start_dap_event (&server->conn, &msg, "exited") == SP_OK)
+    {
+      int code = WIFSIGNALED (dbg->exit_status)
+	? 128 + WTERMSIG (dbg->exit_status) : WEXITSTATUS (dbg->exit_status);
+      fprintf (msg.stream, "\"exitCode\":%d", code);
+      send_dap_message (&server->conn, &msg);
+    }
+  send_dap_event (&server->conn, "terminated");
+}
+
+void
+dap_initialize (DapServer *server, const JsonValue *request,
+		const JsonValue *args)
+{
+  (void) args;
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_OK)
+    {
+      fprintf (msg.stream, "\"supportsConfigurationDoneRequest\":true,"
+	       "\"supportsFunctionBreakpoints\":true");
+      send_dap_message (&server->conn, &msg);
+    }
+
+  /* Breakpoints can be set from now on. */
+  send_dap_event (&server->conn, "initialized");
+}
+
+/* The tracee was started or attached to on the command line already. */
+void
+dap_launch (DapServer *server, const JsonValue *request,
+	    const JsonValue *args)
+{
+  server->stop_on_entry = json_bool_member (args, "stopOnEntry", false);
+  send_dap_response (&server->conn, request, NULL);
+}
+
+/* Delete the breakpoints at `addrs` and free the array. */
+void
+delete_dap_breakpoints (DapServer *server, real_addr *addrs, size_t n_addrs)
+{
+  for (size_t i = 0; i < n_addrs; i++)
+    {
+      exec_delete (server->dbg->breakpoints, addrs[i]);
+    }
+  free (addrs);
+}
+
+void
+dap_set_breakpoints (DapServer *server, const JsonValue *request,
+		     const JsonValue *args)
+{
+  Debugger *dbg = server->dbg;
+  const char *filepath = json_string_member (json_member (args, "source"),
+					     "path");
+  const JsonValue *breakpoints = json_member (args, "breakpoints");
+  if (filepath == NULL)
+    {
+      send_dap_response (&server->conn, request, "Missing source path");
+      return;
+    }
+  if (dbg->core != NULL)
+    {
+      send_dap_response (&server->conn, request,
+			 "A core dump can't be run or changed");
+      return;
+    }
+
+  DapSourceBreakpoints *source = NULL;
+  for (size_t i = 0; i < server->n_sources; i++)
+    {
+      if (str_eq (server->sources[i].filepath, filepath))
+	{
+	  source = &server->sources[i];
+	}
+    }
+  if (source == NULL)
+    {
+      server->sources = realloc (server->sources, (server->n_sources + 1)
+				 * sizeof (*server->sources));
+      assert (server->sources != NULL);
+      source = &server->sources[server->n_sources++];
+      *source = (DapSourceBreakpoints) {.filepath = strdup (filepath) };
+      assert (source->filepath != NULL);
+    }
+
+  /* The request replaces all breakpoints in the file. */
+  delete_dap_breakpoints (server, source->addrs, source->n_addrs);
+  source->addrs = NULL;
+  source->n_addrs = 0;
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_ERR)
+    {
+      return;
+    }
+
+  fprintf (msg.stream, "\"breakpoints\":[");
+  size_t n_items = breakpoints != NULL && breakpoints->kind == JSON_ARRAY
+    ? breakpoints->array.n_items : 0;
+  for (size_t i = 0; i < n_items; i++)
+    {
+      int64_t line = 0;
+      dbg_addr addr = { 0 };
+      bool is_verified =
+	json_int_member (&breakpoints->array.items[i], "line", &line) == SP_OK
+	&& line > 0 && line <= UINT_MAX
+	&& addr_at (filepath, line, dbg->info, &addr) == SP_OK;
+
+      fprintf (msg.stream, "%s{\"verified\":%s,\"line\":%" PRId64,
+	       i == 0 ? "" : ",", is_verified ? "true" : "false", line);
+      if (is_verified)
+	{
+	  real_addr real = dbg_to_real (dbg->load_address, addr);
+	  exec_break (dbg->breakpoints, real);
+	  source->addrs = realloc (source->addrs, (source->n_addrs + 1)
+				   * sizeof (*source->addrs));
+	  assert (source->addrs != NULL);
+	  source->addrs[source->n_addrs++] = real;
+	}
+      else
+	{
+	  fprintf (msg.stream, ",\"message\":\"There is no code at line %"
+		   PRId64 "\"", line);
+	}
+      fprintf (msg.stream, "}");
+    }
+  fprintf (msg.stream, "]");
+  send_dap_message (&server->conn, &msg);
+}
+
+void
+dap_set_function_breakpoints (DapServer *server, const JsonValue *request,
+			      const JsonValue *args)
+{
+  Debugger *dbg = server->dbg;
+  if (dbg->core != NULL)
+    {
+      send_dap_response (&server->conn, request,
+			 "A core dump can't be run or changed");
+      return;
+    }
+
+  delete_dap_breakpoints (server, server->function_addrs,
+			  server->n_function_addrs);
+  server->function_addrs = NULL;
+  server->n_function_addrs = 0;
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_ERR)
+    {
+      return;
+    }
+
+  const JsonValue *breakpoints = json_member (args, "breakpoints");
+  size_t n_items = breakpoints != NULL && breakpoints->kind == JSON_ARRAY
+    ? breakpoints->array.n_items : 0;
+  fprintf (msg.stream, "\"breakpoints\":[");
+  for (size_t i = 0; i < n_items; i++)
+    {
+      /* Locations are the same as those of the `break` command. */
+      const char *name = json_string_member (&breakpoints->array.items[i],
+					     "name");
+      dbg_addr addr = { 0 };
+      bool is_verified = name != NULL
+	&& parse_break_location (*dbg, name, &addr) == SP_OK;
+
+      fprintf (msg.stream, "%s{\"verified\":%s", i == 0 ? "" : ",",
+	       is_verified ? "true" : "false");
+      if (is_verified)
+	{
+	  real_addr real = dbg_to_real (dbg->load_address, addr);
+	  exec_break (dbg->breakpoints, real);
+	  server->function_addrs = realloc (server->function_addrs,
+					    (server->n_function_addrs + 1)
+					    * sizeof (*server->function_addrs));
+	  assert (server->function_addrs != NULL);
+	  server->function_addrs[server->n_function_addrs++] = real;
+	}
+      else
+	{
+	  fprintf (msg.stream, ",\"message\":\"There is no such function "
+		   "or location\"");
+	}
+      fprintf (msg.stream, "}");
+    }
+  fprintf (msg.stream, "]");
+  send_dap_message (&server->conn, &msg);
+}
+
+/* Move the tracee, and report where it stopped once it did. */
+void
+dap_move (DapServer *server, Movement movement)
+{
+  Debugger *dbg = server->dbg;
+
+  Capture capture = { 0 };
+  if (start_capture (&capture) == SP_ERR)
+    {
+      return;
+    }
+  move_tracee (dbg, movement);
+  stop_capture (&capture);
+  send_dap_output (server, capture.buf);
+  free (capture.buf);
+
+  const char *reason = "step";
+  if (movement == MOVE_CONTINUE)
+    {
+      reason = is_tracee_alive (dbg) && is_user_breakpoint (dbg)
+	? "breakpoint" : "exception";
+    }
+  send_dap_stop (server, reason);
+}
+
+void
+dap_configuration_done (DapServer *server, const JsonValue *request,
+			const JsonValue *args)
+{
+  (void) args;
+
+  send_dap_response (&server->conn, request, NULL);
+
+  /* Attached processes and core dumps are inspected where they
+   * stopped, just like the tracee is without `--dap`. */
+  Debugger *dbg = server->dbg;
+  if (server->stop_on_entry || dbg->is_attached || dbg->core != NULL
+      || !is_tracee_alive (dbg))
+    {
+      send_dap_stop (server, "entry");
+    }
+  else
+    {
+      dap_move (server, MOVE_CONTINUE);
+    }
+}
+
+void
+dap_threads (DapServer *server, const JsonValue *request,
+	     const JsonValue *args)
+{
+  (void) args;
+
+  Debugger *dbg = server->dbg;
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_ERR)
+    {
+      return;
+    }
+
+  fprintf (msg.stream, "\"threads\":[");
+  if (is_tracee_alive (dbg))
+    {
+      pid_t *tids = sorted_threads (dbg->threads);
+      for (size_t i = 0; i < n_threads (dbg->threads); i++)
+	{
+	  size_t number = 0;
+	  thread_number (dbg->threads, tids[i], &number);
+	  fprintf (msg.stream, "%s{\"id\":%d,\"name\":\"Thread %zu\"}",
+		   i == 0 ? "" : ",", tids[i], number);
+	}
+      free (tids);
+    }
+  fprintf (msg.stream, "]");
+  send_dap_message (&server->conn, &msg);
+}
+
+/* Select the thread with the id `tid` if it isn't selected already. */
+SprayResult
+select_dap_thread (DapServer *server, const JsonValue *args)
+{
+  Debugger *dbg = server->dbg;
+  int64_t tid = 0;
+  if (json_int_member (args, "threadId", &tid) == SP_ERR
+      || tid == dbg->pid)
+    {
+      return SP_OK;
+    }
+
+  if (tid <= 0 || tid > INT_MAX || !lookup_thread (dbg->threads, tid))
+    {
+      return SP_ERR;
+    }
+  dbg->pid = tid;
+  invalidate_stop_cache (dbg);
+  return SP_OK;
+}
+
+void
+dap_stack_trace (DapServer *server, const JsonValue *request,
+		 const JsonValue *args)
+{
+  Debugger *dbg = server->dbg;
+  if (select_dap_thread (server, args) == SP_ERR)
+    {
+      send_dap_response (&server->conn, request, "There is no such thread");
+      return;
+    }
+
+  int64_t start = 0;
+  int64_t levels = 0;
+  json_int_member (args, "startFrame", &start);
+  json_int_member (args, "levels", &levels);
+
+  size_t n_frames = 0;
+  const DapFrame *frames = dap_frames (server, &n_frames);
+  size_t first = start > 0 ? (size_t) start : 0;
+  first = first < n_frames ? first : n_frames;
+  size_t end = levels > 0 && (uint64_t) levels < n_frames - first
+    ? first + levels : n_frames;
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_ERR)
+    {
+      return;
+    }
+
+  fprintf (msg.stream, "\"stackFrames\":[");
+  for (size_t i = first; i < end; i++)
+    {
+      /* The return address of a caller is behind its call instruction,
+       * which might belong to the next line already. */
+      dbg_addr pc = frame_pc (frames[i].frame);
+      dbg_addr line_pc = { i == 0 ? pc.value : pc.value - 1 };
+      const char *function = addr_name (line_pc, dbg->info);
+      const char *filepath = addr_filepath (line_pc, dbg->info);
+      const Position *pos = addr_position (line_pc, dbg->info);
+
+      fprintf (msg.stream, "%s{\"id\":%zu,\"name\":", i == first ? "" : ",",
+	       i);
+      print_json_string (msg.stream, function != NULL ? function : "<?>");
+      fprintf (msg.stream, ",\"line\":%u,\"column\":%u",
+	       pos != NULL ? pos->line : 0, pos != NULL ? pos->column : 0);
+      if (filepath != NULL)
+	{
+	  const char *name = strrchr (filepath, '/');
+	  fprintf (msg.stream, ",\"source\":{\"name\":");
+	  print_json_string (msg.stream, name != NULL ? name + 1 : filepath);
+	  fprintf (msg.stream, ",\"path\":");
+	  print_json_string (msg.stream, filepath);
+	  fprintf (msg.stream, "}");
+	}
+      fprintf (msg.stream, ",\"instructionPointerReference\":\""
+	       ADDR_FORMAT "\"}",
+	       dbg_to_real (dbg->load_address, pc).value);
+    }
+  fprintf (msg.stream, "],\"totalFrames\":%zu", n_frames);
+  send_dap_message (&server->conn, &msg);
+}
+
+/* Get the frame with the id in the member `key` of `args`. */
+DapFrame *
+dap_frame_by_id (DapServer *server, const JsonValue *args, const char *key,
+		 int64_t *id)
+{
+  size_t n_frames = 0;
+  dap_frames (server, &n_frames);
+  if (json_int_member (args, key, id) == SP_ERR
+      || *id < 0 || (uint64_t) *id >= n_frames)
+    {
+      return NULL;
+    }
+  return &server->frames[*id];
+}
+
+void
+dap_scopes (DapServer *server, const JsonValue *request,
+	    const JsonValue *args)
+{
+  int64_t id = 0;
+  if (dap_frame_by_id (server, args, "frameId", &id) == NULL)
+    {
+      send_dap_response (&server->conn, request, "There is no such frame");
+      return;
+    }
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_OK)
+    {
+      int64_t ref = id * DAP_N_SCOPES + 1;
+      fprintf (msg.stream, "\"scopes\":["
+	       "{\"name\":\"Locals\",\"presentationHint\":\"locals\","
+	       "\"variablesReference\":%" PRId64 ",\"expensive\":false},"
+	       "{\"name\":\"Registers\",\"presentationHint\":\"registers\","
+	       "\"variablesReference\":%" PRId64 ",\"expensive\":false}]",
+	       ref + DAP_SCOPE_LOCALS, ref + DAP_SCOPE_REGISTERS);
+      send_dap_message (&server->conn, &msg);
+    }
+}
+
+void
+add_dap_variable (DapFrame *frame, DapScope scope, const char *name,
+		  char *value)
+{
+  frame->vars[scope] = realloc (frame->vars[scope], (frame->n_vars[scope]
+						     + 1)
+				* sizeof (*frame->vars[scope]));
+  assert (frame->vars[scope] != NULL);
+  frame->vars[scope][frame->n_vars[scope]++] = (DapVariable) {
+    .name = strdup (name),
+    .value = value != NULL ? value : strdup ("<unavailable>"),
+  };
+}
+
+/* Read the variables in the scope of `frame`. Registers of the
+ * innermost frame are read once per stop, and values on the stack
+ * are read from the copy of the stack. Values in callers are found
+ * through the registers that were recovered while unwinding. */
+void
+read_dap_variables (DapServer *server, DapFrame *frame, DapScope scope)
+{
+  Debugger *dbg = server->dbg;
+  bool is_innermost = frame == &server->frames[0];
+  const FrameRegs *regs = frame_regs (frame->frame);
+  const struct user_regs_struct *user_regs =
+    thread_registers (dbg->threads, dbg->pid);
+
+  if (scope == DAP_SCOPE_REGISTERS)
+    {
+      for (size_t i = 0; i < N_REGISTERS; i++)
+	{
+	  x86_reg reg = i;
+	  uint64_t value = 0;
+	  if (is_innermost && user_regs != NULL)
+	    {
+	      value = ((const uint64_t *) user_regs)[reg];
+	    }
+	  else if (frame_reg_value (regs, reg, &value) == SP_ERR)
+	    {
+	      continue;
+	    }
+
+	  char *value_str = NULL;
+	  if (asprintf (&value_str, "0x%016" PRIx64, value) == -1)
+	    {
+	      value_str = NULL;
+	    }
+	  add_dap_variable (frame, scope, get_name_from_register (reg),
+			    value_str);
+	}
+      return;
+    }
+
+  dbg_addr pc = frame_pc (frame->frame);
+  size_t n_names = 0;
+  char **names = scope_var_names (pc, dbg->info, &n_names);
+  for (size_t i = 0; i < n_names; i++)
+    {
+      RuntimeVariable *var = init_frame_var (pc, dbg->load_address,
+					     names[i], dbg->pid, regs,
+					     dbg->info);
+      uint64_t value = 0;
+      SprayResult res = SP_ERR;
+      if (var != NULL && is_addr_loc (var))
+	{
+	  res = read_stack (get_stack_snapshot (dbg), dbg->pid,
+			    var_loc_addr (var), &value);
+	}
+      else if (var != NULL && is_reg_loc (var))
+	{
+	  /* Only some registers of callers are known. */
+	  if (is_innermost && user_regs != NULL)
+	    {
+	      value = ((const uint64_t *) user_regs)[var_loc_reg (var)];
+	      res = SP_OK;
+	    }
+	  else
+	    {
+	      res = frame_reg_value (regs, var_loc_reg (var), &value);
+	    }
+	}
+
+      char *value_str = NULL;
+      if (res == SP_OK)
+	{
+	  value_str = print_var_value (var, mask_var_value (var, value),
+				       FMT_NONE);
+	}
+      add_dap_variable (frame, scope, names[i], value_str);
+      del_var (var);
+      free (names[i]);
+    }
+  free (names);
+}
+
+void
+dap_variables (DapServer *server, const JsonValue *request,
+	       const JsonValue *args)
+{
+  int64_t ref = 0;
+  size_t n_frames = 0;
+  dap_frames (server, &n_frames);
+  if (json_int_member (args, "variablesReference", &ref) == SP_ERR
+      || ref <= 0 || (uint64_t) (ref - 1) / DAP_N_SCOPES >= n_frames)
+    {
+      send_dap_response (&server->conn, request,
+			 "There are no such variables");
+      return;
+    }
+
+  DapFrame *frame = &server->frames[(ref - 1) / DAP_N_SCOPES];
+  DapScope scope = (ref - 1) % DAP_N_SCOPES;
+  if (!frame->has_vars[scope])
+    {
+      read_dap_variables (server, frame, scope);
+      frame->has_vars[scope] = true;
+    }
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_ERR)
+    {
+      return;
+    }
+
+  fprintf (msg.stream, "\"variables\":[");
+  for (size_t i = 0; i < frame->n_vars[scope]; i++)
+    {
+      fprintf (msg.stream, "%s{\"name\":", i == 0 ? "" : ",");
+      print_json_string (msg.stream, frame->vars[scope][i].name);
+      fprintf (msg.stream, ",\"value\":");
+      print_json_string (msg.stream, frame->vars[scope][i].value);
+      fprintf (msg.stream, ",\"variablesReference\":0}");
+    }
+  fprintf (msg.stream, "]");
+  send_dap_message (&server->conn, &msg);
+}
+
+/* Handle `continue`, `next`, `stepIn` and `stepOut`. All
+ * threads move, whichever thread the request is for. */
+void
+dap_movement (DapServer *server, const JsonValue *request,
+	      const JsonValue *args, Movement movement)
+{
+  Debugger *dbg = server->dbg;
+  if (dbg->core != NULL)
+    {
+      send_dap_response (&server->conn, request,
+			 "A core dump can't be run or changed");
+      return;
+    }
+  if (!is_tracee_alive (dbg))
+    {
+      send_dap_response (&server->conn, request, "The process is dead");
+      return;
+    }
+  if (select_dap_thread (server, args) == SP_ERR)
+    {
+      send_dap_response (&server->conn, request, "There is no such thread");
+      return;
+    }
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_OK)
+    {
+      if (movement == MOVE_CONTINUE)
+	{
+	  fprintf (msg.stream, "\"allThreadsContinued\":true");
+	}
+      send_dap_message (&server->conn, &msg);
+    }
+
+  dap_move (server, movement);
+}
+
+/* Run the expression as a command, as if it was typed into the REPL.
+ * Expressions that are only watched are printed with `print`. */
+void
+dap_evaluate (DapServer *server, const JsonValue *request,
+	      const JsonValue *args)
+{
+  Debugger *dbg = server->dbg;
+  const char *expression = json_string_member (args, "expression");
+  const char *context = json_string_member (args, "context");
+  if (expression == NULL || expression[strspn (expression, " \t")] == '\0')
+    {
+      send_dap_response (&server->conn, request, "Nothing to evaluate");
+      return;
+    }
+
+  char *command = NULL;
+  bool is_repl = context == NULL || str_eq (context, "repl");
+  if (asprintf (&command, "%s%s", is_repl ? "" : "print ",
+		expression) == -1)
+    {
+      send_dap_response (&server->conn, request, "Out of memory");
+      return;
+    }
+
+  size_t n_stops = dbg->n_stops;
+  Capture capture = { 0 };
+  if (start_capture (&capture) == SP_ERR)
+    {
+      free (command);
+      send_dap_response (&server->conn, request,
+			 "Failed to capture the output");
+      return;
+    }
+  handle_debug_command (dbg, command);
+  stop_capture (&capture);
+
+  /* Writes to registers or memory change what was collected. */
+  char **tokens = get_command_tokens (command);
+  if (tokens[0] != NULL && changes_tracee (tokens[0]))
+    {
+      forget_dap_stop (server);
+      invalidate_stop_cache (dbg);
+    }
+  free_command_tokens (tokens);
+  free (command);
+
+  size_t len = strlen (capture.buf);
+  while (len > 0 && capture.buf[len - 1] == '\n')
+    {
+      capture.buf[--len] = '\0';
+    }
+
+  DapMessage msg = { 0 };
+  if (start_dap_response (&server->conn, &msg, request, NULL) == SP_OK)
+    {
+      fprintf (msg.stream, "\"result\":");
+      print_json_string (msg.stream, capture.buf);
+      fprintf (msg.stream, ",\"variablesReference\":0");
+      send_dap_message (&server->conn, &msg);
+    }
+  free (capture.buf);
+
+  if (dbg->n_stops != n_stops)
+    {
+      send_dap_stop (server, "step");
+    }
+}
+
+void
+dap_disconnect (DapServer *server, const JsonValue *request,
+		const JsonValue *args)
+{
+  (void) args;
+
+  /* What happens to the tracee is up to `del_debugger`. */
+  send_dap_response (&server->conn, request, NULL);
+  server->is_done = true;
+}
+
+/* Answer the request `request`. */
+void
+handle_dap_request (DapServer *server, const JsonValue *request)
+{
+  const char *command = json_string_member (request, "command");
+  const JsonValue *args = json_member (request, "arguments");
+  if (command == NULL)
+    {
+      send_dap_response (&server->conn, request, "Missing command");
+    }
+  else if (str_eq (command, "initialize"))
+    dap_initialize (server, request, args);
+  else if (str_eq (command, "launch") || str_eq (command, "attach"))
+    dap_launch (server, request, args);
+  else if (str_eq (command, "setBreakpoints"))
+    dap_set_breakpoints (server, request, args);
+  else if (str_eq (command, "setFunctionBreakpoints"))
+    dap_set_function_breakpoints (server, request, args);
+  else if (str_eq (command, "setExceptionBreakpoints"))
+    send_dap_response (&server->conn, request, NULL);
+  else if (str_eq (command, "configurationDone"))
+    dap_configuration_done (server, request, args);
+  else if (str_eq (command, "threads"))
+    dap_threads (server, request, args);
+  else if (str_eq (command, "stackTrace"))
+    dap_stack_trace (server, request, args);
+  else if (str_eq (command, "scopes"))
+    dap_scopes (server, request, args);
+  else if (str_eq (command, "variables"))
+    dap_variables (server, request, args);
+  else if (str_eq (command, "continue"))
+    dap_movement (server, request, args, MOVE_CONTINUE);
+  else if (str_eq (command, "next"))
+    dap_movement (server, request, args, MOVE_NEXT);
+  else if (str_eq (command, "stepIn"))
+    dap_movement (server, request, args, MOVE_STEP);
+  else if (str_eq (command, "stepOut"))
+    dap_movement (server, request, args, MOVE_LEAVE);
+  else if (str_eq (command, "evaluate"))
+    dap_evaluate (server, request, args);
+  else if (str_eq (command, "disconnect") || str_eq (command, "terminate"))
+    dap_disconnect (server, request, args);
+  else
+    {
+      /* E.g. `pause`: requests are only read while the tracee is
+       * stopped, so it's never running when they arrive. */
+      char *error = NULL;
+      if (asprintf (&error, "Unsupported request %s", command) != -1)
+	{
+	  send_dap_response (&server->conn, request, error);
+	  free (error);
+	}
+    }
+}
+
+SprayResult
+run_dap (Debugger dbg, FILE *in, FILE *out)
+{
+  assert (in != NULL);
+  assert (out != NULL);
+
+  DapServer server = {.dbg = &dbg,.conn = {.in = in,.out = out } };
+
+  /* Everything that's printed goes to the editor's debug console. */
+  Capture capture = { 0 };
+  if (start_capture (&capture) == SP_ERR)
+    {
+      spray_err ("Failed to capture the output");
+      return SP_ERR;
+    }
+  SprayResult res = start_debugging (&dbg);
+  stop_capture (&capture);
+
+  char *start_output = capture.buf;
+
+  JsonValue *message = NULL;
+  while (!server.is_done && (message = read_dap_message (&server.conn))
+	 != NULL)
+    {
+      if (str_eq (json_string_member (message, "type"), "request"))
+	{
+	  bool is_captured = start_capture (&capture) == SP_OK;
+	  handle_dap_request (&server, message);
+	  if (is_captured)
+	    {
+	      stop_capture (&capture);
+	      send_dap_output (&server, capture.buf);
+	      free (capture.buf);
+	    }
+	}
+      free_json (message);
+
+      /* The console only exists once the editor initialized. */
+      if (start_output != NULL && server.conn.seq > 0)
+	{
+	  send_dap_output (&server, start_output);
+	  free (start_output);
+	  start_output = NULL;
+	}
+    }
+
+  free (start_output);
+  forget_dap_stop (&server);
+  for (size_t i = 0; i < server.n_sources; i++)
+    {
+      free (server.sources[i].filepath);
+      free (server.sources[i].addrs);
+    }
+  free (server.sources);
+  free (server.function_addrs);
+
+  /* `dbg` is a copy so the cache must be freed here. */
+  invalidate_stop_cache (&dbg);
+
+  return res;
+}
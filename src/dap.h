@@ -0,0 +1,63 @@
+/* Transport of the Debug Adapter Protocol (DAP) that editors use to
+ * talk to debuggers. Each message is a JSON object that's preceded by
+ * a `Content-Length` header. See the specification at
+ * https://microsoft.github.io/debug-adapter-protocol/specification
+ *
+ * The requests are answered in `dap.c` as well, see `run_dap` in
+ * `debugger.h`. */
+
+#pragma once
+
+#ifndef _SPRAY_DAP_H_
+#define _SPRAY_DAP_H_
+
+#include "json.h"
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct
+{
+  FILE *in;
+  FILE *out;
+  int64_t seq;			/* Sequence number of the last message sent. */
+} DapConnection;
+
+/* Read the next message from `conn->in`. Messages that aren't JSON
+ * objects are skipped. Returns NULL at the end of the input or if
+ * the headers are broken. The message must be deleted with
+ * `free_json`. */
+JsonValue *read_dap_message (DapConnection * conn);
+
+/* A message that's being written. */
+typedef struct
+{
+  FILE *stream;			/* The members of the body go here. */
+  char *buf;
+  size_t size;
+} DapMessage;
+
+/* Start the response to `request`. It failed if `error` isn't NULL,
+ * and `error` is shown to the user then. The members of the response
+ * body are written to `msg->stream` next, separated by commas. */
+SprayResult start_dap_response (DapConnection * conn, DapMessage * msg,
+				const JsonValue * request, const char *error);
+
+/* Start the event `event`. Its body is written like that of a
+ * response. */
+SprayResult start_dap_event (DapConnection * conn, DapMessage * msg,
+			     const char *event);
+
+/* Finish the body of `msg` and write it to `conn->out`. */
+void send_dap_message (DapConnection * conn, DapMessage * msg);
+
+/* Send a response to `request` with an empty body. */
+void send_dap_response (DapConnection * conn, const JsonValue * request,
+			const char *error);
+
+/* Send the event `event` with an empty body. */
+void send_dap_event (DapConnection * conn, const char *event);
+
+#endif /* _SPRAY_DAP_H_ */
@@ -0,0 +1,1101 @@
+#include "debug_info.h"
+
+#include <dwarf.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+  DI_MIN_ABBREVS_ALLOC = 64,
+  DI_MIN_SPECS_ALLOC = 256,
+  /* Size of a form whose values differ in size. */
+  DI_VARIABLE_SIZE = -1,
+};
+
+/* Attributes whose values are read. All other attributes are
+ * skipped. The last five are only used in unit DIEs. */
+typedef enum
+{
+  SLOT_NAME,
+  SLOT_LOW_PC,
+  SLOT_HIGH_PC,
+  SLOT_RANGES,
+  SLOT_LOCATION,
+  SLOT_TYPE,
+  SLOT_ABSTRACT_ORIGIN,
+  SLOT_SPECIFICATION,
+  SLOT_DECL_FILE,
+  SLOT_DECL_LINE,
+  SLOT_CALL_FILE,
+  SLOT_CALL_LINE,
+  SLOT_CALL_COLUMN,
+  SLOT_COMP_DIR,
+  SLOT_STMT_LIST,
+  SLOT_STR_OFFSETS_BASE,
+  SLOT_ADDR_BASE,
+  SLOT_RNGLISTS_BASE,
+  N_SLOTS,
+  SLOT_NONE = N_SLOTS,
+} AttrSlot;
+
+#define SLOT_BIT(slot) ((uint32_t) 1 << (slot))
+
+/* An attribute in an abbreviation. */
+typedef struct
+{
+  uint64_t form;
+  int64_t implicit_const;
+  /* Size of the attribute's value in each DIE,
+   * or `DI_VARIABLE_SIZE` if it has to be read. */
+  int size;
+  AttrSlot slot;
+} AttrSpec;
+
+typedef struct
+{
+  uint64_t code;
+  uint64_t tag;
+  bool has_children;
+  size_t first_spec;		/* Index into `AbbrevTable.specs`. */
+  size_t n_specs;
+} Abbrev;
+
+/* The abbreviations of a unit. The arrays are reused by
+ * all units, so they are only allocated a few times. */
+typedef struct
+{
+  bool is_set;
+  /* The sizes of the forms depend on the unit header. */
+  uint64_t offset;		/* In `.debug_abbrev`. */
+  uint16_t version;
+  uint8_t address_size;
+  bool is_64bit;
+  Abbrev *abbrevs;
+  size_t n_abbrevs;
+  size_t n_abbrevs_alloc;
+  AttrSpec *specs;
+  size_t n_specs;
+  size_t n_specs_alloc;
+} AbbrevTable;
+
+/* The value of an attribute before it's interpreted. */
+typedef struct
+{
+  uint64_t form;
+  uint64_t value;
+  /* Contents of block forms and inline strings. */
+  const byte *block;
+  size_t block_size;
+} RawValue;
+
+SprayResult
+di_sections (const ElfFile *elf, DiSections *sections)
+{
+  assert (elf != NULL);
+  assert (sections != NULL);
+
+  if (elf->endianness != ELF_ENDIAN_LITTLE
+      || !dl_section (elf, ".debug_info", &sections->info)
+      || !dl_section (elf, ".debug_abbrev", &sections->abbrev)
+      || !dl_section (elf, ".debug_str", &sections->str)
+      || !dl_section (elf, ".debug_line_str", &sections->line_str)
+      || !dl_section (elf, ".debug_str_offsets", &sections->str_offsets)
+      || !dl_section (elf, ".debug_addr", &sections->addr)
+      || !dl_section (elf, ".debug_ranges", &sections->ranges)
+      || !dl_section (elf, ".debug_rnglists", &sections->rnglists)
+      || sections->info.bytes == NULL || sections->abbrev.bytes == NULL)
+    {
+      return SP_ERR;
+    }
+  return SP_OK;
+}
+
+/************************************/
+/* Reading abbreviations and forms. */
+/************************************/
+
+AttrSlot
+attr_slot (uint64_t attr)
+{
+  switch (attr)
+    {
+    case DW_AT_name:
+      return SLOT_NAME;
+    case DW_AT_low_pc:
+      return SLOT_LOW_PC;
+    case DW_AT_high_pc:
+      return SLOT_HIGH_PC;
+    case DW_AT_ranges:
+      return SLOT_RANGES;
+    case DW_AT_location:
+      return SLOT_LOCATION;
+    case DW_AT_type:
+      return SLOT_TYPE;
+    case DW_AT_abstract_origin:
+      return SLOT_ABSTRACT_ORIGIN;
+    case DW_AT_specification:
+      return SLOT_SPECIFICATION;
+    case DW_AT_decl_file:
+      return SLOT_DECL_FILE;
+    case DW_AT_decl_line:
+      return SLOT_DECL_LINE;
+    case DW_AT_call_file:
+      return SLOT_CALL_FILE;
+    case DW_AT_call_line:
+      return SLOT_CALL_LINE;
+    case DW_AT_call_column:
+      return SLOT_CALL_COLUMN;
+    case DW_AT_comp_dir:
+      return SLOT_COMP_DIR;
+    case DW_AT_stmt_list:
+      return SLOT_STMT_LIST;
+    case DW_AT_str_offsets_base:
+      return SLOT_STR_OFFSETS_BASE;
+    case DW_AT_addr_base:
+      return SLOT_ADDR_BASE;
+    case DW_AT_rnglists_base:
+      return SLOT_RNGLISTS_BASE;
+    default:
+      return SLOT_NONE;
+    }
+}
+
+/* Get the size that values of `form` have in `unit`. It's
+ * `DI_VARIABLE_SIZE` if the size is stored with the value.
+ * Returns false if `form` isn't supported. */
+bool
+form_size (uint64_t form, const DiUnit *unit, int *size)
+{
+  int offset_size = unit->is_64bit ? 8 : 4;
+
+  switch (form)
+    {
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+      *size = 0;
+      return true;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      *size = 1;
+      return true;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      *size = 2;
+      return true;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      *size = 3;
+      return true;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+      *size = 4;
+      return true;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+      *size = 8;
+      return true;
+    case DW_FORM_data16:
+      *size = 16;
+      return true;
+    case DW_FORM_addr:
+      *size = unit->address_size;
+      return true;
+    case DW_FORM_ref_addr:
+      /* DWARF 2 got the size of this form wrong. */
+      *size = unit->version == 2 ? unit->address_size : offset_size;
+      return true;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+      *size = offset_size;
+      return true;
+    case DW_FORM_udata:
+    case DW_FORM_sdata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+    case DW_FORM_string:
+    case DW_FORM_block1:
+    case DW_FORM_block2:
+    case DW_FORM_block4:
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+    case DW_FORM_indirect:
+      *size = DI_VARIABLE_SIZE;
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Decode the abbreviations at `offset` in `.debug_abbrev` for
+ * `unit` into `table`, unless they are in it already. */
+bool
+decode_abbrevs (const DiSections *sections, const DiUnit *unit,
+		uint64_t offset, AbbrevTable *table)
+{
+  if (table->is_set && table->offset == offset
+      && table->version == unit->version
+      && table->address_size == unit->address_size
+      && table->is_64bit == unit->is_64bit)
+    {
+      return true;
+    }
+
+  table->is_set = false;
+  table->n_abbrevs = 0;
+  table->n_specs = 0;
+  if (offset >= sections->abbrev.size)
+    {
+      return false;
+    }
+
+  DlReader r = {
+    .cur = sections->abbrev.bytes + offset,
+    .end = sections->abbrev.bytes + sections->abbrev.size,
+    .is_err = false,
+  };
+
+  /* The table ends with a null entry. */
+  for (uint64_t code = dl_read_uleb128 (&r); code != 0;
+       code = dl_read_uleb128 (&r))
+    {
+      if (table->n_abbrevs == table->n_abbrevs_alloc)
+	{
+	  table->n_abbrevs_alloc = table->n_abbrevs_alloc == 0
+	    ? DI_MIN_ABBREVS_ALLOC : table->n_abbrevs_alloc * 2;
+	  table->abbrevs = realloc (table->abbrevs, sizeof (*table->abbrevs)
+				    * table->n_abbrevs_alloc);
+	  assert (table->abbrevs != NULL);
+	}
+
+      Abbrev *abbrev = &table->abbrevs[table->n_abbrevs++];
+      abbrev->code = code;
+      abbrev->tag = dl_read_uleb128 (&r);
+      abbrev->has_children = dl_read_unsigned (&r, 1) == DW_CHILDREN_yes;
+      abbrev->first_spec = table->n_specs;
+
+      /* So are the attributes of each abbreviation. */
+      while (!r.is_err)
+	{
+	  uint64_t attr = dl_read_uleb128 (&r);
+	  uint64_t form = dl_read_uleb128 (&r);
+	  int64_t implicit_const = form == DW_FORM_implicit_const
+	    ? dl_read_sleb128 (&r) : 0;
+	  if (attr == 0 && form == 0)
+	    {
+	      break;
+	    }
+
+	  int size = 0;
+	  if (!form_size (form, unit, &size))
+	    {
+	      return false;
+	    }
+
+	  if (table->n_specs == table->n_specs_alloc)
+	    {
+	      table->n_specs_alloc = table->n_specs_alloc == 0
+		? DI_MIN_SPECS_ALLOC : table->n_specs_alloc * 2;
+	      table->specs = realloc (table->specs, sizeof (*table->specs)
+				      * table->n_specs_alloc);
+	      assert (table->specs != NULL);
+	    }
+	  table->specs[table->n_specs++] = (AttrSpec)
+	  {
+	    .form = form,
+	    .implicit_const = implicit_const,
+	    .size = size,
+	    .slot = attr_slot (attr),
+	  };
+	}
+
+      abbrev->n_specs = table->n_specs - abbrev->first_spec;
+      if (r.is_err)
+	{
+	  return false;
+	}
+    }
+
+  if (r.is_err)
+    {
+      return false;
+    }
+
+  table->is_set = true;
+  table->offset = offset;
+  table->version = unit->version;
+  table->address_size = unit->address_size;
+  table->is_64bit = unit->is_64bit;
+  return true;
+}
+
+const Abbrev *
+find_abbrev (const AbbrevTable *table, uint64_t code)
+{
+  /* Producers number the abbreviations consecutively from 1. */
+  if (code - 1 < table->n_abbrevs && table->abbrevs[code - 1].code == code)
+    {
+      return &table->abbrevs[code - 1];
+    }
+
+  for (size_t i = 0; i < table->n_abbrevs; i++)
+    {
+      if (table->abbrevs[i].code == code)
+	{
+	  return &table->abbrevs[i];
+	}
+    }
+  return NULL;
+}
+
+void
+info_read_block (DlReader *r, uint64_t size, RawValue *raw)
+{
+  if (dl_can_read (r, size))
+    {
+      raw->block = r->cur;
+      raw->block_size = size;
+      r->cur += size;
+    }
+}
+
+/* Read the value of an attribute with the given form. Returns
+ * false if the value is invalid or `form` isn't supported. */
+bool
+info_read_form (DlReader *r, const DiUnit *unit, uint64_t form,
+		int64_t implicit_const, RawValue *raw)
+{
+  *raw = (RawValue) {.form = form };
+
+  switch (form)
+    {
+    case DW_FORM_flag_present:
+      raw->value = 1;
+      break;
+    case DW_FORM_implicit_const:
+      raw->value = (uint64_t) implicit_const;
+      break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+      raw->value = dl_read_uleb128 (r);
+      break;
+    case DW_FORM_sdata:
+      raw->value = (uint64_t) dl_read_sleb128 (r);
+      break;
+    case DW_FORM_string:
+      raw->block = (const byte *) dl_read_string (r);
+      break;
+    case DW_FORM_block1:
+      info_read_block (r, dl_read_unsigned (r, 1), raw);
+      break;
+    case DW_FORM_block2:
+      info_read_block (r, dl_read_unsigned (r, 2), raw);
+      break;
+    case DW_FORM_block4:
+      info_read_block (r, dl_read_unsigned (r, 4), raw);
+      break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+      info_read_block (r, dl_read_uleb128 (r), raw);
+      break;
+    case DW_FORM_indirect:
+      /* The form is stored in the DIE instead of the abbreviation. */
+      return info_read_form (r, unit, dl_read_uleb128 (r),
+			     implicit_const, raw);
+    default:
+      {
+	int size = 0;
+	if (!form_size (form, unit, &size) || size < 0)
+	  {
+	    return false;
+	  }
+	if (size <= 8)
+	  {
+	    raw->value = dl_read_unsigned (r, size);
+	  }
+	else
+	  {
+	    /* Values of `DW_FORM_data16` aren't used. */
+	    dl_skip_bytes (r, size);
+	  }
+      }
+    }
+
+  return !r->is_err;
+}
+
+/****************************/
+/* Interpreting the values. */
+/****************************/
+
+/* Read the `size` byte value at `offset` in `section`.
+ * Returns false if it's out of bounds. */
+bool
+info_section_value (const DlSection *section, uint64_t offset, size_t size,
+		    uint64_t *value)
+{
+  if (section->bytes == NULL || offset > section->size)
+    {
+      return false;
+    }
+
+  DlReader r = {
+    .cur = section->bytes + offset,
+    .end = section->bytes + section->size,
+    .is_err = false,
+  };
+  *value = dl_read_unsigned (&r, size);
+  return !r.is_err;
+}
+
+/* Get the string that `raw` refers to. Returns NULL if it's
+ * invalid or in a supplementary object file. */
+const char *
+info_string (const DiSections *sections, const DiUnit *unit,
+	     const RawValue *raw)
+{
+  size_t offset_size = unit->is_64bit ? 8 : 4;
+  uint64_t offset = 0;
+
+  switch (raw->form)
+    {
+    case DW_FORM_string:
+      return (const char *) raw->block;
+    case DW_FORM_strp:
+      return dl_section_string (&sections->str, raw->value);
+    case DW_FORM_line_strp:
+      return dl_section_string (&sections->line_str, raw->value);
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+    case DW_FORM_GNU_str_index:
+      if (!info_section_value (&sections->str_offsets,
+			       unit->str_offsets_base
+			       + raw->value * offset_size, offset_size,
+			       &offset))
+	{
+	  return NULL;
+	}
+      return dl_section_string (&sections->str, offset);
+    default:
+      return NULL;
+    }
+}
+
+/* Get the address that `raw` refers to. Returns false
+ * if `raw` isn't an address or if it's invalid. */
+bool
+info_addr (const DiSections *sections, const DiUnit *unit,
+	   const RawValue *raw, uint64_t *addr)
+{
+  switch (raw->form)
+    {
+    case DW_FORM_addr:
+      *addr = raw->value;
+      return true;
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+    case DW_FORM_GNU_addr_index:
+      return info_section_value (&sections->addr,
+				 unit->addr_base
+				 + raw->value * unit->address_size,
+				 unit->address_size, addr);
+    default:
+      return false;
+    }
+}
+
+bool
+info_is_constant (const RawValue *raw)
+{
+  switch (raw->form)
+    {
+    case DW_FORM_data1:
+    case DW_FORM_data2:
+    case DW_FORM_data4:
+    case DW_FORM_data8:
+    case DW_FORM_udata:
+    case DW_FORM_sdata:
+    case DW_FORM_implicit_const:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Get the constant in `slot`, or 0 if there is none. */
+uint64_t
+info_constant (const RawValue *raws, uint32_t present, AttrSlot slot)
+{
+  if ((present & SLOT_BIT (slot)) && info_is_constant (&raws[slot]))
+    {
+      return raws[slot].value;
+    }
+  return 0;
+}
+
+/* Get the offset in `.debug_info` of the DIE that `raw` refers
+ * to, or 0 if it's in a type unit or another object file. */
+uint64_t
+info_ref (const DiUnit *unit, const RawValue *raw)
+{
+  switch (raw->form)
+    {
+    case DW_FORM_ref1:
+    case DW_FORM_ref2:
+    case DW_FORM_ref4:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_udata:
+      return unit->offset + raw->value;
+    case DW_FORM_ref_addr:
+      return raw->value;
+    default:
+      return 0;
+    }
+}
+
+/* Whether `raw` is an offset into another section. Before
+ * DWARF 4, such offsets were stored as constants. */
+bool
+info_is_sec_offset (const DiUnit *unit, const RawValue *raw)
+{
+  return raw->form == DW_FORM_sec_offset
+    || (unit->version < 4
+	&& (raw->form == DW_FORM_data4 || raw->form == DW_FORM_data8));
+}
+
+/* Set the attributes of `unit` that are stored in its DIE. The
+ * bases must be known before any other attributes are read. */
+void
+read_unit_attrs (const DiSections *sections, DiUnit *unit,
+		 const RawValue *raws, uint32_t present)
+{
+  const RawValue *raw = &raws[SLOT_STR_OFFSETS_BASE];
+  if ((present & SLOT_BIT (SLOT_STR_OFFSETS_BASE))
+      && raw->form == DW_FORM_sec_offset)
+    {
+      unit->str_offsets_base = raw->value;
+    }
+
+  raw = &raws[SLOT_ADDR_BASE];
+  if ((present & SLOT_BIT (SLOT_ADDR_BASE))
+      && raw->form == DW_FORM_sec_offset)
+    {
+      unit->addr_base = raw->value;
+    }
+
+  raw = &raws[SLOT_RNGLISTS_BASE];
+  if ((present & SLOT_BIT (SLOT_RNGLISTS_BASE))
+      && raw->form == DW_FORM_sec_offset)
+    {
+      unit->rnglists_base = raw->value;
+    }
+
+  /* The base address of the range lists. Units
+   * whose code is split still set it, often to 0. */
+  if (present & SLOT_BIT (SLOT_LOW_PC))
+    {
+      info_addr (sections, unit, &raws[SLOT_LOW_PC], &unit->low_pc);
+    }
+
+  raw = &raws[SLOT_STMT_LIST];
+  if ((present & SLOT_BIT (SLOT_STMT_LIST))
+      && info_is_sec_offset (unit, raw))
+    {
+      unit->has_stmt_list = true;
+      unit->stmt_list = raw->value;
+    }
+
+  if (present & SLOT_BIT (SLOT_COMP_DIR))
+    {
+      unit->comp_dir = info_string (sections, unit, &raws[SLOT_COMP_DIR]);
+    }
+}
+
+void
+read_die_attrs (const DiSections *sections, const DiUnit *unit,
+		const RawValue *raws, uint32_t present, DiDie *die)
+{
+  if (present & SLOT_BIT (SLOT_NAME))
+    {
+      die->name = info_string (sections, unit, &raws[SLOT_NAME]);
+    }
+
+  uint64_t low_pc = 0;
+  uint64_t high_pc = 0;
+  if ((present & SLOT_BIT (SLOT_LOW_PC))
+      && (present & SLOT_BIT (SLOT_HIGH_PC))
+      && info_addr (sections, unit, &raws[SLOT_LOW_PC], &low_pc))
+    {
+      /* The high PC is an offset of the low PC if it's a constant. */
+      if (info_addr (sections, unit, &raws[SLOT_HIGH_PC], &high_pc))
+	{
+	  die->has_pc = true;
+	}
+      else if (info_is_constant (&raws[SLOT_HIGH_PC]))
+	{
+	  high_pc = low_pc + raws[SLOT_HIGH_PC].value;
+	  die->has_pc = true;
+	}
+      die->low_pc.value = die->has_pc ? low_pc : 0;
+      die->high_pc.value = die->has_pc ? high_pc : 0;
+    }
+
+  const RawValue *raw = &raws[SLOT_RANGES];
+  if (present & SLOT_BIT (SLOT_RANGES))
+    {
+      die->is_ranges_index = raw->form == DW_FORM_rnglistx;
+      die->has_ranges = die->is_ranges_index
+	|| info_is_sec_offset (unit, raw);
+      die->ranges = die->has_ranges ? raw->value : 0;
+    }
+
+  raw = &raws[SLOT_LOCATION];
+  if ((present & SLOT_BIT (SLOT_LOCATION)) && raw->block != NULL)
+    {
+      die->location = raw->block;
+      die->location_size = raw->block_size;
+    }
+  else if (present & SLOT_BIT (SLOT_LOCATION))
+    {
+      die->is_loclist_index = raw->form == DW_FORM_loclistx;
+      die->has_loclist = die->is_loclist_index
+	|| info_is_sec_offset (unit, raw);
+      die->loclist = die->has_loclist ? raw->value : 0;
+    }
+
+  if (present & SLOT_BIT (SLOT_TYPE))
+    {
+      die->type = info_ref (unit, &raws[SLOT_TYPE]);
+    }
+  if (present & SLOT_BIT (SLOT_ABSTRACT_ORIGIN))
+    {
+      die->origin = info_ref (unit, &raws[SLOT_ABSTRACT_ORIGIN]);
+    }
+  else if (present & SLOT_BIT (SLOT_SPECIFICATION))
+    {
+      die->origin = info_ref (unit, &raws[SLOT_SPECIFICATION]);
+    }
+
+  die->decl_file = info_constant (raws, present, SLOT_DECL_FILE);
+  die->decl_line = info_constant (raws, present, SLOT_DECL_LINE);
+  die->call_file = info_constant (raws, present, SLOT_CALL_FILE);
+  die->call_line = info_constant (raws, present, SLOT_CALL_LINE);
+  die->call_column = info_constant (raws, present, SLOT_CALL_COLUMN);
+}
+
+/**********************/
+/* Walking the units. */
+/**********************/
+
+/* Read the header of the unit at `offset` in `.debug_info`. `r`
+ * is set to the unit's DIEs, `abbrev_offset` to the offset of its
+ * abbreviations and `next_offset` to the offset of the next unit.
+ * Returns false if the header is invalid or isn't supported. */
+bool
+read_unit_header (const DiSections *sections, uint64_t offset,
+		  DiUnit *unit, DlReader *r, uint64_t *abbrev_offset,
+		  uint64_t *next_offset)
+{
+  *r = (DlReader)
+  {
+    .cur = sections->info.bytes + offset,
+    .end = sections->info.bytes + sections->info.size,
+    .is_err = false,
+  };
+  *unit = (DiUnit) {.offset = offset };
+
+  /* This unit length marks the 64-bit DWARF format. */
+  uint64_t unit_length = dl_read_unsigned (r, 4);
+  if (unit_length == 0xffffffff)
+    {
+      unit_length = dl_read_unsigned (r, 8);
+      unit->is_64bit = true;
+    }
+  if (r->is_err || unit_length > (uint64_t) (r->end - r->cur))
+    {
+      return false;
+    }
+  r->end = r->cur + unit_length;
+  *next_offset = r->end - sections->info.bytes;
+
+  size_t offset_size = unit->is_64bit ? 8 : 4;
+  unit->version = dl_read_unsigned (r, 2);
+  if (unit->version < 2 || unit->version > 5)
+    {
+      return false;
+    }
+  else if (unit->version == 5)
+    {
+      uint8_t unit_type = dl_read_unsigned (r, 1);
+      unit->address_size = dl_read_unsigned (r, 1);
+      *abbrev_offset = dl_read_unsigned (r, offset_size);
+      switch (unit_type)
+	{
+	case DW_UT_compile:
+	case DW_UT_partial:
+	  break;
+	case DW_UT_skeleton:
+	case DW_UT_split_compile:
+	  /* Skip the ID of the split unit. */
+	  dl_skip_bytes (r, 8);
+	  break;
+	case DW_UT_type:
+	case DW_UT_split_type:
+	  /* Skip the type signature and offset. */
+	  dl_skip_bytes (r, 8 + offset_size);
+	  break;
+	default:
+	  return false;
+	}
+    }
+  else
+    {
+      *abbrev_offset = dl_read_unsigned (r, offset_size);
+      unit->address_size = dl_read_unsigned (r, 1);
+    }
+
+  /* The bases are right after the headers of the
+   * sections if the unit DIE doesn't set them. */
+  unit->str_offsets_base = 2 * offset_size;
+  unit->addr_base = 2 * offset_size;
+  /* The header of `.debug_rnglists` also has the number of offsets. */
+  unit->rnglists_base = unit->is_64bit ? 20 : 12;
+
+  return !r->is_err
+    && (unit->address_size == 4 || unit->address_size == 8);
+}
+
+/* Call `callback` for each DIE of `unit`. */
+SprayResult
+scan_unit (const DiSections *sections, DiUnit *unit, DlReader *r,
+	   const AbbrevTable *table, DiDieCallback callback, void *data)
+{
+  RawValue raws[N_SLOTS];
+  unsigned level = 0;
+  bool is_unit_die = true;
+
+  while (!r->is_err && r->cur < r->end)
+    {
+      uint64_t offset = r->cur - sections->info.bytes;
+      uint64_t code = dl_read_uleb128 (r);
+      if (code == 0)
+	{
+	  /* A null entry ends a list of siblings. */
+	  level = level > 0 ? level - 1 : 0;
+	  continue;
+	}
+
+      const Abbrev *abbrev = find_abbrev (table, code);
+      if (abbrev == NULL)
+	{
+	  return SP_ERR;
+	}
+
+      uint32_t present = 0;
+      const AttrSpec *specs = &table->specs[abbrev->first_spec];
+      for (size_t i = 0; i < abbrev->n_specs; i++)
+	{
+	  const AttrSpec *spec = &specs[i];
+	  if (spec->slot == SLOT_NONE && spec->size != DI_VARIABLE_SIZE)
+	    {
+	      dl_skip_bytes (r, spec->size);
+	      continue;
+	    }
+
+	  RawValue raw = { 0 };
+	  if (!info_read_form (r, unit, spec->form, spec->implicit_const,
+			       &raw))
+	    {
+	      return SP_ERR;
+	    }
+	  if (spec->slot != SLOT_NONE)
+	    {
+	      raws[spec->slot] = raw;
+	      present |= SLOT_BIT (spec->slot);
+	    }
+	}
+      if (r->is_err)
+	{
+	  return SP_ERR;
+	}
+
+      if (is_unit_die)
+	{
+	  read_unit_attrs (sections, unit, raws, present);
+	  is_unit_die = false;
+	}
+
+      DiDie die = {
+	.offset = offset,
+	.tag = abbrev->tag,
+	.level = level,
+	.has_children = abbrev->has_children,
+      };
+      read_die_attrs (sections, unit, raws, present, &die);
+      if (callback (unit, &die, data) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+
+      if (abbrev->has_children)
+	{
+	  level++;
+	}
+    }
+
+  return r->is_err ? SP_ERR : SP_OK;
+}
+
+SprayResult
+di_for_each_die (const DiSections *sections, DiDieCallback callback,
+		 void *data)
+{
+  assert (sections != NULL);
+  assert (callback != NULL);
+
+  DiUnit unit = { 0 };
+  DlReader r = { 0 };
+  uint64_t abbrev_offset = 0;
+  uint64_t next_offset = 0;
+  AbbrevTable table = { 0 };
+
+  /* Check everything that isn't supported before calling
+   * `callback`. Decoding the abbreviations takes little
+   * time compared to reading the DIEs. */
+  for (uint64_t offset = 0; offset < sections->info.size;
+       offset = next_offset)
+    {
+      if (!read_unit_header (sections, offset, &unit, &r, &abbrev_offset,
+			     &next_offset)
+	  || !decode_abbrevs (sections, &unit, abbrev_offset, &table))
+	{
+	  free (table.abbrevs);
+	  free (table.specs);
+	  return SP_ERR;
+	}
+    }
+
+  SprayResult res = SP_OK;
+  for (uint64_t offset = 0; res == SP_OK && offset < sections->info.size;
+       offset = next_offset)
+    {
+      /* The header was read successfully before. */
+      read_unit_header (sections, offset, &unit, &r, &abbrev_offset,
+			&next_offset);
+      if (decode_abbrevs (sections, &unit, abbrev_offset, &table))
+	{
+	  res = scan_unit (sections, &unit, &r, &table, callback, data);
+	}
+      else
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  free (table.abbrevs);
+  free (table.specs);
+  return res;
+}
+
+/****************************/
+/* Reading the range lists. */
+/****************************/
+
+/* Call `callback` for each range in the list at `offset` in
+ * `.debug_ranges`, which is where range lists were before DWARF 5. */
+SprayResult
+ranges_for_each (const DiSections *sections, const DiUnit *unit,
+		 uint64_t offset, DiRangeCallback callback, void *data)
+{
+  if (sections->ranges.bytes == NULL || offset > sections->ranges.size)
+    {
+      return SP_ERR;
+    }
+
+  DlReader r = {
+    .cur = sections->ranges.bytes + offset,
+    .end = sections->ranges.bytes + sections->ranges.size,
+    .is_err = false,
+  };
+  /* A start address of all ones selects a new base address. */
+  uint64_t max_addr = unit->address_size == 8 ? UINT64_MAX : UINT32_MAX;
+  uint64_t base = unit->low_pc;
+
+  while (true)
+    {
+      uint64_t start = dl_read_unsigned (&r, unit->address_size);
+      uint64_t end = dl_read_unsigned (&r, unit->address_size);
+      if (r.is_err)
+	{
+	  return SP_ERR;
+	}
+      else if (start == 0 && end == 0)
+	{
+	  return SP_OK;
+	}
+      else if (start == max_addr)
+	{
+	  base = end;
+	}
+      else if (start < end
+	       && callback ((dbg_addr) {base + start},
+			    (dbg_addr) {base + end}, data) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+    }
+}
+
+/* Get the address at `index` in the unit's part of `.debug_addr`. */
+bool
+rnglist_addr (const DiSections *sections, const DiUnit *unit,
+	      uint64_t index, uint64_t *addr)
+{
+  RawValue raw = {.form = DW_FORM_addrx,.value = index };
+  return info_addr (sections, unit, &raw, addr);
+}
+
+/* Call `callback` for each range in the list at `offset`
+ * in `.debug_rnglists`, which is new in DWARF 5. */
+SprayResult
+rnglists_for_each (const DiSections *sections, const DiUnit *unit,
+		   uint64_t offset, DiRangeCallback callback, void *data)
+{
+  if (sections->rnglists.bytes == NULL || offset > sections->rnglists.size)
+    {
+      return SP_ERR;
+    }
+
+  DlReader r = {
+    .cur = sections->rnglists.bytes + offset,
+    .end = sections->rnglists.bytes + sections->rnglists.size,
+    .is_err = false,
+  };
+  uint64_t base = unit->low_pc;
+
+  while (true)
+    {
+      uint64_t start = 0;
+      uint64_t end = 0;
+      bool is_range = true;
+      bool is_valid = true;
+
+      switch (dl_read_unsigned (&r, 1))
+	{
+	case DW_RLE_end_of_list:
+	  return r.is_err ? SP_ERR : SP_OK;
+	case DW_RLE_base_addressx:
+	  is_range = false;
+	  is_valid = rnglist_addr (sections, unit, dl_read_uleb128 (&r),
+				   &base);
+	  break;
+	case DW_RLE_startx_endx:
+	  is_valid = rnglist_addr (sections, unit, dl_read_uleb128 (&r),
+				   &start)
+	    && rnglist_addr (sections, unit, dl_read_uleb128 (&r), &end);
+	  break;
+	case DW_RLE_startx_length:
+	  is_valid = rnglist_addr (sections, unit, dl_read_uleb128 (&r),
+				   &start);
+	  end = start + dl_read_uleb128 (&r);
+	  break;
+	case DW_RLE_offset_pair:
+	  start = base + dl_read_uleb128 (&r);
+	  end = base + dl_read_uleb128 (&r);
+	  break;
+	case DW_RLE_base_address:
+	  is_range = false;
+	  base = dl_read_unsigned (&r, unit->address_size);
+	  break;
+	case DW_RLE_start_end:
+	  start = dl_read_unsigned (&r, unit->address_size);
+	  end = dl_read_unsigned (&r, unit->address_size);
+	  break;
+	case DW_RLE_start_length:
+	  start = dl_read_unsigned (&r, unit->address_size);
+	  end = start + dl_read_uleb128 (&r);
+	  break;
+	default:
+	  return SP_ERR;
+	}
+
+      if (r.is_err || !is_valid)
+	{
+	  return SP_ERR;
+	}
+      else if (is_range && start < end
+	       && callback ((dbg_addr) {start}, (dbg_addr) {end},
+			    data) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+    }
+}
+
+SprayResult
+di_for_each_range (const DiSections *sections, const DiUnit *unit,
+		   const DiDie *die, DiRangeCallback callback, void *data)
+{
+  assert (sections != NULL);
+  assert (unit != NULL);
+  assert (die != NULL);
+  assert (callback != NULL);
+
+  if (!die->has_ranges)
+    {
+      return SP_ERR;
+    }
+  else if (unit->version < 5)
+    {
+      return ranges_for_each (sections, unit, die->ranges, callback, data);
+    }
+
+  /* An index selects an offset in the unit's part of
+   * `.debug_rnglists`. The offset is relative to the base. */
+  uint64_t offset = die->ranges;
+  if (die->is_ranges_index)
+    {
+      size_t offset_size = unit->is_64bit ? 8 : 4;
+      if (!info_section_value (&sections->rnglists,
+			       unit->rnglists_base
+			       + die->ranges * offset_size, offset_size,
+			       &offset))
+	{
+	  return SP_ERR;
+	}
+      offset += unit->rnglists_base;
+    }
+  return rnglists_for_each (sections, unit, offset, callback, data);
+}
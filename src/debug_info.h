@@ -0,0 +1,113 @@
+/* Scan the DIEs in `.debug_info` straight from the mapped ELF
+ * file. The abbreviations of a unit are decoded once and the
+ * attributes that nobody asked for are skipped by the size of
+ * their form, so a pass over all DIEs doesn't allocate. */
+
+#pragma once
+
+#ifndef _SPRAY_DEBUG_INFO_H_
+#define _SPRAY_DEBUG_INFO_H_
+
+#include "debug_line.h"
+#include "magic.h"
+#include "spray_elf.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sections that DIEs are read from. */
+typedef struct
+{
+  DlSection info;		/* `.debug_info` */
+  DlSection abbrev;		/* `.debug_abbrev` */
+  DlSection str;		/* `.debug_str` */
+  DlSection line_str;		/* `.debug_line_str` */
+  DlSection str_offsets;	/* `.debug_str_offsets` */
+  DlSection addr;		/* `.debug_addr` */
+  DlSection ranges;		/* `.debug_ranges` */
+  DlSection rnglists;		/* `.debug_rnglists` */
+} DiSections;
+
+/* Get the sections in `elf` that DIEs are read from. Returns
+ * `SP_ERR` if `.debug_info` or `.debug_abbrev` is missing or
+ * if any of them is compressed. The sections stay valid for
+ * as long as `elf` does. */
+SprayResult di_sections (const ElfFile * elf, DiSections * sections);
+
+typedef struct
+{
+  uint64_t offset;		/* Of the unit header in `.debug_info`. */
+  uint16_t version;
+  uint8_t address_size;
+  bool is_64bit;
+  /* Attributes of the unit DIE. */
+  const char *comp_dir;		/* NULL if there is none. */
+  bool has_stmt_list;
+  uint64_t stmt_list;		/* Offset in `.debug_line`. */
+  uint64_t str_offsets_base;
+  uint64_t addr_base;
+  uint64_t rnglists_base;
+  /* Base address of the range lists. */
+  uint64_t low_pc;
+} DiUnit;
+
+/* The attributes of a DIE that are read. Strings point into the
+ * sections and references are offsets in `.debug_info`. Anything
+ * a DIE doesn't have is 0 or NULL. */
+typedef struct
+{
+  uint64_t offset;		/* In `.debug_info`. */
+  uint64_t tag;
+  unsigned level;		/* 0 for the unit DIE. */
+  bool has_children;
+  const char *name;
+  /* `high_pc` is the first address after the code, even
+   * if the DIE stores it as an offset of `low_pc`. */
+  bool has_pc;
+  dbg_addr low_pc;
+  dbg_addr high_pc;
+  /* `ranges` is an index into the unit's range lists
+   * instead of an offset if `is_ranges_index` is set. */
+  bool has_ranges;
+  bool is_ranges_index;
+  uint64_t ranges;
+  /* Either a location expression or a location list. */
+  const byte *location;
+  size_t location_size;
+  bool has_loclist;
+  bool is_loclist_index;
+  uint64_t loclist;
+  uint64_t type;
+  /* `DW_AT_abstract_origin`, or else `DW_AT_specification`. */
+  uint64_t origin;
+  uint64_t decl_file;
+  uint64_t decl_line;
+  uint64_t call_file;
+  uint64_t call_line;
+  uint64_t call_column;
+} DiDie;
+
+typedef SprayResult (*DiDieCallback) (const DiUnit * unit,
+				      const DiDie * die, void *data);
+
+/* Call `callback` for each DIE in `.debug_info` in the order of
+ * the DIE tree. The unit DIE is passed first and sets the
+ * attributes in `unit`. Returns `SP_ERR` if `callback` fails or
+ * the DIEs are invalid. The unit headers are all checked before
+ * `callback` is called for the first time, so if a unit uses an
+ * unsupported version of DWARF, `callback` isn't called at all. */
+SprayResult di_for_each_die (const DiSections * sections,
+			     DiDieCallback callback, void *data);
+
+typedef SprayResult (*DiRangeCallback) (dbg_addr low_pc, dbg_addr high_pc,
+					void *data);
+
+/* Call `callback` for each range of addresses in the range list of
+ * `die`, which must have `has_ranges` set. `high_pc` is the first
+ * address after the range and empty ranges are skipped. Returns
+ * `SP_ERR` if `callback` fails or the range list is invalid. */
+SprayResult di_for_each_range (const DiSections * sections,
+			       const DiUnit * unit, const DiDie * die,
+			       DiRangeCallback callback, void *data);
+
+#endif /* _SPRAY_DEBUG_INFO_H_ */
@@ -0,0 +1,783 @@
+#include "debug_line.h"
+
+#include <dwarf.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+  DL_MIN_ROWS_ALLOC = 64,
+  DL_PATHS_ALLOC_SIZE = 16,
+};
+
+/**************************/
+/* Reading `.debug_line`. */
+/**************************/
+
+bool
+dl_can_read (DlReader *r, size_t n)
+{
+  if (r->is_err || (size_t) (r->end - r->cur) < n)
+    {
+      r->is_err = true;
+      return false;
+    }
+  return true;
+}
+
+uint64_t
+dl_read_unsigned (DlReader *r, size_t n)
+{
+  if (!dl_can_read (r, n))
+    {
+      return 0;
+    }
+
+  /* DWARF is always little endian on x86_64. */
+  uint64_t value = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      value |= (uint64_t) r->cur[i] << (8 * i);
+    }
+  r->cur += n;
+
+  return value;
+}
+
+uint64_t
+dl_read_uleb128 (DlReader *r)
+{
+  uint64_t value = 0;
+  unsigned shift = 0;
+  byte b = 0;
+
+  do
+    {
+      if (!dl_can_read (r, 1))
+	{
+	  return 0;
+	}
+      b = *r->cur++;
+      if (shift < 64)
+	{
+	  value |= (uint64_t) (b & 0x7f) << shift;
+	}
+      shift += 7;
+    }
+  while (b & 0x80);
+
+  return value;
+}
+
+int64_t
+dl_read_sleb128 (DlReader *r)
+{
+  uint64_t value = 0;
+  unsigned shift = 0;
+  byte b = 0;
+
+  do
+    {
+      if (!dl_can_read (r, 1))
+	{
+	  return 0;
+	}
+      b = *r->cur++;
+      if (shift < 64)
+	{
+	  value |= (uint64_t) (b & 0x7f) << shift;
+	}
+      shift += 7;
+    }
+  while (b & 0x80);
+
+  if (shift < 64 && (b & 0x40))
+    {
+      value |= ~(uint64_t) 0 << shift;
+    }
+
+  return (int64_t) value;
+}
+
+const char *
+dl_read_string (DlReader *r)
+{
+  if (r->is_err)
+    {
+      return NULL;
+    }
+
+  const byte *nul = memchr (r->cur, '\0', r->end - r->cur);
+  if (nul == NULL)
+    {
+      r->is_err = true;
+      return NULL;
+    }
+
+  const char *str = (const char *) r->cur;
+  r->cur = nul + 1;
+  return str;
+}
+
+void
+dl_skip_bytes (DlReader *r, uint64_t n)
+{
+  if (dl_can_read (r, n))
+    {
+      r->cur += n;
+    }
+}
+
+const char *
+dl_section_string (const DlSection *section, uint64_t offset)
+{
+  if (section->bytes == NULL || offset >= section->size)
+    {
+      return NULL;
+    }
+
+  const byte *str = section->bytes + offset;
+  if (memchr (str, '\0', section->size - offset) == NULL)
+    {
+      return NULL;
+    }
+  return (const char *) str;
+}
+
+bool
+dl_section (const ElfFile *elf, const char *name, DlSection *section)
+{
+  *section = (DlSection) {0};
+
+  const Elf64_Shdr *shdr = se_section_by_name (name, elf);
+  if (shdr == NULL)
+    {
+      /* Whether the section is required is up to the caller. */
+      return true;
+    }
+  if (shdr->sh_flags & SHF_COMPRESSED)
+    {
+      return false;
+    }
+
+  section->bytes = se_section_data (shdr, elf);
+  section->size = section->bytes != NULL ? shdr->sh_size : 0;
+  return true;
+}
+
+SprayResult
+dl_sections (const ElfFile *elf, DlSections *sections)
+{
+  assert (elf != NULL);
+  assert (sections != NULL);
+
+  if (elf->endianness != ELF_ENDIAN_LITTLE
+      || !dl_section (elf, ".debug_line", &sections->line)
+      || !dl_section (elf, ".debug_line_str", &sections->line_str)
+      || !dl_section (elf, ".debug_str", &sections->str)
+      || sections->line.bytes == NULL)
+    {
+      return SP_ERR;
+    }
+  return SP_OK;
+}
+
+/*****************************************/
+/* Building the file table and the rows. */
+/*****************************************/
+
+/* Header fields that the line number program depends on. */
+typedef struct
+{
+  uint16_t version;
+  bool is_64bit;
+  uint8_t min_inst_length;
+  bool default_is_stmt;
+  int8_t line_base;
+  uint8_t line_range;
+  uint8_t opcode_base;
+  const byte *standard_opcode_lengths;
+  const char *comp_dir;
+  /* Include directories in the order of the header. */
+  const char **dirs;
+  size_t n_dirs;
+  DlInternCallback intern;
+  void *intern_data;
+} LineHeader;
+
+/* Append `part` to the path in `buf` with exactly one slash
+ * between them. This is what libdwarf does to join paths. */
+void
+join_path (char *buf, const char *part)
+{
+  if (part == NULL || *part == '\0')
+    {
+      return;
+    }
+
+  size_t len = strlen (buf);
+  if (len > 0 && buf[len - 1] == '/' && *part == '/')
+    {
+      part++;
+    }
+  else if (len > 0 && buf[len - 1] != '/' && *part != '/')
+    {
+      strcat (buf, "/");
+    }
+  strcat (buf, part);
+}
+
+/* Add the file `name` in the directory `dir_idx` of the
+ * file table to `table`. Its full path is built like
+ * `dwarf_linesrc` would build it. */
+void
+add_filepath (DlLineTable *table, const LineHeader *h, const char *name,
+	      uint64_t dir_idx)
+{
+  const char *dir = NULL;
+  bool needs_comp_dir = false;
+
+  if (name[0] != '/')
+    {
+      /* Before DWARF 5, directory 0 is the compilation
+       * directory and isn't part of the table. */
+      if (h->version >= 5 && dir_idx < h->n_dirs)
+	{
+	  dir = h->dirs[dir_idx];
+	}
+      else if (h->version < 5 && dir_idx > 0 && dir_idx <= h->n_dirs)
+	{
+	  dir = h->dirs[dir_idx - 1];
+	}
+      needs_comp_dir = dir == NULL || dir[0] != '/';
+    }
+
+  const char *comp_dir = needs_comp_dir ? h->comp_dir : NULL;
+  size_t size = strlen (name) + 3;
+  size += comp_dir != NULL ? strlen (comp_dir) : 0;
+  size += dir != NULL ? strlen (dir) : 0;
+
+  char *filepath = calloc (size, sizeof (char));
+  assert (filepath != NULL);
+  join_path (filepath, comp_dir);
+  join_path (filepath, dir);
+  join_path (filepath, name);
+  if (h->intern != NULL)
+    {
+      filepath = h->intern (filepath, h->intern_data);
+    }
+
+  if (table->n_filepaths % DL_PATHS_ALLOC_SIZE == 0)
+    {
+      table->filepaths = realloc (table->filepaths,
+				  sizeof (char *) * (table->n_filepaths
+						     + DL_PATHS_ALLOC_SIZE));
+      assert (table->filepaths != NULL);
+    }
+  table->filepaths[table->n_filepaths++] = filepath;
+}
+
+/* Read an attribute of an entry in the directory or file table
+ * of DWARF 5. Strings are stored in `str` and everything else
+ * in `value`. Returns false if `form` isn't supported. */
+bool
+read_entry_form (DlReader *r, const DlSections *sections,
+		 const LineHeader *h, uint64_t form, const char **str,
+		 uint64_t *value)
+{
+  size_t offset_size = h->is_64bit ? 8 : 4;
+  *str = NULL;
+  *value = 0;
+
+  switch (form)
+    {
+    case DW_FORM_string:
+      *str = dl_read_string (r);
+      return *str != NULL;
+    case DW_FORM_line_strp:
+      *str = dl_section_string (&sections->line_str,
+				dl_read_unsigned (r, offset_size));
+      return *str != NULL;
+    case DW_FORM_strp:
+      *str = dl_section_string (&sections->str,
+				dl_read_unsigned (r, offset_size));
+      return *str != NULL;
+    case DW_FORM_udata:
+      *value = dl_read_uleb128 (r);
+      return true;
+    case DW_FORM_data1:
+      *value = dl_read_unsigned (r, 1);
+      return true;
+    case DW_FORM_data2:
+      *value = dl_read_unsigned (r, 2);
+      return true;
+    case DW_FORM_data4:
+      *value = dl_read_unsigned (r, 4);
+      return true;
+    case DW_FORM_data8:
+      *value = dl_read_unsigned (r, 8);
+      return true;
+    case DW_FORM_data16:
+      dl_skip_bytes (r, 16);
+      return true;
+    case DW_FORM_block:
+      dl_skip_bytes (r, dl_read_uleb128 (r));
+      return true;
+    default:
+      /* `DW_FORM_strx*` would need the unit's string offsets. */
+      return false;
+    }
+}
+
+/* Read a directory or file table of DWARF 5. Directories
+ * are added to `h`, and files are added to `table`. */
+bool
+read_entry_table (DlReader *r, const DlSections *sections, LineHeader *h,
+		  DlLineTable *table, bool is_dir_table)
+{
+  enum
+  {
+    MAX_ENTRY_FORMATS = 16,
+  };
+
+  uint8_t n_formats = dl_read_unsigned (r, 1);
+  if (n_formats > MAX_ENTRY_FORMATS)
+    {
+      return false;
+    }
+
+  uint64_t content_types[MAX_ENTRY_FORMATS];
+  uint64_t forms[MAX_ENTRY_FORMATS];
+  for (uint8_t i = 0; i < n_formats; i++)
+    {
+      content_types[i] = dl_read_uleb128 (r);
+      forms[i] = dl_read_uleb128 (r);
+    }
+
+  uint64_t n_entries = dl_read_uleb128 (r);
+  if (r->is_err || n_entries > (uint64_t) (r->end - r->cur))
+    {
+      return false;
+    }
+
+  if (is_dir_table)
+    {
+      h->dirs = calloc (n_entries > 0 ? n_entries : 1, sizeof (*h->dirs));
+      assert (h->dirs != NULL);
+    }
+
+  for (uint64_t i = 0; i < n_entries; i++)
+    {
+      const char *path = NULL;
+      uint64_t dir_idx = 0;
+      for (uint8_t j = 0; j < n_formats; j++)
+	{
+	  const char *str = NULL;
+	  uint64_t value = 0;
+	  if (!read_entry_form (r, sections, h, forms[j], &str, &value))
+	    {
+	      return false;
+	    }
+	  if (content_types[j] == DW_LNCT_path)
+	    {
+	      path = str;
+	    }
+	  else if (content_types[j] == DW_LNCT_directory_index)
+	    {
+	      dir_idx = value;
+	    }
+	}
+
+      if (r->is_err || path == NULL)
+	{
+	  return false;
+	}
+
+      if (is_dir_table)
+	{
+	  h->dirs[h->n_dirs++] = path;
+	}
+      else
+	{
+	  add_filepath (table, h, path, dir_idx);
+	}
+    }
+
+  return true;
+}
+
+/* Read the directory and file tables from before DWARF 5. */
+bool
+read_v4_tables (DlReader *r, LineHeader *h, DlLineTable *table)
+{
+  size_t n_alloc = 0;
+  for (;;)
+    {
+      const char *dir = dl_read_string (r);
+      if (dir == NULL)
+	{
+	  return false;
+	}
+      else if (*dir == '\0')
+	{
+	  break;
+	}
+
+      if (h->n_dirs == n_alloc)
+	{
+	  n_alloc += DL_PATHS_ALLOC_SIZE;
+	  h->dirs = realloc (h->dirs, sizeof (*h->dirs) * n_alloc);
+	  assert (h->dirs != NULL);
+	}
+      h->dirs[h->n_dirs++] = dir;
+    }
+
+  for (;;)
+    {
+      const char *name = dl_read_string (r);
+      if (name == NULL)
+	{
+	  return false;
+	}
+      else if (*name == '\0')
+	{
+	  break;
+	}
+
+      uint64_t dir_idx = dl_read_uleb128 (r);
+      dl_read_uleb128 (r);	/* Modification time. */
+      dl_read_uleb128 (r);	/* File size. */
+      if (r->is_err)
+	{
+	  return false;
+	}
+      add_filepath (table, h, name, dir_idx);
+    }
+
+  return true;
+}
+
+/* Registers of the line number state machine. */
+typedef struct
+{
+  uint64_t addr;
+  uint64_t file;
+  uint64_t line;
+  uint64_t column;
+  bool is_stmt;
+  bool prologue_end;
+  bool end_sequence;
+} LineState;
+
+LineState
+initial_line_state (const LineHeader *h)
+{
+  return (LineState)
+  {
+    .addr = 0,
+    .file = 1,
+    .line = 1,
+    .column = 0,
+    .is_stmt = h->default_is_stmt,
+    .prologue_end = false,
+    .end_sequence = false,
+  };
+}
+
+/* Append a row with the current state to `table`. Returns
+ * false if the state refers to a file that doesn't exist. */
+bool
+emit_row (DlLineTable *table, const LineHeader *h, const LineState *state)
+{
+  /* Files are numbered from 1 before DWARF 5. */
+  if (h->version < 5 && state->file == 0)
+    {
+      return false;
+    }
+  uint64_t file = h->version >= 5 ? state->file : state->file - 1;
+  if (file >= table->n_filepaths)
+    {
+      return false;
+    }
+
+  if (table->n_rows == table->n_rows_alloc)
+    {
+      table->n_rows_alloc *= 2;
+      table->rows = realloc (table->rows,
+			     sizeof (*table->rows) * table->n_rows_alloc);
+      assert (table->rows != NULL);
+    }
+
+  table->rows[table->n_rows++] = (LineEntry)
+  {
+    .is_ok = true,
+    .new_statement = state->is_stmt,
+    .prologue_end = state->prologue_end,
+    .end_sequence = state->end_sequence,
+    .is_exact = false,
+    .ln = state->line,
+    .cl = state->column,
+    .addr = {state->addr},
+    .filepath = table->filepaths[file],
+  };
+  return true;
+}
+
+/* Run the line number program in `r` and add a row
+ * to `table` for each row of the line table. */
+bool
+run_line_program (DlReader *r, LineHeader *h, DlLineTable *table)
+{
+  /* Rows take up a few bytes of the program each.
+   * Start with enough room for most programs. */
+  table->n_rows_alloc = (r->end - r->cur) / 2 + DL_MIN_ROWS_ALLOC;
+  table->rows = malloc (sizeof (*table->rows) * table->n_rows_alloc);
+  assert (table->rows != NULL);
+
+  LineState state = initial_line_state (h);
+
+  while (r->cur < r->end && !r->is_err)
+    {
+      uint8_t opcode = dl_read_unsigned (r, 1);
+
+      if (opcode >= h->opcode_base)
+	{
+	  uint8_t adjusted = opcode - h->opcode_base;
+	  state.addr += (uint64_t) (adjusted / h->line_range)
+	    * h->min_inst_length;
+	  state.line += h->line_base + adjusted % h->line_range;
+	  if (!emit_row (table, h, &state))
+	    {
+	      return false;
+	    }
+	  state.prologue_end = false;
+	  continue;
+	}
+
+      switch (opcode)
+	{
+	case 0:
+	  {
+	    uint64_t length = dl_read_uleb128 (r);
+	    if (r->is_err || length == 0
+		|| length > (uint64_t) (r->end - r->cur))
+	      {
+		return false;
+	      }
+	    const byte *next = r->cur + length;
+
+	    uint8_t ext_opcode = dl_read_unsigned (r, 1);
+	    switch (ext_opcode)
+	      {
+	      case DW_LNE_end_sequence:
+		state.end_sequence = true;
+		if (!emit_row (table, h, &state))
+		  {
+		    return false;
+		  }
+		state = initial_line_state (h);
+		break;
+	      case DW_LNE_set_address:
+		if (length - 1 > 8)
+		  {
+		    return false;
+		  }
+		state.addr = dl_read_unsigned (r, length - 1);
+		break;
+	      case DW_LNE_define_file:
+		{
+		  const char *name = dl_read_string (r);
+		  uint64_t dir_idx = dl_read_uleb128 (r);
+		  if (name == NULL || r->is_err)
+		    {
+		      return false;
+		    }
+		  add_filepath (table, h, name, dir_idx);
+		  break;
+		}
+	      default:
+		/* `DW_LNE_set_discriminator` and vendor extensions
+		 * don't change any of the registers that are used. */
+		break;
+	      }
+	    r->cur = next;
+	    break;
+	  }
+	case DW_LNS_copy:
+	  if (!emit_row (table, h, &state))
+	    {
+	      return false;
+	    }
+	  state.prologue_end = false;
+	  break;
+	case DW_LNS_advance_pc:
+	  state.addr += dl_read_uleb128 (r) * h->min_inst_length;
+	  break;
+	case DW_LNS_advance_line:
+	  state.line += dl_read_sleb128 (r);
+	  break;
+	case DW_LNS_set_file:
+	  state.file = dl_read_uleb128 (r);
+	  break;
+	case DW_LNS_set_column:
+	  state.column = dl_read_uleb128 (r);
+	  break;
+	case DW_LNS_negate_stmt:
+	  state.is_stmt = !state.is_stmt;
+	  break;
+	case DW_LNS_const_add_pc:
+	  state.addr += (uint64_t) ((255 - h->opcode_base) / h->line_range)
+	    * h->min_inst_length;
+	  break;
+	case DW_LNS_fixed_advance_pc:
+	  state.addr += dl_read_unsigned (r, 2);
+	  break;
+	case DW_LNS_set_prologue_end:
+	  state.prologue_end = true;
+	  break;
+	default:
+	  /* Skip the operands of opcodes that don't change any of
+	   * the registers that are used, e.g. `DW_LNS_set_isa`. */
+	  for (uint8_t i = 0; i < h->standard_opcode_lengths[opcode - 1]; i++)
+	    {
+	      dl_read_uleb128 (r);
+	    }
+	  break;
+	}
+    }
+
+  return !r->is_err;
+}
+
+/* Decode the header of the line number program at `offset` and
+ * the program itself if `has_rows` is set. */
+SprayResult
+decode_line_table (const DlSections *sections, uint64_t offset,
+		   const char *comp_dir, DlInternCallback intern,
+		   void *intern_data, DlLineTable *table, bool has_rows)
+{
+  assert (sections != NULL);
+  assert (table != NULL);
+
+  *table = (DlLineTable) {.is_interned = intern != NULL };
+  if (sections->line.bytes == NULL || offset >= sections->line.size)
+    {
+      return SP_ERR;
+    }
+
+  DlReader r = {
+    .cur = sections->line.bytes + offset,
+    .end = sections->line.bytes + sections->line.size,
+    .is_err = false,
+  };
+  LineHeader h = {
+    .comp_dir = comp_dir,
+    .intern = intern,
+    .intern_data = intern_data,
+  };
+
+  /* This unit length marks the 64-bit DWARF format. */
+  uint64_t unit_length = dl_read_unsigned (&r, 4);
+  if (unit_length == 0xffffffff)
+    {
+      unit_length = dl_read_unsigned (&r, 8);
+      h.is_64bit = true;
+    }
+  if (r.is_err || unit_length > (uint64_t) (r.end - r.cur))
+    {
+      return SP_ERR;
+    }
+  r.end = r.cur + unit_length;
+
+  h.version = dl_read_unsigned (&r, 2);
+  if (h.version < 2 || h.version > 5)
+    {
+      return SP_ERR;
+    }
+  if (h.version >= 5)
+    {
+      uint8_t address_size = dl_read_unsigned (&r, 1);
+      uint8_t segment_selector_size = dl_read_unsigned (&r, 1);
+      if (address_size != 8 || segment_selector_size != 0)
+	{
+	  return SP_ERR;
+	}
+    }
+
+  uint64_t header_length = dl_read_unsigned (&r, h.is_64bit ? 8 : 4);
+  if (r.is_err || header_length > (uint64_t) (r.end - r.cur))
+    {
+      return SP_ERR;
+    }
+  const byte *program = r.cur + header_length;
+
+  h.min_inst_length = dl_read_unsigned (&r, 1);
+  /* Only VLIW architectures have several operations per instruction. */
+  uint8_t max_ops_per_inst = h.version >= 4 ? dl_read_unsigned (&r, 1) : 1;
+  h.default_is_stmt = dl_read_unsigned (&r, 1) != 0;
+  h.line_base = (int8_t) dl_read_unsigned (&r, 1);
+  h.line_range = dl_read_unsigned (&r, 1);
+  h.opcode_base = dl_read_unsigned (&r, 1);
+  h.standard_opcode_lengths = r.cur;
+  if (h.opcode_base > 0)
+    {
+      dl_skip_bytes (&r, h.opcode_base - 1);
+    }
+  if (r.is_err || max_ops_per_inst != 1 || h.line_range == 0
+      || h.opcode_base == 0)
+    {
+      return SP_ERR;
+    }
+
+  bool is_ok = h.version >= 5
+    ? read_entry_table (&r, sections, &h, table, true)
+    && read_entry_table (&r, sections, &h, table, false)
+    : read_v4_tables (&r, &h, table);
+
+  if (is_ok && !r.is_err && r.cur <= program)
+    {
+      r.cur = program;
+      is_ok = !has_rows || run_line_program (&r, &h, table);
+    }
+  else
+    {
+      is_ok = false;
+    }
+
+  free (h.dirs);
+  return is_ok ? SP_OK : SP_ERR;
+}
+
+SprayResult
+dl_decode_line_table (const DlSections *sections, uint64_t offset,
+		      const char *comp_dir, DlInternCallback intern,
+		      void *intern_data, DlLineTable *table)
+{
+  return decode_line_table (sections, offset, comp_dir, intern,
+			    intern_data, table, true);
+}
+
+SprayResult
+dl_decode_file_table (const DlSections *sections, uint64_t offset,
+		      const char *comp_dir, DlInternCallback intern,
+		      void *intern_data, DlLineTable *table)
+{
+  return decode_line_table (sections, offset, comp_dir, intern,
+			    intern_data, table, false);
+}
+
+void
+dl_free_line_table (DlLineTable *table)
+{
+  assert (table != NULL);
+
+  for (size_t i = 0; i < table->n_filepaths && !table->is_interned; i++)
+    {
+      free (table->filepaths[i]);
+    }
+  free (table->filepaths);
+  free (table->rows);
+  *table = (DlLineTable) {0};
+}
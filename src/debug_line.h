@@ -0,0 +1,129 @@
+/* Decode the line number programs in `.debug_line` straight
+ * from the mapped ELF file. This is the same information that
+ * libdwarf's line contexts give, but rows are decoded straight
+ * into a single array of line entries and each file path is
+ * built only once. */
+
+#pragma once
+
+#ifndef _SPRAY_DEBUG_LINE_H_
+#define _SPRAY_DEBUG_LINE_H_
+
+#include "magic.h"
+#include "spray_elf.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  const byte *bytes;		/* NULL if the section is missing. */
+  size_t size;
+} DlSection;
+
+/* Sections that line number programs are read from. */
+typedef struct
+{
+  DlSection line;		/* `.debug_line` */
+  DlSection line_str;		/* `.debug_line_str` */
+  DlSection str;		/* `.debug_str` */
+} DlSections;
+
+/* Get the sections in `elf` that line number programs are read from.
+ * Returns `SP_ERR` if `.debug_line` is missing or if any of them is
+ * compressed. The sections stay valid for as long as `elf` does. */
+SprayResult dl_sections (const ElfFile * elf, DlSections * sections);
+
+/* Get the section called `name` in `elf`. Returns false if it's
+ * compressed. `section->bytes` is NULL if it's missing. */
+bool dl_section (const ElfFile * elf, const char *name, DlSection * section);
+
+/* Get the string at `offset` in a string section
+ * like `.debug_str`. Returns NULL if it's invalid. */
+const char *dl_section_string (const DlSection * section, uint64_t offset);
+
+/* Reads little endian DWARF data. Once a read goes past `end`,
+ * `is_err` is set and all further reads return 0 or NULL. */
+typedef struct
+{
+  const byte *cur;
+  const byte *end;
+  bool is_err;
+} DlReader;
+
+bool dl_can_read (DlReader * r, size_t n);
+
+/* Read an `n` byte unsigned integer. */
+uint64_t dl_read_unsigned (DlReader * r, size_t n);
+
+uint64_t dl_read_uleb128 (DlReader * r);
+
+int64_t dl_read_sleb128 (DlReader * r);
+
+/* Read a NUL-terminated string. */
+const char *dl_read_string (DlReader * r);
+
+void dl_skip_bytes (DlReader * r, uint64_t n);
+
+typedef struct
+{
+  bool is_ok;
+  bool new_statement;
+  bool prologue_end;
+  /* Set if this entry marks the first address past the
+   * end of a sequence of instructions. There is no code
+   * for this line entry at `addr`. */
+  bool end_sequence;
+  /* Set to true if the PC used to retrieve the
+   * line entry was exactly equal to `addr`. */
+  bool is_exact;
+  unsigned ln;
+  unsigned cl;
+  dbg_addr addr;
+  /* Don't free this string. It's owned by the `Dwarf_Debug`
+   * instance or by the `DlLineTable` that decoded it. */
+  char *filepath;
+} LineEntry;
+
+typedef struct
+{
+  /* Rows in the order in which the program produced them. */
+  LineEntry *rows;
+  size_t n_rows;
+  size_t n_rows_alloc;
+  /* Full path of each file in the file table. */
+  char **filepaths;
+  size_t n_filepaths;
+  /* Set if the file paths were interned and
+   * aren't owned by the table. */
+  bool is_interned;
+} DlLineTable;
+
+/* Takes ownership of the full path of a file in the file table
+ * and returns the string that the table should use instead,
+ * e.g. a copy of it that's shared by several tables. */
+typedef char *(*DlInternCallback) (char *filepath, void *data);
+
+/* Decode the line number program at `offset` in `.debug_line`.
+ * `comp_dir` is the compilation directory of the unit that the
+ * program belongs to, or NULL. Relative paths in the file table
+ * are resolved against it like libdwarf's `dwarf_linesrc` does.
+ * Each path is passed to `intern` with `intern_data` unless it's
+ * NULL. Returns `SP_ERR` if the program is invalid or uses a
+ * feature that isn't supported. `table` must be freed in either
+ * case. */
+SprayResult dl_decode_line_table (const DlSections * sections,
+				  uint64_t offset, const char *comp_dir,
+				  DlInternCallback intern, void *intern_data,
+				  DlLineTable * table);
+
+/* Like `dl_decode_line_table`, but only the file table is decoded.
+ * The file paths are the same as those of `dwarf_srcfiles`. */
+SprayResult dl_decode_file_table (const DlSections * sections,
+				  uint64_t offset, const char *comp_dir,
+				  DlInternCallback intern, void *intern_data,
+				  DlLineTable * table);
+
+void dl_free_line_table (DlLineTable * table);
+
+#endif /* _SPRAY_DEBUG_LINE_H_ */
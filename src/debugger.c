@@ -1,8 +1,14 @@
 #include "debugger.h"
-#include "backtrace.h"
+#include "args.h"
+#include "coverage.h"
+#include "dump.h"
+#include "event_loop.h"
+#include "json.h"
 #include "magic.h"
 #include "ptrace.h"
 #include "registers.h"
+#include "stats.h"
+#include "trace.h"
 #include "print_source.h"
 
 #include "linenoise.h"
@@ -16,7 +22,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <regex.h>
+#include <inttypes.h>
 #include <limits.h>		/* `UINT_MAX` */
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <sys/personality.h>
 
@@ -124,6 +134,79 @@ print_current_source (Debugger *dbg)
 /*********************************/
 
 SprayResult wait_for_signal (Debugger * dbg);
+SprayResult wait_for_step (Debugger * dbg, int request);
+
+/* Get a copy of the tracee's stack. It's taken the first time it's
+ * needed after each stop. Returns NULL if it couldn't be copied. */
+const StackSnapshot *
+get_stack_snapshot (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* Reads from a core dump are served from its mapping already. */
+  if (dbg->core != NULL)
+    {
+      return NULL;
+    }
+
+  if (dbg->stack != NULL)
+    {
+      add_stat (STAT_STOP_CACHE_HITS, 1);
+    }
+  else
+    {
+      add_stat (STAT_STOP_CACHE_MISSES, 1);
+      uint64_t stack_pointer = 0;
+      if (get_register_value (dbg->pid, rsp, &stack_pointer) == SP_ERR)
+	{
+	  return NULL;
+	}
+
+      size_t cap = get_args ()->flags.stack_cap;
+      dbg->stack = init_stack_snapshot (dbg->pid,
+					(real_addr) {stack_pointer},
+					cap != 0 ? cap : DEFAULT_STACK_CAP);
+    }
+
+  return dbg->stack;
+}
+
+/* Get the call frames of the tracee. They're unwound the first
+ * time they're needed after each stop. Returns NULL on error. */
+const CallFrame *
+get_call_frames (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  if (dbg->frames != NULL)
+    {
+      add_stat (STAT_STOP_CACHE_HITS, 1);
+    }
+  else
+    {
+      add_stat (STAT_STOP_CACHE_MISSES, 1);
+      dbg->frames = init_backtrace (get_dbg_pc (dbg), dbg->load_address,
+				    get_stack_snapshot (dbg), dbg->pid,
+				    dbg->info);
+    }
+
+  return dbg->frames;
+}
+
+/* Drop the stack snapshot, the call frames and the registers of the
+ * selected thread. Must be called whenever the tracee's stack or
+ * registers might have changed. */
+void
+invalidate_stop_cache (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  forget_thread_registers (dbg->threads, dbg->pid);
+  free_backtrace (dbg->frames);
+  dbg->frames = NULL;
+  free_stack_snapshot (dbg->stack);
+  dbg->stack = NULL;
+}
 
 /* Execute the instruction at the breakpoints location
  * and stop the tracee again. */
@@ -139,7 +222,7 @@ single_step_breakpoint (Debugger *dbg)
       /* Disable the breakpoint, run the original instruction and stop. */
       disable_breakpoint (dbg->breakpoints, pc_address);
       pt_single_step (dbg->pid);
-      SprayResult res = wait_for_signal (dbg);
+      SprayResult res = wait_for_step (dbg, PTRACE_SINGLESTEP);
       enable_breakpoint (dbg->breakpoints, pc_address);
       return res;
     }
@@ -159,7 +242,7 @@ continue_execution (Debugger *dbg)
   single_step_breakpoint (dbg);
 
   errno = 0;
-  pt_continue_execution (dbg->pid);
+  resume_all_threads (dbg->threads);
 
   /* Is the process still alive? */
   if (errno == ESRCH)
@@ -186,30 +269,81 @@ handle_sigtrap (Debugger *dbg, siginfo_t siginfo)
 }
 
 SprayResult
-wait_for_signal (Debugger *dbg)
+handle_state_change (Debugger *dbg, pid_t tid, int wait_status,
+		     bool *is_resumed)
 {
   assert (dbg != NULL);
+  assert (is_resumed != NULL);
 
-  /* Wait for the tracee to be stopped by receiving a
-   * signal. Once the tracee is stopped again we can
-   * continue to poke at it. Effectively this is just
-   * waiting until the next breakpoint sends the tracee
-   * another SIGTRAP. */
+  *is_resumed = false;
 
-  /* In general the following events are awaited by `waitpid`:
-   * - child is terminated
-   * - child is stopped by a signal
-   * - child resumes from a signal
-   */
-  int wait_status;		/* Store status info here. */
-  int options = 0;		/* Normal behavior. */
-  waitpid (dbg->pid, &wait_status, options);
+  /* The tracee ran so everything that was cached is outdated. */
+  invalidate_stop_cache (dbg);
+
+  /* Signals that shouldn't stop the tracee are handled right away
+   * without stopping the other threads. `SIGTRAP`s and events
+   * are always meant for the debugger. */
+  int signo = WIFSTOPPED (wait_status) ? WSTOPSIG (wait_status) : 0;
+  bool is_signal = signo != 0 && signo != SIGTRAP && wait_status >> 16 == 0;
+  SignalPolicy policy = { .stop = true,.print = true,.pass = false };
+  if (is_signal)
+    {
+      policy = signal_policy (dbg->signals, signo);
+    }
+
+  if (is_signal && !policy.stop)
+    {
+      if (policy.print)
+	{
+	  char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+	  signal_name (signo, name);
+	  print_info ("Child received SIG%s", name);
+	}
+      set_thread_signal (dbg->threads, tid, policy.pass ? signo : 0);
+
+      if (dbg->step_request == PTRACE_SINGLEBLOCK)
+	{
+	  /* Finish the step first. The signal is delivered
+	   * later on so that the step doesn't end up in the
+	   * signal handler. */
+	  *is_resumed = pt_single_block (tid) == SP_OK;
+	}
+      else if (dbg->step_request == PTRACE_SINGLESTEP)
+	{
+	  *is_resumed = pt_single_step (tid) == SP_OK;
+	}
+      else
+	{
+	  /* The other threads weren't stopped for this signal. */
+	  *is_resumed = resume_thread (dbg->threads, tid) == SP_OK;
+	}
+      return SP_OK;
+    }
+
+  /* Stop all other threads too, and select the thread that stopped. */
+  if (WIFSTOPPED (wait_status))
+    {
+      stop_all_threads (dbg->threads, dbg->breakpoints);
+
+      if (tid != dbg->pid)
+	{
+	  dbg->pid = tid;
+	  size_t number = 0;
+	  thread_number (dbg->threads, tid, &number);
+	  print_info ("Switched to thread %zu (%d)", number, tid);
+	}
+    }
 
   /* Display some info about the state-change which
    * has just stopped the tracee. This helps grasp
    * what state the tracee is in now that we can
    * inspect it. */
 
+  if (WIFEXITED (wait_status) || WIFSIGNALED (wait_status))
+    {
+      dbg->exit_status = wait_status;
+    }
+
   /* Did the tracee terminate normally? */
   if (WIFEXITED (wait_status))
     {
@@ -236,6 +370,12 @@ wait_for_signal (Debugger *dbg)
       siginfo_t siginfo = { 0 };
       pt_get_signal_info (dbg->pid, &siginfo);
 
+      /* The signal is delivered once the tracee continues. */
+      if (is_signal && policy.pass)
+	{
+	  set_thread_signal (dbg->threads, dbg->pid, signo);
+	}
+
       switch (siginfo.si_signo)
 	{
 	case SIGSEGV:
@@ -250,16 +390,13 @@ wait_for_signal (Debugger *dbg)
 	   * man-page for more. */
 
 	  return SP_OK;
-	case SIGWINCH:
-	  /* Ignore changes in window size by telling the
-	   * tracee to continue in that case and then wait for
-	   * the next interesting signal. */
-	  continue_execution (dbg);
-	  return wait_for_signal (dbg);
 	default:
-	  print_info ("Child was stopped by SIG%s",
-		      sigabbrev_np (WSTOPSIG (wait_status)));
-	  return SP_OK;
+	  {
+	    char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+	    signal_name (WSTOPSIG (wait_status), name);
+	    print_info ("Child was stopped by SIG%s", name);
+	    return SP_OK;
+	  }
 	}
     }
   else
@@ -269,212 +406,679 @@ wait_for_signal (Debugger *dbg)
     }
 }
 
+/* Handle a state change of the tracee that was reported for
+ * the thread `tid`. `is_resumed` is set to whether the tracee
+ * was resumed right away because the stop isn't of interest. */
 SprayResult
-single_step_instruction (Debugger *dbg)
+handle_stop (Debugger *dbg, pid_t tid, int wait_status, bool *is_resumed)
+{
+  TraceSpan span = begin_span ("stop");
+  SprayResult res = handle_state_change (dbg, tid, wait_status, is_resumed);
+  end_span (span, "handle_stop", "thread %d, status 0x%x", tid, wait_status);
+  return res;
+}
+
+/* Sample the monitor whose timer `timer_fd` expired, and print
+ * its value if it changed. */
+void
+report_monitor_sample (Debugger *dbg, int timer_fd)
 {
   assert (dbg != NULL);
 
-  if (lookup_breakpoint (dbg->breakpoints, get_pc (dbg->pid)))
+  bool is_changed = false;
+  const Monitor *monitor = sample_monitor (dbg->monitors, timer_fd,
+					   dbg->pid, &is_changed);
+  if (monitor == NULL || !is_changed)
     {
-      single_step_breakpoint (dbg);
-      return SP_OK;
+      return;
     }
-  else
+
+  if (monitor->has_failed)
     {
-      pt_single_step (dbg->pid);
-      return wait_for_signal (dbg);
+      repl_err ("Failed to read %s", monitor->name);
+      return;
     }
+
+  char *value_str = monitor_value_str (monitor);
+  print_info ("%s = %s", monitor->name,
+	      value_str != NULL ? value_str : "<?>");
+  free (value_str);
 }
 
-/* Set a breakpoint on the current return address.
- * Used for source-level stepping. Returns whether or
- * breakpoint must be removed again after use.
- * If it was to be removed,  the value of `return_address`
- * is set to the address where the breakpoint was created. */
-bool
-set_return_address_breakpoint (Breakpoints *breakpoints, pid_t pid,
-			       real_addr *return_address)
+void
+callback__sample_monitor (int fd, void *void_dbg)
 {
-  assert (breakpoints != NULL);
-  assert (return_address != NULL);
+  report_monitor_sample ((Debugger *) void_dbg, fd);
+}
 
-  /* The return address is stored 8 bytes after the
-   * start of the stack frame. This is where we want
-   * to set a breakpoint. */
-  uint64_t frame_pointer = 0;
-  SprayResult res = get_register_value (pid, rbp, &frame_pointer);
-  assert (res == SP_OK);
+void
+callback__drain_signals (int fd, void *data)
+{
+  unused (data);
 
-  real_addr return_address_location = { frame_pointer + 8 };
-  pt_read_memory (pid, return_address_location, &return_address->value);
+  struct signalfd_siginfo siginfo;
+  while (read (fd, &siginfo, sizeof (siginfo)) == sizeof (siginfo))
+    ;
+}
 
-  bool remove_transient_breakpoint = false;
-  if (!lookup_breakpoint (breakpoints, *return_address))
+/* Should the monitors be sampled while waiting for the tracee? The
+ * asynchronous REPL samples them in its own event loop, and steps
+ * don't take long enough. */
+bool
+is_monitoring (const Debugger *dbg)
+{
+  size_t n_monitors = 0;
+  if (dbg->is_async || dbg->step_request != 0 || dbg->monitors == NULL)
     {
-      enable_breakpoint (breakpoints, *return_address);
-      remove_transient_breakpoint = true;
+      return false;
     }
-
-  return remove_transient_breakpoint;
+  all_monitors (dbg->monitors, &n_monitors);
+  return n_monitors > 0;
 }
 
-/* Step outside of the current function. */
-SprayResult
-step_out (Debugger *dbg)
+/* Wait for the next event of a thread like `wait_for_thread`, and
+ * sample the monitors in the meantime. `SIGCHLD` is read from a
+ * signalfd so that it can be waited for together with the timers.
+ * If `fd` isn't -1, `callback` is run with `data` whenever `fd` is
+ * ready, and 0 is returned once it sets `*is_interrupted`. */
+pid_t
+wait_watching (Debugger *dbg, int fd, EventCallback callback, void *data,
+	       const bool *is_interrupted, int *wait_status)
 {
   assert (dbg != NULL);
+  assert (fd == -1 || (callback != NULL && is_interrupted != NULL));
+  assert (wait_status != NULL);
+
+  sigset_t signals;
+  sigset_t old_signals;
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGCHLD);
+  sigprocmask (SIG_BLOCK, &signals, &old_signals);
+
+  int signal_fd = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  EventLoop *events = init_event_loop ();
+  bool is_sampling = is_monitoring (dbg);
+
+  pid_t tid = 0;
+  if (signal_fd != -1 && events != NULL
+      && watch_fd (events, signal_fd, callback__drain_signals, NULL) == SP_OK
+      && (fd == -1 || watch_fd (events, fd, callback, data) == SP_OK)
+      && (!is_sampling
+	  || watch_monitors (dbg->monitors, events, callback__sample_monitor,
+			     dbg) == SP_OK))
+    {
+      if (is_sampling)
+	{
+	  resume_monitors (dbg->monitors);
+	}
+      /* Events that happened before `SIGCHLD` was
+       * blocked are found by polling first. */
+      while ((tid = poll_thread (dbg->threads, wait_status)) == 0
+	     && (fd == -1 || !*is_interrupted)
+	     && dispatch_events (events, -1) == SP_OK)
+	;
+      if (is_sampling)
+	{
+	  pause_monitors (dbg->monitors);
+	  unwatch_monitors (dbg->monitors);
+	}
+    }
 
-  real_addr return_address = { 0 };
-  bool remove_internal_breakpoint =
-    set_return_address_breakpoint (dbg->breakpoints,
-				   dbg->pid,
-				   &return_address);
+  free_event_loop (events);
+  if (signal_fd != -1)
+    {
+      close (signal_fd);
+    }
+  sigprocmask (SIG_SETMASK, &old_signals, NULL);
 
-  continue_execution (dbg);
-  SprayResult res = wait_for_signal (dbg);
+  /* Wait without the event loop if it failed. */
+  if (tid == 0 && (fd == -1 || !*is_interrupted))
+    {
+      tid = wait_for_thread (dbg->threads, wait_status);
+    }
+  return tid;
+}
 
-  if (remove_internal_breakpoint)
+SprayResult
+wait_for_signal (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  SprayResult res = SP_OK;
+  bool is_resumed = true;
+  while (is_resumed)
     {
-      disable_breakpoint (dbg->breakpoints, return_address);
+      /* Wait for the tracee to be stopped by receiving a
+       * signal. Once the tracee is stopped again we can
+       * continue to poke at it. Effectively this is just
+       * waiting until the next breakpoint sends the tracee
+       * another SIGTRAP. */
+
+      /* In general the following events are awaited:
+       * - child is terminated
+       * - a thread of the child is stopped by a signal
+       * - child resumes from a signal
+       */
+      int wait_status;		/* Store status info here. */
+      TraceSpan span = begin_span ("stop");
+      pid_t tid = is_monitoring (dbg)
+	? wait_watching (dbg, -1, NULL, NULL, NULL, &wait_status)
+	: wait_for_thread (dbg->threads, &wait_status);
+      end_span (span, "wait", NULL);
+      if (tid == -1)
+	{
+	  repl_err ("Failed to wait for the child");
+	  return SP_ERR;
+	}
+
+      res = handle_stop (dbg, tid, wait_status, &is_resumed);
     }
 
   return res;
 }
 
-/* Single step instructions until the line number has changed. */
+/* Wait for the selected thread to finish a step
+ * that was started with the ptrace `request`. */
 SprayResult
-single_step_line (Debugger *dbg)
+wait_for_step (Debugger *dbg, int request)
+{
+  assert (dbg != NULL);
+
+  dbg->step_request = request;
+  SprayResult res = wait_for_signal (dbg);
+  dbg->step_request = 0;
+  return res;
+}
+
+SprayResult
+single_step_instruction (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  const Position *pos = addr_position (get_dbg_pc (dbg), dbg->info);
-  if (pos == NULL)
+  if (lookup_breakpoint (dbg->breakpoints, get_pc (dbg->pid)))
     {
-      printf ("Failed to find current line");
-      return SP_ERR;
+      single_step_breakpoint (dbg);
+      return SP_OK;
+    }
+  else
+    {
+      pt_single_step (dbg->pid);
+      return wait_for_step (dbg, PTRACE_SINGLESTEP);
     }
+}
 
-  uint32_t init_line = pos->line;
+/* Execute instructions until the next branch is taken. Falls
+ * back to stepping a single instruction if the kernel doesn't
+ * support block stepping. */
+SprayResult
+single_step_block (Debugger *dbg)
+{
+  assert (dbg != NULL);
 
-  /* Single step instructions until we find a valid line
-   * with a different line number than before. */
-  unsigned n_instruction_steps = 0;
-  while (!pos->is_exact || pos->line == init_line)
+  if (lookup_breakpoint (dbg->breakpoints, get_pc (dbg->pid)))
     {
-      if (single_step_instruction (dbg) == SP_ERR)
-	return SP_ERR;
-
-      n_instruction_steps++;
+      single_step_breakpoint (dbg);
+      return SP_OK;
+    }
 
-      /* Should we continue searching? We stop after
-       * a certain number of attempts has been made. */
-      pos = addr_position (get_dbg_pc (dbg), dbg->info);
-      if (pos == NULL || n_instruction_steps >= SINGLE_STEP_SEARCH_LIMIT)
+  if (dbg->is_block_step_supported)
+    {
+      errno = 0;
+      if (pt_single_block (dbg->pid) == SP_OK)
+	{
+	  return wait_for_step (dbg, PTRACE_SINGLEBLOCK);
+	}
+      else if (errno == EIO)
+	{
+	  dbg->is_block_step_supported = false;
+	}
+      else
 	{
-	  repl_err ("Failed to find another line to step to");
 	  return SP_ERR;
 	}
     }
 
-  return SP_OK;
+  pt_single_step (dbg->pid);
+  return wait_for_step (dbg, PTRACE_SINGLESTEP);
 }
 
-/* Step to the next line. Don't step into functions. */
+/* Set a breakpoint on the address that the current function
+ * returns to. Used for source-level stepping. Returns `SP_ERR` if
+ * the return address is unknown. `remove_breakpoint` is set to
+ * whether the breakpoint must be removed again after use. */
 SprayResult
-step_over (Debugger *dbg)
+set_return_address_breakpoint (Debugger *dbg, real_addr *return_address,
+			       bool *remove_breakpoint)
 {
   assert (dbg != NULL);
+  assert (return_address != NULL);
+  assert (remove_breakpoint != NULL);
 
-  /* This functions sets breakpoints all over the current DWARF
-   * subprogram except for the next line so that we stop right
-   * after executing the code in it. */
+  *remove_breakpoint = false;
 
-  const DebugSymbol *func = sym_by_addr (get_dbg_pc (dbg), dbg->info);
-  if (func == NULL)
+  const CallFrame *frames = get_call_frames (dbg);
+  if (frames == NULL || frame_caller (frames) == NULL)
     {
-      repl_err ("Failed to find current function");
       return SP_ERR;
     }
 
-  real_addr *to_del = NULL;
-  size_t n_to_del = 0;
+  *return_address = dbg_to_real (dbg->load_address,
+				 frame_pc (frame_caller (frames)));
 
-  SprayResult set_res = set_step_over_breakpoints (func,
-						   dbg->info,
-						   dbg->load_address,
-						   dbg->breakpoints,
-						   &to_del,
-						   &n_to_del);
-  if (set_res == SP_ERR)
+  if (!lookup_breakpoint (dbg->breakpoints, *return_address))
     {
-      repl_err ("Failed to set breakpoints in current scope");
-      return SP_ERR;
+      enable_breakpoint (dbg->breakpoints, *return_address);
+      *remove_breakpoint = true;
     }
 
-  real_addr return_address = { 0 };
-  bool remove_internal_breakpoint =
-    set_return_address_breakpoint (dbg->breakpoints,
-				   dbg->pid,
-				   &return_address);
+  return SP_OK;
+}
 
-  continue_execution (dbg);
-  SprayResult exec_res = wait_for_signal (dbg);
+/* Step outside of the current function. */
+SprayResult
+step_out (Debugger *dbg)
+{
+  assert (dbg != NULL);
 
-  for (size_t i = 0; i < n_to_del; i++)
+  real_addr return_address = { 0 };
+  bool remove_internal_breakpoint = false;
+  if (set_return_address_breakpoint (dbg, &return_address,
+				     &remove_internal_breakpoint) == SP_ERR)
     {
-      disable_breakpoint (dbg->breakpoints, to_del[i]);
+      repl_err ("Failed to find the return address of the current function");
+      return SP_ERR;
     }
-  free (to_del);
+
+  continue_execution (dbg);
+  SprayResult res = wait_for_signal (dbg);
 
   if (remove_internal_breakpoint)
     {
       disable_breakpoint (dbg->breakpoints, return_address);
     }
 
-  return exec_res;
+  return res;
 }
 
-/***************************************/
-/* Filtered printing of command output */
-/***************************************/
+/* Check if the tracee just entered a function by executing a call
+ * instruction inside of `range`. If so, the address the function
+ * will return to is stored in `return_address`. */
+bool
+is_call_from_range (Debugger *dbg, AddrRange range,
+		    real_addr *return_address)
+{
+  assert (dbg != NULL);
+  assert (return_address != NULL);
 
-typedef enum
-  {
-    PF_NONE = FMT_NONE,
-    PF_HEX = FMT_HEX,
-    PF_BITS = FMT_BITS,
-    PF_ADDR = FMT_ADDR,
-    PF_DEC = FMT_DEC,
-    PF_BYTES = FMT_BYTES,
-    /* Interpret the value that would usually be printed as an address,
-     * read the value at that address in memory and print that value. */
-    PF_DEREF,
-  } PrintFilter;
+  /* Right after a call, the return address is on top of the stack. */
+  uint64_t stack_pointer = 0;
+  if (get_register_value (dbg->pid, rsp, &stack_pointer) == SP_ERR)
+    {
+      return false;
+    }
 
-typedef enum
-  {
-    MEM_READ,			/* A memory location was read. */
-    /* A memory location was read as confirmation of a write. */
-    MEM_READ_CONFIRM,
-    REG_READ,
-    REG_READ_CONFIRM,
-    VAR_READ,			/* A variable was read. */
-    VAR_READ_CONFIRM,
-  } PrintValueInfo;
+  real_addr top_of_stack = { 0 };
+  if (pt_read_memory (dbg->pid, (real_addr) {stack_pointer},
+		      &top_of_stack.value) == SP_ERR)
+    {
+      return false;
+    }
 
-/* Print the given value based on (the list of) filter(s).
- * TODO: Use a list of filters. */
-void
-print_filtered (pid_t pid, uint64_t value, PrintFilter filter,
-		PrintValueInfo info, const void *extra)
-{
-  if (filter == PF_DEREF)
+  /* The return address is right after the call instruction.
+   * If the call is the last instruction of the line, it's
+   * equal to the end of the range. */
+  dbg_addr dbg_return_address = real_to_dbg (dbg->load_address,
+					     top_of_stack);
+  if (range.start.value < dbg_return_address.value &&
+      dbg_return_address.value <= range.end.value)
     {
-      real_addr addr = { 0 };
-      if (info == VAR_READ)
-	addr.value = mask_var_value (extra, value);
-      else
-	addr.value = value;
+      *return_address = top_of_stack;
+      return true;
+    }
+  else
+    {
+      return false;
+    }
+}
+
+/* Continue until the function that was just called returns to
+ * `return_address`. */
+SprayResult
+finish_call (Debugger *dbg, real_addr return_address)
+{
+  assert (dbg != NULL);
+
+  bool remove_internal_breakpoint = false;
+  if (!lookup_breakpoint (dbg->breakpoints, return_address))
+    {
+      enable_breakpoint (dbg->breakpoints, return_address);
+      remove_internal_breakpoint = true;
+    }
+
+  SprayResult res = continue_execution (dbg);
+  if (res == SP_OK)
+    {
+      res = wait_for_signal (dbg);
+    }
+
+  if (remove_internal_breakpoint)
+    {
+      disable_breakpoint (dbg->breakpoints, return_address);
+    }
+
+  return res;
+}
+
+/* Set a breakpoint on the first address after `range`. Block
+ * stepping only stops after branches. This breakpoint stops it
+ * if the code falls through to the end of the range. Returns
+ * whether the breakpoint must be removed again. */
+bool
+set_range_end_breakpoint (Debugger *dbg, AddrRange range,
+			  real_addr *range_end)
+{
+  assert (dbg != NULL);
+  assert (range_end != NULL);
+
+  *range_end = dbg_to_real (dbg->load_address, range.end);
+  if (!lookup_breakpoint (dbg->breakpoints, *range_end))
+    {
+      return enable_breakpoint (dbg->breakpoints, *range_end) == SP_OK;
+    }
+  else
+    {
+      return false;
+    }
+}
+
+/* Run until the line number has changed.
+ *
+ * The range of addresses that belongs to the current line is
+ * looked up once. Then, the tracee is advanced branch by branch
+ * until the PC leaves this range. Only then is the new position
+ * looked up. Calls to code without line information (e.g. library
+ * functions) are stepped over by continuing to their return address. */
+SprayResult
+single_step_line (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  dbg_addr pc = get_dbg_pc (dbg);
+  const Position *pos = addr_position (pc, dbg->info);
+  AddrRange range = { 0 };
+  if (pos == NULL || addr_line_range (pc, dbg->info, &range) == SP_ERR)
+    {
+      repl_err ("Failed to find current line");
+      return SP_ERR;
+    }
+
+  uint32_t init_line = pos->line;
+
+  real_addr range_end = { 0 };
+  bool remove_range_end = set_range_end_breakpoint (dbg, range, &range_end);
+  SprayResult res = SP_OK;
+
+  /* Step until we find a valid line with a
+   * different line number than before. */
+  while (true)
+    {
+      res = single_step_block (dbg);
+      if (res == SP_ERR)
+	break;
+
+      pc = get_dbg_pc (dbg);
+      if (addr_in_range (pc, range))
+	{
+	  continue;
+	}
+
+      pos = addr_position (pc, dbg->info);
+      if (pos == NULL)
+	{
+	  real_addr return_address = { 0 };
+	  if (is_call_from_range (dbg, range, &return_address))
+	    {
+	      res = finish_call (dbg, return_address);
+	      if (res == SP_ERR)
+		break;
+	      continue;
+	    }
+	  else
+	    {
+	      repl_err ("Failed to find another line to step to");
+	      res = SP_ERR;
+	      break;
+	    }
+	}
+
+      if (pos->is_exact && pos->line != init_line)
+	{
+	  break;
+	}
+
+      /* We ended up in the middle of a line or in another part of
+       * the initial line. Keep stepping through the new range. */
+      if (addr_line_range (pc, dbg->info, &range) == SP_ERR)
+	{
+	  repl_err ("Failed to find another line to step to");
+	  res = SP_ERR;
+	  break;
+	}
+
+      if (remove_range_end)
+	{
+	  disable_breakpoint (dbg->breakpoints, range_end);
+	}
+      remove_range_end = set_range_end_breakpoint (dbg, range, &range_end);
+    }
+
+  if (remove_range_end)
+    {
+      disable_breakpoint (dbg->breakpoints, range_end);
+    }
+
+  return res;
+}
+
+/* Step to the next line. Don't step into functions. */
+SprayResult
+step_over (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* This functions sets breakpoints all over the current DWARF
+   * subprogram except for the next line so that we stop right
+   * after executing the code in it. */
+
+  const DebugSymbol *func = sym_by_addr (get_dbg_pc (dbg), dbg->info);
+  if (func == NULL)
+    {
+      repl_err ("Failed to find current function");
+      return SP_ERR;
+    }
+
+  real_addr *to_del = NULL;
+  size_t n_to_del = 0;
+
+  SprayResult set_res = set_step_over_breakpoints (func,
+						   dbg->info,
+						   dbg->load_address,
+						   dbg->breakpoints,
+						   &to_del,
+						   &n_to_del);
+  if (set_res == SP_ERR)
+    {
+      repl_err ("Failed to set breakpoints in current scope");
+      return SP_ERR;
+    }
+
+  /* Stop in the caller if the function returns. There's no
+   * caller to stop in if this is the outermost function. */
+  real_addr return_address = { 0 };
+  bool remove_internal_breakpoint = false;
+  set_return_address_breakpoint (dbg, &return_address,
+				 &remove_internal_breakpoint);
+
+  continue_execution (dbg);
+  SprayResult exec_res = wait_for_signal (dbg);
+
+  for (size_t i = 0; i < n_to_del; i++)
+    {
+      disable_breakpoint (dbg->breakpoints, to_del[i]);
+    }
+  free (to_del);
+
+  if (remove_internal_breakpoint)
+    {
+      disable_breakpoint (dbg->breakpoints, return_address);
+    }
+
+  return exec_res;
+}
+
+/*********************************/
+/* Recording stops of the tracee */
+/*********************************/
+
+/* Is the tracee still alive? */
+bool
+is_tracee_alive (Debugger *dbg)
+{
+  assert (dbg != NULL);
+  return lookup_thread (dbg->threads, threads_leader (dbg->threads));
+}
+
+/* Record the stop that the tracee reached with `movement`. */
+void
+record_movement (Debugger *dbg, Movement movement)
+{
+  assert (dbg != NULL);
+
+  dbg->n_stops++;
+  if (dbg->checkpoints == NULL)
+    {
+      return;
+    }
+
+  bool is_alive = is_tracee_alive (dbg);
+  Stop stop = {
+    .movement = movement,
+    .pc = is_alive ? get_pc (dbg->pid) : (real_addr) {0},
+    .is_breakpoint = is_alive && is_user_breakpoint (dbg),
+  };
+
+  size_t n_deleted = record_stop (dbg->checkpoints, stop);
+  if (n_deleted > 0)
+    {
+      print_info ("The program took a different path. Deleted %zu "
+		  "checkpoint%s taken later on", n_deleted,
+		  n_deleted == 1 ? "" : "s");
+    }
+}
+
+/* Bring the tracked changes of the tracee up to date before it's
+ * resumed, so that the next changes are those until it stops. */
+void
+reset_tracked_changes (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  if (dbg->changes != NULL && reset_changes (dbg->changes) == SP_ERR)
+    {
+      repl_err ("Stopped tracking changes: %s", strerror (errno));
+      stop_tracking_changes (dbg->changes);
+    }
+}
+
+/* Move the tracee with `movement` and wait until it stops.
+ * The stop is recorded unless the tracee didn't move. */
+SprayResult
+move_tracee (Debugger *dbg, Movement movement)
+{
+  assert (dbg != NULL);
+
+  bool was_alive = is_tracee_alive (dbg);
+  if (was_alive)
+    {
+      reset_tracked_changes (dbg);
+    }
+  SprayResult res = SP_ERR;
+  switch (movement)
+    {
+    case MOVE_CONTINUE:
+      res = continue_execution (dbg);
+      if (res == SP_OK)
+	{
+	  res = wait_for_signal (dbg);
+	}
+      break;
+    case MOVE_STEP:
+      /* Single step instructions until the line number has changed. */
+      res = single_step_line (dbg);
+      break;
+    case MOVE_NEXT:
+      res = step_over (dbg);
+      break;
+    case MOVE_INST:
+      res = single_step_instruction (dbg);
+      break;
+    case MOVE_LEAVE:
+      res = step_out (dbg);
+      break;
+    case MOVE_INTERRUPT:
+      /* Interrupts happen at random and can't be repeated. */
+      return SP_ERR;
+    }
+
+  if (res == SP_OK || (was_alive && !is_tracee_alive (dbg)))
+    {
+      record_movement (dbg, movement);
+    }
+
+  return res;
+}
+
+/***************************************/
+/* Filtered printing of command output */
+/***************************************/
+
+typedef enum
+  {
+    PF_NONE = FMT_NONE,
+    PF_HEX = FMT_HEX,
+    PF_BITS = FMT_BITS,
+    PF_ADDR = FMT_ADDR,
+    PF_DEC = FMT_DEC,
+    PF_BYTES = FMT_BYTES,
+    /* Interpret the value that would usually be printed as an address,
+     * read the value at that address in memory and print that value. */
+    PF_DEREF,
+  } PrintFilter;
+
+typedef enum
+  {
+    MEM_READ,			/* A memory location was read. */
+    /* A memory location was read as confirmation of a write. */
+    MEM_READ_CONFIRM,
+    REG_READ,
+    REG_READ_CONFIRM,
+    VAR_READ,			/* A variable was read. */
+    VAR_READ_CONFIRM,
+  } PrintValueInfo;
+
+/* Print the given value based on (the list of) filter(s).
+ * TODO: Use a list of filters. */
+void
+print_filtered (pid_t pid, uint64_t value, PrintFilter filter,
+		PrintValueInfo info, const void *extra)
+{
+  if (filter == PF_DEREF)
+    {
+      real_addr addr = { 0 };
+      if (info == VAR_READ)
+	addr.value = mask_var_value (extra, value);
+      else
+	addr.value = value;
 
       uint64_t deref = { 0 };
       SprayResult res = pt_read_memory (pid, addr, &deref);
@@ -708,7 +1312,8 @@ exec_print_variable (Debugger *dbg, const char *var_name,
   if (is_addr_loc (var))
     {
       real_addr loc_addr = var_loc_addr (var);
-      read_res = pt_read_memory (dbg->pid, loc_addr, &value);
+      read_res = read_stack (get_stack_snapshot (dbg), dbg->pid,
+			     loc_addr, &value);
     }
 
   /* Is this location a register number? */
@@ -817,17 +1422,57 @@ exec_delete (Breakpoints *breakpoints, real_addr addr)
   disable_breakpoint (breakpoints, addr);
 }
 
-/* Execute the instruction at the current breakpoint,
- * continue the tracee and wait until it receives the
- * next signal. */
+/* Handle all stops of the tracee that were reported while it
+ * was running in the background. Returns right away if there
+ * are none. */
+void
+poll_tracee (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  int wait_status = 0;
+  pid_t tid = 0;
+  while (dbg->is_running
+	 && (tid = poll_thread (dbg->threads, &wait_status)) > 0)
+    {
+      bool is_resumed = false;
+      SprayResult res = handle_stop (dbg, tid, wait_status, &is_resumed);
+      if (!is_resumed)
+	{
+	  dbg->is_running = false;
+	  pause_monitors (dbg->monitors);
+	  record_movement (dbg, MOVE_CONTINUE);
+	  if (res == SP_OK)
+	    {
+	      print_current_source (dbg);
+	    }
+	}
+    }
+}
+
 void
 exec_continue (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  if (continue_execution (dbg) == SP_OK)
-    if (wait_for_signal (dbg) == SP_OK)
-      print_current_source (dbg);
+  /* Don't wait for the tracee to stop. The stop is
+   * reported by `poll_tracee` once it happens. */
+  if (dbg->is_async)
+    {
+      reset_tracked_changes (dbg);
+      if (continue_execution (dbg) == SP_OK)
+	{
+	  dbg->is_running = true;
+	  resume_monitors (dbg->monitors);
+	  /* Stops that happened earlier while the
+	   * tracee was stopped are reported now. */
+	  poll_tracee (dbg);
+	}
+      return;
+    }
+
+  if (move_tracee (dbg, MOVE_CONTINUE) == SP_OK)
+    print_current_source (dbg);
 }
 
 void
@@ -835,7 +1480,7 @@ exec_inst (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  if (single_step_instruction (dbg) == SP_OK)
+  if (move_tracee (dbg, MOVE_INST) == SP_OK)
     print_current_source (dbg);
 }
 
@@ -844,7 +1489,7 @@ exec_leave (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  if (step_out (dbg) == SP_OK)
+  if (move_tracee (dbg, MOVE_LEAVE) == SP_OK)
     print_current_source (dbg);
 }
 
@@ -853,8 +1498,7 @@ exec_step (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  /* Single step instructions until the line number has changed. */
-  if (single_step_line (dbg) == SP_OK)
+  if (move_tracee (dbg, MOVE_STEP) == SP_OK)
     print_current_source (dbg);
 }
 
@@ -863,7 +1507,7 @@ exec_next (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  if (step_over (dbg) == SP_OK)
+  if (move_tracee (dbg, MOVE_NEXT) == SP_OK)
     print_current_source (dbg);
 }
 
@@ -872,10 +1516,7 @@ exec_backtrace (Debugger *dbg)
 {
   assert (dbg != NULL);
 
-  CallFrame *backtrace = init_backtrace (get_dbg_pc (dbg),
-					 dbg->load_address,
-					 dbg->pid,
-					 dbg->info);
+  const CallFrame *backtrace = get_call_frames (dbg);
   if (backtrace == NULL)
     {
       repl_err ("Failed to determine backtrace");
@@ -884,714 +1525,3026 @@ exec_backtrace (Debugger *dbg)
     {
       print_backtrace (backtrace);
     }
-  free_backtrace (backtrace);
 }
 
-
-/*******************/
-/* Command Parsing */
-/*******************/
-
-static inline const char *
-next_token (char *const *tokens, size_t *i)
+void
+exec_interrupt (Debugger *dbg)
 {
-  assert (i != NULL);
-  const char *ret = tokens[*i];
-  if (ret == NULL)
+  assert (dbg != NULL);
+
+  if (!dbg->is_running)
     {
-      return NULL;
+      repl_err ("The process isn't running");
+      return;
     }
-  else
-    {
-      *i += 1;
-      return ret;
-    }
-}
 
-static inline bool
-end_of_tokens (char *const *tokens, size_t i)
-{
-  if (tokens[i] == NULL)
+  if (stop_all_threads (dbg->threads, dbg->breakpoints) == SP_ERR)
     {
-      return true;
+      repl_err ("Failed to interrupt the process");
+      return;
     }
-  else
+
+  dbg->is_running = false;
+  pause_monitors (dbg->monitors);
+  invalidate_stop_cache (dbg);
+
+  /* The selected thread might have exited in the meantime. */
+  if (!lookup_thread (dbg->threads, dbg->pid))
     {
-      repl_err ("Trailing characters in command");
-      return false;
+      dbg->pid = threads_leader (dbg->threads);
     }
+
+  record_movement (dbg, MOVE_INTERRUPT);
+  print_info ("Child was interrupted");
+  print_current_source (dbg);
 }
 
-bool
-is_command (const char *restrict in,
-	    char short_form, const char *restrict long_form)
+SprayResult
+continue_watching (Debugger *dbg, int fd, EventCallback callback,
+		   void *data, const bool *is_interrupted)
 {
-  if (in != NULL)
+  assert (dbg != NULL);
+  assert (callback != NULL);
+  assert (is_interrupted != NULL);
+
+  reset_tracked_changes (dbg);
+  if (continue_execution (dbg) == SP_ERR)
     {
-      return (strlen (in) == 1 && in[0] == short_form)
-	|| (str_eq (in, long_form));
+      return SP_ERR;
     }
-  else
+
+  SprayResult res = SP_OK;
+  bool is_resumed = true;
+  while (is_resumed)
     {
-      return false;
+      int wait_status = 0;
+      pid_t tid = wait_watching (dbg, fd, callback, data, is_interrupted,
+				 &wait_status);
+      if (tid == 0)
+	{
+	  /* Like `exec_interrupt`. */
+	  if (stop_all_threads (dbg->threads, dbg->breakpoints) == SP_ERR)
+	    {
+	      repl_err ("Failed to interrupt the process");
+	      return SP_ERR;
+	    }
+	  invalidate_stop_cache (dbg);
+	  if (!lookup_thread (dbg->threads, dbg->pid))
+	    {
+	      dbg->pid = threads_leader (dbg->threads);
+	    }
+	  record_movement (dbg, MOVE_INTERRUPT);
+	  print_info ("Child was interrupted");
+	  return SP_OK;
+	}
+      if (tid == -1)
+	{
+	  repl_err ("Failed to wait for the child");
+	  return SP_ERR;
+	}
+
+      res = handle_stop (dbg, tid, wait_status, &is_resumed);
     }
+
+  record_movement (dbg, MOVE_CONTINUE);
+  return res;
 }
 
-SprayResult
-parse_num (const char *restrict str, uint64_t *store, uint8_t base)
+void
+kill_tracee (Debugger *dbg)
 {
-  char *str_end;
-  uint64_t value = strtol (str, &str_end, base);
-  if (str[0] != '\0' && *str_end == '\0')
+  assert (dbg != NULL);
+
+  if (is_tracee_alive (dbg))
     {
-      *store = value;
-      return SP_OK;
+      kill (threads_leader (dbg->threads), SIGKILL);
+      wait_for_signal (dbg);
     }
-  else
+}
+
+void
+exec_threads (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  pid_t *tids = sorted_threads (dbg->threads);
+  for (size_t i = 0; i < n_threads (dbg->threads); i++)
     {
-      return SP_ERR;
+      size_t number = 0;
+      thread_number (dbg->threads, tids[i], &number);
+      printf ("%c %zu Thread %d", tids[i] == dbg->pid ? '*' : ' ',
+	      number, tids[i]);
+
+      const struct user_regs_struct *regs =
+	thread_registers (dbg->threads, tids[i]);
+      if (regs == NULL)
+	{
+	  printf (" <?>\n");
+	  continue;
+	}
+
+      real_addr real_pc = { regs->rip };
+      dbg_addr pc = real_to_dbg (dbg->load_address, real_pc);
+      const DebugSymbol *sym = sym_by_addr (pc, dbg->info);
+      const char *function = sym_name (sym, dbg->info);
+      const Position *pos = addr_position (pc, dbg->info);
+
+      printf (" " ADDR_FORMAT " %s", real_pc.value,
+	      function != NULL ? function : "<?>");
+      if (pos != NULL)
+	{
+	  printf (":%u", pos->line);
+	}
+      printf ("\n");
     }
+  free (tids);
 }
 
-SprayResult
-parse_base16 (const char *restrict str, uint64_t *store)
+void
+exec_thread (Debugger *dbg, size_t number)
 {
-  return parse_num (str, store, 16);
+  assert (dbg != NULL);
+
+  pid_t tid = 0;
+  if (thread_by_number (dbg->threads, number, &tid) == SP_ERR)
+    {
+      repl_err ("There is no thread %zu", number);
+      return;
+    }
+
+  dbg->pid = tid;
+  invalidate_stop_cache (dbg);
+  print_info ("Switched to thread %zu (%d)", number, tid);
+  print_current_source (dbg);
 }
 
-SprayResult
-parse_base10 (const char *restrict str, uint64_t *store)
+void
+print_signal_policy (const Debugger *dbg, int signo)
 {
-  return parse_num (str, store, 10);
+  assert (dbg != NULL);
+
+  char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+  signal_name (signo, name);
+  SignalPolicy policy = signal_policy (dbg->signals, signo);
+  printf ("SIG%-12s %-5s %-5s %s\n", name,
+	  policy.stop ? "Yes" : "No", policy.print ? "Yes" : "No",
+	  policy.pass ? "Yes" : "No");
 }
 
-bool
-is_valid_identifier (const char *ident)
+/* Update the policy of `signo` using the `keywords`. With no keywords,
+ * only the policy is printed. `signo` 0 prints the policies of all
+ * signals. */
+void
+exec_handle (Debugger *dbg, int signo, char *const *keywords)
 {
-  /* Regular expression for identifiers from the 2011 ISO C
-   * standard grammar (https://www.quut.com/c/ANSI-C-grammar-l-2011.html):
-   * L   [a-zA-Z_]
-   * A   [a-zA-Z_0-9]
-   * {L}{A}*
-   */
-  regex_t ident_regex;
-  int comp_res = regcomp (&ident_regex,
-			  "^[a-zA-Z_][a-zA-Z_0-9]*$",
-			  REG_NOSUB | REG_EXTENDED);
-  /* The regex doesn't change so compilation shouldn't fail. */
-  assert (comp_res == 0);
-  int match = regexec (&ident_regex,
-		       ident,
-		       /* Ignore sub-expressions. */
-		       0,
-		       NULL,
-		       0);
-  regfree (&ident_regex);
-  if (match == 0)
+  assert (dbg != NULL);
+  assert (keywords != NULL);
+
+  if (signo == SIGTRAP && keywords[0] != NULL)
     {
-      return true;
+      repl_err ("SIGTRAP is used by the debugger");
+      return;
+    }
+
+  if (signo != 0)
+    {
+      /* Check all keywords before changing anything. */
+      SignalPolicy policy = signal_policy (dbg->signals, signo);
+      for (size_t i = 0; keywords[i] != NULL; i++)
+	{
+	  if (update_signal_policy (&policy, keywords[i]) == SP_ERR)
+	    {
+	      repl_err ("Unknown action %s for 'handle'", keywords[i]);
+	      return;
+	    }
+	}
+      set_signal_policy (dbg->signals, signo, policy);
+    }
+
+  printf ("%-15s %-5s %-5s %s\n", "Signal", "Stop", "Print", "Pass");
+  if (signo != 0)
+    {
+      print_signal_policy (dbg, signo);
     }
   else
     {
-      return false;
+      for (int i = 1; i <= max_signal (); i++)
+	{
+	  print_signal_policy (dbg, i);
+	}
     }
 }
 
-SprayResult
-is_file_with_line (const char *file_line)
+void
+exec_dump_core (Debugger *dbg, const char *filepath)
 {
-  regex_t file_line_regex;
-  int comp_res = regcomp (&file_line_regex,
-			  "^[^:]+:[0-9]+$",
-			  REG_EXTENDED);
-  assert (comp_res == 0);
+  assert (dbg != NULL);
+  assert (filepath != NULL);
 
-  int match = regexec (&file_line_regex, file_line, 0, NULL, 0);
-  regfree (&file_line_regex);
-  if (match == 0)
+  if (dbg->core != NULL)
     {
-      return SP_OK;
+      repl_err ("There is no process to dump");
+      return;
     }
-  else
+
+  size_t n_bytes_written = 0;
+  if (dump_core (dbg->threads, dbg->breakpoints, dbg->pid, filepath,
+		 &n_bytes_written) == SP_ERR)
     {
-      return SP_ERR;
+      repl_err ("Failed to write the core dump to %s: %s", filepath,
+		strerror (errno));
+      return;
     }
+
+  print_info ("Saved a core dump of process %d to %s (%zu KiB of memory)",
+	      threads_leader (dbg->threads), filepath, n_bytes_written / 1024);
 }
 
-SprayResult
-parse_lineno (const char *line_str, unsigned *line_dest)
+/* The `PTRACE_O_*` options the tracee was seized with. */
+int
+tracee_options (const Debugger *dbg)
 {
-  char *str_end = 0;
-  long line_buf = strtol (line_str, &str_end, 10);
-  if (line_str[0] != '\0' && *str_end == '\0' && line_buf <= UINT_MAX)
+  return PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC
+    | (dbg->is_attached ? 0 : PTRACE_O_EXITKILL);
+}
+
+void
+exec_checkpoint (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  if (!is_tracee_alive (dbg))
     {
-      *line_dest = line_buf;
-      return SP_OK;
+      repl_err ("The process is dead");
+      return;
     }
-  else
+  if (n_threads (dbg->threads) > 1)
     {
-      return SP_ERR;
+      repl_err ("Checkpoints only work with single-threaded programs");
+      return;
     }
+
+  pid_t pid = 0;
+  if (fork_stopped_process (threads_leader (dbg->threads),
+			    tracee_options (dbg), dbg->breakpoints,
+			    &pid) == SP_ERR)
+    {
+      repl_err ("Failed to take a checkpoint: %s", strerror (errno));
+      return;
+    }
+
+  size_t number = add_checkpoint (dbg->checkpoints, pid);
+  print_info ("Took checkpoint %zu (process %d)", number, pid);
 }
 
-SprayResult
-parse_break_location (Debugger dbg, const char *location, dbg_addr *dest)
+void
+exec_checkpoints (Debugger *dbg)
 {
-  assert (location != NULL);
-  assert (dest != NULL);
+  assert (dbg != NULL);
 
-  if (is_valid_identifier (location))
-    {
-      const DebugSymbol *func = sym_by_name (location, dbg.info);
-      return function_start_addr (func, dbg.info, dest);
-    }
-  else if (parse_base16 (location, &dest->value) == SP_OK)
+  /* Core dumps don't have any checkpoints. */
+  if (dbg->checkpoints == NULL)
     {
-      return SP_OK;
+      return;
     }
-  else if (is_file_with_line (location) == SP_OK)
+
+  size_t n_checkpoints = 0;
+  const Checkpoint *checkpoints =
+    all_checkpoints (dbg->checkpoints, &n_checkpoints);
+  for (size_t i = 0; i < n_checkpoints; i++)
     {
-      char *location_cpy = strdup (location);
-      const char *filepath = strtok (location_cpy, ":");
-      /* OK since `location` was validated. */
-      assert (filepath != NULL);
+      const Checkpoint *checkpoint = &checkpoints[i];
+      printf ("%zu Process %d at stop %zu", checkpoint->number,
+	      checkpoint->pid, checkpoint->stop);
 
-      unsigned lineno = 0;
-      SprayResult res = parse_lineno (strtok (NULL, ":"), &lineno);
-      if (res == SP_ERR)
+      struct user_regs_struct regs = { 0 };
+      if (pt_read_registers (checkpoint->pid, &regs) == SP_ERR)
 	{
-	  free (location_cpy);
-	  return SP_ERR;
+	  printf (" <?>\n");
+	  continue;
 	}
 
-      SprayResult addr_res = addr_at (filepath, lineno, dbg.info, dest);
-      free (location_cpy);
-      return addr_res;
-    }
-  else
-    {
-      return SP_ERR;
+      real_addr real_pc = { regs.rip };
+      dbg_addr pc = real_to_dbg (dbg->load_address, real_pc);
+      const DebugSymbol *sym = sym_by_addr (pc, dbg->info);
+      const char *function = sym_name (sym, dbg->info);
+      const Position *pos = addr_position (pc, dbg->info);
+
+      printf (" " ADDR_FORMAT " %s", real_pc.value,
+	      function != NULL ? function : "<?>");
+      if (pos != NULL)
+	{
+	  printf (":%u", pos->line);
+	}
+      printf ("\n");
     }
 }
 
-char **
-get_command_tokens (const char *line)
+/* Replace the tracee with a fork of the checkpoint `number`. The
+ * checkpoint itself stays untouched, so it can be restarted again. */
+SprayResult
+restart_checkpoint (Debugger *dbg, size_t number)
 {
-  enum
-  { TOKENS_ALLOC = 8 };
-  size_t n_alloc = TOKENS_ALLOC;
-  char **tokens = calloc (n_alloc, sizeof (*tokens));
-  assert (tokens != NULL);
-
-  char *line_buf = strdup (line);
-  assert (line_buf != NULL);
-
-  const char *token = strtok (line_buf, " \t");
-  size_t i = 0;
+  assert (dbg != NULL);
 
-  while (token != NULL)
+  const Checkpoint *checkpoint = get_checkpoint (dbg->checkpoints, number);
+  if (checkpoint == NULL)
     {
-      if (i >= n_alloc)
-	{
-	  n_alloc += TOKENS_ALLOC;
-	  tokens = realloc (tokens, sizeof (*tokens) * n_alloc);
-	  assert (tokens != NULL);
-	}
-      char *token_cpy = strdup (token);
-      tokens[i] = token_cpy;
-      token = strtok (NULL, " \t");
-      i++;
+      repl_err ("There is no checkpoint %zu", number);
+      return SP_ERR;
     }
 
-  if (i >= n_alloc)
+  pid_t pid = 0;
+  if (fork_stopped_process (checkpoint->pid,
+			    tracee_options (dbg) | PTRACE_O_EXITKILL, NULL,
+			    &pid) == SP_ERR)
     {
-      n_alloc += 1;
-      tokens = realloc (tokens, sizeof (*tokens) * n_alloc);
-      assert (tokens != NULL);
+      repl_err ("Failed to restart checkpoint %zu: %s", number,
+		strerror (errno));
+      return SP_ERR;
     }
 
-  tokens[i] = NULL;
-  free (line_buf);
+  replace_process (dbg->threads, pid);
+  move_breakpoints (dbg->breakpoints, pid);
+  dbg->pid = pid;
+  invalidate_stop_cache (dbg);
+  /* The copies belong to the process that's gone. */
+  if (is_tracking_changes (dbg->changes)
+      && start_tracking_changes (dbg->changes, pid) == SP_ERR)
+    {
+      repl_err ("Stopped tracking changes: %s", strerror (errno));
+    }
+  rewind_to_checkpoint (dbg->checkpoints, number);
+  dbg->n_stops++;
 
-  return tokens;
+  return SP_OK;
 }
 
 void
-free_command_tokens (char **tokens)
+exec_restart (Debugger *dbg, size_t number)
 {
-  if (tokens != NULL)
+  assert (dbg != NULL);
+
+  if (restart_checkpoint (dbg, number) == SP_OK)
     {
-      for (size_t i = 0; tokens[i] != NULL; i++)
-	{
-	  free (tokens[i]);
-	}
-      free (tokens);
+      print_info ("Restarted checkpoint %zu (process %d)", number, dbg->pid);
+      print_current_source (dbg);
     }
 }
 
-bool
-is_filter_delim (const char *delim)
+/* Go back to the stop at the position `target` by restarting the
+ * checkpoint before it and replaying the stops in between. */
+SprayResult
+replay_to_stop (Debugger *dbg, size_t target)
 {
-  return delim != NULL && delim[0] == '|' && delim[1] == '\0';
-}
+  assert (dbg != NULL);
 
-void
-warn_register_name_conflict (const char *ident)
-{
-  assert (ident != NULL);
+  const Checkpoint *checkpoint =
+    nearest_checkpoint (dbg->checkpoints, target);
+  if (checkpoint == NULL)
+    {
+      repl_err ("There is no checkpoint to go back to");
+      repl_hint ("Use 'checkpoint' to take one");
+      return SP_ERR;
+    }
 
-  x86_reg _reg_buf = 0;		/* Not used. */
-  bool valid_reg = get_register_from_name (ident, &_reg_buf);
-  if (valid_reg)
+  if (restart_checkpoint (dbg, checkpoint->number) == SP_ERR)
     {
-      repl_warn ("The variable name '%s' is also the name of a register",
-		 ident);
-      repl_hint ("All register names start with a '%%'. Use '%%%s' to "
-		 "access the '%s' register instead", ident, ident);
+      return SP_ERR;
+    }
+
+  while (current_stop (dbg->checkpoints) < target)
+    {
+      size_t position = current_stop (dbg->checkpoints);
+      Stop expected = *recorded_stop (dbg->checkpoints, position);
+      if (expected.movement == MOVE_INTERRUPT)
+	{
+	  repl_err ("Can't replay the interrupt at stop %zu", position + 1);
+	  return SP_ERR;
+	}
+
+      move_tracee (dbg, expected.movement);
+
+      const Stop *reached = recorded_stop (dbg->checkpoints, position);
+      if (current_stop (dbg->checkpoints) != position + 1
+	  || reached->pc.value != expected.pc.value)
+	{
+	  repl_err ("The program took a different path at stop %zu",
+		    position + 1);
+	  return SP_ERR;
+	}
     }
+
+  return SP_OK;
 }
 
 void
-handle_debug_command_tokens (Debugger *dbg, char *const *tokens)
+exec_reverse_step (Debugger *dbg)
 {
   assert (dbg != NULL);
-  assert (tokens != NULL);
 
-  size_t i = 0;
-  const char *cmd = next_token (tokens, &i);
+  size_t current = current_stop (dbg->checkpoints);
+  if (current == 0)
+    {
+      repl_err ("There is no earlier stop");
+      return;
+    }
 
-  do
+  if (replay_to_stop (dbg, current - 1) == SP_OK)
     {
-      if (is_command (cmd, 'c', "continue"))
+      print_current_source (dbg);
+    }
+}
+
+/* Go back to the last stop at a breakpoint that still exists,
+ * or to the earliest checkpoint if there is no such stop. */
+void
+exec_reverse_continue (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  size_t target = 0;
+  for (size_t stop = current_stop (dbg->checkpoints); stop > 1; stop--)
+    {
+      /* The stop at position `stop - 1` is described by the
+       * movement with the index `stop - 2` that led to it. */
+      const Stop *recorded = recorded_stop (dbg->checkpoints, stop - 2);
+      if (recorded->is_breakpoint
+	  && lookup_breakpoint (dbg->breakpoints, recorded->pc))
 	{
-	  if (!end_of_tokens (tokens, i))
-	    break;
-	  exec_continue (dbg);
+	  target = stop - 1;
+	  break;
 	}
-      else if (is_command (cmd, 'b', "break"))
+    }
+
+  if (target == 0)
+    {
+      size_t n_checkpoints = 0;
+      const Checkpoint *checkpoints =
+	all_checkpoints (dbg->checkpoints, &n_checkpoints);
+      for (size_t i = 0; i < n_checkpoints; i++)
 	{
-	  const char *loc_str = next_token (tokens, &i);
-	  if (loc_str == NULL)
-	    {
-	      repl_err ("Missing location for 'break'");
-	    }
-	  else
+	  if (i == 0 || checkpoints[i].stop < target)
 	    {
-	      dbg_addr addr = { 0 };
-	      if (parse_break_location (*dbg, loc_str, &addr) == SP_OK)
-		{
-		  if (!end_of_tokens (tokens, i))
-		    {
-		      break;
-		    }
-		  exec_break (dbg->breakpoints,
-				dbg_to_real (dbg->load_address, addr));
-		}
-	      else
-		{
-		  repl_err ("Invalid location for 'break'");
-		}
+	      target = checkpoints[i].stop;
 	    }
 	}
-      else if (is_command (cmd, 'd', "delete"))
+    }
+
+  if (replay_to_stop (dbg, target) == SP_OK)
+    {
+      print_current_source (dbg);
+    }
+}
+
+
+
+/*********************************/
+/* Changes of the tracee's memory */
+/*********************************/
+
+enum
+{
+  /* `diff` shows at most this many bytes of a change. */
+  DIFF_MAX_BYTES = 16,
+};
+
+/* A variable in the scope of the function the tracee is stopped in. */
+typedef struct
+{
+  char *name;
+  RuntimeVariable *var;
+  real_addr start;
+  real_addr end;
+} LocalVariable;
+
+/* What's needed to tell what the changed memory belongs to. */
+typedef struct
+{
+  const CallFrame *frames;
+  const char *function;		/* Where the tracee is stopped. */
+  LocalVariable *locals;
+  size_t n_locals;
+  char *exe_filepath;		/* As it's shown in `/proc/<pid>/maps`. */
+} ChangeContext;
+
+/* Part of a change that belongs to a single variable or region. */
+typedef struct
+{
+  char *label;
+  real_addr start;
+  size_t n_bytes;
+  const MemoryChange *change;
+  const RuntimeVariable *var;	/* Variable at `start`, or NULL. */
+  RuntimeVariable *global;	/* Global variable owned by the item. */
+} ChangedItem;
+
+/* Format the label of a changed item like `printf`. */
+char *
+format_label (const char *fmt, ...)
+{
+  va_list argp;
+  va_start (argp, fmt);
+  char *label = NULL;
+  int res = vasprintf (&label, fmt, argp);
+  va_end (argp);
+  assert (res != -1);
+  return label;
+}
+
+ChangeContext
+init_change_context (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  ChangeContext context = {.frames = get_call_frames (dbg) };
+
+  char exe_link[PROC_PID_FILEPATH_LEN] = { 0 };
+  snprintf (exe_link, sizeof (exe_link), "/proc/%d/exe",
+	    threads_leader (dbg->threads));
+  context.exe_filepath = realpath (exe_link, NULL);
+
+  dbg_addr pc = get_dbg_pc (dbg);
+  context.function = sym_name (sym_by_addr (pc, dbg->info), dbg->info);
+  size_t n_names = 0;
+  char **names = scope_var_names (pc, dbg->info, &n_names);
+  for (size_t i = 0; i < n_names; i++)
+    {
+      RuntimeVariable *var = init_var (pc, dbg->load_address, names[i],
+				       dbg->pid, dbg->info);
+      if (var == NULL || !is_addr_loc (var))
 	{
-	  const char *loc_str = next_token (tokens, &i);
-	  if (loc_str == NULL)
-	    {
-	      repl_err ("Missing location for 'delete'");
-	    }
-	  else
-	    {
-	      dbg_addr addr = { 0 };
-	      if (parse_break_location (*dbg, loc_str, &addr) == SP_OK)
-		{
-		  if (!end_of_tokens (tokens, i))
-		    break;
-		  exec_delete (dbg->breakpoints,
-				 dbg_to_real (dbg->load_address, addr));
-		}
-	      else
-		{
-		  repl_err ("Invalid location for 'delete'");
-		}
-	    }
+	  del_var (var);
+	  free (names[i]);
+	  continue;
 	}
 
-      else if (is_command (cmd, 'p', "print"))
-	{
-	  const char *loc_str = next_token (tokens, &i);
-	  if (loc_str == NULL)
-	    {
-	      repl_err ("Missing location to print the value of");
-	      break;
-	    }
+      real_addr start = var_loc_addr (var);
+      context.locals = realloc (context.locals, (context.n_locals + 1)
+				* sizeof (*context.locals));
+      assert (context.locals != NULL);
+      context.locals[context.n_locals++] = (LocalVariable) {
+	.name = names[i],
+	.var = var,
+	.start = start,
+	.end = {start.value + var_size (var)},
+      };
+    }
+  free (names);
 
-	  PrintFilter filter = PF_NONE;
-	  const char *delim_str = next_token (tokens, &i);
-	  if (delim_str != NULL)
-	    {
-	      if (is_filter_delim (delim_str))
-		{
-		  filter = parse_filter (next_token (tokens, &i));
-		  if (filter == PF_NONE)
-		    {
-		      repl_err ("Invalid filter");
-		      break;
-		    }
-		}
-	      else
-		{
-		  repl_err ("Trailing characters in command");
-		  break;
-		}
-	    }
+  return context;
+}
 
+void
+free_change_context (ChangeContext *context)
+{
+  for (size_t i = 0; i < context->n_locals; i++)
+    {
+      free (context->locals[i].name);
+      del_var (context->locals[i].var);
+    }
+  free (context->locals);
+  free (context->exe_filepath);
+}
 
-	  if (!end_of_tokens (tokens, i))
-	    {
-	      break;
-	    }
+/* Get the name of the function of the call frame that `addr`
+ * on the stack belongs to, or NULL if it's below the frames. */
+const char *
+stack_frame_function (Debugger *dbg, const ChangeContext *context,
+		      real_addr addr, real_addr *frame_end)
+{
+  for (const CallFrame *frame = context->frames; frame != NULL;
+       frame = frame_caller (frame))
+    {
+      const CallFrame *caller = frame_caller (frame);
+      real_addr end = caller != NULL
+	? frame_stack_pointer (caller) : (real_addr) {UINT64_MAX};
+      if (frame_stack_pointer (frame).value <= addr.value
+	  && addr.value < end.value)
+	{
+	  *frame_end = end;
+	  const char *function =
+	    sym_name (sym_by_addr (frame_pc (frame), dbg->info), dbg->info);
+	  return function != NULL ? function : "<?>";
+	}
+    }
 
-	  real_addr addr = { 0 };
-	  if (loc_str[0] == '%')
-	    {
-	      const char *reg_name = loc_str + 1;
-	      x86_reg reg = 0;
-	      bool valid_reg = get_register_from_name (reg_name, &reg);
-	      if (valid_reg)
-		{
-		  exec_print_register (dbg->pid, reg, reg_name, filter);
-		}
-	      else
-		{
-		  repl_err ("Invalid register name");
-		}
-	    }
-	  else if (is_valid_identifier (loc_str))
-	    {
-	      warn_register_name_conflict (loc_str);
-	      exec_print_variable (dbg, loc_str, filter);
-	    }
-	  else if (parse_base16 (loc_str, &addr.value) == SP_OK)
+  *frame_end = context->frames != NULL
+    ? frame_stack_pointer (context->frames) : (real_addr) {UINT64_MAX};
+  return NULL;
+}
+
+/* Describe what the changed memory at `addr` belongs to. The
+ * description is true for the memory up to `end`. */
+ChangedItem
+describe_changed_memory (Debugger *dbg, const ChangeContext *context,
+			 const MemoryChange *change, real_addr addr,
+			 real_addr *end)
+{
+  ChangedItem item = {.start = addr,.change = change };
+  real_addr change_end = { change->start.value + change->n_bytes };
+  *end = change_end;
+
+  if (change->kind == MAPPING_STACK)
+    {
+      /* Variables of the function the tracee is stopped in. */
+      for (size_t i = 0; i < context->n_locals; i++)
+	{
+	  const LocalVariable *local = &context->locals[i];
+	  if (local->start.value <= addr.value
+	      && addr.value < local->end.value)
 	    {
-	      exec_print_memory (dbg->pid, addr, filter);
+	      item.label = format_label ("%s in %s", local->name,
+					 context->function != NULL
+					 ? context->function : "<?>");
+	      item.var = local->var;
+	      *end = local->end;
+	      return item;
 	    }
-	  else
+	  else if (addr.value < local->start.value
+		   && local->start.value < end->value)
 	    {
-	      repl_err ("Invalid location to print the value of");
+	      *end = local->start;
 	    }
 	}
-      else if (is_command (cmd, 't', "set"))
+
+      real_addr frame_end = { 0 };
+      const char *function =
+	stack_frame_function (dbg, context, addr, &frame_end);
+      if (frame_end.value < end->value)
 	{
-	  const char *loc_str = next_token (tokens, &i);
-	  if (loc_str == NULL)
-	    {
-	      repl_err ("Missing location to set the value of");
-	      break;
-	    }
+	  *end = frame_end;
+	}
+      item.label = function != NULL
+	? format_label ("frame of %s", function)
+	: format_label ("stack of returned calls");
+      return item;
+    }
 
-	  const char *value_str = next_token (tokens, &i);
-	  if (value_str == NULL)
+  if (change->kind == MAPPING_FILE && change->filepath != NULL
+      && context->exe_filepath != NULL
+      && str_eq (change->filepath, context->exe_filepath))
+    {
+      dbg_addr start = { 0 };
+      dbg_addr object_end = { 0 };
+      const char *name = object_name (real_to_dbg (dbg->load_address, addr),
+				      dbg->info, &start, &object_end);
+      if (name != NULL)
+	{
+	  item.label = format_label ("%s", name);
+	  item.global = init_var (get_dbg_pc (dbg), dbg->load_address, name,
+				  dbg->pid, dbg->info);
+	  real_addr var_start = dbg_to_real (dbg->load_address, start);
+	  if (item.global != NULL && is_addr_loc (item.global)
+	      && var_loc_addr (item.global).value == var_start.value)
 	    {
-	      repl_err ("Missing value to set the location to");
-	      break;
+	      item.var = item.global;
 	    }
+	  *end = dbg_to_real (dbg->load_address, object_end);
+	  return item;
+	}
 
-	  PrintFilter filter = PF_NONE;
-	  const char *delim_str = next_token (tokens, &i);
-	  if (delim_str != NULL)
-	    {
-	      if (is_filter_delim (delim_str))
-		{
-		  filter = parse_filter (next_token (tokens, &i));
-		  if (filter == PF_NONE)
-		    {
-		      repl_err ("Invalid filter");
-		      break;
-		    }
-
-		}
-	      else
-		{
-		  repl_err ("Trailing characters in command");
-		  break;
-		}
-	    }
+      /* The next byte might belong to a variable again. */
+      *end = (real_addr) {addr.value + 1};
+    }
 
-	  if (!end_of_tokens (tokens, i))
-	    {
-	      break;
-	    }
+  if (change->kind == MAPPING_FILE && change->filepath != NULL)
+    {
+      const char *filename = strrchr (change->filepath, '/');
+      item.label = format_label ("data of %s", filename != NULL
+				 ? filename + 1 : change->filepath);
+    }
+  else
+    {
+      item.label = format_label ("heap");
+    }
+  return item;
+}
 
-	  /* Parse the input value using the correct base. By default,
-	   * that same base will be used to print confirmation, too. */
-	  uint64_t value = 0;
-	  if (parse_base10 (value_str, &value) == SP_OK)
+/* Split the changes into the variables and regions they belong
+ * to. The caller must free the array with `free_changed_items`. */
+ChangedItem *
+find_changed_items (Debugger *dbg, const ChangeContext *context,
+		    const MemoryChange *changes, size_t n_changes,
+		    size_t *n_items)
+{
+  ChangedItem *items = NULL;
+  *n_items = 0;
+  for (size_t i = 0; i < n_changes; i++)
+    {
+      const MemoryChange *change = &changes[i];
+      real_addr addr = change->start;
+      real_addr change_end = { change->start.value + change->n_bytes };
+      while (addr.value < change_end.value)
+	{
+	  real_addr end = { 0 };
+	  ChangedItem item =
+	    describe_changed_memory (dbg, context, change, addr, &end);
+	  if (end.value > change_end.value || end.value <= addr.value)
 	    {
-	      filter = default_filter (filter, PF_DEC);
+	      end = change_end;
 	    }
-	  else if (parse_base16 (value_str, &value) == SP_OK)
+	  item.n_bytes = end.value - addr.value;
+	  addr = end;
+
+	  /* Merge memory that isn't a variable and has the same label. */
+	  ChangedItem *last = *n_items > 0 ? &items[*n_items - 1] : NULL;
+	  if (last != NULL && last->var == NULL && item.var == NULL
+	      && last->change == change && str_eq (last->label, item.label)
+	      && last->start.value + last->n_bytes == item.start.value)
 	    {
-	      filter = default_filter (filter, PF_HEX);
+	      last->n_bytes += item.n_bytes;
+	      free (item.label);
+	      del_var (item.global);
+	      continue;
 	    }
-	  else
+
+	  items = realloc (items, (*n_items + 1) * sizeof (*items));
+	  assert (items != NULL);
+	  items[(*n_items)++] = item;
+	}
+    }
+  return items;
+}
+
+void
+free_changed_items (ChangedItem *items, size_t n_items)
+{
+  for (size_t i = 0; i < n_items; i++)
+    {
+      free (items[i].label);
+      del_var (items[i].global);
+    }
+  free (items);
+}
+
+/* Print the value of the variable of `item` before and after
+ * the change. Bytes that didn't change are read from the tracee. */
+void
+print_variable_diff (Debugger *dbg, const ChangedItem *item)
+{
+  real_addr var_start = var_loc_addr (item->var);
+  uint64_t new_value = 0;
+  if (pt_read_memory (dbg->pid, var_start, &new_value) == SP_ERR)
+    {
+      printf ("  <?>\n");
+      return;
+    }
+
+  const MemoryChange *change = item->change;
+  uint64_t old_value = new_value;
+  unsigned char *old_bytes = (unsigned char *) &old_value;
+  bool is_known = change->old_bytes != NULL;
+  for (size_t i = 0; i < sizeof (old_value) && is_known; i++)
+    {
+      uint64_t addr = var_start.value + i;
+      if (change->start.value <= addr
+	  && addr < change->start.value + change->n_bytes)
+	{
+	  old_bytes[i] = change->old_bytes[addr - change->start.value];
+	}
+    }
+
+  char *new_str = print_var_value (item->var, new_value, FMT_NONE);
+  char *old_str = is_known
+    ? print_var_value (item->var, old_value, FMT_NONE) : NULL;
+  printf ("  %s -> %s\n", old_str != NULL ? old_str : "?", new_str);
+  free (old_str);
+  free (new_str);
+}
+
+void
+print_bytes (const unsigned char *bytes, size_t n_bytes)
+{
+  size_t n_shown = n_bytes < DIFF_MAX_BYTES ? n_bytes : DIFF_MAX_BYTES;
+  for (size_t i = 0; i < n_shown; i++)
+    {
+      printf (" %02x", bytes[i]);
+    }
+  printf ("%s\n", n_shown < n_bytes ? " ..." : "");
+}
+
+/* Print the bytes of `item` before and after the change. */
+void
+print_bytes_diff (const ChangedItem *item)
+{
+  const MemoryChange *change = item->change;
+  size_t offset = item->start.value - change->start.value;
+
+  printf ("  old:");
+  if (change->old_bytes != NULL)
+    {
+      print_bytes (change->old_bytes + offset, item->n_bytes);
+    }
+  else
+    {
+      printf (" ?\n");
+    }
+  printf ("  new:");
+  print_bytes (change->new_bytes + offset, item->n_bytes);
+}
+
+/* Print what changed since the tracee was last resumed. The values
+ * before and after the change are printed if `show_values` is set.
+ * Tracking starts the first time this is used. */
+void
+exec_changes (Debugger *dbg, bool show_values)
+{
+  assert (dbg != NULL);
+
+  if (dbg->changes == NULL)
+    {
+      repl_err ("There is no process to track");
+      return;
+    }
+  if (!is_tracee_alive (dbg))
+    {
+      repl_err ("The process is dead");
+      return;
+    }
+
+  if (!is_tracking_changes (dbg->changes))
+    {
+      if (start_tracking_changes (dbg->changes,
+				  threads_leader (dbg->threads)) == SP_ERR)
+	{
+	  repl_err ("Failed to track changes: %s", strerror (errno));
+	  return;
+	}
+      print_info ("Tracking changes from now on. Use '%s' again after "
+		  "the next stop", show_values ? "diff" : "changed");
+      if (!has_soft_dirty_bits (dbg->changes))
+	{
+	  repl_hint ("The kernel doesn't set soft-dirty bits. All copied "
+		     "pages are compared instead, which is slower");
+	}
+      return;
+    }
+
+  const MemoryChange *changes = NULL;
+  size_t n_changes = 0;
+  if (find_changes (dbg->changes, &changes, &n_changes) == SP_ERR)
+    {
+      repl_err ("Failed to find the changes: %s", strerror (errno));
+      return;
+    }
+  if (n_changes == 0)
+    {
+      print_info ("Nothing changed since the last stop");
+      return;
+    }
+
+  ChangeContext context = init_change_context (dbg);
+  size_t n_items = 0;
+  ChangedItem *items =
+    find_changed_items (dbg, &context, changes, n_changes, &n_items);
+  for (size_t i = 0; i < n_items; i++)
+    {
+      const ChangedItem *item = &items[i];
+      printf (ADDR_FORMAT " %s (%zu byte%s)\n", item->start.value,
+	      item->label, item->n_bytes, item->n_bytes == 1 ? "" : "s");
+      if (show_values && item->var != NULL)
+	{
+	  print_variable_diff (dbg, item);
+	}
+      else if (show_values)
+	{
+	  print_bytes_diff (item);
+	}
+    }
+
+  free_changed_items (items, n_items);
+  free_change_context (&context);
+}
+
+
+/************/
+/* Monitors */
+/************/
+
+/* Monitor the global variable `var_name`, or the
+ * word at `addr` if `var_name` is NULL. */
+void
+exec_monitor (Debugger *dbg, const char *var_name, real_addr addr,
+	      unsigned every_ms)
+{
+  assert (dbg != NULL);
+
+  if (dbg->monitors == NULL)
+    {
+      repl_err ("A core dump can't be monitored");
+      return;
+    }
+
+  RuntimeVariable *var = NULL;
+  size_t n_bytes = sizeof (uint64_t);
+  char addr_str[sizeof ("0x") + 2 * sizeof (uint64_t)] = { 0 };
+  const char *name = var_name;
+  if (var_name != NULL)
+    {
+      var = init_global_var (dbg->load_address, var_name, dbg->pid,
+			     dbg->info);
+      if (var == NULL)
+	{
+	  repl_err ("Failed to find a global variable called %s", var_name);
+	  repl_hint ("Only variables at fixed addresses can be monitored");
+	  return;
+	}
+      addr = var_loc_addr (var);
+      n_bytes = var_size (var);
+      if (n_bytes == 0 || n_bytes > sizeof (uint64_t))
+	{
+	  n_bytes = sizeof (uint64_t);
+	}
+    }
+  else
+    {
+      snprintf (addr_str, sizeof (addr_str), ADDR_FORMAT, addr.value);
+      name = addr_str;
+    }
+
+  const Monitor *monitor = NULL;
+  if (add_monitor (dbg->monitors, name, addr, n_bytes, every_ms, var,
+		   &monitor) == SP_ERR)
+    {
+      repl_err ("Failed to add a monitor: %s", strerror (errno));
+      del_var (var);
+      return;
+    }
+
+  print_info ("Monitor %zu samples %s every %u ms", monitor->number,
+	      monitor->name, monitor->every_ms);
+}
+
+void
+exec_monitors (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* Core dumps don't have any monitors. */
+  if (dbg->monitors == NULL)
+    {
+      return;
+    }
+
+  size_t n_monitors = 0;
+  const Monitor *monitors = all_monitors (dbg->monitors, &n_monitors);
+  for (size_t i = 0; i < n_monitors; i++)
+    {
+      const Monitor *monitor = &monitors[i];
+      printf ("%zu %s", monitor->number, monitor->name);
+      if (monitor->var != NULL)
+	{
+	  printf (" at " ADDR_FORMAT, monitor->addr.value);
+	}
+      printf (" every %u ms", monitor->every_ms);
+      if (monitor->has_value)
+	{
+	  char *value_str = monitor_value_str (monitor);
+	  printf (", last %s", value_str != NULL ? value_str : "<?>");
+	  free (value_str);
+	}
+      printf (" (%zu sample%s)\n", monitor->n_samples,
+	      monitor->n_samples == 1 ? "" : "s");
+    }
+}
+
+void
+exec_delete_monitor (Debugger *dbg, size_t number)
+{
+  assert (dbg != NULL);
+
+  if (dbg->monitors == NULL
+      || delete_monitor (dbg->monitors, number) == SP_ERR)
+    {
+      repl_err ("There is no monitor %zu", number);
+      return;
+    }
+
+  print_info ("Deleted monitor %zu", number);
+}
+
+/* Log the samples of all monitors to `filepath`,
+ * or stop logging them if it's NULL. */
+void
+exec_log_monitors (Debugger *dbg, const char *filepath)
+{
+  assert (dbg != NULL);
+
+  if (dbg->monitors == NULL)
+    {
+      repl_err ("A core dump can't be monitored");
+      return;
+    }
+
+  if (log_monitors (dbg->monitors, filepath) == SP_ERR)
+    {
+      repl_err ("Failed to open %s: %s", filepath, strerror (errno));
+    }
+  else if (filepath != NULL)
+    {
+      print_info ("Logging all samples to %s", filepath);
+    }
+  else
+    {
+      print_info ("Stopped logging the samples");
+    }
+}
+
+
+/*******************/
+/* Command Parsing */
+/*******************/
+
+static inline const char *
+next_token (char *const *tokens, size_t *i)
+{
+  assert (i != NULL);
+  const char *ret = tokens[*i];
+  if (ret == NULL)
+    {
+      return NULL;
+    }
+  else
+    {
+      *i += 1;
+      return ret;
+    }
+}
+
+static inline bool
+end_of_tokens (char *const *tokens, size_t i)
+{
+  if (tokens[i] == NULL)
+    {
+      return true;
+    }
+  else
+    {
+      repl_err ("Trailing characters in command");
+      return false;
+    }
+}
+
+bool
+is_command (const char *restrict in,
+	    char short_form, const char *restrict long_form)
+{
+  if (in != NULL)
+    {
+      return (strlen (in) == 1 && in[0] == short_form)
+	|| (str_eq (in, long_form));
+    }
+  else
+    {
+      return false;
+    }
+}
+
+SprayResult
+parse_num (const char *restrict str, uint64_t *store, uint8_t base)
+{
+  char *str_end;
+  uint64_t value = strtol (str, &str_end, base);
+  if (str[0] != '\0' && *str_end == '\0')
+    {
+      *store = value;
+      return SP_OK;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+}
+
+SprayResult
+parse_base16 (const char *restrict str, uint64_t *store)
+{
+  return parse_num (str, store, 16);
+}
+
+SprayResult
+parse_base10 (const char *restrict str, uint64_t *store)
+{
+  return parse_num (str, store, 10);
+}
+
+bool
+is_valid_identifier (const char *ident)
+{
+  /* Regular expression for identifiers from the 2011 ISO C
+   * standard grammar (https://www.quut.com/c/ANSI-C-grammar-l-2011.html):
+   * L   [a-zA-Z_]
+   * A   [a-zA-Z_0-9]
+   * {L}{A}*
+   */
+  regex_t ident_regex;
+  int comp_res = regcomp (&ident_regex,
+			  "^[a-zA-Z_][a-zA-Z_0-9]*$",
+			  REG_NOSUB | REG_EXTENDED);
+  /* The regex doesn't change so compilation shouldn't fail. */
+  assert (comp_res == 0);
+  int match = regexec (&ident_regex,
+		       ident,
+		       /* Ignore sub-expressions. */
+		       0,
+		       NULL,
+		       0);
+  regfree (&ident_regex);
+  if (match == 0)
+    {
+      return true;
+    }
+  else
+    {
+      return false;
+    }
+}
+
+SprayResult
+is_file_with_line (const char *file_line)
+{
+  regex_t file_line_regex;
+  int comp_res = regcomp (&file_line_regex,
+			  "^[^:]+:[0-9]+$",
+			  REG_EXTENDED);
+  assert (comp_res == 0);
+
+  int match = regexec (&file_line_regex, file_line, 0, NULL, 0);
+  regfree (&file_line_regex);
+  if (match == 0)
+    {
+      return SP_OK;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+}
+
+SprayResult
+parse_lineno (const char *line_str, unsigned *line_dest)
+{
+  char *str_end = 0;
+  long line_buf = strtol (line_str, &str_end, 10);
+  if (line_str[0] != '\0' && *str_end == '\0' && line_buf <= UINT_MAX)
+    {
+      *line_dest = line_buf;
+      return SP_OK;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+}
+
+SprayResult
+parse_break_location (Debugger dbg, const char *location, dbg_addr *dest)
+{
+  assert (location != NULL);
+  assert (dest != NULL);
+
+  if (is_valid_identifier (location))
+    {
+      const DebugSymbol *func = sym_by_name (location, dbg.info);
+      return function_start_addr (func, dbg.info, dest);
+    }
+  else if (parse_base16 (location, &dest->value) == SP_OK)
+    {
+      return SP_OK;
+    }
+  else if (is_file_with_line (location) == SP_OK)
+    {
+      char *location_cpy = strdup (location);
+      const char *filepath = strtok (location_cpy, ":");
+      /* OK since `location` was validated. */
+      assert (filepath != NULL);
+
+      unsigned lineno = 0;
+      SprayResult res = parse_lineno (strtok (NULL, ":"), &lineno);
+      if (res == SP_ERR)
+	{
+	  free (location_cpy);
+	  return SP_ERR;
+	}
+
+      SprayResult addr_res = addr_at (filepath, lineno, dbg.info, dest);
+      free (location_cpy);
+      return addr_res;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+}
+
+char **
+get_command_tokens (const char *line)
+{
+  enum
+  { TOKENS_ALLOC = 8 };
+  size_t n_alloc = TOKENS_ALLOC;
+  char **tokens = calloc (n_alloc, sizeof (*tokens));
+  assert (tokens != NULL);
+
+  char *line_buf = strdup (line);
+  assert (line_buf != NULL);
+
+  const char *token = strtok (line_buf, " \t");
+  size_t i = 0;
+
+  while (token != NULL)
+    {
+      if (i >= n_alloc)
+	{
+	  n_alloc += TOKENS_ALLOC;
+	  tokens = realloc (tokens, sizeof (*tokens) * n_alloc);
+	  assert (tokens != NULL);
+	}
+      char *token_cpy = strdup (token);
+      tokens[i] = token_cpy;
+      token = strtok (NULL, " \t");
+      i++;
+    }
+
+  if (i >= n_alloc)
+    {
+      n_alloc += 1;
+      tokens = realloc (tokens, sizeof (*tokens) * n_alloc);
+      assert (tokens != NULL);
+    }
+
+  tokens[i] = NULL;
+  free (line_buf);
+
+  return tokens;
+}
+
+void
+free_command_tokens (char **tokens)
+{
+  if (tokens != NULL)
+    {
+      for (size_t i = 0; tokens[i] != NULL; i++)
+	{
+	  free (tokens[i]);
+	}
+      free (tokens);
+    }
+}
+
+bool
+is_filter_delim (const char *delim)
+{
+  return delim != NULL && delim[0] == '|' && delim[1] == '\0';
+}
+
+void
+warn_register_name_conflict (const char *ident)
+{
+  assert (ident != NULL);
+
+  x86_reg _reg_buf = 0;		/* Not used. */
+  bool valid_reg = get_register_from_name (ident, &_reg_buf);
+  if (valid_reg)
+    {
+      repl_warn ("The variable name '%s' is also the name of a register",
+		 ident);
+      repl_hint ("All register names start with a '%%'. Use '%%%s' to "
+		 "access the '%s' register instead", ident, ident);
+    }
+}
+
+/* Does the command `cmd` run the tracee or change its state? */
+bool
+changes_tracee (const char *cmd)
+{
+  return is_command (cmd, 'c', "continue") || is_command (cmd, 'b', "break")
+    || is_command (cmd, 'd', "delete") || is_command (cmd, 't', "set")
+    || is_command (cmd, 'i', "inst") || is_command (cmd, 'l', "leave")
+    || is_command (cmd, 's', "step") || is_command (cmd, 'n', "next")
+    || str_eq (cmd, "interrupt") || str_eq (cmd, "checkpoint")
+    || str_eq (cmd, "restart") || str_eq (cmd, "reverse-step")
+    || str_eq (cmd, "reverse-continue");
+}
+
+/* Get the long name of `cmd`, so that both forms are timed together. */
+const char *
+command_name (const char *cmd)
+{
+  assert (cmd != NULL);
+
+  static const struct
+  {
+    char short_name;
+    const char *name;
+  } SHORT_COMMANDS[] = {
+    {'a', "backtrace"}, {'b', "break"}, {'c', "continue"},
+    {'d', "delete"}, {'i', "inst"}, {'l', "leave"}, {'n', "next"},
+    {'p', "print"}, {'s', "step"}, {'t', "set"},
+  };
+  const size_t n_short = sizeof (SHORT_COMMANDS) / sizeof (*SHORT_COMMANDS);
+
+  for (size_t i = 0; i < n_short; i++)
+    {
+      if (cmd[0] == SHORT_COMMANDS[i].short_name && cmd[1] == '\0')
+	{
+	  return SHORT_COMMANDS[i].name;
+	}
+    }
+  return cmd;
+}
+
+void
+handle_debug_command_tokens (Debugger *dbg, char *const *tokens)
+{
+  assert (dbg != NULL);
+  assert (tokens != NULL);
+
+  size_t i = 0;
+  const char *cmd = next_token (tokens, &i);
+
+  /* The tracee can't be inspected while it's running. Signal
+   * policies only concern the debugger and can always be changed. */
+  if (dbg->is_running
+      && (cmd == NULL || (!str_eq (cmd, "interrupt")
+			  && !str_eq (cmd, "handle")
+			  && !str_eq (cmd, "monitor")
+			  && !str_eq (cmd, "monitors"))))
+    {
+      repl_err ("The process is running. Use 'interrupt' to stop it");
+      return;
+    }
+
+  /* A core dump can only be inspected. */
+  if (dbg->core != NULL && cmd != NULL && changes_tracee (cmd))
+    {
+      repl_err ("A core dump can't be run or changed");
+      return;
+    }
+
+  double start_ms = monotonic_ms ();
+  TraceSpan span = begin_span ("command");
+  bool is_known = true;
+
+  do
+    {
+      if (is_command (cmd, 'c', "continue"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_continue (dbg);
+	}
+      else if (is_command (cmd, 'b', "break"))
+	{
+	  const char *loc_str = next_token (tokens, &i);
+	  if (loc_str == NULL)
+	    {
+	      repl_err ("Missing location for 'break'");
+	    }
+	  else
+	    {
+	      dbg_addr addr = { 0 };
+	      if (parse_break_location (*dbg, loc_str, &addr) == SP_OK)
+		{
+		  if (!end_of_tokens (tokens, i))
+		    {
+		      break;
+		    }
+		  exec_break (dbg->breakpoints,
+				dbg_to_real (dbg->load_address, addr));
+		}
+	      else
+		{
+		  repl_err ("Invalid location for 'break'");
+		}
+	    }
+	}
+      else if (is_command (cmd, 'd', "delete"))
+	{
+	  const char *loc_str = next_token (tokens, &i);
+	  if (loc_str == NULL)
+	    {
+	      repl_err ("Missing location for 'delete'");
+	    }
+	  else
+	    {
+	      dbg_addr addr = { 0 };
+	      if (parse_break_location (*dbg, loc_str, &addr) == SP_OK)
+		{
+		  if (!end_of_tokens (tokens, i))
+		    break;
+		  exec_delete (dbg->breakpoints,
+				 dbg_to_real (dbg->load_address, addr));
+		}
+	      else
+		{
+		  repl_err ("Invalid location for 'delete'");
+		}
+	    }
+	}
+
+      else if (is_command (cmd, 'p', "print"))
+	{
+	  const char *loc_str = next_token (tokens, &i);
+	  if (loc_str == NULL)
+	    {
+	      repl_err ("Missing location to print the value of");
+	      break;
+	    }
+
+	  PrintFilter filter = PF_NONE;
+	  const char *delim_str = next_token (tokens, &i);
+	  if (delim_str != NULL)
+	    {
+	      if (is_filter_delim (delim_str))
+		{
+		  filter = parse_filter (next_token (tokens, &i));
+		  if (filter == PF_NONE)
+		    {
+		      repl_err ("Invalid filter");
+		      break;
+		    }
+		}
+	      else
+		{
+		  repl_err ("Trailing characters in command");
+		  break;
+		}
+	    }
+
+
+	  if (!end_of_tokens (tokens, i))
+	    {
+	      break;
+	    }
+
+	  real_addr addr = { 0 };
+	  if (loc_str[0] == '%')
+	    {
+	      const char *reg_name = loc_str + 1;
+	      x86_reg reg = 0;
+	      bool valid_reg = get_register_from_name (reg_name, &reg);
+	      if (valid_reg)
+		{
+		  exec_print_register (dbg->pid, reg, reg_name, filter);
+		}
+	      else
+		{
+		  repl_err ("Invalid register name");
+		}
+	    }
+	  else if (is_valid_identifier (loc_str))
+	    {
+	      warn_register_name_conflict (loc_str);
+	      exec_print_variable (dbg, loc_str, filter);
+	    }
+	  else if (parse_base16 (loc_str, &addr.value) == SP_OK)
+	    {
+	      exec_print_memory (dbg->pid, addr, filter);
+	    }
+	  else
+	    {
+	      repl_err ("Invalid location to print the value of");
+	    }
+	}
+      else if (is_command (cmd, 't', "set"))
+	{
+	  const char *loc_str = next_token (tokens, &i);
+	  if (loc_str == NULL)
+	    {
+	      repl_err ("Missing location to set the value of");
+	      break;
+	    }
+
+	  const char *value_str = next_token (tokens, &i);
+	  if (value_str == NULL)
+	    {
+	      repl_err ("Missing value to set the location to");
+	      break;
+	    }
+
+	  PrintFilter filter = PF_NONE;
+	  const char *delim_str = next_token (tokens, &i);
+	  if (delim_str != NULL)
+	    {
+	      if (is_filter_delim (delim_str))
+		{
+		  filter = parse_filter (next_token (tokens, &i));
+		  if (filter == PF_NONE)
+		    {
+		      repl_err ("Invalid filter");
+		      break;
+		    }
+
+		}
+	      else
+		{
+		  repl_err ("Trailing characters in command");
+		  break;
+		}
+	    }
+
+	  if (!end_of_tokens (tokens, i))
+	    {
+	      break;
+	    }
+
+	  /* Parse the input value using the correct base. By default,
+	   * that same base will be used to print confirmation, too. */
+	  uint64_t value = 0;
+	  if (parse_base10 (value_str, &value) == SP_OK)
+	    {
+	      filter = default_filter (filter, PF_DEC);
+	    }
+	  else if (parse_base16 (value_str, &value) == SP_OK)
+	    {
+	      filter = default_filter (filter, PF_HEX);
+	    }
+	  else
+	    {
+	      repl_err ("Invalid value to set the location to");
+	      break;
+	    }
+
+	  /* Writing registers or memory can change the call stack. */
+	  invalidate_stop_cache (dbg);
+
+	  real_addr addr = { 0 };
+	  if (loc_str[0] == '%')
+	    {
+	      const char *reg_name = loc_str + 1;
+	      x86_reg reg = 0;
+	      bool valid_reg = get_register_from_name (reg_name, &reg);
+	      if (valid_reg)
+		{
+		  exec_set_register (dbg->pid, reg, reg_name, value,
+				       filter);
+		}
+	      else
+		{
+		  repl_err ("Invalid register name");
+		}
+	    }
+	  else if (is_valid_identifier (loc_str))
+	    {
+	      exec_set_variable (dbg, loc_str, value, filter);
+	    }
+	  else if (parse_base16 (loc_str, &addr.value) == SP_OK)
+	    {
+	      exec_set_memory (dbg->pid, addr, value, filter);
+	    }
+	  else
+	    {
+	      repl_err ("Invalid location to set the value of");
+	    }
+	}
+
+      else if (is_command (cmd, 'i', "inst"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_inst (dbg);
+	}
+      else if (is_command (cmd, 'l', "leave"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_leave (dbg);
+	}
+      else if (is_command (cmd, 's', "step"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_step (dbg);
+	}
+      else if (is_command (cmd, 'n', "next"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_next (dbg);
+	}
+      else if (is_command (cmd, 'a', "backtrace"))
+	{
+	  exec_backtrace (dbg);
+	}
+      else if (str_eq (cmd, "interrupt"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_interrupt (dbg);
+	}
+      else if (str_eq (cmd, "threads"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_threads (dbg);
+	}
+      else if (str_eq (cmd, "handle"))
+	{
+	  const char *signal_str = next_token (tokens, &i);
+	  int signo = 0;
+	  if (signal_str != NULL && parse_signal (signal_str, &signo) == SP_ERR)
+	    {
+	      repl_err ("Unknown signal %s", signal_str);
+	    }
+	  else
+	    {
+	      exec_handle (dbg, signo, &tokens[i]);
+	    }
+	}
+      else if (str_eq (cmd, "checkpoint"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_checkpoint (dbg);
+	}
+      else if (str_eq (cmd, "checkpoints"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_checkpoints (dbg);
+	}
+      else if (str_eq (cmd, "restart"))
+	{
+	  const char *number_str = next_token (tokens, &i);
+	  uint64_t number = 0;
+	  if (number_str == NULL)
+	    {
+	      repl_err ("Missing checkpoint number for 'restart'");
+	    }
+	  else if (parse_num (number_str, &number, 10) == SP_ERR)
+	    {
+	      repl_err ("Invalid checkpoint number %s", number_str);
+	    }
+	  else
+	    {
+	      if (!end_of_tokens (tokens, i))
+		break;
+	      exec_restart (dbg, number);
+	    }
+	}
+      else if (str_eq (cmd, "reverse-step"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_reverse_step (dbg);
+	}
+      else if (str_eq (cmd, "reverse-continue"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_reverse_continue (dbg);
+	}
+      else if (str_eq (cmd, "changed"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_changes (dbg, false);
+	}
+      else if (str_eq (cmd, "diff"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_changes (dbg, true);
+	}
+      else if (str_eq (cmd, "monitor"))
+	{
+	  const char *loc_str = next_token (tokens, &i);
+	  if (loc_str == NULL)
 	    {
-	      repl_err ("Invalid value to set the location to");
+	      repl_err ("Use 'monitor <variable|address> every <ms>'");
+	    }
+	  else if (str_eq (loc_str, "delete"))
+	    {
+	      const char *number_str = next_token (tokens, &i);
+	      uint64_t number = 0;
+	      if (number_str == NULL)
+		{
+		  repl_err ("Missing monitor number for 'monitor delete'");
+		}
+	      else if (parse_num (number_str, &number, 10) == SP_ERR)
+		{
+		  repl_err ("Invalid monitor number %s", number_str);
+		}
+	      else
+		{
+		  if (!end_of_tokens (tokens, i))
+		    break;
+		  exec_delete_monitor (dbg, number);
+		}
+	    }
+	  else if (str_eq (loc_str, "csv"))
+	    {
+	      const char *filepath = next_token (tokens, &i);
+	      if (filepath == NULL)
+		{
+		  repl_err ("Missing file name for 'monitor csv'");
+		}
+	      else
+		{
+		  if (!end_of_tokens (tokens, i))
+		    break;
+		  exec_log_monitors (dbg, str_eq (filepath, "off")
+				     ? NULL : filepath);
+		}
+	    }
+	  else
+	    {
+	      const char *every = next_token (tokens, &i);
+	      const char *ms_str = next_token (tokens, &i);
+	      uint64_t every_ms = 0;
+	      if (every == NULL || !str_eq (every, "every") || ms_str == NULL)
+		{
+		  repl_err ("Use 'monitor <variable|address> every <ms>'");
+		}
+	      else if (parse_num (ms_str, &every_ms, 10) == SP_ERR
+		       || every_ms == 0 || every_ms > UINT_MAX)
+		{
+		  repl_err ("Invalid interval %s", ms_str);
+		}
+	      else
+		{
+		  if (!end_of_tokens (tokens, i))
+		    break;
+
+		  real_addr addr = { 0 };
+		  if (is_valid_identifier (loc_str))
+		    {
+		      exec_monitor (dbg, loc_str, addr, every_ms);
+		    }
+		  else if (parse_base16 (loc_str, &addr.value) == SP_OK)
+		    {
+		      exec_monitor (dbg, NULL, addr, every_ms);
+		    }
+		  else
+		    {
+		      repl_err ("Invalid location to monitor");
+		    }
+		}
+	    }
+	}
+      else if (str_eq (cmd, "monitors"))
+	{
+	  if (!end_of_tokens (tokens, i))
+	    break;
+	  exec_monitors (dbg);
+	}
+      else if (str_eq (cmd, "dump"))
+	{
+	  const char *what = next_token (tokens, &i);
+	  if (what == NULL || !str_eq (what, "core"))
+	    {
+	      repl_err ("Use 'dump core <file>'");
 	      break;
 	    }
+	  const char *filepath = next_token (tokens, &i);
+	  if (filepath == NULL)
+	    {
+	      repl_err ("Missing file name for 'dump core'");
+	    }
+	  else
+	    {
+	      if (!end_of_tokens (tokens, i))
+		break;
+	      exec_dump_core (dbg, filepath);
+	    }
+	}
+      else if (str_eq (cmd, "thread"))
+	{
+	  const char *number_str = next_token (tokens, &i);
+	  uint64_t number = 0;
+	  if (number_str == NULL)
+	    {
+	      repl_err ("Missing thread number for 'thread'");
+	    }
+	  else if (parse_num (number_str, &number, 10) == SP_ERR)
+	    {
+	      repl_err ("Invalid thread number %s", number_str);
+	    }
+	  else
+	    {
+	      if (!end_of_tokens (tokens, i))
+		break;
+	      exec_thread (dbg, number);
+	    }
+	}
+      else if (str_eq (cmd, "stats"))
+	{
+	  const char *what = next_token (tokens, &i);
+	  if (what == NULL)
+	    {
+	      print_stats (stdout);
+	    }
+	  else if (str_eq (what, "reset"))
+	    {
+	      if (!end_of_tokens (tokens, i))
+		break;
+	      reset_stats ();
+	    }
+	  else
+	    {
+	      repl_err ("Use 'stats' or 'stats reset'");
+	    }
+	}
+      else
+	{
+	  repl_err ("Unknown command");
+	  is_known = false;
+	}
+    }
+  /* Only run this block once. The loop is only added to make
+   * `break` available for skipping subsequent steps on error. */
+  while (0);
+
+  if (is_known)
+    {
+      add_command_time (command_name (cmd), monotonic_ms () - start_ms);
+      end_span (span, command_name (cmd), NULL);
+    }
+}
+
+void
+handle_debug_command (Debugger *dbg, const char *line)
+{
+  assert (dbg != NULL);
+  assert (line != NULL);
+
+  char **tokens = get_command_tokens (line);
+  size_t i = 0;
+  const char *first_token = next_token (tokens, &i);
+
+  /* Is the command empty? */
+  if (first_token == NULL)
+    {
+      free_command_tokens (tokens);
+      char *last_command = NULL;
+      SprayResult res = read_command (dbg->history, &last_command);
+      if (res == SP_OK)
+	{
+	  tokens = get_command_tokens (last_command);
+	  free (last_command);
+	}
+      else
+	{
+	  repl_err ("No command to repeat");
+	  return;
+	}
+    }
+  else
+    {
+      save_command (dbg->history, line);
+    }
+
+  handle_debug_command_tokens (dbg, tokens);
+  free_command_tokens (tokens);
+}
+
+
+/**************/
+/* Event Loop */
+/**************/
+
+/* State of the interactive REPL. */
+typedef struct
+{
+  Debugger *dbg;
+  struct linenoiseState edit;	/* Line that's being edited. */
+  char edit_buf[REPL_LINE_BUF_SIZE];
+  bool is_editing;
+  bool is_done;
+} Repl;
+
+/* Show the prompt and start editing a new line. */
+void
+start_editing (Repl *repl)
+{
+  assert (repl != NULL);
+
+  fflush (stdout);
+  if (linenoiseEditStart (&repl->edit, -1, -1, repl->edit_buf,
+			  sizeof (repl->edit_buf), "spray> ") == -1)
+    {
+      repl->is_done = true;
+    }
+  else
+    {
+      repl->is_editing = true;
+    }
+}
+
+void
+stop_editing (Repl *repl)
+{
+  assert (repl != NULL);
+
+  if (repl->is_editing)
+    {
+      linenoiseEditStop (&repl->edit);
+      repl->is_editing = false;
+    }
+}
+
+void
+callback__read_input (int fd, void *void_repl)
+{
+  unused (fd);
+  Repl *repl = (Repl *) void_repl;
+
+  char *line = linenoiseEditFeed (&repl->edit);
+  if (line == linenoiseEditMore)
+    {
+      return;
+    }
+
+  stop_editing (repl);
+
+  if (line != NULL)
+    {
+      handle_debug_command (repl->dbg, line);
+      linenoiseHistoryAdd (line);
+      linenoiseFree (line);
+    }
+  /* Ctrl-C interrupts the running tracee. Otherwise,
+   * Ctrl-C and Ctrl-D leave the REPL. */
+  else if (errno == EAGAIN && repl->dbg->is_running)
+    {
+      exec_interrupt (repl->dbg);
+    }
+  else
+    {
+      repl->is_done = true;
+      return;
+    }
+
+  start_editing (repl);
+}
+
+void
+callback__read_signals (int fd, void *void_repl)
+{
+  Repl *repl = (Repl *) void_repl;
+
+  /* `SIGCHLD` is received for every event of the tracee. Events
+   * of a stopped tracee were already handled while waiting. */
+  bool is_interrupted = false;
+  struct signalfd_siginfo siginfo;
+  while (read (fd, &siginfo, sizeof (siginfo)) == sizeof (siginfo))
+    {
+      if (siginfo.ssi_signo == SIGINT)
+	{
+	  is_interrupted = true;
+	}
+    }
+
+  if (!repl->dbg->is_running)
+    {
+      return;
+    }
+
+  /* Print the output of the tracee's stop above the prompt. */
+  if (repl->is_editing)
+    {
+      linenoiseHide (&repl->edit);
+    }
+
+  if (is_interrupted)
+    {
+      exec_interrupt (repl->dbg);
+    }
+  else
+    {
+      poll_tracee (repl->dbg);
+    }
+
+  fflush (stdout);
+  if (repl->is_editing)
+    {
+      linenoiseShow (&repl->edit);
+    }
+}
+
+void
+callback__sample_monitor_repl (int fd, void *void_repl)
+{
+  Repl *repl = (Repl *) void_repl;
+
+  /* Print the changed value above the prompt. */
+  if (repl->is_editing)
+    {
+      linenoiseHide (&repl->edit);
+    }
+
+  report_monitor_sample (repl->dbg, fd);
+
+  fflush (stdout);
+  if (repl->is_editing)
+    {
+      linenoiseShow (&repl->edit);
+    }
+}
+
+/* Read commands while the tracee runs in the background. Events
+ * of the tracee and input are handled in the order they arrive.
+ * Returns `SP_ERR` if the event loop couldn't be set up. */
+SprayResult
+run_event_loop (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* The signals are read from `signal_fd` instead of being handled
+   * asynchronously. Since the tracee was forked before, it doesn't
+   * inherit the blocked signals. */
+  sigset_t signals;
+  sigset_t old_signals;
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGCHLD);
+  sigaddset (&signals, SIGINT);
+  sigprocmask (SIG_BLOCK, &signals, &old_signals);
+
+  int signal_fd = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  EventLoop *events = init_event_loop ();
+
+  /* Allocated because of the large line buffer. */
+  Repl *repl = calloc (1, sizeof (*repl));
+
+  if (signal_fd == -1 || events == NULL || repl == NULL
+      || watch_fd (events, signal_fd, callback__read_signals, repl) == SP_ERR
+      || watch_fd (events, STDIN_FILENO, callback__read_input,
+		   repl) == SP_ERR
+      || (dbg->monitors != NULL
+	  && watch_monitors (dbg->monitors, events,
+			     callback__sample_monitor_repl, repl) == SP_ERR))
+    {
+      if (dbg->monitors != NULL)
+	{
+	  unwatch_monitors (dbg->monitors);
+	}
+      free (repl);
+      free_event_loop (events);
+      if (signal_fd != -1)
+	{
+	  close (signal_fd);
+	}
+      sigprocmask (SIG_SETMASK, &old_signals, NULL);
+      return SP_ERR;
+    }
+
+  repl->dbg = dbg;
+  dbg->is_async = true;
+
+  start_editing (repl);
+  while (!repl->is_done && dispatch_events (events, -1) == SP_OK)
+    ;
+  stop_editing (repl);
+
+  dbg->is_async = false;
+
+  /* The tracee must be stopped to detach from it. */
+  if (dbg->is_running)
+    {
+      stop_all_threads (dbg->threads, dbg->breakpoints);
+      dbg->is_running = false;
+    }
+
+  if (dbg->monitors != NULL)
+    {
+      pause_monitors (dbg->monitors);
+      unwatch_monitors (dbg->monitors);
+    }
+
+  free (repl);
+  free_event_loop (events);
+  close (signal_fd);
+  sigprocmask (SIG_SETMASK, &old_signals, NULL);
+
+  return SP_OK;
+}
+
+
+/***************************/
+/* Debugger Initialization */
+/***************************/
+
+/* Read the value of the entry of type `type` in the auxiliary
+ * vector of the process `pid`. See getauxval(3). */
+SprayResult
+read_auxv (pid_t pid, uint64_t type, uint64_t *value)
+{
+  assert (value != NULL);
+
+  char auxv_filepath[PROC_PID_FILEPATH_LEN];
+  snprintf (auxv_filepath, PROC_PID_FILEPATH_LEN, "/proc/%d/auxv", pid);
+
+  FILE *auxv = fopen (auxv_filepath, "r");
+  if (auxv == NULL)
+    {
+      return SP_ERR;
+    }
+
+  SprayResult res = SP_ERR;
+  Elf64_auxv_t entry = { 0 };
+  while (fread (&entry, sizeof (entry), 1, auxv) == 1
+	 && entry.a_type != AT_NULL)
+    {
+      if (entry.a_type == type)
+	{
+	  *value = entry.a_un.a_val;
+	  res = SP_OK;
+	  break;
+	}
+    }
+
+  fclose (auxv);
+
+  return res;
+}
 
-	  real_addr addr = { 0 };
-	  if (loc_str[0] == '%')
-	    {
-	      const char *reg_name = loc_str + 1;
-	      x86_reg reg = 0;
-	      bool valid_reg = get_register_from_name (reg_name, &reg);
-	      if (valid_reg)
-		{
-		  exec_set_register (dbg->pid, reg, reg_name, value,
-				       filter);
-		}
-	      else
-		{
-		  repl_err ("Invalid register name");
-		}
-	    }
-	  else if (is_valid_identifier (loc_str))
-	    {
-	      exec_set_variable (dbg, loc_str, value, filter);
-	    }
-	  else if (parse_base16 (loc_str, &addr.value) == SP_OK)
-	    {
-	      exec_set_memory (dbg->pid, addr, value, filter);
-	    }
-	  else
-	    {
-	      repl_err ("Invalid location to set the value of");
-	    }
+void
+init_load_address (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* Is this a dynamic executable? */
+  if (is_dyn_exec (dbg->info))
+    {
+      /* The kernel tells the process where its entry point
+       * was loaded. This works even if address space layout
+       * randomization is enabled, e.g. for attached processes. */
+      uint64_t real_entry = 0;
+      SprayResult entry_res = dbg->core != NULL
+	? core_auxv_value (dbg->core, AT_ENTRY, &real_entry)
+	: read_auxv (dbg->pid, AT_ENTRY, &real_entry);
+      if (entry_res == SP_OK)
+	{
+	  dbg->load_address.value =
+	    real_entry - entry_point (dbg->info).value;
+	  return;
+	}
+      else if (dbg->core != NULL)
+	{
+	  spray_err ("The core doesn't say where the executable was loaded");
+	  dbg->load_address = (real_addr) {0};
+	  return;
+	}
+
+      /* Open the process' `/proc/<pid>/maps` file. */
+      char proc_maps_filepath[PROC_MAPS_FILEPATH_LEN];
+      snprintf (proc_maps_filepath,
+		PROC_MAPS_FILEPATH_LEN, "/proc/%d/maps", dbg->pid);
+
+      FILE *proc_map = fopen (proc_maps_filepath, "r");
+      assert (proc_map != NULL);
+
+      /* Read the first address from the file. This is
+       * OK since the executable is usually mapped first. */
+      char *addr = NULL;
+      size_t n = 0;
+      ssize_t nread = getdelim (&addr, &n, (int) '-', proc_map);
+      fclose (proc_map);
+      assert (nread != -1);
+
+      real_addr load_address = { 0 };
+      assert (parse_base16 (addr, &load_address.value) == SP_OK);
+
+      free (addr);
+
+      /* Now update the debugger instance on success. */
+      dbg->load_address = load_address;
+    }
+  else
+    {
+      dbg->load_address = (real_addr) {0};
+    }
+}
+
+/* Print that the debug information of `prog_name` couldn't be loaded. */
+void
+print_debug_info_error (const char *prog_name)
+{
+  repl_err ("Failed to initialize debug information");
+  repl_hint ("Did you compile %s with debug information enabled? "
+	     "E.g. clang -g", prog_name);
+}
+
+/* Record that `phase` of the startup ran from `start_ms` until
+ * now. Returns the time it ended. */
+double
+time_startup (Debugger *dbg, StartupPhase phase, double start_ms)
+{
+  assert (dbg != NULL);
+
+  double end_ms = monotonic_ms ();
+  dbg->startup[phase] = (TimeSpan) {.start_ms = start_ms,.end_ms = end_ms };
+  return end_ms;
+}
+
+int
+setup_debugger (const char *prog_name, char *prog_argv[], Debugger *store)
+{
+  assert (store != NULL);
+  assert (prog_name != NULL);
+
+  double start_ms = monotonic_ms ();
+
+  if (access (prog_name, F_OK) != 0)
+    {
+      repl_err ("File %s doesn't exist", prog_name);
+      return -1;
+    }
+
+  /* Parsing the debug information takes a while, so it's
+   * done on another thread while the tracee starts. */
+  DebugInfo *info = load_debug_info (prog_name);
+  if (info == NULL)
+    {
+      print_debug_info_error (prog_name);
+      return -1;
+    }
+
+  pid_t pid = fork ();
+  if (pid == -1)
+    {
+      free_debug_info (&info);
+      return -1;
+    }
+  else if (pid == 0)
+    {
+      /* Start the child process. Only async-signal-safe
+       * functions may be used here since the parent has
+       * more than one thread. */
+
+      /* Disable address space layout randomization. */
+      personality (ADDR_NO_RANDOMIZE);
+
+      /* Wait until the parent has seized *this* process. */
+      raise (SIGSTOP);
+
+      /* Replace the current process with the
+       * given program to debug. Only pass its
+       * name to it. */
+      execv (prog_name, prog_argv);
+      _exit (EXIT_FAILURE);
+    }
+  else if (pid >= 1)
+    {
+      /* Parent process */
+
+      /* `PTRACE_INTERRUPT` only works for seized processes,
+       * so `PTRACE_TRACEME` can't be used to trace the child. */
+      int wait_status;
+      pt_wait (pid, &wait_status, WSTOPPED);
+      if (pt_seize (pid, PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC
+		    | PTRACE_O_EXITKILL) == SP_ERR)
+	{
+	  kill (pid, SIGKILL);
+	  pt_wait (pid, NULL, 0);
+	  free_debug_info (&info);
+	  return -1;
+	}
+      kill (pid, SIGCONT);
+
+      /* Wait until the tracee has executed the program. Don't
+       * handle the stops on the way like in `wait_for_signal`. */
+      while (pt_wait (pid, &wait_status, 0) == pid
+	     && WIFSTOPPED (wait_status)
+	     && wait_status >> 8 != (SIGTRAP | (PTRACE_EVENT_EXEC << 8)))
+	{
+	  pt_continue_execution (pid);
+	}
+
+      if (!WIFSTOPPED (wait_status))
+	{
+	  repl_err ("Failed to execute %s", prog_name);
+	  free_debug_info (&info);
+	  return -1;
+	}
+      TimeSpan exec = {.start_ms = start_ms,.end_ms = monotonic_ms () };
+
+      /* The load address is found using the ELF file. The
+       * DWARF debug information may still be loading. */
+      if (await_debug_info (info, INFO_ELF) == SP_ERR)
+	{
+	  print_debug_info_error (prog_name);
+	  kill (pid, SIGKILL);
+	  pt_wait (pid, NULL, 0);
+	  free_debug_info (&info);
+	  return -1;
+	}
+
+      *store = (Debugger)
+      {
+	.prog_name = prog_name,.pid = pid,.threads =
+	  init_threads (pid),.breakpoints =
+	  init_breakpoints (pid),.info = info,
+	  /* `load_address` is initialized by `init_load_address`. */
+      .load_address.value = 0,.history = init_history (),.signals = init_signal_table (),.stack = NULL,.frames = NULL,.core = NULL,.checkpoints = init_checkpoints (),.changes = init_change_tracker (),.monitors = init_monitors (),.n_stops = 0,.exit_status = 0,.is_attached = false,.is_async = false,.is_running = false,.step_request = 0,.is_block_step_supported = !get_args ()->flags.no_block_step,.startup_ms = start_ms,};
+      store->startup[STARTUP_EXEC] = exec;
+      double elf_ms = time_startup (store, STARTUP_AWAIT_ELF, exec.end_ms);
+      init_load_address (store);
+      time_startup (store, STARTUP_LOAD_ADDRESS, elf_ms);
+      init_print_source ();
+    }
+
+  return 0;
+}
+
+int
+attach_debugger (const char *prog_name, pid_t pid, Debugger *store)
+{
+  assert (store != NULL);
+  assert (prog_name != NULL);
+
+  double start_ms = monotonic_ms ();
+
+  DebugInfo *info = load_debug_info (prog_name);
+  if (info == NULL)
+    {
+      print_debug_info_error (prog_name);
+      return -1;
+    }
+
+  Threads *threads = attach_threads (pid);
+  if (threads == NULL)
+    {
+      repl_err ("Failed to attach to process %d: %s", pid, strerror (errno));
+      if (errno == EPERM)
+	{
+	  repl_hint ("Check /proc/sys/kernel/yama/ptrace_scope");
 	}
+      free_debug_info (&info);
+      return -1;
+    }
+
+  double elf_ms = monotonic_ms ();
+  if (await_debug_info (info, INFO_ELF) == SP_ERR)
+    {
+      print_debug_info_error (prog_name);
+      /* Let the process run the way it did before. */
+      detach_threads (threads);
+      free_threads (threads);
+      free_debug_info (&info);
+      return -1;
+    }
+
+  *store = (Debugger)
+  {
+    .prog_name = prog_name,.pid = pid,.threads = threads,.breakpoints =
+      init_breakpoints (pid),.info = info,
+      /* `load_address` is initialized by `init_load_address`. */
+  .load_address.value = 0,.history = init_history (),.signals = init_signal_table (),.stack = NULL,.frames = NULL,.core = NULL,.checkpoints = init_checkpoints (),.changes = init_change_tracker (),.monitors = init_monitors (),.n_stops = 0,.exit_status = 0,.is_attached = true,.is_async = false,.is_running = false,.step_request = 0,.is_block_step_supported = !get_args ()->flags.no_block_step,.startup_ms = start_ms,};
+  double load_ms = time_startup (store, STARTUP_AWAIT_ELF, elf_ms);
+  init_load_address (store);
+  time_startup (store, STARTUP_LOAD_ADDRESS, load_ms);
+  init_print_source ();
+
+  return 0;
+}
+
+int
+open_core_debugger (const char *prog_name, const char *core_filepath,
+		    Debugger *store)
+{
+  assert (store != NULL);
+  assert (prog_name != NULL);
+  assert (core_filepath != NULL);
+
+  double start_ms = monotonic_ms ();
+
+  DebugInfo *info = load_debug_info (prog_name);
+  if (info == NULL)
+    {
+      print_debug_info_error (prog_name);
+      return -1;
+    }
+
+  CoreFile *core = open_core (core_filepath);
+  if (core == NULL)
+    {
+      repl_err ("Failed to read the core dump %s", core_filepath);
+      free_debug_info (&info);
+      return -1;
+    }
+
+  double elf_ms = monotonic_ms ();
+  if (await_debug_info (info, INFO_ELF) == SP_ERR)
+    {
+      print_debug_info_error (prog_name);
+      free_debug_info (&info);
+      close_core (core);
+      return -1;
+    }
+
+  size_t n_tids = core_n_threads (core);
+  pid_t *tids = calloc (n_tids, sizeof (pid_t));
+  assert (tids != NULL);
+  for (size_t i = 0; i < n_tids; i++)
+    {
+      tids[i] = core_thread (core, i);
+    }
+  Threads *threads = init_stopped_threads (core_pid (core), tids, n_tids);
+  free (tids);
+
+  /* The thread that received the fatal signal is selected. */
+  *store = (Debugger)
+  {
+    .prog_name = prog_name,.pid = core_thread (core, 0),.threads =
+      threads,.breakpoints = init_breakpoints (core_pid (core)),.info = info,
+      /* `load_address` is initialized by `init_load_address`. */
+  .load_address.value = 0,.history = init_history (),.signals = init_signal_table (),.stack = NULL,.frames = NULL,.core = core,.checkpoints = NULL,.changes = NULL,.monitors = NULL,.n_stops = 0,.exit_status = 0,.is_attached = false,.is_async = false,.is_running = false,.step_request = 0,.is_block_step_supported = !get_args ()->flags.no_block_step,.startup_ms = start_ms,};
+  pt_use_core (core);
+  double load_ms = time_startup (store, STARTUP_AWAIT_ELF, elf_ms);
+  init_load_address (store);
+  time_startup (store, STARTUP_LOAD_ADDRESS, load_ms);
+  init_print_source ();
+
+  return 0;
+}
+
+/* Remove all breakpoints and let the attached process
+ * continue to run the way it did before. */
+SprayResult
+detach_debugger (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* There is nothing to detach from if the process exited. */
+  if (!lookup_thread (dbg->threads, threads_leader (dbg->threads)))
+    {
+      return SP_OK;
+    }
+
+  if (disable_all_breakpoints (dbg->breakpoints) == SP_ERR)
+    {
+      spray_err ("Failed to remove all breakpoints from process %d",
+		 threads_leader (dbg->threads));
+      return SP_ERR;
+    }
+
+  if (detach_threads (dbg->threads) == SP_ERR)
+    {
+      spray_err ("Failed to detach from process %d",
+		 threads_leader (dbg->threads));
+      return SP_ERR;
+    }
+
+  print_info ("Detached from process %d", threads_leader (dbg->threads));
+
+  return SP_OK;
+}
+
+SprayResult
+del_debugger (Debugger dbg)
+{
+  SprayResult res = SP_OK;
+  if (dbg.is_attached)
+    {
+      res = detach_debugger (&dbg);
+    }
+
+  free_checkpoints (dbg.checkpoints);
+  free_change_tracker (dbg.changes);
+  free_monitors (dbg.monitors);
+  free_breakpoints (dbg.breakpoints);
+  free_threads (dbg.threads);
+  free_history (dbg.history);
+  free_signal_table (dbg.signals);
+  if (dbg.core != NULL)
+    {
+      pt_use_core (NULL);
+      close_core (dbg.core);
+    }
+  free_backtrace (dbg.frames);
+  free_stack_snapshot (dbg.stack);
+  if (free_debug_info (&dbg.info) == SP_ERR)
+    {
+      res = SP_ERR;
+    }
+  return res;
+}
+
+/* Run the tracee until it reaches `addr`. */
+SprayResult
+run_to_addr (Debugger *dbg, real_addr addr)
+{
+  assert (dbg != NULL);
+
+  enable_breakpoint (dbg->breakpoints, addr);
+  if (continue_execution (dbg) == SP_ERR)
+    return SP_ERR;
+
+  if (wait_for_signal (dbg) == SP_ERR)
+    return SP_ERR;
+
+  disable_breakpoint (dbg->breakpoints, addr);
+  return SP_OK;
+}
+
+/* Run a tracee that was just started to the beginning of `main`.
+ * The ELF symbol is enough to get there, so the dynamic loader and
+ * the C runtime start up while the DWARF debug information is still
+ * loading. It's needed to run past the prologue afterwards. */
+SprayResult
+run_to_main (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  double start_ms = monotonic_ms ();
+
+  const DebugSymbol *main = sym_by_name ("main", dbg->info);
+  if (main == NULL)
+    return SP_ERR;
+
+  dbg_addr symbol_main = sym_start_addr (main);
+  if (run_to_addr (dbg, dbg_to_real (dbg->load_address, symbol_main))
+      == SP_ERR)
+    return SP_ERR;
+  double dwarf_ms = time_startup (dbg, STARTUP_RUN_TO_SYMBOL, start_ms);
+
+  if (await_debug_info (dbg->info, INFO_DWARF) == SP_ERR)
+    {
+      print_debug_info_error (dbg->prog_name);
+      return SP_ERR;
+    }
+  double prologue_ms = time_startup (dbg, STARTUP_AWAIT_DWARF, dwarf_ms);
+
+  dbg_addr start_main = { 0 };
+  if (function_start_addr (main, dbg->info, &start_main) == SP_OK
+      && start_main.value != symbol_main.value
+      && run_to_addr (dbg, dbg_to_real (dbg->load_address, start_main))
+      == SP_ERR)
+    return SP_ERR;
+  time_startup (dbg, STARTUP_RUN_TO_MAIN, prologue_ms);
+
+  return SP_OK;
+}
+
+/* Print why the process of the core dump was terminated. */
+void
+print_core_signal (Debugger *dbg)
+{
+  assert (dbg != NULL);
+  assert (dbg->core != NULL);
 
-      else if (is_command (cmd, 'i', "inst"))
+  siginfo_t siginfo = { 0 };
+  if (pt_get_signal_info (dbg->pid, &siginfo) == SP_ERR
+      || siginfo.si_signo == 0)
+    {
+      return;
+    }
+
+  if (siginfo.si_signo == SIGSEGV)
+    {
+      print_info ("Child was terminated by a segmentation fault, reason %d",
+		  siginfo.si_code);
+    }
+  else
+    {
+      char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+      signal_name (siginfo.si_signo, name);
+      print_info ("Child was terminated by signal SIG%s", name);
+    }
+}
+
+/* Print when each phase of the startup ran, relative to when setting
+ * up the debugger began. Parts of the debug information that are
+ * still loading are printed as such. */
+void
+print_startup_timings (const Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  static const char *const phase_names[N_STARTUP_PHASES] = {
+    [STARTUP_EXEC] = "start the tracee",
+    [STARTUP_AWAIT_ELF] = "wait for the ELF file",
+    [STARTUP_LOAD_ADDRESS] = "find the load address",
+    [STARTUP_RUN_TO_SYMBOL] = "run to the symbol main",
+    [STARTUP_AWAIT_DWARF] = "wait for DWARF",
+    [STARTUP_RUN_TO_MAIN] = "run past main's prologue",
+    [STARTUP_PRINT_SOURCE] = "print the source",
+  };
+  static const char *const part_names[N_INFO_PARTS] = {
+    [INFO_ELF] = "parse the ELF file",
+    [INFO_DWARF] = "load DWARF",
+    [INFO_UNWIND] = "build the unwind table",
+  };
+
+  fprintf (stderr, "Startup timings in ms:\n");
+  double ready_ms = dbg->startup_ms;
+  for (size_t phase = 0; phase < N_STARTUP_PHASES; phase++)
+    {
+      TimeSpan span = dbg->startup[phase];
+      if (span.end_ms == 0)
 	{
-	  if (!end_of_tokens (tokens, i))
-	    break;
-	  exec_inst (dbg);
+	  continue;		/* The phase didn't run. */
 	}
-      else if (is_command (cmd, 'l', "leave"))
+      fprintf (stderr, "  %-28s %9.3f %9.3f\n", phase_names[phase],
+	       span.start_ms - dbg->startup_ms,
+	       span.end_ms - dbg->startup_ms);
+      ready_ms = span.end_ms > ready_ms ? span.end_ms : ready_ms;
+    }
+
+  fprintf (stderr, "In the background:\n");
+  for (size_t part = 0; part < N_INFO_PARTS; part++)
+    {
+      TimeSpan span = { 0 };
+      if (info_load_time (dbg->info, part, &span) == SP_OK)
 	{
-	  if (!end_of_tokens (tokens, i))
-	    break;
-	  exec_leave (dbg);
+	  fprintf (stderr, "  %-28s %9.3f %9.3f\n", part_names[part],
+		   span.start_ms - dbg->startup_ms,
+		   span.end_ms - dbg->startup_ms);
 	}
-      else if (is_command (cmd, 's', "step"))
+      else
 	{
-	  if (!end_of_tokens (tokens, i))
-	    break;
-	  exec_step (dbg);
+	  fprintf (stderr, "  %-28s %9s\n", part_names[part], "loading");
 	}
-      else if (is_command (cmd, 'n', "next"))
+    }
+
+  fprintf (stderr, "Ready after %.3f ms\n", ready_ms - dbg->startup_ms);
+}
+
+/* Get the tracee to where debugging starts and print where it is. */
+SprayResult
+start_debugging (Debugger *dbg)
+{
+  assert (dbg != NULL);
+
+  /* An attached process is inspected wherever it was stopped. */
+  if (dbg->core != NULL || dbg->is_attached)
+    {
+      double start_ms = monotonic_ms ();
+      if (await_debug_info (dbg->info, INFO_DWARF) == SP_ERR)
 	{
-	  if (!end_of_tokens (tokens, i))
-	    break;
-	  exec_next (dbg);
+	  print_debug_info_error (dbg->prog_name);
+	  return SP_ERR;
 	}
-      else if (is_command (cmd, 'a', "backtrace"))
+      time_startup (dbg, STARTUP_AWAIT_DWARF, start_ms);
+
+      if (dbg->core != NULL)
+	print_core_signal (dbg);
+    }
+  else if (run_to_main (dbg) == SP_ERR)
+    return SP_ERR;
+
+  double source_ms = monotonic_ms ();
+  print_current_source (dbg);
+  time_startup (dbg, STARTUP_PRINT_SOURCE, source_ms);
+
+  if (get_args ()->flags.startup_timings)
+    print_startup_timings (dbg);
+
+  return SP_OK;
+}
+
+void
+run_debugger (Debugger dbg)
+{
+  printf ("🐛🐛🐛 %d 🐛🐛🐛\n", dbg.pid);
+
+  if (start_debugging (&dbg) == SP_ERR)
+    return;
+
+  /* Commands that aren't typed in are run one after the other,
+   * and `continue` waits for the tracee to stop. */
+  if (!isatty (STDIN_FILENO) || run_event_loop (&dbg) == SP_ERR)
+    {
+      char *line_buf = NULL;
+      while ((line_buf = linenoise ("spray> ")) != NULL)
 	{
-	  exec_backtrace (dbg);
+	  handle_debug_command (&dbg, line_buf);
+	  linenoiseHistoryAdd (line_buf);
+	  linenoiseFree (line_buf);
 	}
-      else
+    }
+
+  /* `dbg` is a copy so the cache must be freed here. */
+  invalidate_stop_cache (&dbg);
+}
+
+SprayResult
+start_capture (Capture *capture)
+{
+  assert (capture != NULL);
+
+  *capture = (Capture) { 0 };
+  capture->stream = open_memstream (&capture->buf, &capture->size);
+  if (capture->stream == NULL)
+    {
+      return SP_ERR;
+    }
+
+  /* All output goes to `stdout`, so it's
+   * swapped out while the command runs. */
+  capture->original = stdout;
+  stdout = capture->stream;
+  return SP_OK;
+}
+
+/* Restore `stdout`. The caller must free `capture->buf`. */
+void
+stop_capture (Capture *capture)
+{
+  assert (capture != NULL);
+
+  stdout = capture->original;
+  fclose (capture->stream);
+}
+
+/* Print the lines of `output` as the arrays `output`, `errors`,
+ * `warnings` and `hints` of a JSON object. Messages are sorted by
+ * the prefixes that `repl_err` and the like print. Returns the
+ * number of errors. */
+size_t
+print_json_output (const char *output)
+{
+  static const struct
+  {
+    const char *key;
+    const char *prefix;
+  } kinds[] = {
+    {"output", NULL},
+    {"errors", "ERR: "},
+    {"warnings", "WARN: "},
+    {"hints", "HINT: "},
+  };
+  const size_t n_kinds = sizeof (kinds) / sizeof (*kinds);
+
+  size_t n_errors = 0;
+  for (size_t kind = 0; kind < n_kinds; kind++)
+    {
+      printf (",\"%s\":[", kinds[kind].key);
+      bool is_first = true;
+      const char *line = output;
+      while (*line != '\0')
 	{
-	  repl_err ("Unknown command");
+	  const char *end = strchrnul (line, '\n');
+
+	  size_t line_kind = 0;
+	  size_t prefix_len = 0;
+	  for (size_t i = 1; i < n_kinds; i++)
+	    {
+	      size_t len = strlen (kinds[i].prefix);
+	      if (strncmp (line, kinds[i].prefix, len) == 0)
+		{
+		  line_kind = i;
+		  prefix_len = len;
+		}
+	    }
+
+	  if (line_kind == kind)
+	    {
+	      char *text = strndup (line + prefix_len,
+				    end - line - prefix_len);
+	      assert (text != NULL);
+	      printf ("%s", is_first ? "" : ",");
+	      print_json_string (stdout, text);
+	      free (text);
+	      is_first = false;
+	      n_errors += kind == 1;
+	    }
+
+	  line = *end == '\n' ? end + 1 : end;
 	}
+      printf ("]");
     }
-  /* Only run this block once. The loop is only added to make
-   * `break` available for skipping subsequent steps on error. */
-  while (0);
+
+  return n_errors;
 }
 
+/* Print where the tracee stopped, or how it exited, as JSON. */
 void
-handle_debug_command (Debugger *dbg, const char *line)
+print_json_stop (Debugger *dbg)
 {
   assert (dbg != NULL);
-  assert (line != NULL);
-
-  char **tokens = get_command_tokens (line);
-  size_t i = 0;
-  const char *first_token = next_token (tokens, &i);
 
-  /* Is the command empty? */
-  if (first_token == NULL)
+  if (!is_tracee_alive (dbg))
     {
-      free_command_tokens (tokens);
-      char *last_command = NULL;
-      SprayResult res = read_command (dbg->history, &last_command);
-      if (res == SP_OK)
+      if (WIFSIGNALED (dbg->exit_status))
 	{
-	  tokens = get_command_tokens (last_command);
-	  free (last_command);
+	  char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+	  signal_name (WTERMSIG (dbg->exit_status), name);
+	  printf ("{\"event\":\"killed\",\"signal\":\"SIG%s\"}\n", name);
 	}
       else
 	{
-	  repl_err ("No command to repeat");
-	  return;
+	  printf ("{\"event\":\"exit\",\"code\":%d}\n",
+		  WEXITSTATUS (dbg->exit_status));
 	}
+      return;
     }
-  else
+
+  real_addr pc = get_pc (dbg->pid);
+  dbg_addr dbg_pc = real_to_dbg (dbg->load_address, pc);
+  const char *function = sym_name (sym_by_addr (dbg_pc, dbg->info),
+				   dbg->info);
+  const char *filepath = addr_filepath (dbg_pc, dbg->info);
+  const Position *pos = addr_position (dbg_pc, dbg->info);
+
+  printf ("{\"event\":\"stop\",\"thread\":%d,\"pc\":\"" ADDR_FORMAT
+	  "\",\"breakpoint\":%s", dbg->pid, pc.value,
+	  is_user_breakpoint (dbg) ? "true" : "false");
+  if (function != NULL)
     {
-      save_command (dbg->history, line);
+      printf (",\"function\":");
+      print_json_string (stdout, function);
     }
-
-  handle_debug_command_tokens (dbg, tokens);
-  free_command_tokens (tokens);
+  if (filepath != NULL)
+    {
+      printf (",\"file\":");
+      print_json_string (stdout, filepath);
+    }
+  if (pos != NULL)
+    {
+      printf (",\"line\":%u", pos->line);
+    }
+  printf ("}\n");
 }
 
-
-/***************************/
-/* Debugger Initialization */
-/***************************/
-
+/* Run `command` and print its output as JSON. If the
+ * tracee moved, the stop is printed as well. */
 void
-init_load_address (Debugger *dbg)
+run_json_command (Debugger *dbg, const char *command)
 {
   assert (dbg != NULL);
+  assert (command != NULL);
 
-  /* Is this a dynamic executable? */
-  if (is_dyn_exec (dbg->info))
+  size_t n_stops = dbg->n_stops;
+  Capture capture = { 0 };
+  if (start_capture (&capture) == SP_ERR)
     {
-      /* Open the process' `/proc/<pid>/maps` file. */
-      char proc_maps_filepath[PROC_MAPS_FILEPATH_LEN];
-      snprintf (proc_maps_filepath,
-		PROC_MAPS_FILEPATH_LEN, "/proc/%d/maps", dbg->pid);
-
-      FILE *proc_map = fopen (proc_maps_filepath, "r");
-      assert (proc_map != NULL);
-
-      /* Read the first address from the file.
-       * This is OK since address space
-       * layout randomization is disabled. */
-      char *addr = NULL;
-      size_t n = 0;
-      ssize_t nread = getdelim (&addr, &n, (int) '-', proc_map);
-      fclose (proc_map);
-      assert (nread != -1);
-
-      real_addr load_address = { 0 };
-      assert (parse_base16 (addr, &load_address.value) == SP_OK);
+      spray_err ("Failed to capture the output of %s", command);
+      return;
+    }
+  handle_debug_command (dbg, command);
+  stop_capture (&capture);
 
-      free (addr);
+  printf ("{\"command\":");
+  print_json_string (stdout, command);
+  size_t n_errors = print_json_output (capture.buf);
+  printf (",\"ok\":%s}\n", n_errors == 0 ? "true" : "false");
+  free (capture.buf);
 
-      /* Now update the debugger instance on success. */
-      dbg->load_address = load_address;
-    }
-  else
+  if (dbg->n_stops != n_stops)
     {
-      dbg->load_address = (real_addr) {0};
+      print_json_stop (dbg);
     }
 }
 
-int
-setup_debugger (const char *prog_name, char *prog_argv[], Debugger *store)
+/* Print the start of the tracee and where it stopped first as JSON. */
+SprayResult
+start_json_debugging (Debugger *dbg)
 {
-  assert (store != NULL);
-  assert (prog_name != NULL);
+  assert (dbg != NULL);
 
-  if (access (prog_name, F_OK) != 0)
+  Capture capture = { 0 };
+  if (start_capture (&capture) == SP_ERR)
     {
-      repl_err ("File %s doesn't exist", prog_name);
-      return -1;
+      spray_err ("Failed to capture the output");
+      return SP_ERR;
     }
+  SprayResult res = start_debugging (dbg);
+  stop_capture (&capture);
 
-  DebugInfo *info = init_debug_info (prog_name);
-  if (info == NULL)
+  printf ("{\"event\":\"start\",\"pid\":%d", threads_leader (dbg->threads));
+  size_t n_errors = print_json_output (capture.buf);
+  printf (",\"ok\":%s}\n", res == SP_OK && n_errors == 0 ? "true" : "false");
+  free (capture.buf);
+
+  if (res == SP_OK)
     {
-      repl_err ("Failed to initialize debug information");
-      repl_hint ("Did you compile %s with debug information enabled? "
-                 "E.g. clang -g",
-                 prog_name);
-      return -1;
+      print_json_stop (dbg);
     }
+  return res;
+}
 
-  pid_t pid = fork ();
-  if (pid == -1)
+/* The tracee writes to the same file as the debugger. Write the
+ * buffered output before `command` might run it, so that the output
+ * of both doesn't end up interleaved in the middle of a line. */
+void
+flush_before_tracee (const char *command)
+{
+  char **tokens = get_command_tokens (command);
+  if (tokens[0] != NULL && changes_tracee (tokens[0]))
     {
-      return -1;
+      fflush (stdout);
     }
-  else if (pid == 0)
-    {
-      /* Start the child process. */
+  free_command_tokens (tokens);
+}
 
-      /* Disable address space layout randomization. */
-      personality (ADDR_NO_RANDOMIZE);
+SprayResult
+run_script (Debugger dbg, const char *script_filepath, bool is_json)
+{
+  assert (script_filepath != NULL);
 
-      /* Flag *this* process as the tracee. */
-      pt_trace_me ();
+  FILE *script = fopen (script_filepath, "r");
+  if (script == NULL)
+    {
+      spray_err ("Failed to open the script %s: %s", script_filepath,
+		 strerror (errno));
+      return SP_ERR;
+    }
 
-      /* Replace the current process with the
-       * given program to debug. Only pass its
-       * name to it. */
-      execv (prog_name, prog_argv);
+  SprayResult res = SP_OK;
+  if (is_json)
+    {
+      res = start_json_debugging (&dbg);
     }
-  else if (pid >= 1)
+  else
     {
-      /* Parent process */
+      printf ("🐛🐛🐛 %d 🐛🐛🐛\n", dbg.pid);
+      res = start_debugging (&dbg);
+    }
 
-      /* Wait until the tracee has received the initial
-       * SIGTRAP. Don't handle the signal like in `wait_for_signal`. */
-      int wait_status;
-      int options = 0;
-      waitpid (pid, &wait_status, options);
+  char *line = NULL;
+  size_t n = 0;
+  while (res == SP_OK && getline (&line, &n, script) != -1)
+    {
+      line[strcspn (line, "\n")] = '\0';
+      const char *command = line + strspn (line, " \t");
+      if (*command == '\0' || *command == '#')
+	{
+	  continue;
+	}
 
-      *store = (Debugger)
-      {
-	.prog_name = prog_name,.pid = pid,.breakpoints =
-	  init_breakpoints (pid),.info = info,
-	  /* `load_address` is initialized by `init_load_address`. */
-      .load_address.value = 0,.history = init_history (),};
-      init_load_address (store);
-      init_print_source ();
+      flush_before_tracee (command);
+      if (is_json)
+	{
+	  run_json_command (&dbg, command);
+	}
+      else
+	{
+	  handle_debug_command (&dbg, command);
+	}
     }
 
-  return 0;
-}
+  free (line);
+  fclose (script);
 
-SprayResult
-del_debugger (Debugger dbg)
-{
-  free_breakpoints (dbg.breakpoints);
-  free_history (dbg.history);
-  return free_debug_info (&dbg.info);
+  /* `dbg` is a copy so the cache must be freed here. */
+  invalidate_stop_cache (&dbg);
+  fflush (stdout);
+
+  return res;
 }
 
-void
-run_debugger (Debugger dbg)
+
+SprayResult
+run_coverage (Debugger dbg, const char *lcov_filepath)
 {
-  printf ("🐛🐛🐛 %d 🐛🐛🐛\n", dbg.pid);
+  assert (lcov_filepath != NULL);
 
-  const DebugSymbol *main = sym_by_name ("main", dbg.info);
-  if (main == NULL)
-    return;
+  if (await_debug_info (dbg.info, INFO_DWARF) == SP_ERR)
+    {
+      print_debug_info_error (dbg.prog_name);
+      return SP_ERR;
+    }
 
-  dbg_addr start_main = { 0 };
-  if (function_start_addr (main, dbg.info, &start_main) == SP_OK)
+  Coverage *cov = init_coverage (dbg.info, dbg.load_address,
+				 dbg.breakpoints);
+  if (cov == NULL)
     {
-      enable_breakpoint (dbg.breakpoints,
-			 dbg_to_real (dbg.load_address, start_main));
-      if (continue_execution (&dbg) == SP_ERR)
-	return;
+      spray_err ("Failed to set breakpoints for coverage");
+      return SP_ERR;
+    }
 
-      if (wait_for_signal (&dbg) == SP_ERR)
-	return;
+  /* Run the tracee until it exits. Every stop is caused by one of
+   * the coverage breakpoints unless the tracee receives a signal. */
+  while (continue_execution (&dbg) == SP_OK &&
+	 wait_for_signal (&dbg) == SP_OK)
+    {
+      siginfo_t siginfo = { 0 };
+      pt_get_signal_info (dbg.pid, &siginfo);
 
-      disable_breakpoint (dbg.breakpoints,
-			  dbg_to_real (dbg.load_address, start_main));
+      if (siginfo.si_signo == SIGTRAP)
+	{
+	  record_coverage (cov, dbg.breakpoints, get_pc (dbg.pid));
+	}
+      else if (siginfo.si_signo == SIGSEGV)
+	{
+	  /* The tracee would fault again on the same instruction
+	   * after continuing. Stop here and keep what's covered. */
+	  kill (threads_leader (dbg.threads), SIGKILL);
+	  pt_wait (threads_leader (dbg.threads), NULL, 0);
+	  break;
+	}
     }
 
-  print_current_source (&dbg);
+  size_t n_lines = 0;
+  size_t n_hit = 0;
+  coverage_summary (cov, &n_lines, &n_hit);
 
-  char *line_buf = NULL;
-  while ((line_buf = linenoise ("spray> ")) != NULL)
+  SprayResult res = write_lcov (cov, lcov_filepath);
+  if (res == SP_ERR)
+    {
+      spray_err ("Failed to write coverage to %s", lcov_filepath);
+    }
+  else
     {
-      handle_debug_command (&dbg, line_buf);
-      linenoiseHistoryAdd (line_buf);
-      linenoiseFree (line_buf);
+      print_info ("Covered %zu of %zu lines. Wrote coverage to %s",
+		  n_hit, n_lines, lcov_filepath);
     }
+
+  free_coverage (cov);
+
+  return res;
 }
@@ -6,42 +6,236 @@
 /* Required to use `sigabbrev_np` */
 #define _GNU_SOURCE
 
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "backtrace.h"
 #include "breakpoints.h"
+#include "changes.h"
+#include "checkpoints.h"
+#include "core.h"
+#include "event_loop.h"
 #include "history.h"
 #include "info.h"
+#include "monitors.h"
+#include "signals.h"
+#include "stack.h"
+#include "threads.h"
+
+/* Phases of starting to debug that `--startup-timings` reports.
+ * The debug information is loaded at the same time. */
+typedef enum
+{
+  STARTUP_EXEC,			/* Start the tracee and wait for `exec`. */
+  STARTUP_AWAIT_ELF,		/* Wait for the ELF file. */
+  STARTUP_LOAD_ADDRESS,		/* Find where the executable was loaded. */
+  STARTUP_RUN_TO_SYMBOL,	/* Run to the symbol of `main`. */
+  STARTUP_AWAIT_DWARF,		/* Wait for the DWARF debug information. */
+  STARTUP_RUN_TO_MAIN,		/* Run past the prologue of `main`. */
+  STARTUP_PRINT_SOURCE,		/* Print where the tracee is. */
+  N_STARTUP_PHASES,
+} StartupPhase;
 
 typedef struct
 {
   const char *prog_name;	/* Tracee program name. */
-  pid_t pid;			/* Tracee pid. */
+  pid_t pid;			/* Id of the selected thread. */
+  Threads *threads;		/* All threads of the tracee. */
   Breakpoints *breakpoints;	/* Breakpoints. */
   DebugInfo *info;		/* Debug information about the tracee. */
   real_addr load_address;	/* Load address. Set for PIEs, 0 otherwise. */
   History history;		/* Command history of recent commands. */
+  SignalTable *signals;		/* What to do when a signal arrives. */
+  StackSnapshot *stack;		/* Stack at the current stop. NULL
+				 * until it's requested. */
+  CallFrame *frames;		/* Call frames at the current stop. NULL
+				 * until they're requested. */
+  CoreFile *core;		/* Core dump that's debugged instead
+				 * of a live process, or NULL. */
+  Checkpoints *checkpoints;	/* Checkpoints and the stops of the
+				 * tracee. NULL for core dumps. */
+  ChangeTracker *changes;	/* Changes of the tracee's memory
+				 * between stops. NULL for core dumps. */
+  Monitors *monitors;		/* Variables sampled while the tracee
+				 * runs. NULL for core dumps. */
+  size_t n_stops;		/* Number of times the tracee moved to
+				 * another stop or exited. */
+  int exit_status;		/* Wait status of the tracee's exit. */
+  bool is_attached;		/* Was the tracee running before? */
+  bool is_async;		/* Does `continue` return before
+				 * the tracee stops? */
+  bool is_running;		/* Is the tracee running right now? */
+  int step_request;		/* `PTRACE_SINGLESTEP` or `PTRACE_SINGLEBLOCK`
+				 * while only the selected thread is
+				 * stepped, 0 otherwise. */
+  bool is_block_step_supported;	/* Can `PTRACE_SINGLEBLOCK` be used?
+				 * Cleared once the kernel refuses it
+				 * or with `--no-block-step`. */
+  double startup_ms;		/* When the debugger started to set up. */
+  TimeSpan startup[N_STARTUP_PHASES];	/* Phases that ran, and when. */
 } Debugger;
 
 /* Setup a debugger. This forks the child process, launches
- * and immediately stops it.
+ * and immediately stops it. The child is seized so that all
+ * of its threads are traced. The debug information is loaded
+ * on a background thread in the meantime, and only the ELF
+ * file is waited for.
  *
  * On success, `dbg` is modified to accommodate the changes.
  *
  On error, `dbg` stays untouched, and `-1` is returned. */
 int setup_debugger (const char *prog_name, char *prog_argv[], Debugger * dbg);
 
+/* Attach a debugger to the running process `pid`. All threads of the
+ * process are stopped. `prog_name` is the executable the process runs.
+ *
+ * On error, `dbg` stays untouched, and `-1` is returned. */
+int attach_debugger (const char *prog_name, pid_t pid, Debugger * dbg);
+
+/* Debug the core dump at `core_filepath` that was created by a
+ * process running `prog_name`. The state of the process can be
+ * inspected, but it can't be run or changed.
+ *
+ * On error, `dbg` stays untouched, and `-1` is returned. */
+int open_core_debugger (const char *prog_name, const char *core_filepath,
+			Debugger * dbg);
+
 /* Run the debugger. Starts debugging at the beginning
- * of the `main` function of the child process.
+ * of the `main` function of the child process. Attached
+ * processes and core dumps are debugged from wherever
+ * they were stopped.
  *
  * Call `setup_debugger` on `dbg` before calling this function.
  * After `run_debugger` returns, `dbg` is still allocated and
  * must be deleted using `del_debugger`. */
 void run_debugger (Debugger dbg);
 
-/* Free memory allocated by the debugger. Returns
- * `SP_ERR` if some resource couldn't be deleted. */
+/* Run the commands in the file at `script_filepath` one after the
+ * other, like `run_debugger` does for commands that aren't typed in.
+ * Empty lines and lines starting with `#` are skipped. If `is_json`
+ * is set, the output of each command, the start and each stop of
+ * the tracee are printed as JSON objects, one per line.
+ *
+ * Call `setup_debugger` on `dbg` before calling this function.
+ * Returns `SP_ERR` if the script can't be read. */
+SprayResult run_script (Debugger dbg, const char *script_filepath,
+			bool is_json);
+
+/* Talk to an editor over the Debug Adapter Protocol instead of
+ * running the REPL. Requests are read from `in` and the responses
+ * and events are written to `out`. The tracee is started like
+ * `run_debugger` starts it, and everything that's printed is sent
+ * to the editor's debug console.
+ *
+ * Call `setup_debugger` on `dbg` before calling this function. */
+SprayResult run_dap (Debugger dbg, FILE * in, FILE * out);
+
+/* Serve GDB's Remote Serial Protocol on `address` instead of running
+ * the REPL, so that GDB and other tools that speak it can use spray
+ * as their backend. `address` is `:port` for a TCP port on the
+ * loopback interface, or the path of a unix socket. The tracee is
+ * started like `run_debugger` starts it before a single client is
+ * waited for.
+ *
+ * Call `setup_debugger` on `dbg` before calling this function. */
+SprayResult run_gdbserver (Debugger dbg, const char *address);
+
+/* Run the child process to completion without starting the REPL
+ * and record which lines of the program were executed. On exit,
+ * the coverage is written to `lcov_filepath` in the lcov format.
+ *
+ * Call `setup_debugger` on `dbg` before calling this function. */
+SprayResult run_coverage (Debugger dbg, const char *lcov_filepath);
+
+/* Free memory allocated by the debugger. Attached processes are
+ * detached from and keep on running without any breakpoints.
+ * Returns `SP_ERR` if some resource couldn't be deleted. */
 SprayResult del_debugger (Debugger dbg);
 
+/* The rest is shared with the front ends that drive the debugger
+ * over a protocol instead of the REPL, in `dap.c` and `gdbserver.c`. */
+
+/* Print a line of output like `printf`. */
+void print_info (const char *fmt, ...);
+
+/* Get the program counter of the thread `pid`. */
+real_addr get_pc (pid_t pid);
+
+/* Get the tracee to where `run_debugger` starts and print where it is. */
+SprayResult start_debugging (Debugger * dbg);
+
+/* Run the REPL command `line`. */
+void handle_debug_command (Debugger * dbg, const char *line);
+
+/* Is the tracee still alive? */
+bool is_tracee_alive (Debugger * dbg);
+
+/* Move the tracee with `movement` and wait until it stops.
+ * The stop is recorded unless the tracee didn't move. */
+SprayResult move_tracee (Debugger * dbg, Movement movement);
+
+/* Continue the tracee until it stops. `callback` is run with `data`
+ * whenever `fd` is ready in the meantime. Once it sets
+ * `*is_interrupted`, all threads are stopped like by `interrupt`. */
+SprayResult continue_watching (Debugger * dbg, int fd,
+			       EventCallback callback, void *data,
+			       const bool *is_interrupted);
+
+/* Kill the tracee and wait until it's gone. */
+void kill_tracee (Debugger * dbg);
+
+/* Remove all breakpoints and let the attached process
+ * continue to run the way it did before. */
+SprayResult detach_debugger (Debugger * dbg);
+
+/* Did the tracee stop at a breakpoint that the user set? */
+bool is_user_breakpoint (Debugger * dbg);
+
+void exec_break (Breakpoints * breakpoints, real_addr addr);
+void exec_delete (Breakpoints * breakpoints, real_addr addr);
+
+/* Get the address of a location like the `break` command takes
+ * it: a function name, an address or `<file>:<line>`. */
+SprayResult parse_break_location (Debugger dbg, const char *location,
+				  dbg_addr *dest);
+
+/* Get a copy of the tracee's stack. It's taken the first time it's
+ * needed after each stop. Returns NULL if it couldn't be copied. */
+const StackSnapshot *get_stack_snapshot (Debugger * dbg);
+
+/* Get the call frames of the tracee. They're unwound the first
+ * time they're needed after each stop. Returns NULL on error. */
+const CallFrame *get_call_frames (Debugger * dbg);
+
+/* Drop the stack snapshot, the call frames and the registers of the
+ * selected thread. Must be called whenever the tracee's stack or
+ * registers might have changed. */
+void invalidate_stop_cache (Debugger * dbg);
+
+/* Split the command `line` into its tokens. The
+ * array must be freed with `free_command_tokens`. */
+char **get_command_tokens (const char *line);
+void free_command_tokens (char **tokens);
+
+/* Does the command `cmd` run the tracee or change its state? */
+bool changes_tracee (const char *cmd);
+
+/* Output that's printed to `stdout` while a command runs. */
+typedef struct
+{
+  FILE *stream;
+  FILE *original;		/* `stdout` before. */
+  char *buf;
+  size_t size;
+} Capture;
+
+/* Send everything that's printed to `stdout` to `capture->buf`
+ * until `stop_capture` is called. */
+SprayResult start_capture (Capture * capture);
+
+/* Restore `stdout`. The caller must free `capture->buf`. */
+void stop_capture (Capture * capture);
+
 #ifdef UNIT_TESTS
 
 typedef enum
@@ -0,0 +1,705 @@
+/* Required to use `process_vm_readv`. */
+#define _GNU_SOURCE
+
+#include "dump.h"
+
+#include "mappings.h"
+#include "ptrace.h"
+#include "stats.h"
+
+#include <assert.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/procfs.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+enum
+{
+  /* Memory is read from the tracee and written to
+   * the core in chunks of this many bytes. */
+  DUMP_CHUNK_SIZE = 4 * 1024 * 1024,
+  /* Number of chunks in flight. While one chunk is
+   * written, the next one is read from the tracee. */
+  N_DUMP_BUFFERS = 2,
+  /* Notes are padded to multiples of this size. */
+  NOTE_ALIGN = 4,
+};
+
+/* Growable buffer that the notes are collected in. */
+typedef struct
+{
+  unsigned char *bytes;
+  size_t n_bytes;
+  size_t capacity;
+} NoteBuffer;
+
+typedef struct
+{
+  unsigned char *bytes;
+  size_t n_bytes;
+  off_t file_offset;
+  bool is_full;			/* Waiting to be written? */
+} DumpBuffer;
+
+/* State shared between the thread that reads the tracee's memory
+ * and the thread that writes it to the core. */
+typedef struct
+{
+  int fd;
+  Breakpoints *breakpoints;
+  DumpBuffer buffers[N_DUMP_BUFFERS];
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool is_done;			/* No more buffers will be filled. */
+  int write_errno;		/* First error while writing, or 0. */
+  size_t n_bytes_written;
+} DumpPipeline;
+
+static inline uint64_t
+align_up (uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Read the whole file at `filepath`. The caller must free `*bytes`. */
+SprayResult
+read_whole_file (const char *filepath, unsigned char **bytes,
+		 size_t *n_bytes)
+{
+  FILE *file = fopen (filepath, "r");
+  if (file == NULL)
+    {
+      return SP_ERR;
+    }
+
+  *bytes = NULL;
+  *n_bytes = 0;
+  size_t capacity = 0;
+  while (true)
+    {
+      if (*n_bytes == capacity)
+	{
+	  capacity = capacity == 0 ? 1024 : capacity * 2;
+	  unsigned char *grown = realloc (*bytes, capacity);
+	  if (grown == NULL)
+	    {
+	      free (*bytes);
+	      fclose (file);
+	      return SP_ERR;
+	    }
+	  *bytes = grown;
+	}
+
+      size_t n_read = fread (*bytes + *n_bytes, 1, capacity - *n_bytes, file);
+      if (n_read == 0)
+	{
+	  break;
+	}
+      *n_bytes += n_read;
+    }
+
+  fclose (file);
+  return SP_OK;
+}
+
+/* Append a note owned by "CORE" to `notes`. */
+SprayResult
+add_note (NoteBuffer *notes, uint32_t type, const void *desc,
+	  size_t desc_size)
+{
+  static const char NAME[] = "CORE";
+  Elf64_Nhdr nhdr = {
+    .n_namesz = sizeof (NAME),
+    .n_descsz = desc_size,
+    .n_type = type,
+  };
+
+  size_t name_off = notes->n_bytes + sizeof (nhdr);
+  size_t desc_off = name_off + align_up (sizeof (NAME), NOTE_ALIGN);
+  size_t end = desc_off + align_up (desc_size, NOTE_ALIGN);
+
+  if (end > notes->capacity)
+    {
+      size_t capacity = end * 2;
+      unsigned char *grown = realloc (notes->bytes, capacity);
+      if (grown == NULL)
+	{
+	  return SP_ERR;
+	}
+      notes->bytes = grown;
+      notes->capacity = capacity;
+    }
+
+  memset (notes->bytes + notes->n_bytes, 0, end - notes->n_bytes);
+  memcpy (notes->bytes + notes->n_bytes, &nhdr, sizeof (nhdr));
+  memcpy (notes->bytes + name_off, NAME, sizeof (NAME));
+  memcpy (notes->bytes + desc_off, desc, desc_size);
+  notes->n_bytes = end;
+
+  return SP_OK;
+}
+
+/* Fill in what `/proc/<pid>/stat` and `/proc/<pid>/cmdline` say
+ * about the process. See `fill_psinfo` in the Linux kernel. */
+void
+read_process_info (pid_t pid, struct elf_prpsinfo *prpsinfo)
+{
+  prpsinfo->pr_pid = pid;
+
+  char filepath[PROC_PID_FILEPATH_LEN + 4] = { 0 };
+  snprintf (filepath, sizeof (filepath), "/proc/%d/stat", pid);
+  unsigned char *stat = NULL;
+  size_t n_bytes = 0;
+  if (read_whole_file (filepath, &stat, &n_bytes) == SP_OK)
+    {
+      /* The name of the executable is in parentheses and
+       * may contain spaces and parentheses itself. */
+      char *stat_str = (char *) stat;
+      stat_str[n_bytes > 0 ? n_bytes - 1 : 0] = '\0';
+      char *name_start = strchr (stat_str, '(');
+      char *name_end = strrchr (stat_str, ')');
+      if (name_start != NULL && name_end != NULL && name_start < name_end)
+	{
+	  size_t name_len = name_end - name_start - 1;
+	  if (name_len >= sizeof (prpsinfo->pr_fname))
+	    {
+	      name_len = sizeof (prpsinfo->pr_fname) - 1;
+	    }
+	  memcpy (prpsinfo->pr_fname, name_start + 1, name_len);
+
+	  char state = 0;
+	  int ppid = 0, pgrp = 0, sid = 0;
+	  if (sscanf (name_end + 1, " %c %d %d %d", &state, &ppid, &pgrp,
+		      &sid) == 4)
+	    {
+	      prpsinfo->pr_sname = state;
+	      prpsinfo->pr_ppid = ppid;
+	      prpsinfo->pr_pgrp = pgrp;
+	      prpsinfo->pr_sid = sid;
+	    }
+	}
+      free (stat);
+    }
+
+  snprintf (filepath, sizeof (filepath), "/proc/%d/cmdline", pid);
+  unsigned char *cmdline = NULL;
+  if (read_whole_file (filepath, &cmdline, &n_bytes) == SP_OK)
+    {
+      /* The arguments are separated by NULL-bytes. */
+      size_t n_copy = n_bytes < sizeof (prpsinfo->pr_psargs) - 1
+	? n_bytes : sizeof (prpsinfo->pr_psargs) - 1;
+      for (size_t i = 0; i < n_copy; i++)
+	{
+	  prpsinfo->pr_psargs[i] = cmdline[i] != '\0' ? cmdline[i] : ' ';
+	}
+      while (n_copy > 0 && prpsinfo->pr_psargs[n_copy - 1] == ' ')
+	{
+	  prpsinfo->pr_psargs[--n_copy] = '\0';
+	}
+      free (cmdline);
+    }
+}
+
+/* Add the `NT_PRSTATUS` and `NT_FPREGSET` notes of the thread `tid`. */
+SprayResult
+add_thread_notes (NoteBuffer *notes, Threads *threads, pid_t tid,
+		  const struct elf_prpsinfo *prpsinfo)
+{
+  const struct user_regs_struct *regs = thread_registers (threads, tid);
+  if (regs == NULL)
+    {
+      return SP_ERR;
+    }
+
+  struct user_fpregs_struct fp_regs = { 0 };
+  bool has_fp_regs = pt_read_fp_registers (tid, &fp_regs) == SP_OK;
+
+  struct elf_prstatus prstatus = { 0 };
+  prstatus.pr_pid = tid;
+  prstatus.pr_ppid = prpsinfo->pr_ppid;
+  prstatus.pr_pgrp = prpsinfo->pr_pgrp;
+  prstatus.pr_sid = prpsinfo->pr_sid;
+  prstatus.pr_fpvalid = has_fp_regs;
+  static_assert (sizeof (prstatus.pr_reg) == sizeof (*regs),
+		 "Unexpected size of pr_reg");
+  memcpy (&prstatus.pr_reg, regs, sizeof (*regs));
+
+  if (add_note (notes, NT_PRSTATUS, &prstatus, sizeof (prstatus)) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  if (has_fp_regs)
+    {
+      return add_note (notes, NT_FPREGSET, &fp_regs, sizeof (fp_regs));
+    }
+
+  return SP_OK;
+}
+
+/* Add the `NT_FILE` note that lists the mapped files. The layout
+ * is the same as the one of `fill_files_note` in the Linux kernel. */
+SprayResult
+add_file_note (NoteBuffer *notes, const Mappings *mappings)
+{
+  uint64_t page_size = (uint64_t) sysconf (_SC_PAGESIZE);
+  uint64_t n_files = 0;
+  size_t names_size = 0;
+  for (size_t i = 0; i < mappings->n_mappings; i++)
+    {
+      if (mappings->mappings[i].filepath != NULL)
+	{
+	  n_files++;
+	  names_size += strlen (mappings->mappings[i].filepath) + 1;
+	}
+    }
+
+  size_t desc_size = (2 + 3 * n_files) * sizeof (uint64_t) + names_size;
+  unsigned char *desc = calloc (1, desc_size);
+  if (desc == NULL)
+    {
+      return SP_ERR;
+    }
+
+  uint64_t *words = (uint64_t *) desc;
+  words[0] = n_files;
+  words[1] = page_size;
+  char *names = (char *) (words + 2 + 3 * n_files);
+  size_t file_idx = 0;
+  for (size_t i = 0; i < mappings->n_mappings; i++)
+    {
+      const Mapping *mapping = &mappings->mappings[i];
+      if (mapping->filepath == NULL)
+	{
+	  continue;
+	}
+
+      uint64_t *entry = words + 2 + 3 * file_idx++;
+      entry[0] = mapping->start;
+      entry[1] = mapping->end;
+      entry[2] = mapping->file_offset / page_size;
+
+      size_t path_size = strlen (mapping->filepath) + 1;
+      memcpy (names, mapping->filepath, path_size);
+      names += path_size;
+    }
+
+  SprayResult res = add_note (notes, NT_FILE, desc, desc_size);
+  free (desc);
+  return res;
+}
+
+/* Collect all notes of the core. The thread `first_tid` comes first. */
+SprayResult
+collect_notes (NoteBuffer *notes, Threads *threads, pid_t first_tid,
+	       const Mappings *mappings)
+{
+  pid_t pid = threads_leader (threads);
+
+  struct elf_prpsinfo prpsinfo = { 0 };
+  read_process_info (pid, &prpsinfo);
+
+  if (add_note (notes, NT_PRPSINFO, &prpsinfo, sizeof (prpsinfo)) == SP_ERR
+      || add_thread_notes (notes, threads, first_tid, &prpsinfo) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  SprayResult res = SP_OK;
+  pid_t *tids = sorted_threads (threads);
+  for (size_t i = 0; i < n_threads (threads) && res == SP_OK; i++)
+    {
+      if (tids[i] != first_tid)
+	{
+	  res = add_thread_notes (notes, threads, tids[i], &prpsinfo);
+	}
+    }
+  free (tids);
+  if (res == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  char auxv_filepath[PROC_PID_FILEPATH_LEN] = { 0 };
+  snprintf (auxv_filepath, PROC_PID_FILEPATH_LEN, "/proc/%d/auxv", pid);
+  unsigned char *auxv = NULL;
+  size_t auxv_size = 0;
+  if (read_whole_file (auxv_filepath, &auxv, &auxv_size) == SP_OK)
+    {
+      res = add_note (notes, NT_AUXV, auxv, auxv_size);
+      free (auxv);
+      if (res == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+    }
+
+  return add_file_note (notes, mappings);
+}
+
+/* Write the ELF header, the program headers and the notes to the
+ * start of the core. `data_offset` is where the memory goes. */
+SprayResult
+write_headers (int fd, const Mappings *mappings, const NoteBuffer *notes,
+	       uint64_t *data_offset)
+{
+  size_t n_phdrs = mappings->n_mappings + 1;
+  if (n_phdrs >= PN_XNUM)
+    {
+      errno = E2BIG;
+      return SP_ERR;
+    }
+
+  uint64_t page_size = (uint64_t) sysconf (_SC_PAGESIZE);
+  uint64_t notes_offset = sizeof (Elf64_Ehdr) + n_phdrs * sizeof (Elf64_Phdr);
+  *data_offset = align_up (notes_offset + notes->n_bytes, page_size);
+
+  size_t headers_size = notes_offset + notes->n_bytes;
+  unsigned char *headers = calloc (1, headers_size);
+  if (headers == NULL)
+    {
+      return SP_ERR;
+    }
+
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *) headers;
+  memcpy (ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+  ehdr->e_type = ET_CORE;
+  ehdr->e_machine = EM_X86_64;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_phoff = sizeof (Elf64_Ehdr);
+  ehdr->e_ehsize = sizeof (Elf64_Ehdr);
+  ehdr->e_phentsize = sizeof (Elf64_Phdr);
+  ehdr->e_phnum = n_phdrs;
+
+  Elf64_Phdr *phdrs = (Elf64_Phdr *) (headers + sizeof (Elf64_Ehdr));
+  phdrs[0] = (Elf64_Phdr)
+  {
+  .p_type = PT_NOTE,.p_offset = notes_offset,.p_filesz =
+      notes->n_bytes,.p_align = NOTE_ALIGN,};
+
+  uint64_t offset = *data_offset;
+  for (size_t i = 0; i < mappings->n_mappings; i++)
+    {
+      const Mapping *mapping = &mappings->mappings[i];
+      uint64_t size = mapping->end - mapping->start;
+      phdrs[i + 1] = (Elf64_Phdr)
+      {
+      .p_type = PT_LOAD,.p_flags = mapping->flags,.p_offset =
+	  offset,.p_vaddr = mapping->start,.p_filesz =
+	  mapping->is_readable ? size : 0,.p_memsz = size,.p_align =
+	  page_size,};
+      offset += phdrs[i + 1].p_filesz;
+    }
+
+  memcpy (headers + notes_offset, notes->bytes, notes->n_bytes);
+
+  SprayResult res = SP_OK;
+  if (pwrite (fd, headers, headers_size, 0) != (ssize_t) headers_size
+      || ftruncate (fd, (off_t) offset) == -1)
+    {
+      res = SP_ERR;
+    }
+
+  free (headers);
+  return res;
+}
+
+/* Read `n_bytes` of the tracee's memory at `addr` into `bytes`.
+ * Pages that can't be read are filled with zeros. */
+void
+read_chunk (pid_t pid, uint64_t addr, unsigned char *bytes, size_t n_bytes)
+{
+  size_t page_size = (size_t) sysconf (_SC_PAGESIZE);
+  size_t n_done = 0;
+  while (n_done < n_bytes)
+    {
+      struct iovec local = {
+	.iov_base = bytes + n_done,
+	.iov_len = n_bytes - n_done,
+      };
+      struct iovec remote = {
+	.iov_base = (void *) (addr + n_done),
+	.iov_len = n_bytes - n_done,
+      };
+
+      /* Reading stops at the first page that can't be read. */
+      add_stat (STAT_PROCESS_VM_READV, 1);
+      ssize_t n_read = process_vm_readv (pid, &local, 1, &remote, 1, 0);
+      if (n_read > 0)
+	{
+	  n_done += (size_t) n_read;
+	  add_stat (STAT_BYTES_READ, (uint64_t) n_read);
+	}
+      else
+	{
+	  size_t n_skip = page_size < n_bytes - n_done
+	    ? page_size : n_bytes - n_done;
+	  memset (bytes + n_done, 0, n_skip);
+	  n_done += n_skip;
+	}
+    }
+}
+
+static inline bool
+is_zero_page (const unsigned char *page, size_t page_size)
+{
+  const uint64_t *words = (const uint64_t *) page;
+  for (size_t i = 0; i < page_size / sizeof (uint64_t); i++)
+    {
+      if (words[i] != 0)
+	{
+	  return false;
+	}
+    }
+  return true;
+}
+
+/* Write the pages of `buffer` that aren't all zeros. Returns
+ * the number of bytes written, or -1 with `errno` set. */
+ssize_t
+write_sparse (int fd, const DumpBuffer *buffer)
+{
+  size_t page_size = (size_t) sysconf (_SC_PAGESIZE);
+  size_t n_written = 0;
+  size_t i = 0;
+  while (i < buffer->n_bytes)
+    {
+      if (is_zero_page (buffer->bytes + i, page_size))
+	{
+	  i += page_size;
+	  continue;
+	}
+
+      /* Write runs of non-zero pages with a single call. */
+      size_t run_end = i + page_size;
+      while (run_end < buffer->n_bytes
+	     && !is_zero_page (buffer->bytes + run_end, page_size))
+	{
+	  run_end += page_size;
+	}
+
+      size_t n_bytes = run_end - i;
+      if (pwrite (fd, buffer->bytes + i, n_bytes, buffer->file_offset + i)
+	  != (ssize_t) n_bytes)
+	{
+	  return -1;
+	}
+      n_written += n_bytes;
+      i = run_end;
+    }
+
+  return (ssize_t) n_written;
+}
+
+/* Write the buffers that the reader filled in order. */
+void *
+write_buffers (void *void_pipeline)
+{
+  DumpPipeline *pipeline = (DumpPipeline *) void_pipeline;
+
+  for (size_t i = 0;; i = (i + 1) % N_DUMP_BUFFERS)
+    {
+      DumpBuffer *buffer = &pipeline->buffers[i];
+
+      pthread_mutex_lock (&pipeline->lock);
+      while (!buffer->is_full && !pipeline->is_done)
+	{
+	  pthread_cond_wait (&pipeline->changed, &pipeline->lock);
+	}
+      /* Buffers are filled in order, so none of the
+       * following buffers is full if this one isn't. */
+      bool is_finished = !buffer->is_full;
+      pthread_mutex_unlock (&pipeline->lock);
+
+      if (is_finished)
+	{
+	  return NULL;
+	}
+
+      ssize_t n_written = pipeline->write_errno == 0
+	? write_sparse (pipeline->fd, buffer) : 0;
+
+      pthread_mutex_lock (&pipeline->lock);
+      if (n_written == -1 && pipeline->write_errno == 0)
+	{
+	  pipeline->write_errno = errno;
+	}
+      else if (n_written > 0)
+	{
+	  pipeline->n_bytes_written += (size_t) n_written;
+	}
+      buffer->is_full = false;
+      pthread_cond_broadcast (&pipeline->changed);
+      pthread_mutex_unlock (&pipeline->lock);
+    }
+}
+
+/* Read the memory of all mappings into the pipeline's buffers while
+ * the writer thread writes the buffers that were filled before. */
+SprayResult
+stream_memory (pid_t pid, const Mappings *mappings, uint64_t data_offset,
+	       DumpPipeline *pipeline)
+{
+  /* The writer thread mustn't receive the signals of the debugger. */
+  sigset_t signals;
+  sigset_t old_signals;
+  sigfillset (&signals);
+  pthread_sigmask (SIG_BLOCK, &signals, &old_signals);
+  pthread_t writer;
+  int create_err = pthread_create (&writer, NULL, write_buffers, pipeline);
+  pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+  if (create_err != 0)
+    {
+      return SP_ERR;
+    }
+
+  size_t buffer_idx = 0;
+  uint64_t file_offset = data_offset;
+  for (size_t i = 0; i < mappings->n_mappings; i++)
+    {
+      const Mapping *mapping = &mappings->mappings[i];
+      if (!mapping->is_readable)
+	{
+	  continue;
+	}
+
+      for (uint64_t addr = mapping->start; addr < mapping->end;
+	   addr += DUMP_CHUNK_SIZE)
+	{
+	  DumpBuffer *buffer = &pipeline->buffers[buffer_idx];
+
+	  pthread_mutex_lock (&pipeline->lock);
+	  while (buffer->is_full)
+	    {
+	      pthread_cond_wait (&pipeline->changed, &pipeline->lock);
+	    }
+	  bool has_failed = pipeline->write_errno != 0;
+	  pthread_mutex_unlock (&pipeline->lock);
+
+	  if (has_failed)
+	    {
+	      break;
+	    }
+
+	  size_t n_bytes = mapping->end - addr < DUMP_CHUNK_SIZE
+	    ? mapping->end - addr : DUMP_CHUNK_SIZE;
+	  read_chunk (pid, addr, buffer->bytes, n_bytes);
+	  hide_breakpoints (pipeline->breakpoints, (real_addr) {addr},
+			    buffer->bytes, n_bytes);
+	  buffer->n_bytes = n_bytes;
+	  buffer->file_offset = (off_t) (file_offset + (addr - mapping->start));
+
+	  pthread_mutex_lock (&pipeline->lock);
+	  buffer->is_full = true;
+	  pthread_cond_broadcast (&pipeline->changed);
+	  pthread_mutex_unlock (&pipeline->lock);
+
+	  buffer_idx = (buffer_idx + 1) % N_DUMP_BUFFERS;
+	}
+
+      file_offset += mapping->end - mapping->start;
+    }
+
+  pthread_mutex_lock (&pipeline->lock);
+  pipeline->is_done = true;
+  pthread_cond_broadcast (&pipeline->changed);
+  pthread_mutex_unlock (&pipeline->lock);
+
+  pthread_join (writer, NULL);
+
+  if (pipeline->write_errno != 0)
+    {
+      errno = pipeline->write_errno;
+      return SP_ERR;
+    }
+
+  return SP_OK;
+}
+
+SprayResult
+dump_core (Threads *threads, Breakpoints *breakpoints, pid_t first_tid,
+	   const char *filepath, size_t *n_bytes_written)
+{
+  assert (threads != NULL);
+  assert (breakpoints != NULL);
+  assert (filepath != NULL);
+  assert (n_bytes_written != NULL);
+
+  pid_t pid = threads_leader (threads);
+
+  Mappings mappings = { 0 };
+  if (read_mappings (pid, &mappings) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  NoteBuffer notes = { 0 };
+  if (collect_notes (&notes, threads, first_tid, &mappings) == SP_ERR)
+    {
+      int notes_errno = errno;
+      free (notes.bytes);
+      free_mappings (&mappings);
+      errno = notes_errno;
+      return SP_ERR;
+    }
+
+  int fd = open (filepath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    {
+      int open_errno = errno;
+      free (notes.bytes);
+      free_mappings (&mappings);
+      errno = open_errno;
+      return SP_ERR;
+    }
+
+  uint64_t data_offset = 0;
+  SprayResult res = write_headers (fd, &mappings, &notes, &data_offset);
+
+  DumpPipeline pipeline = {.fd = fd,.breakpoints = breakpoints };
+  pthread_mutex_init (&pipeline.lock, NULL);
+  pthread_cond_init (&pipeline.changed, NULL);
+  for (size_t i = 0; i < N_DUMP_BUFFERS && res == SP_OK; i++)
+    {
+      pipeline.buffers[i].bytes = malloc (DUMP_CHUNK_SIZE);
+      if (pipeline.buffers[i].bytes == NULL)
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  if (res == SP_OK)
+    {
+      res = stream_memory (pid, &mappings, data_offset, &pipeline);
+    }
+
+  int dump_errno = errno;
+
+  for (size_t i = 0; i < N_DUMP_BUFFERS; i++)
+    {
+      free (pipeline.buffers[i].bytes);
+    }
+  pthread_cond_destroy (&pipeline.changed);
+  pthread_mutex_destroy (&pipeline.lock);
+  free (notes.bytes);
+  free_mappings (&mappings);
+
+  if (close (fd) == -1 && res == SP_OK)
+    {
+      return SP_ERR;
+    }
+
+  *n_bytes_written = pipeline.n_bytes_written;
+  errno = dump_errno;
+  return res;
+}
@@ -0,0 +1,25 @@
+/* Write core dumps of the stopped tracee, so that its state
+ * can be inspected later on with `spray --core`. */
+
+#pragma once
+
+#ifndef _SPRAY_DUMP_H_
+#define _SPRAY_DUMP_H_
+
+#include "magic.h"
+#include "threads.h"
+
+#include <stdlib.h>
+
+/* Write an ELF core dump of the stopped tracee to `filepath`. The core
+ * contains every readable mapping of the process and the registers of
+ * all `threads`. The original instructions are written in place of the
+ * `breakpoints`. The notes of `first_tid` come first, so it's selected
+ * when the core is opened. Pages that only contain zeros are left as
+ * holes in the file. `n_bytes_written` is set to the number of bytes of
+ * memory that were written. Returns `SP_ERR` with `errno` set on error. */
+SprayResult dump_core (Threads * threads, Breakpoints * breakpoints,
+		       pid_t first_tid, const char *filepath,
+		       size_t *n_bytes_written);
+
+#endif /* _SPRAY_DUMP_H_ */
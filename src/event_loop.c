@@ -0,0 +1,144 @@
+#include "event_loop.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+typedef struct
+{
+  int fd;
+  EventCallback callback;
+  void *data;
+} Watch;
+
+struct EventLoop
+{
+  int epoll_fd;
+  Watch *watches;
+  size_t n_watches;
+};
+
+enum
+{
+  /* Maximum number of events handled per call to `epoll_wait`. */
+  MAX_EVENTS = 16,
+};
+
+EventLoop *
+init_event_loop (void)
+{
+  EventLoop *loop = calloc (1, sizeof (*loop));
+  if (loop == NULL)
+    {
+      return NULL;
+    }
+
+  loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (loop->epoll_fd == -1)
+    {
+      free (loop);
+      return NULL;
+    }
+
+  return loop;
+}
+
+void
+free_event_loop (EventLoop *loop)
+{
+  if (loop != NULL)
+    {
+      close (loop->epoll_fd);
+      free (loop->watches);
+      free (loop);
+    }
+}
+
+/* Returns NULL if `fd` isn't watched. */
+const Watch *
+get_watch (const EventLoop *loop, int fd)
+{
+  for (size_t i = 0; i < loop->n_watches; i++)
+    {
+      if (loop->watches[i].fd == fd)
+	{
+	  return &loop->watches[i];
+	}
+    }
+
+  return NULL;
+}
+
+SprayResult
+watch_fd (EventLoop *loop, int fd, EventCallback callback, void *data)
+{
+  assert (loop != NULL);
+  assert (callback != NULL);
+
+  if (get_watch (loop, fd) != NULL)
+    {
+      return SP_ERR;
+    }
+
+  struct epoll_event event = {.events = EPOLLIN,.data.fd = fd };
+  if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      return SP_ERR;
+    }
+
+  loop->watches = realloc (loop->watches,
+			   sizeof (Watch) * (loop->n_watches + 1));
+  assert (loop->watches != NULL);
+  loop->watches[loop->n_watches++] = (Watch) {
+    .fd = fd,
+    .callback = callback,
+    .data = data,
+  };
+
+  return SP_OK;
+}
+
+void
+unwatch_fd (EventLoop *loop, int fd)
+{
+  assert (loop != NULL);
+
+  for (size_t i = 0; i < loop->n_watches; i++)
+    {
+      if (loop->watches[i].fd == fd)
+	{
+	  epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	  loop->watches[i] = loop->watches[--loop->n_watches];
+	  return;
+	}
+    }
+}
+
+SprayResult
+dispatch_events (EventLoop *loop, int timeout_ms)
+{
+  assert (loop != NULL);
+
+  struct epoll_event events[MAX_EVENTS];
+  int n_events = epoll_wait (loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+  if (n_events == -1)
+    {
+      return errno == EINTR ? SP_OK : SP_ERR;
+    }
+
+  for (int i = 0; i < n_events; i++)
+    {
+      /* The watches are looked up again for each event because
+       * callbacks may stop watching any file descriptor. */
+      const Watch *watch = get_watch (loop, events[i].data.fd);
+      if (watch != NULL)
+	{
+	  Watch copy = *watch;
+	  copy.callback (copy.fd, copy.data);
+	}
+    }
+
+  return SP_OK;
+}
@@ -0,0 +1,39 @@
+/* Wait for several file descriptors at once and run a callback
+ * for each one that's ready. This lets the REPL read input
+ * while the tracee runs. Based on epoll(7). */
+
+#pragma once
+
+#ifndef _SPRAY_EVENT_LOOP_H_
+#define _SPRAY_EVENT_LOOP_H_
+
+#include "magic.h"
+
+typedef struct EventLoop EventLoop;
+
+/* Called when `fd` is ready to be read. `data` is
+ * the pointer that was passed to `watch_fd`. */
+typedef void (*EventCallback) (int fd, void *data);
+
+/* Returns NULL on error. */
+EventLoop *init_event_loop (void);
+
+/* Stop watching all file descriptors. The
+ * file descriptors themselves stay open. */
+void free_event_loop (EventLoop * loop);
+
+/* Run `callback` whenever `fd` is ready to be read.
+ * Returns `SP_ERR` if `fd` is watched already. */
+SprayResult watch_fd (EventLoop * loop, int fd,
+		      EventCallback callback, void *data);
+
+/* Stop watching `fd`. Does nothing if it isn't
+ * watched. It's safe to call this in a callback. */
+void unwatch_fd (EventLoop * loop, int fd);
+
+/* Wait until at least one of the file descriptors is ready
+ * and run their callbacks. Waits at most `timeout_ms`
+ * milliseconds, or indefinitely if it's -1. */
+SprayResult dispatch_events (EventLoop * loop, int timeout_ms);
+
+#endif /* _SPRAY_EVENT_LOOP_H_ */
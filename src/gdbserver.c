@@ -0,0 +1,1240 @@
+/* The GDB stub: answers the packets of GDB's Remote Serial
+ * Protocol, see `run_gdbserver` in `debugger.h`. The framing
+ * of the packets is done in `rsp.c`. */
+
+#include "debugger.h"
+#include "ptrace.h"
+#include "registers.h"
+#include "rsp.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>		/* `INT_MAX` */
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+/* Features of the target description that the registers belong to. */
+typedef enum
+{
+  GDB_FEATURE_CORE,
+  GDB_FEATURE_SSE,
+  GDB_FEATURE_LINUX,
+  GDB_FEATURE_SEGMENTS,
+} GdbFeature;
+
+/* Where the value of a register comes from. */
+typedef enum
+{
+  GDB_REG_GENERAL,		/* `user_regs_struct`, by `x86_reg`. */
+  GDB_REG_ST,			/* `st_space` of `user_fpregs_struct`. */
+  GDB_REG_XMM,			/* `xmm_space` of `user_fpregs_struct`. */
+  GDB_REG_FP_CONTROL,		/* Other members, by `GdbFpControl`. */
+} GdbRegisterSource;
+
+typedef enum
+{
+  GDB_FCTRL,
+  GDB_FSTAT,
+  GDB_FTAG,
+  GDB_FISEG,
+  GDB_FIOFF,
+  GDB_FOSEG,
+  GDB_FOOFF,
+  GDB_FOP,
+  GDB_MXCSR,
+} GdbFpControl;
+
+typedef struct
+{
+  const char *name;
+  unsigned n_bytes;
+  const char *type;
+  GdbFeature feature;
+  GdbRegisterSource source;
+  int index;			/* Of the register in its source. */
+} GdbRegister;
+
+/* The registers in the order of GDB's amd64 target, which is the
+ * order of the `g` packet and of the numbers in `p` and `P`. */
+static const GdbRegister gdb_registers[] = {
+  {"rax", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rax},
+  {"rbx", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rbx},
+  {"rcx", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rcx},
+  {"rdx", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rdx},
+  {"rsi", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rsi},
+  {"rdi", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, rdi},
+  {"rbp", 8, "data_ptr", GDB_FEATURE_CORE, GDB_REG_GENERAL, rbp},
+  {"rsp", 8, "data_ptr", GDB_FEATURE_CORE, GDB_REG_GENERAL, rsp},
+  {"r8", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r8},
+  {"r9", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r9},
+  {"r10", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r10},
+  {"r11", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r11},
+  {"r12", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r12},
+  {"r13", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r13},
+  {"r14", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r14},
+  {"r15", 8, "int64", GDB_FEATURE_CORE, GDB_REG_GENERAL, r15},
+  {"rip", 8, "code_ptr", GDB_FEATURE_CORE, GDB_REG_GENERAL, rip},
+  {"eflags", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, eflags},
+  {"cs", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, cs},
+  {"ss", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, ss},
+  {"ds", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, ds},
+  {"es", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, es},
+  {"fs", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, fs},
+  {"gs", 4, "int32", GDB_FEATURE_CORE, GDB_REG_GENERAL, gs},
+  {"st0", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 0},
+  {"st1", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 1},
+  {"st2", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 2},
+  {"st3", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 3},
+  {"st4", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 4},
+  {"st5", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 5},
+  {"st6", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 6},
+  {"st7", 10, "i387_ext", GDB_FEATURE_CORE, GDB_REG_ST, 7},
+  {"fctrl", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FCTRL},
+  {"fstat", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FSTAT},
+  {"ftag", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FTAG},
+  {"fiseg", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FISEG},
+  {"fioff", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FIOFF},
+  {"foseg", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FOSEG},
+  {"fooff", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FOOFF},
+  {"fop", 4, "int", GDB_FEATURE_CORE, GDB_REG_FP_CONTROL, GDB_FOP},
+  {"xmm0", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 0},
+  {"xmm1", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 1},
+  {"xmm2", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 2},
+  {"xmm3", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 3},
+  {"xmm4", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 4},
+  {"xmm5", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 5},
+  {"xmm6", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 6},
+  {"xmm7", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 7},
+  {"xmm8", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 8},
+  {"xmm9", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 9},
+  {"xmm10", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 10},
+  {"xmm11", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 11},
+  {"xmm12", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 12},
+  {"xmm13", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 13},
+  {"xmm14", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 14},
+  {"xmm15", 16, "vec128", GDB_FEATURE_SSE, GDB_REG_XMM, 15},
+  {"mxcsr", 4, "int", GDB_FEATURE_SSE, GDB_REG_FP_CONTROL, GDB_MXCSR},
+  {"orig_rax", 8, "int", GDB_FEATURE_LINUX, GDB_REG_GENERAL, orig_rax},
+  {"fs_base", 8, "int", GDB_FEATURE_SEGMENTS, GDB_REG_GENERAL, fs_base},
+  {"gs_base", 8, "int", GDB_FEATURE_SEGMENTS, GDB_REG_GENERAL, gs_base},
+};
+
+enum
+{
+  GDB_N_REGISTERS = sizeof (gdb_registers) / sizeof (*gdb_registers),
+  /* Space of each register in `st_space` and `xmm_space`. */
+  FP_REG_SPACE = 16,
+  /* Offset and mask of the top of the x87 register stack in `swd`. */
+  FP_TOP_SHIFT = 11,
+  FP_TOP_MASK = 0x7,
+  FP_EXPONENT_MASK = 0x7fff,
+  FP_INTEGER_BIT = 0x80,
+  FP_TAG_VALID = 0,
+  FP_TAG_ZERO = 1,
+  FP_TAG_SPECIAL = 2,
+  FP_TAG_EMPTY = 3,
+  FP_OPCODE_MASK = 0x7ff,
+  /* Signal reported when the client interrupted the tracee. */
+  GDB_INTERRUPT_SIGNAL = SIGINT,
+};
+
+static const char *const gdb_feature_names[] = {
+  [GDB_FEATURE_CORE] = "org.gnu.gdb.i386.core",
+  [GDB_FEATURE_SSE] = "org.gnu.gdb.i386.sse",
+  [GDB_FEATURE_LINUX] = "org.gnu.gdb.i386.linux",
+  [GDB_FEATURE_SEGMENTS] = "org.gnu.gdb.i386.segments",
+};
+
+/* Type of the `xmm` registers. */
+static const char *const gdb_vec128_type =
+  "<vector id=\"v4f\" type=\"ieee_single\" count=\"4\"/>"
+  "<vector id=\"v2d\" type=\"ieee_double\" count=\"2\"/>"
+  "<vector id=\"v16i8\" type=\"int8\" count=\"16\"/>"
+  "<vector id=\"v8i16\" type=\"int16\" count=\"8\"/>"
+  "<vector id=\"v4i32\" type=\"int32\" count=\"4\"/>"
+  "<vector id=\"v2i64\" type=\"int64\" count=\"2\"/>"
+  "<union id=\"vec128\">"
+  "<field name=\"v4_float\" type=\"v4f\"/>"
+  "<field name=\"v2_double\" type=\"v2d\"/>"
+  "<field name=\"v16_int8\" type=\"v16i8\"/>"
+  "<field name=\"v8_int16\" type=\"v8i16\"/>"
+  "<field name=\"v4_int32\" type=\"v4i32\"/>"
+  "<field name=\"v2_int64\" type=\"v2i64\"/>"
+  "<field name=\"uint128\" type=\"uint128\"/>" "</union>";
+
+typedef struct
+{
+  Debugger *dbg;
+  RspConnection *conn;
+  real_addr *breakpoints;	/* Where the client wants breakpoints. */
+  size_t n_breakpoints;
+  real_addr *inserted;		/* Where they are in the tracee. */
+  size_t n_inserted;
+  bool has_swbreak;		/* Does the client understand `swbreak`? */
+  bool is_interrupted;		/* Did the client stop the tracee? */
+  bool is_done;
+} GdbServer;
+
+/* Format the description of the registers that the client
+ * reads with `qXfer:features:read:target.xml`. */
+char *
+gdb_target_xml (size_t *n_bytes)
+{
+  char *xml = NULL;
+  FILE *stream = open_memstream (&xml, n_bytes);
+  if (stream == NULL)
+    {
+      return NULL;
+    }
+
+  fprintf (stream, "<?xml version=\"1.0\"?>"
+	   "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	   "<target version=\"1.0\">"
+	   "<architecture>i386:x86-64</architecture>"
+	   "<osabi>GNU/Linux</osabi>");
+  for (size_t i = 0; i < GDB_N_REGISTERS; i++)
+    {
+      const GdbRegister *reg = &gdb_registers[i];
+      if (i == 0 || reg->feature != gdb_registers[i - 1].feature)
+	{
+	  fprintf (stream, "%s<feature name=\"%s\">", i == 0 ? ""
+		   : "</feature>", gdb_feature_names[reg->feature]);
+	  if (reg->feature == GDB_FEATURE_SSE)
+	    {
+	      fputs (gdb_vec128_type, stream);
+	    }
+	}
+      fprintf (stream, "<reg name=\"%s\" bitsize=\"%u\" type=\"%s\"/>",
+	       reg->name, reg->n_bytes * 8, reg->type);
+    }
+  fprintf (stream, "</feature></target>");
+
+  fclose (stream);
+  return xml;
+}
+
+/* Rebuild the full x87 tag word from the abridged one that
+ * `FXSAVE` stores, which only tells which registers are empty. */
+uint32_t
+gdb_fp_tag_word (const struct user_fpregs_struct *fp_regs)
+{
+  unsigned top = (fp_regs->swd >> FP_TOP_SHIFT) & FP_TOP_MASK;
+  uint32_t tags = 0;
+  for (unsigned physical = 0; physical < 8; physical++)
+    {
+      uint32_t tag = FP_TAG_EMPTY;
+      if (fp_regs->ftw & (1 << physical))
+	{
+	  /* `st_space` is ordered like the stack, starting at the top. */
+	  const unsigned char *value = (const unsigned char *) fp_regs->st_space
+	    + ((physical - top) & FP_TOP_MASK) * FP_REG_SPACE;
+	  uint16_t exponent = (value[8] | value[9] << 8) & FP_EXPONENT_MASK;
+	  bool is_zero = true;
+	  for (int i = 0; i < 8; i++)
+	    {
+	      is_zero &= value[i] == 0;
+	    }
+
+	  if (exponent == FP_EXPONENT_MASK)
+	    tag = FP_TAG_SPECIAL;
+	  else if (exponent == 0)
+	    tag = is_zero ? FP_TAG_ZERO : FP_TAG_SPECIAL;
+	  else
+	    tag = value[7] & FP_INTEGER_BIT ? FP_TAG_VALID : FP_TAG_SPECIAL;
+	}
+      tags |= tag << (2 * physical);
+    }
+  return tags;
+}
+
+/* Write the value of `reg` to `bytes`, which must have room
+ * for `reg->n_bytes`. `fp_regs` is NULL if they're unknown. */
+SprayResult
+gdb_register_bytes (const GdbRegister *reg,
+		    const struct user_regs_struct *regs,
+		    const struct user_fpregs_struct *fp_regs,
+		    unsigned char *bytes)
+{
+  if (reg->source == GDB_REG_GENERAL)
+    {
+      /* Values are little-endian, so the 32-bit registers
+       * are the low bytes of their 64-bit slots. */
+      memcpy (bytes, &((const uint64_t *) regs)[reg->index], reg->n_bytes);
+      return SP_OK;
+    }
+  if (fp_regs == NULL)
+    {
+      return SP_ERR;
+    }
+
+  uint32_t control = 0;
+  switch (reg->source)
+    {
+    case GDB_REG_ST:
+      memcpy (bytes, (const unsigned char *) fp_regs->st_space
+	      + reg->index * FP_REG_SPACE, reg->n_bytes);
+      return SP_OK;
+    case GDB_REG_XMM:
+      memcpy (bytes, (const unsigned char *) fp_regs->xmm_space
+	      + reg->index * FP_REG_SPACE, reg->n_bytes);
+      return SP_OK;
+    case GDB_REG_FP_CONTROL:
+      switch ((GdbFpControl) reg->index)
+	{
+	case GDB_FCTRL:
+	  control = fp_regs->cwd;
+	  break;
+	case GDB_FSTAT:
+	  control = fp_regs->swd;
+	  break;
+	case GDB_FTAG:
+	  control = gdb_fp_tag_word (fp_regs);
+	  break;
+	case GDB_FISEG:
+	  control = fp_regs->rip >> 32;
+	  break;
+	case GDB_FIOFF:
+	  control = (uint32_t) fp_regs->rip;
+	  break;
+	case GDB_FOSEG:
+	  control = fp_regs->rdp >> 32;
+	  break;
+	case GDB_FOOFF:
+	  control = (uint32_t) fp_regs->rdp;
+	  break;
+	case GDB_FOP:
+	  control = fp_regs->fop & FP_OPCODE_MASK;
+	  break;
+	case GDB_MXCSR:
+	  control = fp_regs->mxcsr;
+	  break;
+	}
+      memcpy (bytes, &control, sizeof (control));
+      return SP_OK;
+    case GDB_REG_GENERAL:
+      break;
+    }
+  return SP_ERR;
+}
+
+/* Write the registers of the selected thread as hex digits to
+ * `stream`, starting at `first` and ending before `end`. Registers
+ * that can't be read are sent as `xx` for each byte. */
+SprayResult
+write_gdb_registers (GdbServer *server, FILE *stream, size_t first,
+		     size_t end)
+{
+  Debugger *dbg = server->dbg;
+  const struct user_regs_struct *regs = is_tracee_alive (dbg)
+    ? thread_registers (dbg->threads, dbg->pid) : NULL;
+  if (regs == NULL)
+    {
+      return SP_ERR;
+    }
+  struct user_fpregs_struct fp_regs = { 0 };
+  bool has_fp_regs = pt_read_fp_registers (dbg->pid, &fp_regs) == SP_OK;
+
+  for (size_t i = first; i < end; i++)
+    {
+      unsigned char bytes[FP_REG_SPACE] = { 0 };
+      const GdbRegister *reg = &gdb_registers[i];
+      if (gdb_register_bytes (reg, regs, has_fp_regs ? &fp_regs : NULL,
+			      bytes) == SP_OK)
+	{
+	  write_rsp_hex (stream, bytes, reg->n_bytes);
+	}
+      else
+	{
+	  for (unsigned j = 0; j < reg->n_bytes; j++)
+	    {
+	      fputs ("xx", stream);
+	    }
+	}
+    }
+  return SP_OK;
+}
+
+/* Send what was written to `stream`, which writes to `buf`. */
+void
+send_gdb_stream (GdbServer *server, FILE *stream, char **buf, size_t *size)
+{
+  fclose (stream);
+  send_rsp_packet (server->conn, *buf, *size);
+  free (*buf);
+}
+
+void
+gdb_read_registers (GdbServer *server, size_t first, size_t end)
+{
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream (&buf, &size);
+  if (stream == NULL)
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  if (write_gdb_registers (server, stream, first, end) == SP_ERR)
+    {
+      fclose (stream);
+      free (buf);
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+  send_gdb_stream (server, stream, &buf, &size);
+}
+
+/* Set the general purpose registers starting at `first` to the
+ * values in `hex` until it ends. The others can't be written. */
+SprayResult
+gdb_write_registers (GdbServer *server, size_t first, const char *hex)
+{
+  Debugger *dbg = server->dbg;
+  const struct user_regs_struct *cached = is_tracee_alive (dbg)
+    ? thread_registers (dbg->threads, dbg->pid) : NULL;
+  if (cached == NULL)
+    {
+      return SP_ERR;
+    }
+
+  struct user_regs_struct regs = *cached;
+  bool is_changed = false;
+  for (size_t i = first; i < GDB_N_REGISTERS && *hex != '\0'; i++)
+    {
+      const GdbRegister *reg = &gdb_registers[i];
+      uint64_t value = 0;
+      unsigned char bytes[FP_REG_SPACE] = { 0 };
+      if (read_rsp_hex (hex, bytes, reg->n_bytes) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      hex += 2 * reg->n_bytes;
+
+      if (reg->source == GDB_REG_GENERAL)
+	{
+	  memcpy (&value, bytes, reg->n_bytes);
+	  ((uint64_t *) &regs)[reg->index] = value;
+	  is_changed = true;
+	}
+    }
+
+  if (!is_changed)
+    {
+      return SP_OK;
+    }
+
+  SprayResult res = pt_write_registers (dbg->pid, &regs);
+  invalidate_stop_cache (dbg);
+  return res;
+}
+
+/* Parse the hex number at `*pos` and move `*pos` past it. */
+SprayResult
+parse_gdb_number (const char **pos, uint64_t *value)
+{
+  char *end = NULL;
+  errno = 0;
+  *value = strtoull (*pos, &end, 16);
+  if (end == *pos || errno != 0)
+    {
+      return SP_ERR;
+    }
+  *pos = end;
+  return SP_OK;
+}
+
+/* Parse `<addr>,<length>` and move `*pos` past it. */
+SprayResult
+parse_gdb_range (const char **pos, uint64_t *addr, uint64_t *length)
+{
+  if (parse_gdb_number (pos, addr) == SP_ERR || **pos != ',')
+    {
+      return SP_ERR;
+    }
+  (*pos)++;
+  return parse_gdb_number (pos, length);
+}
+
+/* Parse a thread id like `1a2b`, `0` (any thread) or `-1` (all
+ * threads). Both of the latter become 0. */
+SprayResult
+parse_gdb_thread (const char **pos, pid_t *tid)
+{
+  if (strncmp (*pos, "-1", 2) == 0)
+    {
+      *pos += 2;
+      *tid = 0;
+      return SP_OK;
+    }
+
+  uint64_t value = 0;
+  if (parse_gdb_number (pos, &value) == SP_ERR || value > INT_MAX)
+    {
+      return SP_ERR;
+    }
+  *tid = value;
+  return SP_OK;
+}
+
+void
+gdb_read_memory (GdbServer *server, const char *args)
+{
+  Debugger *dbg = server->dbg;
+  uint64_t addr = 0;
+  uint64_t length = 0;
+  if (parse_gdb_range (&args, &addr, &length) == SP_ERR || *args != '\0')
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  /* The reply has two hex digits for each byte. */
+  if (length > RSP_PACKET_SIZE / 2)
+    {
+      length = RSP_PACKET_SIZE / 2;
+    }
+
+  unsigned char *bytes = malloc (length + 1);
+  assert (bytes != NULL);
+  size_t n_read = is_tracee_alive (dbg)
+    ? pt_read_memory_range (dbg->pid, (real_addr) {addr}, bytes, length)
+    : 0;
+  if (n_read == 0 && length > 0)
+    {
+      free (bytes);
+      send_rsp_str (server->conn, "E14");
+      return;
+    }
+  hide_breakpoints (dbg->breakpoints, (real_addr) {addr}, bytes, n_read);
+
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream (&buf, &size);
+  if (stream == NULL)
+    {
+      free (bytes);
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+  write_rsp_hex (stream, bytes, n_read);
+  free (bytes);
+  send_gdb_stream (server, stream, &buf, &size);
+}
+
+/* Find the breakpoints in `addrs` that are in the range of `n_bytes`
+ * at `start` and store them as `changes` that set them to
+ * `is_enabled`. Returns the number of changes. */
+size_t
+gdb_breakpoints_in_range (const real_addr *addrs, size_t n_addrs,
+			  real_addr start, size_t n_bytes, bool is_enabled,
+			  BreakpointChange *changes)
+{
+  size_t n_changes = 0;
+  for (size_t i = 0; i < n_addrs; i++)
+    {
+      if (addrs[i].value >= start.value
+	  && addrs[i].value - start.value < n_bytes)
+	{
+	  changes[n_changes++] = (BreakpointChange) {
+	    .addr = addrs[i],.is_enabled = is_enabled,
+	  };
+	}
+    }
+  return n_changes;
+}
+
+void
+gdb_write_memory (GdbServer *server, const char *args)
+{
+  Debugger *dbg = server->dbg;
+  uint64_t addr = 0;
+  uint64_t length = 0;
+  if (parse_gdb_range (&args, &addr, &length) == SP_ERR || *args != ':'
+      || length > RSP_PACKET_SIZE / 2 || strlen (args + 1) != 2 * length
+      || !is_tracee_alive (dbg))
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  unsigned char *bytes = malloc (length + 1);
+  assert (bytes != NULL);
+  read_rsp_hex (args + 1, bytes, length);
+
+  /* Breakpoints in the range are removed first so that
+   * the new bytes end up underneath them. */
+  BreakpointChange *changes = calloc (server->n_inserted + 1,
+				      sizeof (*changes));
+  assert (changes != NULL);
+  size_t n_changes =
+    gdb_breakpoints_in_range (server->inserted, server->n_inserted,
+			      (real_addr) {addr}, length, false, changes);
+  change_breakpoints (dbg->breakpoints, changes, n_changes);
+  SprayResult res =
+    pt_write_memory_range (dbg->pid, (real_addr) {addr}, bytes, length);
+  for (size_t i = 0; i < n_changes; i++)
+    {
+      changes[i].is_enabled = true;
+    }
+  change_breakpoints (dbg->breakpoints, changes, n_changes);
+
+  free (changes);
+  free (bytes);
+  invalidate_stop_cache (dbg);
+  send_rsp_str (server->conn, res == SP_OK ? "OK" : "E01");
+}
+
+/* Add `addr` to the breakpoints that the client wants, or
+ * remove it if `is_inserted` is false. */
+void
+gdb_breakpoint (GdbServer *server, const char *args, bool is_inserted)
+{
+  Debugger *dbg = server->dbg;
+  uint64_t addr = 0;
+  uint64_t kind = 0;
+  /* Only software breakpoints are supported. */
+  if (strncmp (args, "0,", 2) != 0)
+    {
+      send_rsp_str (server->conn, "");
+      return;
+    }
+  args += 2;
+  if (parse_gdb_range (&args, &addr, &kind) == SP_ERR)
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  size_t found = server->n_breakpoints;
+  for (size_t i = 0; i < server->n_breakpoints; i++)
+    {
+      if (server->breakpoints[i].value == addr)
+	{
+	  found = i;
+	}
+    }
+
+  if (is_inserted && found == server->n_breakpoints)
+    {
+      /* Inserting is deferred, so bad addresses are found now. */
+      unsigned char byte = 0;
+      if (!is_tracee_alive (dbg)
+	  || pt_read_memory_range (dbg->pid, (real_addr) {addr}, &byte,
+				   sizeof (byte)) != sizeof (byte))
+	{
+	  send_rsp_str (server->conn, "E01");
+	  return;
+	}
+
+      server->breakpoints = realloc (server->breakpoints,
+				     (server->n_breakpoints + 1)
+				     * sizeof (*server->breakpoints));
+      assert (server->breakpoints != NULL);
+      server->breakpoints[server->n_breakpoints++] = (real_addr) {addr};
+    }
+  else if (!is_inserted && found < server->n_breakpoints)
+    {
+      server->breakpoints[found] =
+	server->breakpoints[--server->n_breakpoints];
+    }
+
+  send_rsp_str (server->conn, "OK");
+}
+
+/* Bring the breakpoints in the tracee in line with those that the
+ * client wants. This happens in one batch right before the tracee is
+ * resumed. GDB removes all breakpoints whenever the tracee stops and
+ * inserts them again before it's resumed, so usually nothing
+ * changes at all. */
+SprayResult
+sync_gdb_breakpoints (GdbServer *server)
+{
+  Debugger *dbg = server->dbg;
+  size_t n_changes = 0;
+  BreakpointChange *changes =
+    calloc (server->n_breakpoints + server->n_inserted + 1,
+	    sizeof (*changes));
+  assert (changes != NULL);
+
+  for (size_t i = 0; i < server->n_breakpoints; i++)
+    {
+      changes[n_changes++] = (BreakpointChange) {
+	.addr = server->breakpoints[i],.is_enabled = true,
+      };
+    }
+  for (size_t i = 0; i < server->n_inserted; i++)
+    {
+      bool is_wanted = false;
+      for (size_t j = 0; j < server->n_breakpoints; j++)
+	{
+	  is_wanted |= server->inserted[i].value
+	    == server->breakpoints[j].value;
+	}
+      if (!is_wanted)
+	{
+	  changes[n_changes++] = (BreakpointChange) {
+	    .addr = server->inserted[i],.is_enabled = false,
+	  };
+	}
+    }
+
+  SprayResult res =
+    change_breakpoints (dbg->breakpoints, changes, n_changes);
+
+  /* Some of them might have failed. */
+  server->n_inserted = 0;
+  server->inserted = realloc (server->inserted,
+			      (n_changes + 1) * sizeof (*server->inserted));
+  assert (server->inserted != NULL);
+  for (size_t i = 0; i < n_changes; i++)
+    {
+      if (lookup_breakpoint (dbg->breakpoints, changes[i].addr))
+	{
+	  server->inserted[server->n_inserted++] = changes[i].addr;
+	}
+    }
+
+  free (changes);
+  return res;
+}
+
+void
+callback__gdb_interrupt (int fd, void *void_server)
+{
+  unused (fd);
+  GdbServer *server = (GdbServer *) void_server;
+  if (poll_rsp_interrupt (server->conn))
+    {
+      server->is_interrupted = true;
+    }
+}
+
+/* Continue the tracee until it stops or until the client
+ * interrupts it. The client is listened to in the meantime. */
+SprayResult
+gdb_continue (GdbServer *server)
+{
+  return continue_watching (server->dbg, rsp_fd (server->conn),
+			    callback__gdb_interrupt, server,
+			    &server->is_interrupted);
+}
+
+/* Send the reason why the tracee stopped. */
+void
+send_gdb_stop (GdbServer *server)
+{
+  Debugger *dbg = server->dbg;
+  char reply[128];
+
+  if (!is_tracee_alive (dbg))
+    {
+      int status = dbg->exit_status;
+      if (WIFSIGNALED (status))
+	snprintf (reply, sizeof (reply), "X%02x",
+		  gdb_signal_from_signo (WTERMSIG (status)));
+      else
+	snprintf (reply, sizeof (reply), "W%02x", WEXITSTATUS (status));
+      send_rsp_str (server->conn, reply);
+      return;
+    }
+
+  int signo = GDB_INTERRUPT_SIGNAL;
+  siginfo_t siginfo = { 0 };
+  if (!server->is_interrupted)
+    {
+      signo = pt_get_signal_info (dbg->pid, &siginfo) == SP_OK
+	&& siginfo.si_signo != 0 ? siginfo.si_signo : SIGTRAP;
+    }
+
+  bool is_swbreak = server->has_swbreak && signo == SIGTRAP
+    && lookup_breakpoint (dbg->breakpoints, get_pc (dbg->pid));
+  snprintf (reply, sizeof (reply), "T%02xthread:%x;%s",
+	    gdb_signal_from_signo (signo), (unsigned) dbg->pid,
+	    is_swbreak ? "swbreak:;" : "");
+  send_rsp_str (server->conn, reply);
+}
+
+/* Resume the tracee with `movement` and report the next stop. */
+void
+gdb_move (GdbServer *server, Movement movement)
+{
+  Debugger *dbg = server->dbg;
+  if (!is_tracee_alive (dbg))
+    {
+      send_gdb_stop (server);
+      return;
+    }
+
+  server->is_interrupted = false;
+  if (sync_gdb_breakpoints (server) == SP_ERR)
+    {
+      repl_err ("Failed to insert all breakpoints");
+    }
+
+  if (movement == MOVE_CONTINUE)
+    {
+      gdb_continue (server);
+    }
+  else
+    {
+      move_tracee (dbg, movement);
+    }
+  fflush (stdout);
+  send_gdb_stop (server);
+}
+
+/* Handle `vCont;<action>[:<thread>]...`. A thread that should step
+ * is stepped on its own. Otherwise, all threads continue. */
+void
+gdb_vcont (GdbServer *server, const char *actions)
+{
+  Debugger *dbg = server->dbg;
+  pid_t step_tid = 0;
+  bool is_continue = false;
+
+  /* Signals are only delivered if the client asks for them. */
+  if (is_tracee_alive (dbg))
+    {
+      pid_t *tids = sorted_threads (dbg->threads);
+      for (size_t i = 0; i < n_threads (dbg->threads); i++)
+	{
+	  set_thread_signal (dbg->threads, tids[i], 0);
+	}
+      free (tids);
+    }
+
+  while (*actions == ';' && actions[1] != '\0')
+    {
+      char action = actions[1];
+      actions += 2;
+      uint64_t gdb_signo = 0;
+      if ((action == 'C' || action == 'S')
+	  && parse_gdb_number (&actions, &gdb_signo) == SP_ERR)
+	{
+	  send_rsp_str (server->conn, "E01");
+	  return;
+	}
+
+      pid_t tid = 0;
+      if (*actions == ':')
+	{
+	  actions++;
+	  if (parse_gdb_thread (&actions, &tid) == SP_ERR)
+	    {
+	      send_rsp_str (server->conn, "E01");
+	      return;
+	    }
+	}
+
+      if ((action == 's' || action == 'S') && step_tid == 0)
+	step_tid = tid != 0 ? tid : dbg->pid;
+      else if (action == 'c' || action == 'C')
+	is_continue = true;
+      else if (action != 's' && action != 'S')
+	{
+	  /* E.g. range stepping or stopping threads in non-stop mode. */
+	  send_rsp_str (server->conn, "E01");
+	  return;
+	}
+
+      if (gdb_signo != 0)
+	{
+	  set_thread_signal (dbg->threads, tid != 0 ? tid : dbg->pid,
+			     signo_from_gdb_signal (gdb_signo));
+	}
+    }
+
+  if (*actions != '\0' || (step_tid == 0 && !is_continue))
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  if (step_tid != 0 && step_tid != dbg->pid
+      && lookup_thread (dbg->threads, step_tid))
+    {
+      dbg->pid = step_tid;
+      invalidate_stop_cache (dbg);
+    }
+  gdb_move (server, step_tid != 0 ? MOVE_INST : MOVE_CONTINUE);
+}
+
+/* Handle the old `c`, `C<sig>`, `s` and `S<sig>` packets. Resuming at
+ * another address isn't supported. */
+void
+gdb_resume (GdbServer *server, const char *packet)
+{
+  const char *args = packet + 1;
+  uint64_t gdb_signo = 0;
+  if ((packet[0] == 'C' || packet[0] == 'S')
+      && parse_gdb_number (&args, &gdb_signo) == SP_ERR)
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  if (*args != '\0')
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  char actions[32];
+  snprintf (actions, sizeof (actions), ";%c", packet[0]);
+  if (gdb_signo != 0)
+    {
+      snprintf (actions, sizeof (actions), ";%c%02x", packet[0],
+		(unsigned) gdb_signo);
+    }
+  gdb_vcont (server, actions);
+}
+
+/* Select the thread that `H<op><thread>` names. */
+void
+gdb_select_thread (GdbServer *server, const char *args)
+{
+  Debugger *dbg = server->dbg;
+  pid_t tid = 0;
+  if (parse_gdb_thread (&args, &tid) == SP_ERR || *args != '\0'
+      || (tid != 0 && !lookup_thread (dbg->threads, tid)))
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  if (tid != 0 && tid != dbg->pid)
+    {
+      dbg->pid = tid;
+      invalidate_stop_cache (dbg);
+    }
+  send_rsp_str (server->conn, "OK");
+}
+
+void
+gdb_thread_info (GdbServer *server)
+{
+  Debugger *dbg = server->dbg;
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream (&buf, &size);
+  if (stream == NULL)
+    {
+      send_rsp_str (server->conn, "E01");
+      return;
+    }
+
+  fputc ('m', stream);
+  pid_t *tids = sorted_threads (dbg->threads);
+  for (size_t i = 0; i < n_threads (dbg->threads); i++)
+    {
+      fprintf (stream, "%s%x", i == 0 ? "" : ",", (unsigned) tids[i]);
+    }
+  free (tids);
+  send_gdb_stream (server, stream, &buf, &size);
+}
+
+/* Read all of the file at `filepath`. The caller must free it. */
+char *
+read_gdb_file (const char *filepath, size_t *n_bytes)
+{
+  FILE *file = fopen (filepath, "r");
+  if (file == NULL)
+    {
+      return NULL;
+    }
+
+  char *buf = NULL;
+  FILE *stream = open_memstream (&buf, n_bytes);
+  if (stream == NULL)
+    {
+      fclose (file);
+      return NULL;
+    }
+
+  char chunk[BUFSIZ];
+  size_t n_read = 0;
+  while ((n_read = fread (chunk, 1, sizeof (chunk), file)) > 0)
+    {
+      fwrite (chunk, 1, n_read, stream);
+    }
+  fclose (file);
+  fclose (stream);
+  return buf;
+}
+
+/* Handle `qXfer:<object>:read:<annex>:<offset>,<length>`. Other
+ * objects than the target description, the auxiliary vector
+ * and the path of the executable are unknown. */
+void
+gdb_xfer (GdbServer *server, const char *args)
+{
+  Debugger *dbg = server->dbg;
+  char object[32] = { 0 };
+  char annex[32] = { 0 };
+  int n_parsed = 0;
+  if (sscanf (args, "%31[^:]:read:%31[^:]:%n", object, annex, &n_parsed)
+      < 1 || n_parsed == 0)
+    {
+      /* The annex can be empty, which `sscanf` doesn't allow. */
+      if (sscanf (args, "%31[^:]:read::%n", object, &n_parsed) < 1
+	  || n_parsed == 0)
+	{
+	  send_rsp_str (server->conn, "");
+	  return;
+	}
+      annex[0] = '\0';
+    }
+
+  const char *range = args + n_parsed;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  if (parse_gdb_range (&range, &offset, &length) == SP_ERR)
+    {
+      send_rsp_str (server->conn, "E00");
+      return;
+    }
+
+  char filepath[PROC_PID_FILEPATH_LEN] = { 0 };
+  char *data = NULL;
+  size_t n_bytes = 0;
+  if (str_eq (object, "features") && str_eq (annex, "target.xml"))
+    {
+      data = gdb_target_xml (&n_bytes);
+    }
+  else if (str_eq (object, "auxv") && is_tracee_alive (dbg))
+    {
+      snprintf (filepath, sizeof (filepath), "/proc/%d/auxv",
+		threads_leader (dbg->threads));
+      data = read_gdb_file (filepath, &n_bytes);
+    }
+  else if (str_eq (object, "exec-file") && is_tracee_alive (dbg))
+    {
+      snprintf (filepath, sizeof (filepath), "/proc/%d/exe",
+		threads_leader (dbg->threads));
+      data = realpath (filepath, NULL);
+      n_bytes = data != NULL ? strlen (data) : 0;
+    }
+  else
+    {
+      send_rsp_str (server->conn, "");
+      return;
+    }
+
+  if (data == NULL)
+    {
+      send_rsp_str (server->conn, "E00");
+      return;
+    }
+
+  /* `l` marks the last part, `m` says that there is more. */
+  if (length > RSP_PACKET_SIZE - 1)
+    {
+      length = RSP_PACKET_SIZE - 1;
+    }
+  size_t start = offset < n_bytes ? offset : n_bytes;
+  size_t n_part = n_bytes - start < length ? n_bytes - start : length;
+  char *reply = malloc (n_part + 1);
+  assert (reply != NULL);
+  reply[0] = start + n_part < n_bytes ? 'm' : 'l';
+  memcpy (reply + 1, data + start, n_part);
+  send_rsp_packet (server->conn, reply, n_part + 1);
+  free (reply);
+  free (data);
+}
+
+void
+gdb_supported (GdbServer *server, const char *features)
+{
+  server->has_swbreak = strstr (features, "swbreak+") != NULL;
+
+  char reply[256];
+  snprintf (reply, sizeof (reply), "PacketSize=%x;qXfer:features:read+;"
+	    "qXfer:auxv:read+;qXfer:exec-file:read+;QStartNoAckMode+;"
+	    "vContSupported+%s", RSP_PACKET_SIZE,
+	    server->has_swbreak ? ";swbreak+" : "");
+  send_rsp_str (server->conn, reply);
+}
+
+/* Kill the tracee and wait until it's gone. */
+void
+gdb_kill (GdbServer *server)
+{
+  kill_tracee (server->dbg);
+  server->is_done = true;
+}
+
+void
+handle_gdb_packet (GdbServer *server, const char *packet)
+{
+  Debugger *dbg = server->dbg;
+  pid_t tid = 0;
+  const char *args = packet + 1;
+  char reply[64];
+
+  switch (packet[0])
+    {
+    case '?':
+      send_gdb_stop (server);
+      return;
+    case 'g':
+      gdb_read_registers (server, 0, GDB_N_REGISTERS);
+      return;
+    case 'G':
+      send_rsp_str (server->conn,
+		    gdb_write_registers (server, 0, args) == SP_OK
+		    ? "OK" : "E01");
+      return;
+    case 'p':
+      {
+	uint64_t regno = 0;
+	if (parse_gdb_number (&args, &regno) == SP_ERR
+	    || regno >= GDB_N_REGISTERS)
+	  send_rsp_str (server->conn, "E01");
+	else
+	  gdb_read_registers (server, regno, regno + 1);
+	return;
+      }
+    case 'P':
+      {
+	uint64_t regno = 0;
+	if (parse_gdb_number (&args, &regno) == SP_ERR || *args != '='
+	    || regno >= GDB_N_REGISTERS
+	    || gdb_registers[regno].source != GDB_REG_GENERAL
+	    || strlen (args + 1) != 2 * gdb_registers[regno].n_bytes)
+	  send_rsp_str (server->conn, "E01");
+	else
+	  send_rsp_str (server->conn,
+			gdb_write_registers (server, regno, args + 1)
+			== SP_OK ? "OK" : "E01");
+	return;
+      }
+    case 'm':
+      gdb_read_memory (server, args);
+      return;
+    case 'M':
+      gdb_write_memory (server, args);
+      return;
+    case 'Z':
+      gdb_breakpoint (server, args, true);
+      return;
+    case 'z':
+      gdb_breakpoint (server, args, false);
+      return;
+    case 'c':
+    case 'C':
+    case 's':
+    case 'S':
+      gdb_resume (server, packet);
+      return;
+    case 'H':
+      if (args[0] == '\0')
+	send_rsp_str (server->conn, "E01");
+      else
+	gdb_select_thread (server, args + 1);
+      return;
+    case 'T':
+      send_rsp_str (server->conn,
+		    parse_gdb_thread (&args, &tid) == SP_OK
+		    && lookup_thread (dbg->threads, tid) ? "OK" : "E01");
+      return;
+    case 'D':
+      detach_debugger (dbg);
+      send_rsp_str (server->conn, "OK");
+      server->is_done = true;
+      return;
+    case 'k':
+      gdb_kill (server);
+      return;
+    }
+
+  if (str_eq (packet, "vCont?"))
+    send_rsp_str (server->conn, "vCont;c;C;s;S");
+  else if (strncmp (packet, "vCont;", strlen ("vCont;")) == 0)
+    gdb_vcont (server, packet + strlen ("vCont"));
+  else if (strncmp (packet, "vKill", strlen ("vKill")) == 0)
+    {
+      gdb_kill (server);
+      send_rsp_str (server->conn, "OK");
+    }
+  else if (strncmp (packet, "qSupported", strlen ("qSupported")) == 0)
+    gdb_supported (server, packet);
+  else if (str_eq (packet, "QStartNoAckMode"))
+    {
+      send_rsp_str (server->conn, "OK");
+      stop_rsp_acks (server->conn);
+    }
+  else if (strncmp (packet, "qXfer:", strlen ("qXfer:")) == 0)
+    gdb_xfer (server, packet + strlen ("qXfer:"));
+  else if (str_eq (packet, "qfThreadInfo"))
+    gdb_thread_info (server);
+  else if (str_eq (packet, "qsThreadInfo"))
+    send_rsp_str (server->conn, "l");
+  else if (str_eq (packet, "qC"))
+    {
+      snprintf (reply, sizeof (reply), "QC%x", (unsigned) dbg->pid);
+      send_rsp_str (server->conn, reply);
+    }
+  else if (strncmp (packet, "qAttached", strlen ("qAttached")) == 0)
+    send_rsp_str (server->conn, dbg->is_attached ? "1" : "0");
+  else if (strncmp (packet, "qSymbol", strlen ("qSymbol")) == 0)
+    send_rsp_str (server->conn, "OK");
+  else
+    /* An empty reply says that the packet isn't supported. */
+    send_rsp_str (server->conn, "");
+}
+
+SprayResult
+run_gdbserver (Debugger dbg, const char *address)
+{
+  assert (address != NULL);
+
+  GdbServer server = {.dbg = &dbg };
+  server.conn = listen_rsp (address);
+  if (server.conn == NULL)
+    {
+      spray_err ("Failed to listen on %s: %s", address, strerror (errno));
+      return SP_ERR;
+    }
+
+  SprayResult res = start_debugging (&dbg);
+  if (res == SP_OK)
+    {
+      print_info ("Listening on %s", rsp_address (server.conn));
+      fflush (stdout);
+      res = accept_rsp (server.conn);
+      if (res == SP_ERR)
+	{
+	  spray_err ("Failed to accept a client: %s", strerror (errno));
+	}
+    }
+
+  const char *packet = NULL;
+  size_t n_bytes = 0;
+  while (res == SP_OK && !server.is_done)
+    {
+      RspEvent event = read_rsp_packet (server.conn, &packet, &n_bytes);
+      if (event == RSP_CLOSED)
+	{
+	  break;
+	}
+      /* The tracee is already stopped if there is nothing to interrupt. */
+      if (event == RSP_PACKET)
+	{
+	  handle_gdb_packet (&server, packet);
+	  fflush (stdout);
+	}
+    }
+
+  close_rsp (server.conn);
+  free (server.breakpoints);
+  free (server.inserted);
+
+  /* `dbg` is a copy so the cache must be freed here. */
+  invalidate_stop_cache (&dbg);
+
+  return res;
+}
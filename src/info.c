@@ -2,8 +2,13 @@
 
 #include "spray_dwarf.h"
 #include "spray_elf.h"
+#include "stats.h"
+
+#include "hashmap.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
 
 struct DebugSymbol
@@ -134,62 +139,263 @@ mut_sym_ptr (const DebugSymbol *sym, DebugSymbolBuf *buf)
     }
 }
 
+/* State shared between the thread that loads the debug
+ * information and the functions that wait for it. */
+typedef struct
+{
+  char *filepath;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  size_t n_loaded;		/* Parts that are loaded so far. */
+  bool has_failed;		/* Did the next part fail to load? */
+  TimeSpan times[N_INFO_PARTS];
+} InfoLoader;
+
 struct DebugInfo
 {
+  /* The loader sets `elf`, `dbg` and `unwind`. Wait
+   * for their part before reading them. */
   ElfFile *elf;
   Dwarf_Debug dbg;
+  UnwindTable *unwind;
   DebugSymbolBuf *symbols;
+  /* Symbols that were already looked up by their address. */
+  struct hashmap *addr_syms;
+  /* Built when the first line range is looked up. */
+  LineIndex *lines;
+  InfoLoader *loader;
 };
 
+/* Entry in `DebugInfo.addr_syms`. */
+typedef struct
+{
+  uint64_t addr;
+  size_t buf_idx;		/* Index into `DebugInfo.symbols`. */
+} AddrSymbol;
+
+int
+addr_symbol_compare (const void *a, const void *b, void *udata)
+{
+  unused (udata);
+  const AddrSymbol *sym_a = (AddrSymbol *) a;
+  const AddrSymbol *sym_b = (AddrSymbol *) b;
+  return !(sym_a->addr == sym_b->addr);
+}
+
+uint64_t
+addr_symbol_hash (const void *entry, uint64_t seed0, uint64_t seed1)
+{
+  const AddrSymbol *sym = (AddrSymbol *) entry;
+  return hashmap_sip (&sym->addr, sizeof (sym->addr), seed0, seed1);
+}
+
+SprayResult
+load_part (DebugInfo *info, InfoPart part)
+{
+  switch (part)
+    {
+    case INFO_ELF:
+      {
+	ElfFile *elf = malloc (sizeof (*elf));
+	if (elf == NULL)
+	  {
+	    return SP_ERR;
+	  }
+	if (se_parse_elf (info->loader->filepath, elf) != ELF_PARSE_OK)
+	  {
+	    free (elf);
+	    return SP_ERR;
+	  }
+	info->elf = elf;
+	return SP_OK;
+      }
+    case INFO_DWARF:
+      {
+	Dwarf_Error error = NULL;
+	info->dbg = sd_dwarf_init (info->loader->filepath, &error);
+	if (info->dbg == NULL)
+	  {
+	    dwarf_dealloc_error (NULL, error);
+	    return SP_ERR;
+	  }
+	/* libdwarf reads all of the DWARF if this fails. */
+	sd_set_sections (info->dbg, info->elf);
+	return SP_OK;
+      }
+    case INFO_UNWIND:
+      /* Executables without call frame information are fine. */
+      info->unwind = init_unwind_table (info->elf);
+      return SP_OK;
+    default:
+      return SP_ERR;
+    }
+}
+
+/* Load the parts of `void_info` one after the other. */
+void *
+load_parts (void *void_info)
+{
+  DebugInfo *info = (DebugInfo *) void_info;
+  InfoLoader *loader = info->loader;
+
+  for (InfoPart part = 0; part < N_INFO_PARTS; part++)
+    {
+      TimeSpan time = {.start_ms = monotonic_ms () };
+      SprayResult res = load_part (info, part);
+      time.end_ms = monotonic_ms ();
+
+      pthread_mutex_lock (&loader->lock);
+      if (res == SP_OK)
+	{
+	  loader->times[part] = time;
+	  loader->n_loaded++;
+	}
+      else
+	{
+	  loader->has_failed = true;
+	}
+      pthread_cond_broadcast (&loader->changed);
+      pthread_mutex_unlock (&loader->lock);
+
+      if (res == SP_ERR)
+	{
+	  break;
+	}
+    }
+
+  return NULL;
+}
+
+void
+free_loader (InfoLoader *loader)
+{
+  if (loader != NULL)
+    {
+      free (loader->filepath);
+      free (loader);
+    }
+}
+
 DebugInfo *
-init_debug_info (const char *filepath)
+load_debug_info (const char *filepath)
 {
   if (filepath == NULL)
     {
       return NULL;
     }
 
-  Dwarf_Error error = NULL;
-  Dwarf_Debug dbg = sd_dwarf_init (filepath, &error);
-  if (dbg == NULL)
+  DebugInfo *info = calloc (1, sizeof (*info));
+  InfoLoader *loader = calloc (1, sizeof (*loader));
+  if (info == NULL || loader == NULL)
     {
-      dwarf_dealloc_error (NULL, error);
+      free (info);
+      free (loader);
       return NULL;
     }
 
-  ElfFile *elf = malloc (sizeof (*elf));
-  if (elf == NULL)
+  loader->filepath = strdup (filepath);
+  info->loader = loader;
+  info->symbols = init_symbol_buf ();
+  info->addr_syms = hashmap_new (sizeof (AddrSymbol), 0, 0, 0,
+				 addr_symbol_hash,
+				 addr_symbol_compare, NULL, NULL);
+  if (loader->filepath == NULL || info->symbols == NULL
+      || info->addr_syms == NULL)
     {
+      free_loader (loader);
+      free_symbol_buf (&info->symbols);
+      if (info->addr_syms != NULL)
+	{
+	  hashmap_free (info->addr_syms);
+	}
+      free (info);
       return NULL;
     }
-  ElfParseResult elf_res = se_parse_elf (filepath, elf);
-  if (elf_res == SP_ERR)
+
+  pthread_mutex_init (&loader->lock, NULL);
+  pthread_cond_init (&loader->changed, NULL);
+
+  /* Signals like `SIGCHLD` or `SIGINT` must reach the main
+   * thread, so the loader thread blocks all of them. */
+  sigset_t signals;
+  sigset_t old_signals;
+  sigfillset (&signals);
+  pthread_sigmask (SIG_BLOCK, &signals, &old_signals);
+  int create_err = pthread_create (&loader->thread, NULL, load_parts, info);
+  pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+  if (create_err != 0)
     {
-      free (elf);
-      dwarf_finish (dbg);
+      pthread_cond_destroy (&loader->changed);
+      pthread_mutex_destroy (&loader->lock);
+      free_loader (loader);
+      free_symbol_buf (&info->symbols);
+      hashmap_free (info->addr_syms);
+      free (info);
       return NULL;
     }
 
-  DebugSymbolBuf *buf = init_symbol_buf ();
-  if (buf == NULL)
+  return info;
+}
+
+SprayResult
+await_debug_info (const DebugInfo *info, InfoPart part)
+{
+  assert (info != NULL);
+
+  InfoLoader *loader = info->loader;
+  pthread_mutex_lock (&loader->lock);
+  while (loader->n_loaded <= (size_t) part && !loader->has_failed)
     {
-      free (elf);
-      dwarf_finish (dbg);
-      return NULL;
+      pthread_cond_wait (&loader->changed, &loader->lock);
     }
+  bool is_loaded = loader->n_loaded > (size_t) part;
+  pthread_mutex_unlock (&loader->lock);
 
-  DebugInfo *info = malloc (sizeof (*info));
-  if (info == NULL)
+  return is_loaded ? SP_OK : SP_ERR;
+}
+
+SprayResult
+info_load_time (const DebugInfo *info, InfoPart part, TimeSpan *time)
+{
+  assert (info != NULL);
+  assert (time != NULL);
+
+  InfoLoader *loader = info->loader;
+  pthread_mutex_lock (&loader->lock);
+  bool is_loaded = loader->n_loaded > (size_t) part;
+  if (is_loaded)
     {
-      free_symbol_buf (&buf);
-      free (elf);
-      dwarf_finish (dbg);
-      return NULL;
+      *time = loader->times[part];
     }
+  pthread_mutex_unlock (&loader->lock);
+
+  return is_loaded ? SP_OK : SP_ERR;
+}
+
+/* Wait for the ELF file. Returns NULL if it failed to load. */
+ElfFile *
+info_elf (const DebugInfo *info)
+{
+  return await_debug_info (info, INFO_ELF) == SP_OK ? info->elf : NULL;
+}
 
-  info->elf = elf;
-  info->dbg = dbg;
-  info->symbols = buf;
+/* Wait for the DWARF debug information. Returns
+ * NULL if it failed to load. */
+Dwarf_Debug
+info_dwarf (const DebugInfo *info)
+{
+  return await_debug_info (info, INFO_DWARF) == SP_OK ? info->dbg : NULL;
+}
+
+DebugInfo *
+init_debug_info (const char *filepath)
+{
+  DebugInfo *info = load_debug_info (filepath);
+  if (info != NULL && await_debug_info (info, INFO_DWARF) == SP_ERR)
+    {
+      free_debug_info (&info);
+    }
 
   return info;
 }
@@ -202,13 +408,32 @@ free_debug_info (DebugInfo **infop)
   if (*infop != NULL)
     {
       DebugInfo *info = *infop;
-      ElfFile elf = *info->elf;
-      dwarf_finish (info->dbg);
+      pthread_join (info->loader->thread, NULL);
+      pthread_cond_destroy (&info->loader->changed);
+      pthread_mutex_destroy (&info->loader->lock);
+      free_loader (info->loader);
+
+      SprayResult res = SP_OK;
+      if (info->dbg != NULL)
+	{
+	  sd_clear_sections (info->dbg);
+	}
+      if (info->elf != NULL)
+	{
+	  res = se_free_elf (*info->elf);
+	  free (info->elf);
+	}
+      if (info->dbg != NULL)
+	{
+	  dwarf_finish (info->dbg);
+	}
+      free_unwind_table (info->unwind);
+      sd_free_line_index (info->lines);
       free_symbol_buf (&info->symbols);
-      free (info->elf);
+      hashmap_free (info->addr_syms);
       free (info);
       *infop = NULL;
-      return se_free_elf (elf);
+      return res;
     }
   else
     {
@@ -216,6 +441,19 @@ free_debug_info (DebugInfo **infop)
     }
 }
 
+const UnwindTable *
+unwind_table (DebugInfo *info)
+{
+  assert (info != NULL);
+
+  if (await_debug_info (info, INFO_UNWIND) == SP_ERR)
+    {
+      return NULL;
+    }
+
+  return info->unwind;
+}
+
 const DebugSymbol *
 sym_by_name (const char *name, DebugInfo *info)
 {
@@ -224,7 +462,8 @@ sym_by_name (const char *name, DebugInfo *info)
       return NULL;
     }
 
-  const Elf64_Sym *elf = se_symbol_from_name (name, info->elf);
+  add_stat (STAT_SYMBOL_LOOKUPS, 1);
+  const Elf64_Sym *elf = se_symbol_from_name (name, info_elf (info));
   if (elf == NULL)
     {
       return NULL;
@@ -243,7 +482,19 @@ sym_by_addr (dbg_addr addr, DebugInfo *info)
       return NULL;
     }
 
-  const Elf64_Sym *elf = se_symbol_from_addr (addr, info->elf);
+  /* Reuse symbols that were looked up before. This way, their
+   * file path and position only have to be retrieved once. */
+  add_stat (STAT_SYMBOL_LOOKUPS, 1);
+  AddrSymbol lookup = {.addr = addr.value };
+  const AddrSymbol *cached = hashmap_get (info->addr_syms, &lookup);
+  if (cached != NULL)
+    {
+      add_stat (STAT_SYMBOL_CACHE_HITS, 1);
+      return &info->symbols->syms[cached->buf_idx];
+    }
+  add_stat (STAT_SYMBOL_CACHE_MISSES, 1);
+
+  const Elf64_Sym *elf = se_symbol_from_addr (addr, info_elf (info));
   if (elf == NULL)
     {
       return NULL;
@@ -253,6 +504,10 @@ sym_by_addr (dbg_addr addr, DebugInfo *info)
   sym->elf = elf;
   sym->has_addr = true;
   sym->addr = addr;
+
+  AddrSymbol entry = {.addr = addr.value,.buf_idx = sym->buf_idx };
+  hashmap_set (info->addr_syms, &entry);
+
   return sym;
 }
 
@@ -264,7 +519,27 @@ sym_name (const DebugSymbol *sym, const DebugInfo *info)
       return NULL;
     }
 
-  return se_symbol_name (sym->elf, info->elf);
+  return se_symbol_name (sym->elf, info_elf (info));
+}
+
+const char *
+object_name (dbg_addr addr, const DebugInfo *info,
+	     dbg_addr *start, dbg_addr *end)
+{
+  if (info == NULL || start == NULL || end == NULL)
+    {
+      return NULL;
+    }
+
+  const Elf64_Sym *object = se_object_from_addr (addr, info_elf (info));
+  if (object == NULL)
+    {
+      return NULL;
+    }
+
+  *start = se_symbol_start_addr (object);
+  *end = se_symbol_end_addr (object);
+  return se_symbol_name (object, info_elf (info));
 }
 
 SprayResult
@@ -277,10 +552,10 @@ function_start_addr (const DebugSymbol *func,
     }
   else
     {
-      if (se_symbol_type (func->elf) == STT_FUNC)
+      Dwarf_Debug dbg = info_dwarf (info);
+      if (dbg != NULL && se_symbol_type (func->elf) == STT_FUNC)
 	{
-	  return sd_effective_start_addr (info->dbg,
-					  sym_start_addr (func),
+	  return sd_effective_start_addr (dbg, sym_start_addr (func),
 					  sym_end_addr (func), addr);
 	}
       else
@@ -371,7 +646,9 @@ sym_filepath (const DebugSymbol *sym, const DebugInfo *info)
     }
   else
     {
-      char *filepath = sd_filepath_from_pc (info->dbg, sym_addr (sym));
+      Dwarf_Debug dbg = info_dwarf (info);
+      char *filepath =
+	dbg != NULL ? sd_filepath_from_pc (dbg, sym_addr (sym)) : NULL;
       if (filepath == NULL)
 	{
 	  return NULL;
@@ -399,8 +676,13 @@ sym_position (const DebugSymbol *sym, const DebugInfo *info)
     }
   else
     {
-      LineEntry line_entry =
-	sd_line_entry_from_pc (info->dbg, sym_addr (sym));
+      Dwarf_Debug dbg = info_dwarf (info);
+      if (dbg == NULL)
+	{
+	  return NULL;
+	}
+
+      LineEntry line_entry = sd_line_entry_from_pc (dbg, sym_addr (sym));
       if (!line_entry.is_ok)
 	{
 	  return NULL;
@@ -433,6 +715,35 @@ addr_position (dbg_addr addr, DebugInfo *info)
     }
 }
 
+SprayResult
+addr_line_range (dbg_addr addr, DebugInfo *info, AddrRange *range)
+{
+  if (info == NULL || range == NULL)
+    {
+      return SP_ERR;
+    }
+
+  /* Decoding all line tables once is cheaper than
+   * decoding the table of a unit on each lookup. */
+  if (info->lines == NULL)
+    {
+      Dwarf_Debug dbg = info_dwarf (info);
+      if (dbg == NULL || (info->lines = sd_init_line_index (dbg)) == NULL)
+	{
+	  return SP_ERR;
+	}
+    }
+
+  return sd_line_range_from_pc (info->lines, addr,
+				&range->start, &range->end);
+}
+
+bool
+addr_in_range (dbg_addr addr, AddrRange range)
+{
+  return range.start.value <= addr.value && addr.value < range.end.value;
+}
+
 const char *
 addr_name (dbg_addr addr, DebugInfo *info)
 {
@@ -465,13 +776,15 @@ SprayResult
 addr_at (const char *filepath,
 	 uint32_t lineno, const DebugInfo *info, dbg_addr *addr)
 {
-  if (filepath == NULL || info == NULL || addr == NULL)
+  Dwarf_Debug dbg = NULL;
+  if (filepath == NULL || info == NULL || addr == NULL
+      || (dbg = info_dwarf (info)) == NULL)
     {
       return SP_ERR;
     }
   else
     {
-      LineEntry line = sd_line_entry_at (info->dbg, filepath, lineno);
+      LineEntry line = sd_line_entry_at (dbg, filepath, lineno);
       if (line.is_ok)
 	{
 	  *addr = line.addr;
@@ -493,10 +806,58 @@ is_dyn_exec (const DebugInfo *info)
     }
   else
     {
-      return info->elf->type == ELF_TYPE_DYN;
+      return info_elf (info)->type == ELF_TYPE_DYN;
     }
 }
 
+dbg_addr
+entry_point (const DebugInfo *info)
+{
+  assert (info != NULL);
+  return se_entry_point (info_elf (info));
+}
+
+typedef struct
+{
+  StatementCallback callback;
+  void *data;
+} StatementData;
+
+SprayResult
+callback__statement_line (LineEntry *line, void *const void_data)
+{
+  assert (line != NULL);
+  assert (void_data != NULL);
+
+  StatementData *data = (StatementData *) void_data;
+  Position pos = {
+    .line = line->ln,
+    .column = line->cl,
+    .is_exact = true,
+  };
+
+  return data->callback (line->filepath, &pos, line->addr, data->data);
+}
+
+SprayResult
+for_each_statement (const DebugInfo *info,
+		    StatementCallback callback, void *data)
+{
+  Dwarf_Debug dbg = NULL;
+  if (info == NULL || callback == NULL || (dbg = info_dwarf (info)) == NULL)
+    {
+      return SP_ERR;
+    }
+
+  StatementData statement_data = {
+    .callback = callback,
+    .data = data,
+  };
+
+  return sd_for_each_statement (dbg, callback__statement_line,
+				&statement_data);
+}
+
 /* `break_scope_around_sym` places a breakpoint on each line
  *  in the function belonging to the symbol `func`. The only
  * line that doesn't get a breakpoint is the line that `func`
@@ -561,10 +922,11 @@ set_step_over_breakpoints (const DebugSymbol *func,
       return SP_ERR;
     }
 
+  Dwarf_Debug dbg = info_dwarf (info);
   const Position *pos = sym_position (func, info);
   const char *func_name = sym_name (func, info);
   const char *filepath = sym_filepath (func, info);
-  if (pos == NULL || func_name == NULL || filepath == NULL)
+  if (dbg == NULL || pos == NULL || func_name == NULL || filepath == NULL)
     {
       return SP_ERR;
     }
@@ -583,7 +945,7 @@ set_step_over_breakpoints (const DebugSymbol *func,
       return SP_ERR;
     }
 
-  sd_for_each_line (info->dbg, func_name, filepath,
+  sd_for_each_line (dbg, func_name, filepath,
 		    callback__set_dwarf_line_breakpoint, &data);
 
   *n_to_del = data.to_del_idx;
@@ -900,16 +1262,30 @@ print_var_deref_value (const RuntimeVariable *var, uint64_t deref,
 RuntimeVariable *
 init_var (dbg_addr pc, real_addr load_address,
 	  const char *var_name, pid_t pid, const DebugInfo *info)
+{
+  return init_frame_var (pc, load_address, var_name, pid, NULL, info);
+}
+
+RuntimeVariable *
+init_frame_var (dbg_addr pc, real_addr load_address,
+		const char *var_name, pid_t pid,
+		const FrameRegs *regs, const DebugInfo *info)
 {
   if (var_name == NULL || info == NULL)
     {
       return NULL;
     }
 
+  Dwarf_Debug dbg = info_dwarf (info);
+  if (dbg == NULL)
+    {
+      return NULL;
+    }
+
   SdVarattr var_attr = { 0 };
   char *decl_file = NULL;
   unsigned decl_line = 0;
-  SprayResult res = sd_runtime_variable (info->dbg,
+  SprayResult res = sd_runtime_variable (dbg,
 					 pc,
 					 var_name,
 					 &var_attr,
@@ -922,7 +1298,7 @@ init_var (dbg_addr pc, real_addr load_address,
 
   /* Evaluate the location description and store it in `loc`. */
   SdLoclist loclist = { 0 };
-  res = sd_init_loclist (info->dbg, var_attr.loc, &loclist);
+  res = sd_init_loclist (dbg, var_attr.loc, &loclist);
   if (res == SP_ERR)
     {
       return NULL;
@@ -931,12 +1307,13 @@ init_var (dbg_addr pc, real_addr load_address,
   SdLocEvalCtx ctx = {
     .pid = pid,
     .pc = pc,
-    .elf = info->elf,
+    .elf = info_elf (info),
     .load_address = load_address,
+    .regs = regs,
   };
 
   SdLocation loc = { 0 };
-  res = sd_eval_loclist (info->dbg, ctx, loclist, &loc);
+  res = sd_eval_loclist (dbg, ctx, loclist, &loc);
   del_loclist (&loclist);
   if (res == SP_ERR)
     {
@@ -956,6 +1333,22 @@ init_var (dbg_addr pc, real_addr load_address,
   return var;
 }
 
+RuntimeVariable *
+init_global_var (real_addr load_address, const char *var_name,
+		 pid_t pid, const DebugInfo *info)
+{
+  /* No function contains the PC 0. Locations relative to
+   * the frame base or in registers fail to evaluate there. */
+  RuntimeVariable *var = init_var ((dbg_addr) {0}, load_address,
+				   var_name, pid, info);
+  if (var != NULL && !is_addr_loc (var))
+    {
+      del_var (var);
+      return NULL;
+    }
+  return var;
+}
+
 void
 del_var (RuntimeVariable *loc)
 {
@@ -966,3 +1359,45 @@ del_var (RuntimeVariable *loc)
       free (loc);
     }
 }
+
+size_t
+var_size (const RuntimeVariable *var)
+{
+  if (var != NULL)
+    {
+      for (size_t i = 0; i < var->type.n_nodes; i++)
+	{
+	  const SdTypenode *node = &var->type.nodes[i];
+	  if (node->tag == NODE_BASE_TYPE)
+	    {
+	      return node->base_type.size;
+	    }
+	  else if (node->tag == NODE_MODIFIER
+		   && node->modifier == TYPE_MOD_POINTER)
+	    {
+	      return sizeof (uint64_t);
+	    }
+	}
+    }
+
+  return sizeof (uint64_t);
+}
+
+char **
+scope_var_names (dbg_addr pc, const DebugInfo *info, size_t *n_names)
+{
+  if (info == NULL || n_names == NULL)
+    {
+      return NULL;
+    }
+
+  Dwarf_Debug dbg = info_dwarf (info);
+  char **names = NULL;
+  if (dbg == NULL
+      || sd_scope_variable_names (dbg, pc, &names, n_names) == SP_ERR)
+    {
+      *n_names = 0;
+      return NULL;
+    }
+  return names;
+}
@@ -7,20 +7,52 @@
 
 #include "breakpoints.h"
 #include "registers.h"
+#include "unwind.h"
 #include <stdbool.h>
 
 typedef struct DebugInfo DebugInfo;
 
-/* Initialize debugging information. Returns NULL on error. */
+/* Parts of the debug information. They are loaded in this order. */
+typedef enum
+{
+  INFO_ELF,			/* Sections and symbols of the executable. */
+  INFO_DWARF,			/* DWARF debug information. */
+  INFO_UNWIND,			/* Table to unwind the call stack. */
+  N_INFO_PARTS,
+} InfoPart;
+
+/* Start loading debugging information on a background thread.
+ * Functions in this file wait for the parts they need. Use
+ * `await_debug_info` to find out if a part failed to load:
+ * functions that need it must not be called then. Returns
+ * NULL if the thread couldn't be started. */
+DebugInfo *load_debug_info (const char *filepath);
+
+/* Wait until `part` is loaded. Returns `SP_ERR` if it failed to load. */
+SprayResult await_debug_info (const DebugInfo * info, InfoPart part);
+
+/* Get when `part` was loaded without waiting for it. Returns
+ * `SP_ERR` if it isn't loaded yet or failed to load. */
+SprayResult info_load_time (const DebugInfo * info, InfoPart part,
+			    TimeSpan *time);
+
+/* Initialize debugging information and wait until everything but the
+ * unwind table is loaded. Returns NULL on error. */
 DebugInfo *init_debug_info (const char *filepath);
 
 /* Free the given `DebugInfo` instance. Any pointer
  * to an object returned from a function in this file
  * becomes invalid if the `DebugInfo` instance given
- * to that function is deleted.
+ * to that function is deleted. Waits for loading to finish.
  * Returns `SP_ERR` if some resources couldn't be deleted. */
 SprayResult free_debug_info (DebugInfo ** infop);
 
+/* Get the table used to unwind the call stack. It's built from the
+ * call frame information in the executable after the DWARF debug
+ * information was loaded. Returns NULL if the executable doesn't
+ * contain any. */
+const UnwindTable *unwind_table (DebugInfo * info);
+
 /* A symbol in the executable that's being debugged. */
 typedef struct DebugSymbol DebugSymbol;
 
@@ -34,6 +66,12 @@ const DebugSymbol *sym_by_addr (dbg_addr addr, DebugInfo * info);
 /* Get the name of the given symbol. Returns NULL if there is no name. */
 const char *sym_name (const DebugSymbol * sym, const DebugInfo * info);
 
+/* Get the name of the global variable that the data address `addr`
+ * belongs to. The variable's address range is stored in `start` and
+ * `end`. Returns NULL if there is no such variable. */
+const char *object_name (dbg_addr addr, const DebugInfo * info,
+			 dbg_addr * start, dbg_addr * end);
+
 /* Get the address at which the code of the first line
  * of the given function starts. Returns `SP_ERR` and
  * leaves `addr` untouched if the symbol doesn't refer
@@ -76,6 +114,22 @@ const Position *sym_position (const DebugSymbol * sym,
  * Returns NULL on error. */
 const Position *addr_position (dbg_addr addr, DebugInfo * info);
 
+/* A range of addresses. `start` is inclusive and `end` is exclusive. */
+typedef struct AddrRange
+{
+  dbg_addr start;
+  dbg_addr end;
+} AddrRange;
+
+/* Get the range of addresses around `addr` whose code belongs
+ * to the same line in the source as the code at `addr`.
+ * Returns `SP_ERR` if there is no line information for `addr`. */
+SprayResult addr_line_range (dbg_addr addr, DebugInfo * info,
+			     AddrRange * range);
+
+/* Check if `addr` is inside of `range`. */
+bool addr_in_range (dbg_addr addr, AddrRange range);
+
 /* Returns the function name that belongs to the given address.
  * Returns NULL on error. */
 const char *addr_name (dbg_addr addr, DebugInfo * info);
@@ -84,6 +138,19 @@ const char *addr_name (dbg_addr addr, DebugInfo * info);
  * Returns NULL on error. */
 const char *addr_filepath (dbg_addr addr, DebugInfo * info);
 
+/* Callback for `for_each_statement`. `filepath` is only
+ * valid for the duration of the call. */
+typedef SprayResult (*StatementCallback) (const char *filepath,
+					  const Position * pos,
+					  dbg_addr addr, void *data);
+
+/* Call `callback` for each address in the executable where a
+ * new statement begins according to the line table. Returns
+ * `SP_ERR` if `callback` failed, there is no DWARF debug
+ * information, or the line tables couldn't be read. */
+SprayResult for_each_statement (const DebugInfo * info,
+				StatementCallback callback, void *data);
+
 /* The following function don't fit the regular scheme of
  * this interface. They are currently required by might
  * be incorporated in a generic interface later. */
@@ -98,6 +165,9 @@ SprayResult addr_at (const char *filepath,
 /* Is this a dynamic executable which is relocated? */
 bool is_dyn_exec (const DebugInfo * info);
 
+/* Get the entry point of the executable. */
+dbg_addr entry_point (const DebugInfo * info);
+
 /* Set breakpoints required to step over the line referred to by `func`.
  * On error `SP_ERR` is returned and nothing has to be deleted. */
 SprayResult set_step_over_breakpoints (const DebugSymbol * func,
@@ -182,7 +252,36 @@ RuntimeVariable *init_var (dbg_addr pc,
 			   const char *var_name,
 			   pid_t pid, const DebugInfo * info);
 
+/* Same as `init_var`, but the variable belongs to the call frame
+ * whose registers are `regs`, and `pc` is the code address in that
+ * frame. Locations relative to the frame base are evaluated with
+ * `regs`, so the variables of callers can be found as well. */
+RuntimeVariable *init_frame_var (dbg_addr pc,
+				 real_addr load_address,
+				 const char *var_name,
+				 pid_t pid,
+				 const FrameRegs * regs,
+				 const DebugInfo * info);
+
+/* Get the global or static variable with the given name. Only
+ * variables at a fixed address (`DW_OP_addr`) are found, since
+ * they can be read without knowing where the tracee is stopped.
+ * Returns NULL if there is none. */
+RuntimeVariable *init_global_var (real_addr load_address,
+				  const char *var_name,
+				  pid_t pid, const DebugInfo * info);
+
 /* Delete a `RuntimeVariable` pointer as returned by `init_var`. */
 void del_var (RuntimeVariable *var);
 
+/* Number of bytes used to store the value of the variable. */
+size_t var_size (const RuntimeVariable *var);
+
+/* Get the names of the variables in the scope of the function
+ * around `pc`. The caller must free the names and the array,
+ * which has `n_names` elements. Returns NULL and sets `n_names`
+ * to 0 if there are none or on error. */
+char **scope_var_names (dbg_addr pc, const DebugInfo * info,
+			size_t *n_names);
+
 #endif /* _SPRAY_INFO_H_ */
@@ -0,0 +1,531 @@
+#include "json.h"
+
+#include <assert.h>
+#include <math.h>		/* `isfinite` */
+#include <string.h>
+
+void
+print_json_string (FILE *stream, const char *str)
+{
+  assert (stream != NULL);
+  assert (str != NULL);
+
+  fputc ('"', stream);
+  for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++)
+    {
+      switch (*c)
+	{
+	case '"':
+	  fputs ("\\\"", stream);
+	  break;
+	case '\\':
+	  fputs ("\\\\", stream);
+	  break;
+	case '\n':
+	  fputs ("\\n", stream);
+	  break;
+	case '\r':
+	  fputs ("\\r", stream);
+	  break;
+	case '\t':
+	  fputs ("\\t", stream);
+	  break;
+	default:
+	  if (*c < 0x20)
+	    {
+	      fprintf (stream, "\\u%04x", *c);
+	    }
+	  else
+	    {
+	      fputc (*c, stream);
+	    }
+	}
+    }
+  fputc ('"', stream);
+}
+
+
+/***************/
+/* JSON Parser */
+/***************/
+
+enum
+{
+  /* Deeper documents are rejected so that
+   * parsing can't exhaust the C stack. */
+  JSON_MAX_DEPTH = 128,
+};
+
+typedef struct
+{
+  const char *pos;
+  size_t depth;
+} JsonParser;
+
+SprayResult parse_json_value (JsonParser * parser, JsonValue * value);
+void free_json_members (JsonValue * value);
+
+void
+skip_json_space (JsonParser *parser)
+{
+  parser->pos += strspn (parser->pos, " \t\n\r");
+}
+
+/* Consume `literal` if the input continues with it. */
+bool
+accept_json (JsonParser *parser, const char *literal)
+{
+  size_t len = strlen (literal);
+  if (strncmp (parser->pos, literal, len) == 0)
+    {
+      parser->pos += len;
+      return true;
+    }
+  return false;
+}
+
+/* Parse the four hex digits of a `\u` escape. */
+SprayResult
+parse_json_hex4 (JsonParser *parser, uint32_t *code)
+{
+  *code = 0;
+  for (size_t i = 0; i < 4; i++)
+    {
+      char c = parser->pos[i];
+      uint32_t digit = 0;
+      if (c >= '0' && c <= '9')
+	digit = c - '0';
+      else if (c >= 'a' && c <= 'f')
+	digit = c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+	digit = c - 'A' + 10;
+      else
+	return SP_ERR;
+      *code = *code * 16 + digit;
+    }
+  parser->pos += 4;
+  return SP_OK;
+}
+
+/* Write `code` to `stream` as UTF-8. */
+void
+put_utf8 (FILE *stream, uint32_t code)
+{
+  if (code < 0x80)
+    {
+      fputc (code, stream);
+    }
+  else if (code < 0x800)
+    {
+      fputc (0xc0 | (code >> 6), stream);
+      fputc (0x80 | (code & 0x3f), stream);
+    }
+  else if (code < 0x10000)
+    {
+      fputc (0xe0 | (code >> 12), stream);
+      fputc (0x80 | ((code >> 6) & 0x3f), stream);
+      fputc (0x80 | (code & 0x3f), stream);
+    }
+  else
+    {
+      fputc (0xf0 | (code >> 18), stream);
+      fputc (0x80 | ((code >> 12) & 0x3f), stream);
+      fputc (0x80 | ((code >> 6) & 0x3f), stream);
+      fputc (0x80 | (code & 0x3f), stream);
+    }
+}
+
+/* Parse a `\u` escape, which might be the first half
+ * of a UTF-16 surrogate pair, and write it as UTF-8. */
+SprayResult
+parse_json_unicode (JsonParser *parser, FILE *stream)
+{
+  uint32_t code = 0;
+  if (parse_json_hex4 (parser, &code) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  if (code >= 0xd800 && code < 0xdc00)
+    {
+      uint32_t low = 0;
+      if (!accept_json (parser, "\\u")
+	  || parse_json_hex4 (parser, &low) == SP_ERR
+	  || low < 0xdc00 || low >= 0xe000)
+	{
+	  return SP_ERR;
+	}
+      code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+    }
+  else if (code >= 0xdc00 && code < 0xe000)
+    {
+      return SP_ERR;
+    }
+
+  put_utf8 (stream, code);
+  return SP_OK;
+}
+
+/* Parse a quoted string. The caller must free `*str`. */
+SprayResult
+parse_json_string (JsonParser *parser, char **str)
+{
+  if (!accept_json (parser, "\""))
+    {
+      return SP_ERR;
+    }
+
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream (&buf, &size);
+  if (stream == NULL)
+    {
+      return SP_ERR;
+    }
+
+  SprayResult res = SP_OK;
+  while (res == SP_OK && *parser->pos != '"')
+    {
+      unsigned char c = *parser->pos;
+      if (c < 0x20)
+	{
+	  /* Includes the end of the input. */
+	  res = SP_ERR;
+	  break;
+	}
+
+      parser->pos++;
+      if (c != '\\')
+	{
+	  fputc (c, stream);
+	}
+      else
+	{
+	  char escape = *parser->pos;
+	  parser->pos += escape != '\0';
+	  switch (escape)
+	    {
+	    case '"':
+	    case '\\':
+	    case '/':
+	      fputc (escape, stream);
+	      break;
+	    case 'b':
+	      fputc ('\b', stream);
+	      break;
+	    case 'f':
+	      fputc ('\f', stream);
+	      break;
+	    case 'n':
+	      fputc ('\n', stream);
+	      break;
+	    case 'r':
+	      fputc ('\r', stream);
+	      break;
+	    case 't':
+	      fputc ('\t', stream);
+	      break;
+	    case 'u':
+	      res = parse_json_unicode (parser, stream);
+	      break;
+	    default:
+	      res = SP_ERR;
+	    }
+	}
+    }
+
+  fclose (stream);
+  if (res == SP_ERR)
+    {
+      free (buf);
+      return SP_ERR;
+    }
+
+  parser->pos++;		/* Closing quote. */
+  *str = buf;
+  return SP_OK;
+}
+
+SprayResult
+parse_json_number (JsonParser *parser, double *number)
+{
+  /* `strtod` accepts more than JSON does, e.g. hex numbers and `inf`. */
+  const char *start = parser->pos;
+  const char *digits = start + (*start == '-');
+  if (*digits < '0' || *digits > '9')
+    {
+      return SP_ERR;
+    }
+
+  char *end = NULL;
+  *number = strtod (start, &end);
+  if (end == start || !isfinite (*number))
+    {
+      return SP_ERR;
+    }
+  parser->pos = end;
+  return SP_OK;
+}
+
+/* Parse the items of an array after its opening bracket. */
+SprayResult
+parse_json_array (JsonParser *parser, JsonValue *value)
+{
+  *value = (JsonValue) {.kind = JSON_ARRAY };
+
+  skip_json_space (parser);
+  if (accept_json (parser, "]"))
+    {
+      return SP_OK;
+    }
+
+  do
+    {
+      value->array.items = realloc (value->array.items,
+				    (value->array.n_items + 1)
+				    * sizeof (*value->array.items));
+      assert (value->array.items != NULL);
+      JsonValue *item = &value->array.items[value->array.n_items];
+      if (parse_json_value (parser, item) == SP_ERR)
+	{
+	  free_json_members (item);
+	  return SP_ERR;
+	}
+      value->array.n_items++;
+      skip_json_space (parser);
+    }
+  while (accept_json (parser, ","));
+
+  return accept_json (parser, "]") ? SP_OK : SP_ERR;
+}
+
+/* Parse the members of an object after its opening brace. */
+SprayResult
+parse_json_object (JsonParser *parser, JsonValue *value)
+{
+  *value = (JsonValue) {.kind = JSON_OBJECT };
+
+  skip_json_space (parser);
+  if (accept_json (parser, "}"))
+    {
+      return SP_OK;
+    }
+
+  do
+    {
+      size_t n = value->object.n_members;
+      value->object.keys = realloc (value->object.keys,
+				    (n + 1) * sizeof (*value->object.keys));
+      value->object.values = realloc (value->object.values,
+				      (n + 1)
+				      * sizeof (*value->object.values));
+      assert (value->object.keys != NULL);
+      assert (value->object.values != NULL);
+
+      skip_json_space (parser);
+      if (parse_json_string (parser, &value->object.keys[n]) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+
+      skip_json_space (parser);
+      if (!accept_json (parser, ":"))
+	{
+	  free (value->object.keys[n]);
+	  return SP_ERR;
+	}
+      if (parse_json_value (parser, &value->object.values[n]) == SP_ERR)
+	{
+	  free (value->object.keys[n]);
+	  free_json_members (&value->object.values[n]);
+	  return SP_ERR;
+	}
+      value->object.n_members++;
+      skip_json_space (parser);
+    }
+  while (accept_json (parser, ","));
+
+  return accept_json (parser, "}") ? SP_OK : SP_ERR;
+}
+
+/* Parse any value. On error, `value` is still valid
+ * and has to be freed with `free_json_members`. */
+SprayResult
+parse_json_value (JsonParser *parser, JsonValue *value)
+{
+  *value = (JsonValue) {.kind = JSON_NULL };
+
+  if (parser->depth >= JSON_MAX_DEPTH)
+    {
+      return SP_ERR;
+    }
+
+  skip_json_space (parser);
+  SprayResult res = SP_ERR;
+  parser->depth++;
+  switch (*parser->pos)
+    {
+    case '{':
+      parser->pos++;
+      res = parse_json_object (parser, value);
+      break;
+    case '[':
+      parser->pos++;
+      res = parse_json_array (parser, value);
+      break;
+    case '"':
+      res = parse_json_string (parser, &value->string);
+      if (res == SP_OK)
+	{
+	  value->kind = JSON_STRING;
+	}
+      break;
+    default:
+      if (accept_json (parser, "null"))
+	{
+	  res = SP_OK;
+	}
+      else if (accept_json (parser, "true"))
+	{
+	  *value = (JsonValue) {.kind = JSON_BOOL,.boolean = true };
+	  res = SP_OK;
+	}
+      else if (accept_json (parser, "false"))
+	{
+	  *value = (JsonValue) {.kind = JSON_BOOL,.boolean = false };
+	  res = SP_OK;
+	}
+      else
+	{
+	  value->kind = JSON_NUMBER;
+	  res = parse_json_number (parser, &value->number);
+	}
+    }
+  parser->depth--;
+
+  return res;
+}
+
+/* Free everything that `value` owns, but not `value` itself. */
+void
+free_json_members (JsonValue *value)
+{
+  switch (value->kind)
+    {
+    case JSON_STRING:
+      free (value->string);
+      break;
+    case JSON_ARRAY:
+      for (size_t i = 0; i < value->array.n_items; i++)
+	{
+	  free_json_members (&value->array.items[i]);
+	}
+      free (value->array.items);
+      break;
+    case JSON_OBJECT:
+      for (size_t i = 0; i < value->object.n_members; i++)
+	{
+	  free (value->object.keys[i]);
+	  free_json_members (&value->object.values[i]);
+	}
+      free (value->object.keys);
+      free (value->object.values);
+      break;
+    default:
+      break;
+    }
+}
+
+JsonValue *
+parse_json (const char *text)
+{
+  assert (text != NULL);
+
+  JsonValue *value = malloc (sizeof (*value));
+  assert (value != NULL);
+
+  JsonParser parser = {.pos = text };
+  SprayResult res = parse_json_value (&parser, value);
+  if (res == SP_OK)
+    {
+      /* Nothing may follow the value. */
+      skip_json_space (&parser);
+      res = *parser.pos == '\0' ? SP_OK : SP_ERR;
+    }
+  if (res == SP_ERR)
+    {
+      free_json (value);
+      return NULL;
+    }
+
+  return value;
+}
+
+void
+free_json (JsonValue *value)
+{
+  if (value != NULL)
+    {
+      free_json_members (value);
+      free (value);
+    }
+}
+
+const JsonValue *
+json_member (const JsonValue *object, const char *key)
+{
+  assert (key != NULL);
+
+  if (object == NULL || object->kind != JSON_OBJECT)
+    {
+      return NULL;
+    }
+
+  for (size_t i = 0; i < object->object.n_members; i++)
+    {
+      if (strcmp (object->object.keys[i], key) == 0)
+	{
+	  return &object->object.values[i];
+	}
+    }
+  return NULL;
+}
+
+const char *
+json_string_member (const JsonValue *object, const char *key)
+{
+  const JsonValue *member = json_member (object, key);
+  if (member == NULL || member->kind != JSON_STRING)
+    {
+      return NULL;
+    }
+  return member->string;
+}
+
+SprayResult
+json_int_member (const JsonValue *object, const char *key, int64_t *store)
+{
+  assert (store != NULL);
+
+  const JsonValue *member = json_member (object, key);
+  /* Doubles beyond 2^63 can't be converted to `int64_t`. */
+  if (member == NULL || member->kind != JSON_NUMBER
+      || member->number < -0x1p63 || member->number >= 0x1p63
+      || member->number != (double) (int64_t) member->number)
+    {
+      return SP_ERR;
+    }
+  *store = (int64_t) member->number;
+  return SP_OK;
+}
+
+bool
+json_bool_member (const JsonValue *object, const char *key, bool fallback)
+{
+  const JsonValue *member = json_member (object, key);
+  if (member == NULL || member->kind != JSON_BOOL)
+    {
+      return fallback;
+    }
+  return member->boolean;
+}
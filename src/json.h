@@ -0,0 +1,79 @@
+/* Helpers to read and write JSON for programs that talk to Spray. */
+
+#pragma once
+
+#ifndef _SPRAY_JSON_H_
+#define _SPRAY_JSON_H_
+
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Write `str` to `stream` as a quoted JSON string. Control
+ * characters are escaped. Bytes that aren't ASCII are copied,
+ * so `str` should be UTF-8. */
+void print_json_string (FILE * stream, const char *str);
+
+typedef enum
+{
+  JSON_NULL,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT,
+} JsonKind;
+
+/* A parsed JSON value. Strings are decoded to UTF-8. */
+typedef struct JsonValue JsonValue;
+struct JsonValue
+{
+  JsonKind kind;
+  union
+  {
+    bool boolean;
+    double number;
+    char *string;
+    struct
+    {
+      JsonValue *items;
+      size_t n_items;
+    } array;
+    struct
+    {
+      char **keys;
+      JsonValue *values;
+      size_t n_members;
+    } object;
+  };
+};
+
+/* Parse the JSON document in `text`. Returns NULL if it isn't valid
+ * JSON. The value must be deleted with `free_json`. */
+JsonValue *parse_json (const char *text);
+
+void free_json (JsonValue * value);
+
+/* Get the member `key` of `object`. Returns NULL if `object`
+ * is NULL or not an object, or if there is no such member. */
+const JsonValue *json_member (const JsonValue * object, const char *key);
+
+/* Get the string in the member `key` of `object`. Returns NULL
+ * if there is no such member or if it isn't a string. */
+const char *json_string_member (const JsonValue * object, const char *key);
+
+/* Store the integer in the member `key` of `object` in `store`.
+ * Returns `SP_ERR` and leaves `store` untouched if there is no
+ * such member or if it isn't an integer. */
+SprayResult json_int_member (const JsonValue * object, const char *key,
+			     int64_t *store);
+
+/* Get the boolean in the member `key` of `object`. Returns
+ * `fallback` if there is no such member or if it isn't a boolean. */
+bool json_bool_member (const JsonValue * object, const char *key,
+		       bool fallback);
+
+#endif /* _SPRAY_JSON_H_ */
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <limits.h>		/* `PATH_MAX` */
 #include <stdarg.h>
+#include <time.h>
 
 unsigned
 n_digits (double num)
@@ -37,6 +38,14 @@ str_eq (const char *restrict a, const char *restrict b)
   return strcmp (a, b) == 0;
 }
 
+double
+monotonic_ms (void)
+{
+  struct timespec now = { 0 };
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec * 1000.0 + (double) now.tv_nsec / 1000000.0;
+}
+
 dbg_addr
 real_to_dbg (real_addr offset, real_addr real)
 {
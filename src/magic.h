@@ -25,6 +25,10 @@ enum magic_numbers
    * number has 7 digits. This plus characters for the rest
    * of the path plus a NULL terminator make up this number. */
   PROC_MAPS_FILEPATH_LEN = 19,
+  /* Same as `PROC_MAPS_FILEPATH_LEN` for other files in
+   * `/proc/<pid>` with names of up to four characters,
+   * e.g. `/proc/<pid>/auxv` or `/proc/<pid>/task`. */
+  PROC_PID_FILEPATH_LEN = 19,
   /* Size of the buffer to print all the tracee's registers.
    * All values are zero-padded so the size is always the same. */
   REGISTER_PRINT_BUF_SIZE = 716,
@@ -32,11 +36,14 @@ enum magic_numbers
    * substituted is no longer that 8 characters. This doesn't
    * include the string's NULL-byte. */
   REGISTER_PRINT_LEN = 26,
-  /* Maximum number of instruction-level steps performed by
-   * `single_step_line` until giving up trying to find another
-   * line. Can be fairly large since the program will likely
-   * end after this limit was reached. */
-  SINGLE_STEP_SEARCH_LIMIT = 128,
+  /* Default maximum number of bytes copied from the tracee's stack
+   * at each stop. It's the default stack size limit on Linux. */
+  DEFAULT_STACK_CAP = 8 * 1024 * 1024,
+  /* Size of the buffer for a line that's entered in the REPL. */
+  REPL_LINE_BUF_SIZE = 4096,
+  /* Size of the buffer for the name of a signal without the
+   * `SIG` prefix, e.g. `RTMIN+15`, including the NULL-byte. */
+  SIGNAL_NAME_BUF_SIZE = 16,
 };
 
 typedef enum
@@ -54,6 +61,17 @@ void indent_by (unsigned n_spaces);
 /* Helper to test if two strings are equal (`strcmp(...) == 0`) */
 bool str_eq (const char *restrict a, const char *restrict b);
 
+/* Milliseconds on the `CLOCK_MONOTONIC` clock. Only the
+ * difference between two values has a meaning. */
+double monotonic_ms (void);
+
+/* Time between `start_ms` and `end_ms` of `monotonic_ms`. */
+typedef struct
+{
+  double start_ms;
+  double end_ms;
+} TimeSpan;
+
 typedef struct
 {
   uint64_t value;
@@ -0,0 +1,109 @@
+#include "mappings.h"
+
+#include <elf.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+void
+free_mappings (Mappings *mappings)
+{
+  for (size_t i = 0; i < mappings->n_mappings; i++)
+    {
+      free (mappings->mappings[i].filepath);
+    }
+  free (mappings->mappings);
+}
+
+/* Get the kind of the mapping with the given path. */
+MappingKind
+mapping_kind (const char *path, uint64_t inode)
+{
+  if (inode != 0 && path[0] == '/')
+    {
+      return MAPPING_FILE;
+    }
+  else if (str_eq (path, "[heap]"))
+    {
+      return MAPPING_HEAP;
+    }
+  else if (str_eq (path, "[stack]"))
+    {
+      return MAPPING_STACK;
+    }
+  else if (path[0] == '[')
+    {
+      return MAPPING_SPECIAL;
+    }
+  else
+    {
+      return MAPPING_ANONYMOUS;
+    }
+}
+
+SprayResult
+read_mappings (pid_t pid, Mappings *mappings)
+{
+  char maps_filepath[PROC_MAPS_FILEPATH_LEN] = { 0 };
+  snprintf (maps_filepath, PROC_MAPS_FILEPATH_LEN, "/proc/%d/maps", pid);
+
+  FILE *maps = fopen (maps_filepath, "r");
+  if (maps == NULL)
+    {
+      return SP_ERR;
+    }
+
+  *mappings = (Mappings) { 0 };
+  SprayResult res = SP_OK;
+  char *line = NULL;
+  size_t n = 0;
+  while (getline (&line, &n, maps) != -1)
+    {
+      Mapping mapping = { 0 };
+      char perms[5] = { 0 };
+      uint64_t inode = 0;
+      int path_idx = 0;
+      if (sscanf (line, "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %*s %"
+		  SCNu64 " %n", &mapping.start, &mapping.end, perms,
+		  &mapping.file_offset, &inode, &path_idx) != 5)
+	{
+	  continue;
+	}
+
+      char *path = line + path_idx;
+      path[strcspn (path, "\n")] = '\0';
+
+      mapping.flags = (perms[0] == 'r' ? PF_R : 0)
+	| (perms[1] == 'w' ? PF_W : 0) | (perms[2] == 'x' ? PF_X : 0);
+      mapping.kind = mapping_kind (path, inode);
+      if (mapping.kind == MAPPING_FILE)
+	{
+	  mapping.filepath = strdup (path);
+	}
+
+      /* `[vvar]` can't be read and `[vsyscall]` isn't part of
+       * the address space seen by `process_vm_readv`. */
+      mapping.is_readable = (mapping.flags & PF_R) != 0
+	&& strncmp (path, "[vvar", 5) != 0 && !str_eq (path, "[vsyscall]");
+
+      Mapping *grown = realloc (mappings->mappings,
+				(mappings->n_mappings + 1) * sizeof (*grown));
+      if (grown == NULL)
+	{
+	  free (mapping.filepath);
+	  res = SP_ERR;
+	  break;
+	}
+      mappings->mappings = grown;
+      mappings->mappings[mappings->n_mappings++] = mapping;
+    }
+
+  free (line);
+  fclose (maps);
+
+  if (res == SP_ERR)
+    {
+      free_mappings (mappings);
+    }
+  return res;
+}
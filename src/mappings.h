@@ -0,0 +1,49 @@
+/* Read the memory mappings of a process from `/proc/<pid>/maps`. */
+
+#pragma once
+
+#ifndef _SPRAY_MAPPINGS_H_
+#define _SPRAY_MAPPINGS_H_
+
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* What's mapped into memory. */
+typedef enum
+{
+  MAPPING_FILE,
+  MAPPING_ANONYMOUS,
+  MAPPING_HEAP,			/* `[heap]`, grown with `brk`. */
+  MAPPING_STACK,		/* `[stack]` of the initial thread. */
+  MAPPING_SPECIAL,		/* E.g. `[vdso]` or `[vvar]`. */
+} MappingKind;
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  uint64_t file_offset;
+  uint32_t flags;		/* `PF_R`, `PF_W` and `PF_X`. */
+  MappingKind kind;
+  char *filepath;		/* NULL unless backed by a file. */
+  bool is_readable;		/* Can the content be read with
+				 * `process_vm_readv`? */
+} Mapping;
+
+typedef struct
+{
+  Mapping *mappings;
+  size_t n_mappings;
+} Mappings;
+
+/* Read all mappings of the process `pid`. They're ordered by
+ * their addresses. Returns `SP_ERR` with `errno` set on error. */
+SprayResult read_mappings (pid_t pid, Mappings * mappings);
+
+void free_mappings (Mappings * mappings);
+
+#endif /* _SPRAY_MAPPINGS_H_ */
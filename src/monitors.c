@@ -0,0 +1,422 @@
+/* Required to use `process_vm_readv` */
+#define _GNU_SOURCE
+
+#include "monitors.h"
+
+#include "stats.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+struct Monitors
+{
+  Monitor *monitors;
+  size_t n_monitors;
+  size_t next_number;
+  FILE *log;			/* CSV log, or NULL. */
+  EventLoop *loop;		/* Loop that watches the timers, or NULL. */
+  EventCallback callback;
+  void *data;
+  bool is_resumed;		/* Are the timers running? */
+};
+
+Monitors *
+init_monitors (void)
+{
+  Monitors *monitors = calloc (1, sizeof (*monitors));
+  if (monitors != NULL)
+    {
+      monitors->next_number = 1;
+    }
+  return monitors;
+}
+
+void
+del_monitor (Monitor *monitor)
+{
+  close (monitor->timer_fd);
+  free (monitor->name);
+  del_var (monitor->var);
+}
+
+void
+free_monitors (Monitors *monitors)
+{
+  if (monitors == NULL)
+    {
+      return;
+    }
+
+  unwatch_monitors (monitors);
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      del_monitor (&monitors->monitors[i]);
+    }
+  free (monitors->monitors);
+  if (monitors->log != NULL)
+    {
+      fclose (monitors->log);
+    }
+  free (monitors);
+}
+
+/* Start the timer of `monitor` if `is_armed` is set, stop it otherwise. */
+void
+arm_monitor (const Monitor *monitor, bool is_armed)
+{
+  struct timespec interval = { 0 };
+  if (is_armed)
+    {
+      interval.tv_sec = monitor->every_ms / 1000;
+      interval.tv_nsec = (long) (monitor->every_ms % 1000) * 1000000;
+    }
+
+  /* The first sample is taken right away. */
+  struct itimerspec spec = {
+    .it_interval = interval,
+    .it_value = is_armed ? (struct timespec) {.tv_nsec = 1} : interval,
+  };
+  timerfd_settime (monitor->timer_fd, 0, &spec, NULL);
+}
+
+SprayResult
+add_monitor (Monitors *monitors, const char *name, real_addr addr,
+	     size_t n_bytes, unsigned every_ms, RuntimeVariable *var,
+	     const Monitor **monitor)
+{
+  assert (monitors != NULL);
+  assert (name != NULL);
+  assert (n_bytes > 0 && n_bytes <= sizeof (uint64_t));
+  assert (every_ms > 0);
+  assert (monitor != NULL);
+
+  int timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1)
+    {
+      return SP_ERR;
+    }
+
+  if (monitors->loop != NULL
+      && watch_fd (monitors->loop, timer_fd, monitors->callback,
+		   monitors->data) == SP_ERR)
+    {
+      int watch_errno = errno;
+      close (timer_fd);
+      errno = watch_errno;
+      return SP_ERR;
+    }
+
+  monitors->monitors = realloc (monitors->monitors,
+				(monitors->n_monitors + 1)
+				* sizeof (*monitors->monitors));
+  assert (monitors->monitors != NULL);
+
+  Monitor *added = &monitors->monitors[monitors->n_monitors++];
+  *added = (Monitor) {
+    .number = monitors->next_number++,
+    .name = strdup (name),
+    .addr = addr,
+    .n_bytes = n_bytes,
+    .every_ms = every_ms,
+    .var = var,
+    .timer_fd = timer_fd,
+  };
+  assert (added->name != NULL);
+
+  arm_monitor (added, monitors->is_resumed);
+
+  *monitor = added;
+  return SP_OK;
+}
+
+SprayResult
+delete_monitor (Monitors *monitors, size_t number)
+{
+  assert (monitors != NULL);
+
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      Monitor *monitor = &monitors->monitors[i];
+      if (monitor->number == number)
+	{
+	  /* The timer must be unwatched before it's closed, or else
+	   * its file descriptor might be reused while it's watched. */
+	  if (monitors->loop != NULL)
+	    {
+	      unwatch_fd (monitors->loop, monitor->timer_fd);
+	    }
+	  del_monitor (monitor);
+
+	  memmove (monitor, monitor + 1,
+		   (monitors->n_monitors - i - 1) * sizeof (*monitor));
+	  monitors->n_monitors--;
+	  return SP_OK;
+	}
+    }
+
+  return SP_ERR;
+}
+
+const Monitor *
+all_monitors (const Monitors *monitors, size_t *n_monitors)
+{
+  assert (monitors != NULL);
+  assert (n_monitors != NULL);
+
+  *n_monitors = monitors->n_monitors;
+  return monitors->monitors;
+}
+
+SprayResult
+log_monitors (Monitors *monitors, const char *filepath)
+{
+  assert (monitors != NULL);
+
+  FILE *log = NULL;
+  if (filepath != NULL)
+    {
+      log = fopen (filepath, "w");
+      if (log == NULL)
+	{
+	  return SP_ERR;
+	}
+      fprintf (log, "time,monitor,name,address,value\n");
+    }
+
+  if (monitors->log != NULL)
+    {
+      fclose (monitors->log);
+    }
+  monitors->log = log;
+  return SP_OK;
+}
+
+SprayResult
+watch_monitors (Monitors *monitors, EventLoop *loop,
+		EventCallback callback, void *data)
+{
+  assert (monitors != NULL);
+  assert (loop != NULL);
+  assert (callback != NULL);
+
+  unwatch_monitors (monitors);
+
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      if (watch_fd (loop, monitors->monitors[i].timer_fd,
+		    callback, data) == SP_ERR)
+	{
+	  for (size_t j = 0; j < i; j++)
+	    {
+	      unwatch_fd (loop, monitors->monitors[j].timer_fd);
+	    }
+	  return SP_ERR;
+	}
+    }
+
+  monitors->loop = loop;
+  monitors->callback = callback;
+  monitors->data = data;
+  return SP_OK;
+}
+
+void
+unwatch_monitors (Monitors *monitors)
+{
+  assert (monitors != NULL);
+
+  if (monitors->loop == NULL)
+    {
+      return;
+    }
+
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      unwatch_fd (monitors->loop, monitors->monitors[i].timer_fd);
+    }
+  monitors->loop = NULL;
+  monitors->callback = NULL;
+  monitors->data = NULL;
+}
+
+/* Start or stop all timers. */
+void
+arm_monitors (Monitors *monitors, bool is_armed)
+{
+  assert (monitors != NULL);
+
+  if (monitors->is_resumed == is_armed)
+    {
+      return;
+    }
+
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      arm_monitor (&monitors->monitors[i], is_armed);
+    }
+  monitors->is_resumed = is_armed;
+}
+
+void
+resume_monitors (Monitors *monitors)
+{
+  arm_monitors (monitors, true);
+}
+
+void
+pause_monitors (Monitors *monitors)
+{
+  arm_monitors (monitors, false);
+
+  /* The log is only written out while the tracee is stopped
+   * so that sampling doesn't have to wait for the disk. */
+  if (monitors->log != NULL)
+    {
+      fflush (monitors->log);
+    }
+}
+
+/* Write `field` to `file`, quoted if it contains
+ * characters that have a meaning in CSV. */
+void
+write_csv_field (FILE *file, const char *field)
+{
+  if (strpbrk (field, ",\"\n") == NULL)
+    {
+      fputs (field, file);
+      return;
+    }
+
+  fputc ('"', file);
+  for (const char *c = field; *c != '\0'; c++)
+    {
+      if (*c == '"')
+	{
+	  fputc ('"', file);
+	}
+      fputc (*c, file);
+    }
+  fputc ('"', file);
+}
+
+void
+log_sample (FILE *log, const Monitor *monitor)
+{
+  struct timespec now = { 0 };
+  clock_gettime (CLOCK_REALTIME, &now);
+
+  fprintf (log, "%lld.%03ld,%zu,", (long long) now.tv_sec,
+	   now.tv_nsec / 1000000, monitor->number);
+  write_csv_field (log, monitor->name);
+  fprintf (log, "," ADDR_FORMAT ",", monitor->addr.value);
+
+  if (monitor->has_failed)
+    {
+      fputc ('\n', log);
+      return;
+    }
+
+  char *value_str = monitor_value_str (monitor);
+  write_csv_field (log, value_str != NULL ? value_str : "");
+  fputc ('\n', log);
+  free (value_str);
+}
+
+const Monitor *
+sample_monitor (Monitors *monitors, int timer_fd, pid_t pid,
+		bool *is_changed)
+{
+  assert (monitors != NULL);
+  assert (is_changed != NULL);
+
+  *is_changed = false;
+
+  /* Expirations that were missed are dropped. Only
+   * the current value is of interest. */
+  uint64_t n_expirations = 0;
+  if (read (timer_fd, &n_expirations, sizeof (n_expirations)) == -1)
+    {
+      n_expirations = 0;
+    }
+
+  Monitor *monitor = NULL;
+  for (size_t i = 0; i < monitors->n_monitors; i++)
+    {
+      if (monitors->monitors[i].timer_fd == timer_fd)
+	{
+	  monitor = &monitors->monitors[i];
+	}
+    }
+  if (monitor == NULL || n_expirations == 0)
+    {
+      return NULL;
+    }
+
+  uint64_t value = 0;
+  struct iovec local = {.iov_base = &value,.iov_len = monitor->n_bytes };
+  struct iovec remote = {
+    .iov_base = (void *) monitor->addr.value,
+    .iov_len = monitor->n_bytes,
+  };
+  add_stat (STAT_PROCESS_VM_READV, 1);
+  bool has_failed = process_vm_readv (pid, &local, 1, &remote, 1, 0)
+    != (ssize_t) monitor->n_bytes;
+  if (!has_failed)
+    {
+      add_stat (STAT_BYTES_READ, monitor->n_bytes);
+    }
+
+  /* The process exited, and the exit is reported soon. */
+  if (has_failed && errno == ESRCH)
+    {
+      return NULL;
+    }
+
+  if (has_failed)
+    {
+      *is_changed = !monitor->has_failed;
+    }
+  else
+    {
+      *is_changed = !monitor->has_value || monitor->has_failed
+	|| value != monitor->value;
+      monitor->value = value;
+      monitor->has_value = true;
+    }
+  monitor->has_failed = has_failed;
+  monitor->n_samples++;
+
+  if (monitors->log != NULL)
+    {
+      log_sample (monitors->log, monitor);
+    }
+
+  return monitor;
+}
+
+char *
+monitor_value_str (const Monitor *monitor)
+{
+  assert (monitor != NULL);
+
+  if (monitor->var != NULL)
+    {
+      return print_var_value (monitor->var,
+			      mask_var_value (monitor->var, monitor->value),
+			      FMT_NONE);
+    }
+
+  char *str = NULL;
+  if (asprintf (&str, "0x%" PRIx64, monitor->value) == -1)
+    {
+      return NULL;
+    }
+  return str;
+}
@@ -0,0 +1,94 @@
+/* Sample variables of the tracee at a fixed rate while it's running.
+ *
+ * `process_vm_readv` reads the memory of another process without
+ * stopping it. Every monitor has a timer file descriptor that's
+ * watched by an event loop, and each time the timer expires the
+ * monitored value is read once. Only memory at fixed addresses can
+ * be monitored this way, since everything else (registers and the
+ * stack) would require the tracee to stop. */
+
+#pragma once
+
+#ifndef _SPRAY_MONITORS_H_
+#define _SPRAY_MONITORS_H_
+
+#include "event_loop.h"
+#include "info.h"
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+typedef struct
+{
+  size_t number;		/* Numbers start at 1. */
+  char *name;			/* Name of the variable, or the address. */
+  real_addr addr;
+  size_t n_bytes;		/* At most 8. */
+  unsigned every_ms;		/* Sampling interval. */
+  RuntimeVariable *var;		/* Type of the value. NULL for addresses. */
+  int timer_fd;
+  uint64_t value;		/* Last value that was read. */
+  bool has_value;		/* Was a value read yet? */
+  bool has_failed;		/* Did the last read fail? */
+  size_t n_samples;
+} Monitor;
+
+typedef struct Monitors Monitors;
+
+Monitors *init_monitors (void);
+
+/* Stop watching the timers and close the CSV log. */
+void free_monitors (Monitors * monitors);
+
+/* Add a monitor that reads `n_bytes` at `addr` every `every_ms`
+ * milliseconds. `name` is copied. The monitor takes ownership of
+ * `var`, which may be NULL. Returns `SP_ERR` with `errno` set on
+ * error. */
+SprayResult add_monitor (Monitors * monitors, const char *name,
+			 real_addr addr, size_t n_bytes, unsigned every_ms,
+			 RuntimeVariable *var, const Monitor ** monitor);
+
+/* Returns `SP_ERR` if there is no monitor with the given number. */
+SprayResult delete_monitor (Monitors * monitors, size_t number);
+
+/* Get the monitors ordered by their number. The length
+ * of the array is `n_monitors`. */
+const Monitor *all_monitors (const Monitors * monitors, size_t *n_monitors);
+
+/* Write every sample to the CSV file at `filepath` from now
+ * on. The file is truncated. Logging stops if `filepath` is
+ * NULL. Returns `SP_ERR` with `errno` set on error. */
+SprayResult log_monitors (Monitors * monitors, const char *filepath);
+
+/* Run `callback` with `data` in `loop` whenever the timer of a
+ * monitor expires. The file descriptor that's passed to `callback`
+ * must be given to `sample_monitor`. Monitors added later on are
+ * watched as well. The timers only expire between `resume_monitors`
+ * and `pause_monitors`. */
+SprayResult watch_monitors (Monitors * monitors, EventLoop * loop,
+			    EventCallback callback, void *data);
+
+/* Stop watching the timers. Does nothing if they aren't watched. */
+void unwatch_monitors (Monitors * monitors);
+
+/* Start the timers. Must be called when the tracee is resumed. */
+void resume_monitors (Monitors * monitors);
+
+/* Stop the timers. Must be called when the tracee stops. */
+void pause_monitors (Monitors * monitors);
+
+/* Read the value of the monitor whose timer `timer_fd` expired from
+ * the memory of `pid`, and log it. `is_changed` is set if it's the
+ * first value, if it's different from the last one, or if reading
+ * failed for the first time. Returns NULL if no monitor uses the
+ * timer or if `pid` is gone. */
+const Monitor *sample_monitor (Monitors * monitors, int timer_fd,
+			       pid_t pid, bool *is_changed);
+
+/* Format the last value of `monitor`. The caller must free the string. */
+char *monitor_value_str (const Monitor * monitor);
+
+#endif /* _SPRAY_MONITORS_H_ */
@@ -1,5 +1,6 @@
 #include "print_source.h"
 #include "args.h"
+#include "trace.h"
 
 #include <stdbool.h>
 #include <chicken.h>
@@ -19,10 +20,12 @@ SprayResult
 print_source (const char *filepath, unsigned lineno, unsigned n_context)
 {
   bool use_color = !get_args ()->flags.no_color;
+  TraceSpan span = begin_span ("scheme");
   int res = print_source_extern (filepath,
 				 lineno,
 				 n_context,
 				 use_color);
+  end_span (span, "print_source", "%s:%u", filepath, lineno);
   if (res == 0)
     {
       return SP_OK;
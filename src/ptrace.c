@@ -1,12 +1,44 @@
+/* Required to use `process_vm_readv`. */
+#define _GNU_SOURCE
+
 #include "ptrace.h"
+#include "stats.h"
 
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 enum
 { PTRACE_ERROR = -1 };
 
+/* Core dump that reads are served from, or NULL for a live process. */
+static CoreFile *core_backend = NULL;
+
+/* Count the request in its own counter, e.g. `STAT_PTRACE_CONT`. */
+#define counted_ptrace(request, ...)					\
+  (add_stat (STAT_##request, 1), ptrace (request, __VA_ARGS__))
+
+uint64_t
+pt_n_syscalls (void)
+{
+  uint64_t n_syscalls = 0;
+  for (Stat stat = STAT_PTRACE_TRACEME; stat <= STAT_PROCESS_VM_READV;
+       stat++)
+    {
+      n_syscalls += get_stat (stat);
+    }
+  return n_syscalls;
+}
+
+void
+pt_use_core (CoreFile *core)
+{
+  core_backend = core;
+}
+
 /* NOTE: All `PTRACE_PEEK*` requests return the
  * requested data. Because the return value if
  * always used to indicate an error (by returning
@@ -18,13 +50,20 @@ pt_read_memory (pid_t pid, real_addr addr, uint64_t *read)
 {
   assert (read != NULL);
 
+  if (core_backend != NULL)
+    {
+      errno = EFAULT;
+      return core_read_memory (core_backend, addr, read);
+    }
+
   /* The `ptrace(2)` API requires that we manually set `errno` here. */
   errno = 0;
-  uint64_t value = ptrace (PTRACE_PEEKDATA, pid, addr, NULL);
+  uint64_t value = counted_ptrace (PTRACE_PEEKDATA, pid, addr, NULL);
   if (errno == 0)
     {
       /* No error was raised. Return the result. */
       *read = value;
+      add_stat (STAT_BYTES_READ, sizeof (value));
       return SP_OK;
     }
   else
@@ -37,7 +76,13 @@ pt_read_memory (pid_t pid, real_addr addr, uint64_t *read)
 SprayResult
 pt_write_memory (pid_t pid, real_addr addr, uint64_t write)
 {
-  if (ptrace (PTRACE_POKEDATA, pid, addr, write) == PTRACE_ERROR)
+  if (core_backend != NULL)
+    {
+      errno = EPERM;
+      return SP_ERR;
+    }
+
+  if (counted_ptrace (PTRACE_POKEDATA, pid, addr, write) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -47,13 +92,141 @@ pt_write_memory (pid_t pid, real_addr addr, uint64_t write)
     }
 }
 
+size_t
+pt_read_memory_range (pid_t pid, real_addr addr, void *buf, size_t n_bytes)
+{
+  assert (buf != NULL);
+
+  unsigned char *bytes = buf;
+  size_t n_read = 0;
+
+  if (core_backend != NULL)
+    {
+      const unsigned char *core_bytes =
+	core_memory (core_backend, addr, n_bytes);
+      if (core_bytes != NULL)
+	{
+	  memcpy (bytes, core_bytes, n_bytes);
+	  return n_bytes;
+	}
+    }
+  else
+    {
+      struct iovec local = {.iov_base = bytes,.iov_len = n_bytes };
+      struct iovec remote = {
+	.iov_base = (void *) addr.value,
+	.iov_len = n_bytes,
+      };
+      add_stat (STAT_PROCESS_VM_READV, 1);
+      ssize_t res = process_vm_readv (pid, &local, 1, &remote, 1, 0);
+      if (res > 0)
+	{
+	  n_read = (size_t) res;
+	  add_stat (STAT_BYTES_READ, n_read);
+	}
+    }
+
+  /* `process_vm_readv` respects the protection of pages, while
+   * `PTRACE_PEEKDATA` doesn't. Whatever is left is read word by
+   * word. The words are aligned so that none of them extends
+   * into a page that isn't part of the range. */
+  while (n_read < n_bytes)
+    {
+      uint64_t at = addr.value + n_read;
+      uint64_t word_start = at & ~(uint64_t) (sizeof (uint64_t) - 1);
+      uint64_t word = 0;
+      if (pt_read_memory (pid, (real_addr) {word_start}, &word) == SP_ERR)
+	{
+	  break;
+	}
+
+      size_t offset = at - word_start;
+      size_t n_copy = sizeof (word) - offset;
+      if (n_copy > n_bytes - n_read)
+	{
+	  n_copy = n_bytes - n_read;
+	}
+      memcpy (bytes + n_read, (unsigned char *) &word + offset, n_copy);
+      n_read += n_copy;
+    }
+
+  return n_read;
+}
+
+SprayResult
+pt_write_memory_range (pid_t pid, real_addr addr, const void *buf,
+		       size_t n_bytes)
+{
+  assert (buf != NULL);
+
+  const unsigned char *bytes = buf;
+  size_t n_written = 0;
+
+  while (n_written < n_bytes)
+    {
+      uint64_t at = addr.value + n_written;
+      uint64_t word_start = at & ~(uint64_t) (sizeof (uint64_t) - 1);
+      size_t offset = at - word_start;
+      size_t n_copy = sizeof (uint64_t) - offset;
+      if (n_copy > n_bytes - n_written)
+	{
+	  n_copy = n_bytes - n_written;
+	}
+
+      /* Words that are only partially covered must be read first. */
+      uint64_t word = 0;
+      if (n_copy < sizeof (word)
+	  && pt_read_memory (pid, (real_addr) {word_start}, &word) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      memcpy ((unsigned char *) &word + offset, bytes + n_written, n_copy);
+      if (pt_write_memory (pid, (real_addr) {word_start}, word) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      n_written += n_copy;
+    }
+
+  return SP_OK;
+}
+
 SprayResult
 pt_read_registers (pid_t pid, struct user_regs_struct *regs)
 {
   assert (regs != NULL);
+
+  if (core_backend != NULL)
+    {
+      errno = ESRCH;
+      return core_registers (core_backend, pid, regs);
+    }
+
   /* `addr` is ignored here. `PTRACE_GETREGS` stores all
    * of the tracee's general purpose registers in `regs`. */
-  if (ptrace (PTRACE_GETREGS, pid, NULL, regs) == PTRACE_ERROR)
+  if (counted_ptrace (PTRACE_GETREGS, pid, NULL, regs) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_read_fp_registers (pid_t pid, struct user_fpregs_struct *fp_regs)
+{
+  assert (fp_regs != NULL);
+
+  /* Core dumps only provide the general purpose registers. */
+  if (core_backend != NULL)
+    {
+      errno = ESRCH;
+      return SP_ERR;
+    }
+
+  if (counted_ptrace (PTRACE_GETFPREGS, pid, NULL, fp_regs) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -67,7 +240,14 @@ SprayResult
 pt_write_registers (pid_t pid, struct user_regs_struct *regs)
 {
   assert (regs != NULL);
-  if (ptrace (PTRACE_SETREGS, pid, NULL, regs) == PTRACE_ERROR)
+
+  if (core_backend != NULL)
+    {
+      errno = EPERM;
+      return SP_ERR;
+    }
+
+  if (counted_ptrace (PTRACE_SETREGS, pid, NULL, regs) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -80,7 +260,20 @@ pt_write_registers (pid_t pid, struct user_regs_struct *regs)
 SprayResult
 pt_continue_execution (pid_t pid)
 {
-  if (ptrace (PTRACE_CONT, pid, NULL, NULL) == PTRACE_ERROR)
+  if (counted_ptrace (PTRACE_CONT, pid, NULL, NULL) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_continue_with_signal (pid_t pid, int signo)
+{
+  if (counted_ptrace (PTRACE_CONT, pid, NULL, signo) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -93,7 +286,7 @@ pt_continue_execution (pid_t pid)
 SprayResult
 pt_trace_me (void)
 {
-  if (ptrace (PTRACE_TRACEME, 0, NULL, NULL) == PTRACE_ERROR)
+  if (counted_ptrace (PTRACE_TRACEME, 0, NULL, NULL) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -106,7 +299,20 @@ pt_trace_me (void)
 SprayResult
 pt_single_step (pid_t pid)
 {
-  if (ptrace (PTRACE_SINGLESTEP, pid, NULL, NULL) == PTRACE_ERROR)
+  if (counted_ptrace (PTRACE_SINGLESTEP, pid, NULL, NULL) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_single_block (pid_t pid)
+{
+  if (counted_ptrace (PTRACE_SINGLEBLOCK, pid, NULL, NULL) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -120,7 +326,87 @@ SprayResult
 pt_get_signal_info (pid_t pid, siginfo_t *siginfo)
 {
   assert (siginfo != NULL);
-  if (ptrace (PTRACE_GETSIGINFO, pid, NULL, siginfo) == PTRACE_ERROR)
+
+  if (core_backend != NULL)
+    {
+      errno = ESRCH;
+      return core_signal_info (core_backend, pid, siginfo);
+    }
+
+  if (counted_ptrace (PTRACE_GETSIGINFO, pid, NULL, siginfo) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+pid_t
+pt_wait (pid_t pid, int *status, int options)
+{
+  add_stat (STAT_WAITPID, 1);
+  return waitpid (pid, status, options);
+}
+
+SprayResult
+pt_seize (pid_t pid, int options)
+{
+  if (counted_ptrace (PTRACE_SEIZE, pid, NULL, options) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_set_options (pid_t pid, int options)
+{
+  if (counted_ptrace (PTRACE_SETOPTIONS, pid, NULL, options) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_detach (pid_t tid, int signo)
+{
+  if (counted_ptrace (PTRACE_DETACH, tid, NULL, signo) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_interrupt (pid_t tid)
+{
+  if (counted_ptrace (PTRACE_INTERRUPT, tid, NULL, NULL) == PTRACE_ERROR)
+    {
+      return SP_ERR;
+    }
+  else
+    {
+      return SP_OK;
+    }
+}
+
+SprayResult
+pt_get_event_msg (pid_t tid, unsigned long *msg)
+{
+  assert (msg != NULL);
+  if (counted_ptrace (PTRACE_GETEVENTMSG, tid, NULL, msg) == PTRACE_ERROR)
     {
       return SP_ERR;
     }
@@ -1,7 +1,10 @@
 /* The `ptrace` API is ... special. This header
  * wraps it up for use in the rest of this program.
  * If one of the functions here fails, `errno` will
- * hold the value set by `ptrace`. */
+ * hold the value set by `ptrace`.
+ *
+ * When a core dump is debugged, reads of memory, registers
+ * and signal info are served from the core instead. */
 
 #pragma once
 
@@ -14,18 +17,67 @@
 #include <signal.h>
 #include <sys/user.h>
 
+#include "core.h"
 #include "magic.h"
 
+/* Serve all reads from `core` instead of a live process. Writes
+ * fail with `EPERM`. NULL switches back to live processes. */
+void pt_use_core (CoreFile * core);
+
+/* Number of `ptrace` and `process_vm_readv` calls that were made
+ * to access live processes so far. See `stats.h`. */
+uint64_t pt_n_syscalls (void);
+
 SprayResult pt_read_memory (pid_t pid, real_addr addr, uint64_t * read);
 SprayResult pt_write_memory (pid_t pid, real_addr addr, uint64_t write);
 
+/* Read `n_bytes` of memory at `addr` into `buf` with as few system
+ * calls as possible. Returns the number of bytes that were read,
+ * which is less than `n_bytes` if some of them aren't mapped. */
+size_t pt_read_memory_range (pid_t pid, real_addr addr, void *buf,
+			     size_t n_bytes);
+/* Write `n_bytes` from `buf` to the memory at `addr`. Bytes around
+ * the range that share a word with it are preserved. */
+SprayResult pt_write_memory_range (pid_t pid, real_addr addr,
+				   const void *buf, size_t n_bytes);
+
 SprayResult pt_read_registers (pid_t pid, struct user_regs_struct *regs);
 SprayResult pt_write_registers (pid_t pid, struct user_regs_struct *regs);
+SprayResult pt_read_fp_registers (pid_t pid,
+				  struct user_fpregs_struct *fp_regs);
 
 SprayResult pt_continue_execution (pid_t pid);
+/* Continue and deliver the signal `signo` to `pid`. 0 delivers no signal. */
+SprayResult pt_continue_with_signal (pid_t pid, int signo);
 SprayResult pt_trace_me (void);
 SprayResult pt_single_step (pid_t pid);
 
+/* Continue until the tracee has taken the next branch. Not all
+ * kernels support this. `errno` is `EIO` if this one doesn't. */
+SprayResult pt_single_block (pid_t pid);
+
 SprayResult pt_get_signal_info (pid_t pid, siginfo_t * siginfo);
 
+/* Same as `waitpid`, but the call is counted in `STAT_WAITPID`. */
+pid_t pt_wait (pid_t pid, int *status, int options);
+
+/* Attach to the process `pid` without stopping it, using the
+ * `PTRACE_O_*` options in `options`. Threads created by the
+ * process later on are seized automatically. */
+SprayResult pt_seize (pid_t pid, int options);
+
+/* Replace the `PTRACE_O_*` options of the stopped process `pid`. */
+SprayResult pt_set_options (pid_t pid, int options);
+
+/* Stop tracing the stopped thread `tid` and resume it. If `signo`
+ * isn't 0, the signal is delivered to the thread. */
+SprayResult pt_detach (pid_t tid, int signo);
+
+/* Stop a seized thread. It reports a `PTRACE_EVENT_STOP`. */
+SprayResult pt_interrupt (pid_t tid);
+
+/* Get the message of the last ptrace event of the thread, e.g.
+ * the id of the new thread for `PTRACE_EVENT_CLONE`. */
+SprayResult pt_get_event_msg (pid_t tid, unsigned long *msg);
+
 #endif /* _SPRAY_PTRACE_H_ */
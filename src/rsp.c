@@ -0,0 +1,614 @@
+/* Required to use `accept4` and `asprintf`. */
+#define _GNU_SOURCE
+
+#include "rsp.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+enum
+{
+  /* Room for the framing around a packet of `RSP_PACKET_SIZE`. */
+  RSP_BUF_SIZE = RSP_PACKET_SIZE + 8,
+  RSP_INTERRUPT_BYTE = 0x03,
+  RSP_ESCAPE_BYTE = '}',
+  RSP_ESCAPE_XOR = 0x20,
+  RSP_CHECKSUM_LEN = 2,
+};
+
+struct RspConnection
+{
+  int listen_fd;		/* -1 once a client connected. */
+  int fd;			/* Socket of the client, or -1. */
+  char *address;		/* Address that's listened on. */
+  char *unix_path;		/* Path of the unix socket, or NULL. */
+  bool is_ack_mode;
+  bool is_closed;
+  bool has_interrupt;		/* Was `0x03` received but not handled? */
+  unsigned char in[RSP_BUF_SIZE];	/* Bytes that were received... */
+  size_t in_start;		/* ... starting here ... */
+  size_t in_end;		/* ... and ending here. */
+  char packet[RSP_PACKET_SIZE + 1];	/* Data of the last packet. */
+  char *out;			/* Frame of the last packet sent. */
+  size_t out_cap;
+};
+
+/* Parse `[host]:port` into `addr`. */
+SprayResult
+parse_rsp_tcp_address (const char *address, struct sockaddr_in *addr)
+{
+  const char *colon = strrchr (address, ':');
+  if (colon == NULL)
+    {
+      return SP_ERR;
+    }
+
+  size_t host_len = colon - address;
+  bool is_loopback = host_len == 0
+    || (host_len == strlen ("localhost")
+	&& strncmp (address, "localhost", host_len) == 0)
+    || (host_len == strlen ("127.0.0.1")
+	&& strncmp (address, "127.0.0.1", host_len) == 0);
+  if (!is_loopback)
+    {
+      return SP_ERR;
+    }
+
+  char *end = NULL;
+  errno = 0;
+  unsigned long port = strtoul (colon + 1, &end, 10);
+  if (colon[1] == '\0' || *end != '\0' || errno != 0 || port > UINT16_MAX)
+    {
+      return SP_ERR;
+    }
+
+  *addr = (struct sockaddr_in) {
+    .sin_family = AF_INET,
+    .sin_port = htons (port),
+    .sin_addr = {.s_addr = htonl (INADDR_LOOPBACK)},
+  };
+  return SP_OK;
+}
+
+/* Create the listening socket of `conn` for `address`. */
+SprayResult
+bind_rsp_socket (RspConnection *conn, const char *address)
+{
+  if (strchr (address, '/') != NULL)
+    {
+      struct sockaddr_un addr = {.sun_family = AF_UNIX };
+      if (strlen (address) >= sizeof (addr.sun_path))
+	{
+	  errno = ENAMETOOLONG;
+	  return SP_ERR;
+	}
+      strcpy (addr.sun_path, address);
+
+      /* A socket that's left over from an earlier run is replaced.
+       * Other files are never removed. */
+      struct stat st;
+      if (stat (address, &st) == 0 && S_ISSOCK (st.st_mode))
+	{
+	  unlink (address);
+	}
+
+      conn->listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (conn->listen_fd == -1
+	  || bind (conn->listen_fd, (struct sockaddr *) &addr,
+		   sizeof (addr)) == -1)
+	{
+	  return SP_ERR;
+	}
+      conn->unix_path = strdup (address);
+      conn->address = strdup (address);
+      assert (conn->unix_path != NULL && conn->address != NULL);
+      return SP_OK;
+    }
+
+  struct sockaddr_in addr;
+  if (parse_rsp_tcp_address (address, &addr) == SP_ERR)
+    {
+      errno = EINVAL;
+      return SP_ERR;
+    }
+
+  conn->listen_fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int reuse = 1;
+  if (conn->listen_fd == -1
+      || setsockopt (conn->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+		     &reuse, sizeof (reuse)) == -1
+      || bind (conn->listen_fd, (struct sockaddr *) &addr,
+	       sizeof (addr)) == -1)
+    {
+      return SP_ERR;
+    }
+
+  /* Find out which port was picked if it was 0. */
+  socklen_t addr_len = sizeof (addr);
+  if (getsockname (conn->listen_fd, (struct sockaddr *) &addr,
+		   &addr_len) == -1)
+    {
+      return SP_ERR;
+    }
+  if (asprintf (&conn->address, "127.0.0.1:%u",
+		(unsigned) ntohs (addr.sin_port)) == -1)
+    {
+      conn->address = NULL;
+      errno = ENOMEM;
+      return SP_ERR;
+    }
+  return SP_OK;
+}
+
+RspConnection *
+listen_rsp (const char *address)
+{
+  assert (address != NULL);
+
+  RspConnection *conn = calloc (1, sizeof (*conn));
+  if (conn == NULL)
+    {
+      return NULL;
+    }
+  conn->listen_fd = -1;
+  conn->fd = -1;
+  conn->is_ack_mode = true;
+
+  if (bind_rsp_socket (conn, address) == SP_ERR
+      || listen (conn->listen_fd, 1) == -1)
+    {
+      int listen_errno = errno;
+      close_rsp (conn);
+      errno = listen_errno;
+      return NULL;
+    }
+
+  return conn;
+}
+
+const char *
+rsp_address (const RspConnection *conn)
+{
+  assert (conn != NULL);
+  return conn->address;
+}
+
+/* Stop listening for more clients. */
+void
+close_rsp_listener (RspConnection *conn)
+{
+  if (conn->listen_fd != -1)
+    {
+      close (conn->listen_fd);
+      conn->listen_fd = -1;
+    }
+  if (conn->unix_path != NULL)
+    {
+      unlink (conn->unix_path);
+      free (conn->unix_path);
+      conn->unix_path = NULL;
+    }
+}
+
+SprayResult
+accept_rsp (RspConnection *conn)
+{
+  assert (conn != NULL);
+  assert (conn->listen_fd != -1);
+
+  do
+    {
+      conn->fd = accept4 (conn->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    }
+  while (conn->fd == -1 && errno == EINTR);
+
+  int accept_errno = errno;
+  close_rsp_listener (conn);
+  if (conn->fd == -1)
+    {
+      errno = accept_errno;
+      return SP_ERR;
+    }
+
+  /* Packets are small and each one waits for a reply. Delaying
+   * them to fill up segments only adds latency. This fails for
+   * unix sockets, which don't delay anything anyways. */
+  int no_delay = 1;
+  setsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+	      sizeof (no_delay));
+
+  return SP_OK;
+}
+
+void
+close_rsp (RspConnection *conn)
+{
+  if (conn == NULL)
+    {
+      return;
+    }
+
+  close_rsp_listener (conn);
+  if (conn->fd != -1)
+    {
+      close (conn->fd);
+    }
+  free (conn->address);
+  free (conn->out);
+  free (conn);
+}
+
+int
+rsp_fd (const RspConnection *conn)
+{
+  assert (conn != NULL);
+  return conn->fd;
+}
+
+/* Write all of `bytes` to the client. */
+SprayResult
+write_rsp (RspConnection *conn, const void *bytes, size_t n_bytes)
+{
+  const char *next = bytes;
+  while (n_bytes > 0)
+    {
+      ssize_t n_written = send (conn->fd, next, n_bytes, MSG_NOSIGNAL);
+      if (n_written == -1 && errno == EINTR)
+	{
+	  continue;
+	}
+      if (n_written == -1)
+	{
+	  conn->is_closed = true;
+	  return SP_ERR;
+	}
+      next += n_written;
+      n_bytes -= n_written;
+    }
+  return SP_OK;
+}
+
+/* Receive more bytes. Waits for them unless `is_blocking` is false.
+ * Returns `SP_ERR` if nothing was received. */
+SprayResult
+receive_rsp (RspConnection *conn, bool is_blocking)
+{
+  if (conn->is_closed)
+    {
+      return SP_ERR;
+    }
+
+  /* Make room at the end of the buffer. */
+  if (conn->in_start > 0)
+    {
+      memmove (conn->in, conn->in + conn->in_start,
+	       conn->in_end - conn->in_start);
+      conn->in_end -= conn->in_start;
+      conn->in_start = 0;
+    }
+  if (conn->in_end == sizeof (conn->in))
+    {
+      return SP_ERR;
+    }
+
+  ssize_t n_read = 0;
+  do
+    {
+      n_read = recv (conn->fd, conn->in + conn->in_end,
+		     sizeof (conn->in) - conn->in_end,
+		     is_blocking ? 0 : MSG_DONTWAIT);
+    }
+  while (n_read == -1 && errno == EINTR);
+
+  if (n_read == 0 || (n_read == -1 && errno != EAGAIN
+		      && errno != EWOULDBLOCK))
+    {
+      conn->is_closed = true;
+      return SP_ERR;
+    }
+  if (n_read == -1)
+    {
+      return SP_ERR;
+    }
+
+  conn->in_end += n_read;
+  return SP_OK;
+}
+
+/* Skip acknowledgements and note interrupts until the start
+ * of a packet or the end of the received bytes is reached. */
+void
+skip_rsp_noise (RspConnection *conn)
+{
+  while (conn->in_start < conn->in_end && conn->in[conn->in_start] != '$')
+    {
+      if (conn->in[conn->in_start] == RSP_INTERRUPT_BYTE)
+	{
+	  conn->has_interrupt = true;
+	}
+      conn->in_start++;
+    }
+}
+
+int
+rsp_hex_digit (unsigned char c)
+{
+  if (c >= '0' && c <= '9')
+    {
+      return c - '0';
+    }
+  if (c >= 'a' && c <= 'f')
+    {
+      return c - 'a' + 10;
+    }
+  if (c >= 'A' && c <= 'F')
+    {
+      return c - 'A' + 10;
+    }
+  return -1;
+}
+
+void
+write_rsp_hex (FILE *out, const void *bytes, size_t n_bytes)
+{
+  assert (out != NULL);
+  assert (bytes != NULL || n_bytes == 0);
+
+  for (size_t i = 0; i < n_bytes; i++)
+    {
+      fprintf (out, "%02x", ((const unsigned char *) bytes)[i]);
+    }
+}
+
+SprayResult
+read_rsp_hex (const char *hex, void *bytes, size_t n_bytes)
+{
+  assert (hex != NULL);
+  assert (bytes != NULL || n_bytes == 0);
+
+  for (size_t i = 0; i < n_bytes; i++)
+    {
+      /* The NUL byte at the end isn't a digit. */
+      int high = rsp_hex_digit (hex[2 * i]);
+      int low = high == -1 ? -1 : rsp_hex_digit (hex[2 * i + 1]);
+      if (low == -1)
+	{
+	  return SP_ERR;
+	}
+      ((unsigned char *) bytes)[i] = high << 4 | low;
+    }
+  return SP_OK;
+}
+
+/* Is the frame of the packet in `data` valid? It starts after
+ * the `$` and ends before the `#`. */
+bool
+is_rsp_checksum_valid (const unsigned char *data, size_t n_bytes,
+		       const unsigned char *checksum)
+{
+  uint8_t sum = 0;
+  for (size_t i = 0; i < n_bytes; i++)
+    {
+      sum += data[i];
+    }
+  int high = rsp_hex_digit (checksum[0]);
+  int low = rsp_hex_digit (checksum[1]);
+  return high != -1 && low != -1 && sum == (high << 4 | low);
+}
+
+/* Copy the data of a packet to `conn->packet` and remove escapes.
+ * Returns `SP_ERR` if the packet is too big. */
+SprayResult
+unescape_rsp_packet (RspConnection *conn, const unsigned char *data,
+		     size_t n_bytes, size_t *n_unescaped)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < n_bytes; i++)
+    {
+      if (n == RSP_PACKET_SIZE)
+	{
+	  return SP_ERR;
+	}
+      if (data[i] == RSP_ESCAPE_BYTE && i + 1 < n_bytes)
+	{
+	  conn->packet[n++] = data[++i] ^ RSP_ESCAPE_XOR;
+	}
+      else
+	{
+	  conn->packet[n++] = data[i];
+	}
+    }
+  conn->packet[n] = '\0';
+  *n_unescaped = n;
+  return SP_OK;
+}
+
+RspEvent
+read_rsp_packet (RspConnection *conn, const char **packet, size_t *n_bytes)
+{
+  assert (conn != NULL);
+  assert (packet != NULL);
+  assert (n_bytes != NULL);
+
+  while (true)
+    {
+      skip_rsp_noise (conn);
+      if (conn->has_interrupt)
+	{
+	  conn->has_interrupt = false;
+	  return RSP_INTERRUPT;
+	}
+
+      /* Find the end of the packet at `in_start`, if there is one. */
+      unsigned char *start = conn->in + conn->in_start;
+      size_t n_available = conn->in_end - conn->in_start;
+      unsigned char *hash = n_available > 0
+	? memchr (start, '#', n_available) : NULL;
+      if (hash == NULL || (size_t) (hash - start) + RSP_CHECKSUM_LEN
+	  >= n_available)
+	{
+	  if (n_available == sizeof (conn->in))
+	    {
+	      /* The packet doesn't fit. Drop what was received. */
+	      conn->in_start = conn->in_end;
+	      if (conn->is_ack_mode)
+		{
+		  write_rsp (conn, "-", 1);
+		}
+	    }
+	  if (receive_rsp (conn, true) == SP_ERR && conn->is_closed)
+	    {
+	      return RSP_CLOSED;
+	    }
+	  continue;
+	}
+
+      const unsigned char *data = start + 1;
+      size_t n_data = hash - data;
+      conn->in_start += (hash - start) + 1 + RSP_CHECKSUM_LEN;
+
+      bool is_valid = !conn->is_ack_mode
+	|| is_rsp_checksum_valid (data, n_data, hash + 1);
+      if (is_valid
+	  && unescape_rsp_packet (conn, data, n_data, n_bytes) == SP_ERR)
+	{
+	  is_valid = false;
+	}
+      if (conn->is_ack_mode)
+	{
+	  write_rsp (conn, is_valid ? "+" : "-", 1);
+	}
+      if (is_valid)
+	{
+	  *packet = conn->packet;
+	  return RSP_PACKET;
+	}
+    }
+}
+
+bool
+poll_rsp_interrupt (RspConnection *conn)
+{
+  assert (conn != NULL);
+
+  while (receive_rsp (conn, false) == SP_OK)
+    {
+    }
+  skip_rsp_noise (conn);
+  return conn->has_interrupt || conn->is_closed;
+}
+
+/* Wait for the acknowledgement of the packet that was just sent.
+ * Returns `SP_ERR` if it must be sent again or the connection
+ * closed. */
+SprayResult
+wait_for_rsp_ack (RspConnection *conn)
+{
+  while (true)
+    {
+      if (conn->in_start == conn->in_end
+	  && receive_rsp (conn, true) == SP_ERR)
+	{
+	  if (conn->is_closed)
+	    {
+	      return SP_ERR;
+	    }
+	  continue;
+	}
+
+      unsigned char c = conn->in[conn->in_start];
+      if (c == '$')
+	{
+	  /* The client moved on without acknowledging. */
+	  return SP_OK;
+	}
+      conn->in_start++;
+      if (c == '+')
+	{
+	  return SP_OK;
+	}
+      if (c == '-')
+	{
+	  return SP_ERR;
+	}
+      if (c == RSP_INTERRUPT_BYTE)
+	{
+	  conn->has_interrupt = true;
+	}
+    }
+}
+
+SprayResult
+send_rsp_packet (RspConnection *conn, const char *data, size_t n_bytes)
+{
+  assert (conn != NULL);
+  assert (data != NULL || n_bytes == 0);
+
+  /* In the worst case, every byte is escaped. */
+  size_t needed = 2 * n_bytes + 1 + 1 + RSP_CHECKSUM_LEN;
+  if (needed > conn->out_cap)
+    {
+      conn->out = realloc (conn->out, needed);
+      assert (conn->out != NULL);
+      conn->out_cap = needed;
+    }
+
+  size_t n = 0;
+  uint8_t sum = 0;
+  conn->out[n++] = '$';
+  for (size_t i = 0; i < n_bytes; i++)
+    {
+      char c = data[i];
+      if (c == '$' || c == '#' || c == '*' || c == RSP_ESCAPE_BYTE)
+	{
+	  conn->out[n++] = RSP_ESCAPE_BYTE;
+	  sum += RSP_ESCAPE_BYTE;
+	  c ^= RSP_ESCAPE_XOR;
+	}
+      conn->out[n++] = c;
+      sum += (uint8_t) c;
+    }
+  const char *digits = "0123456789abcdef";
+  conn->out[n++] = '#';
+  conn->out[n++] = digits[sum >> 4];
+  conn->out[n++] = digits[sum & 0xf];
+
+  while (true)
+    {
+      if (write_rsp (conn, conn->out, n) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      if (!conn->is_ack_mode || wait_for_rsp_ack (conn) == SP_OK)
+	{
+	  return SP_OK;
+	}
+      if (conn->is_closed)
+	{
+	  return SP_ERR;
+	}
+    }
+}
+
+SprayResult
+send_rsp_str (RspConnection *conn, const char *str)
+{
+  assert (str != NULL);
+  return send_rsp_packet (conn, str, strlen (str));
+}
+
+void
+stop_rsp_acks (RspConnection *conn)
+{
+  assert (conn != NULL);
+  conn->is_ack_mode = false;
+}
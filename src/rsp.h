@@ -0,0 +1,88 @@
+/* Transport of the GDB Remote Serial Protocol (RSP) that GDB and
+ * other tools use to talk to a debugging stub. Every packet looks like
+ * `$<data>#<checksum>` and is acknowledged with `+` by the receiver
+ * until both sides agree to stop doing that. A single `0x03` byte
+ * outside of a packet asks to interrupt the target. See
+ * https://sourceware.org/gdb/current/onlinedocs/gdb.html/Remote-Protocol.html */
+
+#pragma once
+
+#ifndef _SPRAY_RSP_H_
+#define _SPRAY_RSP_H_
+
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum
+{
+  /* Size of the biggest packet that's accepted. This is
+   * the `PacketSize` that's announced to the client. */
+  RSP_PACKET_SIZE = 0x10000,
+};
+
+typedef struct RspConnection RspConnection;
+
+/* Listen on `address`, which is either `[host]:port` or the path of a
+ * unix socket. Only `localhost` and `127.0.0.1` are valid hosts, and
+ * they are the default. Port 0 picks a free port. Returns NULL with
+ * `errno` set on error. */
+RspConnection *listen_rsp (const char *address);
+
+/* Get the address that's listened on, with the port that was picked. */
+const char *rsp_address (const RspConnection * conn);
+
+/* Wait for a client to connect and stop listening. Only one client
+ * is served. Returns `SP_ERR` with `errno` set on error. */
+SprayResult accept_rsp (RspConnection * conn);
+
+/* Close the connection, or stop listening. */
+void close_rsp (RspConnection * conn);
+
+/* Socket of the client. It's ready to be read when the client sent
+ * something. */
+int rsp_fd (const RspConnection * conn);
+
+typedef enum
+{
+  RSP_PACKET,
+  RSP_INTERRUPT,
+  RSP_CLOSED,
+} RspEvent;
+
+/* Wait for the next packet or interrupt. The data of the packet is
+ * stored in `packet` with escapes removed. It's `n_bytes` long, has a
+ * NUL byte after it and is valid until the next packet is read.
+ * Packets that are broken or too big are rejected and skipped. */
+RspEvent read_rsp_packet (RspConnection * conn, const char **packet,
+			  size_t *n_bytes);
+
+/* Read what the client sent without waiting for more. Returns `true`
+ * if it asked to interrupt the target or closed the connection.
+ * Packets that were sent are kept for `read_rsp_packet`. */
+bool poll_rsp_interrupt (RspConnection * conn);
+
+/* Send `n_bytes` of `data` as a packet. Bytes that have a meaning in
+ * the protocol are escaped. Waits for the acknowledgement unless
+ * `stop_rsp_acks` was called. */
+SprayResult send_rsp_packet (RspConnection * conn, const char *data,
+			     size_t n_bytes);
+
+/* Send the string `str` as a packet. */
+SprayResult send_rsp_str (RspConnection * conn, const char *str);
+
+/* Neither send nor expect acknowledgements anymore. This must be
+ * called after the reply to `QStartNoAckMode` was sent. */
+void stop_rsp_acks (RspConnection * conn);
+
+/* Write `n_bytes` of `bytes` to `out` as two hex digits each, which
+ * is how memory and registers are sent. */
+void write_rsp_hex (FILE * out, const void *bytes, size_t n_bytes);
+
+/* Read `n_bytes` from the `2 * n_bytes` hex digits in `hex`. Returns
+ * `SP_ERR` if there aren't that many digits. */
+SprayResult read_rsp_hex (const char *hex, void *bytes, size_t n_bytes);
+
+#endif /* _SPRAY_RSP_H_ */
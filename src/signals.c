@@ -0,0 +1,330 @@
+/* Required to use `sigabbrev_np` */
+#define _GNU_SOURCE
+
+#include "signals.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+struct SignalTable
+{
+  SignalPolicy policies[NSIG];
+};
+
+/* Signals that are passed on to the tracee without stopping it. They
+ * are either sent very often or they're part of the normal operation
+ * of most programs, so stopping on each of them isn't useful. */
+static const int QUIET_SIGNALS[] = {
+  SIGALRM, SIGURG, SIGCHLD, SIGWINCH, SIGIO, SIGVTALRM, SIGPROF,
+};
+
+enum
+{
+  GDB_SIGNAL_UNKNOWN = 143,
+  /* Kernel numbers of the first real-time signals. */
+  SIGNAL_REALTIME_32 = 32,
+  SIGNAL_REALTIME_33 = 33,
+  SIGNAL_REALTIME_34 = 34,
+  SIGNAL_REALTIME_63 = 63,
+  /* GDB's numbers for them. The others are consecutive. */
+  GDB_SIGNAL_REALTIME_32 = 77,
+  GDB_SIGNAL_REALTIME_33 = 45,
+  GDB_SIGNAL_REALTIME_34 = 46,
+};
+
+/* GDB's numbers of the standard signals, which it numbers like
+ * other systems do. `SIGSTKFLT` has no number of its own. */
+static const int GDB_SIGNALS[] = {
+  [SIGHUP] = 1,[SIGINT] = 2,[SIGQUIT] = 3,[SIGILL] = 4,
+  [SIGTRAP] = 5,[SIGABRT] = 6,[SIGBUS] = 10,[SIGFPE] = 8,
+  [SIGKILL] = 9,[SIGUSR1] = 30,[SIGSEGV] = 11,[SIGUSR2] = 31,
+  [SIGPIPE] = 13,[SIGALRM] = 14,[SIGTERM] = 15,
+  [SIGSTKFLT] = GDB_SIGNAL_UNKNOWN,[SIGCHLD] = 20,[SIGCONT] = 19,
+  [SIGSTOP] = 17,[SIGTSTP] = 18,[SIGTTIN] = 21,[SIGTTOU] = 22,
+  [SIGURG] = 16,[SIGXCPU] = 24,[SIGXFSZ] = 25,[SIGVTALRM] = 26,
+  [SIGPROF] = 27,[SIGWINCH] = 28,[SIGIO] = 23,[SIGPWR] = 32,
+  [SIGSYS] = 12,
+};
+
+SignalTable *
+init_signal_table (void)
+{
+  SignalTable *table = calloc (1, sizeof (*table));
+  if (table == NULL)
+    {
+      return NULL;
+    }
+
+  for (int signo = 1; signo < NSIG; signo++)
+    {
+      table->policies[signo] = (SignalPolicy) {
+	.stop = true,.print = true,.pass = true
+      };
+    }
+
+  size_t n_quiet = sizeof (QUIET_SIGNALS) / sizeof (QUIET_SIGNALS[0]);
+  for (size_t i = 0; i < n_quiet; i++)
+    {
+      table->policies[QUIET_SIGNALS[i]] = (SignalPolicy) {
+	.stop = false,.print = false,.pass = true
+      };
+    }
+
+  /* `SIGINT` is usually sent from the terminal to interrupt
+   * the tracee. Passing it on would terminate the tracee. */
+  table->policies[SIGINT].pass = false;
+
+  /* `SIGTRAP` is used by the debugger itself. */
+  table->policies[SIGTRAP].pass = false;
+
+  return table;
+}
+
+void
+free_signal_table (SignalTable *table)
+{
+  free (table);
+}
+
+int
+max_signal (void)
+{
+  return SIGRTMAX;
+}
+
+SignalPolicy
+signal_policy (const SignalTable *table, int signo)
+{
+  assert (table != NULL);
+  assert (signo > 0 && signo < NSIG);
+
+  return table->policies[signo];
+}
+
+void
+set_signal_policy (SignalTable *table, int signo, SignalPolicy policy)
+{
+  assert (table != NULL);
+  assert (signo > 0 && signo < NSIG);
+
+  table->policies[signo] = policy;
+}
+
+SprayResult
+update_signal_policy (SignalPolicy *policy, const char *keyword)
+{
+  assert (policy != NULL);
+  assert (keyword != NULL);
+
+  if (str_eq (keyword, "stop"))
+    {
+      policy->stop = true;
+      policy->print = true;
+    }
+  else if (str_eq (keyword, "nostop"))
+    {
+      policy->stop = false;
+    }
+  else if (str_eq (keyword, "print"))
+    {
+      policy->print = true;
+    }
+  else if (str_eq (keyword, "noprint"))
+    {
+      policy->print = false;
+      policy->stop = false;
+    }
+  else if (str_eq (keyword, "pass") || str_eq (keyword, "noignore"))
+    {
+      policy->pass = true;
+    }
+  else if (str_eq (keyword, "nopass") || str_eq (keyword, "ignore"))
+    {
+      policy->pass = false;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+
+  return SP_OK;
+}
+
+/* Parse the number in `str` and store it in `number`.
+ * Returns `SP_ERR` if `str` isn't only a number. */
+SprayResult
+parse_signal_number (const char *str, int *number)
+{
+  char *str_end = NULL;
+  long value = strtol (str, &str_end, 10);
+  if (str[0] == '\0' || *str_end != '\0' || value < 0 || value >= NSIG)
+    {
+      return SP_ERR;
+    }
+
+  *number = (int) value;
+  return SP_OK;
+}
+
+/* Parse the name of a real-time signal without the `SIG` prefix. */
+SprayResult
+parse_realtime_signal (const char *name, int *signo)
+{
+  int offset = 0;
+  int number = 0;
+
+  if (strncasecmp (name, "RTMIN", 5) == 0)
+    {
+      if (name[5] != '\0'
+	  && (name[5] != '+'
+	      || parse_signal_number (&name[6], &offset) == SP_ERR))
+	{
+	  return SP_ERR;
+	}
+      number = SIGRTMIN + offset;
+    }
+  else if (strncasecmp (name, "RTMAX", 5) == 0)
+    {
+      if (name[5] != '\0'
+	  && (name[5] != '-'
+	      || parse_signal_number (&name[6], &offset) == SP_ERR))
+	{
+	  return SP_ERR;
+	}
+      number = SIGRTMAX - offset;
+    }
+  else
+    {
+      return SP_ERR;
+    }
+
+  if (number < SIGRTMIN || number > SIGRTMAX)
+    {
+      return SP_ERR;
+    }
+
+  *signo = number;
+  return SP_OK;
+}
+
+SprayResult
+parse_signal (const char *str, int *signo)
+{
+  assert (str != NULL);
+  assert (signo != NULL);
+
+  int number = 0;
+  if (parse_signal_number (str, &number) == SP_OK)
+    {
+      if (number == 0 || number > SIGRTMAX)
+	{
+	  return SP_ERR;
+	}
+      *signo = number;
+      return SP_OK;
+    }
+
+  const char *name = str;
+  if (strncasecmp (name, "SIG", 3) == 0)
+    {
+      name += 3;
+    }
+
+  if (parse_realtime_signal (name, signo) == SP_OK)
+    {
+      return SP_OK;
+    }
+
+  for (int i = 1; i < SIGRTMIN; i++)
+    {
+      const char *abbrev = sigabbrev_np (i);
+      if (abbrev != NULL && strcasecmp (abbrev, name) == 0)
+	{
+	  *signo = i;
+	  return SP_OK;
+	}
+    }
+
+  return SP_ERR;
+}
+
+void
+signal_name (int signo, char buf[SIGNAL_NAME_BUF_SIZE])
+{
+  assert (buf != NULL);
+
+  const char *abbrev = sigabbrev_np (signo);
+
+  if (signo == SIGRTMIN)
+    {
+      snprintf (buf, SIGNAL_NAME_BUF_SIZE, "RTMIN");
+    }
+  else if (signo == SIGRTMAX)
+    {
+      snprintf (buf, SIGNAL_NAME_BUF_SIZE, "RTMAX");
+    }
+  else if (signo > SIGRTMIN && signo < SIGRTMAX)
+    {
+      /* Name them relative to the closer end like `kill -l` does. */
+      if (signo - SIGRTMIN <= (SIGRTMAX - SIGRTMIN) / 2)
+	{
+	  snprintf (buf, SIGNAL_NAME_BUF_SIZE, "RTMIN+%d", signo - SIGRTMIN);
+	}
+      else
+	{
+	  snprintf (buf, SIGNAL_NAME_BUF_SIZE, "RTMAX-%d", SIGRTMAX - signo);
+	}
+    }
+  else if (abbrev != NULL)
+    {
+      snprintf (buf, SIGNAL_NAME_BUF_SIZE, "%s", abbrev);
+    }
+  else
+    {
+      snprintf (buf, SIGNAL_NAME_BUF_SIZE, "%d", signo);
+    }
+}
+
+int
+gdb_signal_from_signo (int signo)
+{
+  if (signo >= 0
+      && (size_t) signo < sizeof (GDB_SIGNALS) / sizeof (*GDB_SIGNALS))
+    {
+      return GDB_SIGNALS[signo];
+    }
+  else if (signo == SIGNAL_REALTIME_32)
+    {
+      return GDB_SIGNAL_REALTIME_32;
+    }
+  else if (signo == SIGNAL_REALTIME_33)
+    {
+      return GDB_SIGNAL_REALTIME_33;
+    }
+  else if (signo >= SIGNAL_REALTIME_34 && signo <= SIGNAL_REALTIME_63)
+    {
+      return GDB_SIGNAL_REALTIME_34 + (signo - SIGNAL_REALTIME_34);
+    }
+  else
+    {
+      return GDB_SIGNAL_UNKNOWN;
+    }
+}
+
+int
+signo_from_gdb_signal (int gdb_signo)
+{
+  for (int signo = 0; signo <= SIGNAL_REALTIME_63; signo++)
+    {
+      if (gdb_signal_from_signo (signo) == gdb_signo
+	  && gdb_signo != GDB_SIGNAL_UNKNOWN)
+	{
+	  return signo;
+	}
+    }
+  return 0;
+}
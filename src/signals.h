@@ -0,0 +1,66 @@
+/* Decide what happens when the tracee receives a signal. Each
+ * signal has a policy that says whether the tracee is stopped,
+ * whether a message is printed, and whether the signal is passed
+ * on to the tracee. Signals that don't stop the tracee are handled
+ * without returning to the REPL. */
+
+#pragma once
+
+#ifndef _SPRAY_SIGNALS_H_
+#define _SPRAY_SIGNALS_H_
+
+#include "magic.h"
+
+#include <stdbool.h>
+
+typedef struct
+{
+  bool stop;			/* Stop the tracee and return to the REPL. */
+  bool print;			/* Print a message when the signal arrives. */
+  bool pass;			/* Deliver the signal to the tracee. */
+} SignalPolicy;
+
+typedef struct SignalTable SignalTable;
+
+/* Create a table with the default policies. Signals that programs
+ * commonly use for timers, I/O and children, e.g. `SIGALRM`, are
+ * passed on silently. `SIGINT` stops the tracee and isn't passed
+ * on. All other signals stop the tracee and are passed on. */
+SignalTable *init_signal_table (void);
+
+void free_signal_table (SignalTable * table);
+
+/* Get the policy for `signo`. */
+SignalPolicy signal_policy (const SignalTable * table, int signo);
+
+void set_signal_policy (SignalTable * table, int signo, SignalPolicy policy);
+
+/* Change `policy` according to `keyword`, which is one of `stop`,
+ * `nostop`, `print`, `noprint`, `pass`, `nopass`, `ignore` (same as
+ * `nopass`) or `noignore` (same as `pass`). `stop` implies `print`
+ * and `noprint` implies `nostop`. Returns `SP_ERR` if the keyword
+ * is unknown. */
+SprayResult update_signal_policy (SignalPolicy * policy, const char *keyword);
+
+/* Parse a signal name like `SIGALRM` or `ALRM`, a real-time signal
+ * like `SIGRTMIN+2`, or a signal number. Returns `SP_ERR` if `str`
+ * doesn't name a signal. */
+SprayResult parse_signal (const char *str, int *signo);
+
+/* Write the name of `signo` without the `SIG` prefix, e.g. `ALRM`
+ * or `RTMIN+2`, to `buf`. */
+void signal_name (int signo, char buf[SIGNAL_NAME_BUF_SIZE]);
+
+/* Translate `signo` to the number that GDB's remote protocol uses
+ * for the signal. Signals that GDB doesn't know become its
+ * `GDB_SIGNAL_UNKNOWN`. */
+int gdb_signal_from_signo (int signo);
+
+/* Translate a signal number of GDB's remote protocol to the number
+ * of the signal. Returns 0 if there is no such signal. */
+int signo_from_gdb_signal (int gdb_signo);
+
+/* Number of the last signal. Valid signal numbers start at 1. */
+int max_signal (void);
+
+#endif /* _SPRAY_SIGNALS_H_ */
@@ -4,6 +4,12 @@
 
 #define SET_ARGS_ONCE
 #include "args.h"
+#include "stats.h"
+#include "symbolize.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 int
 setup_args (int argc, char **argv)
@@ -22,25 +28,198 @@ setup_args (int argc, char **argv)
     }
 }
 
+enum
+{
+  /* Size of the buffer of `stdout` while running a script. */
+  SCRIPT_OUTPUT_BUF_SIZE = 1 << 16,
+};
+
+/* Keep the original `stdin` and `stdout` for the Debug Adapter
+ * Protocol. They're replaced by `/dev/null` and `stderr` so that
+ * neither the tracee nor the debugger can mess up the messages.
+ * This must happen before the tracee is started. */
+SprayResult
+open_dap_streams (FILE **in, FILE **out)
+{
+  int in_fd = fcntl (STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+  int out_fd = fcntl (STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  int null_fd = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (in_fd == -1 || out_fd == -1 || null_fd == -1
+      || dup2 (null_fd, STDIN_FILENO) == -1
+      || dup2 (STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+      return SP_ERR;
+    }
+  close (null_fd);
+
+  *in = fdopen (in_fd, "r");
+  *out = fdopen (out_fd, "w");
+  return *in != NULL && *out != NULL ? SP_OK : SP_ERR;
+}
+
+/* Run `spray symbolize file [--inlines]`. No tracee is started. */
+int
+run_symbolize_command (int argc, char **argv)
+{
+  const char *filepath = NULL;
+  bool inlines = false;
+  for (int i = 2; i < argc; i++)
+    {
+      if (str_eq (argv[i], "--inlines"))
+	{
+	  inlines = true;
+	}
+      else if (filepath == NULL)
+	{
+	  filepath = argv[i];
+	}
+      else
+	{
+	  filepath = NULL;
+	  break;
+	}
+    }
+
+  if (filepath == NULL)
+    {
+      print_help_message (prog_name_arg (argc, argv));
+      return -1;
+    }
+
+  Symbolizer *sym = init_symbolizer (filepath);
+  if (sym == NULL)
+    {
+      spray_err ("Failed to read the debug information of %s", filepath);
+      return -1;
+    }
+
+  int ret = 0;
+  if (run_symbolizer (sym, inlines, STDIN_FILENO, stdout) == SP_ERR)
+    {
+      spray_err ("Failed to symbolize the addresses");
+      ret = -1;
+    }
+
+  free_symbolizer (sym);
+  return ret;
+}
+
 int
 main (int argc, char **argv)
 {
+  if (argc > 1 && str_eq (argv[1], "symbolize"))
+    {
+      return run_symbolize_command (argc, argv);
+    }
+
   if (setup_args (argc, argv) == -1)
     {
       return -1;
     }
 
+  /* Output of scripts is read by other programs, so there is
+   * no need to write it out line by line. This must happen
+   * before anything is printed. */
+  if (get_args ()->flags.script != NULL)
+    {
+      setvbuf (stdout, NULL, _IOFBF, SCRIPT_OUTPUT_BUF_SIZE);
+    }
+
+  /* Recording must start before the thread that
+   * loads the debug information is started. */
+  const char *trace_filepath = get_args ()->flags.trace_internal;
+  if (trace_filepath != NULL && start_trace (trace_filepath) == SP_ERR)
+    {
+      spray_err ("Failed to open %s to write the trace to", trace_filepath);
+      return -1;
+    }
+
+  FILE *dap_in = NULL;
+  FILE *dap_out = NULL;
+  if (get_args ()->flags.dap && open_dap_streams (&dap_in, &dap_out) == SP_ERR)
+    {
+      spray_err ("Failed to set up the streams for the Debug Adapter "
+		 "Protocol");
+      return -1;
+    }
+
   Debugger debugger;
+  pid_t attach_pid = get_args ()->flags.attach_pid;
+  char exe_filepath[PROC_PID_FILEPATH_LEN];
+
+  if (get_args ()->flags.core != NULL)
+    {
+      if (open_core_debugger (get_args ()->file, get_args ()->flags.core,
+			      &debugger) == -1)
+	{
+	  return -1;
+	}
+    }
+  else if (attach_pid != 0)
+    {
+      /* Default to the executable that the process runs. */
+      const char *prog_name = get_args ()->file;
+      if (prog_name == NULL)
+	{
+	  snprintf (exe_filepath, PROC_PID_FILEPATH_LEN, "/proc/%d/exe",
+		    attach_pid);
+	  prog_name = exe_filepath;
+	}
 
-  if (setup_debugger (get_args ()->file, get_args ()->args, &debugger) == -1)
+      if (attach_debugger (prog_name, attach_pid, &debugger) == -1)
+	{
+	  return -1;
+	}
+    }
+  else if (setup_debugger (get_args ()->file, get_args ()->args, &debugger)
+	   == -1)
     {
       return -1;
     }
 
-  run_debugger (debugger);
+  int ret = 0;
+
+  if (get_args ()->flags.coverage != NULL)
+    {
+      if (run_coverage (debugger, get_args ()->flags.coverage) == SP_ERR)
+	ret = -1;
+    }
+  else if (get_args ()->flags.script != NULL)
+    {
+      if (run_script (debugger, get_args ()->flags.script,
+		      get_args ()->flags.json) == SP_ERR)
+	ret = -1;
+    }
+  else if (get_args ()->flags.dap)
+    {
+      if (run_dap (debugger, dap_in, dap_out) == SP_ERR)
+	ret = -1;
+    }
+  else if (get_args ()->flags.gdbserver != NULL)
+    {
+      if (run_gdbserver (debugger, get_args ()->flags.gdbserver) == SP_ERR)
+	ret = -1;
+    }
+  else
+    {
+      run_debugger (debugger);
+    }
+
+  if (get_args ()->flags.stats)
+    {
+      print_stats (stderr);
+    }
 
   if (del_debugger (debugger) == SP_ERR)
-    return -1;
+    ret = -1;
+
+  /* The debug information has been freed, so no
+   * other thread records spans anymore. */
+  if (finish_trace () == SP_ERR)
+    {
+      spray_err ("Failed to write the trace to %s", trace_filepath);
+      ret = -1;
+    }
 
-  return 0;
+  return ret;
 }
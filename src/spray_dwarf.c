@@ -1,7 +1,12 @@
 #include "spray_dwarf.h"
 
+#include "debug_info.h"
+#include "debug_line.h"
+#include "hashmap.h"
 #include "magic.h"
 #include "registers.h"		/* For evaluating location expressions. */
+#include "stats.h"
+#include "trace.h"
 
 #include <dwarf.h>
 #include <stdlib.h>
@@ -9,6 +14,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 
 /* NOTE: The function prefix `sd_` stands for 'Spray DWARF' and
@@ -134,6 +140,7 @@ sd_search_dwarf_die (Dwarf_Debug dbg,
   };
 
   /* Search self. */
+  add_stat (STAT_DIE_VISITS, 1);
   bool in_die_found =
     search_callback (dbg, in_die, search_for, search_findings);
   if (in_die_found)
@@ -197,6 +204,7 @@ sd_search_dwarf_die (Dwarf_Debug dbg,
       else if (res == DW_DLV_OK)
 	{
 	  cur_die = sib_die;
+	  add_stat (STAT_DIE_VISITS, 1);
 	  bool sib_die_found =
 	    search_callback (dbg, sib_die, search_for, search_findings);
 	  if (sib_die_found)
@@ -212,10 +220,10 @@ sd_search_dwarf_die (Dwarf_Debug dbg,
  * `search_callback` returns `true`, the search ends. If it returns `false`,
  * the search goes on. */
 int
-sd_search_dwarf_dbg (Dwarf_Debug dbg,
-		     Dwarf_Error *const error,
-		     SearchCallback search_callback,
-		     const void *search_for_data, void *search_findings_data)
+search_dwarf_dbg (Dwarf_Debug dbg,
+		  Dwarf_Error *const error,
+		  SearchCallback search_callback,
+		  const void *search_for_data, void *search_findings_data)
 {
   Dwarf_Half version_stamp = 0;	/* Store version number (2 - 5). */
   /* .debug_abbrev offset from CU just read. */
@@ -320,6 +328,19 @@ sd_search_dwarf_dbg (Dwarf_Debug dbg,
     }
 }
 
+int
+sd_search_dwarf_dbg (Dwarf_Debug dbg,
+		     Dwarf_Error *const error,
+		     SearchCallback search_callback,
+		     const void *search_for_data, void *search_findings_data)
+{
+  TraceSpan span = begin_span ("dwarf");
+  int res = search_dwarf_dbg (dbg, error, search_callback,
+			      search_for_data, search_findings_data);
+  end_span (span, "sd_search_dwarf_dbg", NULL);
+  return res;
+}
+
 int
 sd_get_high_and_low_pc (Dwarf_Die die,
 			Dwarf_Error *error,
@@ -567,6 +588,7 @@ sd_get_line_context (Dwarf_Debug dbg, Dwarf_Die cu_die,
   Dwarf_Line_Context line_context_buf = NULL;
   Dwarf_Error error = NULL;
 
+  add_stat (STAT_LINE_TABLE_DECODES, 1);
   res = dwarf_srclines_b (cu_die,
 			  &line_table_version, &line_table_count,
 			  &line_context_buf, &error);
@@ -596,6 +618,7 @@ typedef struct
   bool is_set;
   LineEntry *lines;
   unsigned n_lines;
+  /* NULL if the table wasn't decoded by libdwarf. */
   Dwarf_Line_Context line_context;
 } LineTable;
 
@@ -615,7 +638,10 @@ sd_free_line_table (LineTable *line_table)
 {
   assert (line_table != NULL);
   free (line_table->lines);
-  dwarf_srclines_dealloc_b (line_table->line_context);
+  if (line_table->line_context != NULL)
+    {
+      dwarf_srclines_dealloc_b (line_table->line_context);
+    }
   *line_table = (LineTable) {0};
 }
 
@@ -665,6 +691,14 @@ sd_line_entry_from_dwarf_line (Dwarf_Line line,
   Dwarf_Bool new_statement = false;
   res = dwarf_linebeginstatement (line, &new_statement, error);
 
+  if (res != DW_DLV_OK)
+    {
+      return res;
+    }
+
+  Dwarf_Bool end_sequence = false;
+  res = dwarf_lineendsequence (line, &end_sequence, error);
+
   if (res != DW_DLV_OK)
     {
       return res;
@@ -689,6 +723,7 @@ sd_line_entry_from_dwarf_line (Dwarf_Line line,
   line_entry->is_ok = true;
   line_entry->new_statement = dwarf_bool_to_bool (new_statement);
   line_entry->prologue_end = dwarf_bool_to_bool (prologue_end);
+  line_entry->end_sequence = dwarf_bool_to_bool (end_sequence);
   /* `false` by default. Might be set by `sd_line_entry_from_pc`. */
   line_entry->is_exact = false;
   line_entry->ln = lineno;
@@ -701,6 +736,362 @@ sd_line_entry_from_dwarf_line (Dwarf_Line line,
   return DW_DLV_OK;
 }
 
+enum
+{
+  NATIVE_SECTIONS_ALLOC_SIZE = 4,
+};
+
+typedef struct
+{
+  Dwarf_Debug dbg;
+  bool has_line;
+  DlSections line;
+  bool has_info;
+  DiSections info;
+  /* File paths of all line tables that were decoded.
+   * Line entries point to them until the sections are
+   * cleared, like they would point to libdwarf's file
+   * paths until the `Dwarf_Debug` instance is freed. */
+  struct hashmap *filepaths;
+  /* Guards `filepaths`, so that tables of different
+   * instances are decoded without waiting for each other. */
+  pthread_mutex_t filepaths_lock;
+} NativeSections;
+
+typedef struct
+{
+  char *filepath;
+} InternedPath;
+
+int
+interned_path_compare (const void *a, const void *b, void *udata)
+{
+  unused (udata);
+  return strcmp (((InternedPath *) a)->filepath,
+		 ((InternedPath *) b)->filepath);
+}
+
+uint64_t
+interned_path_hash (const void *entry, uint64_t seed0, uint64_t seed1)
+{
+  const char *filepath = ((InternedPath *) entry)->filepath;
+  return hashmap_sip (filepath, strlen (filepath), seed0, seed1);
+}
+
+void
+free_native_sections (NativeSections *native)
+{
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (native->filepaths, &iter, &item))
+    {
+      free (((InternedPath *) item)->filepath);
+    }
+  hashmap_free (native->filepaths);
+  pthread_mutex_destroy (&native->filepaths_lock);
+  free (native);
+}
+
+/* libdwarf doesn't give access to the bytes of the sections, and
+ * a `Dwarf_Debug` instance can't carry any data of its own. So the
+ * sections are looked up by the instance they belong to. Decoding
+ * only takes the lock for reading, and clearing the sections waits
+ * until no table of them is decoded anymore. */
+static pthread_rwlock_t native_sections_lock = PTHREAD_RWLOCK_INITIALIZER;
+static NativeSections **native_sections = NULL;
+static size_t n_native_sections = 0;
+
+/* Must be called with `native_sections_lock` held. */
+size_t
+find_native_sections (Dwarf_Debug dbg)
+{
+  size_t i = 0;
+  while (i < n_native_sections && native_sections[i]->dbg != dbg)
+    {
+      i++;
+    }
+  return i;
+}
+
+SprayResult
+sd_set_sections (Dwarf_Debug dbg, const ElfFile *elf)
+{
+  assert (dbg != NULL);
+  assert (elf != NULL);
+
+  DlSections line = { 0 };
+  DiSections info = { 0 };
+  bool has_line = dl_sections (elf, &line) == SP_OK;
+  bool has_info = di_sections (elf, &info) == SP_OK;
+  if (!has_line && !has_info)
+    {
+      return SP_ERR;
+    }
+
+  pthread_rwlock_wrlock (&native_sections_lock);
+  size_t i = find_native_sections (dbg);
+  if (i == n_native_sections)
+    {
+      if (n_native_sections % NATIVE_SECTIONS_ALLOC_SIZE == 0)
+	{
+	  native_sections =
+	    realloc (native_sections, sizeof (*native_sections)
+		     * (n_native_sections + NATIVE_SECTIONS_ALLOC_SIZE));
+	  assert (native_sections != NULL);
+	}
+
+      NativeSections *native = calloc (1, sizeof (NativeSections));
+      assert (native != NULL);
+      native->dbg = dbg;
+      native->filepaths =
+	hashmap_new (sizeof (InternedPath), 0, 0, 0, interned_path_hash,
+		     interned_path_compare, NULL, NULL);
+      assert (native->filepaths != NULL);
+      pthread_mutex_init (&native->filepaths_lock, NULL);
+      native_sections[n_native_sections++] = native;
+    }
+
+  NativeSections *native = native_sections[i];
+  native->has_line = has_line;
+  native->line = line;
+  native->has_info = has_info;
+  native->info = info;
+  pthread_rwlock_unlock (&native_sections_lock);
+
+  return SP_OK;
+}
+
+void
+sd_clear_sections (Dwarf_Debug dbg)
+{
+  pthread_rwlock_wrlock (&native_sections_lock);
+  size_t i = find_native_sections (dbg);
+  if (i < n_native_sections)
+    {
+      free_native_sections (native_sections[i]);
+      native_sections[i] = native_sections[--n_native_sections];
+    }
+  if (n_native_sections == 0)
+    {
+      free (native_sections);
+      native_sections = NULL;
+    }
+  pthread_rwlock_unlock (&native_sections_lock);
+}
+
+/* Get the sections of `dbg` and keep them from being cleared
+ * until `unlock_native_sections` is called. Returns NULL if
+ * they aren't set. The lock must be released in either case. */
+NativeSections *
+lock_native_sections (Dwarf_Debug dbg)
+{
+  pthread_rwlock_rdlock (&native_sections_lock);
+  size_t i = find_native_sections (dbg);
+  return i < n_native_sections ? native_sections[i] : NULL;
+}
+
+void
+unlock_native_sections (void)
+{
+  pthread_rwlock_unlock (&native_sections_lock);
+}
+
+bool
+get_line_sections (Dwarf_Debug dbg, DlSections *sections)
+{
+  NativeSections *native = lock_native_sections (dbg);
+  bool is_set = native != NULL && native->has_line;
+  if (is_set)
+    {
+      *sections = native->line;
+    }
+  unlock_native_sections ();
+  return is_set;
+}
+
+bool
+get_info_sections (Dwarf_Debug dbg, DiSections *sections)
+{
+  NativeSections *native = lock_native_sections (dbg);
+  bool is_set = native != NULL && native->has_info;
+  if (is_set)
+    {
+      *sections = native->info;
+    }
+  unlock_native_sections ();
+  return is_set;
+}
+
+/* Intern callback of the native decoder. Returns the copy of
+ * `filepath` that's kept in the `NativeSections` in `data`.
+ * The copy is made if there is none yet. */
+char *
+intern_filepath (char *filepath, void *data)
+{
+  NativeSections *native = data;
+  pthread_mutex_lock (&native->filepaths_lock);
+  const InternedPath *found =
+    hashmap_get (native->filepaths, &(InternedPath) {.filepath = filepath});
+  if (found != NULL)
+    {
+      free (filepath);
+      filepath = found->filepath;
+    }
+  else
+    {
+      hashmap_set (native->filepaths,
+		   &(InternedPath) {.filepath = filepath});
+    }
+  pthread_mutex_unlock (&native->filepaths_lock);
+  return filepath;
+}
+
+/* Decode the line table of `cu_die` without libdwarf. Must
+ * be called while the sections in `native` are locked. */
+bool
+native_line_table (Dwarf_Debug dbg, Dwarf_Die cu_die,
+		   NativeSections *native, LineTable *line_table)
+{
+  Dwarf_Error error = NULL;
+  Dwarf_Attribute stmt_list = NULL;
+  Dwarf_Off offset = 0;
+  int res = dwarf_attr (cu_die, DW_AT_stmt_list, &stmt_list, &error);
+  if (res == DW_DLV_OK)
+    {
+      res = dwarf_global_formref (stmt_list, &offset, &error);
+      dwarf_dealloc_attribute (stmt_list);
+    }
+
+  /* Don't free this string. It's owned by `dbg`. */
+  char *comp_dir = NULL;
+  if (res == DW_DLV_OK)
+    {
+      res = dwarf_die_text (cu_die, DW_AT_comp_dir, &comp_dir, &error);
+      if (res == DW_DLV_NO_ENTRY)
+	{
+	  res = DW_DLV_OK;
+	}
+    }
+
+  if (res != DW_DLV_OK)
+    {
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  add_stat (STAT_LINE_TABLE_DECODES, 1);
+  DlLineTable native_table = { 0 };
+  if (dl_decode_line_table (&native->line, offset, comp_dir,
+			    intern_filepath, native,
+			    &native_table) == SP_ERR)
+    {
+      dl_free_line_table (&native_table);
+      return false;
+    }
+
+  /* The rows are the line entries already. Only
+   * give back the room that was reserved for more. */
+  size_t n_rows = native_table.n_rows;
+  LineEntry *lines = realloc (native_table.rows, sizeof (LineEntry)
+			      * (n_rows > 0 ? n_rows : 1));
+  assert (lines != NULL);
+  native_table.rows = NULL;
+  dl_free_line_table (&native_table);
+
+  *line_table = (LineTable)
+  {
+    .is_set = true,
+    .lines = lines,
+    .n_lines = n_rows,
+  };
+  return true;
+}
+
+/* Decode the line table of `cu_die` using libdwarf. */
+bool
+libdwarf_line_table (Dwarf_Debug dbg, Dwarf_Die cu_die,
+		     LineTable *line_table)
+{
+  Dwarf_Line_Context line_context = NULL;
+  if (!sd_get_line_context (dbg, cu_die, &line_context))
+    {
+      return false;
+    }
+
+  Dwarf_Error error = NULL;
+  Dwarf_Line *lines = NULL;
+  Dwarf_Signed n_lines = 0;
+
+  int res = dwarf_srclines_from_linecontext (line_context,
+					     &lines, &n_lines, &error);
+
+  if (res != DW_DLV_OK)
+    {
+      dwarf_srclines_dealloc_b (line_context);
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  LineEntry *line_entries = calloc (n_lines > 0 ? n_lines : 1,
+				    sizeof (LineEntry));
+  assert (line_entries != NULL);
+
+  for (Dwarf_Signed i = 0; i < n_lines; i++)
+    {
+      res = sd_line_entry_from_dwarf_line (lines[i],
+					   &line_entries[i], &error);
+
+      if (res != DW_DLV_OK)
+	{
+	  if (res == DW_DLV_ERROR)
+	    {
+	      dwarf_dealloc_error (dbg, error);
+	    }
+	  /* Also free buffers on error. */
+	  free (line_entries);
+	  dwarf_srclines_dealloc_b (line_context);
+	  return false;
+	}
+
+      /* Must be the case if `res != DW_DLV_OK` */
+      assert (line_entries[i].is_ok);
+    }
+
+  *line_table = (LineTable)
+  {
+    .is_set = true,
+    .lines = line_entries,
+    .n_lines = n_lines,
+    .line_context = line_context,
+  };
+  return true;
+}
+
+/* Get the line table of the CU `cu_die`. It's decoded straight
+ * from the ELF file if its sections were set and the decoder
+ * supports it. Otherwise libdwarf decodes it. */
+bool
+sd_get_cu_line_table (Dwarf_Debug dbg, Dwarf_Die cu_die,
+		      LineTable *line_table)
+{
+  assert (dbg != NULL);
+  assert (cu_die != NULL);
+  assert (line_table != NULL);
+
+  NativeSections *native = lock_native_sections (dbg);
+  bool is_set = native != NULL && native->has_line
+    && native_line_table (dbg, cu_die, native, line_table);
+  unlock_native_sections ();
+
+  return is_set || libdwarf_line_table (dbg, cu_die, line_table);
+}
+
 bool
 sd_has_at (Dwarf_Debug dbg, Dwarf_Die die, Dwarf_Half attrnum)
 {
@@ -1901,6 +2292,113 @@ sd_runtime_variable (Dwarf_Debug dbg,
     }
 }
 
+typedef struct
+{
+  bool in_scope;
+  unsigned scope_level;
+  char **names;
+  size_t n_names;
+} ScopeVarsSearchFindings;
+
+/* Search callback used in combination with `sd_search_dwarf_die`
+ * that collects the names of all variables and formal parameters
+ * in the scope of the subprogram around a PC. The scope is tracked
+ * in the same way as in `callback__find_runtime_variable`. */
+bool
+callback__collect_scope_variables (Dwarf_Debug dbg,
+				   Dwarf_Die die,
+				   SearchFor search_for,
+				   SearchFindings search_findings)
+{
+  const dbg_addr *pc = (const dbg_addr *) search_for.data;
+  ScopeVarsSearchFindings *findings =
+    (ScopeVarsSearchFindings *) search_findings.data;
+  Dwarf_Error error = NULL;
+
+  if (!(search_for.level > findings->scope_level))
+    {
+      findings->in_scope = false;
+    }
+
+  if (sd_has_tag (dbg, die, DW_TAG_subprogram))
+    {
+      bool in_scope = false;
+      int res = sd_check_pc_in_die (die, &error, pc->value, &in_scope);
+      if (res == DW_DLV_OK && in_scope)
+	{
+	  findings->in_scope = true;
+	  findings->scope_level = search_for.level;
+	}
+      else if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  if (findings->in_scope
+      && (sd_has_tag (dbg, die, DW_TAG_variable)
+	  || sd_has_tag (dbg, die, DW_TAG_formal_parameter))
+      && sd_has_at (dbg, die, DW_AT_location))
+    {
+      /* Don't free the string returned by `dwarf_diename`. */
+      char *name = NULL;
+      int res = dwarf_diename (die, &name, &error);
+      if (res == DW_DLV_OK)
+	{
+	  char **grown = realloc (findings->names,
+				  (findings->n_names + 1) * sizeof (*grown));
+	  assert (grown != NULL);
+	  findings->names = grown;
+	  findings->names[findings->n_names] = strdup (name);
+	  assert (findings->names[findings->n_names] != NULL);
+	  findings->n_names++;
+	}
+      else if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+    }
+
+  /* Keep on searching to find all variables. */
+  return false;
+}
+
+SprayResult
+sd_scope_variable_names (Dwarf_Debug dbg,
+			 dbg_addr pc, char ***names, size_t *n_names)
+{
+  assert (dbg != NULL);
+  assert (names != NULL);
+  assert (n_names != NULL);
+
+  Dwarf_Error error = NULL;
+  ScopeVarsSearchFindings search_findings = { 0 };
+
+  int res = sd_search_dwarf_dbg (dbg,
+				 &error,
+				 callback__collect_scope_variables,
+				 &pc,
+				 &search_findings);
+
+  /* The search never ends early, so it always
+   * returns `DW_DLV_NO_ENTRY` unless it failed. */
+  if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+      for (size_t i = 0; i < search_findings.n_names; i++)
+	{
+	  free (search_findings.names[i]);
+	}
+      free (search_findings.names);
+      return SP_ERR;
+    }
+
+  *names = search_findings.names;
+  *n_names = search_findings.n_names;
+  return SP_OK;
+}
+
 #ifndef UNIT_TESTS
 
 typedef Dwarf_Small SdOperator;
@@ -2482,7 +2980,7 @@ is_active_range (SdLocRange range, dbg_addr _pc)
 }
 
 SprayResult
-sd_init_loclist (Dwarf_Debug dbg, SdLocattr loc_attr, SdLoclist *loclist)
+init_loclist (Dwarf_Debug dbg, SdLocattr loc_attr, SdLoclist *loclist)
 {
   assert (dbg != NULL);
   assert (loclist != NULL);
@@ -2616,6 +3114,15 @@ sd_init_loclist (Dwarf_Debug dbg, SdLocattr loc_attr, SdLoclist *loclist)
     }
 }
 
+SprayResult
+sd_init_loclist (Dwarf_Debug dbg, SdLocattr loc_attr, SdLoclist *loclist)
+{
+  TraceSpan span = begin_span ("dwarf");
+  SprayResult res = init_loclist (dbg, loc_attr, loclist);
+  end_span (span, "sd_init_loclist", NULL);
+  return res;
+}
+
 void
 del_loclist (SdLoclist *loclist)
 {
@@ -2841,7 +3348,14 @@ sd_eval_op_fbreg (Dwarf_Debug dbg,
   if (location.tag == LOC_REG)
     {
       uint64_t base_addr = 0;
-      res = get_register_value (ctx.pid, location.reg, &base_addr);
+      if (ctx.regs != NULL)
+	{
+	  res = frame_reg_value (ctx.regs, location.reg, &base_addr);
+	}
+      else
+	{
+	  res = get_register_value (ctx.pid, location.reg, &base_addr);
+	}
       if (res == SP_ERR)
 	{
 	  return SP_ERR;
@@ -3160,9 +3674,6 @@ callback__get_srclines (Dwarf_Debug dbg,
   const char *filepath = (const char *) search_for.data;
   LineTable *line_table = (LineTable *) search_findings.data;
 
-  int res = DW_DLV_OK;
-  Dwarf_Error error = NULL;
-
   /* Is this DIE a CU DIE? */
   if (!sd_has_tag (dbg, cu_die, DW_TAG_compile_unit))
     {
@@ -3175,57 +3686,7 @@ callback__get_srclines (Dwarf_Debug dbg,
       return false;
     }
 
-  Dwarf_Line_Context line_context = NULL;
-  if (!sd_get_line_context (dbg, cu_die, &line_context))
-    {
-      return false;
-    }
-
-  Dwarf_Line *lines = NULL;
-  Dwarf_Signed n_lines = 0;
-
-  res = dwarf_srclines_from_linecontext (line_context,
-					 &lines, &n_lines, &error);
-
-  if (res != DW_DLV_OK)
-    {
-      dwarf_srclines_dealloc_b (line_context);
-      if (res == DW_DLV_ERROR)
-	{
-	  dwarf_dealloc_error (dbg, error);
-	}
-      return false;
-    }
-  else
-    {
-      LineEntry *line_entries = calloc (n_lines, sizeof (LineEntry));
-
-      for (unsigned i = 0; i < n_lines; i++)
-	{
-	  res = sd_line_entry_from_dwarf_line (lines[i],
-					       &line_entries[i], &error);
-
-	  if (res != DW_DLV_OK)
-	    {
-	      if (res == DW_DLV_ERROR)
-		{
-		  dwarf_dealloc_error (dbg, error);
-		}
-	      /* Also free buffer on error. */
-	      free (line_entries);
-	      return false;
-	    }
-
-	  /* Must be the case if `res != DW_DLV_OK` */
-	  assert (line_entries[i].is_ok);
-	}
-
-      line_table->lines = line_entries;
-      line_table->n_lines = n_lines;
-      line_table->line_context = line_context;
-      line_table->is_set = true;
-      return true;
-    }
+  return sd_get_cu_line_table (dbg, cu_die, line_table);
 }
 
 LineTable
@@ -3238,9 +3699,11 @@ sd_get_line_table (Dwarf_Debug dbg, const char *filepath)
 
   LineTable line_table = { 0 };
 
+  TraceSpan span = begin_span ("dwarf");
   int res = sd_search_dwarf_dbg (dbg, &error,
 				 callback__get_srclines,
 				 filepath, &line_table);
+  end_span (span, "sd_get_line_table", "%s", filepath);
 
   if (res != DW_DLV_OK)
     {
@@ -3531,6 +3994,986 @@ sd_for_each_line (Dwarf_Debug dbg, const char *fn_name,
   return SP_OK;
 }
 
+typedef struct
+{
+  LineCallback callback;
+  void *data;
+  SprayResult res;
+  /* Also pass rows that aren't statements or end a sequence. */
+  bool is_every_row;
+} StatementCallbackData;
+
+/* Search callback that calls the line callback in `search_findings`
+ * on each new statement row in the line table of every CU DIE. */
+bool
+callback__for_each_statement (Dwarf_Debug dbg,
+			      Dwarf_Die cu_die,
+			      SearchFor search_for,
+			      SearchFindings search_findings)
+{
+  unused (search_for);
+
+  StatementCallbackData *data =
+    (StatementCallbackData *) search_findings.data;
+
+  if (!sd_has_tag (dbg, cu_die, DW_TAG_compile_unit))
+    {
+      return false;
+    }
+
+  LineTable line_table = { 0 };
+  if (!sd_get_cu_line_table (dbg, cu_die, &line_table))
+    {
+      return false;
+    }
+
+  for (unsigned i = 0; i < line_table.n_lines; i++)
+    {
+      LineEntry *line = &line_table.lines[i];
+      if (data->is_every_row || (line->new_statement && !line->end_sequence))
+	{
+	  if (data->callback (line, data->data) == SP_ERR)
+	    {
+	      /* Stop the search. */
+	      data->res = SP_ERR;
+	      sd_free_line_table (&line_table);
+	      return true;
+	    }
+	}
+    }
+
+  sd_free_line_table (&line_table);
+
+  /* Never signal success so as to walk all CU DIEs. */
+  return false;
+}
+
+SprayResult
+for_each_row (Dwarf_Debug dbg, LineCallback callback, void *const init_data,
+	      bool is_every_row)
+{
+  assert (dbg != NULL);
+  assert (callback != NULL);
+
+  Dwarf_Error error = NULL;
+  StatementCallbackData data = {
+    .callback = callback,
+    .data = init_data,
+    .res = SP_OK,
+    .is_every_row = is_every_row,
+  };
+
+  int res = sd_search_dwarf_dbg (dbg, &error,
+				 callback__for_each_statement,
+				 NULL, &data);
+  if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+      return SP_ERR;
+    }
+
+  /* `DW_DLV_NO_ENTRY` is expected unless the callback failed. */
+  return data.res;
+}
+
+SprayResult
+sd_for_each_statement (Dwarf_Debug dbg,
+		       LineCallback callback, void *const init_data)
+{
+  return for_each_row (dbg, callback, init_data, false);
+}
+
+SprayResult
+sd_for_each_row (Dwarf_Debug dbg,
+		 LineCallback callback, void *const init_data)
+{
+  return for_each_row (dbg, callback, init_data, true);
+}
+
+/* Row of a line table in `LineIndex`. */
+typedef struct
+{
+  dbg_addr addr;
+  unsigned ln;
+  bool end_sequence;
+} IndexRow;
+
+typedef struct
+{
+  dbg_addr addr;
+  size_t row;			/* Index into `LineIndex.rows`. */
+} RowStart;
+
+struct LineIndex
+{
+  /* All rows in the order of the line tables. */
+  IndexRow *rows;
+  size_t n_rows;
+  size_t n_rows_alloc;
+  /* The rows that start a non-empty range of
+   * code, sorted by their address. */
+  RowStart *starts;
+  size_t n_starts;
+};
+
+enum
+{
+  MIN_INDEX_ROWS_ALLOC = 256,
+};
+
+SprayResult
+callback__index_row (LineEntry *line, void *const data)
+{
+  LineIndex *index = (LineIndex *) data;
+  if (index->n_rows == index->n_rows_alloc)
+    {
+      index->n_rows_alloc = index->n_rows_alloc == 0
+	? MIN_INDEX_ROWS_ALLOC : index->n_rows_alloc * 2;
+      index->rows = realloc (index->rows, sizeof (*index->rows)
+			     * index->n_rows_alloc);
+      assert (index->rows != NULL);
+    }
+
+  index->rows[index->n_rows++] = (IndexRow)
+  {
+    .addr = line->addr,
+    .ln = line->ln,
+    .end_sequence = line->end_sequence,
+  };
+  return SP_OK;
+}
+
+int
+compare_row_starts (const void *a, const void *b)
+{
+  uint64_t addr_a = ((const RowStart *) a)->addr.value;
+  uint64_t addr_b = ((const RowStart *) b)->addr.value;
+  return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+LineIndex *
+sd_init_line_index (Dwarf_Debug dbg)
+{
+  assert (dbg != NULL);
+
+  LineIndex *index = calloc (1, sizeof (*index));
+  assert (index != NULL);
+  if (sd_for_each_row (dbg, callback__index_row, index) == SP_ERR)
+    {
+      sd_free_line_index (index);
+      return NULL;
+    }
+
+  /* The code of a row ends where the next row starts. */
+  index->starts = calloc (index->n_rows > 0 ? index->n_rows : 1,
+			  sizeof (*index->starts));
+  assert (index->starts != NULL);
+  for (size_t i = 0; i + 1 < index->n_rows; i++)
+    {
+      if (!index->rows[i].end_sequence
+	  && index->rows[i].addr.value < index->rows[i + 1].addr.value)
+	{
+	  index->starts[index->n_starts++] = (RowStart)
+	  {
+	  .addr = index->rows[i].addr,.row = i};
+	}
+    }
+  qsort (index->starts, index->n_starts, sizeof (*index->starts),
+	 compare_row_starts);
+
+  return index;
+}
+
+void
+sd_free_line_index (LineIndex *index)
+{
+  if (index != NULL)
+    {
+      free (index->rows);
+      free (index->starts);
+      free (index);
+    }
+}
+
+SprayResult
+sd_line_range_from_pc (const LineIndex *index, dbg_addr pc,
+		       dbg_addr *start, dbg_addr *end)
+{
+  assert (index != NULL);
+  assert (start != NULL);
+  assert (end != NULL);
+
+  /* Find the last row that starts at or before `pc`. */
+  size_t low = 0;
+  size_t high = index->n_starts;
+  while (low < high)
+    {
+      size_t mid = low + (high - low) / 2;
+      if (index->starts[mid].addr.value <= pc.value)
+	{
+	  low = mid + 1;
+	}
+      else
+	{
+	  high = mid;
+	}
+    }
+  if (low == 0)
+    {
+      return SP_ERR;
+    }
+
+  const IndexRow *rows = index->rows;
+  size_t i = index->starts[low - 1].row;
+  if (pc.value >= rows[i + 1].addr.value)
+    {
+      return SP_ERR;
+    }
+
+  unsigned lineno = rows[i].ln;
+
+  /* Extend the range to the neighboring rows of the same line. */
+  size_t first = i;
+  while (first > 0 &&
+	 !rows[first - 1].end_sequence && rows[first - 1].ln == lineno)
+    {
+      first--;
+    }
+
+  size_t last = i + 1;
+  while (last + 1 < index->n_rows &&
+	 !rows[last].end_sequence &&
+	 (rows[last].ln == lineno || rows[last].ln == 0))
+    {
+      last++;
+    }
+
+  *start = rows[first].addr;
+  *end = rows[last].addr;
+  return SP_OK;
+}
+
+/* Get the DIE that the reference in the attribute `attrnum` of
+ * `die` points to. The DIE must be deallocated by the caller. */
+SprayResult
+sd_ref_die (Dwarf_Debug dbg, Dwarf_Die die, Dwarf_Half attrnum,
+	    Dwarf_Die *ref_die)
+{
+  assert (dbg != NULL);
+  assert (die != NULL);
+  assert (ref_die != NULL);
+
+  Dwarf_Error error = NULL;
+  Dwarf_Attribute attr = NULL;
+  int res = dwarf_attr (die, attrnum, &attr, &error);
+  if (res == DW_DLV_OK)
+    {
+      Dwarf_Off offset = 0;
+      res = dwarf_global_formref (attr, &offset, &error);
+      dwarf_dealloc_attribute (attr);
+      if (res == DW_DLV_OK)
+	{
+	  res = dwarf_offdie_b (dbg, offset, true, ref_die, &error);
+	}
+    }
+
+  if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+    }
+  return res == DW_DLV_OK ? SP_OK : SP_ERR;
+}
+
+/* Get the value of the attribute `attrnum` of `die`,
+ * or 0 if it doesn't have this attribute. */
+Dwarf_Unsigned
+sd_udata_at (Dwarf_Debug dbg, Dwarf_Die die, Dwarf_Half attrnum)
+{
+  assert (dbg != NULL);
+  assert (die != NULL);
+
+  Dwarf_Error error = NULL;
+  Dwarf_Attribute attr = NULL;
+  Dwarf_Unsigned value = 0;
+  int res = dwarf_attr (die, attrnum, &attr, &error);
+  if (res == DW_DLV_OK)
+    {
+      res = dwarf_formudata (attr, &value, &error);
+      dwarf_dealloc_attribute (attr);
+    }
+
+  if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+    }
+  return res == DW_DLV_OK ? value : 0;
+}
+
+enum
+{
+  /* Don't follow cycles of broken references forever. */
+  MAX_NAME_REFS = 4,
+};
+
+/* Get the name of the function `die`. Inlined instances and
+ * out-of-line definitions of a function only refer to the DIE
+ * that holds its name. Returns NULL if there is no name. */
+const char *
+sd_function_name (Dwarf_Debug dbg, Dwarf_Die die, unsigned n_refs)
+{
+  assert (dbg != NULL);
+  assert (die != NULL);
+
+  Dwarf_Error error = NULL;
+  /* Don't free the string returned by `dwarf_diename`. */
+  char *name = NULL;
+  int res = dwarf_diename (die, &name, &error);
+  if (res == DW_DLV_OK)
+    {
+      return name;
+    }
+  else if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+      return NULL;
+    }
+  else if (n_refs == MAX_NAME_REFS)
+    {
+      return NULL;
+    }
+
+  static const Dwarf_Half refs[] = {
+    DW_AT_abstract_origin,
+    DW_AT_specification,
+  };
+  for (size_t i = 0; i < sizeof (refs) / sizeof (*refs); i++)
+    {
+      Dwarf_Die ref_die = NULL;
+      if (sd_ref_die (dbg, die, refs[i], &ref_die) == SP_OK)
+	{
+	  const char *ref_name = sd_function_name (dbg, ref_die, n_refs + 1);
+	  dwarf_dealloc_die (ref_die);
+	  return ref_name;
+	}
+    }
+
+  return NULL;
+}
+
+typedef struct
+{
+  FunctionCallback callback;
+  void *data;
+  SprayResult res;
+  /* Source files, DWARF version and base address
+   * of the range lists of the CU that's searched. */
+  char **files;
+  Dwarf_Signed n_files;
+  Dwarf_Half version;
+  Dwarf_Addr base_pc;
+} FunctionCallbackData;
+
+/* A range of addresses `[low_pc, high_pc)`. */
+typedef struct
+{
+  Dwarf_Addr low_pc;
+  Dwarf_Addr high_pc;
+} FunctionRange;
+
+/* Add `[low_pc, high_pc)` to `ranges` unless it's empty. */
+void
+add_function_range (FunctionRange **ranges, size_t *n_ranges,
+		    Dwarf_Addr low_pc, Dwarf_Addr high_pc)
+{
+  if (low_pc >= high_pc)
+    {
+      return;
+    }
+  *ranges = realloc (*ranges, sizeof (**ranges) * (*n_ranges + 1));
+  assert (*ranges != NULL);
+  (*ranges)[*n_ranges] = (FunctionRange) {low_pc, high_pc};
+  (*n_ranges)++;
+}
+
+/* Get the ranges in the range list `attr` of `die`. `base_pc` is
+ * the base address of the CU. `ranges` must be freed. Returns the
+ * libdwarf error code. */
+int
+sd_get_function_ranges (Dwarf_Debug dbg, Dwarf_Die die,
+			Dwarf_Attribute attr, Dwarf_Half version,
+			Dwarf_Addr base_pc, FunctionRange **ranges,
+			size_t *n_ranges, Dwarf_Error *error)
+{
+  *ranges = NULL;
+  *n_ranges = 0;
+
+  /* An index into the CU's range lists or an offset. */
+  Dwarf_Half form = 0;
+  Dwarf_Unsigned value = 0;
+  int res = dwarf_whatform (attr, &form, error);
+  if (res == DW_DLV_OK && form == DW_FORM_rnglistx)
+    {
+      res = dwarf_formudata (attr, &value, error);
+    }
+  else if (res == DW_DLV_OK)
+    {
+      Dwarf_Off offset = 0;
+      res = dwarf_global_formref (attr, &offset, error);
+      value = offset;
+    }
+  if (res != DW_DLV_OK)
+    {
+      return res;
+    }
+
+  if (version < 5)
+    {
+      Dwarf_Ranges *entries = NULL;
+      Dwarf_Signed n_entries = 0;
+      Dwarf_Off real_offset = 0;
+      Dwarf_Unsigned n_bytes = 0;
+      res = dwarf_get_ranges_b (dbg, value, die, &real_offset, &entries,
+				&n_entries, &n_bytes, error);
+      if (res != DW_DLV_OK)
+	{
+	  return res;
+	}
+
+      /* The addresses are relative to a base
+       * address that entries can change. */
+      Dwarf_Addr base = base_pc;
+      for (Dwarf_Signed i = 0; i < n_entries; i++)
+	{
+	  const Dwarf_Ranges *entry = &entries[i];
+	  if (entry->dwr_type == DW_RANGES_ADDRESS_SELECTION)
+	    {
+	      base = entry->dwr_addr2;
+	    }
+	  else if (entry->dwr_type == DW_RANGES_ENTRY)
+	    {
+	      add_function_range (ranges, n_ranges, base + entry->dwr_addr1,
+				  base + entry->dwr_addr2);
+	    }
+	}
+      dwarf_dealloc_ranges (dbg, entries, n_entries);
+      return DW_DLV_OK;
+    }
+
+  Dwarf_Rnglists_Head head = NULL;
+  Dwarf_Unsigned n_entries = 0;
+  Dwarf_Unsigned global_offset = 0;
+  res = dwarf_rnglists_get_rle_head (attr, form, value, &head, &n_entries,
+				     &global_offset, error);
+  if (res != DW_DLV_OK)
+    {
+      return res;
+    }
+
+  /* The cooked addresses already include the base address. */
+  for (Dwarf_Unsigned i = 0; res == DW_DLV_OK && i < n_entries; i++)
+    {
+      unsigned entry_len = 0;
+      unsigned code = 0;
+      Dwarf_Unsigned raw_low = 0;
+      Dwarf_Unsigned raw_high = 0;
+      Dwarf_Bool is_unavailable = false;
+      Dwarf_Unsigned low_pc = 0;
+      Dwarf_Unsigned high_pc = 0;
+      res = dwarf_get_rnglists_entry_fields_a (head, i, &entry_len, &code,
+					       &raw_low, &raw_high,
+					       &is_unavailable, &low_pc,
+					       &high_pc, error);
+      if (res == DW_DLV_OK && !is_unavailable
+	  && code != DW_RLE_end_of_list && code != DW_RLE_base_address
+	  && code != DW_RLE_base_addressx)
+	{
+	  add_function_range (ranges, n_ranges, low_pc, high_pc);
+	}
+    }
+  dwarf_dealloc_rnglists_head (head);
+
+  if (res != DW_DLV_OK)
+    {
+      free (*ranges);
+      *ranges = NULL;
+      *n_ranges = 0;
+    }
+  return res;
+}
+
+/* Search callback that calls the function callback in
+ * `search_findings` on each function and each inlined
+ * instance of a function once for each range of addresses. */
+bool
+callback__for_each_function (Dwarf_Debug dbg,
+			     Dwarf_Die die,
+			     SearchFor search_for,
+			     SearchFindings search_findings)
+{
+  FunctionCallbackData *data = (FunctionCallbackData *) search_findings.data;
+
+  Dwarf_Error error = NULL;
+  Dwarf_Half tag = 0;
+  int res = dwarf_tag (die, &tag, &error);
+  if (res != DW_DLV_OK)
+    {
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  /* CU DIEs are visited before the DIEs in them. The file list
+   * isn't freed, so that the file paths of the calls stay valid
+   * for as long as the `Dwarf_Debug` instance. */
+  if (tag == DW_TAG_compile_unit)
+    {
+      Dwarf_Half offset_size = 0;
+      data->files = NULL;
+      data->n_files = 0;
+      data->version = 0;
+      data->base_pc = 0;
+      res = dwarf_srcfiles (die, &data->files, &data->n_files, &error);
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      dwarf_get_version_of_die (die, &data->version, &offset_size);
+      res = dwarf_lowpc (die, &data->base_pc, &error);
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  bool is_inlined = tag == DW_TAG_inlined_subroutine;
+  if (tag != DW_TAG_subprogram && !is_inlined)
+    {
+      return false;
+    }
+
+  /* Declarations and abstract instances of inlined functions
+   * don't have any code. Functions whose code is split into
+   * several ranges have a range list instead of a low and
+   * high PC. */
+  FunctionRange range = { 0 };
+  FunctionRange *ranges = &range;
+  size_t n_ranges = 1;
+  res = sd_get_high_and_low_pc (die, &error, &range.low_pc,
+				&range.high_pc);
+  if (res == DW_DLV_NO_ENTRY)
+    {
+      Dwarf_Attribute attr = NULL;
+      res = dwarf_attr (die, DW_AT_ranges, &attr, &error);
+      if (res == DW_DLV_OK)
+	{
+	  res = sd_get_function_ranges (dbg, die, attr, data->version,
+					data->base_pc, &ranges, &n_ranges,
+					&error);
+	  dwarf_dealloc_attribute (attr);
+	}
+    }
+  if (res != DW_DLV_OK)
+    {
+      if (res == DW_DLV_ERROR)
+	{
+	  dwarf_dealloc_error (dbg, error);
+	}
+      return false;
+    }
+
+  SdFunction func = {
+    .name = sd_function_name (dbg, die, 0),
+    .level = search_for.level,
+    .is_inlined = is_inlined,
+  };
+
+  if (is_inlined)
+    {
+      /* File numbers start at 1 before DWARF 5. */
+      Dwarf_Unsigned file_num = sd_udata_at (dbg, die, DW_AT_call_file);
+      Dwarf_Unsigned file_idx = data->version >= 5 ? file_num : file_num - 1;
+      if ((data->version >= 5 || file_num > 0)
+	  && file_idx < (Dwarf_Unsigned) data->n_files)
+	{
+	  func.call_file = data->files[file_idx];
+	}
+      func.call_line = sd_udata_at (dbg, die, DW_AT_call_line);
+      func.call_column = sd_udata_at (dbg, die, DW_AT_call_column);
+    }
+
+  for (size_t i = 0; i < n_ranges && data->res == SP_OK; i++)
+    {
+      func.low_pc = (dbg_addr) {ranges[i].low_pc};
+      func.high_pc = (dbg_addr) {ranges[i].high_pc};
+      func.range_idx = i;
+      data->res = data->callback (&func, data->data);
+    }
+  if (ranges != &range)
+    {
+      free (ranges);
+    }
+
+  /* Stop the search if the callback failed. */
+  return data->res == SP_ERR;
+}
+
+/* Call `callback` on each function of `dbg` using libdwarf. */
+SprayResult
+libdwarf_for_each_function (Dwarf_Debug dbg,
+			    FunctionCallback callback, void *const init_data)
+{
+  Dwarf_Error error = NULL;
+  FunctionCallbackData data = {
+    .callback = callback,
+    .data = init_data,
+    .res = SP_OK,
+  };
+
+  int res = sd_search_dwarf_dbg (dbg, &error,
+				 callback__for_each_function,
+				 NULL, &data);
+  if (res == DW_DLV_ERROR)
+    {
+      dwarf_dealloc_error (dbg, error);
+      return SP_ERR;
+    }
+
+  /* `DW_DLV_NO_ENTRY` is expected unless the callback failed. */
+  return data.res;
+}
+
+enum
+{
+  MIN_UNIT_FUNCTIONS_ALLOC = 64,
+};
+
+/* A subprogram DIE that other DIEs might get their name from. */
+typedef struct
+{
+  uint64_t offset;
+  const char *name;
+  uint64_t origin;
+} NamedDie;
+
+typedef struct
+{
+  SdFunction func;
+  /* Where the name comes from if the DIE doesn't have one. */
+  uint64_t origin;
+  uint64_t call_file;
+} UnitFunction;
+
+/* The functions of a unit are collected until the unit has been
+ * scanned. Only then can names be looked up in the DIEs that the
+ * functions refer to. The arrays are reused by all units. */
+typedef struct
+{
+  Dwarf_Debug dbg;
+  FunctionCallback callback;
+  void *data;
+  /* Whether `callback` was called at least once. */
+  bool is_called;
+  bool has_line;
+  DlSections line;
+  DiUnit unit;
+  size_t n_dies;
+  /* Sorted by offset, since DIEs are scanned in that order. */
+  NamedDie *named;
+  size_t n_named;
+  size_t n_named_alloc;
+  UnitFunction *funcs;
+  size_t n_funcs;
+  size_t n_funcs_alloc;
+  const DiSections *info;
+  /* The function whose ranges are added. */
+  UnitFunction range_func;
+} FunctionIndexData;
+
+int
+named_die_compare (const void *a, const void *b)
+{
+  uint64_t offset_a = ((const NamedDie *) a)->offset;
+  uint64_t offset_b = ((const NamedDie *) b)->offset;
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+/* Get the name of a function whose DIE refers to the DIE at
+ * `origin` instead of having a name. It's looked up the same
+ * way as in `sd_function_name`. */
+const char *
+unit_function_name (const FunctionIndexData *data, uint64_t origin)
+{
+  for (unsigned n_refs = 1; origin != 0 && n_refs <= MAX_NAME_REFS;
+       n_refs++)
+    {
+      NamedDie key = {.offset = origin };
+      const NamedDie *named = bsearch (&key, data->named, data->n_named,
+				       sizeof (*data->named),
+				       named_die_compare);
+      if (named == NULL)
+	{
+	  /* The DIE is in another unit. Only libdwarf knows
+	   * it, since each unit is forgotten after its scan. */
+	  Dwarf_Error error = NULL;
+	  Dwarf_Die die = NULL;
+	  int res = dwarf_offdie_b (data->dbg, origin, true, &die, &error);
+	  if (res != DW_DLV_OK)
+	    {
+	      if (res == DW_DLV_ERROR)
+		{
+		  dwarf_dealloc_error (data->dbg, error);
+		}
+	      return NULL;
+	    }
+	  const char *name = sd_function_name (data->dbg, die, n_refs);
+	  dwarf_dealloc_die (die);
+	  return name;
+	}
+      else if (named->name != NULL)
+	{
+	  return named->name;
+	}
+      origin = named->origin;
+    }
+
+  return NULL;
+}
+
+/* Get the file table of the unit that's scanned. The file paths
+ * are interned, so that they stay valid until the sections of
+ * `dbg` are cleared. */
+void
+unit_file_table (const FunctionIndexData *data, DlLineTable *files)
+{
+  const DiUnit *unit = &data->unit;
+  *files = (DlLineTable) {0};
+  if (!data->has_line || !unit->has_stmt_list)
+    {
+      return;
+    }
+
+  NativeSections *native = lock_native_sections (data->dbg);
+  if (native == NULL
+      || dl_decode_file_table (&data->line, unit->stmt_list,
+			       unit->comp_dir, intern_filepath, native,
+			       files) == SP_ERR)
+    {
+      dl_free_line_table (files);
+    }
+  unlock_native_sections ();
+}
+
+/* Call the function callback on the functions of the unit that
+ * was scanned last. Then start collecting the next unit's. */
+SprayResult
+flush_unit_functions (FunctionIndexData *data)
+{
+  add_stat (STAT_DIE_VISITS, data->n_dies);
+  data->n_dies = 0;
+
+  DlLineTable files = { 0 };
+  bool has_files = false;
+  SprayResult res = SP_OK;
+
+  for (size_t i = 0; i < data->n_funcs && res == SP_OK; i++)
+    {
+      const UnitFunction *unit_func = &data->funcs[i];
+      SdFunction func = unit_func->func;
+      if (func.name == NULL)
+	{
+	  func.name = unit_function_name (data, unit_func->origin);
+	}
+
+      if (func.is_inlined)
+	{
+	  if (!has_files)
+	    {
+	      unit_file_table (data, &files);
+	      has_files = true;
+	    }
+
+	  /* File numbers start at 1 before DWARF 5. */
+	  uint64_t file_num = unit_func->call_file;
+	  uint64_t file_idx = data->unit.version >= 5 ? file_num : file_num - 1;
+	  if ((data->unit.version >= 5 || file_num > 0)
+	      && file_idx < files.n_filepaths)
+	    {
+	      func.call_file = files.filepaths[file_idx];
+	    }
+	}
+
+      data->is_called = true;
+      res = data->callback (&func, data->data);
+    }
+
+  dl_free_line_table (&files);
+
+  data->n_named = 0;
+  data->n_funcs = 0;
+  return res;
+}
+
+void
+add_unit_function (FunctionIndexData *data, const UnitFunction *unit_func)
+{
+  if (data->n_funcs == data->n_funcs_alloc)
+    {
+      data->n_funcs_alloc = data->n_funcs_alloc == 0
+	? MIN_UNIT_FUNCTIONS_ALLOC : data->n_funcs_alloc * 2;
+      data->funcs = realloc (data->funcs, sizeof (*data->funcs)
+			     * data->n_funcs_alloc);
+      assert (data->funcs != NULL);
+    }
+  data->funcs[data->n_funcs++] = *unit_func;
+}
+
+/* Range callback that adds `range_func` once for each range. */
+SprayResult
+callback__add_function_range (dbg_addr low_pc, dbg_addr high_pc,
+			      void *data_ptr)
+{
+  FunctionIndexData *data = (FunctionIndexData *) data_ptr;
+  UnitFunction unit_func = data->range_func;
+  unit_func.func.low_pc = low_pc;
+  unit_func.func.high_pc = high_pc;
+  add_unit_function (data, &unit_func);
+  data->range_func.func.range_idx++;
+  return SP_OK;
+}
+
+/* DIE callback that collects the functions with code and
+ * the subprograms that names can come from. */
+SprayResult
+callback__index_function (const DiUnit *unit, const DiDie *die,
+			  void *data_ptr)
+{
+  FunctionIndexData *data = (FunctionIndexData *) data_ptr;
+
+  if (die->level == 0)
+    {
+      if (flush_unit_functions (data) == SP_ERR)
+	{
+	  return SP_ERR;
+	}
+      data->unit = *unit;
+    }
+  data->n_dies++;
+
+  bool is_inlined = die->tag == DW_TAG_inlined_subroutine;
+  if (die->tag != DW_TAG_subprogram && !is_inlined)
+    {
+      return SP_OK;
+    }
+
+  if (!is_inlined)
+    {
+      if (data->n_named == data->n_named_alloc)
+	{
+	  data->n_named_alloc = data->n_named_alloc == 0
+	    ? MIN_UNIT_FUNCTIONS_ALLOC : data->n_named_alloc * 2;
+	  data->named = realloc (data->named, sizeof (*data->named)
+				 * data->n_named_alloc);
+	  assert (data->named != NULL);
+	}
+      data->named[data->n_named++] = (NamedDie)
+      {
+	.offset = die->offset,
+	.name = die->name,
+	.origin = die->origin,
+      };
+    }
+
+  UnitFunction unit_func = {
+    .func = {
+      .name = die->name,
+      .low_pc = die->low_pc,
+      .high_pc = die->high_pc,
+      .level = die->level,
+      .is_inlined = is_inlined,
+      .call_line = die->call_line,
+      .call_column = die->call_column,
+    },
+    .origin = die->origin,
+    .call_file = die->call_file,
+  };
+
+  if (die->has_pc)
+    {
+      add_unit_function (data, &unit_func);
+    }
+  else if (die->has_ranges)
+    {
+      /* A function whose range list is invalid is skipped
+       * entirely instead of with some of its ranges. */
+      size_t n_funcs = data->n_funcs;
+      data->range_func = unit_func;
+      if (di_for_each_range (data->info, unit, die,
+			     callback__add_function_range, data) == SP_ERR)
+	{
+	  data->n_funcs = n_funcs;
+	}
+    }
+
+  return SP_OK;
+}
+
+/* Call `callback` on each function of `dbg` by scanning the
+ * sections directly. Sets `is_called` to whether `callback` was
+ * called. If it wasn't, libdwarf can still search the DIEs. */
+SprayResult
+native_for_each_function (Dwarf_Debug dbg, const DiSections *info,
+			  FunctionCallback callback, void *const init_data,
+			  bool *is_called)
+{
+  FunctionIndexData data = {
+    .dbg = dbg,
+    .callback = callback,
+    .data = init_data,
+    .is_called = false,
+    .info = info,
+  };
+  data.has_line = get_line_sections (dbg, &data.line);
+
+  SprayResult res = di_for_each_die (info, callback__index_function,
+				     &data);
+  if (res == SP_OK)
+    {
+      res = flush_unit_functions (&data);
+    }
+
+  free (data.named);
+  free (data.funcs);
+  *is_called = data.is_called;
+  return res;
+}
+
+/* The DIEs are scanned straight from the sections if they were
+ * set. Otherwise, and if the scanner doesn't support the DWARF
+ * in them, libdwarf searches the DIEs. */
+SprayResult
+sd_for_each_function (Dwarf_Debug dbg,
+		      FunctionCallback callback, void *const init_data)
+{
+  assert (dbg != NULL);
+  assert (callback != NULL);
+
+  DiSections info = { 0 };
+  bool is_called = false;
+  if (get_info_sections (dbg, &info))
+    {
+      SprayResult res = native_for_each_function (dbg, &info, callback,
+						  init_data, &is_called);
+      if (res == SP_OK || is_called)
+	{
+	  return res;
+	}
+    }
+  return libdwarf_for_each_function (dbg, callback, init_data);
+}
+
 SprayResult
 sd_effective_start_addr (Dwarf_Debug dbg,
 			 dbg_addr prologue_start,
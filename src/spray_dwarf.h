@@ -9,9 +9,11 @@
 #ifndef _SPRAY_SPRAY_DWARF_H_
 #define _SPRAY_SPRAY_DWARF_H_
 
+#include "debug_line.h"		/* `LineEntry` */
 #include "ptrace.h"
 #include "spray_elf.h"		/* `ElfFile` in `SdLocEvalCtx` */
 #include "registers.h"		/* `x86_reg` in `SdLocation` */
+#include "unwind.h"		/* `FrameRegs` in `SdLocEvalCtx` */
 
 #include <dwarf.h>
 #include <libdwarf-0/libdwarf.h>
@@ -20,6 +22,19 @@
 /* Initialized libdwarf's debug info. Returns NULL on error. */
 Dwarf_Debug sd_dwarf_init (const char *filepath, Dwarf_Error * error);
 
+/* Decode the line tables and scan the DIEs of `dbg` straight from
+ * the sections in `elf` instead of using libdwarf. This is several
+ * times faster. Returns `SP_ERR` if none of the sections can be
+ * used, e.g. because they are compressed. libdwarf is used then,
+ * and for anything that the native decoders don't support. */
+SprayResult sd_set_sections (Dwarf_Debug dbg, const ElfFile * elf);
+
+/* Stop reading the sections of `dbg` natively. Must be called
+ * before `dbg` is finished or `elf` is freed. The file paths in
+ * all line entries of `dbg` and the names and file paths of all
+ * functions found with `sd_for_each_function` become invalid. */
+void sd_clear_sections (Dwarf_Debug dbg);
+
 
 /**************************************************/
 /* Information about the current position of the  */
@@ -31,22 +46,6 @@ Dwarf_Debug sd_dwarf_init (const char *filepath, Dwarf_Error * error);
  * must be `free`'d by the caller. */
 char *sd_filepath_from_pc (Dwarf_Debug dbg, dbg_addr pc);
 
-typedef struct
-{
-  bool is_ok;
-  bool new_statement;
-  bool prologue_end;
-  /* Set to true if the PC used to retrieve the
-   * line entry was exactly equal to `addr`. */
-  bool is_exact;
-  unsigned ln;
-  unsigned cl;
-  dbg_addr addr;
-  /* Don't free this string.
-   * It's owned by the `Dwarf_Debug` instance. */
-  char *filepath;
-} LineEntry;
-
 /* Returns the line entry for the PC if this line entry contains
  * the address of PC. On error `is_ok` is set to false. */
 LineEntry sd_line_entry_from_pc (Dwarf_Debug dbg, dbg_addr pc);
@@ -64,6 +63,70 @@ SprayResult sd_for_each_line (Dwarf_Debug dbg,
 			      const char *filepath,
 			      LineCallback callback, void *const init_data);
 
+/* Call `callback` for each new statement line entry in the
+ * line tables of all compilation units. Entries that mark the
+ * end of a sequence are skipped. */
+SprayResult sd_for_each_statement (Dwarf_Debug dbg,
+				   LineCallback callback,
+				   void *const init_data);
+
+/* Call `callback` for every row in the line tables of all
+ * compilation units, including the rows that end a sequence. */
+SprayResult sd_for_each_row (Dwarf_Debug dbg,
+			     LineCallback callback, void *const init_data);
+
+/* Rows of all line tables sorted by address. */
+typedef struct LineIndex LineIndex;
+
+/* Decode the line tables of `dbg` once and index their rows,
+ * so that `sd_line_range_from_pc` doesn't have to decode any
+ * line table itself. Returns NULL on error. */
+LineIndex *sd_init_line_index (Dwarf_Debug dbg);
+
+void sd_free_line_index (LineIndex * index);
+
+/* Get the range of addresses `[start, end)` around `pc` which
+ * belong to the same line as `pc`. Line entries without a line
+ * number (line 0) that follow the line of `pc` are counted as
+ * part of it. */
+SprayResult sd_line_range_from_pc (const LineIndex * index, dbg_addr pc,
+				   dbg_addr * start, dbg_addr * end);
+
+/* A function, or an instance of a function that was inlined
+ * into another one, with the code at `[low_pc, high_pc)`. */
+typedef struct
+{
+  /* NULL if the function has no name. Don't free this
+   * string. It's owned by the `Dwarf_Debug` instance. */
+  const char *name;
+  dbg_addr low_pc;
+  dbg_addr high_pc;
+  unsigned level;		/* Level in the DIE tree. */
+  bool is_inlined;
+  /* Position of the call that was inlined. The file path
+   * is NULL if it's unknown and owned by `Dwarf_Debug`. */
+  const char *call_file;
+  unsigned call_line;
+  unsigned call_column;
+  /* Index of the range if the code is split into several
+   * ranges of addresses. Each range is passed separately,
+   * right after the one before it. */
+  unsigned range_idx;
+} SdFunction;
+
+typedef SprayResult (*FunctionCallback) (const SdFunction * func,
+					 void *const data);
+
+/* Call `callback` for each function and each inlined instance of
+ * a function in the order of the DIE tree, so that the instances
+ * inlined into a function follow it. Functions whose code is split
+ * into several ranges of addresses are passed once for each range.
+ * The DIEs are read without libdwarf if the sections of `dbg` were
+ * set. */
+SprayResult sd_for_each_function (Dwarf_Debug dbg,
+				  FunctionCallback callback,
+				  void *const init_data);
+
 /* Figure out where the function prologue of the function starting
  * at `low_pc` ends and return this address. Used for breakpoints on
  * functions to break only after the prologue.
@@ -182,6 +245,16 @@ SprayResult sd_runtime_variable (Dwarf_Debug dbg,
 				 SdVarattr * attr,
 				 char **decl_file, unsigned *decl_line);
 
+/* Get the names of the variables and formal parameters that
+ * are in the scope of the function around `pc`.
+ *
+ * On success `SP_OK` is returned, and `names` is set to an
+ * array of `n_names` strings. The caller must `free` both
+ * the strings and the array. */
+SprayResult sd_scope_variable_names (Dwarf_Debug dbg,
+				     dbg_addr pc,
+				     char ***names, size_t *n_names);
+
 
 /* Location information. */
 
@@ -217,6 +290,9 @@ typedef struct SdLocEvalCtx
   dbg_addr pc;
   const ElfFile *elf;
   real_addr load_address;
+  /* Registers of the call frame to evaluate in, or NULL
+   * to read the registers of `pid` instead. */
+  const FrameRegs *regs;
 } SdLocEvalCtx;
 
 /* The location of a runtime variable at a specific point
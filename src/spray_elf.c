@@ -119,8 +119,9 @@ parse_elf_header (const Elf64_Ehdr *elf_src,
       *prog_table_off = elf_src->e_phoff;
     }
 
-  /* Is this file missing a section header table? */
-  if (elf_src->e_shoff == 0)
+  /* Is this file missing a section header table? Core dumps
+   * only have one if they have too many program headers. */
+  if (elf_src->e_shoff == 0 && elf_dest->type != ELF_TYPE_CORE)
     {
       return ELF_PARSE_DISLIKE;
     }
@@ -131,7 +132,7 @@ parse_elf_header (const Elf64_Ehdr *elf_src,
 
   /* Are the entry sizes in the header tables meant for 64-bit? */
   if (elf_src->e_phentsize != sizeof (Elf64_Phdr) ||
-      elf_src->e_shentsize != sizeof (Elf64_Shdr))
+      (elf_src->e_shoff != 0 && elf_src->e_shentsize != sizeof (Elf64_Shdr)))
     {
       return ELF_PARSE_DISLIKE;
     }
@@ -399,6 +400,32 @@ se_parse_elf (const char *filepath, ElfFile *elf_store)
 	}
     }
 
+  /* Core dumps don't have symbols. Only the program headers are used. */
+  if (elf_store->type == ELF_TYPE_CORE)
+    {
+      if (sect_table_off != 0)
+	{
+	  parse_init_section (shdr_at (bytes, sect_table_off), &n_prog_hdrs,
+			      &n_sect_hdrs, &shstrtab_idx);
+	}
+
+      if (prog_table_off + (uint64_t) n_prog_hdrs * sizeof (Elf64_Phdr)
+	  > n_bytes)
+	{
+	  munmap (bytes, n_bytes);
+	  return ELF_PARSE_INVALID;
+	}
+
+      elf_store->sect_table = (ElfSectTable) {0};
+      elf_store->prog_table = (ElfProgTable)
+      {
+      .n_headers = n_prog_hdrs,.headers = phdr_at (bytes, prog_table_off)};
+      elf_store->data = (ElfData)
+      {
+      .bytes = bytes,.n_bytes = n_bytes};
+      return ELF_PARSE_OK;
+    }
+
   Elf64_Shdr *sect_headers = shdr_at (bytes, sect_table_off);
 
   /* Fill-in missing values if they weren't found in the ELF header. */
@@ -477,6 +504,65 @@ se_free_elf (ElfFile elf)
     }
 }
 
+dbg_addr
+se_entry_point (const ElfFile *elf)
+{
+  assert (elf != NULL);
+
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) elf->data.bytes;
+  return (dbg_addr) {ehdr->e_entry};
+}
+
+const Elf64_Shdr *
+se_section_by_name (const char *name, const ElfFile *elf)
+{
+  assert (name != NULL);
+  assert (elf != NULL);
+
+  const Elf64_Shdr *shstrtab_hdr =
+    &elf->sect_table.headers[elf->sect_table.shstrtab_idx];
+  const char *shstrtab = strtab_at (elf->data.bytes,
+				    shstrtab_hdr->sh_offset);
+
+  for (uint32_t i = 0; i < elf->sect_table.n_headers; i++)
+    {
+      const Elf64_Shdr *shdr = &elf->sect_table.headers[i];
+      if (str_eq (&shstrtab[shdr->sh_name], name))
+	{
+	  return shdr;
+	}
+    }
+
+  return NULL;
+}
+
+const byte *
+se_section_data (const Elf64_Shdr *shdr, const ElfFile *elf)
+{
+  assert (shdr != NULL);
+  assert (elf != NULL);
+
+  if (shdr->sh_type == SHT_NOBITS ||
+      shdr->sh_offset + shdr->sh_size > elf->data.n_bytes)
+    {
+      return NULL;
+    }
+
+  return elf->data.bytes + shdr->sh_offset;
+}
+
+const Elf64_Sym *
+se_symbols (const ElfFile *elf, size_t *n_symbols)
+{
+  assert (elf != NULL);
+  assert (n_symbols != NULL);
+
+  Elf64_Shdr *symtab_hdr =
+    &elf->sect_table.headers[elf->sect_table.symtab_idx];
+  *n_symbols = symtab_hdr->sh_size / symtab_hdr->sh_entsize;
+  return symtab_at (elf->data.bytes, symtab_hdr->sh_offset);
+}
+
 const Elf64_Sym *
 se_symbol_from_name (const char *name, const ElfFile *elf)
 {
@@ -525,6 +611,33 @@ se_symbol_from_addr (dbg_addr addr, const ElfFile *elf)
   return NULL;
 }
 
+const Elf64_Sym *
+se_object_from_addr (dbg_addr addr, const ElfFile *elf)
+{
+  assert (elf != NULL);
+
+  Elf64_Shdr *symtab_hdr =
+    &elf->sect_table.headers[elf->sect_table.symtab_idx];
+  const Elf64_Sym *symtab =
+    symtab_at (elf->data.bytes, symtab_hdr->sh_offset);
+
+  uint64_t n_symbols = symtab_hdr->sh_size / symtab_hdr->sh_entsize;
+
+  for (uint64_t i = 0; i < n_symbols; i++)
+    {
+      /* Unlike code addresses, the end of an object
+       * belongs to the object that follows it. */
+      if (ELF64_ST_TYPE (symtab[i].st_info) == STT_OBJECT
+	  && symtab[i].st_value <= addr.value
+	  && addr.value < symtab[i].st_value + symtab[i].st_size)
+	{
+	  return &symtab[i];
+	}
+    }
+
+  return NULL;
+}
+
 int
 se_symbol_binding (const Elf64_Sym *sym)
 {
@@ -85,11 +85,25 @@ ElfParseResult se_parse_elf (const char *filepath, ElfFile * elf);
 /* Returns `SP_ERR` if un-mapping the ELF file didn't work. */
 SprayResult se_free_elf (ElfFile elf);
 
+/* Get the address of the first instruction that's executed. */
+dbg_addr se_entry_point (const ElfFile * elf);
+
+/* Get the header of the section with the given name, e.g. `.eh_frame`.
+ * Returns `NULL` if there is no such section. */
+const Elf64_Shdr *se_section_by_name (const char *name, const ElfFile * elf);
+
+/* Get a pointer to the contents of the section in the mapped file.
+ * Returns `NULL` for sections that don't occupy space in the file. */
+const byte *se_section_data (const Elf64_Shdr * shdr, const ElfFile * elf);
+
 
 /***************************/
 /* Symbol table interface. */
 /***************************/
 
+/* Get all entries in the symbol table and their number. */
+const Elf64_Sym *se_symbols (const ElfFile * elf, size_t *n_symbols);
+
 /* Get the symbol table entry for the symbol name.
  * Returns `NULL` in no such symbol was found. */
 const Elf64_Sym *se_symbol_from_name (const char *name, const ElfFile * elf);
@@ -98,6 +112,11 @@ const Elf64_Sym *se_symbol_from_name (const char *name, const ElfFile * elf);
  * belongs to the given instruction address. */
 const Elf64_Sym *se_symbol_from_addr (dbg_addr addr, const ElfFile * elf);
 
+/* Get the symbol table entry of the data object (e.g. a global
+ * variable) that contains the given data address. Returns `NULL`
+ * if no such symbol was found. */
+const Elf64_Sym *se_object_from_addr (dbg_addr addr, const ElfFile * elf);
+
 /* Access different fields in a symbol. The way information
  * is stored in the different members of a symbol is a bit
  * weird so these wrappers make the code more readable. */
@@ -0,0 +1,133 @@
+/* Required to use `process_vm_readv`. */
+#define _GNU_SOURCE
+
+#include "stack.h"
+
+#include "ptrace.h"
+#include "stats.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/uio.h>
+
+struct StackSnapshot
+{
+  real_addr start;
+  size_t n_bytes;
+  unsigned char *bytes;
+};
+
+/* Find the end of the mapping in the tracee's address space
+ * that contains `addr`. Returns `SP_ERR` if there is none. */
+SprayResult
+mapping_end (pid_t pid, real_addr addr, real_addr *end)
+{
+  char maps_filepath[PROC_MAPS_FILEPATH_LEN] = { 0 };
+  snprintf (maps_filepath, PROC_MAPS_FILEPATH_LEN, "/proc/%d/maps", pid);
+
+  FILE *maps = fopen (maps_filepath, "r");
+  if (maps == NULL)
+    {
+      return SP_ERR;
+    }
+
+  SprayResult res = SP_ERR;
+  char *line = NULL;
+  size_t n = 0;
+  while (getline (&line, &n, maps) != -1)
+    {
+      uint64_t start_value = 0;
+      uint64_t end_value = 0;
+      if (sscanf (line, "%" SCNx64 "-%" SCNx64, &start_value, &end_value)
+	  == 2 && start_value <= addr.value && addr.value < end_value)
+	{
+	  end->value = end_value;
+	  res = SP_OK;
+	  break;
+	}
+    }
+
+  free (line);
+  fclose (maps);
+
+  return res;
+}
+
+StackSnapshot *
+init_stack_snapshot (pid_t pid, real_addr stack_pointer, size_t max_size)
+{
+  real_addr end = { 0 };
+  if (mapping_end (pid, stack_pointer, &end) == SP_ERR)
+    {
+      return NULL;
+    }
+
+  size_t n_bytes = end.value - stack_pointer.value;
+  if (n_bytes > max_size)
+    {
+      n_bytes = max_size;
+    }
+
+  StackSnapshot *stack = malloc (sizeof (*stack));
+  if (stack == NULL)
+    {
+      return NULL;
+    }
+
+  stack->bytes = malloc (n_bytes);
+  if (stack->bytes == NULL)
+    {
+      free (stack);
+      return NULL;
+    }
+
+  struct iovec local = {.iov_base = stack->bytes,.iov_len = n_bytes };
+  struct iovec remote = {
+    .iov_base = (void *) stack_pointer.value,
+    .iov_len = n_bytes,
+  };
+
+  add_stat (STAT_PROCESS_VM_READV, 1);
+  ssize_t n_read = process_vm_readv (pid, &local, 1, &remote, 1, 0);
+  if (n_read <= 0)
+    {
+      free_stack_snapshot (stack);
+      return NULL;
+    }
+  add_stat (STAT_BYTES_READ, (uint64_t) n_read);
+
+  stack->start = stack_pointer;
+  stack->n_bytes = (size_t) n_read;
+
+  return stack;
+}
+
+void
+free_stack_snapshot (StackSnapshot *stack)
+{
+  if (stack != NULL)
+    {
+      free (stack->bytes);
+      free (stack);
+    }
+}
+
+SprayResult
+read_stack (const StackSnapshot *stack, pid_t pid,
+	    real_addr addr, uint64_t *read)
+{
+  assert (read != NULL);
+
+  if (stack != NULL && addr.value >= stack->start.value
+      && addr.value - stack->start.value + sizeof (*read) <= stack->n_bytes)
+    {
+      memcpy (read, stack->bytes + (addr.value - stack->start.value),
+	      sizeof (*read));
+      return SP_OK;
+    }
+  else
+    {
+      return pt_read_memory (pid, addr, read);
+    }
+}
@@ -0,0 +1,32 @@
+/* Snapshots of the tracee's stack. */
+
+#pragma once
+
+#ifndef _SPRAY_STACK_H_
+#define _SPRAY_STACK_H_
+
+#include "magic.h"
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Copy of the tracee's stack taken while it's stopped. Reading
+ * from the copy saves a system call for each word that's read. */
+typedef struct StackSnapshot StackSnapshot;
+
+/* Copy the stack of the stopped tracee in a single read. The
+ * copy starts at `stack_pointer` and ends at the end of the
+ * mapping that contains it or after `max_size` bytes.
+ * Returns NULL on error. */
+StackSnapshot *init_stack_snapshot (pid_t pid, real_addr stack_pointer,
+				    size_t max_size);
+
+void free_stack_snapshot (StackSnapshot * stack);
+
+/* Read a word from the stack snapshot. The word is read from the
+ * tracee's memory instead if it isn't part of the snapshot, so
+ * `stack` can be NULL. Returns `SP_ERR` if reading failed. */
+SprayResult read_stack (const StackSnapshot * stack, pid_t pid,
+			real_addr addr, uint64_t * read);
+
+#endif /* _SPRAY_STACK_H_ */
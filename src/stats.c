@@ -0,0 +1,135 @@
+#include "stats.h"
+#include "magic.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+enum
+{
+  /* Commands beyond this many aren't timed. */
+  MAX_TIMED_COMMANDS = 64,
+  COMMAND_NAME_BUF_SIZE = 32,
+};
+
+static const char *STAT_NAMES[N_STATS] = {
+  [STAT_PTRACE_TRACEME] = "ptrace TRACEME",
+  [STAT_PTRACE_PEEKDATA] = "ptrace PEEKDATA",
+  [STAT_PTRACE_POKEDATA] = "ptrace POKEDATA",
+  [STAT_PTRACE_GETREGS] = "ptrace GETREGS",
+  [STAT_PTRACE_GETFPREGS] = "ptrace GETFPREGS",
+  [STAT_PTRACE_SETREGS] = "ptrace SETREGS",
+  [STAT_PTRACE_CONT] = "ptrace CONT",
+  [STAT_PTRACE_SINGLESTEP] = "ptrace SINGLESTEP",
+  [STAT_PTRACE_SINGLEBLOCK] = "ptrace SINGLEBLOCK",
+  [STAT_PTRACE_GETSIGINFO] = "ptrace GETSIGINFO",
+  [STAT_PTRACE_SEIZE] = "ptrace SEIZE",
+  [STAT_PTRACE_SETOPTIONS] = "ptrace SETOPTIONS",
+  [STAT_PTRACE_DETACH] = "ptrace DETACH",
+  [STAT_PTRACE_INTERRUPT] = "ptrace INTERRUPT",
+  [STAT_PTRACE_GETEVENTMSG] = "ptrace GETEVENTMSG",
+  [STAT_PROCESS_VM_READV] = "process_vm_readv",
+  [STAT_WAITPID] = "waitpid",
+  [STAT_BYTES_READ] = "bytes read",
+  [STAT_DIE_VISITS] = "DIE visits",
+  [STAT_LINE_TABLE_DECODES] = "line table decodes",
+  [STAT_SYMBOL_LOOKUPS] = "symbol lookups",
+  [STAT_SYMBOL_CACHE_HITS] = "symbol cache hits",
+  [STAT_SYMBOL_CACHE_MISSES] = "symbol cache misses",
+  [STAT_STOP_CACHE_HITS] = "stop cache hits",
+  [STAT_STOP_CACHE_MISSES] = "stop cache misses",
+};
+
+/* DIEs are also visited by the thread that loads the
+ * debug information, so the counters are atomic. */
+static _Atomic uint64_t counters[N_STATS];
+
+/* Commands are only run by the main thread. */
+typedef struct
+{
+  char name[COMMAND_NAME_BUF_SIZE];
+  uint64_t n_runs;
+  double total_ms;
+} CommandTime;
+
+static CommandTime command_times[MAX_TIMED_COMMANDS];
+static size_t n_command_times = 0;
+
+void
+add_stat (Stat stat, uint64_t n)
+{
+  assert (stat < N_STATS);
+  atomic_fetch_add_explicit (&counters[stat], n, memory_order_relaxed);
+}
+
+uint64_t
+get_stat (Stat stat)
+{
+  assert (stat < N_STATS);
+  return atomic_load_explicit (&counters[stat], memory_order_relaxed);
+}
+
+void
+add_command_time (const char *cmd, double ms)
+{
+  assert (cmd != NULL);
+
+  CommandTime *time = NULL;
+  for (size_t i = 0; i < n_command_times; i++)
+    {
+      if (str_eq (command_times[i].name, cmd))
+	{
+	  time = &command_times[i];
+	  break;
+	}
+    }
+
+  if (time == NULL)
+    {
+      if (n_command_times == MAX_TIMED_COMMANDS)
+	{
+	  return;
+	}
+      time = &command_times[n_command_times++];
+      snprintf (time->name, COMMAND_NAME_BUF_SIZE, "%s", cmd);
+    }
+
+  time->n_runs++;
+  time->total_ms += ms;
+}
+
+void
+reset_stats (void)
+{
+  for (size_t i = 0; i < N_STATS; i++)
+    {
+      atomic_store_explicit (&counters[i], 0, memory_order_relaxed);
+    }
+  memset (command_times, 0, sizeof (command_times));
+  n_command_times = 0;
+}
+
+void
+print_stats (FILE *stream)
+{
+  assert (stream != NULL);
+
+  for (size_t i = 0; i < N_STATS; i++)
+    {
+      fprintf (stream, "%-22s %12" PRIu64 "\n", STAT_NAMES[i], get_stat (i));
+    }
+
+  if (n_command_times > 0)
+    {
+      fprintf (stream, "\n%-22s %12s %12s %12s\n", "command", "runs",
+	       "total ms", "mean ms");
+      for (size_t i = 0; i < n_command_times; i++)
+	{
+	  const CommandTime *time = &command_times[i];
+	  fprintf (stream, "%-22s %12" PRIu64 " %12.3f %12.3f\n", time->name,
+		   time->n_runs, time->total_ms,
+		   time->total_ms / time->n_runs);
+	}
+    }
+}
@@ -0,0 +1,61 @@
+/* Counters of the work that the debugger does on its hot paths.
+ * They're always on and cost one atomic increment each. */
+
+#pragma once
+
+#ifndef _SPRAY_STATS_H_
+#define _SPRAY_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+  /* One counter per `ptrace` request. The names must be the
+   * request names with `STAT_` in front of them. */
+  STAT_PTRACE_TRACEME,
+  STAT_PTRACE_PEEKDATA,
+  STAT_PTRACE_POKEDATA,
+  STAT_PTRACE_GETREGS,
+  STAT_PTRACE_GETFPREGS,
+  STAT_PTRACE_SETREGS,
+  STAT_PTRACE_CONT,
+  STAT_PTRACE_SINGLESTEP,
+  STAT_PTRACE_SINGLEBLOCK,
+  STAT_PTRACE_GETSIGINFO,
+  STAT_PTRACE_SEIZE,
+  STAT_PTRACE_SETOPTIONS,
+  STAT_PTRACE_DETACH,
+  STAT_PTRACE_INTERRUPT,
+  STAT_PTRACE_GETEVENTMSG,
+  STAT_PROCESS_VM_READV,
+  STAT_WAITPID,
+  /* Bytes of the tracee's memory that were read. */
+  STAT_BYTES_READ,
+  STAT_DIE_VISITS,
+  STAT_LINE_TABLE_DECODES,
+  STAT_SYMBOL_LOOKUPS,
+  /* Symbols looked up by address are cached. */
+  STAT_SYMBOL_CACHE_HITS,
+  STAT_SYMBOL_CACHE_MISSES,
+  /* The stack snapshot and the call frames are
+   * cached until the tracee runs again. */
+  STAT_STOP_CACHE_HITS,
+  STAT_STOP_CACHE_MISSES,
+  N_STATS,
+} Stat;
+
+/* Add `n` to the counter `stat`. Safe to call from any thread. */
+void add_stat (Stat stat, uint64_t n);
+
+uint64_t get_stat (Stat stat);
+
+/* Record that the command `cmd` ran for `ms` milliseconds. */
+void add_command_time (const char *cmd, double ms);
+
+/* Set all counters and command times back to zero. */
+void reset_stats (void);
+
+void print_stats (FILE *stream);
+
+#endif /* _SPRAY_STATS_H_ */
@@ -0,0 +1,769 @@
+/* Required to use `open_memstream`. */
+#define _GNU_SOURCE
+
+#include "symbolize.h"
+
+#include "spray_dwarf.h"
+#include "spray_elf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum
+{
+  SYMBOLIZE_ALLOC_SIZE = 1024,
+  /* Inlined calls nested deeper than this are cut off. */
+  MAX_INLINE_DEPTH = 64,
+  /* Initial size of the buffer that input is read into. */
+  INPUT_BUF_SIZE = 1 << 16,
+  /* Batches with fewer addresses than this are symbolized
+   * by the calling thread alone. */
+  MIN_ADDRS_PER_THREAD = 1024,
+  MAX_SYMBOLIZE_THREADS = 16,
+};
+
+/* A row of the line table. Rows that end a sequence
+ * mark the first address that isn't part of it. */
+typedef struct
+{
+  dbg_addr addr;
+  const char *filepath;
+  unsigned line;
+  unsigned column;
+  bool end_sequence;
+  size_t order;			/* Position in the line table. */
+} LineRow;
+
+/* A function that isn't inlined and the instances of other
+ * functions that were inlined into it. These instances are
+ * `inlines[first_inline, first_inline + n_inlines)`. A function
+ * whose code is split has one of these for each range, which
+ * all share the instances. */
+typedef struct
+{
+  SdFunction func;
+  size_t first_inline;
+  size_t n_inlines;
+} Subprogram;
+
+struct Symbolizer
+{
+  ElfFile elf;
+  /* Owns all strings in the indexes. */
+  Dwarf_Debug dbg;
+  /* Sorted by address. */
+  LineRow *rows;
+  size_t n_rows;
+  size_t n_rows_alloc;
+  /* Sorted by low PC. */
+  Subprogram *subprograms;
+  size_t n_subprograms;
+  size_t n_subprograms_alloc;
+  /* In the order of the DIE tree, so that outer
+   * instances come before the ones nested in them. */
+  SdFunction *inlines;
+  size_t n_inlines;
+  size_t n_inlines_alloc;
+  /* Function symbols sorted by address. Used for
+   * functions that have no debug information. */
+  const Elf64_Sym **symbols;
+  size_t n_symbols;
+};
+
+/* Return the file path in the last row that equals `filepath`
+ * or `filepath` itself. Each row gets its own copy of the file
+ * path from libdwarf, so this saves comparing them later. */
+const char *
+intern_filepath (const Symbolizer *sym, const char *filepath)
+{
+  if (filepath == NULL)
+    {
+      return NULL;
+    }
+
+  /* Consecutive rows are usually in the same file. */
+  for (size_t i = sym->n_rows; i > 0; i--)
+    {
+      const char *row_filepath = sym->rows[i - 1].filepath;
+      if (row_filepath == filepath
+	  || (row_filepath != NULL && str_eq (row_filepath, filepath)))
+	{
+	  return row_filepath;
+	}
+    }
+
+  return filepath;
+}
+
+SprayResult
+callback__add_line_row (LineEntry *line, void *const data)
+{
+  assert (line != NULL);
+  assert (data != NULL);
+
+  Symbolizer *sym = (Symbolizer *) data;
+
+  if (sym->n_rows >= sym->n_rows_alloc)
+    {
+      sym->n_rows_alloc += SYMBOLIZE_ALLOC_SIZE;
+      sym->rows = realloc (sym->rows, sizeof (*sym->rows) * sym->n_rows_alloc);
+      assert (sym->rows != NULL);
+    }
+
+  sym->rows[sym->n_rows] = (LineRow)
+  {
+    .addr = line->addr,
+    .filepath = intern_filepath (sym, line->filepath),
+    .line = line->ln,
+    .column = line->cl,
+    .end_sequence = line->end_sequence,
+    .order = sym->n_rows,
+  };
+  sym->n_rows++;
+
+  return SP_OK;
+}
+
+SprayResult
+callback__add_function (const SdFunction *func, void *const data)
+{
+  assert (func != NULL);
+  assert (data != NULL);
+
+  Symbolizer *sym = (Symbolizer *) data;
+
+  if (!func->is_inlined)
+    {
+      if (sym->n_subprograms >= sym->n_subprograms_alloc)
+	{
+	  sym->n_subprograms_alloc += SYMBOLIZE_ALLOC_SIZE;
+	  sym->subprograms = realloc (sym->subprograms,
+				      sizeof (*sym->subprograms)
+				      * sym->n_subprograms_alloc);
+	  assert (sym->subprograms != NULL);
+	}
+
+      sym->subprograms[sym->n_subprograms++] = (Subprogram)
+      {
+	.func = *func,
+	.first_inline = sym->n_inlines,
+	.n_inlines = 0,
+      };
+      return SP_OK;
+    }
+
+  /* The function that this instance was inlined into is the
+   * last one that was added. If its code is split, its ranges
+   * were added right before and the instance is in one of them. */
+  if (sym->n_subprograms == 0)
+    {
+      return SP_OK;
+    }
+  size_t first_range = sym->n_subprograms - 1;
+  while (first_range > 0
+	 && sym->subprograms[first_range].func.range_idx > 0)
+    {
+      first_range--;
+    }
+
+  bool is_nested = false;
+  for (size_t i = first_range; i < sym->n_subprograms && !is_nested; i++)
+    {
+      const SdFunction *outer = &sym->subprograms[i].func;
+      is_nested = func->low_pc.value >= outer->low_pc.value
+	&& func->low_pc.value < outer->high_pc.value
+	&& func->level > outer->level;
+    }
+  if (!is_nested)
+    {
+      return SP_OK;
+    }
+
+  if (sym->n_inlines >= sym->n_inlines_alloc)
+    {
+      sym->n_inlines_alloc += SYMBOLIZE_ALLOC_SIZE;
+      sym->inlines = realloc (sym->inlines,
+			      sizeof (*sym->inlines) * sym->n_inlines_alloc);
+      assert (sym->inlines != NULL);
+    }
+
+  sym->inlines[sym->n_inlines++] = *func;
+  for (size_t i = first_range; i < sym->n_subprograms; i++)
+    {
+      sym->subprograms[i].n_inlines++;
+    }
+
+  return SP_OK;
+}
+
+int
+line_row_compare (const void *a, const void *b)
+{
+  const LineRow *row_a = (LineRow *) a;
+  const LineRow *row_b = (LineRow *) b;
+
+  if (row_a->addr.value != row_b->addr.value)
+    {
+      return row_a->addr.value < row_b->addr.value ? -1 : 1;
+    }
+  /* A sequence may start at the address where another one
+   * ends. Its rows must take precedence over the end. */
+  if (row_a->end_sequence != row_b->end_sequence)
+    {
+      return row_a->end_sequence ? -1 : 1;
+    }
+  return row_a->order < row_b->order ? -1 : row_a->order > row_b->order;
+}
+
+int
+subprogram_compare (const void *a, const void *b)
+{
+  const Subprogram *sub_a = (Subprogram *) a;
+  const Subprogram *sub_b = (Subprogram *) b;
+  uint64_t low_a = sub_a->func.low_pc.value;
+  uint64_t low_b = sub_b->func.low_pc.value;
+  return low_a < low_b ? -1 : low_a > low_b;
+}
+
+int
+symbol_compare (const void *a, const void *b)
+{
+  const Elf64_Sym *sym_a = *(const Elf64_Sym **) a;
+  const Elf64_Sym *sym_b = *(const Elf64_Sym **) b;
+  return sym_a->st_value < sym_b->st_value ? -1
+    : sym_a->st_value > sym_b->st_value;
+}
+
+void
+init_symbol_index (Symbolizer *sym)
+{
+  assert (sym != NULL);
+
+  size_t n_symbols = 0;
+  const Elf64_Sym *symbols = se_symbols (&sym->elf, &n_symbols);
+
+  sym->symbols = calloc (n_symbols > 0 ? n_symbols : 1,
+			 sizeof (*sym->symbols));
+  assert (sym->symbols != NULL);
+
+  for (size_t i = 0; i < n_symbols; i++)
+    {
+      if (se_symbol_type (&symbols[i]) == STT_FUNC
+	  && symbols[i].st_value != 0)
+	{
+	  sym->symbols[sym->n_symbols++] = &symbols[i];
+	}
+    }
+
+  qsort (sym->symbols, sym->n_symbols, sizeof (*sym->symbols),
+	 symbol_compare);
+}
+
+Symbolizer *
+init_symbolizer (const char *filepath)
+{
+  assert (filepath != NULL);
+
+  Symbolizer *sym = calloc (1, sizeof (*sym));
+  assert (sym != NULL);
+
+  if (se_parse_elf (filepath, &sym->elf) != ELF_PARSE_OK)
+    {
+      free (sym);
+      return NULL;
+    }
+
+  Dwarf_Error error = NULL;
+  sym->dbg = sd_dwarf_init (filepath, &error);
+  if (sym->dbg == NULL)
+    {
+      se_free_elf (sym->elf);
+      free (sym);
+      return NULL;
+    }
+
+  /* libdwarf reads all of the DWARF if this fails. */
+  sd_set_sections (sym->dbg, &sym->elf);
+
+  if (sd_for_each_row (sym->dbg, callback__add_line_row, sym) == SP_ERR
+      || sd_for_each_function (sym->dbg, callback__add_function,
+			       sym) == SP_ERR)
+    {
+      free_symbolizer (sym);
+      return NULL;
+    }
+
+  qsort (sym->rows, sym->n_rows, sizeof (*sym->rows), line_row_compare);
+  qsort (sym->subprograms, sym->n_subprograms, sizeof (*sym->subprograms),
+	 subprogram_compare);
+  init_symbol_index (sym);
+
+  return sym;
+}
+
+void
+free_symbolizer (Symbolizer *sym)
+{
+  if (sym == NULL)
+    {
+      return;
+    }
+
+  free (sym->rows);
+  free (sym->subprograms);
+  free (sym->inlines);
+  free (sym->symbols);
+  sd_clear_sections (sym->dbg);
+  dwarf_finish (sym->dbg);
+  se_free_elf (sym->elf);
+  free (sym);
+}
+
+/* Get the line table row that `addr` belongs
+ * to. Returns NULL if there is no such row. */
+const LineRow *
+find_line_row (const Symbolizer *sym, dbg_addr addr)
+{
+  assert (sym != NULL);
+
+  /* Find the last row whose address isn't past `addr`. */
+  size_t lo = 0;
+  size_t hi = sym->n_rows;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (sym->rows[mid].addr.value <= addr.value)
+	{
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+
+  if (lo == 0 || sym->rows[lo - 1].end_sequence)
+    {
+      return NULL;
+    }
+  return &sym->rows[lo - 1];
+}
+
+/* Get the function that isn't inlined and contains `addr`.
+ * Returns NULL if there is no such function. */
+const Subprogram *
+find_subprogram (const Symbolizer *sym, dbg_addr addr)
+{
+  assert (sym != NULL);
+
+  size_t lo = 0;
+  size_t hi = sym->n_subprograms;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (sym->subprograms[mid].func.low_pc.value <= addr.value)
+	{
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+
+  if (lo == 0 || addr.value >= sym->subprograms[lo - 1].func.high_pc.value)
+    {
+      return NULL;
+    }
+  return &sym->subprograms[lo - 1];
+}
+
+/* Get the name of the function symbol that contains `addr`.
+ * Returns NULL if there is no such symbol. */
+const char *
+find_symbol_name (const Symbolizer *sym, dbg_addr addr)
+{
+  assert (sym != NULL);
+
+  size_t lo = 0;
+  size_t hi = sym->n_symbols;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (sym->symbols[mid]->st_value <= addr.value)
+	{
+	  lo = mid + 1;
+	}
+      else
+	{
+	  hi = mid;
+	}
+    }
+
+  if (lo == 0)
+    {
+      return NULL;
+    }
+
+  const Elf64_Sym *symbol = sym->symbols[lo - 1];
+  if (addr.value >= symbol->st_value + symbol->st_size)
+    {
+      return NULL;
+    }
+  return se_symbol_name (symbol, &sym->elf);
+}
+
+void
+print_frame (FILE *out, const char *name, const char *filepath,
+	     unsigned line, unsigned column)
+{
+  if (filepath == NULL)
+    {
+      fprintf (out, "%s\n??:0:0\n", name != NULL ? name : "??");
+    }
+  else
+    {
+      fprintf (out, "%s\n%s:%u:%u\n", name != NULL ? name : "??",
+	       filepath, line, column);
+    }
+}
+
+void
+symbolize_addr (const Symbolizer *sym, dbg_addr addr, bool inlines,
+		FILE *out)
+{
+  assert (sym != NULL);
+  assert (out != NULL);
+
+  const LineRow *row = find_line_row (sym, addr);
+  const char *filepath = row != NULL ? row->filepath : NULL;
+  unsigned line = row != NULL ? row->line : 0;
+  unsigned column = row != NULL ? row->column : 0;
+
+  const Subprogram *subprogram = find_subprogram (sym, addr);
+  if (subprogram == NULL)
+    {
+      print_frame (out, find_symbol_name (sym, addr), filepath, line,
+		   column);
+      fprintf (out, "\n");
+      return;
+    }
+
+  /* Instances that contain `addr` are nested in the ones that
+   * come before them, because the instances are in tree order
+   * and the ranges of siblings don't overlap. */
+  const SdFunction *chain[MAX_INLINE_DEPTH];
+  size_t depth = 0;
+  const SdFunction *first = &sym->inlines[subprogram->first_inline];
+  for (size_t i = 0; i < subprogram->n_inlines && depth < MAX_INLINE_DEPTH;
+       i++)
+    {
+      if (first[i].low_pc.value <= addr.value
+	  && addr.value < first[i].high_pc.value)
+	{
+	  chain[depth++] = &first[i];
+	}
+    }
+
+  /* Each frame is at the position where the
+   * function of the frame below it was called. */
+  for (size_t i = depth; i > 0; i--)
+    {
+      const SdFunction *inlined = chain[i - 1];
+      print_frame (out, inlined->name, filepath, line, column);
+      if (!inlines)
+	{
+	  fprintf (out, "\n");
+	  return;
+	}
+      filepath = inlined->call_file;
+      line = inlined->call_line;
+      column = inlined->call_column;
+    }
+
+  const char *name = subprogram->func.name != NULL
+    ? subprogram->func.name : find_symbol_name (sym, addr);
+  print_frame (out, name, filepath, line, column);
+  fprintf (out, "\n");
+}
+
+/* An address that was read. Lines that
+ * aren't addresses are kept as unknown. */
+typedef struct
+{
+  dbg_addr addr;
+  bool is_valid;
+} InputAddr;
+
+typedef struct
+{
+  const Symbolizer *sym;
+  bool inlines;
+  const InputAddr *addrs;
+  size_t n_addrs;
+  /* Output of this thread. */
+  char *out_buf;
+  size_t out_size;
+} SymbolizeTask;
+
+void
+symbolize_addrs (const Symbolizer *sym, bool inlines,
+		 const InputAddr *addrs, size_t n_addrs, FILE *out)
+{
+  for (size_t i = 0; i < n_addrs; i++)
+    {
+      if (addrs[i].is_valid)
+	{
+	  symbolize_addr (sym, addrs[i].addr, inlines, out);
+	}
+      else
+	{
+	  print_frame (out, NULL, NULL, 0, 0);
+	  fprintf (out, "\n");
+	}
+    }
+}
+
+void *
+run_symbolize_task (void *data)
+{
+  SymbolizeTask *task = (SymbolizeTask *) data;
+
+  FILE *out = open_memstream (&task->out_buf, &task->out_size);
+  if (out == NULL)
+    {
+      return NULL;
+    }
+  symbolize_addrs (task->sym, task->inlines, task->addrs, task->n_addrs,
+		   out);
+  fclose (out);
+
+  return NULL;
+}
+
+/* Symbolize `addrs` and write the output in the order of the
+ * input. Large batches are split up between several threads. */
+SprayResult
+symbolize_batch (const Symbolizer *sym, bool inlines,
+		 const InputAddr *addrs, size_t n_addrs, FILE *out)
+{
+  long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t n_threads = n_addrs / MIN_ADDRS_PER_THREAD;
+  if (n_cpus > 0 && n_threads > (size_t) n_cpus)
+    {
+      n_threads = n_cpus;
+    }
+  if (n_threads > MAX_SYMBOLIZE_THREADS)
+    {
+      n_threads = MAX_SYMBOLIZE_THREADS;
+    }
+
+  if (n_threads <= 1)
+    {
+      symbolize_addrs (sym, inlines, addrs, n_addrs, out);
+      return SP_OK;
+    }
+
+  SymbolizeTask tasks[MAX_SYMBOLIZE_THREADS] = { 0 };
+  pthread_t threads[MAX_SYMBOLIZE_THREADS];
+  size_t per_thread = (n_addrs + n_threads - 1) / n_threads;
+  size_t n_started = 0;
+
+  for (size_t i = 0; i < n_threads; i++)
+    {
+      size_t start = i * per_thread;
+      tasks[i] = (SymbolizeTask)
+      {
+	.sym = sym,
+	.inlines = inlines,
+	.addrs = &addrs[start],
+	.n_addrs = start < n_addrs
+	  ? (n_addrs - start < per_thread ? n_addrs - start : per_thread) : 0,
+      };
+    }
+
+  /* The first part is done by the calling thread. */
+  for (size_t i = 1; i < n_threads; i++)
+    {
+      if (pthread_create (&threads[i], NULL, run_symbolize_task,
+			  &tasks[i]) != 0)
+	{
+	  break;
+	}
+      n_started++;
+    }
+
+  run_symbolize_task (&tasks[0]);
+
+  SprayResult res = SP_OK;
+  for (size_t i = 0; i < n_threads; i++)
+    {
+      if (i > 0 && i <= n_started)
+	{
+	  pthread_join (threads[i], NULL);
+	}
+
+      /* Tasks that couldn't be started run here. */
+      if (i > n_started)
+	{
+	  symbolize_addrs (sym, inlines, tasks[i].addrs, tasks[i].n_addrs,
+			   out);
+	  continue;
+	}
+
+      if (tasks[i].out_buf == NULL)
+	{
+	  res = SP_ERR;
+	  continue;
+	}
+      fwrite (tasks[i].out_buf, 1, tasks[i].out_size, out);
+      free (tasks[i].out_buf);
+    }
+
+  return res;
+}
+
+/* Parse the addresses in the lines `buf[0, n)`. The array
+ * that's returned must be `free`'d by the caller. */
+InputAddr *
+parse_input_addrs (char *buf, size_t n, size_t *n_addrs)
+{
+  size_t n_lines = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      n_lines += buf[i] == '\n';
+    }
+  /* The last line might not end in a newline. */
+  n_lines++;
+
+  InputAddr *addrs = calloc (n_lines, sizeof (*addrs));
+  assert (addrs != NULL);
+
+  *n_addrs = 0;
+  char *line = buf;
+  char *end = buf + n;
+  while (line < end)
+    {
+      char *newline = memchr (line, '\n', end - line);
+      if (newline == NULL)
+	{
+	  newline = end;
+	}
+      *newline = '\0';
+
+      while (*line == ' ' || *line == '\t')
+	{
+	  line++;
+	}
+
+      if (*line != '\0' && *line != '\r')
+	{
+	  char *addr_end = NULL;
+	  errno = 0;
+	  uint64_t value = strtoull (line, &addr_end, 16);
+	  while (*addr_end == ' ' || *addr_end == '\t' || *addr_end == '\r')
+	    {
+	      addr_end++;
+	    }
+	  addrs[*n_addrs] = (InputAddr)
+	  {
+	    .addr = {value},
+	    .is_valid = errno == 0 && addr_end != line && *addr_end == '\0',
+	  };
+	  (*n_addrs)++;
+	}
+
+      line = newline + 1;
+    }
+
+  return addrs;
+}
+
+bool
+has_more_input (int in_fd)
+{
+  struct pollfd pollfd = {.fd = in_fd,.events = POLLIN };
+  return poll (&pollfd, 1, 0) == 1 && (pollfd.revents & POLLIN);
+}
+
+SprayResult
+run_symbolizer (const Symbolizer *sym, bool inlines, int in_fd, FILE *out)
+{
+  assert (sym != NULL);
+  assert (out != NULL);
+
+  size_t buf_size = INPUT_BUF_SIZE;
+  char *buf = malloc (buf_size);
+  assert (buf != NULL);
+  size_t n_buf = 0;
+  bool is_eof = false;
+  SprayResult res = SP_OK;
+
+  while (!is_eof && res == SP_OK)
+    {
+      /* Wait for input and then take all input that's ready. */
+      do
+	{
+	  if (n_buf == buf_size)
+	    {
+	      buf_size *= 2;
+	      buf = realloc (buf, buf_size);
+	      assert (buf != NULL);
+	    }
+
+	  ssize_t n_read = read (in_fd, buf + n_buf, buf_size - n_buf);
+	  if (n_read == -1 && errno == EINTR)
+	    {
+	      continue;
+	    }
+	  else if (n_read == -1)
+	    {
+	      res = SP_ERR;
+	      break;
+	    }
+	  else if (n_read == 0)
+	    {
+	      is_eof = true;
+	      break;
+	    }
+	  n_buf += n_read;
+	}
+      while (has_more_input (in_fd));
+
+      /* A line that isn't complete yet is kept for the next batch. */
+      size_t n_lines = n_buf;
+      if (!is_eof)
+	{
+	  while (n_lines > 0 && buf[n_lines - 1] != '\n')
+	    {
+	      n_lines--;
+	    }
+	}
+
+      size_t n_addrs = 0;
+      InputAddr *addrs = parse_input_addrs (buf, n_lines, &n_addrs);
+      if (symbolize_batch (sym, inlines, addrs, n_addrs, out) == SP_ERR)
+	{
+	  res = SP_ERR;
+	}
+      free (addrs);
+
+      memmove (buf, buf + n_lines, n_buf - n_lines);
+      n_buf -= n_lines;
+
+      /* Flush each batch so that it's possible to wait for
+       * the output of one address before writing the next. */
+      if (fflush (out) == EOF)
+	{
+	  res = SP_ERR;
+	}
+    }
+
+  free (buf);
+  return res;
+}
@@ -0,0 +1,41 @@
+/* Turn addresses in an executable into functions and source
+ * positions without running it. All lookups go through indexes
+ * which are built once and then shared by all threads. */
+
+#pragma once
+
+#ifndef _SPRAY_SYMBOLIZE_H_
+#define _SPRAY_SYMBOLIZE_H_
+
+#include "magic.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct Symbolizer Symbolizer;
+
+/* Map the executable at `filepath` and build the indexes
+ * of its line table rows, functions, inlined calls and
+ * function symbols. Returns NULL on error. */
+Symbolizer *init_symbolizer (const char *filepath);
+
+void free_symbolizer (Symbolizer * sym);
+
+/* Write the function and the `file:line:column` position of `addr`
+ * to `out`, each on a line of its own. If `inlines` is set, the
+ * same is written for each function that the code at `addr` was
+ * inlined into, starting with the innermost one. The frames of an
+ * address are followed by an empty line. Unknown functions and
+ * positions are written as `??` and `??:0:0`. Safe to call from
+ * several threads at once. */
+void symbolize_addr (const Symbolizer * sym, dbg_addr addr, bool inlines,
+		     FILE * out);
+
+/* Read hexadecimal addresses from `in_fd`, one per line, and write
+ * what `symbolize_addr` writes for each of them to `out`. Whatever
+ * input is available is symbolized as one batch, which is split up
+ * between several threads if it's large. */
+SprayResult run_symbolizer (const Symbolizer * sym, bool inlines, int in_fd,
+			    FILE * out);
+
+#endif /* _SPRAY_SYMBOLIZE_H_ */
@@ -0,0 +1,902 @@
+/* Required to use `__WALL` */
+#define _GNU_SOURCE
+
+#include "threads.h"
+
+#include "hashmap.h"
+#include "ptrace.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+typedef enum
+{
+  THREAD_RUNNING,
+  THREAD_STOPPED,
+} ThreadState;
+
+typedef struct
+{
+  pid_t tid;			/* The thread id is the only member that's
+				 * used to compare and look up threads. */
+  size_t number;
+  ThreadState state;
+  bool has_pending_status;
+  int pending_status;
+  size_t pending_order;		/* Pending stops are reported in order. */
+  bool has_regs;
+  struct user_regs_struct regs;
+  int signal;			/* Delivered on the next resume, or 0. */
+} Thread;
+
+struct Threads
+{
+  struct hashmap *map;
+  pid_t leader;
+  size_t next_number;
+  size_t n_running;
+  size_t n_pending;
+  size_t next_pending_order;
+  bool report_pending;
+  bool has_pending_exit;
+  int pending_exit_status;
+};
+
+int
+thread_compare (const void *a, const void *b, void *udata)
+{
+  unused (udata);
+  const Thread *thread_a = (Thread *) a;
+  const Thread *thread_b = (Thread *) b;
+  return !(thread_a->tid == thread_b->tid);
+}
+
+uint64_t
+thread_hash (const void *entry, uint64_t seed0, uint64_t seed1)
+{
+  const Thread *thread = (Thread *) entry;
+  pid_t tid = thread->tid;
+  return hashmap_sip (&tid, sizeof (tid), seed0, seed1);
+}
+
+/* Create a thread table without any threads in it. */
+Threads *
+new_threads (pid_t pid)
+{
+  Threads *threads = calloc (1, sizeof (*threads));
+  if (threads == NULL)
+    {
+      return NULL;
+    }
+
+  threads->map = hashmap_new (sizeof (Thread), 0, 0, 0,
+			      thread_hash, thread_compare, NULL, NULL);
+  if (threads->map == NULL)
+    {
+      free (threads);
+      return NULL;
+    }
+
+  threads->leader = pid;
+  threads->next_number = 1;
+
+  return threads;
+}
+
+void add_thread (Threads * threads, pid_t tid, ThreadState state);
+
+Threads *
+init_threads (pid_t pid)
+{
+  Threads *threads = new_threads (pid);
+  if (threads != NULL)
+    {
+      add_thread (threads, pid, THREAD_STOPPED);
+    }
+  return threads;
+}
+
+/* `qsort` comparison function for thread ids. */
+int
+compare_tids (const void *a, const void *b)
+{
+  pid_t tid_a = *(const pid_t *) a;
+  pid_t tid_b = *(const pid_t *) b;
+  return (tid_a > tid_b) - (tid_a < tid_b);
+}
+
+Threads *
+init_stopped_threads (pid_t pid, const pid_t *tids, size_t n_tids)
+{
+  assert (tids != NULL);
+
+  Threads *threads = init_threads (pid);
+  if (threads == NULL)
+    {
+      return NULL;
+    }
+
+  /* Ids are assigned in increasing order, so sorting them
+   * approximates the order in which the threads were created. */
+  pid_t *sorted = calloc (n_tids + 1, sizeof (pid_t));
+  assert (sorted != NULL);
+  memcpy (sorted, tids, n_tids * sizeof (pid_t));
+  qsort (sorted, n_tids, sizeof (pid_t), compare_tids);
+
+  for (size_t i = 0; i < n_tids; i++)
+    {
+      add_thread (threads, sorted[i], THREAD_STOPPED);
+    }
+  free (sorted);
+
+  return threads;
+}
+
+void
+free_threads (Threads *threads)
+{
+  if (threads != NULL)
+    {
+      hashmap_free (threads->map);
+      free (threads);
+    }
+}
+
+size_t
+n_threads (const Threads *threads)
+{
+  assert (threads != NULL);
+  return hashmap_count (threads->map);
+}
+
+pid_t
+threads_leader (const Threads *threads)
+{
+  assert (threads != NULL);
+  return threads->leader;
+}
+
+const Thread *
+get_thread (const Threads *threads, pid_t tid)
+{
+  assert (threads != NULL);
+
+  Thread lookup = {.tid = tid };
+  return hashmap_get (threads->map, &lookup);
+}
+
+bool
+lookup_thread (const Threads *threads, pid_t tid)
+{
+  return get_thread (threads, tid) != NULL;
+}
+
+SprayResult
+thread_number (const Threads *threads, pid_t tid, size_t *number)
+{
+  assert (number != NULL);
+
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL)
+    {
+      return SP_ERR;
+    }
+
+  *number = thread->number;
+  return SP_OK;
+}
+
+SprayResult
+thread_by_number (const Threads *threads, size_t number, pid_t *tid)
+{
+  assert (threads != NULL);
+  assert (tid != NULL);
+
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (threads->map, &iter, &item))
+    {
+      const Thread *thread = (Thread *) item;
+      if (thread->number == number)
+	{
+	  *tid = thread->tid;
+	  return SP_OK;
+	}
+    }
+
+  return SP_ERR;
+}
+
+/* Get the ids of all threads in no particular order.
+ * The caller must free the array. */
+pid_t *
+thread_ids (const Threads *threads, size_t *n_ids)
+{
+  assert (threads != NULL);
+  assert (n_ids != NULL);
+
+  *n_ids = hashmap_count (threads->map);
+  pid_t *tids = calloc (*n_ids + 1, sizeof (pid_t));
+  assert (tids != NULL);
+
+  size_t i = 0;
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (threads->map, &iter, &item))
+    {
+      tids[i++] = ((Thread *) item)->tid;
+    }
+
+  return tids;
+}
+
+/* `qsort_r` comparison function that orders
+ * thread ids by the numbers of their threads. */
+int
+compare_thread_numbers (const void *a, const void *b, void *void_threads)
+{
+  const Threads *threads = (const Threads *) void_threads;
+  size_t number_a = get_thread (threads, *(const pid_t *) a)->number;
+  size_t number_b = get_thread (threads, *(const pid_t *) b)->number;
+  return (number_a > number_b) - (number_a < number_b);
+}
+
+pid_t *
+sorted_threads (const Threads *threads)
+{
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+  qsort_r (tids, n_ids, sizeof (pid_t), compare_thread_numbers,
+	   (void *) threads);
+  return tids;
+}
+
+const struct user_regs_struct *
+thread_registers (Threads *threads, pid_t tid)
+{
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL || thread->state != THREAD_STOPPED)
+    {
+      return NULL;
+    }
+
+  if (!thread->has_regs)
+    {
+      Thread update = *thread;
+      if (pt_read_registers (tid, &update.regs) == SP_ERR)
+	{
+	  return NULL;
+	}
+      update.has_regs = true;
+      hashmap_set (threads->map, &update);
+      thread = get_thread (threads, tid);
+    }
+
+  return &thread->regs;
+}
+
+void
+forget_thread_registers (Threads *threads, pid_t tid)
+{
+  const Thread *thread = get_thread (threads, tid);
+  if (thread != NULL && thread->has_regs)
+    {
+      Thread update = *thread;
+      update.has_regs = false;
+      hashmap_set (threads->map, &update);
+    }
+}
+
+/* Start tracking the new thread `tid` unless it's known already. */
+void
+add_thread (Threads *threads, pid_t tid, ThreadState state)
+{
+  if (lookup_thread (threads, tid))
+    {
+      return;
+    }
+
+  Thread thread = {
+    .tid = tid,
+    .number = threads->next_number++,
+    .state = state,
+  };
+  hashmap_set (threads->map, &thread);
+
+  if (state == THREAD_RUNNING)
+    {
+      threads->n_running++;
+    }
+}
+
+void
+remove_thread (Threads *threads, pid_t tid)
+{
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL)
+    {
+      return;
+    }
+
+  if (thread->state == THREAD_RUNNING)
+    {
+      threads->n_running--;
+    }
+  if (thread->has_pending_status)
+    {
+      threads->n_pending--;
+    }
+
+  Thread lookup = {.tid = tid };
+  hashmap_delete (threads->map, &lookup);
+}
+
+/* Update the state of `tid`. The cached registers of
+ * the thread are dropped since it might have run. */
+void
+set_thread_state (Threads *threads, pid_t tid, ThreadState state)
+{
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL)
+    {
+      return;
+    }
+
+  if (thread->state == THREAD_RUNNING && state == THREAD_STOPPED)
+    {
+      threads->n_running--;
+    }
+  else if (thread->state == THREAD_STOPPED && state == THREAD_RUNNING)
+    {
+      threads->n_running++;
+    }
+
+  Thread update = *thread;
+  update.state = state;
+  update.has_regs = false;
+  if (state == THREAD_RUNNING)
+    {
+      update.signal = 0;
+    }
+  hashmap_set (threads->map, &update);
+}
+
+SprayResult
+set_thread_signal (Threads *threads, pid_t tid, int signo)
+{
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL || thread->state != THREAD_STOPPED)
+    {
+      return SP_ERR;
+    }
+
+  Thread update = *thread;
+  update.signal = signo;
+  hashmap_set (threads->map, &update);
+  return SP_OK;
+}
+
+/* Only the initial thread survives if any thread calls `exec`. The
+ * other threads vanish without reporting that they exited. */
+void
+remove_other_threads (Threads *threads)
+{
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+
+  for (size_t i = 0; i < n_ids; i++)
+    {
+      if (tids[i] != threads->leader)
+	{
+	  remove_thread (threads, tids[i]);
+	}
+    }
+
+  free (tids);
+}
+
+/* Handle the events that are reported for both running and
+ * interrupted threads. Returns `true` if `wait_status` was
+ * one of them. `tid` is left in the stopped state. */
+bool
+handle_thread_event (Threads *threads, pid_t tid, int wait_status)
+{
+  switch (wait_status >> 16)
+    {
+    case PTRACE_EVENT_CLONE:
+      {
+	unsigned long new_tid = 0;
+	if (pt_get_event_msg (tid, &new_tid) == SP_OK)
+	  {
+	    /* The new thread reports a `PTRACE_EVENT_STOP` once it's
+	     * started. That stop might be reported before this event. */
+	    add_thread (threads, (pid_t) new_tid, THREAD_RUNNING);
+	  }
+	set_thread_state (threads, tid, THREAD_STOPPED);
+	return true;
+      }
+    case PTRACE_EVENT_EXEC:
+      remove_other_threads (threads);
+      set_thread_state (threads, tid, THREAD_STOPPED);
+      return true;
+    case PTRACE_EVENT_STOP:
+      /* Initial stop of a new thread, group-stop,
+       * or the result of `PTRACE_INTERRUPT`. */
+      set_thread_state (threads, tid, THREAD_STOPPED);
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Report the oldest stop that happened while all threads were
+ * stopped. Returns -1 if there is no such stop. */
+pid_t
+take_pending_status (Threads *threads, int *wait_status)
+{
+  const Thread *oldest = NULL;
+  size_t iter = 0;
+  void *item = NULL;
+  while (hashmap_iter (threads->map, &iter, &item))
+    {
+      const Thread *thread = (Thread *) item;
+      if (thread->has_pending_status
+	  && (oldest == NULL || thread->pending_order < oldest->pending_order))
+	{
+	  oldest = thread;
+	}
+    }
+
+  if (oldest != NULL)
+    {
+      Thread update = *oldest;
+      update.has_pending_status = false;
+      hashmap_set (threads->map, &update);
+      threads->n_pending--;
+      *wait_status = update.pending_status;
+      return update.tid;
+    }
+  else if (threads->has_pending_exit)
+    {
+      threads->has_pending_exit = false;
+      *wait_status = threads->pending_exit_status;
+      return threads->leader;
+    }
+  else
+    {
+      return -1;
+    }
+}
+
+/* Get the next event of a thread. Returns 0 if `is_blocking` is
+ * false and there is no event. See `wait_for_thread`. */
+pid_t
+next_thread_event (Threads *threads, int *wait_status, bool is_blocking)
+{
+  assert (threads != NULL);
+  assert (wait_status != NULL);
+
+  if (threads->report_pending)
+    {
+      pid_t tid = take_pending_status (threads, wait_status);
+      if (tid != -1)
+	{
+	  return tid;
+	}
+      threads->report_pending = false;
+    }
+
+  /* A single `waitpid` call reports the next event of any thread,
+   * no matter how many threads there are. */
+  while (true)
+    {
+      int status = 0;
+      int options = __WALL | (is_blocking ? 0 : WNOHANG);
+      pid_t tid = pt_wait (-1, &status, options);
+      if (tid == -1)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  return -1;
+	}
+      else if (tid == 0)
+	{
+	  return 0;
+	}
+
+      if (WIFEXITED (status) || WIFSIGNALED (status))
+	{
+	  if (tid == threads->leader)
+	    {
+	      remove_thread (threads, tid);
+	      *wait_status = status;
+	      return tid;
+	    }
+	  remove_thread (threads, tid);
+	  continue;
+	}
+
+      if (!WIFSTOPPED (status))
+	{
+	  *wait_status = status;
+	  return tid;
+	}
+
+      /* Stops of new threads might be reported before the
+       * `PTRACE_EVENT_CLONE` of the thread that created them. */
+      add_thread (threads, tid, THREAD_RUNNING);
+
+      if (handle_thread_event (threads, tid, status))
+	{
+	  pt_continue_execution (tid);
+	  set_thread_state (threads, tid, THREAD_RUNNING);
+	  continue;
+	}
+
+      set_thread_state (threads, tid, THREAD_STOPPED);
+      *wait_status = status;
+      return tid;
+    }
+}
+
+pid_t
+wait_for_thread (Threads *threads, int *wait_status)
+{
+  return next_thread_event (threads, wait_status, true);
+}
+
+pid_t
+poll_thread (Threads *threads, int *wait_status)
+{
+  return next_thread_event (threads, wait_status, false);
+}
+
+/* Did the stopped thread `tid` hit one of the `breakpoints`? If
+ * so, rewind its PC to the breakpoint's address. */
+bool
+rewind_breakpoint_hit (Breakpoints *breakpoints, pid_t tid)
+{
+  siginfo_t siginfo = { 0 };
+  if (breakpoints == NULL
+      || pt_get_signal_info (tid, &siginfo) == SP_ERR
+      || siginfo.si_signo != SIGTRAP
+      || (siginfo.si_code != SI_KERNEL && siginfo.si_code != TRAP_BRKPT))
+    {
+      return false;
+    }
+
+  struct user_regs_struct regs = { 0 };
+  if (pt_read_registers (tid, &regs) == SP_ERR
+      || !lookup_breakpoint (breakpoints, (real_addr) {regs.rip - 1}))
+    {
+      return false;
+    }
+
+  regs.rip -= 1;
+  return pt_write_registers (tid, &regs) == SP_OK;
+}
+
+SprayResult
+stop_all_threads (Threads *threads, Breakpoints *breakpoints)
+{
+  assert (threads != NULL);
+
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+  for (size_t i = 0; i < n_ids; i++)
+    {
+      const Thread *thread = get_thread (threads, tids[i]);
+      if (thread->state == THREAD_RUNNING)
+	{
+	  /* Threads that are gone already report their exit below. */
+	  pt_interrupt (tids[i]);
+	}
+    }
+  free (tids);
+
+  while (threads->n_running > 0)
+    {
+      int status = 0;
+      pid_t tid = pt_wait (-1, &status, __WALL);
+      if (tid == -1)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  return SP_ERR;
+	}
+
+      if (WIFEXITED (status) || WIFSIGNALED (status))
+	{
+	  if (tid == threads->leader)
+	    {
+	      threads->has_pending_exit = true;
+	      threads->pending_exit_status = status;
+	    }
+	  remove_thread (threads, tid);
+	  continue;
+	}
+
+      if (!WIFSTOPPED (status))
+	{
+	  continue;
+	}
+
+      add_thread (threads, tid, THREAD_RUNNING);
+
+      if (handle_thread_event (threads, tid, status))
+	{
+	  continue;
+	}
+
+      set_thread_state (threads, tid, THREAD_STOPPED);
+
+      /* The breakpoint is hit again once the thread is resumed, unless
+       * it was deleted in the meantime. Either way, there is nothing
+       * to report. The interrupt is still pending and will be reported
+       * as a `PTRACE_EVENT_STOP` that `wait_for_thread` ignores. */
+      if (!rewind_breakpoint_hit (breakpoints, tid))
+	{
+	  Thread update = *get_thread (threads, tid);
+	  update.has_pending_status = true;
+	  update.pending_status = status;
+	  update.pending_order = threads->next_pending_order++;
+	  hashmap_set (threads->map, &update);
+	  threads->n_pending++;
+	}
+    }
+
+  return SP_OK;
+}
+
+SprayResult
+resume_all_threads (Threads *threads)
+{
+  assert (threads != NULL);
+
+  if (threads->n_pending > 0 || threads->has_pending_exit)
+    {
+      threads->report_pending = true;
+      return SP_OK;
+    }
+
+  SprayResult res = SP_OK;
+  int resume_errno = 0;
+
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+  for (size_t i = 0; i < n_ids; i++)
+    {
+      const Thread *thread = get_thread (threads, tids[i]);
+      if (thread->state != THREAD_STOPPED)
+	{
+	  continue;
+	}
+
+      errno = 0;
+      if (pt_continue_with_signal (tids[i], thread->signal) == SP_ERR)
+	{
+	  /* Threads other than the leader may have exited
+	   * already. Their exit is reported later on. */
+	  if (tids[i] == threads->leader || errno != ESRCH)
+	    {
+	      res = SP_ERR;
+	      resume_errno = errno;
+	    }
+	  continue;
+	}
+
+      set_thread_state (threads, tids[i], THREAD_RUNNING);
+    }
+  free (tids);
+
+  errno = resume_errno;
+  return res;
+}
+
+SprayResult
+resume_thread (Threads *threads, pid_t tid)
+{
+  assert (threads != NULL);
+
+  const Thread *thread = get_thread (threads, tid);
+  if (thread == NULL || thread->state != THREAD_STOPPED)
+    {
+      return SP_ERR;
+    }
+
+  /* The stop was reported while all threads were stopped. */
+  if (threads->n_running == 0)
+    {
+      return resume_all_threads (threads);
+    }
+
+  if (pt_continue_with_signal (tid, thread->signal) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+
+  set_thread_state (threads, tid, THREAD_RUNNING);
+  return SP_OK;
+}
+
+/* Seize all threads of `threads->leader` that aren't seized yet.
+ * Returns the number of threads that were seized. */
+size_t
+seize_new_threads (Threads *threads)
+{
+  char task_dirpath[PROC_PID_FILEPATH_LEN] = { 0 };
+  snprintf (task_dirpath, PROC_PID_FILEPATH_LEN, "/proc/%d/task",
+	    threads->leader);
+
+  DIR *task_dir = opendir (task_dirpath);
+  if (task_dir == NULL)
+    {
+      return 0;
+    }
+
+  size_t n_seized = 0;
+  struct dirent *entry = NULL;
+  while ((entry = readdir (task_dir)) != NULL)
+    {
+      pid_t tid = (pid_t) strtol (entry->d_name, NULL, 10);
+      if (tid <= 0 || lookup_thread (threads, tid))
+	{
+	  continue;
+	}
+
+      /* Seizing fails for threads that exited in the meantime and
+       * for threads that were seized automatically on creation.
+       * The latter are added once their creation is reported. */
+      if (pt_seize (tid, PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC) == SP_OK)
+	{
+	  add_thread (threads, tid, THREAD_RUNNING);
+	  n_seized++;
+	}
+    }
+
+  closedir (task_dir);
+
+  return n_seized;
+}
+
+Threads *
+attach_threads (pid_t pid)
+{
+  Threads *threads = new_threads (pid);
+  if (threads == NULL)
+    {
+      return NULL;
+    }
+
+  /* Seize the leader first so that it's thread number 1. */
+  if (pt_seize (pid, PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC) == SP_ERR)
+    {
+      int seize_errno = errno;
+      free_threads (threads);
+      errno = seize_errno;
+      return NULL;
+    }
+  add_thread (threads, pid, THREAD_RUNNING);
+
+  /* Threads that aren't seized yet may create new threads
+   * while the others are seized. Repeat until there are none. */
+  while (seize_new_threads (threads) > 0)
+    ;
+
+  if (stop_all_threads (threads, NULL) == SP_ERR)
+    {
+      detach_threads (threads);
+      free_threads (threads);
+      return NULL;
+    }
+
+  return threads;
+}
+
+SprayResult
+detach_threads (Threads *threads)
+{
+  assert (threads != NULL);
+
+  SprayResult res = SP_OK;
+
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+  for (size_t i = 0; i < n_ids; i++)
+    {
+      const Thread *thread = get_thread (threads, tids[i]);
+
+      /* Deliver signals that weren't reported or passed on yet.
+       * Other stops, e.g. `SIGTRAP`s, are meant for the debugger. */
+      int signo = thread->signal;
+      if (signo == 0 && thread->has_pending_status
+	  && thread->pending_status >> 16 == 0
+	  && WSTOPSIG (thread->pending_status) != SIGTRAP)
+	{
+	  signo = WSTOPSIG (thread->pending_status);
+	}
+
+      if (thread->state == THREAD_RUNNING)
+	{
+	  /* The thread might report a signal-delivery stop before
+	   * the stop of the interrupt. Its signal must be passed
+	   * on, or else it's lost when the thread is detached. */
+	  int status = 0;
+	  pt_interrupt (tids[i]);
+	  if (pt_wait (tids[i], &status, __WALL) == tids[i]
+	      && WIFSTOPPED (status) && status >> 16 == 0
+	      && WSTOPSIG (status) != SIGTRAP && signo == 0)
+	    {
+	      signo = WSTOPSIG (status);
+	    }
+	}
+
+      if (pt_detach (tids[i], signo) == SP_ERR && errno != ESRCH)
+	{
+	  res = SP_ERR;
+	}
+      remove_thread (threads, tids[i]);
+    }
+  free (tids);
+
+  return res;
+}
+
+SprayResult
+replace_process (Threads *threads, pid_t pid)
+{
+  assert (threads != NULL);
+
+  SprayResult res = SP_OK;
+  if (n_threads (threads) > 0 && kill (threads->leader, SIGKILL) == -1
+      && errno != ESRCH)
+    {
+      res = SP_ERR;
+    }
+
+  /* The exit of the leader is only reported once all
+   * other threads are gone, so it's waited for last. */
+  size_t n_ids = 0;
+  pid_t *tids = thread_ids (threads, &n_ids);
+  for (size_t i = 0; i <= n_ids; i++)
+    {
+      pid_t tid = i < n_ids ? tids[i] : threads->leader;
+      if ((tid == threads->leader && i < n_ids)
+	  || !lookup_thread (threads, tid))
+	{
+	  continue;
+	}
+
+      int status = 0;
+      pid_t waited = 0;
+      do
+	{
+	  waited = pt_wait (tid, &status, __WALL);
+	}
+      while ((waited == -1 && errno == EINTR)
+	     || (waited == tid && !WIFEXITED (status)
+		 && !WIFSIGNALED (status)));
+      remove_thread (threads, tid);
+    }
+  free (tids);
+
+  threads->leader = pid;
+  threads->next_number = 1;
+  threads->n_running = 0;
+  threads->n_pending = 0;
+  threads->next_pending_order = 0;
+  threads->report_pending = false;
+  threads->has_pending_exit = false;
+  add_thread (threads, pid, THREAD_STOPPED);
+
+  return res;
+}
@@ -0,0 +1,116 @@
+/* Keep track of all the threads of the tracee. The debugger
+ * uses all-stop semantics: when one thread stops, all other
+ * threads are stopped too, and they're resumed together. */
+
+#pragma once
+
+#ifndef _SPRAY_THREADS_H_
+#define _SPRAY_THREADS_H_
+
+#include "breakpoints.h"
+#include "magic.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+typedef struct Threads Threads;
+
+/* Start tracking the threads of the process `pid`. The process
+ * must be seized with `PTRACE_O_TRACECLONE` and stopped. */
+Threads *init_threads (pid_t pid);
+
+/* Track the threads `tids` of the process `pid` which are stopped
+ * for good, e.g. because they're read from a core dump. Threads
+ * are numbered by their ids, starting with `pid`. They can't be
+ * waited for or resumed. */
+Threads *init_stopped_threads (pid_t pid, const pid_t *tids, size_t n_tids);
+
+/* Attach to all threads of the running process `pid` and stop
+ * them. Returns NULL with `errno` set if the process couldn't be
+ * attached to. */
+Threads *attach_threads (pid_t pid);
+
+/* Detach from all threads and let them run freely. Breakpoints
+ * must be disabled before. The threads can't be used afterwards. */
+SprayResult detach_threads (Threads * threads);
+
+/* Kill the tracee, wait until all of its threads are gone and
+ * track the stopped process `pid` instead, e.g. a fork of the
+ * tracee. `pid` must be seized the same way as the tracee. */
+SprayResult replace_process (Threads * threads, pid_t pid);
+
+void free_threads (Threads * threads);
+
+/* Number of threads that are currently alive. */
+size_t n_threads (const Threads * threads);
+
+/* Id of the process, i.e. of the initial thread. */
+pid_t threads_leader (const Threads * threads);
+
+/* Is `tid` a thread of the tracee? */
+bool lookup_thread (const Threads * threads, pid_t tid);
+
+/* Get the number of the thread `tid`. Threads are numbered in the
+ * order they were created, starting at 1 for the initial thread.
+ * Returns `SP_ERR` if there is no such thread. */
+SprayResult thread_number (const Threads * threads, pid_t tid,
+			   size_t *number);
+
+/* Get the id of the thread with the given number. Returns
+ * `SP_ERR` if there is no such thread. */
+SprayResult thread_by_number (const Threads * threads, size_t number,
+			      pid_t *tid);
+
+/* Get the ids of all threads ordered by their number. The
+ * caller must free the array. Its length is `n_threads`. */
+pid_t *sorted_threads (const Threads * threads);
+
+/* Get the registers of the stopped thread `tid`. They're read once
+ * per stop and cached until the thread is resumed. Returns NULL if
+ * the registers couldn't be read. */
+const struct user_regs_struct *thread_registers (Threads * threads,
+						 pid_t tid);
+
+/* Drop the cached registers of `tid`, e.g. because they were written. */
+void forget_thread_registers (Threads * threads, pid_t tid);
+
+/* Wait until a thread of the tracee stops or the tracee exits.
+ * Thread creation and exit is handled internally. Returns the id
+ * of the thread that stopped, or the id of the process if it exited.
+ * Returns -1 on error. `wait_status` is set like `waitpid` sets it.
+ *
+ * The other threads keep on running until `stop_all_threads`
+ * is called. If a thread stopped while the others were stopped,
+ * that stop is reported first after `resume_all_threads`. */
+pid_t wait_for_thread (Threads * threads, int *wait_status);
+
+/* Like `wait_for_thread`, but returns 0 right away
+ * if no thread stopped and the tracee didn't exit. */
+pid_t poll_thread (Threads * threads, int *wait_status);
+
+/* Interrupt all threads that are running and wait until they're
+ * stopped. Threads that stop for another reason at the same time
+ * are reported by `wait_for_thread` after they're resumed. The
+ * exception are threads that hit one of the `breakpoints`: their
+ * PC is rewound so that they hit the breakpoint again later. */
+SprayResult stop_all_threads (Threads * threads, Breakpoints * breakpoints);
+
+/* Deliver the signal `signo` to the stopped thread `tid` when it's
+ * resumed next. 0 delivers no signal. Returns `SP_ERR` if there
+ * is no such thread or it isn't stopped. */
+SprayResult set_thread_signal (Threads * threads, pid_t tid, int signo);
+
+/* Resume all stopped threads. Nothing is resumed if there is a
+ * stop that wasn't reported yet. Returns `SP_ERR` with `errno`
+ * set if one of the threads couldn't be resumed. */
+SprayResult resume_all_threads (Threads * threads);
+
+/* Resume only the stopped thread `tid` and deliver the signal that
+ * was set for it, while the other threads keep on running. If none
+ * of them is running, e.g. because the stop of `tid` was reported
+ * after `stop_all_threads`, this is `resume_all_threads`. Returns
+ * `SP_ERR` if there is no such thread or it couldn't be resumed. */
+SprayResult resume_thread (Threads * threads, pid_t tid);
+
+#endif /* _SPRAY_THREADS_H_ */
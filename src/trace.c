@@ -0,0 +1,215 @@
+/* Required to use `syscall`. */
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include "json.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum
+{
+  TRACE_NAME_BUF_SIZE = 64,
+  TRACE_ARG_BUF_SIZE = 256,
+  /* Number of events that a buffer has room for at first. */
+  INIT_N_EVENTS = 1024,
+};
+
+typedef struct
+{
+  const char *cat;
+  char name[TRACE_NAME_BUF_SIZE];
+  char arg[TRACE_ARG_BUF_SIZE];
+  bool has_arg;
+  double start_us;
+  double dur_us;
+} TraceEvent;
+
+/* Events of a single thread. */
+typedef struct TraceBuffer
+{
+  pid_t tid;
+  TraceEvent *events;
+  size_t n_events;
+  size_t capacity;
+  struct TraceBuffer *next;
+} TraceBuffer;
+
+/* Set before any other thread is started, and
+ * cleared after all of them are done. */
+static FILE *trace_file = NULL;
+
+/* The buffers of all threads. The lock is only
+ * taken when a thread records its first span. */
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *buffers = NULL;
+
+static _Thread_local TraceBuffer *local_buffer = NULL;
+
+double
+now_us (void)
+{
+  return monotonic_ms () * 1000.0;
+}
+
+SprayResult
+start_trace (const char *filepath)
+{
+  assert (filepath != NULL);
+  assert (trace_file == NULL);
+
+  trace_file = fopen (filepath, "w");
+  return trace_file != NULL ? SP_OK : SP_ERR;
+}
+
+/* Get the buffer of the calling thread and make room for one more
+ * event in it. Returns NULL if there is no memory left. */
+TraceBuffer *
+get_local_buffer (void)
+{
+  if (local_buffer == NULL)
+    {
+      TraceBuffer *buffer = calloc (1, sizeof (*buffer));
+      if (buffer == NULL)
+	{
+	  return NULL;
+	}
+      buffer->tid = (pid_t) syscall (SYS_gettid);
+
+      pthread_mutex_lock (&buffers_lock);
+      buffer->next = buffers;
+      buffers = buffer;
+      pthread_mutex_unlock (&buffers_lock);
+
+      local_buffer = buffer;
+    }
+
+  if (local_buffer->n_events == local_buffer->capacity)
+    {
+      size_t capacity = local_buffer->capacity == 0
+	? INIT_N_EVENTS : local_buffer->capacity * 2;
+      TraceEvent *events = realloc (local_buffer->events,
+				    capacity * sizeof (*events));
+      if (events == NULL)
+	{
+	  return NULL;
+	}
+      local_buffer->events = events;
+      local_buffer->capacity = capacity;
+    }
+
+  return local_buffer;
+}
+
+TraceSpan
+begin_span (const char *cat)
+{
+  assert (cat != NULL);
+
+  if (trace_file == NULL)
+    {
+      return (TraceSpan) {.cat = cat,.start_us = -1 };
+    }
+  return (TraceSpan) {.cat = cat,.start_us = now_us () };
+}
+
+void
+end_span (TraceSpan span, const char *name, const char *arg_fmt, ...)
+{
+  assert (name != NULL);
+
+  if (span.start_us < 0 || trace_file == NULL)
+    {
+      return;
+    }
+
+  double end_us = now_us ();
+  TraceBuffer *buffer = get_local_buffer ();
+  if (buffer == NULL)
+    {
+      return;
+    }
+
+  TraceEvent *event = &buffer->events[buffer->n_events++];
+  event->cat = span.cat;
+  snprintf (event->name, TRACE_NAME_BUF_SIZE, "%s", name);
+  event->has_arg = arg_fmt != NULL;
+  if (arg_fmt != NULL)
+    {
+      va_list argp;
+      va_start (argp, arg_fmt);
+      vsnprintf (event->arg, TRACE_ARG_BUF_SIZE, arg_fmt, argp);
+      va_end (argp);
+    }
+  event->start_us = span.start_us;
+  event->dur_us = end_us - span.start_us;
+}
+
+void
+print_trace_event (FILE *stream, const TraceEvent *event, pid_t pid,
+		   pid_t tid)
+{
+  fprintf (stream, "{\"name\": ");
+  print_json_string (stream, event->name);
+  fprintf (stream, ", \"cat\": ");
+  print_json_string (stream, event->cat);
+  fprintf (stream, ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+	   "\"pid\": %d, \"tid\": %d", event->start_us, event->dur_us, pid,
+	   tid);
+  if (event->has_arg)
+    {
+      fprintf (stream, ", \"args\": {\"detail\": ");
+      print_json_string (stream, event->arg);
+      fprintf (stream, "}");
+    }
+  fprintf (stream, "}");
+}
+
+SprayResult
+finish_trace (void)
+{
+  if (trace_file == NULL)
+    {
+      return SP_OK;
+    }
+
+  FILE *stream = trace_file;
+  trace_file = NULL;
+
+  pid_t pid = getpid ();
+  bool is_first = true;
+  fprintf (stream, "{\"traceEvents\": [\n");
+  for (TraceBuffer *buffer = buffers; buffer != NULL;)
+    {
+      for (size_t i = 0; i < buffer->n_events; i++)
+	{
+	  fprintf (stream, "%s", is_first ? "" : ",\n");
+	  print_trace_event (stream, &buffer->events[i], pid, buffer->tid);
+	  is_first = false;
+	}
+
+      TraceBuffer *next = buffer->next;
+      free (buffer->events);
+      free (buffer);
+      buffer = next;
+    }
+  fprintf (stream, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+  buffers = NULL;
+  local_buffer = NULL;
+
+  bool has_failed = ferror (stream);
+  if (fclose (stream) != 0 || has_failed)
+    {
+      return SP_ERR;
+    }
+  return SP_OK;
+}
@@ -0,0 +1,37 @@
+/* Record what the debugger itself spends its time on as Chrome trace
+ * events, which Perfetto and `chrome://tracing` can open. Each thread
+ * records its spans into a buffer of its own without any locking, and
+ * all buffers are written out at once when the trace is finished. If
+ * no trace was started, spans cost a single branch. */
+
+#pragma once
+
+#ifndef _SPRAY_TRACE_H_
+#define _SPRAY_TRACE_H_
+
+#include "magic.h"
+
+typedef struct
+{
+  const char *cat;		/* Category, e.g. "dwarf". */
+  double start_us;		/* Negative if nothing is recorded. */
+} TraceSpan;
+
+/* Start recording spans. They're written to `filepath` by
+ * `finish_trace`. Returns `SP_ERR` if the file can't be opened. */
+SprayResult start_trace (const char *filepath);
+
+/* Write all spans that were recorded and stop recording. Must only be
+ * called once no other thread records spans anymore. Does nothing if
+ * no trace was started. */
+SprayResult finish_trace (void);
+
+/* Start a span of the category `cat`, which must be a string literal. */
+TraceSpan begin_span (const char *cat);
+
+/* End `span` and record it as `name`. If `arg_fmt` isn't NULL, it's
+ * formatted like `printf` and shown as the span's argument. Nothing
+ * is formatted unless the span is recorded. */
+void end_span (TraceSpan span, const char *name, const char *arg_fmt, ...);
+
+#endif /* _SPRAY_TRACE_H_ */
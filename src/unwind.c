@@ -0,0 +1,975 @@
+#include "unwind.h"
+
+#include "debug_line.h"
+
+#include <dwarf.h>
+
+#include <assert.h>
+
+/* DWARF register numbers on x86_64. See figure 3.36
+ * in the System V ABI for the AMD64 architecture. */
+enum
+{
+  DWARF_REG_RBX = 3,
+  DWARF_REG_RBP = 6,
+  DWARF_REG_RSP = 7,
+  DWARF_REG_R12 = 12,
+  DWARF_REG_R13 = 13,
+  DWARF_REG_R14 = 14,
+  DWARF_REG_R15 = 15,
+};
+
+/* Pointer encodings used in `.eh_frame`. See section
+ * 10.5.1 in the Linux Standard Base Core Specification. */
+enum
+{
+  EH_PE_ABSPTR = 0x00,
+  EH_PE_ULEB128 = 0x01,
+  EH_PE_UDATA2 = 0x02,
+  EH_PE_UDATA4 = 0x03,
+  EH_PE_UDATA8 = 0x04,
+  EH_PE_SLEB128 = 0x09,
+  EH_PE_SDATA2 = 0x0a,
+  EH_PE_SDATA4 = 0x0b,
+  EH_PE_SDATA8 = 0x0c,
+  EH_PE_FORMAT_MASK = 0x0f,
+  EH_PE_PCREL = 0x10,
+  EH_PE_APPLICATION_MASK = 0x70,
+  EH_PE_INDIRECT = 0x80,
+  EH_PE_OMIT = 0xff,
+};
+
+enum
+{
+  UNWIND_ALLOC_SIZE = 256,
+  /* Maximum nesting of `DW_CFA_remember_state`. */
+  UNWIND_STATE_STACK_SIZE = 16,
+};
+
+typedef enum
+{
+  RULE_SAME_VALUE,
+  RULE_UNDEFINED,
+  RULE_OFFSET,			/* Saved at CFA + `operand`. */
+  RULE_VAL_OFFSET,		/* The value is CFA + `operand`. */
+  RULE_REGISTER,		/* Saved in the register `operand`. */
+  RULE_UNSUPPORTED,		/* DWARF expressions and registers
+				 * that aren't tracked. */
+} RuleKind;
+
+typedef struct
+{
+  RuleKind kind;
+  int64_t operand;
+} RegRule;
+
+typedef struct
+{
+  /* False if the CFA is computed by a DWARF
+   * expression or uses a register that isn't tracked. */
+  bool is_supported;
+  UnwindReg reg;
+  int64_t offset;
+} CfaRule;
+
+typedef struct
+{
+  CfaRule cfa;
+  RegRule regs[UNWIND_N_REGS];
+} UnwindState;
+
+typedef struct
+{
+  dbg_addr start;		/* Inclusive. */
+  dbg_addr end;			/* Exclusive. */
+  UnwindState state;
+} UnwindRow;
+
+struct UnwindTable
+{
+  UnwindRow *rows;
+  size_t n_rows;
+  size_t n_alloc;
+};
+
+/************************/
+/* Reading CFI sections */
+/************************/
+
+/* Pointers can be relative to their own address, so the reader
+ * also knows where the section starts and where it's loaded. */
+typedef struct
+{
+  DlReader reader;
+  const byte *start;		/* Start of the section. */
+  uint64_t section_addr;	/* Address of the section at runtime. */
+} CfiReader;
+
+/* Read a pointer that's encoded using one of the `EH_PE_*` encodings. */
+uint64_t
+read_encoded (CfiReader *cfi, uint8_t encoding)
+{
+  if (encoding == EH_PE_OMIT)
+    {
+      return 0;
+    }
+
+  DlReader *r = &cfi->reader;
+  uint64_t field_addr = cfi->section_addr + (r->cur - cfi->start);
+  uint64_t value = 0;
+
+  switch (encoding & EH_PE_FORMAT_MASK)
+    {
+    case EH_PE_ABSPTR:
+    case EH_PE_UDATA8:
+    case EH_PE_SDATA8:
+      value = dl_read_unsigned (r, 8);
+      break;
+    case EH_PE_ULEB128:
+      value = dl_read_uleb128 (r);
+      break;
+    case EH_PE_UDATA2:
+      value = dl_read_unsigned (r, 2);
+      break;
+    case EH_PE_UDATA4:
+      value = dl_read_unsigned (r, 4);
+      break;
+    case EH_PE_SLEB128:
+      value = dl_read_sleb128 (r);
+      break;
+    case EH_PE_SDATA2:
+      value = (int16_t) dl_read_unsigned (r, 2);
+      break;
+    case EH_PE_SDATA4:
+      value = (int32_t) dl_read_unsigned (r, 4);
+      break;
+    default:
+      r->is_err = true;
+      return 0;
+    }
+
+  switch (encoding & EH_PE_APPLICATION_MASK)
+    {
+    case EH_PE_ABSPTR:
+      break;
+    case EH_PE_PCREL:
+      value += field_addr;
+      break;
+    default:
+      /* Text, data and function relative pointers aren't used
+       * for the addresses in FDEs of executables. */
+      r->is_err = true;
+      return 0;
+    }
+
+  if (encoding & EH_PE_INDIRECT)
+    {
+      r->is_err = true;
+      return 0;
+    }
+
+  return value;
+}
+
+/* Read the length of the CIE or FDE at the reader's position.
+ * Returns false if the entry is a terminator or invalid. */
+bool
+read_entry_length (DlReader *r, bool *is_64bit, const byte **entry_end)
+{
+  uint64_t length = dl_read_unsigned (r, 4);
+  *is_64bit = false;
+  if (length == 0xffffffff)
+    {
+      length = dl_read_unsigned (r, 8);
+      *is_64bit = true;
+    }
+
+  if (r->is_err || length == 0 || length > (uint64_t) (r->end - r->cur))
+    {
+      return false;
+    }
+
+  *entry_end = r->cur + length;
+  return true;
+}
+
+/* Size of the CIE ID and the CIE pointer. In `.eh_frame`
+ * it's always four bytes, even in 64-bit entries. */
+size_t
+id_size (bool is_eh_frame, bool is_64bit)
+{
+  return !is_eh_frame && is_64bit ? 8 : 4;
+}
+
+bool
+is_cie_id (uint64_t id, bool is_eh_frame, bool is_64bit)
+{
+  if (is_eh_frame)
+    {
+      return id == 0;
+    }
+  else
+    {
+      return id == (is_64bit ? UINT64_MAX : UINT32_MAX);
+    }
+}
+
+/* Common information entry. */
+typedef struct
+{
+  uint64_t code_align;
+  int64_t data_align;
+  uint64_t ra_reg;
+  uint8_t fde_encoding;
+  bool has_augmentation_data;
+  const byte *instructions;
+  const byte *instructions_end;
+} Cie;
+
+bool
+parse_cie (const CfiReader *section, uint64_t cie_offset,
+	   bool is_eh_frame, Cie *cie)
+{
+  if (cie_offset >= (uint64_t) (section->reader.end - section->start))
+    {
+      return false;
+    }
+
+  CfiReader cfi = *section;
+  DlReader *r = &cfi.reader;
+  r->cur = cfi.start + cie_offset;
+
+  bool is_64bit = false;
+  const byte *entry_end = NULL;
+  if (!read_entry_length (r, &is_64bit, &entry_end))
+    {
+      return false;
+    }
+  r->end = entry_end;
+
+  uint64_t id = dl_read_unsigned (r, id_size (is_eh_frame, is_64bit));
+  if (!is_cie_id (id, is_eh_frame, is_64bit))
+    {
+      return false;
+    }
+
+  uint8_t version = dl_read_unsigned (r, 1);
+  const char *augmentation = dl_read_string (r);
+  if (augmentation == NULL)
+    {
+      return false;
+    }
+
+  if (version >= 4)
+    {
+      uint8_t address_size = dl_read_unsigned (r, 1);
+      uint8_t segment_selector_size = dl_read_unsigned (r, 1);
+      if (address_size != 8 || segment_selector_size != 0)
+	{
+	  return false;
+	}
+    }
+
+  cie->code_align = dl_read_uleb128 (r);
+  cie->data_align = dl_read_sleb128 (r);
+  cie->ra_reg = version == 1 ? dl_read_unsigned (r, 1) : dl_read_uleb128 (r);
+  cie->fde_encoding = EH_PE_ABSPTR;
+  cie->has_augmentation_data = false;
+
+  if (augmentation[0] == 'z')
+    {
+      cie->has_augmentation_data = true;
+      uint64_t augmentation_len = dl_read_uleb128 (r);
+      if (!dl_can_read (r, augmentation_len))
+	{
+	  return false;
+	}
+      const byte *augmentation_end = r->cur + augmentation_len;
+
+      for (const char *c = augmentation + 1; *c != '\0'; c++)
+	{
+	  if (*c == 'R')
+	    {
+	      cie->fde_encoding = dl_read_unsigned (r, 1);
+	    }
+	  else if (*c == 'P')
+	    {
+	      /* Skip the personality routine. */
+	      uint8_t encoding = dl_read_unsigned (r, 1);
+	      read_encoded (&cfi, encoding & ~EH_PE_INDIRECT);
+	    }
+	  else if (*c == 'L')
+	    {
+	      /* Skip the LSDA encoding. */
+	      dl_read_unsigned (r, 1);
+	    }
+	  else if (*c != 'S')
+	    {
+	      /* The length of the augmentation data
+	       * allows skipping unknown augmentations. */
+	      break;
+	    }
+	}
+
+      r->cur = augmentation_end;
+    }
+  else if (augmentation[0] != '\0')
+    {
+      return false;
+    }
+
+  cie->instructions = r->cur;
+  cie->instructions_end = entry_end;
+
+  return !r->is_err;
+}
+
+/**************************/
+/* Executing CFI programs */
+/**************************/
+
+typedef struct
+{
+  UnwindTable *table;		/* NULL while running the CIE's
+				 * initial instructions. */
+  const Cie *cie;
+  uint64_t loc;
+  UnwindState state;
+  UnwindState initial;		/* State to go back to on `DW_CFA_restore`. */
+  UnwindState stack[UNWIND_STATE_STACK_SIZE];
+  size_t stack_size;
+} CfiMachine;
+
+/* Map a DWARF register number to the register that's
+ * tracked for it. Returns -1 for untracked registers. */
+int
+unwind_reg (const Cie *cie, uint64_t dwarf_reg)
+{
+  if (dwarf_reg == cie->ra_reg)
+    {
+      return UNWIND_RIP;
+    }
+
+  switch (dwarf_reg)
+    {
+    case DWARF_REG_RBX:
+      return UNWIND_RBX;
+    case DWARF_REG_RBP:
+      return UNWIND_RBP;
+    case DWARF_REG_RSP:
+      return UNWIND_RSP;
+    case DWARF_REG_R12:
+      return UNWIND_R12;
+    case DWARF_REG_R13:
+      return UNWIND_R13;
+    case DWARF_REG_R14:
+      return UNWIND_R14;
+    case DWARF_REG_R15:
+      return UNWIND_R15;
+    default:
+      return -1;
+    }
+}
+
+UnwindState
+default_state (void)
+{
+  UnwindState state = {.cfa = {.is_supported = false } };
+  for (size_t i = 0; i < UNWIND_N_REGS; i++)
+    {
+      state.regs[i] = (RegRule) {.kind = RULE_SAME_VALUE };
+    }
+  state.regs[UNWIND_RIP].kind = RULE_UNDEFINED;
+  return state;
+}
+
+void
+add_row (UnwindTable *table, uint64_t start, uint64_t end,
+	 const UnwindState *state)
+{
+  if (table->n_rows >= table->n_alloc)
+    {
+      table->n_alloc += UNWIND_ALLOC_SIZE;
+      table->rows = realloc (table->rows,
+			     sizeof (*table->rows) * table->n_alloc);
+      assert (table->rows != NULL);
+    }
+
+  table->rows[table->n_rows++] = (UnwindRow)
+  {
+    .start = {start},.end = {end},.state = *state,
+  };
+}
+
+/* Move to `new_loc` and emit a row for the code in between. */
+void
+advance_loc (CfiMachine *m, uint64_t new_loc)
+{
+  if (m->table != NULL && new_loc > m->loc)
+    {
+      add_row (m->table, m->loc, new_loc, &m->state);
+    }
+  m->loc = new_loc;
+}
+
+void
+set_rule (CfiMachine *m, uint64_t dwarf_reg, RuleKind kind,
+	  int64_t operand)
+{
+  int reg = unwind_reg (m->cie, dwarf_reg);
+  if (reg >= 0)
+    {
+      m->state.regs[reg] = (RegRule) {.kind = kind,.operand = operand };
+    }
+}
+
+void
+restore_rule (CfiMachine *m, uint64_t dwarf_reg)
+{
+  int reg = unwind_reg (m->cie, dwarf_reg);
+  if (reg >= 0)
+    {
+      m->state.regs[reg] = m->initial.regs[reg];
+    }
+}
+
+void
+set_cfa (CfiMachine *m, uint64_t dwarf_reg, int64_t offset)
+{
+  int reg = unwind_reg (m->cie, dwarf_reg);
+  m->state.cfa = (CfaRule)
+  {
+    .is_supported = reg >= 0 && reg != UNWIND_RIP,.reg = reg,.offset =
+      offset,
+  };
+}
+
+/* Run the CFA instructions in `r`. Returns false if
+ * they're invalid or use an unknown instruction. */
+bool
+execute_cfi (CfiMachine *m, CfiReader *cfi)
+{
+  const Cie *cie = m->cie;
+  DlReader *r = &cfi->reader;
+
+  while (r->cur < r->end && !r->is_err)
+    {
+      uint8_t op = dl_read_unsigned (r, 1);
+      uint8_t low_bits = op & 0x3f;
+
+      /* These instructions store their operand in the low six bits. */
+      switch (op & 0xc0)
+	{
+	case DW_CFA_advance_loc:
+	  advance_loc (m, m->loc + low_bits * cie->code_align);
+	  continue;
+	case DW_CFA_offset:
+	  set_rule (m, low_bits, RULE_OFFSET,
+		    (int64_t) dl_read_uleb128 (r) * cie->data_align);
+	  continue;
+	case DW_CFA_restore:
+	  restore_rule (m, low_bits);
+	  continue;
+	}
+
+      uint64_t reg = 0;
+      switch (op)
+	{
+	case DW_CFA_nop:
+	  break;
+	case DW_CFA_set_loc:
+	  advance_loc (m, read_encoded (cfi, cie->fde_encoding));
+	  break;
+	case DW_CFA_advance_loc1:
+	  advance_loc (m, m->loc + dl_read_unsigned (r, 1) * cie->code_align);
+	  break;
+	case DW_CFA_advance_loc2:
+	  advance_loc (m, m->loc + dl_read_unsigned (r, 2) * cie->code_align);
+	  break;
+	case DW_CFA_advance_loc4:
+	  advance_loc (m, m->loc + dl_read_unsigned (r, 4) * cie->code_align);
+	  break;
+	case DW_CFA_offset_extended:
+	  reg = dl_read_uleb128 (r);
+	  set_rule (m, reg, RULE_OFFSET,
+		    (int64_t) dl_read_uleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_offset_extended_sf:
+	  reg = dl_read_uleb128 (r);
+	  set_rule (m, reg, RULE_OFFSET, dl_read_sleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_GNU_negative_offset_extended:
+	  reg = dl_read_uleb128 (r);
+	  set_rule (m, reg, RULE_OFFSET,
+		    -(int64_t) dl_read_uleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_val_offset:
+	  reg = dl_read_uleb128 (r);
+	  set_rule (m, reg, RULE_VAL_OFFSET,
+		    (int64_t) dl_read_uleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_val_offset_sf:
+	  reg = dl_read_uleb128 (r);
+	  set_rule (m, reg, RULE_VAL_OFFSET,
+		    dl_read_sleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_restore_extended:
+	  restore_rule (m, dl_read_uleb128 (r));
+	  break;
+	case DW_CFA_undefined:
+	  set_rule (m, dl_read_uleb128 (r), RULE_UNDEFINED, 0);
+	  break;
+	case DW_CFA_same_value:
+	  set_rule (m, dl_read_uleb128 (r), RULE_SAME_VALUE, 0);
+	  break;
+	case DW_CFA_register:
+	  {
+	    reg = dl_read_uleb128 (r);
+	    int saved_in = unwind_reg (cie, dl_read_uleb128 (r));
+	    if (saved_in >= 0)
+	      {
+		set_rule (m, reg, RULE_REGISTER, saved_in);
+	      }
+	    else
+	      {
+		set_rule (m, reg, RULE_UNSUPPORTED, 0);
+	      }
+	    break;
+	  }
+	case DW_CFA_remember_state:
+	  if (m->stack_size >= UNWIND_STATE_STACK_SIZE)
+	    {
+	      return false;
+	    }
+	  m->stack[m->stack_size++] = m->state;
+	  break;
+	case DW_CFA_restore_state:
+	  if (m->stack_size == 0)
+	    {
+	      return false;
+	    }
+	  m->state = m->stack[--m->stack_size];
+	  break;
+	case DW_CFA_def_cfa:
+	  reg = dl_read_uleb128 (r);
+	  set_cfa (m, reg, dl_read_uleb128 (r));
+	  break;
+	case DW_CFA_def_cfa_sf:
+	  reg = dl_read_uleb128 (r);
+	  set_cfa (m, reg, dl_read_sleb128 (r) * cie->data_align);
+	  break;
+	case DW_CFA_def_cfa_register:
+	  reg = dl_read_uleb128 (r);
+	  set_cfa (m, reg, m->state.cfa.offset);
+	  break;
+	case DW_CFA_def_cfa_offset:
+	  m->state.cfa.offset = dl_read_uleb128 (r);
+	  break;
+	case DW_CFA_def_cfa_offset_sf:
+	  m->state.cfa.offset = dl_read_sleb128 (r) * cie->data_align;
+	  break;
+	case DW_CFA_def_cfa_expression:
+	  dl_skip_bytes (r, dl_read_uleb128 (r));
+	  m->state.cfa.is_supported = false;
+	  break;
+	case DW_CFA_expression:
+	case DW_CFA_val_expression:
+	  reg = dl_read_uleb128 (r);
+	  dl_skip_bytes (r, dl_read_uleb128 (r));
+	  set_rule (m, reg, RULE_UNSUPPORTED, 0);
+	  break;
+	case DW_CFA_GNU_args_size:
+	  dl_read_uleb128 (r);
+	  break;
+	default:
+	  return false;
+	}
+    }
+
+  return !r->is_err;
+}
+
+/* Parse the FDE in `r` and add its rows to `table`. `r` must
+ * point right after the CIE pointer. */
+void
+parse_fde (UnwindTable *table, CfiReader *cfi,
+	   const CfiReader *section, const Cie *cie)
+{
+  DlReader *r = &cfi->reader;
+  uint64_t pc_begin = read_encoded (cfi, cie->fde_encoding);
+  /* The range is never relative to anything. */
+  uint64_t pc_range = read_encoded (cfi, cie->fde_encoding
+				    & EH_PE_FORMAT_MASK);
+  if (cie->has_augmentation_data)
+    {
+      dl_skip_bytes (r, dl_read_uleb128 (r));
+    }
+
+  /* The linker sets the addresses of discarded functions to 0. */
+  if (r->is_err || pc_begin == 0 || pc_range == 0)
+    {
+      return;
+    }
+
+  CfiMachine m = {
+    .table = NULL,
+    .cie = cie,
+    .loc = pc_begin,
+    .state = default_state (),
+    .stack_size = 0,
+  };
+
+  CfiReader initial_instructions = *section;
+  initial_instructions.reader.cur = cie->instructions;
+  initial_instructions.reader.end = cie->instructions_end;
+  if (!execute_cfi (&m, &initial_instructions))
+    {
+      return;
+    }
+
+  m.initial = m.state;
+  m.table = table;
+  m.loc = pc_begin;
+  m.stack_size = 0;
+
+  /* Rows of an FDE are only kept if all of them are valid. */
+  size_t n_rows_before = table->n_rows;
+  if (!execute_cfi (&m, cfi))
+    {
+      table->n_rows = n_rows_before;
+      return;
+    }
+
+  advance_loc (&m, pc_begin + pc_range);
+}
+
+void
+parse_cfi_section (UnwindTable *table, const ElfFile *elf,
+		   const char *section_name, bool is_eh_frame)
+{
+  const Elf64_Shdr *shdr = se_section_by_name (section_name, elf);
+  if (shdr == NULL)
+    {
+      return;
+    }
+
+  const byte *data = se_section_data (shdr, elf);
+  if (data == NULL)
+    {
+      return;
+    }
+
+  CfiReader section = {
+    .reader = {
+      .cur = data,
+      .end = data + shdr->sh_size,
+      .is_err = false,
+    },
+    .start = data,
+    /* Addresses in `.debug_frame` are absolute. */
+    .section_addr = is_eh_frame ? shdr->sh_addr : 0,
+  };
+
+  while (section.reader.cur < section.reader.end)
+    {
+      bool is_64bit = false;
+      const byte *entry_end = NULL;
+      if (!read_entry_length (&section.reader, &is_64bit, &entry_end))
+	{
+	  break;
+	}
+
+      CfiReader entry = section;
+      entry.reader.end = entry_end;
+      section.reader.cur = entry_end;
+
+      uint64_t id_offset = entry.reader.cur - entry.start;
+      uint64_t id = dl_read_unsigned (&entry.reader,
+				      id_size (is_eh_frame, is_64bit));
+      if (entry.reader.is_err || is_cie_id (id, is_eh_frame, is_64bit))
+	{
+	  continue;
+	}
+
+      /* In `.eh_frame` the CIE pointer is relative to the position of
+       * the pointer. In `.debug_frame` it's an offset into the section. */
+      if (is_eh_frame && id > id_offset)
+	{
+	  continue;
+	}
+      uint64_t cie_offset = is_eh_frame ? id_offset - id : id;
+
+      Cie cie = { 0 };
+      if (parse_cie (&section, cie_offset, is_eh_frame, &cie))
+	{
+	  parse_fde (table, &entry, &section, &cie);
+	}
+    }
+}
+
+int
+compare_rows (const void *a, const void *b)
+{
+  const UnwindRow *row_a = (const UnwindRow *) a;
+  const UnwindRow *row_b = (const UnwindRow *) b;
+
+  if (row_a->start.value != row_b->start.value)
+    {
+      return row_a->start.value < row_b->start.value ? -1 : 1;
+    }
+  else
+    {
+      return 0;
+    }
+}
+
+UnwindTable *
+init_unwind_table (const ElfFile *elf)
+{
+  assert (elf != NULL);
+
+  UnwindTable *table = calloc (1, sizeof (*table));
+  if (table == NULL)
+    {
+      return NULL;
+    }
+
+  /* `.eh_frame` is part of the loaded image and therefore present even
+   * in stripped executables. Use `.debug_frame` only if it's missing. */
+  parse_cfi_section (table, elf, ".eh_frame", true);
+  if (table->n_rows == 0)
+    {
+      parse_cfi_section (table, elf, ".debug_frame", false);
+    }
+
+  if (table->n_rows == 0)
+    {
+      free_unwind_table (table);
+      return NULL;
+    }
+
+  qsort (table->rows, table->n_rows, sizeof (*table->rows), compare_rows);
+
+  return table;
+}
+
+void
+free_unwind_table (UnwindTable *table)
+{
+  if (table != NULL)
+    {
+      free (table->rows);
+      free (table);
+    }
+}
+
+/* Find the row that covers `pc` using binary search. */
+const UnwindRow *
+find_row (const UnwindTable *table, dbg_addr pc)
+{
+  if (table == NULL)
+    {
+      return NULL;
+    }
+
+  /* Find the first row that starts after `pc`. */
+  size_t low = 0;
+  size_t high = table->n_rows;
+  while (low < high)
+    {
+      size_t mid = low + (high - low) / 2;
+      if (table->rows[mid].start.value <= pc.value)
+	{
+	  low = mid + 1;
+	}
+      else
+	{
+	  high = mid;
+	}
+    }
+
+  if (low == 0)
+    {
+      return NULL;
+    }
+
+  const UnwindRow *row = &table->rows[low - 1];
+  return pc.value < row->end.value ? row : NULL;
+}
+
+bool
+has_unwind_row (const UnwindTable *table, dbg_addr pc)
+{
+  return find_row (table, pc) != NULL;
+}
+
+/*************/
+/* Unwinding */
+/*************/
+
+FrameRegs
+init_frame_regs (const struct user_regs_struct *regs)
+{
+  assert (regs != NULL);
+
+  FrameRegs frame_regs = { 0 };
+  frame_regs.values[UNWIND_RBX] = regs->rbx;
+  frame_regs.values[UNWIND_RBP] = regs->rbp;
+  frame_regs.values[UNWIND_RSP] = regs->rsp;
+  frame_regs.values[UNWIND_R12] = regs->r12;
+  frame_regs.values[UNWIND_R13] = regs->r13;
+  frame_regs.values[UNWIND_R14] = regs->r14;
+  frame_regs.values[UNWIND_R15] = regs->r15;
+  frame_regs.values[UNWIND_RIP] = regs->rip;
+  return frame_regs;
+}
+
+SprayResult
+frame_reg_value (const FrameRegs *regs, x86_reg reg, uint64_t *value)
+{
+  assert (regs != NULL);
+  assert (value != NULL);
+
+  UnwindReg unwind_reg = UNWIND_N_REGS;
+  switch (reg)
+    {
+    case rbx:
+      unwind_reg = UNWIND_RBX;
+      break;
+    case rbp:
+      unwind_reg = UNWIND_RBP;
+      break;
+    case rsp:
+      unwind_reg = UNWIND_RSP;
+      break;
+    case r12:
+      unwind_reg = UNWIND_R12;
+      break;
+    case r13:
+      unwind_reg = UNWIND_R13;
+      break;
+    case r14:
+      unwind_reg = UNWIND_R14;
+      break;
+    case r15:
+      unwind_reg = UNWIND_R15;
+      break;
+    case rip:
+      unwind_reg = UNWIND_RIP;
+      break;
+    default:
+      return SP_ERR;
+    }
+
+  *value = regs->values[unwind_reg];
+  return SP_OK;
+}
+
+/* Unwind a frame of code without CFI, such as code in shared
+ * libraries, by assuming that `rbp` points to a saved frame
+ * pointer followed by the return address. */
+SprayResult
+unwind_frame_pointer (const StackSnapshot *stack, pid_t pid,
+		      const FrameRegs *regs, FrameRegs *caller)
+{
+  uint64_t frame_pointer = regs->values[UNWIND_RBP];
+  if (frame_pointer == 0 || frame_pointer < regs->values[UNWIND_RSP])
+    {
+      return SP_ERR;
+    }
+
+  *caller = *regs;
+  if (read_stack (stack, pid, (real_addr) {frame_pointer + 8},
+		  &caller->values[UNWIND_RIP]) == SP_ERR
+      || read_stack (stack, pid, (real_addr) {frame_pointer},
+		     &caller->values[UNWIND_RBP]) == SP_ERR)
+    {
+      return SP_ERR;
+    }
+  caller->values[UNWIND_RSP] = frame_pointer + 16;
+
+  return SP_OK;
+}
+
+SprayResult
+unwind_frame (const UnwindTable *table,
+	      real_addr load_address,
+	      const StackSnapshot *stack,
+	      pid_t pid,
+	      const FrameRegs *regs, bool is_innermost, FrameRegs *caller)
+{
+  assert (regs != NULL);
+  assert (caller != NULL);
+
+  /* The PC of all frames but the innermost one is a return address.
+   * It points after the call instruction, which might be the last
+   * instruction of the function. Look up the call instead. */
+  dbg_addr pc = real_to_dbg (load_address,
+			     (real_addr) {regs->values[UNWIND_RIP]});
+  if (!is_innermost)
+    {
+      pc.value--;
+    }
+
+  const UnwindRow *row = find_row (table, pc);
+  if (row == NULL || !row->state.cfa.is_supported)
+    {
+      return unwind_frame_pointer (stack, pid, regs, caller);
+    }
+
+  const UnwindState *state = &row->state;
+  uint64_t cfa = regs->values[state->cfa.reg] + state->cfa.offset;
+
+  /* The stack grows down so the caller's frame must be above
+   * this one. Anything else means the CFI can't be trusted. */
+  if (cfa <= regs->values[UNWIND_RSP])
+    {
+      return SP_ERR;
+    }
+
+  *caller = *regs;
+  caller->values[UNWIND_RSP] = cfa;
+
+  for (size_t i = 0; i < UNWIND_N_REGS; i++)
+    {
+      const RegRule *rule = &state->regs[i];
+      if (i == UNWIND_RSP)
+	{
+	  continue;
+	}
+
+      switch (rule->kind)
+	{
+	case RULE_SAME_VALUE:
+	  break;
+	case RULE_UNDEFINED:
+	case RULE_UNSUPPORTED:
+	  /* An undefined return address marks the outermost frame. */
+	  if (i == UNWIND_RIP)
+	    {
+	      return SP_ERR;
+	    }
+	  break;
+	case RULE_OFFSET:
+	  if (read_stack (stack, pid, (real_addr) {cfa + rule->operand},
+			  &caller->values[i]) == SP_ERR)
+	    {
+	      return SP_ERR;
+	    }
+	  break;
+	case RULE_VAL_OFFSET:
+	  caller->values[i] = cfa + rule->operand;
+	  break;
+	case RULE_REGISTER:
+	  caller->values[i] = regs->values[rule->operand];
+	  break;
+	}
+    }
+
+  if (caller->values[UNWIND_RIP] == 0)
+    {
+      return SP_ERR;
+    }
+
+  return SP_OK;
+}
@@ -0,0 +1,76 @@
+/* Unwind the call stack using the DWARF call frame
+ * information (CFI) in `.eh_frame` and `.debug_frame`.
+ * See section 6.4 of the DWARF 5 standard. */
+
+#pragma once
+
+#ifndef _SPRAY_UNWIND_H_
+#define _SPRAY_UNWIND_H_
+
+#include "magic.h"
+#include "registers.h"
+#include "spray_elf.h"
+#include "stack.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+/* Unwind rules of all the functions in an executable, compiled
+ * into a table of rows that's sorted by their addresses. */
+typedef struct UnwindTable UnwindTable;
+
+/* Parse the CFI in `elf`. Returns NULL if the executable
+ * doesn't contain any CFI that could be parsed. */
+UnwindTable *init_unwind_table (const ElfFile * elf);
+
+void free_unwind_table (UnwindTable * table);
+
+/* Is there an unwind row that covers `pc`? */
+bool has_unwind_row (const UnwindTable * table, dbg_addr pc);
+
+/* Registers that are recovered while unwinding. The values of
+ * all other registers are lost once a function was called. */
+typedef enum
+{
+  UNWIND_RBX,
+  UNWIND_RBP,
+  UNWIND_RSP,
+  UNWIND_R12,
+  UNWIND_R13,
+  UNWIND_R14,
+  UNWIND_R15,
+  UNWIND_RIP,
+  UNWIND_N_REGS,
+} UnwindReg;
+
+/* Register values in a single call frame. */
+typedef struct
+{
+  uint64_t values[UNWIND_N_REGS];
+} FrameRegs;
+
+/* Get the value of `reg` in the frame described by `regs`. Returns
+ * `SP_ERR` if the register isn't one of those that are recovered. */
+SprayResult frame_reg_value (const FrameRegs * regs, x86_reg reg,
+			     uint64_t *value);
+
+/* Get the registers of the innermost frame. */
+FrameRegs init_frame_regs (const struct user_regs_struct *regs);
+
+/* Recover the registers of the caller of the frame described by
+ * `regs`. `is_innermost` must be true if `regs` belongs to the frame
+ * the tracee is stopped in. If there is no unwind row for the frame's
+ * PC, the frame pointer in `rbp` is used instead. Saved registers
+ * are read from `stack` if possible.
+ *
+ * Returns `SP_ERR` if the caller's frame can't be determined,
+ * e.g. because `regs` belongs to the outermost frame. */
+SprayResult unwind_frame (const UnwindTable * table,
+			  real_addr load_address,
+			  const StackSnapshot * stack,
+			  pid_t pid,
+			  const FrameRegs * regs,
+			  bool is_innermost, FrameRegs * caller);
+
+#endif /* _SPRAY_UNWIND_H_ */
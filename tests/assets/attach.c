@@ -0,0 +1,18 @@
+#include <sys/prctl.h>
+#include <unistd.h>
+
+int ticks = 0;
+
+void tick(void) {
+  ticks++;
+}
+
+int main(void) {
+  /* Allow debuggers that aren't the parent to attach. */
+  prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
+  for (int i = 0; i < 30; i++) {
+    tick();
+    usleep(100000);
+  }
+  return ticks == 30 ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+#include <stdio.h>
+
+int main(void) {
+  int sum = 0;
+  for (int i = 0; i < 3; i++) {
+    sum += i;
+  }
+  puts("done");
+  return sum == 3 ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#include <stdlib.h>
+
+int total = 0;
+long untouched = 7;
+
+void add(int *numbers, int n) {
+  for (int i = 0; i < n; i++) {
+    numbers[i] = i * i;
+    total += numbers[i];
+  }
+}
+
+int main(void) {
+  int count = 4;
+  int *numbers = malloc(count * sizeof(int));
+  add(numbers, count);
+  count = 5;
+  free(numbers);
+  return total == 14 && untouched == 7 ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+int counter = 0;
+
+void tick(void) {
+  counter++;
+}
+
+int main(void) {
+  for (int i = 0; i < 10; i++) {
+    tick();
+  }
+  return counter == 10 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#include <pthread.h>
+#include <unistd.h>
+
+int answer = 42;
+
+void crash(int *pointer) {
+  *pointer = answer;
+}
+
+void *wait_forever(void *arg) {
+  for (;;) {
+    pause();
+  }
+  return arg;
+}
+
+int main(void) {
+  pthread_t thread;
+  pthread_create(&thread, NULL, wait_forever, NULL);
+  /* Let the thread start before the crash. */
+  usleep(100000);
+  answer = 7;
+  crash(NULL);
+  return 0;
+}
@@ -0,0 +1,13 @@
+int bottom(void) {
+  return 0;
+}
+
+int recurse(int n) {
+  if (n == 0)
+    return bottom();
+  return recurse(n - 1) + 1;
+}
+
+int main(void) {
+  return recurse(10000) == 10000 ? 0 : 1;
+}
@@ -0,0 +1,5 @@
+int main(void) {
+  int acc = 0;
+  for (int i = 0; i < 1000; i++) acc += i;
+  return acc == 499500 ? 0 : 1;
+}
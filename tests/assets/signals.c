@@ -0,0 +1,22 @@
+#include <signal.h>
+
+static volatile sig_atomic_t alarms = 0;
+static volatile sig_atomic_t usr1s = 0;
+
+void on_signal(int signo) {
+  if (signo == SIGALRM) {
+    alarms++;
+  } else {
+    usr1s++;
+  }
+}
+
+int main(void) {
+  signal(SIGALRM, on_signal);
+  signal(SIGUSR1, on_signal);
+  for (int i = 0; i < 1000; i++) {
+    raise(SIGALRM);
+  }
+  raise(SIGUSR1);
+  return alarms == 1000 && usr1s == 1 ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+static inline int square(int x) { return x * x + 1; }
+
+__attribute__((cold, noinline)) void report_overflow(int i) {
+  fprintf(stderr, "overflow at %d\n", i);
+}
+
+/* The unlikely branch is moved out of the function. */
+__attribute__((noinline)) int checked_sum(int n) {
+  int total = 0;
+  for (int i = 0; i < n; i++) {
+    if (__builtin_expect(i > 1000, 0)) {
+      report_overflow(i);
+      total -= square(i);
+      continue;
+    }
+    total += square(i) + square(i + n);
+  }
+  return total;
+}
+
+int main(int argc, char **argv) {
+  (void)argv;
+  return checked_sum(argc * 3) == 61 ? 0 : 1;
+}
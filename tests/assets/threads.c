@@ -0,0 +1,17 @@
+#include <pthread.h>
+
+int counter = 0;
+
+void *worker(void *arg) {
+  counter += (int) (long) arg;
+  return NULL;
+}
+
+int main(void) {
+  pthread_t threads[2];
+  for (long i = 0; i < 2; i++)
+    pthread_create(&threads[i], NULL, worker, (void *) i);
+  for (int i = 0; i < 2; i++)
+    pthread_join(threads[i], NULL);
+  return counter == 1 ? 0 : 1;
+}
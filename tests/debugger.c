@@ -1,9 +1,15 @@
 #include "test_utils.h"
 
 #include "../src/breakpoints.h"
+#include "../src/json.h"
+#include "../src/signals.h"
 #define UNIT_TESTS
 #include "../src/debugger.h"
 
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 TEST (breakpoints_work)
 {
   Debugger dbg;
@@ -23,6 +29,58 @@ TEST (breakpoints_work)
   return MUNIT_OK;
 }
 
+TEST (changing_breakpoints_works)
+{
+  Debugger dbg;
+  char *prog_argv[] = { SIMPLE_64BIT_BIN, NULL };
+  assert_int (setup_debugger (prog_argv[0], prog_argv, &dbg), ==, 0);
+
+  real_addr start = { 0x00401120 };
+  unsigned char orig[16] = { 0 };
+  assert_size (pt_read_memory_range (dbg.pid, start, orig, sizeof (orig)),
+	       ==, sizeof (orig));
+
+  /* Two of the breakpoints share a word. */
+  BreakpointChange changes[] = {
+    {{0x0040112a}, true},
+    {{0x00401122}, true},
+    {{0x00401124}, true},
+  };
+  assert_int (change_breakpoints (dbg.breakpoints, changes, 3), ==, SP_OK);
+  assert_true (lookup_breakpoint (dbg.breakpoints, (real_addr) {0x00401122}));
+  assert_true (lookup_breakpoint (dbg.breakpoints, (real_addr) {0x00401124}));
+  assert_true (lookup_breakpoint (dbg.breakpoints, (real_addr) {0x0040112a}));
+
+  unsigned char bytes[16] = { 0 };
+  assert_size (pt_read_memory_range (dbg.pid, start, bytes, sizeof (bytes)),
+	       ==, sizeof (bytes));
+  assert_uint8 (bytes[0x2], ==, 0xcc);
+  assert_uint8 (bytes[0x4], ==, 0xcc);
+  assert_uint8 (bytes[0xa], ==, 0xcc);
+  hide_breakpoints (dbg.breakpoints, start, bytes, sizeof (bytes));
+  assert_memory_equal (sizeof (bytes), bytes, orig);
+
+  /* Enabling an enabled breakpoint keeps its original byte. */
+  BreakpointChange more_changes[] = {
+    {{0x00401122}, false},
+    {{0x00401124}, true},
+    {{0x0040112a}, false},
+  };
+  assert_int (change_breakpoints (dbg.breakpoints, more_changes, 3), ==,
+	      SP_OK);
+  assert_false (lookup_breakpoint (dbg.breakpoints, (real_addr) {0x00401122}));
+  assert_true (lookup_breakpoint (dbg.breakpoints, (real_addr) {0x00401124}));
+
+  disable_breakpoint (dbg.breakpoints, (real_addr) {0x00401124});
+  assert_size (pt_read_memory_range (dbg.pid, start, bytes, sizeof (bytes)),
+	       ==, sizeof (bytes));
+  assert_memory_equal (sizeof (bytes), bytes, orig);
+
+  del_debugger (dbg);
+
+  return MUNIT_OK;
+}
+
 #define TEST_VARLOC(test_name, bin_name, var_name, pc_value, expect)	\
   TEST ((test_name)) {							\
     Debugger dbg;							\
@@ -102,8 +160,204 @@ TEST (function_name_check_works)
   return MUNIT_OK;
 }
 
+TEST (parse_signal_works)
+{
+  int signo = 0;
+  assert_int (parse_signal ("SIGALRM", &signo), ==, SP_OK);
+  assert_int (signo, ==, SIGALRM);
+  assert_int (parse_signal ("usr1", &signo), ==, SP_OK);
+  assert_int (signo, ==, SIGUSR1);
+  assert_int (parse_signal ("15", &signo), ==, SP_OK);
+  assert_int (signo, ==, SIGTERM);
+  assert_int (parse_signal ("SIGRTMIN+2", &signo), ==, SP_OK);
+  assert_int (signo, ==, SIGRTMIN + 2);
+
+  char name[SIGNAL_NAME_BUF_SIZE] = { 0 };
+  signal_name (signo, name);
+  assert_string_equal (name, "RTMIN+2");
+
+  assert_int (parse_signal ("SIGFOO", &signo), ==, SP_ERR);
+  assert_int (parse_signal ("0", &signo), ==, SP_ERR);
+  assert_int (parse_signal ("RTMAX-100", &signo), ==, SP_ERR);
+
+  /* GDB numbers some signals differently. */
+  assert_int (gdb_signal_from_signo (SIGTRAP), ==, 5);
+  assert_int (gdb_signal_from_signo (SIGUSR1), ==, 30);
+  assert_int (signo_from_gdb_signal (30), ==, SIGUSR1);
+  assert_int (signo_from_gdb_signal (gdb_signal_from_signo (SIGSYS)), ==,
+	      SIGSYS);
+  assert_int (signo_from_gdb_signal (143), ==, 0);
+
+  return MUNIT_OK;
+}
+
+TEST (parse_json_works)
+{
+  JsonValue *request =
+    parse_json (" {\"seq\": 7, \"command\": \"evaluate\", "
+		"\"arguments\": {\"expression\": \"p \\\"x\\u00e9\\\"\", "
+		"\"lines\": [1, 2.5, true, null]}} ");
+  assert_not_null (request);
+
+  int64_t seq = 0;
+  assert_int (json_int_member (request, "seq", &seq), ==, SP_OK);
+  assert_int (seq, ==, 7);
+  assert_string_equal (json_string_member (request, "command"), "evaluate");
+
+  const JsonValue *args = json_member (request, "arguments");
+  assert_string_equal (json_string_member (args, "expression"),
+		       "p \"x\xc3\xa9\"");
+  assert_int (json_int_member (args, "lines", &seq), ==, SP_ERR);
+  assert_true (json_bool_member (args, "missing", true));
+
+  const JsonValue *lines = json_member (args, "lines");
+  assert_int (lines->kind, ==, JSON_ARRAY);
+  assert_int (lines->array.n_items, ==, 4);
+  assert_double (lines->array.items[1].number, ==, 2.5);
+  assert_true (lines->array.items[2].boolean);
+  assert_int (lines->array.items[3].kind, ==, JSON_NULL);
+  free_json (request);
+
+  assert_null (parse_json ("{\"seq\": 1,}"));
+  assert_null (parse_json ("[1] 2"));
+  assert_null (parse_json ("\"\\ud800\""));
+
+  return MUNIT_OK;
+}
+
+TEST (signal_policies_work)
+{
+  SignalTable *table = init_signal_table ();
+  assert_false (signal_policy (table, SIGALRM).stop);
+  assert_true (signal_policy (table, SIGALRM).pass);
+  assert_true (signal_policy (table, SIGSEGV).stop);
+  assert_false (signal_policy (table, SIGINT).pass);
+
+  SignalPolicy policy = signal_policy (table, SIGUSR1);
+  assert_int (update_signal_policy (&policy, "noprint"), ==, SP_OK);
+  assert_int (update_signal_policy (&policy, "ignore"), ==, SP_OK);
+  assert_int (update_signal_policy (&policy, "never"), ==, SP_ERR);
+  set_signal_policy (table, SIGUSR1, policy);
+  assert_false (signal_policy (table, SIGUSR1).stop);
+  assert_false (signal_policy (table, SIGUSR1).print);
+  assert_false (signal_policy (table, SIGUSR1).pass);
+
+  free_signal_table (table);
+
+  return MUNIT_OK;
+}
+
+/* Start a process that stands in for the fork of a checkpoint. */
+pid_t
+start_checkpoint_process (void)
+{
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      pause ();
+      _exit (EXIT_SUCCESS);
+    }
+  return pid;
+}
+
+TEST (recording_stops_works)
+{
+  Checkpoints *checkpoints = init_checkpoints ();
+  Stop first = {.movement = MOVE_CONTINUE,.pc = {0x401126},.is_breakpoint =
+      true };
+  Stop second = {.movement = MOVE_STEP,.pc = {0x40112a} };
+
+  assert_size (add_checkpoint (checkpoints, start_checkpoint_process ()),
+	       ==, 1);
+  assert_size (record_stop (checkpoints, first), ==, 0);
+  assert_size (add_checkpoint (checkpoints, start_checkpoint_process ()),
+	       ==, 2);
+  assert_size (record_stop (checkpoints, second), ==, 0);
+  assert_size (current_stop (checkpoints), ==, 2);
+  assert_ptr_equal (nearest_checkpoint (checkpoints, 0),
+		    get_checkpoint (checkpoints, 1));
+  assert_ptr_equal (nearest_checkpoint (checkpoints, 2),
+		    get_checkpoint (checkpoints, 2));
+
+  /* Replaying the same stops keeps everything. */
+  rewind_to_checkpoint (checkpoints, 1);
+  assert_size (current_stop (checkpoints), ==, 0);
+  assert_size (record_stop (checkpoints, first), ==, 0);
+  assert_ptr_not_null (recorded_stop (checkpoints, 1));
+
+  /* A different stop deletes what came after it. */
+  rewind_to_checkpoint (checkpoints, 1);
+  assert_size (record_stop (checkpoints, second), ==, 1);
+  assert_null (get_checkpoint (checkpoints, 2));
+  assert_null (recorded_stop (checkpoints, 1));
+  assert_size (current_stop (checkpoints), ==, 1);
+
+  free_checkpoints (checkpoints);
+
+  return MUNIT_OK;
+}
+
+/* Written by a fork of the test between two stops. */
+volatile int change_target = 0;
+
+TEST (tracking_changes_works)
+{
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      raise (SIGSTOP);
+      change_target = 42;
+      raise (SIGSTOP);
+      _exit (EXIT_SUCCESS);
+    }
+
+  int status = 0;
+  assert_int (waitpid (pid, &status, WUNTRACED), ==, pid);
+  ChangeTracker *tracker = init_change_tracker ();
+  assert_int (start_tracking_changes (tracker, pid), ==, SP_OK);
+
+  const MemoryChange *changes = NULL;
+  size_t n_changes = 0;
+  assert_int (find_changes (tracker, &changes, &n_changes), ==, SP_OK);
+  assert_size (n_changes, ==, 0);
+
+  assert_int (reset_changes (tracker), ==, SP_OK);
+  kill (pid, SIGCONT);
+  assert_int (waitpid (pid, &status, WUNTRACED), ==, pid);
+  assert_int (find_changes (tracker, &changes, &n_changes), ==, SP_OK);
+
+  uint64_t target = (uint64_t) &change_target;
+  const MemoryChange *found = NULL;
+  for (size_t i = 0; i < n_changes; i++)
+    {
+      if (changes[i].start.value <= target
+	  && target < changes[i].start.value + changes[i].n_bytes)
+	{
+	  found = &changes[i];
+	}
+    }
+  assert_ptr_not_null (found);
+  assert_int (found->kind, ==, MAPPING_FILE);
+  assert_ptr_not_null (found->old_bytes);
+  size_t offset = target - found->start.value;
+  assert_uint8 (found->old_bytes[offset], ==, 0);
+  assert_uint8 (found->new_bytes[offset], ==, 42);
+
+  free_change_tracker (tracker);
+  kill (pid, SIGKILL);
+  waitpid (pid, &status, 0);
+
+  return MUNIT_OK;
+}
+
 MunitTest debugger_tests[] = {
   REG_TEST (breakpoints_work),
+  REG_TEST (changing_breakpoints_works),
+  REG_TEST (parse_signal_works),
+  REG_TEST (parse_json_works),
+  REG_TEST (signal_policies_work),
+  REG_TEST (recording_stops_works),
+  REG_TEST (tracking_changes_works),
   REG_TEST (file_line_check_works),
   REG_TEST (function_name_check_works),
   REG_TEST (varloc_fbreg_works0),
@@ -3,8 +3,12 @@
 #include "test_utils.h"
 
 #define UNIT_TESTS
+#include "../src/debug_info.h"
+#include "../src/debug_line.h"
 #include "../src/info.h"
 #include "../src/spray_dwarf.h"
+#include "../src/stats.h"
+#include "../src/symbolize.h"
 
 #include <limits.h>
 #include <stdlib.h>
@@ -162,6 +166,109 @@ TEST (get_effective_function_start_works)
   return MUNIT_OK;
 }
 
+TEST (loading_debug_info_in_the_background_works)
+{
+  DebugInfo *info = load_debug_info (SIMPLE_64BIT_BIN);
+  assert_ptr_not_null (info);
+
+  /* Functions wait for the parts they need. */
+  const DebugSymbol *sym = sym_by_name ("main", info);
+  assert_ptr_not_null (sym);
+  dbg_addr main_start = { 0 };
+  assert_int (function_start_addr (sym, info, &main_start), ==, SP_OK);
+
+  double end_ms = 0;
+  for (InfoPart part = 0; part < N_INFO_PARTS; part++)
+    {
+      assert_int (await_debug_info (info, part), ==, SP_OK);
+      TimeSpan span = { 0 };
+      assert_int (info_load_time (info, part, &span), ==, SP_OK);
+      /* The parts are loaded one after the other. */
+      assert_double (span.start_ms, >=, end_ms);
+      assert_double (span.end_ms, >=, span.start_ms);
+      end_ms = span.end_ms;
+    }
+  assert_int (free_debug_info (&info), ==, SP_OK);
+
+  /* Parts fail to load if the file doesn't exist. */
+  info = load_debug_info ("does/not/exist");
+  assert_ptr_not_null (info);
+  assert_int (await_debug_info (info, INFO_ELF), ==, SP_ERR);
+  assert_int (await_debug_info (info, INFO_UNWIND), ==, SP_ERR);
+  TimeSpan span = { 0 };
+  assert_int (info_load_time (info, INFO_ELF, &span), ==, SP_ERR);
+  free_debug_info (&info);
+  assert_null (init_debug_info ("does/not/exist"));
+
+  return MUNIT_OK;
+}
+
+TEST (counting_lookups_works)
+{
+  DebugInfo *info = init_debug_info (SIMPLE_64BIT_BIN);
+  assert_ptr_not_null (info);
+  dbg_addr main_start = { 0 };
+  assert_int (function_start_addr (sym_by_name ("main", info), info,
+				   &main_start), ==, SP_OK);
+  /* Nothing is counted in the background after this. */
+  assert_int (await_debug_info (info, INFO_UNWIND), ==, SP_OK);
+
+  reset_stats ();
+  assert_ptr_not_null (sym_by_addr (main_start, info));
+  assert_ptr_not_null (sym_by_addr (main_start, info));
+  assert_uint64 (get_stat (STAT_SYMBOL_LOOKUPS), ==, 2);
+  assert_uint64 (get_stat (STAT_SYMBOL_CACHE_MISSES), ==, 1);
+  assert_uint64 (get_stat (STAT_SYMBOL_CACHE_HITS), ==, 1);
+
+  Dwarf_Error error = NULL;
+  Dwarf_Debug dbg = sd_dwarf_init (SIMPLE_64BIT_BIN, &error);
+  assert_ptr_not_null (dbg);
+  assert_true (sd_line_entry_from_pc (dbg, main_start).is_ok);
+  assert_uint64 (get_stat (STAT_LINE_TABLE_DECODES), >, 0);
+  assert_uint64 (get_stat (STAT_DIE_VISITS), >, 0);
+  dwarf_finish (dbg);
+
+  reset_stats ();
+  for (Stat stat = 0; stat < N_STATS; stat++)
+    {
+      assert_uint64 (get_stat (stat), ==, 0);
+    }
+
+  assert_int (free_debug_info (&info), ==, SP_OK);
+
+  return MUNIT_OK;
+}
+
+TEST (symbolizing_addrs_works)
+{
+  ElfFile elf;
+  assert_int (se_parse_elf (SIMPLE_64BIT_BIN, &elf), ==, ELF_PARSE_OK);
+  const Elf64_Sym *main_sym = se_symbol_from_name ("main", &elf);
+  assert_ptr_not_null (main_sym);
+  dbg_addr main_start = se_symbol_start_addr (main_sym);
+
+  Symbolizer *sym = init_symbolizer (SIMPLE_64BIT_BIN);
+  assert_ptr_not_null (sym);
+
+  char *out_buf = NULL;
+  size_t out_size = 0;
+  FILE *out = open_memstream (&out_buf, &out_size);
+  assert_ptr_not_null (out);
+  symbolize_addr (sym, main_start, true, out);
+  symbolize_addr (sym, (dbg_addr) {0}, true, out);
+  fclose (out);
+
+  assert_true (strncmp (out_buf, "main\n", 5) == 0);
+  assert_ptr_not_null (strstr (out_buf, "simple.c:9:"));
+  assert_ptr_not_null (strstr (out_buf, "\n\n??\n??:0:0\n\n"));
+
+  free (out_buf);
+  free_symbolizer (sym);
+  assert_int (se_free_elf (elf), ==, SP_OK);
+
+  return MUNIT_OK;
+}
+
 TEST (get_filepath_from_pc_works)
 {
   Dwarf_Error error = NULL;
@@ -202,6 +309,46 @@ TEST (sd_line_entry_at_works)
   return MUNIT_OK;
 }
 
+TEST (line_ranges_work)
+{
+  Dwarf_Error error = NULL;
+  Dwarf_Debug dbg = sd_dwarf_init (SIMPLE_64BIT_BIN, &error);
+  assert_ptr_not_null (dbg);
+  LineIndex *index = sd_init_line_index (dbg);
+  assert_ptr_not_null (index);
+
+  LineEntry line = sd_line_entry_at (dbg, SIMPLE_SRC, 4);
+  assert_true (line.is_ok);
+
+  /* The range ends where the code of the next line starts. */
+  dbg_addr start = { 0 };
+  dbg_addr end = { 0 };
+  assert_int (sd_line_range_from_pc (index, line.addr, &start, &end),
+	      ==, SP_OK);
+  assert_uint64 (start.value, <=, line.addr.value);
+  assert_uint64 (end.value, >, line.addr.value);
+  LineEntry next = sd_line_entry_from_pc (dbg, end);
+  assert_true (next.is_ok);
+  assert_int (next.ln, !=, 4);
+
+  /* Addresses in the range have the same range. */
+  dbg_addr in_range = {end.value - 1 };
+  dbg_addr same_start = { 0 };
+  dbg_addr same_end = { 0 };
+  assert_int (sd_line_range_from_pc (index, in_range, &same_start,
+				     &same_end), ==, SP_OK);
+  assert_uint64 (same_start.value, ==, start.value);
+  assert_uint64 (same_end.value, ==, end.value);
+
+  /* Addresses without code have no range. */
+  assert_int (sd_line_range_from_pc (index, (dbg_addr) {0}, &start, &end),
+	      ==, SP_ERR);
+
+  sd_free_line_index (index);
+  dwarf_finish (dbg);
+  return MUNIT_OK;
+}
+
 #define ASSERT_TYPE(name, pc, _type)                                           \
   {                                                                            \
     SdVarattr var_attr = {0};                                                  \
@@ -541,14 +688,377 @@ TEST(get_filepaths_works)
   return MUNIT_OK;
 }
 
+typedef struct
+{
+  LineEntry *rows;
+  size_t n_rows;
+} CollectedRows;
+
+SprayResult
+callback__collect_row (LineEntry *line, void *const data)
+{
+  CollectedRows *collected = (CollectedRows *) data;
+  collected->rows = realloc (collected->rows, sizeof (LineEntry)
+			     * (collected->n_rows + 1));
+  assert_ptr_not_null (collected->rows);
+  collected->rows[collected->n_rows++] = *line;
+  return SP_OK;
+}
+
+TEST (native_line_tables_match_libdwarf)
+{
+  const char *binaries[] = {
+    SIMPLE_64BIT_BIN,
+    NESTED_FUNCTIONS_BIN,
+    MULTI_FILE_BIN,
+    INCLUDE_VARIABLE_BIN,
+    TYPE_EXAMPLES_BIN,
+    MANY_FILES_BIN,
+  };
+
+  for (size_t i = 0; i < sizeof (binaries) / sizeof (*binaries); i++)
+    {
+      Dwarf_Error error = NULL;
+      Dwarf_Debug lib_dbg = sd_dwarf_init (binaries[i], &error);
+      Dwarf_Debug native_dbg = sd_dwarf_init (binaries[i], &error);
+      assert_ptr_not_null (lib_dbg);
+      assert_ptr_not_null (native_dbg);
+      ElfFile elf;
+      assert_int (se_parse_elf (binaries[i], &elf), ==, ELF_PARSE_OK);
+      assert_int (sd_set_sections (native_dbg, &elf), ==, SP_OK);
+
+      CollectedRows lib = { 0 };
+      CollectedRows native = { 0 };
+      assert_int (sd_for_each_row (lib_dbg, callback__collect_row, &lib),
+		  ==, SP_OK);
+      assert_int (sd_for_each_row (native_dbg, callback__collect_row,
+				   &native), ==, SP_OK);
+
+      assert_size (lib.n_rows, >, 0);
+      assert_size (native.n_rows, ==, lib.n_rows);
+      for (size_t j = 0; j < lib.n_rows; j++)
+	{
+	  const LineEntry *a = &lib.rows[j];
+	  const LineEntry *b = &native.rows[j];
+	  assert_uint64 (b->addr.value, ==, a->addr.value);
+	  assert_uint (b->ln, ==, a->ln);
+	  assert_uint (b->cl, ==, a->cl);
+	  assert_string_equal (b->filepath, a->filepath);
+	  assert_true (b->new_statement == a->new_statement);
+	  assert_true (b->prologue_end == a->prologue_end);
+	  assert_true (b->end_sequence == a->end_sequence);
+	}
+
+      free (lib.rows);
+      free (native.rows);
+      sd_clear_sections (native_dbg);
+      dwarf_finish (native_dbg);
+      dwarf_finish (lib_dbg);
+      assert_int (se_free_elf (elf), ==, SP_OK);
+    }
+
+  return MUNIT_OK;
+}
+
+TEST (decoding_line_programs_works)
+{
+  ElfFile elf;
+  assert_int (se_parse_elf (SIMPLE_64BIT_BIN, &elf), ==, ELF_PARSE_OK);
+  DlSections sections = { 0 };
+  assert_int (dl_sections (&elf, &sections), ==, SP_OK);
+
+  /* The program of the only unit starts at the beginning. */
+  DlLineTable table = { 0 };
+  assert_int (dl_decode_line_table (&sections, 0, "/comp/dir", NULL, NULL,
+				    &table), ==, SP_OK);
+  assert_size (table.n_rows, >, 0);
+  assert_true (table.rows[table.n_rows - 1].end_sequence);
+  for (size_t i = 0; i < table.n_rows; i++)
+    {
+      assert_true (table.rows[i].is_ok);
+      assert_not_null (table.rows[i].filepath);
+      assert_true (ends_with (table.rows[i].filepath, "simple.c"));
+    }
+  dl_free_line_table (&table);
+
+  /* Offsets past the end of the section are rejected. */
+  assert_int (dl_decode_line_table (&sections, sections.line.size, NULL,
+				    NULL, NULL, &table), ==, SP_ERR);
+  dl_free_line_table (&table);
+
+  assert_int (se_free_elf (elf), ==, SP_OK);
+  return MUNIT_OK;
+}
+
+typedef struct
+{
+  SdFunction *funcs;
+  size_t n_funcs;
+} CollectedFunctions;
+
+SprayResult
+callback__collect_function (const SdFunction *func, void *const data)
+{
+  CollectedFunctions *collected = (CollectedFunctions *) data;
+  collected->funcs = realloc (collected->funcs, sizeof (SdFunction)
+			      * (collected->n_funcs + 1));
+  assert_ptr_not_null (collected->funcs);
+  collected->funcs[collected->n_funcs++] = *func;
+  return SP_OK;
+}
+
+TEST (native_functions_match_libdwarf)
+{
+  const char *binaries[] = {
+    SIMPLE_64BIT_BIN,
+    NESTED_FUNCTIONS_BIN,
+    MULTI_FILE_BIN,
+    INCLUDE_VARIABLE_BIN,
+    TYPE_EXAMPLES_BIN,
+    MANY_FILES_BIN,
+    SPLIT_FUNCTIONS_BIN,
+  };
+
+  for (size_t i = 0; i < sizeof (binaries) / sizeof (*binaries); i++)
+    {
+      Dwarf_Error error = NULL;
+      Dwarf_Debug lib_dbg = sd_dwarf_init (binaries[i], &error);
+      Dwarf_Debug native_dbg = sd_dwarf_init (binaries[i], &error);
+      assert_ptr_not_null (lib_dbg);
+      assert_ptr_not_null (native_dbg);
+      ElfFile elf;
+      assert_int (se_parse_elf (binaries[i], &elf), ==, ELF_PARSE_OK);
+      assert_int (sd_set_sections (native_dbg, &elf), ==, SP_OK);
+
+      CollectedFunctions lib = { 0 };
+      CollectedFunctions native = { 0 };
+      assert_int (sd_for_each_function (lib_dbg, callback__collect_function,
+					&lib), ==, SP_OK);
+      assert_int (sd_for_each_function (native_dbg,
+					callback__collect_function,
+					&native), ==, SP_OK);
+
+      assert_size (lib.n_funcs, >, 0);
+      assert_size (native.n_funcs, ==, lib.n_funcs);
+      for (size_t j = 0; j < lib.n_funcs; j++)
+	{
+	  const SdFunction *a = &lib.funcs[j];
+	  const SdFunction *b = &native.funcs[j];
+	  assert_string_equal (b->name, a->name);
+	  assert_uint64 (b->low_pc.value, ==, a->low_pc.value);
+	  assert_uint64 (b->high_pc.value, ==, a->high_pc.value);
+	  assert_uint (b->level, ==, a->level);
+	  assert_true (b->is_inlined == a->is_inlined);
+	  if (a->call_file != NULL)
+	    {
+	      assert_string_equal (b->call_file, a->call_file);
+	    }
+	  else
+	    {
+	      assert_null (b->call_file);
+	    }
+	  assert_uint (b->call_line, ==, a->call_line);
+	  assert_uint (b->call_column, ==, a->call_column);
+	  assert_uint (b->range_idx, ==, a->range_idx);
+	}
+
+      free (lib.funcs);
+      free (native.funcs);
+      sd_clear_sections (native_dbg);
+      dwarf_finish (native_dbg);
+      dwarf_finish (lib_dbg);
+      assert_int (se_free_elf (elf), ==, SP_OK);
+    }
+
+  return MUNIT_OK;
+}
+
+typedef struct
+{
+  size_t n_dies;
+  const char *comp_dir;
+  DiDie main;
+  DiDie weird_sum;
+  DiDie local_c;
+} ScannedDies;
+
+SprayResult
+callback__scan_die (const DiUnit *unit, const DiDie *die, void *data)
+{
+  ScannedDies *scanned = (ScannedDies *) data;
+  scanned->n_dies++;
+  scanned->comp_dir = unit->comp_dir;
+
+  if (die->name == NULL)
+    {
+      return SP_OK;
+    }
+  else if (die->tag == DW_TAG_subprogram && str_eq (die->name, "main"))
+    {
+      scanned->main = *die;
+    }
+  else if (die->tag == DW_TAG_subprogram
+	   && str_eq (die->name, "weird_sum"))
+    {
+      scanned->weird_sum = *die;
+    }
+  else if (die->tag == DW_TAG_variable && str_eq (die->name, "c")
+	   && die->decl_line == 3)
+    {
+      scanned->local_c = *die;
+    }
+  return SP_OK;
+}
+
+TEST (scanning_dies_works)
+{
+  ElfFile elf;
+  assert_int (se_parse_elf (SIMPLE_64BIT_BIN, &elf), ==, ELF_PARSE_OK);
+  DiSections sections = { 0 };
+  assert_int (di_sections (&elf, &sections), ==, SP_OK);
+
+  ScannedDies scanned = { 0 };
+  assert_int (di_for_each_die (&sections, callback__scan_die, &scanned),
+	      ==, SP_OK);
+  assert_size (scanned.n_dies, >, 0);
+  assert_ptr_not_null (scanned.comp_dir);
+
+  assert_uint (scanned.main.level, ==, 1);
+  assert_true (scanned.main.has_pc);
+  assert_uint64 (scanned.main.low_pc.value, <, scanned.main.high_pc.value);
+  assert_uint64 (scanned.main.decl_line, ==, 9);
+  assert_uint64 (scanned.main.type, !=, 0);
+
+  assert_true (scanned.weird_sum.has_pc);
+  assert_uint64 (scanned.weird_sum.decl_line, ==, 1);
+  assert_uint64 (scanned.weird_sum.high_pc.value, <=,
+		 scanned.main.low_pc.value);
+
+  /* The local variable `c` of `weird_sum`. */
+  assert_uint (scanned.local_c.level, ==, 2);
+  assert_ptr_not_null (scanned.local_c.location);
+  assert_size (scanned.local_c.location_size, >, 0);
+  assert_uint64 (scanned.local_c.type, !=, 0);
+
+  assert_int (se_free_elf (elf), ==, SP_OK);
+  return MUNIT_OK;
+}
+
+TEST (scanning_split_functions_works)
+{
+  Dwarf_Error error = NULL;
+  Dwarf_Debug dbg = sd_dwarf_init (SPLIT_FUNCTIONS_BIN, &error);
+  assert_ptr_not_null (dbg);
+  ElfFile elf;
+  assert_int (se_parse_elf (SPLIT_FUNCTIONS_BIN, &elf), ==, ELF_PARSE_OK);
+  assert_int (sd_set_sections (dbg, &elf), ==, SP_OK);
+
+  CollectedFunctions collected = { 0 };
+  assert_int (sd_for_each_function (dbg, callback__collect_function,
+				    &collected), ==, SP_OK);
+
+  /* The cold part of `checked_sum` follows the hot one. */
+  size_t n_ranges = 0;
+  size_t n_inlines = 0;
+  for (size_t i = 0; i < collected.n_funcs; i++)
+    {
+      const SdFunction *func = &collected.funcs[i];
+      if (func->name == NULL)
+	{
+	  continue;
+	}
+      else if (str_eq (func->name, "checked_sum"))
+	{
+	  assert_uint (func->range_idx, ==, n_ranges);
+	  assert_uint64 (func->low_pc.value, <, func->high_pc.value);
+	  n_ranges++;
+	}
+      else if (str_eq (func->name, "square"))
+	{
+	  assert_true (func->is_inlined);
+	  assert_ptr_not_null (func->call_file);
+	  assert_uint (func->call_line, >, 0);
+	  n_inlines++;
+	}
+    }
+  assert_size (n_ranges, ==, 2);
+  assert_size (n_inlines, >, 0);
+
+  free (collected.funcs);
+  sd_clear_sections (dbg);
+  dwarf_finish (dbg);
+  assert_int (se_free_elf (elf), ==, SP_OK);
+  return MUNIT_OK;
+}
+
+TEST (symbolizing_split_functions_works)
+{
+  ElfFile elf;
+  assert_int (se_parse_elf (SPLIT_FUNCTIONS_BIN, &elf), ==, ELF_PARSE_OK);
+  const Elf64_Sym *cold_sym = se_symbol_from_name ("checked_sum.cold",
+						   &elf);
+  assert_ptr_not_null (cold_sym);
+  dbg_addr cold_start = se_symbol_start_addr (cold_sym);
+
+  /* The first instance of `square` that was inlined. */
+  Dwarf_Error error = NULL;
+  Dwarf_Debug dbg = sd_dwarf_init (SPLIT_FUNCTIONS_BIN, &error);
+  assert_ptr_not_null (dbg);
+  CollectedFunctions collected = { 0 };
+  assert_int (sd_for_each_function (dbg, callback__collect_function,
+				    &collected), ==, SP_OK);
+  dbg_addr square_start = { 0 };
+  for (size_t i = 0; i < collected.n_funcs && square_start.value == 0; i++)
+    {
+      const SdFunction *func = &collected.funcs[i];
+      if (func->is_inlined && func->name != NULL
+	  && str_eq (func->name, "square"))
+	{
+	  square_start = func->low_pc;
+	}
+    }
+  assert_uint64 (square_start.value, !=, 0);
+
+  Symbolizer *sym = init_symbolizer (SPLIT_FUNCTIONS_BIN);
+  assert_ptr_not_null (sym);
+
+  char *out_buf = NULL;
+  size_t out_size = 0;
+  FILE *out = open_memstream (&out_buf, &out_size);
+  assert_ptr_not_null (out);
+  symbolize_addr (sym, square_start, true, out);
+  symbolize_addr (sym, cold_start, true, out);
+  fclose (out);
+
+  /* The instance is found even though the range of `checked_sum`
+   * that contains it isn't the last one that was added. */
+  char *cold_frames = strstr (out_buf, "\n\n");
+  assert_ptr_not_null (cold_frames);
+  *cold_frames = '\0';
+  assert_true (strncmp (out_buf, "square\n", 7) == 0);
+  assert_ptr_not_null (strstr (out_buf, "\nchecked_sum\n"));
+  assert_ptr_not_null (strstr (cold_frames + 2, "checked_sum\n"));
+
+  free (out_buf);
+  free_symbolizer (sym);
+  free (collected.funcs);
+  dwarf_finish (dbg);
+  assert_int (se_free_elf (elf), ==, SP_OK);
+  return MUNIT_OK;
+}
+
 
 MunitTest dwarf_tests[] = {
   REG_TEST (get_line_entry_from_pc_works),
   REG_TEST (iterating_lines_works),
   REG_TEST (search_returns_the_correct_result),
   REG_TEST (get_effective_function_start_works),
+  REG_TEST (loading_debug_info_in_the_background_works),
+  REG_TEST (counting_lookups_works),
+  REG_TEST (symbolizing_addrs_works),
   REG_TEST (get_filepath_from_pc_works),
   REG_TEST (sd_line_entry_at_works),
+  REG_TEST (line_ranges_work),
   REG_TEST (finding_basic_variable_types_works),
   REG_TEST (finding_variable_locations_works),
   REG_TEST (finding_locations_by_scope_works),
@@ -557,5 +1067,11 @@ MunitTest dwarf_tests[] = {
   REG_TEST (validating_compilers_works),
   REG_TEST (type_attribute_form),
   REG_TEST (get_filepaths_works),
+  REG_TEST (native_line_tables_match_libdwarf),
+  REG_TEST (decoding_line_programs_works),
+  REG_TEST (native_functions_match_libdwarf),
+  REG_TEST (scanning_dies_works),
+  REG_TEST (scanning_split_functions_works),
+  REG_TEST (symbolizing_split_functions_works),
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
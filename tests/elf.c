@@ -3,6 +3,7 @@
 #include "test_utils.h"
 
 #include "../src/spray_elf.h"
+#include "../src/unwind.h"
 
 TEST (accept_valid_executable)
 {
@@ -100,9 +101,51 @@ TEST (reject_invalid_executables)
   return MUNIT_OK;
 }
 
+TEST (parse_call_frame_information)
+{
+  ElfFile elf_file = { 0 };
+  ElfParseResult res = se_parse_elf (NESTED_FUNCTIONS_BIN, &elf_file);
+  assert_int (res, ==, ELF_PARSE_OK);
+
+  UnwindTable *table = init_unwind_table (&elf_file);
+  assert_ptr_not_null (table);
+
+  /* Every function in the program has an FDE. */
+  const char *functions[] = { "add", "mul", "main" };
+  for (size_t i = 0; i < sizeof (functions) / sizeof (*functions); i++)
+    {
+      const Elf64_Sym *sym = se_symbol_from_name (functions[i], &elf_file);
+      assert_ptr_not_null (sym);
+      assert_true (has_unwind_row (table, se_symbol_start_addr (sym)));
+    }
+
+  assert_false (has_unwind_row (table, (dbg_addr) { 0 }));
+
+  free_unwind_table (table);
+  se_free_elf (elf_file);
+  return MUNIT_OK;
+}
+
+TEST (read_entry_point)
+{
+  ElfFile elf_file = { 0 };
+  ElfParseResult res = se_parse_elf (NESTED_FUNCTIONS_BIN, &elf_file);
+  assert_int (res, ==, ELF_PARSE_OK);
+
+  const Elf64_Sym *start = se_symbol_from_name ("_start", &elf_file);
+  assert_ptr_not_null (start);
+  assert_int (se_entry_point (&elf_file).value, ==,
+	      se_symbol_start_addr (start).value);
+
+  se_free_elf (elf_file);
+  return MUNIT_OK;
+}
+
 MunitTest parse_elf_tests[] = {
   REG_TEST (accept_valid_executable),
   REG_TEST (reject_invalid_executables),
   REG_TEST (read_elf_symbol_table_entries),
+  REG_TEST (parse_call_frame_information),
+  REG_TEST (read_entry_point),
   {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
 };
@@ -1,8 +1,16 @@
 from subprocess import Popen, PIPE, run
 from typing import Optional
+import json
 import re
 import string
 import random
+import time
+import os
+import pty
+import resource
+import select
+import socket
+import pytest
 
 DEBUGGER = 'build/spray'
 SIMPLE_64BIT_BIN = 'tests/assets/64bit-linux-simple.bin'
@@ -15,6 +23,15 @@ COMMENTED_BIN = 'tests/assets/commented.bin'
 CUSTOM_TYPES_BIN = 'tests/assets/custom-types.bin'
 TYPE_EXAMPLES_BIN = 'tests/assets/type-examples.bin'
 DEREF_POINTERS_BIN = 'tests/assets/deref_pointers.bin'
+LONG_LOOP_BIN = 'tests/assets/long-loop.bin'
+DEEP_RECURSION_BIN = 'tests/assets/deep-recursion.bin'
+THREADS_BIN = 'tests/assets/threads.bin'
+ATTACH_BIN = 'tests/assets/attach.bin'
+SIGNALS_BIN = 'tests/assets/signals.bin'
+CRASH_BIN = 'tests/assets/crash.bin'
+CHECKPOINTS_BIN = 'tests/assets/checkpoints.bin'
+CHANGES_BIN = 'tests/assets/changes.bin'
+BLOCK_STEP_BIN = 'tests/assets/block-step.bin'
 
 
 def random_string() -> str:
@@ -49,6 +66,35 @@ def assert_ends_with(cmd: str,
     assert match
 
 
+class Terminal:
+    """Spray running in a pseudo terminal, like in an interactive session."""
+
+    def __init__(self, debugee: str):
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            os.execv(DEBUGGER, [DEBUGGER, '--no-color', debugee])
+        self.output = ''
+
+    def expect(self, text: str, timeout: float = 10):
+        """Read the output until it contains `text`."""
+        deadline = time.monotonic() + timeout
+        while text not in self.output:
+            remaining = deadline - time.monotonic()
+            assert remaining > 0, self.output
+            ready, _, _ = select.select([self.fd], [], [], remaining)
+            if ready:
+                self.output += os.read(self.fd, 4096).decode('UTF-8')
+
+    def send(self, keys: str):
+        os.write(self.fd, keys.encode('UTF-8'))
+
+    def close(self):
+        # Ctrl-D leaves the REPL.
+        self.send('\x04')
+        os.waitpid(self.pid, 0)
+        os.close(self.fd)
+
+
 class TestStepCommands:
     def test_single_step(self):
         assert_lit('b 0x0040116b\nc\ns',
@@ -68,6 +114,14 @@ class TestStepCommands:
     6      return e;
 """)
 
+    def test_single_step_long_line(self):
+        # Line 3 runs thousands of instructions before line 4 is reached.
+        assert_ends_with('s\ns', """\
+    3      for (int i = 0; i < 1000; i++) acc += i;
+    4 ->   return acc == 499500 ? 0 : 1;
+    5    }
+""", LONG_LOOP_BIN)
+
     def test_leave(self):
         assert_ends_with('b 0x00401120\nc\nl', """\
    12 ->   int c = weird_sum(a, b);
@@ -106,6 +160,29 @@ class TestStepCommands:
 """, NESTED_FUNCTIONS_BIN)
 
 
+class TestBlockStep:
+    def current_lines(self, stdout):
+        lines = re.findall(r'^\s+(\d+) -> ', stdout, re.MULTILINE)
+        return [int(line) for line in lines]
+
+    # Without block stepping, `step` falls back to single steps.
+    @pytest.mark.parametrize('flags', [[], ['--no-block-step']])
+    def test_step_through_loop(self, flags):
+        # The body of the loop falls through to the increment on
+        # line 5, which the breakpoint at the end of line 6 catches.
+        stdout = run_cmd('s\n' * 8, BLOCK_STEP_BIN,
+                         ['--no-color'] + flags, [])
+        assert self.current_lines(stdout) == [4, 5, 6, 5, 6, 5, 6, 5, 8]
+
+    @pytest.mark.parametrize('flags', [[], ['--no-block-step']])
+    def test_step_over_call_without_lines(self, flags):
+        # `puts` has no line information, so the step
+        # runs until it returns and stops on line 9.
+        stdout = run_cmd('b tests/assets/block_step.c:8\nc\ns',
+                         BLOCK_STEP_BIN, ['--no-color'] + flags, [])
+        assert self.current_lines(stdout)[-2:] == [8, 9]
+
+
 class TestRegisterCommands:
     def test_register_read(self):
         assert_lit('p %rip',
@@ -384,6 +461,35 @@ class TestCLI:
         # `--no-color` is a valid flag but we didn't specify a binary.
         assert USAGE_MSG in self.output(['--no-color'])
 
+    def test_startup_timings(self):
+        stderr = run([DEBUGGER, '--startup-timings', SIMPLE_64BIT_BIN],
+                     input='', capture_output=True, text=True).stderr
+        assert 'Startup timings in ms:' in stderr
+        for phase in ['start the tracee', 'wait for the ELF file',
+                      'run to the symbol main', 'wait for DWARF',
+                      'print the source', 'parse the ELF file', 'load DWARF']:
+            assert phase in stderr
+        assert re.search(r'^Ready after \d+\.\d{3} ms$', stderr, re.MULTILINE)
+
+
+class TestCoverage:
+    def test_coverage_is_written(self, tmp_path):
+        out = tmp_path / 'out.info'
+        stdout = run([DEBUGGER, '--coverage', str(out), SIMPLE_64BIT_BIN],
+                     capture_output=True, text=True).stdout
+        assert 'Wrote coverage to' in stdout
+        lcov = out.read_text()
+        assert lcov.startswith('TN:\nSF:')
+        assert 'simple.c\n' in lcov
+        # Both the callee and the caller were executed.
+        assert 'DA:3,1\n' in lcov
+        assert 'DA:12,1\n' in lcov
+        assert lcov.endswith('end_of_record\n')
+
+    def test_coverage_requires_output(self):
+        assert USAGE_MSG in run([DEBUGGER, '--coverage'],
+                                capture_output=True, text=True).stderr
+
 
 class TestBacktrace:
     def test_basic_backtrace(self):
@@ -397,17 +503,758 @@ How did we even get here? (backtrace)
   0x000000000040113a add:4
 """, FRAME_POINTER_BIN)
 
-        assert_ends_with('b add\nc\na', """\
-WARN: it seems like this executable doesn't maintain a frame pointer.
-      This results in incorrect or incomplete backtraces.
-HINT: Try to compile again with `-fno-omit-frame-pointer`.
+    def test_backtrace_without_frame_pointer(self):
+        # The call frame information is used to unwind
+        # functions that don't maintain a frame pointer.
+        stdout = run_cmd('b add\nc\na', NO_FRAME_POINTER_BIN,
+                         ['--no-color'], [])
+        assert 'WARN' not in stdout
+        backtrace = stdout[stdout.index('(backtrace)'):].splitlines()[1:]
+        assert backtrace[0] == '  0x0000000000401065 _start'
+        assert backtrace[-3].endswith(' main:17')
+        assert backtrace[-2].endswith(' mul:11')
+        assert backtrace[-1] == '  0x0000000000401138 add:4'
 
-How did we even get here? (backtrace)
-  0x0000000000401065 _start
-  0x00007ffff7df4c4b <?>
-  0x0000000000401138 add:4
+    def test_deep_backtrace(self):
+        stdout = run_cmd('b bottom\nc\na', DEEP_RECURSION_BIN,
+                         ['--no-color'], [])
+        # One frame for each call of `recurse` including `recurse(0)`.
+        assert stdout.count(' recurse:') == 10001
+        assert ' main:12\n' in stdout
+        assert ' bottom:2\n' in stdout
+
+    def test_leave_without_frame_pointer(self):
+        assert_lit('b add\nc\nl', """\
+   10        for (int i = 0; i < b; i++) {
+   11 ->       acc = add(acc, a);
 """, NO_FRAME_POINTER_BIN)
 
+    def test_threads(self):
+        stdout = run_cmd('b worker\nc\nthreads', THREADS_BIN,
+                         ['--no-color'], [])
+        assert 'Switched to thread ' in stdout
+        lines = [line for line in stdout.split('\n') if ' Thread ' in line]
+        assert len(lines) >= 2
+        assert lines[0].startswith('  1 Thread ')
+        assert any(re.match(r'\* \d+ Thread \d+ 0x[0-9a-f]{16} worker:6$',
+                            line) for line in lines)
+
+    def test_switch_thread(self):
+        stdout = run_cmd('b worker\nc\nthread 1\nthreads', THREADS_BIN,
+                         ['--no-color'], [])
+        assert 'Switched to thread 1 (' in stdout
+        assert re.search(r'^\* 1 Thread ', stdout, re.MULTILINE)
+        assert_ends_with('thread 42', 'There is no thread 42', THREADS_BIN)
+
+
+class TestSignals:
+    def test_default_policies(self):
+        stdout = run_cmd('c\nc', SIGNALS_BIN, ['--no-color'], [])
+        # The many `SIGALRM`s are passed on without stopping.
+        assert 'ALRM' not in stdout
+        assert 'Child was stopped by SIGUSR1' in stdout
+        assert 'Child exited with code 0' in stdout
+
+    def test_nostop(self):
+        stdout = run_cmd('handle SIGUSR1 nostop noprint\nc', SIGNALS_BIN,
+                         ['--no-color'], [])
+        assert 'Child was stopped by' not in stdout
+        assert 'Child received' not in stdout
+        assert 'Child exited with code 0' in stdout
+        assert_lit('handle USR1 nostop\nc', 'Child received SIGUSR1',
+                   SIGNALS_BIN)
+
+    def test_ignore(self):
+        # The program counts the signals it received.
+        assert_lit('handle SIGUSR1 ignore\nc\nc', 'Child exited with code 1',
+                   SIGNALS_BIN)
+
+    def test_print_policy(self):
+        stdout = run_cmd('handle SIGALRM\nhandle 10 nopass', SIGNALS_BIN,
+                         ['--no-color'], [])
+        assert re.search(r'^SIGALRM +No +No +Yes$', stdout, re.MULTILINE)
+        assert re.search(r'^SIGUSR1 +Yes +Yes +No$', stdout, re.MULTILINE)
+
+    def test_handle_errors(self):
+        assert_lit('handle SIGFOO', 'Unknown signal SIGFOO', SIGNALS_BIN)
+        assert_lit('handle SIGUSR1 sometimes',
+                   "Unknown action sometimes for 'handle'", SIGNALS_BIN)
+        assert_lit('handle SIGTRAP nostop', 'SIGTRAP is used by the debugger',
+                   SIGNALS_BIN)
+
+
+def make_core(directory) -> str:
+    """Crash `CRASH_BIN` in `directory` and return the path to its core."""
+    def allow_core():
+        resource.setrlimit(resource.RLIMIT_CORE,
+                           (resource.RLIM_INFINITY, resource.RLIM_INFINITY))
+
+    run([os.path.abspath(CRASH_BIN)], cwd=directory, preexec_fn=allow_core)
+    cores = list(directory.glob('core*'))
+    if not cores:
+        pytest.skip('No core dump was written. See core_pattern in core(5)')
+    return str(cores[0])
+
+
+class TestCore:
+    def test_core_stop(self, tmp_path):
+        core = make_core(tmp_path)
+        stdout = run_cmd('threads', CRASH_BIN, ['--no-color', '--core', core], [])
+        assert 'Child was terminated by a segmentation fault' in stdout
+        assert '->   *pointer = answer;' in stdout
+        lines = [line for line in stdout.split('\n') if ' Thread ' in line]
+        assert len(lines) == 2
+        assert any(line.startswith('*') and line.endswith(' crash:7')
+                   for line in lines)
+
+    def test_core_inspect(self, tmp_path):
+        core = make_core(tmp_path)
+        stdout = run_cmd('p answer\nbacktrace', CRASH_BIN,
+                         ['--no-color', '--core', core], [])
+        assert re.search(r'^\s+7 \(tests/assets/crash.c:4\)$', stdout,
+                         re.MULTILINE)
+        backtrace = stdout[stdout.index('(backtrace)'):].splitlines()[1:]
+        assert backtrace[-2].endswith(' main:23')
+        assert backtrace[-1].endswith(' crash:7')
+
+    def test_core_is_read_only(self, tmp_path):
+        core = make_core(tmp_path)
+        for cmd in ['c', 'n', 'b crash', 't answer 1']:
+            stdout = run_cmd(cmd, CRASH_BIN, ['--no-color', '--core', core], [])
+            assert "A core dump can't be run or changed" in stdout
+
+    def test_dump_core(self, tmp_path):
+        core = str(tmp_path / 'dumped-core')
+        stdout = run_cmd(f'b crash\nc\ndump core {core}', CRASH_BIN,
+                         ['--no-color'], [])
+        assert f'to {core}' in stdout
+        stdout = run_cmd('p answer\nthreads', CRASH_BIN,
+                         ['--no-color', '--core', core], [])
+        assert re.search(r'^\s+7 \(tests/assets/crash.c:4\)$', stdout,
+                         re.MULTILINE)
+        lines = [line for line in stdout.split('\n') if ' Thread ' in line]
+        assert len(lines) == 2
+        assert any(line.startswith('*') and ' crash:' in line
+                   for line in lines)
+
+    def test_dump_core_errors(self, tmp_path):
+        stdout = run_cmd('b crash\nc\ndump core', CRASH_BIN,
+                         ['--no-color'], [])
+        assert "Missing file name for 'dump core'" in stdout
+        stdout = run_cmd(f'dump {tmp_path}/core', CRASH_BIN,
+                         ['--no-color'], [])
+        assert "Use 'dump core <file>'" in stdout
+
+
+class TestCheckpoints:
+    def counter(self, stdout):
+        values = re.findall(r'^\s+(\d+) \(tests/assets/checkpoints.c:1\)$',
+                            stdout, re.MULTILINE)
+        return [int(value) for value in values]
+
+    def test_restart(self):
+        stdout = run_cmd('checkpoint\nb tick\nc\nc\nc\np counter\n'
+                         'restart 1\nc\np counter\nrestart 1\nc\nc\n'
+                         'p counter\ncheckpoints', CHECKPOINTS_BIN,
+                         ['--no-color'], [])
+        assert 'Took checkpoint 1' in stdout
+        assert 'Restarted checkpoint 1' in stdout
+        # A checkpoint can be restarted as often as needed.
+        assert self.counter(stdout) == [2, 0, 1]
+        assert re.search(r'^1 Process \d+ at stop 0 .* main:8$', stdout,
+                         re.MULTILINE)
+
+    def test_reverse_step(self):
+        stdout = run_cmd('b tick\nc\ncheckpoint\nc\nc\nreverse-step\n'
+                         'p counter\nreverse-step\np counter\nc\np counter',
+                         CHECKPOINTS_BIN, ['--no-color'], [])
+        assert self.counter(stdout) == [1, 0, 1]
+
+    def test_reverse_continue(self):
+        stdout = run_cmd('b tick\ncheckpoint\nc\ni\ni\nreverse-continue\n'
+                         'p counter\nreverse-continue\np counter',
+                         CHECKPOINTS_BIN, ['--no-color'], [])
+        # The first one goes back to the breakpoint. There is no
+        # breakpoint before that, so the second one goes back to the
+        # checkpoint at the start of `main`.
+        assert self.counter(stdout) == [0, 0]
+        assert stdout.count('Hit breakpoint') == 2
+
+    def test_program_exit(self):
+        stdout = run_cmd('checkpoint\nc\nrestart 1\nb tick\nc\np counter',
+                         CHECKPOINTS_BIN, ['--no-color'], [])
+        assert 'Child exited with code 0' in stdout
+        assert self.counter(stdout) == [0]
+
+    def test_checkpoint_errors(self):
+        assert_lit('reverse-step', 'There is no earlier stop',
+                   CHECKPOINTS_BIN)
+        assert_lit('b tick\nc\nreverse-step',
+                   'There is no checkpoint to go back to', CHECKPOINTS_BIN)
+        assert_lit('restart 3', 'There is no checkpoint 3', CHECKPOINTS_BIN)
+        assert_lit('b worker\nc\ncheckpoint',
+                   'Checkpoints only work with single-threaded programs',
+                   THREADS_BIN)
+
+
+class TestChanges:
+    def test_changed(self):
+        stdout = run_cmd('changed\nn\nchanged\nn\nn\nchanged',
+                         CHANGES_BIN, ['--no-color'], [])
+        assert 'Tracking changes from now on' in stdout
+        assert re.search(r'^0x[0-9a-f]{16} count in main \(4 bytes\)$',
+                         stdout, re.MULTILINE)
+        # Stepping over `add` changed the global, the array on the heap
+        # and the stack of `add`, which isn't in use anymore.
+        after_add = stdout.split('numbers = malloc')[-1]
+        assert re.search(r'^0x[0-9a-f]{16} total \(4 bytes\)$', after_add,
+                         re.MULTILINE)
+        assert re.search(r'^0x[0-9a-f]{16} heap ', after_add, re.MULTILINE)
+        assert 'stack of returned calls' in after_add
+        assert 'untouched' not in stdout
+
+    def test_diff(self):
+        stdout = run_cmd('b add\nc\ndiff\nleave\ndiff', CHANGES_BIN,
+                         ['--no-color'], [])
+        assert re.search(r'total \(4 bytes\)\n  0 -> 14$', stdout,
+                         re.MULTILINE)
+
+    def test_nothing_changed(self):
+        assert_lit('changed\nchanged', 'Nothing changed since the last stop',
+                   CHANGES_BIN)
+
+
+class TestMonitor:
+    def test_monitor_global(self):
+        stdout = run_cmd('monitor ticks every 20\nc', ATTACH_BIN,
+                         ['--no-color'], [])
+        assert 'Monitor 1 samples ticks every 20 ms' in stdout
+        # The debugee never stops, but every change is seen.
+        assert re.search(r'^ticks = 1$', stdout, re.MULTILINE)
+        assert re.search(r'^ticks = 30$', stdout, re.MULTILINE)
+        assert 'Child exited with code 0' in stdout
+
+    def test_monitor_csv(self, tmp_path):
+        csv_filepath = tmp_path / 'ticks.csv'
+        stdout = run_cmd(f'monitor csv {csv_filepath}\n'
+                         'monitor ticks every 20\nc', ATTACH_BIN,
+                         ['--no-color'], [])
+        assert f'Logging all samples to {csv_filepath}' in stdout
+        lines = csv_filepath.read_text().splitlines()
+        assert lines[0] == 'time,monitor,name,address,value'
+        # Every sample is logged, not only the changes.
+        assert len(lines) > 30
+        assert re.match(r'^\d+\.\d{3},1,ticks,0x[0-9a-f]{16},0$', lines[1])
+        assert lines[-1].endswith(',30')
+
+    def test_monitor_only_globals(self):
+        assert_lit('monitor i every 10',
+                   'Failed to find a global variable called i', ATTACH_BIN)
+
+    def test_delete_monitor(self):
+        stdout = run_cmd('monitor ticks every 10\nmonitor 0x1000 every 5\n'
+                         'monitor delete 1\nmonitors', ATTACH_BIN,
+                         ['--no-color'], [])
+        assert 'Deleted monitor 1' in stdout
+        assert re.search(r'^2 0x0000000000001000 every 5 ms \(0 samples\)$',
+                         stdout, re.MULTILINE)
+
+
+class TestStats:
+    def test_stats_are_printed(self):
+        stdout = run_cmd('s\nstep\nstats\n', SIMPLE_64BIT_BIN,
+                         ['--no-color'], [])
+        assert re.search(r'^waitpid +[1-9]\d*$', stdout, re.MULTILINE)
+        assert re.search(r'^DIE visits +[1-9]\d*$', stdout, re.MULTILINE)
+        # Both forms of a command are timed together.
+        assert re.search(r'^step +2 +\d+\.\d{3} +\d+\.\d{3}$', stdout,
+                         re.MULTILINE)
+
+    def test_stats_are_reset(self):
+        stdout = run_cmd('step\nstats reset\nstats\n', SIMPLE_64BIT_BIN,
+                         ['--no-color'], [])
+        assert not re.search(r'^step ', stdout, re.MULTILINE)
+        # `stats reset` itself is timed after the reset.
+        assert re.search(r'^stats +1 ', stdout, re.MULTILINE)
+
+    def test_stats_are_printed_at_exit(self):
+        stderr = run([DEBUGGER, '--stats', SIMPLE_64BIT_BIN],
+                     input='step\n', capture_output=True, text=True).stderr
+        assert re.search(r'^ptrace GETREGS +[1-9]\d*$', stderr, re.MULTILINE)
+        assert re.search(r'^step +1 ', stderr, re.MULTILINE)
+
+    def test_internal_trace(self, tmp_path):
+        out = tmp_path / 'trace.json'
+        run([DEBUGGER, '--trace-internal', str(out), SIMPLE_64BIT_BIN],
+            input='next\n', capture_output=True, text=True)
+        events = json.loads(out.read_text())['traceEvents']
+        names = {event['name'] for event in events}
+        for name in ['next', 'wait', 'handle_stop', 'sd_get_line_table',
+                     'sd_search_dwarf_dbg', 'print_source']:
+            assert name in names
+        for event in events:
+            assert event['ph'] == 'X'
+            assert event['dur'] >= 0
+        # Everything else that `next` did is nested inside of it.
+        next_event = next(e for e in events if e['name'] == 'next')
+        assert next_event['cat'] == 'command'
+        assert any(e['name'] == 'handle_stop'
+                   and next_event['ts'] <= e['ts']
+                   < next_event['ts'] + next_event['dur'] for e in events)
+
+
+def run_script(script: str, debugee: str, flags: list[str], tmp_path) -> str:
+    script_filepath = tmp_path / 'commands.spray'
+    script_filepath.write_text(script)
+    result = run([DEBUGGER, '-x', str(script_filepath)] + flags + [debugee],
+                 stdout=PIPE, stderr=PIPE, stdin=PIPE)
+    return result.stdout.decode('UTF-8')
+
+
+class TestScript:
+    def test_script(self, tmp_path):
+        stdout = run_script('# Comments and empty lines are skipped.\n\n'
+                            'b add\nc\np total', CHANGES_BIN,
+                            ['--no-color'], tmp_path)
+        assert 'Hit breakpoint at address' in stdout
+        assert 'total' in stdout
+        assert 'Unknown command' not in stdout
+
+    def test_json(self, tmp_path):
+        stdout = run_script('b add\nc\np total\nfoo\nc', CHANGES_BIN,
+                            ['--json'], tmp_path)
+        objects = [json.loads(line) for line in stdout.splitlines()]
+        assert objects[0]['event'] == 'start'
+        assert objects[0]['ok']
+        assert objects[1]['event'] == 'stop'
+        assert objects[1]['function'] == 'main'
+        assert objects[2] == {'command': 'b add', 'output': [], 'errors': [],
+                              'warnings': [], 'hints': [], 'ok': True}
+        assert objects[3]['command'] == 'c'
+        assert objects[4]['event'] == 'stop'
+        assert objects[4]['function'] == 'add'
+        assert objects[4]['breakpoint']
+        assert objects[4]['file'].endswith('tests/assets/changes.c')
+        assert objects[5]['command'] == 'p total'
+        assert objects[5]['output'][0].strip().startswith('0 (')
+        assert objects[6]['errors'] == ['Unknown command']
+        assert not objects[6]['ok']
+        assert objects[-1] == {'event': 'exit', 'code': 0}
+
+    def test_json_needs_script(self):
+        result = run([DEBUGGER, '--json', CHANGES_BIN], stdout=PIPE,
+                     stderr=PIPE, stdin=PIPE)
+        assert result.returncode != 0
+        assert 'usage' in result.stderr.decode('UTF-8')
+
+
+class Dap:
+    """Spray talking to an editor over the Debug Adapter Protocol."""
+
+    def __init__(self, debugee: str):
+        self.process = Popen([DEBUGGER, '--dap', debugee],
+                             stdin=PIPE, stdout=PIPE, stderr=PIPE)
+        self.seq = 0
+        self.events = []
+
+    def read(self) -> dict:
+        length = None
+        while (line := self.process.stdout.readline().strip()) != b'':
+            name, value = line.split(b':', 1)
+            if name.lower() == b'content-length':
+                length = int(value)
+        return json.loads(self.process.stdout.read(length))
+
+    def request(self, command: str, **arguments) -> dict:
+        """Send a request and read everything up to its response."""
+        self.seq += 1
+        body = json.dumps({'seq': self.seq, 'type': 'request',
+                           'command': command,
+                           'arguments': arguments}).encode('UTF-8')
+        self.process.stdin.write(b'Content-Length: %d\r\n\r\n' % len(body)
+                                 + body)
+        self.process.stdin.flush()
+        while (message := self.read())['type'] != 'response':
+            self.events.append(message)
+        assert message['request_seq'] == self.seq
+        assert message['command'] == command
+        return message
+
+    def event(self, name: str) -> dict:
+        """Get the next event called `name`, skipping all others."""
+        while True:
+            message = self.events.pop(0) if self.events else self.read()
+            if message['type'] == 'event' and message['event'] == name:
+                return message
+
+    def start(self, **launch_arguments) -> dict:
+        response = self.request('initialize', adapterID='spray')
+        assert response['success']
+        assert response['body']['supportsConfigurationDoneRequest']
+        self.event('initialized')
+        assert self.request('launch', **launch_arguments)['success']
+        return response
+
+    def close(self):
+        assert self.request('disconnect')['success']
+        self.process.communicate(timeout=10)
+
+
+class TestDap:
+    def test_stop_at_breakpoint(self):
+        dap = Dap(FRAME_POINTER_BIN)
+        dap.start()
+        response = dap.request('setFunctionBreakpoints',
+                               breakpoints=[{'name': 'add'},
+                                            {'name': 'does_not_exist'}])
+        assert [b['verified'] for b in response['body']['breakpoints']] \
+            == [True, False]
+        dap.request('configurationDone')
+        stopped = dap.event('stopped')['body']
+        assert stopped['reason'] == 'breakpoint'
+
+        response = dap.request('threads')
+        assert [t['id'] for t in response['body']['threads']] \
+            == [stopped['threadId']]
+
+        response = dap.request('stackTrace', threadId=stopped['threadId'])
+        frames = response['body']['stackFrames']
+        assert [f['name'] for f in frames[:3]] == ['add', 'mul', 'main']
+        assert frames[0]['line'] == 4
+        assert frames[1]['line'] == 11
+        assert frames[2]['line'] == 17
+        assert frames[0]['source']['path'].endswith('nested_functions.c')
+        dap.close()
+
+    def test_variables_of_all_frames(self):
+        dap = Dap(FRAME_POINTER_BIN)
+        dap.start()
+        dap.request('setFunctionBreakpoints', breakpoints=[{'name': 'add'}])
+        dap.request('configurationDone')
+        thread_id = dap.event('stopped')['body']['threadId']
+        frames = dap.request('stackTrace', threadId=thread_id)['body']
+
+        # Editors ask for the variables of several frames at each stop.
+        values = []
+        for frame in frames['stackFrames'][:2]:
+            scopes = dap.request('scopes', frameId=frame['id'])['body']
+            assert [s['name'] for s in scopes['scopes']] \
+                == ['Locals', 'Registers']
+            locals_ref = scopes['scopes'][0]['variablesReference']
+            variables = dap.request('variables',
+                                    variablesReference=locals_ref)
+            values.append({v['name']: v['value']
+                           for v in variables['body']['variables']})
+        assert values[0]['a'] == '0'
+        assert values[0]['b'] == '9'
+        assert values[1]['a'] == '9'
+        assert values[1]['b'] == '3'
+        assert values[1]['acc'] == '0'
+
+        registers_ref = scopes['scopes'][1]['variablesReference']
+        registers = dap.request('variables',
+                                variablesReference=registers_ref)
+        names = [v['name'] for v in registers['body']['variables']]
+        assert 'rip' in names and 'rbp' in names
+        dap.close()
+
+    def test_step_and_exit(self):
+        dap = Dap(FRAME_POINTER_BIN)
+        dap.start(stopOnEntry=True)
+        dap.request('configurationDone')
+        thread_id = dap.event('stopped')['body']['threadId']
+        assert dap.request('next', threadId=thread_id)['success']
+        assert dap.event('stopped')['body']['reason'] == 'step'
+        frames = dap.request('stackTrace', threadId=thread_id)['body']
+        assert frames['stackFrames'][0]['line'] == 18
+
+        dap.request('continue', threadId=thread_id)
+        assert dap.event('exited')['body']['exitCode'] == 0
+        dap.event('terminated')
+        assert dap.request('threads')['body']['threads'] == []
+        assert not dap.request('next', threadId=thread_id)['success']
+        dap.close()
+
+    def test_source_breakpoints(self):
+        dap = Dap(FRAME_POINTER_BIN)
+        dap.start()
+        source = {'path': os.path.abspath('tests/assets/nested_functions.c')}
+        response = dap.request('setBreakpoints', source=source,
+                               breakpoints=[{'line': 13}, {'line': 1000}])
+        breakpoints = response['body']['breakpoints']
+        assert breakpoints[0]['verified']
+        assert not breakpoints[1]['verified']
+        dap.request('configurationDone')
+        thread_id = dap.event('stopped')['body']['threadId']
+        frames = dap.request('stackTrace', threadId=thread_id)['body']
+        assert frames['stackFrames'][0]['name'] == 'mul'
+        assert frames['stackFrames'][0]['line'] == 13
+        dap.close()
+
+    def test_evaluate(self):
+        dap = Dap(FRAME_POINTER_BIN)
+        dap.start(stopOnEntry=True)
+        dap.request('configurationDone')
+        dap.event('stopped')
+        response = dap.request('evaluate', expression='backtrace',
+                               context='repl')
+        assert ' main:17' in response['body']['result']
+        response = dap.request('evaluate', expression='foo', context='repl')
+        assert 'Unknown command' in response['body']['result']
+        dap.close()
+
+    def test_dap_conflicts_with_scripts(self):
+        result = run([DEBUGGER, '--dap', '-x', 'script', FRAME_POINTER_BIN],
+                     stdout=PIPE, stderr=PIPE, stdin=PIPE)
+        assert result.returncode != 0
+        assert 'usage' in result.stderr.decode('UTF-8')
+
+
+def symbol_addr(binary: str, name: str) -> int:
+    """Find the address of the symbol `name` in `binary` using nm(1)."""
+    nm = run(['nm', binary], stdout=PIPE, check=True).stdout.decode('UTF-8')
+    for line in nm.splitlines():
+        fields = line.split()
+        if fields[-1] == name:
+            return int(fields[0], 16)
+    raise KeyError(name)
+
+
+class GdbClient:
+    """A client of spray's server for GDB's remote protocol."""
+
+    def __init__(self, debugee: str, address: str = ':0'):
+        self.process = Popen([DEBUGGER, '--gdbserver', address, debugee],
+                             stdout=PIPE, stderr=PIPE)
+        while b'Listening on ' not in (line := self.process.stdout.readline()):
+            assert line != b''
+        address = line.split(b'Listening on ')[1].strip().decode('UTF-8')
+        if '/' in address:
+            self.socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.socket.connect(address)
+        else:
+            host, port = address.rsplit(':', 1)
+            self.socket = socket.create_connection((host, int(port)))
+        self.socket.settimeout(10)
+        self.buf = b''
+        self.acks = True
+
+    def read_byte(self) -> int:
+        if not self.buf:
+            self.buf = self.socket.recv(1 << 16)
+            assert self.buf != b''
+        byte = self.buf[0]
+        self.buf = self.buf[1:]
+        return byte
+
+    def read_packet(self) -> bytes:
+        while self.read_byte() != ord('$'):
+            pass
+        data = bytearray()
+        while (byte := self.read_byte()) != ord('#'):
+            data.append(byte)
+        checksum = int(bytes([self.read_byte(), self.read_byte()]), 16)
+        assert checksum == sum(data) % 256
+        if self.acks:
+            self.socket.sendall(b'+')
+        return re.sub(rb'}(.)', lambda m: bytes([m[1][0] ^ 0x20]),
+                      bytes(data), flags=re.DOTALL)
+
+    def send(self, packet: str) -> str:
+        data = packet.encode('UTF-8')
+        self.socket.sendall(b'$%s#%02x' % (data, sum(data) % 256))
+        if self.acks:
+            assert self.read_byte() == ord('+')
+        return self.read_packet().decode('UTF-8')
+
+    def start(self):
+        assert 'PacketSize=10000' in self.send('qSupported:swbreak+')
+        assert self.send('QStartNoAckMode') == 'OK'
+        self.acks = False
+
+    def register(self, number: int) -> int:
+        return int.from_bytes(bytes.fromhex(self.send('p%x' % number)),
+                              'little')
+
+    def close(self):
+        self.socket.close()
+        self.process.communicate(timeout=10)
+
+
+class TestGdbServer:
+    def test_registers_and_memory(self):
+        gdb = GdbClient(FRAME_POINTER_BIN)
+        gdb.start()
+        assert gdb.send('?').startswith('T05thread:')
+
+        registers = gdb.send('g')
+        # 24 general purpose registers, the x87 and SSE registers.
+        assert len(registers) == 2 * (17 * 8 + 7 * 4 + 8 * 10 + 8 * 4
+                                      + 16 * 16 + 4 + 3 * 8)
+        rip = int.from_bytes(bytes.fromhex(registers[16 * 16:17 * 16]),
+                             'little')
+        assert rip == gdb.register(16)
+
+        rsp = gdb.register(7)
+        old = gdb.send('m%x,8' % rsp)
+        assert len(old) == 16
+        assert gdb.send('M%x,3:aabbcc' % (rsp + 1)) == 'OK'
+        assert gdb.send('m%x,8' % rsp) == old[:2] + 'aabbcc' + old[8:]
+        assert gdb.send('M%x,8:%s' % (rsp, old)) == 'OK'
+
+        # Large reads are answered in a single packet.
+        page = symbol_addr(FRAME_POINTER_BIN, 'main') & ~0xfff
+        assert len(gdb.send('m%x,1000' % page)) == 2 * 0x1000
+        assert gdb.send('m0,8') == 'E14'
+
+        assert gdb.send('P0=2a00000000000000') == 'OK'
+        assert gdb.register(0) == 42
+        gdb.close()
+
+    def test_breakpoints(self):
+        gdb = GdbClient(FRAME_POINTER_BIN)
+        gdb.start()
+        add = symbol_addr(FRAME_POINTER_BIN, 'add')
+        code = gdb.send('m%x,8' % add)
+        assert gdb.send('Z0,%x,1' % add) == 'OK'
+        assert gdb.send('Z0,0,1') == 'E01'
+        assert gdb.send('Z1,%x,1' % add) == ''
+
+        stop = gdb.send('vCont;c')
+        assert stop.startswith('T05') and 'swbreak:;' in stop
+        assert gdb.register(16) == add
+        # The trap is hidden from the client.
+        assert gdb.send('m%x,8' % add) == code
+
+        assert gdb.send('z0,%x,1' % add) == 'OK'
+        assert gdb.send('vCont;s').startswith('T05')
+        assert gdb.register(16) != add
+        assert gdb.send('vCont;c') == 'W00'
+        gdb.close()
+
+    def test_target_description(self):
+        gdb = GdbClient(FRAME_POINTER_BIN)
+        gdb.start()
+        xml = gdb.send('qXfer:features:read:target.xml:0,ffff')
+        assert xml.startswith('l')
+        assert '<architecture>i386:x86-64</architecture>' in xml
+        assert 'name="xmm15"' in xml
+
+        # Parts are read until the last one starts with `l`.
+        parts = ''
+        while not (part := gdb.send('qXfer:features:read:target.xml:'
+                                    '%x,100' % len(parts))).startswith('l'):
+            assert part.startswith('m')
+            parts += part[1:]
+        assert 'l' + parts + part[1:] == xml
+        assert gdb.send('qXfer:features:read:other.xml:0,100') == ''
+        gdb.close()
+
+    def test_threads_and_interrupt(self, tmp_path):
+        gdb = GdbClient(ATTACH_BIN, str(tmp_path / 'spray.sock'))
+        gdb.start()
+        thread = gdb.send('qC')[2:]
+        assert gdb.send('qfThreadInfo') == 'm' + thread
+        assert gdb.send('qsThreadInfo') == 'l'
+        assert gdb.send('Hg' + thread) == 'OK'
+        assert gdb.send('T' + thread) == 'OK'
+
+        gdb.socket.sendall(b'$vCont;c#a8')
+        time.sleep(0.3)
+        gdb.socket.sendall(b'\x03')
+        assert gdb.read_packet() == b'T02thread:%s;' % thread.encode()
+        assert gdb.send('D') == 'OK'
+        gdb.close()
+
+    def test_gdbserver_conflicts_with_dap(self):
+        result = run([DEBUGGER, '--gdbserver', ':0', '--dap',
+                      FRAME_POINTER_BIN], stdout=PIPE, stderr=PIPE)
+        assert result.returncode != 0
+        assert 'usage' in result.stderr.decode('UTF-8')
+
+
+class TestSymbolize:
+    def symbolize(self, binary: str, addrs: list[str],
+                  flags: list[str] = []) -> list[list[str]]:
+        stdout = run([DEBUGGER, 'symbolize', binary] + flags,
+                     input='\n'.join(addrs) + '\n', capture_output=True,
+                     text=True, check=True).stdout
+        assert stdout.endswith('\n\n')
+        return [block.split('\n') for block in stdout[:-2].split('\n\n')]
+
+    def test_symbolize_function(self):
+        main = hex(symbol_addr(SIMPLE_64BIT_BIN, 'main'))
+        weird_sum = hex(symbol_addr(SIMPLE_64BIT_BIN, 'weird_sum'))
+        blocks = self.symbolize(SIMPLE_64BIT_BIN, [main, weird_sum])
+        assert len(blocks) == 2
+        assert blocks[0][0] == 'main'
+        assert re.fullmatch(r'.*simple\.c:9:\d+', blocks[0][1])
+        assert blocks[1][0] == 'weird_sum'
+        assert re.fullmatch(r'.*simple\.c:1:\d+', blocks[1][1])
+
+    def test_symbolize_unknown(self):
+        blocks = self.symbolize(SIMPLE_64BIT_BIN, ['0', 'not an address'],
+                                ['--inlines'])
+        assert blocks == [['??', '??:0:0'], ['??', '??:0:0']]
+
+    def test_symbolize_many(self):
+        # Enough addresses to be split up between threads.
+        main = hex(symbol_addr(SIMPLE_64BIT_BIN, 'main'))
+        weird_sum = hex(symbol_addr(SIMPLE_64BIT_BIN, 'weird_sum'))
+        blocks = self.symbolize(SIMPLE_64BIT_BIN, [main, weird_sum] * 5000)
+        assert len(blocks) == 10000
+        assert [block[0] for block in blocks] == ['main', 'weird_sum'] * 5000
+
+    def test_symbolize_requires_file(self):
+        assert USAGE_MSG in run([DEBUGGER, 'symbolize', '--inlines'],
+                                capture_output=True, text=True).stderr
+
+
+class TestAttach:
+    def test_attach_and_detach(self):
+        with Popen([ATTACH_BIN]) as debugee:
+            # Give the debugee time to allow being traced.
+            time.sleep(0.2)
+            stdout = run_cmd('b tick\nc', ATTACH_BIN,
+                             ['--no-color', '-p', str(debugee.pid)], [])
+            assert '->   ticks++;' in stdout
+            assert f'Detached from process {debugee.pid}' in stdout
+            # The breakpoint is gone and the debugee runs to completion.
+            assert debugee.wait(timeout=10) == 0
+
+    def test_attach_without_file(self):
+        with Popen([ATTACH_BIN]) as debugee:
+            time.sleep(0.2)
+            # The executable is found using the process id.
+            stdout = run_cmd('b tick\nc', str(debugee.pid),
+                             ['--no-color', '-p'], [])
+            assert '->   ticks++;' in stdout
+            assert debugee.wait(timeout=10) == 0
+
+
+class TestEventLoop:
+    def test_continue_in_background(self):
+        term = Terminal(ATTACH_BIN)
+        term.expect('spray> ')
+        # The prompt is back while the debugee is still running.
+        term.send('c\r')
+        term.send('p ticks\r')
+        term.expect("The process is running. Use 'interrupt' to stop it")
+        term.send('interrupt\r')
+        term.expect('Child was interrupted')
+        term.send('p ticks\r')
+        term.expect('(tests/assets/attach.c:4)')
+        term.close()
+
+    def test_stop_in_background(self):
+        term = Terminal(ATTACH_BIN)
+        term.expect('spray> ')
+        term.send('b tick\rc\r')
+        # The breakpoint is reported without typing anything.
+        term.expect('->   ticks++;')
+        term.close()
+
+
 class TestColors:
     def test_colored_comments(self):
         stdout = run_cmd('', COMMENTED_BIN, [], [])
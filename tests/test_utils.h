@@ -24,6 +24,7 @@
 #define WRONG_COMPILER_BIN "tests/assets/wrong-compiler.bin"
 #define TYPE_EXAMPLES_BIN "tests/assets/type-examples.bin"
 #define MANY_FILES_BIN "tests/assets/many-files.bin"
+#define SPLIT_FUNCTIONS_BIN "tests/assets/split-functions.bin"
 
 // Create a test
 #define TEST(name) \